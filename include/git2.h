@@ -18,6 +18,7 @@
 #include "git2/cherrypick.h"
 #include "git2/clone.h"
 #include "git2/commit.h"
+#include "git2/commit_graph.h"
 #include "git2/common.h"
 #include "git2/config.h"
 #include "git2/describe.h"
@@ -46,6 +47,7 @@
 #include "git2/refs.h"
 #include "git2/refspec.h"
 #include "git2/remote.h"
+#include "git2/repack.h"
 #include "git2/repository.h"
 #include "git2/reset.h"
 #include "git2/revert.h"
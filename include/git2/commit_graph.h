@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_commit_graph_h__
+#define INCLUDE_git_commit_graph_h__
+
+#include "common.h"
+#include "types.h"
+
+/**
+ * @file git2/commit_graph.h
+ * @brief Git commit-graph routines
+ * @defgroup git_commit_graph Git commit-graph routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Write the commit-graph file of a repository
+ *
+ * Every commit reachable from the references of the repository and
+ * from `HEAD` is written to `objects/info/commit-graph`, in the format
+ * git uses, together with its tree, parents, commit time and generation
+ * number.
+ *
+ * Each commit also gets a Bloom filter of the paths it changed
+ * compared to its first parent. Revision walks limited to some paths
+ * (see `git_revwalk_set_paths`) use these to skip the commits which
+ * certainly did not touch the paths, without loading their trees.
+ *
+ * Revision walkers read the file when they are created, and also use
+ * it to load commits and to sort them topologically without walking
+ * the whole history first. The file is a snapshot: commits created
+ * afterwards are walked as usual until the file is written again.
+ *
+ * @param repo the repository
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_commit_graph_write(git_repository *repo);
+
+/** @} */
+GIT_END_DECL
+#endif
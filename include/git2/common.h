@@ -147,6 +147,8 @@ typedef enum {
 	GIT_OPT_SET_TEMPLATE_PATH,
 	GIT_OPT_SET_SSL_CERT_LOCATIONS,
 	GIT_OPT_SET_USER_AGENT,
+	GIT_OPT_SET_CONNECTION_POOL,
+	GIT_OPT_SET_ODB_REFRESH_INTERVAL,
 } git_libgit2_opt_t;
 
 /**
@@ -245,6 +247,24 @@ typedef enum {
  *
  *	* opts(GIT_OPT_SET_USER_AGENT, const char *user_agent)
  *
+ *	* opts(GIT_OPT_SET_CONNECTION_POOL, int max_idle, int idle_timeout)
+ *
+ *		> Set how many idle HTTP connections are kept open so that
+ *		> later operations against the same scheme, host and port can
+ *		> reuse them, and for how many seconds an idle connection is
+ *		> kept.  Setting either to zero turns the reuse off.  The
+ *		> defaults are 8 connections and 30 seconds.
+ *
+ *	* opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, int msec)
+ *
+ *		> When an object isn't found, the object database reloads
+ *		> its backends (e.g. looks for new packfiles) and tries once
+ *		> more.  Set the minimum number of milliseconds between two
+ *		> such reloads, for workloads which look up many objects that
+ *		> don't exist.  Writing a pack through the object database
+ *		> always allows the next reload.  The default is 0, which
+ *		> reloads on every miss.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
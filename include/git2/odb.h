@@ -158,6 +158,41 @@ GIT_EXTERN(int) git_odb_read_header(size_t *len_out, git_otype *type_out, git_od
  */
 GIT_EXTERN(int) git_odb_exists(git_odb *db, const git_oid *id);
 
+/**
+ * Determine which of the given objects can be found in the object database.
+ *
+ * This gives the same answers as calling `git_odb_exists` for each of
+ * the objects, but the backends get to look them all up in one go.
+ *
+ * @param found array of `count` elements; each is set to 1 if the
+ *        object with the same index was found, or to 0 otherwise
+ * @param db database to be searched for the given objects.
+ * @param ids the objects to search for, sorted and without duplicates
+ * @param count the number of ids
+ * @return 0 on success, error code otherwise
+ */
+GIT_EXTERN(int) git_odb_exists_many(
+	int *found, git_odb *db, const git_oid *ids, size_t count);
+
+/**
+ * Read the headers of many objects at once.
+ *
+ * This gives the same answers as calling `git_odb_read_header` for each
+ * of the objects, but the backends get to look them all up in one go.
+ * An object which is not in the database does not make the call fail;
+ * its type is set to `GIT_OBJ_BAD` and its length to 0.
+ *
+ * @param len_out array of `count` elements for the lengths
+ * @param type_out array of `count` elements for the types
+ * @param db database to search for the objects in.
+ * @param ids the objects to read, sorted and without duplicates
+ * @param count the number of ids
+ * @return 0 on success, error code otherwise
+ */
+GIT_EXTERN(int) git_odb_read_header_many(
+	size_t *len_out, git_otype *type_out, git_odb *db,
+	const git_oid *ids, size_t count);
+
 /**
  * Determine if objects can be found in the object database from a short OID.
  *
@@ -191,6 +226,21 @@ GIT_EXTERN(int) git_odb_exists_prefix(
  */
 GIT_EXTERN(int) git_odb_refresh(struct git_odb *db);
 
+/**
+ * Make sure the given objects are available
+ *
+ * Objects which aren't in the database yet are handed in a single
+ * batch to the backends which can fetch missing objects, such as the
+ * one of a promisor remote in a partial clone. Reading them afterwards
+ * doesn't need one request per object.
+ *
+ * @param db database to use
+ * @param ids the ids of the objects which are about to be read
+ * @param count the number of ids
+ * @return 0 on success, error code otherwise
+ */
+GIT_EXTERN(int) git_odb_prefetch(git_odb *db, const git_oid *ids, size_t count);
+
 /**
  * List all objects available in the database
  *
@@ -296,6 +346,8 @@ GIT_EXTERN(void) git_odb_stream_free(git_odb_stream *stream);
  *
  * Note that most backends do *not* support streaming reads
  * because they store their objects as compressed/delta'ed blobs.
+ * The packfile backend does, including for deltified objects, in
+ * which case only the deltas are kept in memory.
  *
  * It's recommended to use `git_odb_read` instead, which is
  * assured to work on all backends.
@@ -303,10 +355,15 @@ GIT_EXTERN(void) git_odb_stream_free(git_odb_stream *stream);
  * The returned stream will be of type `GIT_STREAM_RDONLY` and
  * will have the following methods:
  *
- *		- stream->read: read `n` bytes from the stream
+ *		- stream->read: read `n` bytes from the stream; returns the
+ *		  number of bytes read, 0 at the end of the object or an
+ *		  error code
  *		- stream->free: free the stream
  *
- * The stream must always be free'd or will leak memory.
+ * The stream's `declared_size` holds the size of the object.
+ *
+ * The stream must always be free'd, before the object database it
+ * was opened from, or will leak memory.
  *
  * @see git_odb_stream
  *
@@ -341,6 +398,64 @@ GIT_EXTERN(int) git_odb_write_pack(
 	git_transfer_progress_cb progress_cb,
 	void *progress_payload);
 
+/**
+ * Start a batch of object writes
+ *
+ * Objects written through the batch are compressed into a temporary
+ * file and stored as a single packfile (and its index) when the batch
+ * is committed, instead of creating one loose file per object. The
+ * temporary file lives next to the packs of the repository owning the
+ * database, or in the system's temporary directory.
+ * This makes bulk imports much cheaper. Nothing is visible in the
+ * object database before `git_odb_batch_commit` is called; freeing
+ * an uncommitted batch discards its objects.
+ *
+ * If none of the backends of the database can store a pack, objects
+ * are written through `git_odb_write` immediately instead.
+ *
+ * @param out pointer where to store the batch
+ * @param db object database the objects will be written to
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_batch_new(git_odb_batch **out, git_odb *db);
+
+/**
+ * Add an object to a batch
+ *
+ * Objects which already exist in the database, or were already added
+ * to the batch, are skipped.
+ *
+ * @param out pointer to store the OID of the object
+ * @param batch the batch to add the object to
+ * @param data buffer with the data to store
+ * @param len size of the buffer
+ * @param type type of the data to store
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_batch_write(
+	git_oid *out,
+	git_odb_batch *batch,
+	const void *data,
+	size_t len,
+	git_otype type);
+
+/**
+ * Store the objects of a batch in the object database
+ *
+ * The batch is emptied and can be used again afterwards.
+ *
+ * @param batch the batch to commit
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_batch_commit(git_odb_batch *batch);
+
+/**
+ * Free a batch, discarding any object which was not committed
+ *
+ * @param batch the batch to free
+ */
+GIT_EXTERN(void) git_odb_batch_free(git_odb_batch *batch);
+
 /**
  * Determine the object-ID (sha1 hash) of a data buffer
  *
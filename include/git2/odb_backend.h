@@ -66,6 +66,42 @@ GIT_EXTERN(int) git_odb_backend_loose(
  */
 GIT_EXTERN(int) git_odb_backend_one_pack(git_odb_backend **out, const char *index_file);
 
+/**
+ * Create a backend for the objects promised by a remote
+ *
+ * The objects a partial clone left out are fetched from the given
+ * remote when they are read and no other backend has them. It is set
+ * up automatically for the remotes marked with `remote.<name>.promisor`
+ * in the configuration of a repository.
+ *
+ * The backend never reports objects as existing before they have been
+ * fetched; use `git_odb_prefetch()` to fetch many objects at once.
+ *
+ * @param out location to store the odb backend pointer
+ * @param repo the repository the objects are fetched into; only its
+ *        path is kept, so the backend may outlive it
+ * @param remote_name the name of the remote to fetch from
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_backend_promisor(
+	git_odb_backend **out, git_repository *repo, const char *remote_name);
+
+/**
+ * Set the callbacks the promisor backends fetch missing objects with
+ *
+ * These answer the requests for credentials and certificate checks of
+ * the fetches, and see their progress. The callbacks are copied; set
+ * them before reading any object which may have to be fetched.
+ *
+ * @param odb the database whose promisor backends use the callbacks
+ * @param callbacks the callbacks, or NULL to reset them
+ *
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_set_promisor_callbacks(
+	git_odb *odb, const git_remote_callbacks *callbacks);
+
 /** Streaming mode */
 typedef enum {
 	GIT_STREAM_RDONLY = (1 << 1),
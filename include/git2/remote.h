@@ -370,6 +370,9 @@ typedef int (*git_push_negotiation)(const git_push_update **updates, size_t len,
  *
  * Set the callbacks to be called by the remote when informing the user
  * about the progress of the network operations.
+ *
+ * The callbacks are called on the thread which started the operation,
+ * even while the pack is received on a thread of its own.
  */
 struct git_remote_callbacks {
 	unsigned int version;
@@ -512,6 +515,30 @@ typedef enum {
 	GIT_REMOTE_DOWNLOAD_TAGS_ALL,
 } git_remote_autotag_option_t;
 
+/**
+ * Negotiation algorithm used to tell the server which commits we have
+ */
+typedef enum {
+	/**
+	 * Use the setting from the configuration ("fetch.negotiationAlgorithm").
+	 */
+	GIT_FETCH_NEGOTIATION_UNSPECIFIED = 0,
+	/**
+	 * Offer every commit, walking back from the local references.
+	 */
+	GIT_FETCH_NEGOTIATION_CONSECUTIVE,
+	/**
+	 * Skip over exponentially growing stretches of history while
+	 * walking back, which takes far fewer round trips when the local
+	 * history has diverged a lot from the remote's.
+	 */
+	GIT_FETCH_NEGOTIATION_SKIPPING,
+	/**
+	 * Don't offer any commit; the server sends the complete history.
+	 */
+	GIT_FETCH_NEGOTIATION_NOOP,
+} git_fetch_negotiation_t;
+
 /**
  * Fetch options structure.
  *
@@ -552,8 +579,45 @@ typedef struct {
 	 * Extra headers for this fetch operation
 	 */
 	git_strarray custom_headers;
+
+	/**
+	 * Depth of the history to fetch. When set, only this many commits
+	 * are fetched down from each of the fetched references and the
+	 * repository becomes shallow. `GIT_FETCH_DEPTH_UNSHALLOW` fetches
+	 * the missing history of a shallow repository. The default,
+	 * `GIT_FETCH_DEPTH_FULL`, does not change the depth.
+	 */
+	int depth;
+
+	/**
+	 * Only fetch the history more recent than this time (in seconds
+	 * since the epoch), making the repository shallow at the older
+	 * commits. Zero disables it; it cannot be combined with `depth`.
+	 */
+	git_time_t shallow_since;
+
+	/**
+	 * Object filter for a partial clone, such as "blob:none",
+	 * "blob:limit=1m" or "tree:0". The objects left out are fetched
+	 * from the remote, which is recorded as a promisor remote, when
+	 * they are read. NULL fetches every object.
+	 */
+	const char *filter;
+
+	/**
+	 * How to tell the server which commits we already have. The
+	 * default is to use the configuration and fall back to offering
+	 * every commit.
+	 */
+	git_fetch_negotiation_t negotiation;
 } git_fetch_options;
 
+/** Fetch the full history (or keep the current depth) */
+#define GIT_FETCH_DEPTH_FULL 0
+
+/** Fetch the missing history of a shallow repository */
+#define GIT_FETCH_DEPTH_UNSHALLOW 2147483647
+
 #define GIT_FETCH_OPTIONS_VERSION 1
 #define GIT_FETCH_OPTIONS_INIT { GIT_FETCH_OPTIONS_VERSION, GIT_REMOTE_CALLBACKS_INIT, GIT_FETCH_PRUNE_UNSPECIFIED, 1 }
 
@@ -596,6 +660,18 @@ typedef struct {
 	 * Extra headers for this push operation
 	 */
 	git_strarray custom_headers;
+
+	/**
+	 * Ask the server to update either all of the references or none
+	 * of them.  The push fails if the server cannot do that.
+	 */
+	int atomic;
+
+	/**
+	 * "Push options" to deliver to the server's hooks.  The push fails
+	 * if there are any and the server does not accept them.
+	 */
+	git_strarray remote_push_options;
 } git_push_options;
 
 #define GIT_PUSH_OPTIONS_VERSION 1
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_git_repack_h__
+#define INCLUDE_git_repack_h__
+
+#include "common.h"
+#include "types.h"
+#include "indexer.h"
+
+/**
+ * @file git2/repack.h
+ * @brief Git pack maintenance routines
+ * @defgroup git_repack Git pack maintenance routines
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Flags controlling which objects take part in a repack
+ */
+typedef enum {
+	GIT_REPACK_DEFAULT = 0,
+
+	/**
+	 * Also pack the loose objects of the repository and remove the
+	 * loose copies once the new pack has been written.
+	 */
+	GIT_REPACK_LOOSE = (1u << 0),
+
+	/**
+	 * After repacking, write a `multi-pack-index` file covering every
+	 * pack in the repository.
+	 */
+	GIT_REPACK_WRITE_MIDX = (1u << 1),
+} git_repack_flag_t;
+
+/**
+ * Repack options structure
+ *
+ * Initialize with `GIT_REPACK_OPTIONS_INIT` macro to correctly set
+ * the `version` field.  E.g.
+ *
+ *		git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+ */
+typedef struct git_repack_options {
+	unsigned int version;
+
+	/** combination of `git_repack_flag_t` values */
+	unsigned int flags;
+
+	/**
+	 * The geometric factor the packs must follow. Sorted by their
+	 * number of objects, every pack which is kept must hold at least
+	 * `factor` times as many objects as all the smaller packs together;
+	 * the packs breaking this progression are merged into a new one.
+	 * Packs with a `.keep` file are never touched. Defaults to 2.
+	 */
+	unsigned int factor;
+
+	/** progress callback while the new pack is indexed */
+	git_transfer_progress_cb progress_cb;
+	void *progress_payload;
+} git_repack_options;
+
+#define GIT_REPACK_DEFAULT_FACTOR 2
+
+#define GIT_REPACK_OPTIONS_VERSION 1
+#define GIT_REPACK_OPTIONS_INIT { \
+	GIT_REPACK_OPTIONS_VERSION, \
+	GIT_REPACK_DEFAULT, \
+	GIT_REPACK_DEFAULT_FACTOR, \
+}
+
+/**
+ * Initializes a `git_repack_options` with default values. Equivalent to
+ * creating an instance with GIT_REPACK_OPTIONS_INIT.
+ *
+ * @param opts the `git_repack_options` struct to initialize
+ * @param version Version of struct; pass `GIT_REPACK_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_repack_init_options(
+	git_repack_options *opts,
+	unsigned int version);
+
+/**
+ * Consolidate the packfiles of a repository geometrically
+ *
+ * The packs in `objects/pack` are sorted by their number of objects
+ * and the smallest ones are rolled up into a single new pack until
+ * the remaining packs form a geometric progression (see the `factor`
+ * option). Large packs are left untouched, so the cost of a repack
+ * stays proportional to the amount of recently written data.
+ *
+ * The packs which were rolled up are deleted and the object database
+ * of the repository is refreshed, so lookups only consider the packs
+ * which are left on disk.
+ *
+ * @param repo the repository to repack
+ * @param opts options for the repack, or NULL for defaults
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_repack(
+	git_repository *repo,
+	const git_repack_options *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -10,6 +10,8 @@
 #include "common.h"
 #include "types.h"
 #include "oid.h"
+#include "strarray.h"
+#include "oidarray.h"
 
 /**
  * @file git2/revwalk.h
@@ -207,7 +209,9 @@ GIT_EXTERN(int) git_revwalk_hide_ref(git_revwalk *walk, const char *refname);
  * Iterating with Topological or inverted modes makes the initial
  * call blocking to preprocess the commit list, but this block should be
  * mostly unnoticeable on most repositories (topological preprocessing
- * times at 0.3s on the git.git repo).
+ * times at 0.3s on the git.git repo). When the repository has a
+ * commit-graph (see `git_commit_graph_write`), a topological walk which
+ * is not inverted only looks at the history as deep as it needs to.
  *
  * The revision walker is reset when the walk is over.
  *
@@ -251,6 +255,67 @@ GIT_EXTERN(int) git_revwalk_push_range(git_revwalk *walk, const char *range);
  */
 GIT_EXTERN(void) git_revwalk_simplify_first_parent(git_revwalk *walk);
 
+/**
+ * Limit the walk to the commits which changed some paths
+ *
+ * Only the commits where one of the paths differs from each of their
+ * parents are returned; a root commit is returned if one of the paths
+ * exists in it. The other commits are still walked through, so the
+ * order of the ones returned follows the sorting mode as usual.
+ *
+ * The paths are literal paths relative to the root of the repository,
+ * each naming a file or a directory. When the repository has a
+ * commit-graph with changed-path filters (see `git_commit_graph_write`),
+ * the commits which certainly did not touch the paths are skipped
+ * without looking at their trees.
+ *
+ * The paths are kept when the walker is reset.
+ *
+ * @param walk the revision walker
+ * @param paths the paths to limit the walk to, or NULL to walk every
+ *        commit again
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_revwalk_set_paths(
+	git_revwalk *walk, const git_strarray *paths);
+
+/**
+ * Simplify the history of a walk limited to some paths
+ *
+ * When a commit has the same content at the paths as one of its
+ * parents, only that parent is walked: the other lines of history it
+ * merged did not contribute to the paths. This is the history `git log`
+ * shows for some paths by default.
+ *
+ * Like `git_revwalk_simplify_first_parent`, this lasts until the walker
+ * is reset. It has no effect on walks which are not limited to paths.
+ *
+ * @param walk the revision walker
+ */
+GIT_EXTERN(void) git_revwalk_simplify_history(git_revwalk *walk);
+
+/**
+ * Get the parents of a commit as seen by a path-limited walk
+ *
+ * The parents of the commit which the walk goes through are rewritten
+ * to their closest ancestors which the walk returns, skipping the
+ * commits which did not change the paths. Commits hidden from the walk
+ * are kept as they are, and a line of history which ends without
+ * touching the paths is dropped. Without paths, these are the parents
+ * the walk goes through.
+ *
+ * This is meant to be called on the commits returned by
+ * `git_revwalk_next` before the walk is over.
+ *
+ * @param out the rewritten parents; free with `git_oidarray_free`
+ * @param walk the revision walker
+ * @param commit_id a commit returned by the walk
+ * @return 0, GIT_ENOTFOUND if the walk has not seen the commit, or an
+ *         error code
+ */
+GIT_EXTERN(int) git_revwalk_rewritten_parents(
+	git_oidarray *out, git_revwalk *walk, const git_oid *commit_id);
+
 
 /**
  * Free a revision walker previously allocated.
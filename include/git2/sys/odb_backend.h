@@ -88,6 +88,36 @@ struct git_odb_backend {
 	 * itself). An odb backend implementation must provide this function.
 	 */
 	void (* free)(git_odb_backend *);
+
+	/**
+	 * Backends which can fetch objects missing from the object database
+	 * (such as the one for a promisor remote) should expose it through
+	 * this endpoint; `git_odb_prefetch()` calls it with the list of
+	 * missing objects, so they can be fetched in a single batch.
+	 */
+	int (* prefetch)(
+		git_odb_backend *, const git_oid *ids, size_t count);
+
+	/**
+	 * Look up many objects at once. The `count` ids are sorted and
+	 * without duplicates; `found[i]` has to be set to 1 for each object
+	 * the backend has and to 0 for the others. Backends which can
+	 * answer a whole batch cheaper than one object at a time (by merging
+	 * against a sorted index, or in a single round trip) should
+	 * implement this; otherwise `exists()` is called for each object.
+	 */
+	int (* exists_many)(
+		int *found, git_odb_backend *, const git_oid *ids, size_t count);
+
+	/**
+	 * Read the headers of many objects at once, under the same rules
+	 * as `exists_many()`. The type of each object the backend does not
+	 * have has to be set to `GIT_OBJ_BAD`. When this is NULL,
+	 * `read_header()` is called for each object.
+	 */
+	int (* read_header_many)(
+		size_t *len, git_otype *type, git_odb_backend *,
+		const git_oid *ids, size_t count);
 };
 
 #define GIT_ODB_BACKEND_VERSION 1
@@ -167,6 +167,18 @@ struct git_refdb_backend {
 	 */
 	int (*unlock)(git_refdb_backend *backend, void *payload, int success, int update_reflog,
 		      const git_reference *ref, const git_signature *sig, const char *message);
+
+	/**
+	 * Read only the most recent entries of the reflog for the given
+	 * reference name, at least `count` of them if the log has that
+	 * many.  The entries are in the same order as `reflog_read` gives
+	 * them.
+	 *
+	 * A backend implementing this does not have to go through the
+	 * whole log.  This function is optional; when it is NULL, the full
+	 * log is read instead.
+	 */
+	int (*reflog_read_recent)(git_reflog **out, git_refdb_backend *backend, const char *name, size_t count);
 };
 
 #define GIT_REFDB_BACKEND_VERSION 1
@@ -199,6 +211,23 @@ GIT_EXTERN(int) git_refdb_backend_fs(
 	git_refdb_backend **backend_out,
 	git_repository *repo);
 
+/**
+ * Constructor for the reftable refdb backend
+ *
+ * This keeps references and their logs in a stack of binary tables
+ * under `reftable/` in the repository's directory, the way git does
+ * when `extensions.refStorage` is set to "reftable".  It is used for
+ * you when a repository is opened with that setting; use this to put
+ * one in place yourself.
+ *
+ * @param backend_out Output pointer to the git_refdb_backend object
+ * @param repo Git repository to access
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo);
+
 /**
  * Sets the custom backend to an existing reference DB
  *
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_server_h__
+#define INCLUDE_sys_git_server_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/oid.h"
+
+/**
+ * @file git2/sys/server.h
+ * @brief Server side of the git smart protocol
+ * @defgroup git_server Server side of the git smart protocol
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * Read the client's side of the conversation.
+ *
+ * Fill `buffer` with up to `len` bytes and set `bytes_read` to how many
+ * were read; zero bytes means the client closed the connection (or,
+ * for a stateless request, that the request body is over).
+ *
+ * @return 0 on success, an error code otherwise
+ */
+typedef int (*git_server_read_cb)(
+	char *buffer, size_t len, size_t *bytes_read, void *payload);
+
+/**
+ * Send the server's side of the conversation to the client.
+ *
+ * @return 0 on success, an error code otherwise
+ */
+typedef int (*git_server_write_cb)(
+	const char *buffer, size_t len, void *payload);
+
+/**
+ * Options for serving a fetch with `git_upload_pack`
+ */
+typedef struct {
+	unsigned int version;
+
+	/** Reads the client's requests */
+	git_server_read_cb read;
+
+	/** Writes the responses */
+	git_server_write_cb write;
+
+	/** Payload passed to the read and write callbacks */
+	void *payload;
+
+	/**
+	 * Serve a single request of a stateless protocol such as smart
+	 * HTTP: the reference advertisement and each round of the
+	 * negotiation come in requests of their own.
+	 */
+	int stateless_rpc;
+
+	/**
+	 * Only advertise the references and return. Together with
+	 * `stateless_rpc`, this answers the "info/refs" request of smart
+	 * HTTP; the "# service=git-upload-pack" header in front of it is
+	 * up to the caller.
+	 */
+	int advertise_refs;
+
+	/**
+	 * The version of the protocol the client asked for, such as with
+	 * the "Git-Protocol" header of smart HTTP: 2 speaks protocol v2,
+	 * anything else version 0. Smart HTTP leaves out the
+	 * "# service=git-upload-pack" header for version 2.
+	 */
+	int protocol_version;
+} git_upload_pack_options;
+
+#define GIT_UPLOAD_PACK_OPTIONS_VERSION 1
+#define GIT_UPLOAD_PACK_OPTIONS_INIT {GIT_UPLOAD_PACK_OPTIONS_VERSION}
+
+/**
+ * Initializes a `git_upload_pack_options` with default values. Equivalent
+ * to creating an instance with GIT_UPLOAD_PACK_OPTIONS_INIT.
+ *
+ * @param opts the `git_upload_pack_options` struct to initialize
+ * @param version Version of struct; pass `GIT_UPLOAD_PACK_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_upload_pack_init_options(
+	git_upload_pack_options *opts,
+	unsigned int version);
+
+/**
+ * Serve a fetch from `repo`, like `git upload-pack` does.
+ *
+ * The references are advertised, the client's wants and haves are
+ * negotiated, and the pack is built with a `git_packbuilder` and sent
+ * over the side-band if the client asked for it. This speaks version 0
+ * of the protocol with the multi_ack, multi_ack_detailed, side-band,
+ * side-band-64k, no-progress and include-tag capabilities, or version
+ * 2 with its ls-refs and fetch commands; shallow fetches and object
+ * filters aren't supported.
+ *
+ * The repository isn't modified, so a server may keep it open and use
+ * it for many requests, sharing its object cache between them.
+ *
+ * @param repo the repository to serve
+ * @param opts the options, with the I/O callbacks
+ * @return 0 on success, an error code otherwise
+ */
+GIT_EXTERN(int) git_upload_pack(
+	git_repository *repo,
+	const git_upload_pack_options *opts);
+
+/**
+ * A reference update a client pushed
+ */
+typedef struct {
+	/** The reference to update */
+	const char *refname;
+
+	/** The value the client expects it to have; zero when it's new */
+	git_oid old_id;
+
+	/** The value to give it; zero to delete it */
+	git_oid new_id;
+} git_receive_command;
+
+/**
+ * Look over all the commands of a push before any of them is applied,
+ * like git's pre-receive hook. The objects have been received.
+ *
+ * @return 0 to go ahead, non-zero to reject every command
+ */
+typedef int (*git_receive_pre_cb)(
+	const git_receive_command **commands, size_t len, void *payload);
+
+/**
+ * Look over a single command, like git's update hook.
+ *
+ * @return 0 to go ahead, non-zero to reject the command
+ */
+typedef int (*git_receive_update_cb)(
+	const git_receive_command *command, void *payload);
+
+/**
+ * Learn which commands have been applied, like git's post-receive
+ * hook. The return value is ignored.
+ */
+typedef int (*git_receive_post_cb)(
+	const git_receive_command **commands, size_t len, void *payload);
+
+/**
+ * Options for serving a push with `git_receive_pack`
+ */
+typedef struct {
+	unsigned int version;
+
+	/** Reads the client's requests */
+	git_server_read_cb read;
+
+	/** Writes the responses */
+	git_server_write_cb write;
+
+	/** Payload passed to the read and write callbacks */
+	void *payload;
+
+	/**
+	 * Serve a single request of a stateless protocol such as smart
+	 * HTTP: the reference advertisement comes in a request of its own.
+	 */
+	int stateless_rpc;
+
+	/**
+	 * Only advertise the references and return; the
+	 * "# service=git-receive-pack" header is up to the caller.
+	 */
+	int advertise_refs;
+
+	/** Called with all the commands before they are applied */
+	git_receive_pre_cb pre_receive;
+
+	/** Called with each command before it is applied */
+	git_receive_update_cb update;
+
+	/** Called with the commands which have been applied */
+	git_receive_post_cb post_receive;
+
+	/** Payload passed to the hooks */
+	void *hook_payload;
+} git_receive_pack_options;
+
+#define GIT_RECEIVE_PACK_OPTIONS_VERSION 1
+#define GIT_RECEIVE_PACK_OPTIONS_INIT {GIT_RECEIVE_PACK_OPTIONS_VERSION}
+
+/**
+ * Initializes a `git_receive_pack_options` with default values. Equivalent
+ * to creating an instance with GIT_RECEIVE_PACK_OPTIONS_INIT.
+ *
+ * @param opts the `git_receive_pack_options` struct to initialize
+ * @param version Version of struct; pass `GIT_RECEIVE_PACK_OPTIONS_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_receive_pack_init_options(
+	git_receive_pack_options *opts,
+	unsigned int version);
+
+/**
+ * Serve a push into `repo`, like `git receive-pack` does.
+ *
+ * The references are advertised and the client's commands are read.
+ * The pack which follows is streamed into the object database through
+ * a `git_indexer`, and the objects each command needs are checked to
+ * be there. The updates that pass the checks and the hooks are then
+ * applied with a single `git_transaction`, which holds the locks of
+ * all the references while their old values are compared; with the
+ * atomic capability, one rejected command rejects them all.
+ *
+ * This speaks version 0 of the protocol with the report-status,
+ * delete-refs, side-band-64k, atomic and ofs-delta capabilities. The
+ * `receive.denyDeletes`, `receive.denyNonFastForwards` and
+ * `receive.denyCurrentBranch` configuration is honoured.
+ *
+ * @param repo the repository to serve
+ * @param opts the options, with the I/O callbacks and the hooks
+ * @return 0 once the client has its report (even when commands were
+ * rejected), an error code otherwise
+ */
+GIT_EXTERN(int) git_receive_pack(
+	git_repository *repo,
+	const git_receive_pack_options *opts);
+
+/** @} */
+GIT_END_DECL
+#endif
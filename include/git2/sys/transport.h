@@ -269,7 +269,9 @@ typedef struct git_smart_subtransport git_smart_subtransport;
 typedef struct git_smart_subtransport_stream git_smart_subtransport_stream;
 
 /* A stream used by the smart transport to read and write data
- * from a subtransport */
+ * from a subtransport. When libgit2 is built with threads, the rest
+ * of a pack is read from a thread of its own, after the first read
+ * of the response it is in. */
 struct git_smart_subtransport_stream {
 	/* The owning subtransport */
 	git_smart_subtransport *subtransport;
@@ -92,6 +92,9 @@ typedef struct git_odb_stream git_odb_stream;
 /** A stream to write a packfile to the ODB */
 typedef struct git_odb_writepack git_odb_writepack;
 
+/** A batch of objects written to the ODB as a single pack */
+typedef struct git_odb_batch git_odb_batch;
+
 /** An open refs database handle. */
 typedef struct git_refdb git_refdb;
 
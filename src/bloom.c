@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bloom.h"
+
+#define BLOOM_SEED0 0x293ae76f
+#define BLOOM_SEED1 0x7e646e2c
+
+GIT_INLINE(uint32_t) rotl32(uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+GIT_INLINE(uint32_t) bloom_byte(const char *data, size_t i, int version)
+{
+	if (version == 1)
+		return (uint32_t)(signed char)data[i];
+
+	return (uint32_t)(unsigned char)data[i];
+}
+
+/* MurmurHash3 (32 bits), as used for changed-path filters */
+static uint32_t murmur3(uint32_t seed, const char *data, size_t len, int version)
+{
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	uint32_t h = seed, k;
+	size_t i, blocks = len / 4;
+
+	for (i = 0; i < blocks; i++) {
+		k = bloom_byte(data, 4 * i, version) |
+			(bloom_byte(data, 4 * i + 1, version) << 8) |
+			(bloom_byte(data, 4 * i + 2, version) << 16) |
+			(bloom_byte(data, 4 * i + 3, version) << 24);
+
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+
+		h ^= k;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+
+	switch (len & 3) {
+	case 3:
+		k ^= bloom_byte(data, 4 * blocks + 2, version) << 16;
+		/* fall through */
+	case 2:
+		k ^= bloom_byte(data, 4 * blocks + 1, version) << 8;
+		/* fall through */
+	case 1:
+		k ^= bloom_byte(data, 4 * blocks, version);
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+	}
+
+	h ^= (uint32_t)len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+void git_bloom_key_init(
+	git_bloom_key *key, const char *path, size_t len, int version)
+{
+	uint32_t hash0 = murmur3(BLOOM_SEED0, path, len, version);
+	uint32_t hash1 = murmur3(BLOOM_SEED1, path, len, version);
+	int i;
+
+	for (i = 0; i < GIT_BLOOM_NUM_HASHES; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void git_bloom_filter_add(
+	unsigned char *filter, size_t len, const git_bloom_key *key)
+{
+	uint64_t bits = (uint64_t)len * 8, pos;
+	int i;
+
+	for (i = 0; i < GIT_BLOOM_NUM_HASHES; i++) {
+		pos = key->hashes[i] % bits;
+		filter[pos / 8] |= (unsigned char)(1 << (pos % 8));
+	}
+}
+
+int git_bloom_filter_contains(
+	const unsigned char *filter, size_t len, const git_bloom_key *key)
+{
+	uint64_t bits = (uint64_t)len * 8, pos;
+	int i;
+
+	if (!len)
+		return 1;
+
+	for (i = 0; i < GIT_BLOOM_NUM_HASHES; i++) {
+		pos = key->hashes[i] % bits;
+
+		if (!(filter[pos / 8] & (1 << (pos % 8))))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bloom_h__
+#define INCLUDE_bloom_h__
+
+#include "common.h"
+
+/*
+ * The changed-path Bloom filters of a commit-graph, with the settings
+ * git uses: each path sets 7 bits, and the filter has 10 bits for each
+ * path.  A commit which changed too many paths gets a filter with all
+ * bits set, which matches any path.
+ */
+#define GIT_BLOOM_NUM_HASHES 7
+#define GIT_BLOOM_BITS_PER_ENTRY 10
+#define GIT_BLOOM_MAX_CHANGED_PATHS 512
+
+/*
+ * Version 1 hashes the bytes of the paths as signed chars, like git
+ * did at first; version 2 fixes that for paths which aren't ASCII.
+ */
+#define GIT_BLOOM_VERSION 1
+
+typedef struct {
+	uint32_t hashes[GIT_BLOOM_NUM_HASHES];
+} git_bloom_key;
+
+extern void git_bloom_key_init(
+	git_bloom_key *key, const char *path, size_t len, int version);
+
+/* Set the bits of the key in a filter of `len` bytes */
+extern void git_bloom_filter_add(
+	unsigned char *filter, size_t len, const git_bloom_key *key);
+
+/*
+ * Returns 1 if the path of the key may be in the filter, 0 if it
+ * certainly isn't.
+ */
+extern int git_bloom_filter_contains(
+	const unsigned char *filter, size_t len, const git_bloom_key *key);
+
+#endif
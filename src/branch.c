@@ -194,19 +194,39 @@ int git_branch_next(git_reference **out, git_branch_t *out_type, git_branch_iter
 	return error;
 }
 
+static const char *branch_glob(git_branch_t list_flags)
+{
+	switch (list_flags & GIT_BRANCH_ALL) {
+	case GIT_BRANCH_LOCAL:
+		return GIT_REFS_HEADS_DIR "*";
+	case GIT_BRANCH_REMOTE:
+		return GIT_REFS_REMOTES_DIR "*";
+	default:
+		return NULL;
+	}
+}
+
 int git_branch_iterator_new(
 	git_branch_iterator **out,
 	git_repository *repo,
 	git_branch_t list_flags)
 {
 	branch_iter *iter;
+	const char *glob;
+	int error;
 
 	iter = git__calloc(1, sizeof(branch_iter));
 	GITERR_CHECK_ALLOC(iter);
 
 	iter->flags = list_flags;
 
-	if (git_reference_iterator_new(&iter->iter, repo) < 0) {
+	/* let the refdb skip everything that cannot be a branch of the kind asked for */
+	if ((glob = branch_glob(list_flags)) != NULL)
+		error = git_reference_iterator_glob_new(&iter->iter, repo, glob);
+	else
+		error = git_reference_iterator_new(&iter->iter, repo);
+
+	if (error < 0) {
 		git__free(iter);
 		return -1;
 	}
@@ -1820,6 +1820,38 @@ static int checkout_deferred_remove(git_repository *repo, const char *path)
 #endif
 }
 
+/*
+ * Ask for all the blobs we're about to write at once, so those missing
+ * from a partial clone are fetched in a single batch.
+ */
+static int checkout_prefetch_blobs(
+	unsigned int *actions,
+	size_t count,
+	checkout_data *data)
+{
+	git_odb *odb;
+	git_oid *ids;
+	git_diff_delta *delta;
+	size_t i, n = 0;
+	int error;
+
+	if ((error = git_repository_odb__weakptr(&odb, data->repo)) < 0)
+		return error;
+
+	ids = git__calloc(count, sizeof(git_oid));
+	GITERR_CHECK_ALLOC(ids);
+
+	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB)
+			git_oid_cpy(&ids[n++], &delta->new_file.id);
+	}
+
+	error = git_odb_prefetch(odb, ids, n);
+
+	git__free(ids);
+	return error;
+}
+
 static int checkout_create_the_new(
 	unsigned int *actions,
 	checkout_data *data)
@@ -2564,7 +2596,9 @@ int git_checkout_iterator(
 		goto cleanup;
 
 	if (counts[CHECKOUT_ACTION__UPDATE_BLOB] > 0 &&
-		(error = checkout_create_the_new(actions, &data)) < 0)
+		((error = checkout_prefetch_blobs(
+			actions, counts[CHECKOUT_ACTION__UPDATE_BLOB], &data)) < 0 ||
+		 (error = checkout_create_the_new(actions, &data)) < 0))
 		goto cleanup;
 
 	if (counts[CHECKOUT_ACTION__UPDATE_SUBMODULE] > 0 &&
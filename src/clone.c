@@ -424,6 +424,11 @@ int git_clone(
 		int clone_local = git_clone__should_clone_local(url, options.local);
 		int link = options.local != GIT_CLONE_LOCAL_NO_LINKS;
 
+		/* copying the object database would fetch the whole history */
+		if (clone_local == 1 &&
+			(options.fetch_opts.depth || options.fetch_opts.shallow_since))
+			clone_local = 0;
+
 		if (clone_local == 1)
 			error = clone_local_into(
 				repo, origin, &options.fetch_opts, &options.checkout_opts,
@@ -0,0 +1,867 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "commit_graph.h"
+#include "array.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "odb.h"
+#include "pack.h"
+#include "repository.h"
+#include "sha1_lookup.h"
+
+#include "git2/commit.h"
+#include "git2/diff.h"
+#include "git2/revwalk.h"
+
+#define COMMIT_DATA_SIZE (GIT_OID_RAWSZ + 16)
+#define BLOOM_HEADER_SIZE 12
+
+#define PARENT_NONE 0x70000000
+#define PARENT_EXTRA_EDGES 0x80000000
+#define LAST_EXTRA_EDGE 0x80000000
+
+static uint32_t get_be32(const unsigned char *in)
+{
+	return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
+		((uint32_t)in[2] << 8) | (uint32_t)in[3];
+}
+
+static uint64_t get_be64(const unsigned char *in)
+{
+	return ((uint64_t)get_be32(in) << 32) | get_be32(in + 4);
+}
+
+static int commit_graph_corrupted(void)
+{
+	giterr_set(GITERR_ODB, "commit-graph is corrupted");
+	return -1;
+}
+
+static int commit_graph_parse(git_commit_graph_file *file)
+{
+	const unsigned char *data = file->data, *chunk;
+	size_t trailer = file->size - GIT_OID_RAWSZ;
+	size_t i, nr_chunks, start, end, len;
+	uint32_t id;
+
+	if (file->size < 8 + 12 + GIT_OID_RAWSZ)
+		return commit_graph_corrupted();
+
+	if (get_be32(data) != GIT_COMMIT_GRAPH_SIGNATURE ||
+		data[4] != GIT_COMMIT_GRAPH_VERSION ||
+		data[5] != GIT_COMMIT_GRAPH_OID_VERSION) {
+		giterr_set(GITERR_ODB, "unsupported commit-graph version");
+		return -1;
+	}
+
+	/* graphs split over several files are not supported */
+	if (data[7] != 0) {
+		giterr_set(GITERR_ODB, "commit-graph chains are not supported");
+		return -1;
+	}
+
+	nr_chunks = data[6];
+
+	if (8 + (nr_chunks + 1) * 12 > trailer)
+		return commit_graph_corrupted();
+
+	for (i = 0; i < nr_chunks; i++) {
+		chunk = data + 8 + i * 12;
+		id = get_be32(chunk);
+		start = (size_t)get_be64(chunk + 4);
+		end = (size_t)get_be64(chunk + 16);
+
+		if (start < 8 + (nr_chunks + 1) * 12 || start > end || end > trailer)
+			return commit_graph_corrupted();
+
+		len = end - start;
+
+		switch (id) {
+		case GIT_COMMIT_GRAPH_CHUNK_OIDFANOUT:
+			if (len != 256 * 4)
+				return commit_graph_corrupted();
+			file->fanout = data + start;
+			file->num_commits = get_be32(file->fanout + 255 * 4);
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP:
+			file->oid_lookup = data + start;
+			if (len % GIT_OID_RAWSZ)
+				return commit_graph_corrupted();
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_COMMITDATA:
+			file->commit_data = data + start;
+			if (len % COMMIT_DATA_SIZE)
+				return commit_graph_corrupted();
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_EXTRAEDGES:
+			file->extra_edges = data + start;
+			file->num_extra_edges = len / 4;
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX:
+			file->bloom_index = data + start;
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_BLOOMDATA:
+			if (len < BLOOM_HEADER_SIZE)
+				return commit_graph_corrupted();
+			file->bloom_version = (int)get_be32(data + start);
+			file->bloom_data = data + start + BLOOM_HEADER_SIZE;
+			file->bloom_data_size = len - BLOOM_HEADER_SIZE;
+
+			/* filters built with other settings can't be queried */
+			if ((file->bloom_version != 1 && file->bloom_version != 2) ||
+				get_be32(data + start + 4) != GIT_BLOOM_NUM_HASHES ||
+				get_be32(data + start + 8) != GIT_BLOOM_BITS_PER_ENTRY)
+				file->bloom_data = NULL;
+			break;
+		}
+	}
+
+	if (!file->fanout || !file->oid_lookup || !file->commit_data)
+		return commit_graph_corrupted();
+
+	/* sizes of the chunks are only known once the commits are counted */
+	for (i = 0; i < nr_chunks; i++) {
+		chunk = data + 8 + i * 12;
+		len = (size_t)(get_be64(chunk + 16) - get_be64(chunk + 4));
+
+		switch (get_be32(chunk)) {
+		case GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP:
+			if (len != (size_t)file->num_commits * GIT_OID_RAWSZ)
+				return commit_graph_corrupted();
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_COMMITDATA:
+			if (len != (size_t)file->num_commits * COMMIT_DATA_SIZE)
+				return commit_graph_corrupted();
+			break;
+		case GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX:
+			if (len != (size_t)file->num_commits * 4)
+				return commit_graph_corrupted();
+			break;
+		}
+	}
+
+	if (!file->bloom_index || !file->bloom_data) {
+		file->bloom_index = NULL;
+		file->bloom_data = NULL;
+		file->bloom_data_size = 0;
+	}
+
+	return 0;
+}
+
+int git_commit_graph_open(git_commit_graph_file **out, const char *objects_dir)
+{
+	git_commit_graph_file *file = NULL;
+	git_buf path = GIT_BUF_INIT;
+	int error;
+
+	assert(out && objects_dir);
+
+	*out = NULL;
+
+	if ((error = git_buf_joinpath(&path, objects_dir, GIT_COMMIT_GRAPH_FILE)) < 0)
+		goto done;
+
+	if (!git_path_isfile(path.ptr)) {
+		giterr_set(GITERR_ODB, "there is no commit-graph in '%s'", objects_dir);
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GITERR_CHECK_ALLOC(file);
+
+#ifdef GIT_WIN32
+	if ((error = git_futils_readbuffer(&file->contents, path.ptr)) < 0)
+		goto done;
+
+	file->data = (const unsigned char *)file->contents.ptr;
+	file->size = file->contents.size;
+#else
+	if ((error = git_futils_mmap_ro_file(&file->map, path.ptr)) < 0)
+		goto done;
+
+	file->data = file->map.data;
+	file->size = file->map.len;
+#endif
+
+	if ((error = commit_graph_parse(file)) < 0)
+		goto done;
+
+	*out = file;
+	file = NULL;
+
+done:
+	git_commit_graph_free(file);
+	git_buf_free(&path);
+	return error;
+}
+
+void git_commit_graph_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+#ifdef GIT_WIN32
+	git_buf_free(&file->contents);
+#else
+	if (file->map.data)
+		git_futils_mmap_free(&file->map);
+#endif
+	git__free(file);
+}
+
+int git_commit_graph_find(
+	size_t *pos, const git_commit_graph_file *file, const git_oid *id)
+{
+	uint32_t lo, hi;
+	int found;
+
+	hi = get_be32(file->fanout + id->id[0] * 4);
+	lo = id->id[0] ? get_be32(file->fanout + (id->id[0] - 1) * 4) : 0;
+
+	if (hi > file->num_commits || lo > hi)
+		return commit_graph_corrupted();
+
+	if (lo < hi &&
+		(found = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, id->id)) >= 0) {
+		*pos = (size_t)found;
+		return 0;
+	}
+
+	return GIT_ENOTFOUND;
+}
+
+void git_commit_graph_id(
+	git_oid *out, const git_commit_graph_file *file, size_t pos)
+{
+	assert(pos < file->num_commits);
+	git_oid_fromraw(out, file->oid_lookup + pos * GIT_OID_RAWSZ);
+}
+
+int git_commit_graph_entry_get(
+	git_commit_graph_entry *out, const git_commit_graph_file *file, size_t pos)
+{
+	const unsigned char *data;
+	uint32_t p2, gen;
+
+	assert(pos < file->num_commits);
+
+	data = file->commit_data + pos * COMMIT_DATA_SIZE;
+	git_oid_fromraw(&out->tree_id, data);
+
+	gen = get_be32(data + GIT_OID_RAWSZ + 8);
+	out->generation = gen >> 2;
+	out->commit_time = (int64_t)(((uint64_t)(gen & 3) << 32) |
+		get_be32(data + GIT_OID_RAWSZ + 12));
+
+	p2 = get_be32(data + GIT_OID_RAWSZ + 4);
+
+	if (get_be32(data + GIT_OID_RAWSZ) == PARENT_NONE)
+		out->parent_count = 0;
+	else if (p2 == PARENT_NONE)
+		out->parent_count = 1;
+	else if (!(p2 & PARENT_EXTRA_EDGES))
+		out->parent_count = 2;
+	else {
+		size_t edge = p2 & ~PARENT_EXTRA_EDGES;
+
+		out->parent_count = 2;
+
+		for (; edge < file->num_extra_edges; edge++, out->parent_count++) {
+			if (get_be32(file->extra_edges + edge * 4) & LAST_EXTRA_EDGE)
+				break;
+		}
+
+		if (edge == file->num_extra_edges)
+			return commit_graph_corrupted();
+	}
+
+	return 0;
+}
+
+int git_commit_graph_parent(
+	size_t *parent_pos, const git_commit_graph_file *file, size_t pos, size_t n)
+{
+	const unsigned char *data = file->commit_data + pos * COMMIT_DATA_SIZE;
+	uint32_t value;
+
+	if (n == 0)
+		value = get_be32(data + GIT_OID_RAWSZ);
+	else {
+		value = get_be32(data + GIT_OID_RAWSZ + 4);
+
+		if (value & PARENT_EXTRA_EDGES) {
+			size_t edge = (value & ~PARENT_EXTRA_EDGES) + n - 1;
+
+			if (edge >= file->num_extra_edges)
+				return commit_graph_corrupted();
+
+			value = get_be32(file->extra_edges + edge * 4) & ~LAST_EXTRA_EDGE;
+		} else if (n > 1)
+			value = PARENT_NONE;
+	}
+
+	if (value == PARENT_NONE) {
+		giterr_set(GITERR_INVALID, "commit has no parent %"PRIuZ, n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (value >= file->num_commits)
+		return commit_graph_corrupted();
+
+	*parent_pos = value;
+	return 0;
+}
+
+void git_commit_graph_bloom_key(
+	git_bloom_key *key, const git_commit_graph_file *file, const char *path)
+{
+	git_bloom_key_init(key, path, strlen(path), file->bloom_version);
+}
+
+int git_commit_graph_bloom_maybe_changed(
+	const git_commit_graph_file *file, size_t pos, const git_bloom_key *key)
+{
+	size_t start, end;
+
+	if (!file->bloom_data)
+		return GIT_ENOTFOUND;
+
+	start = pos ? get_be32(file->bloom_index + (pos - 1) * 4) : 0;
+	end = get_be32(file->bloom_index + pos * 4);
+
+	/* no filter was computed for this commit */
+	if (start >= end || end > file->bloom_data_size)
+		return GIT_ENOTFOUND;
+
+	return git_bloom_filter_contains(
+		file->bloom_data + start, end - start, key);
+}
+
+/*
+ * Writing the graph
+ */
+
+typedef struct {
+	git_oid id;
+	git_oid tree_id;
+	int64_t time;
+	size_t parents; /* index of the first one in `parent_ids` */
+	size_t parent_count;
+	size_t topo; /* position in the walk, parents first */
+	uint32_t generation;
+} graph_commit;
+
+typedef struct {
+	const char *path;
+	size_t len;
+} changed_path;
+
+typedef struct {
+	git_repository *repo;
+	git_array_t(graph_commit) commits;
+	git_array_t(git_oid) parent_ids;
+	git_array_t(uint32_t) parent_pos;
+	git_array_t(uint32_t) bloom_index;
+	git_array_t(changed_path) paths;
+	git_buf bloom_data;
+	size_t nr_extra_edges;
+} graph_writer;
+
+static int graph_commit_cmp(const void *a, const void *b, void *payload)
+{
+	const graph_commit *ca = a, *cb = b;
+	GIT_UNUSED(payload);
+	return git_oid__cmp(&ca->id, &cb->id);
+}
+
+static int graph_commit_pos(uint32_t *out, graph_writer *w, const git_oid *id)
+{
+	size_t lo = 0, hi = w->commits.size, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = git_oid__cmp(&w->commits.ptr[mid].id, id);
+
+		if (!cmp) {
+			*out = (uint32_t)mid;
+			return 0;
+		} else if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	giterr_set(GITERR_INVALID, "parent of commit not found in the commit-graph");
+	return -1;
+}
+
+static int graph_add_commit(graph_writer *w, const git_oid *id)
+{
+	git_commit *commit;
+	graph_commit *c;
+	git_oid *parent_id;
+	unsigned int i;
+
+	if (git_commit_lookup(&commit, w->repo, id) < 0)
+		return -1;
+
+	c = git_array_alloc(w->commits);
+	GITERR_CHECK_ALLOC(c);
+
+	git_oid_cpy(&c->id, id);
+	git_oid_cpy(&c->tree_id, git_commit_tree_id(commit));
+	c->time = git_commit_time(commit);
+	c->parents = w->parent_ids.size;
+	c->parent_count = git_commit_parentcount(commit);
+	c->topo = w->commits.size - 1;
+
+	for (i = 0; i < c->parent_count; i++) {
+		parent_id = git_array_alloc(w->parent_ids);
+		GITERR_CHECK_ALLOC(parent_id);
+
+		git_oid_cpy(parent_id, git_commit_parent_id(commit, i));
+	}
+
+	if (c->parent_count > 2)
+		w->nr_extra_edges += c->parent_count - 1;
+
+	git_commit_free(commit);
+	return 0;
+}
+
+static int graph_collect(graph_writer *w)
+{
+	git_revwalk *walk;
+	git_oid id;
+	int error;
+
+	if ((error = git_revwalk_new(&walk, w->repo)) < 0)
+		return error;
+
+	git_revwalk_sorting(walk, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE);
+
+	if ((error = git_revwalk_push_glob(walk, "*")) < 0)
+		goto done;
+
+	/* an unborn HEAD has nothing to add */
+	if ((error = git_reference_name_to_id(&id, w->repo, GIT_HEAD_FILE)) == 0)
+		error = git_revwalk_push(walk, &id);
+	else if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	if (error < 0)
+		goto done;
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = graph_add_commit(w, &id)) < 0)
+			goto done;
+	}
+
+	if (error == GIT_ITEROVER)
+		error = 0;
+
+done:
+	git_revwalk_free(walk);
+	return error;
+}
+
+/*
+ * Find the position of the parents of each commit once the commits are
+ * sorted, and give each commit its generation number: one more than the
+ * highest of its parents, roots being at 1.
+ */
+static int graph_link_commits(graph_writer *w)
+{
+	size_t *by_topo, i, j;
+	graph_commit *c;
+	uint32_t *pos, gen;
+	int error = 0;
+
+	if (w->commits.size)
+		git__qsort_r(w->commits.ptr, w->commits.size,
+			sizeof(graph_commit), graph_commit_cmp, NULL);
+
+	by_topo = git__calloc(w->commits.size ? w->commits.size : 1, sizeof(size_t));
+	GITERR_CHECK_ALLOC(by_topo);
+
+	for (i = 0; i < w->commits.size; i++)
+		by_topo[w->commits.ptr[i].topo] = i;
+
+	git_array_init_to_size(w->parent_pos, max(w->parent_ids.size, 1));
+	GITERR_CHECK_ALLOC(w->parent_pos.ptr);
+	w->parent_pos.size = w->parent_ids.size;
+
+	for (i = 0; i < w->commits.size; i++) {
+		c = &w->commits.ptr[by_topo[i]];
+		gen = 1;
+
+		for (j = 0; j < c->parent_count; j++) {
+			pos = &w->parent_pos.ptr[c->parents + j];
+
+			if ((error = graph_commit_pos(pos,
+					w, &w->parent_ids.ptr[c->parents + j])) < 0)
+				goto done;
+
+			if (w->commits.ptr[*pos].generation >= gen)
+				gen = w->commits.ptr[*pos].generation + 1;
+		}
+
+		c->generation = min(gen, GIT_COMMIT_GRAPH_GENERATION_MAX);
+	}
+
+done:
+	git__free(by_topo);
+	return error;
+}
+
+static int changed_path_cmp(const void *a, const void *b, void *payload)
+{
+	const changed_path *pa = a, *pb = b;
+	int cmp = memcmp(pa->path, pb->path, min(pa->len, pb->len));
+
+	GIT_UNUSED(payload);
+
+	if (cmp)
+		return cmp;
+
+	return (pa->len < pb->len) ? -1 : (pa->len > pb->len);
+}
+
+static int graph_add_changed_path(graph_writer *w, const char *path)
+{
+	changed_path *entry;
+	const char *slash;
+	size_t len = strlen(path);
+
+	/* the leading directories count as changed paths as well */
+	while (len) {
+		entry = git_array_alloc(w->paths);
+		GITERR_CHECK_ALLOC(entry);
+
+		entry->path = path;
+		entry->len = len;
+
+		for (slash = path + len - 1; slash > path && *slash != '/'; slash--)
+			;
+		len = slash - path;
+	}
+
+	return 0;
+}
+
+/*
+ * Append to `bloom_data` the filter of the paths the commit changed
+ * compared to its first parent, the same way git does.
+ */
+static int graph_write_bloom_filter(graph_writer *w, graph_commit *c)
+{
+	git_tree *old_tree = NULL, *new_tree = NULL;
+	git_diff *diff = NULL;
+	const git_diff_delta *delta;
+	git_bloom_key key;
+	changed_path *entry, *last = NULL;
+	unsigned char *filter;
+	uint32_t *end;
+	size_t i, nr = 0, len;
+	int error;
+
+	w->paths.size = 0;
+
+	if (c->parent_count > 0) {
+		graph_commit *parent =
+			&w->commits.ptr[w->parent_pos.ptr[c->parents]];
+
+		if ((error = git_tree_lookup(&old_tree, w->repo, &parent->tree_id)) < 0)
+			goto done;
+	}
+
+	if ((error = git_tree_lookup(&new_tree, w->repo, &c->tree_id)) < 0 ||
+		(error = git_diff_tree_to_tree(&diff, w->repo, old_tree, new_tree, NULL)) < 0)
+		goto done;
+
+	if (git_diff_num_deltas(diff) <= GIT_BLOOM_MAX_CHANGED_PATHS) {
+		for (i = 0; i < git_diff_num_deltas(diff); i++) {
+			delta = git_diff_get_delta(diff, i);
+
+			if ((error = graph_add_changed_path(w, delta->new_file.path)) < 0)
+				goto done;
+		}
+
+		/* a commit may change no paths at all */
+		if (w->paths.size)
+			git__qsort_r(w->paths.ptr, w->paths.size,
+				sizeof(changed_path), changed_path_cmp, NULL);
+
+		for (i = 0; i < w->paths.size; i++) {
+			entry = &w->paths.ptr[i];
+
+			if (last && !changed_path_cmp(last, entry, NULL))
+				continue;
+
+			last = &w->paths.ptr[nr++];
+			if (last != entry)
+				memcpy(last, entry, sizeof(changed_path));
+		}
+	}
+
+	if (git_diff_num_deltas(diff) > GIT_BLOOM_MAX_CHANGED_PATHS ||
+		nr > GIT_BLOOM_MAX_CHANGED_PATHS) {
+		/* too many changes: a filter with every bit set */
+		len = 1;
+
+		if ((error = git_buf_putc(&w->bloom_data, (char)0xff)) < 0)
+			goto done;
+	} else {
+		len = (nr * GIT_BLOOM_BITS_PER_ENTRY + 7) / 8;
+		if (!len)
+			len = 1;
+
+		if ((error = git_buf_grow_by(&w->bloom_data, len + 1)) < 0)
+			goto done;
+
+		filter = (unsigned char *)w->bloom_data.ptr + w->bloom_data.size;
+		memset(filter, 0, len);
+
+		for (i = 0; i < nr; i++) {
+			git_bloom_key_init(&key, w->paths.ptr[i].path,
+				w->paths.ptr[i].len, GIT_BLOOM_VERSION);
+			git_bloom_filter_add(filter, len, &key);
+		}
+
+		w->bloom_data.size += len;
+		w->bloom_data.ptr[w->bloom_data.size] = '\0';
+	}
+
+	end = git_array_alloc(w->bloom_index);
+	GITERR_CHECK_ALLOC(end);
+
+	*end = (uint32_t)w->bloom_data.size;
+
+done:
+	git_diff_free(diff);
+	git_tree_free(old_tree);
+	git_tree_free(new_tree);
+	return error;
+}
+
+static int write_u32(git_filebuf *file, uint32_t n)
+{
+	n = htonl(n);
+	return git_filebuf_write(file, &n, sizeof(n));
+}
+
+static int write_u64(git_filebuf *file, uint64_t n)
+{
+	if (write_u32(file, (uint32_t)(n >> 32)) < 0)
+		return -1;
+
+	return write_u32(file, (uint32_t)(n & 0xffffffff));
+}
+
+static int write_chunk_header(git_filebuf *file, uint32_t id, uint64_t offset)
+{
+	if (write_u32(file, id) < 0)
+		return -1;
+
+	return write_u64(file, offset);
+}
+
+static int graph_write_commit_data(git_filebuf *file, graph_writer *w, graph_commit *c, size_t *edge)
+{
+	uint32_t parents[2] = { PARENT_NONE, PARENT_NONE };
+	uint64_t time = (uint64_t)c->time;
+
+	if (c->parent_count > 0)
+		parents[0] = w->parent_pos.ptr[c->parents];
+
+	if (c->parent_count == 2)
+		parents[1] = w->parent_pos.ptr[c->parents + 1];
+	else if (c->parent_count > 2) {
+		parents[1] = PARENT_EXTRA_EDGES | (uint32_t)*edge;
+		*edge += c->parent_count - 1;
+	}
+
+	if (git_filebuf_write(file, c->tree_id.id, GIT_OID_RAWSZ) < 0 ||
+		write_u32(file, parents[0]) < 0 ||
+		write_u32(file, parents[1]) < 0 ||
+		write_u32(file, (c->generation << 2) | (uint32_t)((time >> 32) & 3)) < 0 ||
+		write_u32(file, (uint32_t)time) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int graph_write_file(git_filebuf *file, graph_writer *w)
+{
+	graph_commit *c;
+	uint32_t fanout[256] = {0};
+	size_t i, j, nr = w->commits.size, nr_chunks, edge = 0;
+	uint64_t offset;
+	unsigned char header[8];
+	git_oid hash;
+
+	for (i = 0; i < nr; i++)
+		fanout[w->commits.ptr[i].id.id[0]]++;
+
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	nr_chunks = w->nr_extra_edges ? 6 : 5;
+
+	header[0] = 'C'; header[1] = 'G'; header[2] = 'P'; header[3] = 'H';
+	header[4] = GIT_COMMIT_GRAPH_VERSION;
+	header[5] = GIT_COMMIT_GRAPH_OID_VERSION;
+	header[6] = (unsigned char)nr_chunks;
+	header[7] = 0; /* no base graphs */
+
+	if (git_filebuf_write(file, header, 8) < 0)
+		return -1;
+
+	/* chunk lookup table, terminated by the offset of the trailer */
+	offset = 8 + (nr_chunks + 1) * 12;
+
+	if (write_chunk_header(file, GIT_COMMIT_GRAPH_CHUNK_OIDFANOUT, offset) < 0)
+		return -1;
+	offset += sizeof(fanout);
+
+	if (write_chunk_header(file, GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP, offset) < 0)
+		return -1;
+	offset += nr * GIT_OID_RAWSZ;
+
+	if (write_chunk_header(file, GIT_COMMIT_GRAPH_CHUNK_COMMITDATA, offset) < 0)
+		return -1;
+	offset += nr * COMMIT_DATA_SIZE;
+
+	if (w->nr_extra_edges) {
+		if (write_chunk_header(file, GIT_COMMIT_GRAPH_CHUNK_EXTRAEDGES, offset) < 0)
+			return -1;
+		offset += w->nr_extra_edges * 4;
+	}
+
+	if (write_chunk_header(file, GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX, offset) < 0)
+		return -1;
+	offset += nr * 4;
+
+	if (write_chunk_header(file, GIT_COMMIT_GRAPH_CHUNK_BLOOMDATA, offset) < 0)
+		return -1;
+	offset += BLOOM_HEADER_SIZE + w->bloom_data.size;
+
+	if (write_chunk_header(file, 0, offset) < 0)
+		return -1;
+
+	/* OIDF */
+	for (i = 0; i < 256; i++) {
+		if (write_u32(file, fanout[i]) < 0)
+			return -1;
+	}
+
+	/* OIDL */
+	for (i = 0; i < nr; i++) {
+		if (git_filebuf_write(file, w->commits.ptr[i].id.id, GIT_OID_RAWSZ) < 0)
+			return -1;
+	}
+
+	/* CDAT */
+	for (i = 0; i < nr; i++) {
+		if (graph_write_commit_data(file, w, &w->commits.ptr[i], &edge) < 0)
+			return -1;
+	}
+
+	/* EDGE: the parents of octopus merges after the first one */
+	for (i = 0; i < nr && w->nr_extra_edges; i++) {
+		c = &w->commits.ptr[i];
+
+		for (j = 1; j < c->parent_count && c->parent_count > 2; j++) {
+			uint32_t pos = w->parent_pos.ptr[c->parents + j];
+
+			if (j == c->parent_count - 1)
+				pos |= LAST_EXTRA_EDGE;
+
+			if (write_u32(file, pos) < 0)
+				return -1;
+		}
+	}
+
+	/* BIDX */
+	for (i = 0; i < nr; i++) {
+		if (write_u32(file, w->bloom_index.ptr[i]) < 0)
+			return -1;
+	}
+
+	/* BDAT */
+	if (write_u32(file, GIT_BLOOM_VERSION) < 0 ||
+		write_u32(file, GIT_BLOOM_NUM_HASHES) < 0 ||
+		write_u32(file, GIT_BLOOM_BITS_PER_ENTRY) < 0 ||
+		git_filebuf_write(file, w->bloom_data.ptr, w->bloom_data.size) < 0)
+		return -1;
+
+	if (git_filebuf_hash(&hash, file) < 0)
+		return -1;
+
+	return git_filebuf_write(file, hash.id, GIT_OID_RAWSZ);
+}
+
+int git_commit_graph_write(git_repository *repo)
+{
+	graph_writer w = {0};
+	git_buf path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	size_t i;
+	int error;
+
+	assert(repo);
+
+	if ((error = git_repository_is_shallow(repo)) != 0) {
+		if (error > 0) {
+			giterr_set(GITERR_INVALID,
+				"cannot write a commit-graph for a shallow repository");
+			error = -1;
+		}
+		return error;
+	}
+
+	w.repo = repo;
+
+	if ((error = graph_collect(&w)) < 0 ||
+		(error = graph_link_commits(&w)) < 0)
+		goto done;
+
+	for (i = 0; i < w.commits.size; i++) {
+		if ((error = graph_write_bloom_filter(&w, &w.commits.ptr[i])) < 0)
+			goto done;
+	}
+
+	if ((error = git_buf_joinpath(&path,
+			repo->path_repository, GIT_OBJECTS_DIR)) < 0 ||
+		(error = git_buf_joinpath(&path, path.ptr, GIT_COMMIT_GRAPH_FILE)) < 0 ||
+		(error = git_futils_mkpath2file(path.ptr, GIT_OBJECT_DIR_MODE)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS, GIT_PACK_FILE_MODE)) < 0)
+		goto done;
+
+	if ((error = graph_write_file(&file, &w)) < 0 ||
+		(error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+done:
+	git_filebuf_cleanup(&file);
+	git_array_clear(w.commits);
+	git_array_clear(w.parent_ids);
+	git_array_clear(w.parent_pos);
+	git_array_clear(w.bloom_index);
+	git_array_clear(w.paths);
+	git_buf_free(&w.bloom_data);
+	git_buf_free(&path);
+	return error;
+}
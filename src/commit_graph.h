@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_commit_graph_h__
+#define INCLUDE_commit_graph_h__
+
+#include "common.h"
+#include "git2/commit_graph.h"
+#include "git2/oid.h"
+#include "bloom.h"
+#include "buffer.h"
+#include "map.h"
+
+#define GIT_COMMIT_GRAPH_FILE "info/commit-graph"
+
+#define GIT_COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GIT_COMMIT_GRAPH_VERSION 1
+#define GIT_COMMIT_GRAPH_OID_VERSION 1 /* SHA-1 */
+
+#define GIT_COMMIT_GRAPH_CHUNK_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GIT_COMMIT_GRAPH_CHUNK_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GIT_COMMIT_GRAPH_CHUNK_COMMITDATA 0x43444154 /* "CDAT" */
+#define GIT_COMMIT_GRAPH_CHUNK_EXTRAEDGES 0x45444745 /* "EDGE" */
+#define GIT_COMMIT_GRAPH_CHUNK_BLOOMINDEX 0x42494458 /* "BIDX" */
+#define GIT_COMMIT_GRAPH_CHUNK_BLOOMDATA 0x42444154 /* "BDAT" */
+
+/* Generation numbers stop growing at this value */
+#define GIT_COMMIT_GRAPH_GENERATION_MAX 0x3fffffff
+
+/* The generation of commits which are not in the graph */
+#define GIT_COMMIT_GRAPH_GENERATION_INFINITY 0xffffffff
+
+/* A commit-graph file read back from disk */
+typedef struct {
+#ifdef GIT_WIN32
+	/* the file gets replaced when it's written again */
+	git_buf contents;
+#else
+	git_map map;
+#endif
+	const unsigned char *data;
+	size_t size;
+
+	uint32_t num_commits;
+	const unsigned char *fanout;
+	const unsigned char *oid_lookup;
+	const unsigned char *commit_data;
+	const unsigned char *extra_edges;
+	size_t num_extra_edges;
+
+	/* the changed-path filters, if the file has them */
+	const unsigned char *bloom_index;
+	const unsigned char *bloom_data;
+	size_t bloom_data_size;
+	int bloom_version;
+} git_commit_graph_file;
+
+typedef struct {
+	git_oid tree_id;
+	int64_t commit_time;
+	uint32_t generation;
+	size_t parent_count;
+} git_commit_graph_entry;
+
+/*
+ * Open the commit-graph of an object directory.  Returns GIT_ENOTFOUND
+ * when there is none.
+ */
+extern int git_commit_graph_open(
+	git_commit_graph_file **out, const char *objects_dir);
+
+extern void git_commit_graph_free(git_commit_graph_file *file);
+
+/* Find the position of a commit in the file, or return GIT_ENOTFOUND */
+extern int git_commit_graph_find(
+	size_t *pos, const git_commit_graph_file *file, const git_oid *id);
+
+/* The id of the commit at `pos` */
+extern void git_commit_graph_id(
+	git_oid *out, const git_commit_graph_file *file, size_t pos);
+
+extern int git_commit_graph_entry_get(
+	git_commit_graph_entry *out, const git_commit_graph_file *file, size_t pos);
+
+/* The position of the `n`th parent of the commit at `pos` */
+extern int git_commit_graph_parent(
+	size_t *parent_pos, const git_commit_graph_file *file, size_t pos, size_t n);
+
+/*
+ * Prepare the key of a path, to look for it in the file's changed-path
+ * filters.
+ */
+extern void git_commit_graph_bloom_key(
+	git_bloom_key *key, const git_commit_graph_file *file, const char *path);
+
+/*
+ * Whether the commit at `pos` may have changed the path of `key`
+ * compared to its first parent: 1 if it may, 0 if it certainly didn't,
+ * or GIT_ENOTFOUND if the commit has no filter to tell.
+ */
+extern int git_commit_graph_bloom_maybe_changed(
+	const git_commit_graph_file *file, size_t pos, const git_bloom_key *key);
+
+#endif
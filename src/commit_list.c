@@ -10,6 +10,7 @@
 #include "revwalk.h"
 #include "pool.h"
 #include "odb.h"
+#include "shallow.h"
 
 int git_commit_list_time_cmp(const void *a, const void *b)
 {
@@ -19,6 +20,18 @@ int git_commit_list_time_cmp(const void *a, const void *b)
 	return (commit_a->time < commit_b->time);
 }
 
+/* Children come out of a queue sorted this way before their parents */
+int git_commit_list_generation_cmp(const void *a, const void *b)
+{
+	const git_commit_list_node *commit_a = a;
+	const git_commit_list_node *commit_b = b;
+
+	if (commit_a->generation != commit_b->generation)
+		return (commit_a->generation < commit_b->generation) ? 1 : -1;
+
+	return git_commit_list_time_cmp(a, b);
+}
+
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p)
 {
 	git_commit_list *new_list = git__malloc(sizeof(git_commit_list));
@@ -45,9 +58,99 @@ git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_
 	return git_commit_list_insert(item, pp);
 }
 
+git_commit_list_node *git_commit_store_alloc(git_commit_store *store)
+{
+	git_commit_list_node *commit, **pages, **page;
+	uint8_t *flags;
+	size_t alloc;
+
+	if (store->count == UINT32_MAX) {
+		giterr_set(GITERR_INVALID, "too many commits in the walk");
+		return NULL;
+	}
+
+	/* the pages and the flags grow together, a whole page at a time */
+	if (store->count == store->alloc) {
+		alloc = store->alloc ? store->alloc * 2 : COMMIT_STORE_PAGE_SIZE;
+
+		pages = git__reallocarray(store->pages,
+			alloc / COMMIT_STORE_PAGE_SIZE, sizeof(git_commit_list_node *));
+		if (pages == NULL)
+			return NULL;
+
+		memset(pages + store->alloc / COMMIT_STORE_PAGE_SIZE, 0,
+			(alloc - store->alloc) / COMMIT_STORE_PAGE_SIZE * sizeof(git_commit_list_node *));
+		store->pages = pages;
+
+		if ((flags = git__realloc(store->flags, alloc)) == NULL)
+			return NULL;
+
+		memset(flags + store->alloc, 0, alloc - store->alloc);
+		store->flags = flags;
+
+		store->alloc = alloc;
+	}
+
+	page = &store->pages[store->count >> COMMIT_STORE_PAGE_BITS];
+
+	if (*page == NULL &&
+		(*page = git__calloc(COMMIT_STORE_PAGE_SIZE, sizeof(git_commit_list_node))) == NULL)
+		return NULL;
+
+	commit = &(*page)[store->count & (COMMIT_STORE_PAGE_SIZE - 1)];
+	commit->id = store->count++;
+
+	return commit;
+}
+
+int git_commit_store_add_parent(
+	git_commit_store *store, const git_commit_list_node *parent)
+{
+	uint32_t *parents;
+	size_t alloc;
+
+	if (store->parents_len == store->parents_alloc) {
+		alloc = store->parents_alloc ? store->parents_alloc * 2 : COMMIT_STORE_PAGE_SIZE;
+
+		if (alloc > UINT32_MAX) {
+			giterr_set(GITERR_INVALID, "too many parents in the walk");
+			return -1;
+		}
+
+		parents = git__reallocarray(store->parents, alloc, sizeof(uint32_t));
+		GITERR_CHECK_ALLOC(parents);
+
+		store->parents = parents;
+		store->parents_alloc = alloc;
+	}
+
+	store->parents[store->parents_len++] = parent->id;
+	return 0;
+}
+
+void git_commit_store_clear_flags(git_commit_store *store)
+{
+	if (store->count)
+		memset(store->flags, 0, store->count);
+}
+
+void git_commit_store_free(git_commit_store *store)
+{
+	size_t i;
+
+	for (i = 0; i < store->alloc / COMMIT_STORE_PAGE_SIZE; i++)
+		git__free(store->pages[i]);
+
+	git__free(store->pages);
+	git__free(store->flags);
+	git__free(store->parents);
+
+	memset(store, 0, sizeof(git_commit_store));
+}
+
 git_commit_list_node *git_commit_list_alloc_node(git_revwalk *walk)
 {
-	return (git_commit_list_node *)git_pool_mallocz(&walk->commit_pool, 1);
+	return git_commit_store_alloc(&walk->store);
 }
 
 static int commit_error(git_commit_list_node *commit, const char *msg)
@@ -61,16 +164,6 @@ static int commit_error(git_commit_list_node *commit, const char *msg)
 	return -1;
 }
 
-static git_commit_list_node **alloc_parents(
-	git_revwalk *walk, git_commit_list_node *commit, size_t n_parents)
-{
-	if (n_parents <= PARENTS_PER_COMMIT)
-		return (git_commit_list_node **)((char *)commit + sizeof(git_commit_list_node));
-
-	return (git_commit_list_node **)git_pool_malloc(
-		&walk->commit_pool, (uint32_t)(n_parents * sizeof(git_commit_list_node *)));
-}
-
 
 void git_commit_list_free(git_commit_list **list_p)
 {
@@ -120,18 +213,26 @@ static int commit_quick_parse(
 		buffer += parent_len;
 	}
 
-	commit->parents = alloc_parents(walk, commit, parents);
-	GITERR_CHECK_ALLOC(commit->parents);
+	/* the history of a shallow root is not there; it has no parents */
+	if (parents && git_array_size(walk->shallow) &&
+		git_shallow__contains(&walk->shallow, &commit->oid)) {
+		parents_start = buffer;
+		parents = 0;
+	}
+
+	/* looking the parents up doesn't add to the store's parents */
+	commit->parents = (uint32_t)walk->store.parents_len;
 
 	buffer = parents_start;
 	for (i = 0; i < parents; ++i) {
+		git_commit_list_node *parent;
 		git_oid oid;
 
 		if (git_oid_fromstr(&oid, (const char *)buffer + strlen("parent ")) < 0)
 			return -1;
 
-		commit->parents[i] = git_revwalk__commit_lookup(walk, &oid);
-		if (commit->parents[i] == NULL)
+		if ((parent = git_revwalk__commit_lookup(walk, &oid)) == NULL ||
+			git_commit_store_add_parent(&walk->store, parent) < 0)
 			return -1;
 
 		buffer += parent_len;
@@ -170,6 +271,34 @@ static int commit_quick_parse(
 		return commit_error(commit, "cannot parse commit time");
 
 	commit->time = commit_time;
+	commit->generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+	commit->parsed = 1;
+	return 0;
+}
+
+static int commit_graph_parse(git_revwalk *walk, git_commit_list_node *commit)
+{
+	size_t pos = commit->graph_pos;
+	git_commit_graph_entry entry;
+	size_t i, parent_pos;
+
+	if (git_commit_graph_entry_get(&entry, walk->graph, pos) < 0)
+		return -1;
+
+	commit->parents = (uint32_t)walk->store.parents_len;
+
+	for (i = 0; i < entry.parent_count; i++) {
+		git_commit_list_node *parent;
+
+		if (git_commit_graph_parent(&parent_pos, walk->graph, pos, i) < 0 ||
+			(parent = git_revwalk__graph_commit_lookup(walk, parent_pos)) == NULL ||
+			git_commit_store_add_parent(&walk->store, parent) < 0)
+			return -1;
+	}
+
+	commit->out_degree = (unsigned short)entry.parent_count;
+	commit->time = entry.commit_time;
+	commit->generation = entry.generation;
 	commit->parsed = 1;
 	return 0;
 }
@@ -182,6 +311,10 @@ int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 	if (commit->parsed)
 		return 0;
 
+	/* the commit-graph has everything the walk needs */
+	if (commit->in_graph)
+		return commit_graph_parse(walk, commit);
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
@@ -7,6 +7,7 @@
 #ifndef INCLUDE_commit_list_h__
 #define INCLUDE_commit_list_h__
 
+#include "common.h"
 #include "git2/oid.h"
 
 #define PARENT1  (1 << 0)
@@ -15,27 +16,80 @@
 #define STALE    (1 << 3)
 #define ALL_FLAGS (PARENT1 | PARENT2 | STALE | RESULT)
 
-#define PARENTS_PER_COMMIT	2
-#define COMMIT_ALLOC \
-	(sizeof(git_commit_list_node) + PARENTS_PER_COMMIT * sizeof(git_commit_list_node *))
-
 #define FLAG_BITS 4
 
+#define COMMIT_STORE_PAGE_BITS 10
+#define COMMIT_STORE_PAGE_SIZE (1 << COMMIT_STORE_PAGE_BITS)
+
 typedef struct git_commit_list_node {
 	git_oid oid;
+	/* the number of the commit in the walk's store */
+	uint32_t id;
+	uint32_t generation;
 	int64_t time;
 	unsigned int seen:1,
 			 uninteresting:1,
 			 topo_delay:1,
 			 parsed:1,
-			 flags : FLAG_BITS;
+			 /* for walks limited to some paths */
+			 treesame_checked:1,
+			 treesame:1,
+			 rewrite_seen:1,
+			 treesame_parent:16,
+			 /* for incremental topological sorting */
+			 topo_explored:1,
+			 topo_counted:1,
+			 /* whether the commit is in the walk's commit-graph */
+			 in_graph:1;
 
 	unsigned short in_degree;
 	unsigned short out_degree;
+	uint32_t graph_pos;
 
-	struct git_commit_list_node **parents;
+	/* where the numbers of the parents start in the store */
+	uint32_t parents;
 } git_commit_list_node;
 
+/*
+ * The commits a walk has reached, numbered densely in the order it
+ * reached them. The nodes are kept in pages, so a commit's number finds
+ * it without hashing. What the merge-base and graph code go over for
+ * every commit is kept apart in arrays indexed by that number: the
+ * marks they paint the history with (`PARENT1` and the like), and the
+ * numbers of the parents of all the parsed commits, one after another.
+ *
+ * The time and generation stay in the nodes; they are what the
+ * priority queues compare the nodes by, without any other context.
+ */
+typedef struct {
+	git_commit_list_node **pages;
+	uint8_t *flags;
+	uint32_t count;
+	size_t alloc;
+
+	uint32_t *parents;
+	size_t parents_len;
+	size_t parents_alloc;
+} git_commit_store;
+
+GIT_INLINE(git_commit_list_node *) git_commit_store_get(
+	const git_commit_store *store, uint32_t id)
+{
+	return &store->pages[id >> COMMIT_STORE_PAGE_BITS][id & (COMMIT_STORE_PAGE_SIZE - 1)];
+}
+
+/* The `n`th parent of a parsed commit */
+GIT_INLINE(git_commit_list_node *) git_commit_store_parent(
+	const git_commit_store *store, const git_commit_list_node *commit, size_t n)
+{
+	return git_commit_store_get(store, store->parents[commit->parents + n]);
+}
+
+git_commit_list_node *git_commit_store_alloc(git_commit_store *store);
+int git_commit_store_add_parent(git_commit_store *store, const git_commit_list_node *parent);
+void git_commit_store_clear_flags(git_commit_store *store);
+void git_commit_store_free(git_commit_store *store);
+
 typedef struct git_commit_list {
 	git_commit_list_node *item;
 	struct git_commit_list *next;
@@ -43,6 +97,7 @@ typedef struct git_commit_list {
 
 git_commit_list_node *git_commit_list_alloc_node(git_revwalk *walk);
 int git_commit_list_time_cmp(const void *a, const void *b);
+int git_commit_list_generation_cmp(const void *a, const void *b);
 void git_commit_list_free(git_commit_list **list_p);
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p);
 git_commit_list *git_commit_list_insert_by_date(git_commit_list_node *item, git_commit_list **list_p);
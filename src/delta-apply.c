@@ -133,3 +133,245 @@ fail:
 	giterr_set(GITERR_INVALID, "Failed to apply delta");
 	return -1;
 }
+
+/*
+ * Decode the next instruction of a delta. Copy instructions are
+ * returned with `*literal` set to NULL and the offset into the
+ * source in `*off`; insert instructions point `*literal` into the
+ * delta stream itself.
+ */
+static int delta_next_op(
+	const unsigned char **literal,
+	size_t *off,
+	size_t *len,
+	const unsigned char **delta,
+	const unsigned char *delta_end)
+{
+	const unsigned char *d = *delta;
+	unsigned char cmd = *d++;
+
+	if (cmd & 0x80) {
+		size_t o = 0, l = 0, i;
+
+		for (i = 0; i < 4; i++) {
+			if (!(cmd & (0x01 << i)))
+				continue;
+			if (d == delta_end)
+				return -1;
+			o |= ((size_t)*d++) << (i * 8);
+		}
+
+		for (i = 0; i < 3; i++) {
+			if (!(cmd & (0x10 << i)))
+				continue;
+			if (d == delta_end)
+				return -1;
+			l |= ((size_t)*d++) << (i * 8);
+		}
+
+		if (!l)
+			l = 0x10000;
+
+		*literal = NULL;
+		*off = o;
+		*len = l;
+	} else if (cmd) {
+		if ((size_t)(delta_end - d) < cmd)
+			return -1;
+
+		*literal = d;
+		*off = 0;
+		*len = cmd;
+		d += cmd;
+	} else {
+		/* cmd == 0 is reserved for future encodings. */
+		return -1;
+	}
+
+	*delta = d;
+	return 0;
+}
+
+static int chain_push(
+	git_delta_fragments *frags,
+	size_t *res_off,
+	const unsigned char *data,
+	size_t base_off,
+	size_t len)
+{
+	git_delta_fragment *last = git_array_last(*frags), *frag;
+
+	/* merge contiguous runs to keep the chain short */
+	if (last && ((!data && !last->data && last->base_off + last->len == base_off) ||
+		(data && last->data && last->data + last->len == data))) {
+		last->len += len;
+		*res_off += len;
+		return 0;
+	}
+
+	frag = git_array_alloc(*frags);
+	GITERR_CHECK_ALLOC(frag);
+
+	frag->res_off = *res_off;
+	frag->len = len;
+	frag->data = data;
+	frag->base_off = base_off;
+
+	*res_off += len;
+	return 0;
+}
+
+/* Find the fragment containing the given offset of the chain's result */
+static size_t chain_find(git_delta_fragments *frags, size_t off)
+{
+	size_t lo = 0, hi = git_array_size(*frags);
+
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (frags->ptr[mid].res_off <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static int chain_copy(
+	git_delta_chain *chain,
+	size_t *res_off,
+	size_t off,
+	size_t len)
+{
+	size_t pos = chain_find(&chain->frags, off);
+
+	while (len) {
+		git_delta_fragment *frag = git_array_get(chain->frags, pos);
+		size_t skip, n;
+
+		if (!frag) {
+			giterr_set(GITERR_INVALID, "Failed to compose delta");
+			return -1;
+		}
+
+		pos++;
+		skip = off - frag->res_off;
+		n = min(frag->len - skip, len);
+
+		if (chain_push(&chain->scratch, res_off,
+				frag->data ? frag->data + skip : NULL,
+				frag->data ? 0 : frag->base_off + skip, n) < 0)
+			return -1;
+
+		off += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+int git__delta_chain_add(
+	git_delta_chain *chain,
+	const unsigned char *delta,
+	size_t delta_len)
+{
+	const unsigned char *delta_end = delta + delta_len;
+	git_delta_fragments tmp;
+	size_t base_sz, res_sz, res_off = 0;
+
+	if (hdr_sz(&base_sz, &delta, delta_end) < 0 ||
+		(chain->depth && base_sz != chain->res_len)) {
+		giterr_set(GITERR_INVALID, "Failed to compose delta. Base size does not match given data");
+		return -1;
+	}
+
+	if (hdr_sz(&res_sz, &delta, delta_end) < 0) {
+		giterr_set(GITERR_INVALID, "Failed to compose delta. Base size does not match given data");
+		return -1;
+	}
+
+	chain->scratch.size = 0;
+
+	while (delta < delta_end) {
+		const unsigned char *literal;
+		size_t off, len, end;
+
+		if (delta_next_op(&literal, &off, &len, &delta, delta_end) < 0 ||
+			res_sz - res_off < len)
+			goto fail;
+
+		if (literal) {
+			if (chain_push(&chain->scratch, &res_off, literal, 0, len) < 0)
+				return -1;
+			continue;
+		}
+
+		if (GIT_ADD_SIZET_OVERFLOW(&end, off, len) || end > base_sz)
+			goto fail;
+
+		if (!chain->depth) {
+			if (chain_push(&chain->scratch, &res_off, NULL, off, len) < 0)
+				return -1;
+		} else if (chain_copy(chain, &res_off, off, len) < 0) {
+			return -1;
+		}
+	}
+
+	if (res_off != res_sz)
+		goto fail;
+
+	if (!chain->depth)
+		chain->base_len = base_sz;
+	chain->res_len = res_sz;
+	chain->depth++;
+
+	tmp = chain->frags;
+	chain->frags = chain->scratch;
+	chain->scratch = tmp;
+	return 0;
+
+fail:
+	giterr_set(GITERR_INVALID, "Failed to compose delta");
+	return -1;
+}
+
+int git__delta_chain_apply(
+	git_rawobj *out,
+	git_delta_chain *chain,
+	const unsigned char *base,
+	size_t base_len)
+{
+	unsigned char *res_dp;
+	size_t alloc_sz, i;
+
+	if (!chain->depth || chain->base_len != base_len) {
+		giterr_set(GITERR_INVALID, "Failed to apply delta. Base size does not match given data");
+		return -1;
+	}
+
+	GITERR_CHECK_ALLOC_ADD(&alloc_sz, chain->res_len, 1);
+	res_dp = git__malloc(alloc_sz);
+	GITERR_CHECK_ALLOC(res_dp);
+
+	res_dp[chain->res_len] = '\0';
+	out->data = res_dp;
+	out->len = chain->res_len;
+
+	for (i = 0; i < git_array_size(chain->frags); i++) {
+		git_delta_fragment *frag = git_array_get(chain->frags, i);
+
+		memcpy(res_dp + frag->res_off,
+			frag->data ? frag->data : base + frag->base_off,
+			frag->len);
+	}
+
+	return 0;
+}
+
+void git__delta_chain_free(git_delta_chain *chain)
+{
+	git_array_clear(chain->frags);
+	git_array_clear(chain->scratch);
+	chain->base_len = chain->res_len = chain->depth = 0;
+}
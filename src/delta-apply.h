@@ -8,6 +8,7 @@
 #define INCLUDE_delta_apply_h__
 
 #include "odb.h"
+#include "array.h"
 
 /**
  * Apply a git binary delta to recover the original content.
@@ -47,4 +48,74 @@ extern int git__delta_read_header(
 	size_t *base_sz,
 	size_t *res_sz);
 
+/**
+ * A run of bytes in the result of a composed delta chain: either a
+ * literal taken from one of the deltas in the chain, or a range that
+ * is copied from the chain's base object.
+ */
+typedef struct {
+	size_t res_off;
+	size_t len;
+	const unsigned char *data; /* literal data, NULL when copying from the base */
+	size_t base_off;
+} git_delta_fragment;
+
+typedef git_array_t(git_delta_fragment) git_delta_fragments;
+
+/**
+ * A chain of deltas that have been merged into a single list of
+ * instructions against the bottom-most base, so the final object can
+ * be produced without materializing any of the intermediate objects.
+ *
+ * Literal fragments point into the delta buffers that were added to
+ * the chain; those must stay alive until the chain is applied.
+ */
+typedef struct {
+	git_delta_fragments frags;
+	git_delta_fragments scratch;
+	size_t base_len;
+	size_t res_len;
+	size_t depth;
+} git_delta_chain;
+
+#define GIT_DELTA_CHAIN_INIT { GIT_ARRAY_INIT, GIT_ARRAY_INIT, 0, 0, 0 }
+
+/**
+ * Add a delta on top of the chain. The first delta added applies to
+ * the base object; every following one applies to the result of the
+ * previous delta.
+ *
+ * @param chain the chain to extend
+ * @param delta the delta to execute copy/insert instructions from.
+ * @param delta_len total number of bytes in the delta.
+ * @return
+ * - 0 on success
+ * - GIT_ERROR if the delta is corrupt or doesn't match the chain.
+ */
+extern int git__delta_chain_add(
+	git_delta_chain *chain,
+	const unsigned char *delta,
+	size_t delta_len);
+
+/**
+ * Apply a composed delta chain to its base, recovering the content of
+ * the object at the top of the chain with a single allocation.
+ *
+ * @param out the output buffer to receive the data; as with
+ *		`git__delta_apply`, only out->data and out->len are populated.
+ * @param chain the composed chain of deltas
+ * @param base the base to copy from during copy instructions.
+ * @param base_len number of bytes available at base.
+ * @return
+ * - 0 on a successful delta unpack.
+ * - GIT_ERROR if the chain doesn't match the base.
+ */
+extern int git__delta_chain_apply(
+	git_rawobj *out,
+	git_delta_chain *chain,
+	const unsigned char *base,
+	size_t base_len);
+
+extern void git__delta_chain_free(git_delta_chain *chain);
+
 #endif
@@ -306,11 +306,11 @@ static unsigned long finish_depth_computation(
 	while (git_pqueue_size(list) > 0) {
 		git_commit_list_node *c = git_pqueue_pop(list);
 		seen_commits++;
-		if (c->flags & best->flag_within) {
+		if (walk->store.flags[c->id] & best->flag_within) {
 			size_t index = 0;
 			while (git_pqueue_size(list) > index) {
 				git_commit_list_node *i = git_pqueue_get(list, index);
-				if (!(i->flags & best->flag_within))
+				if (!(walk->store.flags[i->id] & best->flag_within))
 					break;
 				index++;
 			}
@@ -319,13 +319,13 @@ static unsigned long finish_depth_computation(
 		} else
 			best->depth++;
 		for (i = 0; i < c->out_degree; i++) {
-			git_commit_list_node *p = c->parents[i];
+			git_commit_list_node *p = git_commit_store_parent(&walk->store, c, i);
 			if ((error = git_commit_list_parse(walk, p)) < 0)
 				return error;
-			if (!(p->flags & SEEN))
+			if (!(walk->store.flags[p->id] & SEEN))
 				if ((error = git_pqueue_insert(list, p)) < 0)
 					return error;
-			p->flags |= c->flags;
+			walk->store.flags[p->id] |= walk->store.flags[c->id];
 		}
 	}
 	return seen_commits;
@@ -485,7 +485,7 @@ static int describe(
 	if ((error = git_commit_list_parse(walk, cmit)) < 0)
 		goto cleanup;
 
-	cmit->flags = SEEN;
+	walk->store.flags[cmit->id] = SEEN;
 
 	if ((error = git_pqueue_insert(&list, cmit)) < 0)
 		goto cleanup;
@@ -514,7 +514,7 @@ static int describe(
 				t->depth = seen_commits - 1;
 				t->flag_within = 1u << match_cnt;
 				t->found_order = match_cnt;
-				c->flags |= t->flag_within;
+				walk->store.flags[c->id] |= t->flag_within;
 				if (n->prio == 2)
 					annotated_cnt++;
 			}
@@ -526,7 +526,7 @@ static int describe(
 
 		for (cur_match = 0; cur_match < match_cnt; cur_match++) {
 			struct possible_tag *t = git_vector_get(&all_matches, cur_match);
-			if (!(c->flags & t->flag_within))
+			if (!(walk->store.flags[c->id] & t->flag_within))
 				t->depth++;
 		}
 
@@ -542,13 +542,13 @@ static int describe(
 			break;
 		}
 		for (i = 0; i < c->out_degree; i++) {
-			git_commit_list_node *p = c->parents[i];
+			git_commit_list_node *p = git_commit_store_parent(&walk->store, c, i);
 			if ((error = git_commit_list_parse(walk, p)) < 0)
 				goto cleanup;
-			if (!(p->flags & SEEN))
+			if (!(walk->store.flags[p->id] & SEEN))
 				if ((error = git_pqueue_insert(&list, p)) < 0)
 					goto cleanup;
-			p->flags |= c->flags;
+			walk->store.flags[p->id] |= walk->store.flags[c->id];
 
 			if (data->opts->only_follow_first_parent)
 				break;
@@ -14,12 +14,16 @@
 #include "remote.h"
 #include "refspec.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "fetch.h"
 #include "netops.h"
+#include "odb.h"
 #include "repository.h"
 #include "refs.h"
+#include "shallow.h"
+#include "global.h"
 
-static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, git_refspec *tagspec, git_remote_autotag_option_t tagopt)
+static int maybe_want(git_remote *remote, git_remote_head *head, git_refspec *tagspec, git_remote_autotag_option_t tagopt)
 {
 	int match = 0;
 
@@ -41,14 +45,77 @@ static int maybe_want(git_remote *remote, git_remote_head *head, git_odb *odb, g
 	if (!match)
 		return 0;
 
-	/* If we have the object, mark it so we don't ask for it */
-	if (git_odb_exists(odb, &head->oid)) {
-		head->local = 1;
-	}
-	else
+	return git_vector_insert(&remote->refs, head);
+}
+
+static int oid_cmp_r(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid__cmp(a, b);
+}
+
+/*
+ * If we have the objects, mark them so we don't ask for them, unless
+ * we're deepening the history behind them.  The object database gets
+ * asked about all of them in one batch.
+ */
+static int mark_local_heads(git_remote *remote, git_odb *odb, bool deepen)
+{
+	git_oid *ids = NULL;
+	int *found = NULL;
+	git_remote_head *head;
+	size_t i, count = 0, lo, hi, mid;
+	int cmp, error = 0;
+
+	if (!remote->refs.length)
+		return 0;
+
+	if (deepen) {
 		remote->need_pack = 1;
+		return 0;
+	}
 
-	return git_vector_insert(&remote->refs, head);
+	ids = git__mallocarray(remote->refs.length, sizeof(git_oid));
+	found = git__calloc(remote->refs.length, sizeof(int));
+	if (!ids || !found) {
+		error = -1;
+		goto done;
+	}
+
+	git_vector_foreach(&remote->refs, i, head)
+		git_oid_cpy(&ids[i], &head->oid);
+
+	git__qsort_r(ids, remote->refs.length, sizeof(git_oid), oid_cmp_r, NULL);
+
+	for (i = 0; i < remote->refs.length; i++)
+		if (!count || git_oid__cmp(&ids[count - 1], &ids[i]))
+			git_oid_cpy(&ids[count++], &ids[i]);
+
+	if ((error = git_odb_exists_many(found, odb, ids, count)) < 0)
+		goto done;
+
+	git_vector_foreach(&remote->refs, i, head) {
+		for (lo = 0, hi = count; lo < hi; ) {
+			mid = lo + (hi - lo) / 2;
+
+			if ((cmp = git_oid__cmp(&head->oid, &ids[mid])) == 0)
+				break;
+			else if (cmp < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		if (lo < hi && found[mid])
+			head->local = 1;
+		else
+			remote->need_pack = 1;
+	}
+
+done:
+	git__free(ids);
+	git__free(found);
+	return error;
 }
 
 static int filter_wants(git_remote *remote, const git_fetch_options *opts)
@@ -59,6 +126,7 @@ static int filter_wants(git_remote *remote, const git_fetch_options *opts)
 	git_odb *odb;
 	size_t i, heads_len;
 	git_remote_autotag_option_t tagopt = remote->download_tags;
+	bool deepen = false;
 
 	if (opts && opts->download_tags != GIT_REMOTE_DOWNLOAD_TAGS_UNSPECIFIED)
 		tagopt = opts->download_tags;
@@ -90,17 +158,157 @@ static int filter_wants(git_remote *remote, const git_fetch_options *opts)
 	if (git_remote_ls((const git_remote_head ***)&heads, &heads_len, remote) < 0)
 		goto cleanup;
 
+	if (remote->depth || remote->shallow_since) {
+		if ((error = git_repository_is_shallow(remote->repo)) < 0)
+			goto cleanup;
+
+		deepen = (error > 0);
+		error = 0;
+	}
+
 	for (i = 0; i < heads_len; i++) {
-		if ((error = maybe_want(remote, heads[i], odb, &tagspec, tagopt)) < 0)
-			break;
+		if ((error = maybe_want(remote, heads[i], &tagspec, tagopt)) < 0)
+			goto cleanup;
 	}
 
+	error = mark_local_heads(remote, odb, deepen);
+
 cleanup:
 	git_refspec__free(&tagspec);
 
 	return error;
 }
 
+/*
+ * The filter configured for a promisor remote, which keeps applying
+ * to its fetches once the repository is a partial clone.
+ */
+static int promisor_filter(char **out, git_remote *remote)
+{
+	git_config *cfg;
+	git_buf key = GIT_BUF_INIT, filter = GIT_BUF_INIT;
+	int promisor = 0, error;
+
+	*out = NULL;
+
+	if (!remote->name)
+		return 0;
+
+	if ((error = git_repository_config__weakptr(&cfg, remote->repo)) < 0 ||
+		(error = git_buf_printf(&key, "remote.%s.promisor", remote->name)) < 0)
+		goto done;
+
+	if ((error = git_config_get_bool(&promisor, cfg, key.ptr)) < 0 || !promisor)
+		goto done;
+
+	git_buf_clear(&key);
+
+	if ((error = git_buf_printf(&key, "remote.%s.partialclonefilter", remote->name)) < 0 ||
+		(error = git_config_get_string_buf(&filter, cfg, key.ptr)) < 0)
+		goto done;
+
+	*out = git_buf_detach(&filter);
+
+done:
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	git_buf_free(&key);
+	git_buf_free(&filter);
+	return error;
+}
+
+static int setup_filter(git_remote *remote, const git_fetch_options *opts)
+{
+	git_pack_filter filter;
+
+	git__free(remote->filter);
+	remote->filter = NULL;
+
+	if (!opts || !opts->filter)
+		return promisor_filter(&remote->filter, remote);
+
+	if (git_pack_filter_parse(&filter, opts->filter) < 0)
+		return -1;
+
+	remote->filter = git__strdup(opts->filter);
+	GITERR_CHECK_ALLOC(remote->filter);
+
+	return 0;
+}
+
+static int setup_negotiation(git_remote *remote, const git_fetch_options *opts)
+{
+	static const git_cvar_map algorithms[] = {
+		{GIT_CVAR_STRING, "consecutive", GIT_FETCH_NEGOTIATION_CONSECUTIVE},
+		{GIT_CVAR_STRING, "default", GIT_FETCH_NEGOTIATION_CONSECUTIVE},
+		{GIT_CVAR_STRING, "skipping", GIT_FETCH_NEGOTIATION_SKIPPING},
+		{GIT_CVAR_STRING, "noop", GIT_FETCH_NEGOTIATION_NOOP},
+	};
+	git_config *cfg;
+	int algorithm, error;
+
+	remote->negotiation = GIT_FETCH_NEGOTIATION_CONSECUTIVE;
+
+	if (opts && opts->negotiation) {
+		remote->negotiation = opts->negotiation;
+		return 0;
+	}
+
+	if ((error = git_repository_config__weakptr(&cfg, remote->repo)) < 0)
+		return error;
+
+	error = git_config_get_mapped(&algorithm, cfg,
+		"fetch.negotiationAlgorithm", algorithms, ARRAY_SIZE(algorithms));
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (!error)
+		remote->negotiation = algorithm;
+
+	return error;
+}
+
+/*
+ * Objects left out by the filter are now promised by the remote;
+ * remember it, and have the object database fetch them on demand.
+ */
+static int record_promisor(git_remote *remote)
+{
+	git_config *cfg;
+	git_odb *odb;
+	git_buf key = GIT_BUF_INIT;
+	int error;
+
+	if (!remote->filter || !remote->name)
+		return 0;
+
+	if ((error = git_repository_config__weakptr(&cfg, remote->repo)) < 0 ||
+		(error = git_buf_printf(&key, "remote.%s.promisor", remote->name)) < 0 ||
+		(error = git_config_set_bool(cfg, key.ptr, true)) < 0)
+		goto done;
+
+	git_buf_clear(&key);
+
+	if ((error = git_buf_printf(&key, "remote.%s.partialclonefilter", remote->name)) < 0 ||
+		(error = git_config_set_string(cfg, key.ptr, remote->filter)) < 0)
+		goto done;
+
+	if ((error = git_repository_odb__weakptr(&odb, remote->repo)) < 0)
+		goto done;
+
+	error = git_odb__add_promisor(odb, remote->repo, remote->name);
+
+done:
+	git_buf_free(&key);
+	return error;
+}
+
 /*
  * In this first version, we push all our refs in and start sending
  * them out. When we get an ACK we hide that commit and continue
@@ -111,6 +319,19 @@ int git_fetch_negotiate(git_remote *remote, const git_fetch_options *opts)
 	git_transport *t = remote->transport;
 
 	remote->need_pack = 0;
+	remote->depth = opts ? opts->depth : 0;
+	remote->shallow_since = opts ? opts->shallow_since : 0;
+	git_array_clear(remote->shallow);
+	git_array_clear(remote->unshallow);
+
+	if (remote->depth < 0 || (remote->depth && remote->shallow_since)) {
+		giterr_set(GITERR_INVALID, "Invalid depth for the fetch");
+		return -1;
+	}
+
+	if (setup_filter(remote, opts) < 0 ||
+		setup_negotiation(remote, opts) < 0)
+		return -1;
 
 	if (filter_wants(remote, opts) < 0) {
 		giterr_set(GITERR_NET, "Failed to filter the reference list for wants");
@@ -131,11 +352,27 @@ int git_fetch_negotiate(git_remote *remote, const git_fetch_options *opts)
 		remote->refs.length);
 }
 
-int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *callbacks)
+/* Mark the pack as a promisor pack if objects may be missing behind it */
+static int download_pack(
+	git_remote *remote, bool promisor,
+	git_transfer_progress_cb progress, void *payload)
 {
 	git_transport *t = remote->transport;
+	bool promisor_pack = GIT_GLOBAL->promisor_pack;
+	int error;
+
+	GIT_GLOBAL->promisor_pack = promisor;
+	error = t->download_pack(t, remote->repo, &remote->stats, progress, payload);
+	GIT_GLOBAL->promisor_pack = promisor_pack;
+
+	return error;
+}
+
+int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *callbacks)
+{
 	git_transfer_progress_cb progress = NULL;
 	void *payload = NULL;
+	int error;
 
 	if (!remote->need_pack)
 		return 0;
@@ -145,7 +382,78 @@ int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *call
 		payload  = callbacks->payload;
 	}
 
-	return t->download_pack(t, remote->repo, &remote->stats, progress, payload);
+	/* the objects left out by a filter are promised by the remote */
+	if ((error = download_pack(remote, remote->filter != NULL, progress, payload)) < 0)
+		return error;
+
+	/* record where the history of the repository is now cut off */
+	if ((error = git_shallow__update(remote->repo, &remote->shallow, &remote->unshallow)) < 0)
+		return error;
+
+	return record_promisor(remote);
+}
+
+int git_fetch__objects(
+	git_remote *remote,
+	const git_oid *ids,
+	size_t count,
+	const git_remote_callbacks *callbacks)
+{
+	git_transfer_progress_cb progress = NULL;
+	void *payload = NULL;
+	git_remote_head *heads, **wants;
+	git_transport *t;
+	size_t i;
+	int error;
+
+	heads = git__calloc(count, sizeof(git_remote_head));
+	wants = git__calloc(count, sizeof(git_remote_head *));
+
+	if (!heads || !wants) {
+		error = -1;
+		goto done;
+	}
+
+	/* these are no references, but the transports only need the ids */
+	for (i = 0; i < count; i++) {
+		git_oid_cpy(&heads[i].oid, &ids[i]);
+		wants[i] = &heads[i];
+	}
+
+	remote->depth = 0;
+	remote->shallow_since = 0;
+	git_array_clear(remote->shallow);
+	git_array_clear(remote->unshallow);
+
+	if ((error = setup_filter(remote, NULL)) < 0)
+		goto done;
+
+	/* the objects are wanted no matter what we have */
+	remote->negotiation = GIT_FETCH_NEGOTIATION_NOOP;
+
+	/* the refs aren't needed, so keep the advertisement short */
+	if (!git_remote_connected(remote) &&
+		((error = git_remote__add_ref_prefix(remote, GIT_HEAD_FILE)) < 0 ||
+		 (error = git_remote_connect(remote, GIT_DIRECTION_FETCH, callbacks, NULL)) < 0))
+		goto done;
+
+	t = remote->transport;
+
+	if (callbacks) {
+		progress = callbacks->transfer_progress;
+		payload = callbacks->payload;
+	}
+
+	if ((error = t->negotiate_fetch(t, remote->repo,
+			(const git_remote_head * const *)wants, count)) < 0 ||
+		(error = download_pack(remote, true, progress, payload)) < 0)
+		goto done;
+
+done:
+	git_remote_disconnect(remote);
+	git__free(wants);
+	git__free(heads);
+	return error;
 }
 
 int git_fetch_init_options(git_fetch_options *opts, unsigned int version)
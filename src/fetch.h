@@ -15,4 +15,14 @@ int git_fetch_download_pack(git_remote *remote, const git_remote_callbacks *call
 
 int git_fetch_setup_walk(git_revwalk **out, git_repository *repo);
 
+/*
+ * Fetch the given objects from a promisor remote in a single request,
+ * with the remote's object filter applied to what they point to.
+ */
+int git_fetch__objects(
+	git_remote *remote,
+	const git_oid *ids,
+	size_t count,
+	const git_remote_callbacks *callbacks);
+
 #endif
@@ -17,6 +17,7 @@
 #endif
 
 git_mutex git__mwindow_mutex;
+git_mutex git__stream_pool_mutex;
 
 #define MAX_SHUTDOWN_CB 8
 
@@ -45,7 +46,8 @@ static void git__global_state_cleanup(git_global_st *st)
 	if (!st)
 		return;
 
-	git__free(st->error_t.message);
+	/* the message lives in the buffer, unless it has been captured */
+	git_buf_free(&st->error_buf);
 	st->error_t.message = NULL;
 }
 
@@ -208,7 +210,8 @@ static int synchronized_threads_init(void)
 	int error;
 
 	_tls_index = TlsAlloc();
-	if (git_mutex_init(&git__mwindow_mutex))
+	if (git_mutex_init(&git__mwindow_mutex) ||
+		git_mutex_init(&git__stream_pool_mutex))
 		return -1;
 
 	/* Initialize any other subsystems that have global state */
@@ -253,6 +256,7 @@ static void synchronized_threads_shutdown(void)
 
 	TlsFree(_tls_index);
 	git_mutex_free(&git__mwindow_mutex);
+	git_mutex_free(&git__stream_pool_mutex);
 }
 
 int git_libgit2_shutdown(void)
@@ -329,7 +333,8 @@ static void cb__free_status(void *st)
 
 static void init_once(void)
 {
-	if ((init_error = git_mutex_init(&git__mwindow_mutex)) != 0)
+	if ((init_error = git_mutex_init(&git__mwindow_mutex)) != 0 ||
+		(init_error = git_mutex_init(&git__stream_pool_mutex)) != 0)
 		return;
 	pthread_key_create(&_tls_key, &cb__free_status);
 
@@ -376,6 +381,7 @@ int git_libgit2_shutdown(void)
 
 	pthread_key_delete(_tls_key);
 	git_mutex_free(&git__mwindow_mutex);
+	git_mutex_free(&git__stream_pool_mutex);
 	_once_init = new_once;
 
 	return 0;
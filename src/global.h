@@ -16,6 +16,15 @@ typedef struct {
 	git_error error_t;
 	git_buf error_buf;
 	char oid_fmt[GIT_OID_HEXSZ+1];
+
+	/* a promisor backend is fetching on this thread */
+	bool promisor_fetching;
+
+	/* the packs written on this thread come from a promisor remote */
+	bool promisor_pack;
+
+	/* the transaction locking references on this thread */
+	const void *refdb_txn;
 } git_global_st;
 
 #ifdef GIT_OPENSSL
@@ -26,6 +35,7 @@ extern SSL_CTX *git__ssl_ctx;
 git_global_st *git__global_state(void);
 
 extern git_mutex git__mwindow_mutex;
+extern git_mutex git__stream_pool_mutex;
 
 #define GIT_GLOBAL (git__global_state())
 
@@ -9,18 +9,18 @@
 #include "merge.h"
 #include "git2/graph.h"
 
-static int interesting(git_pqueue *list, git_commit_list *roots)
+static int interesting(git_revwalk *walk, git_pqueue *list, git_commit_list *roots)
 {
 	unsigned int i;
 
 	for (i = 0; i < git_pqueue_size(list); i++) {
 		git_commit_list_node *commit = git_pqueue_get(list, i);
-		if ((commit->flags & STALE) == 0)
+		if ((walk->store.flags[commit->id] & STALE) == 0)
 			return 1;
 	}
 
 	while(roots) {
-		if ((roots->item->flags & STALE) == 0)
+		if ((walk->store.flags[roots->item->id] & STALE) == 0)
 			return 1;
 		roots = roots->next;
 	}
@@ -37,7 +37,7 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 
 	/* if the commit is repeated, we have a our merge base already */
 	if (one == two) {
-		one->flags |= PARENT1 | PARENT2 | RESULT;
+		walk->store.flags[one->id] |= PARENT1 | PARENT2 | RESULT;
 		return 0;
 	}
 
@@ -46,41 +46,40 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 
 	if (git_commit_list_parse(walk, one) < 0)
 		goto on_error;
-	one->flags |= PARENT1;
+	walk->store.flags[one->id] |= PARENT1;
 	if (git_pqueue_insert(&list, one) < 0)
 		goto on_error;
 
 	if (git_commit_list_parse(walk, two) < 0)
 		goto on_error;
-	two->flags |= PARENT2;
+	walk->store.flags[two->id] |= PARENT2;
 	if (git_pqueue_insert(&list, two) < 0)
 		goto on_error;
 
 	/* as long as there are non-STALE commits */
-	while (interesting(&list, roots)) {
+	while (interesting(walk, &list, roots)) {
 		git_commit_list_node *commit = git_pqueue_pop(&list);
 		int flags;
 
 		if (commit == NULL)
 			break;
 
-		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
+		flags = walk->store.flags[commit->id] & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
-			if (!(commit->flags & RESULT))
-				commit->flags |= RESULT;
+			walk->store.flags[commit->id] |= RESULT;
 			/* we mark the parents of a merge stale */
 			flags |= STALE;
 		}
 
 		for (i = 0; i < commit->out_degree; i++) {
-			git_commit_list_node *p = commit->parents[i];
-			if ((p->flags & flags) == flags)
+			git_commit_list_node *p = git_commit_store_parent(&walk->store, commit, i);
+			if ((walk->store.flags[p->id] & flags) == flags)
 				continue;
 
 			if (git_commit_list_parse(walk, p) < 0)
 				goto on_error;
 
-			p->flags |= flags;
+			walk->store.flags[p->id] |= flags;
 			if (git_pqueue_insert(&list, p) < 0)
 				goto on_error;
 		}
@@ -103,11 +102,13 @@ on_error:
 }
 
 
-static int ahead_behind(git_commit_list_node *one, git_commit_list_node *two,
+static int ahead_behind(git_revwalk *walk,
+	git_commit_list_node *one, git_commit_list_node *two,
 	size_t *ahead, size_t *behind)
 {
 	git_commit_list_node *commit;
 	git_pqueue pq;
+	uint8_t flags;
 	int error = 0, i;
 	*ahead = 0;
 	*behind = 0;
@@ -120,20 +121,22 @@ static int ahead_behind(git_commit_list_node *one, git_commit_list_node *two,
 		goto done;
 
 	while ((commit = git_pqueue_pop(&pq)) != NULL) {
-		if (commit->flags & RESULT ||
-			(commit->flags & (PARENT1 | PARENT2)) == (PARENT1 | PARENT2))
+		flags = walk->store.flags[commit->id];
+
+		if (flags & RESULT ||
+			(flags & (PARENT1 | PARENT2)) == (PARENT1 | PARENT2))
 			continue;
-		else if (commit->flags & PARENT1)
+		else if (flags & PARENT1)
 			(*ahead)++;
-		else if (commit->flags & PARENT2)
+		else if (flags & PARENT2)
 			(*behind)++;
 
 		for (i = 0; i < commit->out_degree; i++) {
-			git_commit_list_node *p = commit->parents[i];
+			git_commit_list_node *p = git_commit_store_parent(&walk->store, commit, i);
 			if ((error = git_pqueue_insert(&pq, p)) < 0)
 				goto done;
 		}
-		commit->flags |= RESULT;
+		walk->store.flags[commit->id] |= RESULT;
 	}
 
 done:
@@ -160,7 +163,7 @@ int git_graph_ahead_behind(size_t *ahead, size_t *behind, git_repository *repo,
 
 	if (mark_parents(walk, commit_l, commit_u) < 0)
 		goto on_error;
-	if (ahead_behind(commit_l, commit_u, ahead, behind) < 0)
+	if (ahead_behind(walk, commit_l, commit_u, ahead, behind) < 0)
 		goto on_error;
 
 	git_revwalk_free(walk);
@@ -9,6 +9,7 @@
 #include "git2/object.h"
 
 #include "common.h"
+#include "indexer.h"
 #include "pack.h"
 #include "mwindow.h"
 #include "posix.h"
@@ -35,7 +36,8 @@ struct git_indexer {
 	unsigned int parsed_header :1,
 		opened_pack :1,
 		have_stream :1,
-		have_delta :1;
+		have_delta :1,
+		committed :1;
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
 	unsigned int mode;
@@ -676,53 +678,111 @@ static void seek_back_trailer(git_indexer *idx)
 	git_mwindow_free_all(&idx->pack->mwf);
 }
 
+/* Append everything the deflate stream produces to the pack */
+static int append_zstream(git_indexer *idx, git_zstream *zs, uint32_t *crc)
+{
+	size_t written;
+
+	while (!git_zstream_done(zs)) {
+		written = sizeof(idx->objbuf);
+
+		if (git_zstream_get_output(idx->objbuf, &written, zs) < 0 ||
+			append_to_pack(idx, idx->objbuf, written) < 0)
+			return -1;
+
+		idx->pack->mwf.size += written;
+		*crc = crc32(*crc, (unsigned char *)idx->objbuf, (uInt)written);
+	}
+
+	return 0;
+}
+
+/*
+ * Big objects are streamed out of the object database and stored
+ * uncompressed, the same way the packbuilder writes them.
+ */
+static int append_object_stream(git_indexer *idx, git_odb_stream *stream, git_zstream *zs, uint32_t *crc)
+{
+	char buf[8 * 1024];
+	int read;
+
+	if (git_zstream_set_level(zs, Z_NO_COMPRESSION) < 0)
+		return -1;
+
+	while ((read = git_odb_stream_read(stream, buf, sizeof(buf))) > 0) {
+		if (git_zstream_set_input_partial(zs, buf, read) < 0 ||
+			append_zstream(idx, zs, crc) < 0)
+			return -1;
+	}
+
+	if (read < 0 || git_zstream_set_input(zs, NULL, 0) < 0)
+		return -1;
+
+	return append_zstream(idx, zs, crc);
+}
+
 static int inject_object(git_indexer *idx, git_oid *id)
 {
-	git_odb_object *obj;
-	struct entry *entry;
+	git_odb_object *obj = NULL;
+	git_odb_stream *stream = NULL;
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	struct entry *entry = NULL;
 	struct git_pack_entry *pentry = NULL;
 	git_oid foo = {{0}};
 	unsigned char hdr[64];
-	git_buf buf = GIT_BUF_INIT;
 	git_off_t entry_start;
-	const void *data;
+	git_otype type;
 	size_t len, hdr_len;
 	int error;
 
 	seek_back_trailer(idx);
 	entry_start = idx->pack->mwf.size;
 
-	if (git_odb_read(&obj, idx->odb, id) < 0) {
+	if (git_odb_read_header(&len, &type, idx->odb, id) < 0) {
 		giterr_set(GITERR_INDEXER, "missing delta bases");
 		return -1;
 	}
 
-	data = git_odb_object_data(obj);
-	len = git_odb_object_size(obj);
+	if (len > idx->odb->big_file_threshold &&
+		git_odb_open_rstream(&stream, idx->odb, id) < 0) {
+		giterr_clear();
+		stream = NULL;
+	}
 
-	entry = git__calloc(1, sizeof(*entry));
-	GITERR_CHECK_ALLOC(entry);
+	if (!stream && git_odb_read(&obj, idx->odb, id) < 0) {
+		giterr_set(GITERR_INDEXER, "missing delta bases");
+		return -1;
+	}
+
+	if ((entry = git__calloc(1, sizeof(*entry))) == NULL) {
+		error = -1;
+		goto cleanup;
+	}
 
 	entry->crc = crc32(0L, Z_NULL, 0);
 
 	/* Write out the object header */
-	hdr_len = git_packfile__object_header(hdr, len, git_odb_object_type(obj));
+	hdr_len = git_packfile__object_header(hdr, len, type);
 	if ((error = append_to_pack(idx, hdr, hdr_len)) < 0)
 		goto cleanup;
 
 	idx->pack->mwf.size += hdr_len;
 	entry->crc = crc32(entry->crc, hdr, (uInt)hdr_len);
 
-	if ((error = git_zstream_deflatebuf(&buf, data, len)) < 0)
+	if ((error = git_zstream_init(&zs)) < 0)
 		goto cleanup;
 
 	/* And then the compressed object */
-	if ((error = append_to_pack(idx, buf.ptr, buf.size)) < 0)
+	if (stream)
+		error = append_object_stream(idx, stream, &zs, &entry->crc);
+	else if ((error = git_zstream_set_input(&zs,
+			git_odb_object_data(obj), git_odb_object_size(obj))) == 0)
+		error = append_zstream(idx, &zs, &entry->crc);
+
+	if (error < 0)
 		goto cleanup;
 
-	idx->pack->mwf.size += buf.size;
-	entry->crc = htonl(crc32(entry->crc, (unsigned char *)buf.ptr, (uInt)buf.size));
-	git_buf_free(&buf);
+	entry->crc = htonl(entry->crc);
 
 	/* Write a fake trailer so the pack functions play ball */
 
@@ -731,8 +791,10 @@ static int inject_object(git_indexer *idx, git_oid *id)
 
 	idx->pack->mwf.size += GIT_OID_RAWSZ;
 
-	pentry = git__calloc(1, sizeof(struct git_pack_entry));
-	GITERR_CHECK_ALLOC(pentry);
+	if ((pentry = git__calloc(1, sizeof(struct git_pack_entry))) == NULL) {
+		error = -1;
+		goto cleanup;
+	}
 
 	git_oid_cpy(&pentry->sha1, id);
 	git_oid_cpy(&entry->oid, id);
@@ -746,6 +808,8 @@ cleanup:
 		git__free(pentry);
 	}
 
+	git_zstream_free(&zs);
+	git_odb_stream_free(stream);
 	git_odb_object_free(obj);
 	return error;
 }
@@ -1050,6 +1114,7 @@ int git_indexer_commit(git_indexer *idx, git_transfer_progress *stats)
 
 	/* And don't forget to rename the packfile to its new place. */
 	p_rename(idx->pack->pack_name, git_buf_cstr(&filename));
+	idx->committed = 1;
 
 	git_buf_free(&filename);
 	git_hash_ctx_cleanup(&ctx);
@@ -1063,11 +1128,28 @@ on_error:
 	return -1;
 }
 
+int git_indexer__complete(const git_indexer *idx, const git_transfer_progress *stats)
+{
+	return idx->parsed_header &&
+		stats->received_objects == idx->nr_objects &&
+		idx->pack->mwf.size >= idx->off + GIT_OID_RAWSZ;
+}
+
 void git_indexer_free(git_indexer *idx)
 {
+	git_buf tmp_path = GIT_BUF_INIT;
+
 	if (idx == NULL)
 		return;
 
+	/* a pack we didn't finish is of no use to anyone */
+	if (idx->pack && !idx->committed)
+		git_buf_puts(&tmp_path, idx->pack->pack_name);
+
+	/* the pack ended in the middle of an object */
+	if (idx->have_stream)
+		git_packfile_stream_free(&idx->stream);
+
 	git_vector_free_deep(&idx->objects);
 
 	if (idx->pack && idx->pack->idx_cache) {
@@ -1085,6 +1167,10 @@ void git_indexer_free(git_indexer *idx)
 		git_mutex_unlock(&git__mwindow_mutex);
 	}
 
+	if (git_buf_len(&tmp_path))
+		p_unlink(git_buf_cstr(&tmp_path));
+
+	git_buf_free(&tmp_path);
 	git_hash_ctx_cleanup(&idx->trailer);
 	git_hash_ctx_cleanup(&idx->hash_ctx);
 	git__free(idx);
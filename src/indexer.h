@@ -0,0 +1,18 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_indexer_h__
+#define INCLUDE_indexer_h__
+
+#include "git2/indexer.h"
+
+/*
+ * Whether the whole pack, up to its trailer, has been appended. A pack
+ * on a connection which stays open has no other end.
+ */
+extern int git_indexer__complete(const git_indexer *idx, const git_transfer_progress *stats);
+
+#endif
@@ -304,40 +304,42 @@ on_error:
 	return -1;
 }
 
-static int interesting(git_pqueue *list)
+static int interesting(git_revwalk *walk, git_pqueue *list)
 {
 	size_t i;
 
 	for (i = 0; i < git_pqueue_size(list); i++) {
 		git_commit_list_node *commit = git_pqueue_get(list, i);
-		if ((commit->flags & STALE) == 0)
+		if ((walk->store.flags[commit->id] & STALE) == 0)
 			return 1;
 	}
 
 	return 0;
 }
 
-static void clear_commit_marks_1(git_commit_list **plist,
+static void clear_commit_marks_1(git_revwalk *walk, git_commit_list **plist,
 		git_commit_list_node *commit, unsigned int mark)
 {
 	while (commit) {
 		unsigned int i;
 
-		if (!(mark & commit->flags))
+		if (!(mark & walk->store.flags[commit->id]))
 			return;
 
-		commit->flags &= ~mark;
+		walk->store.flags[commit->id] &= ~mark;
 
 		for (i = 1; i < commit->out_degree; i++) {
-			git_commit_list_node *p = commit->parents[i];
+			git_commit_list_node *p = git_commit_store_parent(&walk->store, commit, i);
 			git_commit_list_insert(p, plist);
 		}
 
-		commit = commit->out_degree ? commit->parents[0] : NULL;
+		commit = commit->out_degree ?
+			git_commit_store_parent(&walk->store, commit, 0) : NULL;
 	}
 }
 
-static void clear_commit_marks_many(git_vector *commits, unsigned int mark)
+static void clear_commit_marks_many(
+	git_revwalk *walk, git_vector *commits, unsigned int mark)
 {
 	git_commit_list *list = NULL;
 	git_commit_list_node *c;
@@ -348,15 +350,16 @@ static void clear_commit_marks_many(git_vector *commits, unsigned int mark)
 	}
 
 	while (list)
-		clear_commit_marks_1(&list, git_commit_list_pop(&list), mark);
+		clear_commit_marks_1(walk, &list, git_commit_list_pop(&list), mark);
 }
 
-static void clear_commit_marks(git_commit_list_node *commit, unsigned int mark)
+static void clear_commit_marks(
+	git_revwalk *walk, git_commit_list_node *commit, unsigned int mark)
 {
 	git_commit_list *list = NULL;
 	git_commit_list_insert(commit, &list);
 	while (list)
-		clear_commit_marks_1(&list, git_commit_list_pop(&list), mark);
+		clear_commit_marks_1(walk, &list, git_commit_list_pop(&list), mark);
 }
 
 static int paint_down_to_common(
@@ -372,7 +375,7 @@ static int paint_down_to_common(
 	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_time_cmp) < 0)
 		return -1;
 
-	one->flags |= PARENT1;
+	walk->store.flags[one->id] |= PARENT1;
 	if (git_pqueue_insert(&list, one) < 0)
 		return -1;
 
@@ -380,24 +383,24 @@ static int paint_down_to_common(
 		if (git_commit_list_parse(walk, two) < 0)
 			return -1;
 
-		two->flags |= PARENT2;
+		walk->store.flags[two->id] |= PARENT2;
 
 		if (git_pqueue_insert(&list, two) < 0)
 			return -1;
 	}
 
 	/* as long as there are non-STALE commits */
-	while (interesting(&list)) {
+	while (interesting(walk, &list)) {
 		git_commit_list_node *commit = git_pqueue_pop(&list);
 		int flags;
 
 		if (commit == NULL)
 			break;
 
-		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
+		flags = walk->store.flags[commit->id] & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
-			if (!(commit->flags & RESULT)) {
-				commit->flags |= RESULT;
+			if (!(walk->store.flags[commit->id] & RESULT)) {
+				walk->store.flags[commit->id] |= RESULT;
 				if (git_commit_list_insert(commit, &result) == NULL)
 					return -1;
 			}
@@ -406,14 +409,14 @@ static int paint_down_to_common(
 		}
 
 		for (i = 0; i < commit->out_degree; i++) {
-			git_commit_list_node *p = commit->parents[i];
-			if ((p->flags & flags) == flags)
+			git_commit_list_node *p = git_commit_store_parent(&walk->store, commit, i);
+			if ((walk->store.flags[p->id] & flags) == flags)
 				continue;
 
 			if ((error = git_commit_list_parse(walk, p)) < 0)
 				return error;
 
-			p->flags |= flags;
+			walk->store.flags[p->id] |= flags;
 			if (git_pqueue_insert(&list, p) < 0)
 				return -1;
 		}
@@ -464,17 +467,17 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 		if (error < 0)
 			goto done;
 
-		if (commit->flags & PARENT2)
+		if (walk->store.flags[commit->id] & PARENT2)
 			redundant[i] = 1;
 
 		for (j = 0; j < work.length; j++) {
 			git_commit_list_node *w = work.contents[j];
-			if (w->flags & PARENT1)
+			if (walk->store.flags[w->id] & PARENT1)
 				redundant[filled_index[j]] = 1;
 		}
 
-		clear_commit_marks(commit, ALL_FLAGS);
-		clear_commit_marks_many(&work, ALL_FLAGS);
+		clear_commit_marks(walk, commit, ALL_FLAGS);
+		clear_commit_marks_many(walk, &work, ALL_FLAGS);
 
 		git_commit_list_free(&common);
 	}
@@ -523,7 +526,7 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 
 	while (tmp) {
 		git_commit_list_node *c = git_commit_list_pop(&tmp);
-		if (!(c->flags & STALE))
+		if (!(walk->store.flags[c->id] & STALE))
 			if (git_commit_list_insert_by_date(c, &result) == NULL)
 				return -1;
 	}
@@ -538,8 +541,8 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 		while (result)
 			git_vector_insert(&redundant, git_commit_list_pop(&result));
 
-		clear_commit_marks(one, ALL_FLAGS);
-		clear_commit_marks_many(twos, ALL_FLAGS);
+		clear_commit_marks(walk, one, ALL_FLAGS);
+		clear_commit_marks_many(walk, twos, ALL_FLAGS);
 
 		if ((error = remove_redundant(walk, &redundant)) < 0) {
 			git_vector_free(&redundant);
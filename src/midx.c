@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "midx.h"
+#include "array.h"
+#include "filebuf.h"
+#include "mwindow.h"
+#include "pack.h"
+#include "path.h"
+#include "vector.h"
+
+typedef struct {
+	git_oid id;
+	git_off_t offset;
+	uint32_t pack_id;
+} midx_entry;
+
+typedef struct {
+	git_vector packs;
+	git_array_t(midx_entry) entries;
+	uint32_t pack_id;
+	struct git_pack_file *pack;
+} midx_writer;
+
+static const char *midx_pack_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+static int midx_pack_cmp(const void *a, const void *b)
+{
+	const struct git_pack_file *pa = a, *pb = b;
+	return strcmp(pa->pack_name, pb->pack_name);
+}
+
+static int midx_load_pack__cb(void *payload, git_buf *path)
+{
+	midx_writer *w = payload;
+	struct git_pack_file *p;
+	int error;
+
+	if (git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0;
+
+	error = git_mwindow_get_pack(&p, path->ptr);
+
+	/* ignore missing .pack file as the pack backend does */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (error < 0)
+		return error;
+
+	if ((error = git_vector_insert(&w->packs, p)) < 0)
+		git_mwindow_put_pack(p);
+
+	return error;
+}
+
+static int midx_add_entry__cb(const git_oid *id, void *payload)
+{
+	midx_writer *w = payload;
+	struct git_pack_entry e;
+	midx_entry *entry;
+
+	if (git_pack_entry_find(&e, w->pack, id, GIT_OID_HEXSZ) < 0)
+		return -1;
+
+	entry = git_array_alloc(w->entries);
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->id, id);
+	entry->offset = e.offset;
+	entry->pack_id = w->pack_id;
+	return 0;
+}
+
+/*
+ * Order the entries by object id; for duplicates, put the copy from
+ * the youngest pack first, as it's the one the pack backend would
+ * find first too.
+ */
+static int midx_entry_cmp(const void *a, const void *b, void *payload)
+{
+	const midx_entry *ea = a, *eb = b;
+	midx_writer *w = payload;
+	struct git_pack_file *pa, *pb;
+	int cmp;
+
+	if ((cmp = git_oid_cmp(&ea->id, &eb->id)) != 0)
+		return cmp;
+
+	pa = git_vector_get(&w->packs, ea->pack_id);
+	pb = git_vector_get(&w->packs, eb->pack_id);
+
+	if (pa->mtime != pb->mtime)
+		return pa->mtime < pb->mtime ? 1 : -1;
+
+	return (int)ea->pack_id - (int)eb->pack_id;
+}
+
+static int write_u32(git_filebuf *file, uint32_t n)
+{
+	n = htonl(n);
+	return git_filebuf_write(file, &n, sizeof(n));
+}
+
+static int write_u64(git_filebuf *file, uint64_t n)
+{
+	if (write_u32(file, (uint32_t)(n >> 32)) < 0)
+		return -1;
+
+	return write_u32(file, (uint32_t)(n & 0xffffffff));
+}
+
+static int write_chunk_header(git_filebuf *file, uint32_t id, uint64_t offset)
+{
+	if (write_u32(file, id) < 0)
+		return -1;
+
+	return write_u64(file, offset);
+}
+
+static int midx_write_file(git_filebuf *file, midx_writer *w, size_t nr)
+{
+	struct git_pack_file *p;
+	midx_entry *entry;
+	const char *name;
+	uint32_t fanout[256] = {0};
+	size_t i, names_len = 0, nr_large = 0, nr_chunks;
+	uint64_t offset;
+	unsigned char header[12], pad[4] = {0};
+	git_oid hash;
+
+	git_vector_foreach(&w->packs, i, p) {
+		names_len += strlen(midx_pack_basename(p->pack_name)) -
+			strlen(".pack") + strlen(".idx") + 1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		entry = git_array_get(w->entries, i);
+		fanout[entry->id.id[0]]++;
+
+		if ((uint64_t)entry->offset > 0x7fffffff)
+			nr_large++;
+	}
+
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	nr_chunks = nr_large ? 5 : 4;
+
+	header[0] = 'M'; header[1] = 'I'; header[2] = 'D'; header[3] = 'X';
+	header[4] = GIT_MIDX_VERSION;
+	header[5] = GIT_MIDX_OID_VERSION;
+	header[6] = (unsigned char)nr_chunks;
+	header[7] = 0; /* no base files */
+
+	if (git_filebuf_write(file, header, 8) < 0 ||
+		write_u32(file, (uint32_t)w->packs.length) < 0)
+		return -1;
+
+	/* chunk lookup table, terminated by the offset of the trailer */
+	offset = 12 + (nr_chunks + 1) * 12;
+
+	if (write_chunk_header(file, GIT_MIDX_CHUNK_PACKNAMES, offset) < 0)
+		return -1;
+	offset += (names_len + 3) & ~3;
+
+	if (write_chunk_header(file, GIT_MIDX_CHUNK_OIDFANOUT, offset) < 0)
+		return -1;
+	offset += sizeof(fanout);
+
+	if (write_chunk_header(file, GIT_MIDX_CHUNK_OIDLOOKUP, offset) < 0)
+		return -1;
+	offset += nr * GIT_OID_RAWSZ;
+
+	if (write_chunk_header(file, GIT_MIDX_CHUNK_OBJECTOFFSETS, offset) < 0)
+		return -1;
+	offset += nr * 8;
+
+	if (nr_large) {
+		if (write_chunk_header(file, GIT_MIDX_CHUNK_LARGEOFFSETS, offset) < 0)
+			return -1;
+		offset += nr_large * 8;
+	}
+
+	if (write_chunk_header(file, 0, offset) < 0)
+		return -1;
+
+	/* PNAM: the names of the pack indices, sorted and NUL-terminated */
+	git_vector_foreach(&w->packs, i, p) {
+		name = midx_pack_basename(p->pack_name);
+
+		if (git_filebuf_write(file, (void *)name, strlen(name) - strlen(".pack")) < 0 ||
+			git_filebuf_write(file, ".idx", strlen(".idx") + 1) < 0)
+			return -1;
+	}
+
+	if ((names_len & 3) &&
+		git_filebuf_write(file, pad, 4 - (names_len & 3)) < 0)
+		return -1;
+
+	/* OIDF */
+	for (i = 0; i < 256; i++) {
+		if (write_u32(file, fanout[i]) < 0)
+			return -1;
+	}
+
+	/* OIDL */
+	for (i = 0; i < nr; i++) {
+		entry = git_array_get(w->entries, i);
+
+		if (git_filebuf_write(file, entry->id.id, GIT_OID_RAWSZ) < 0)
+			return -1;
+	}
+
+	/* OOFF */
+	for (i = 0, nr_large = 0; i < nr; i++) {
+		entry = git_array_get(w->entries, i);
+
+		if (write_u32(file, entry->pack_id) < 0)
+			return -1;
+
+		if ((uint64_t)entry->offset > 0x7fffffff) {
+			if (write_u32(file, 0x80000000 | (uint32_t)nr_large++) < 0)
+				return -1;
+		} else if (write_u32(file, (uint32_t)entry->offset) < 0)
+			return -1;
+	}
+
+	/* LOFF */
+	for (i = 0; i < nr && nr_large; i++) {
+		entry = git_array_get(w->entries, i);
+
+		if ((uint64_t)entry->offset > 0x7fffffff &&
+			write_u64(file, (uint64_t)entry->offset) < 0)
+			return -1;
+	}
+
+	if (git_filebuf_hash(&hash, file) < 0)
+		return -1;
+
+	return git_filebuf_write(file, hash.id, GIT_OID_RAWSZ);
+}
+
+int git_midx_write(const char *pack_dir)
+{
+	midx_writer w = {{0}};
+	git_buf path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	struct git_pack_file *p;
+	midx_entry *entry, *last = NULL;
+	size_t i, nr = 0;
+	int error;
+
+	if ((error = git_vector_init(&w.packs, 8, midx_pack_cmp)) < 0 ||
+		(error = git_buf_sets(&path, pack_dir)) < 0 ||
+		(error = git_path_direach(&path, 0, midx_load_pack__cb, &w)) < 0)
+		goto done;
+
+	git_vector_sort(&w.packs);
+
+	git_vector_foreach(&w.packs, i, p) {
+		w.pack = p;
+		w.pack_id = (uint32_t)i;
+
+		if ((error = git_pack_foreach_entry(p, midx_add_entry__cb, &w)) < 0)
+			goto done;
+	}
+
+	if (w.entries.size)
+		git__qsort_r(w.entries.ptr, w.entries.size, sizeof(midx_entry),
+			midx_entry_cmp, &w);
+
+	/* keep only the first (preferred) copy of each object */
+	for (i = 0; i < w.entries.size; i++) {
+		entry = git_array_get(w.entries, i);
+
+		if (last && git_oid_equal(&last->id, &entry->id))
+			continue;
+
+		last = git_array_get(w.entries, nr);
+		nr++;
+
+		if (last != entry)
+			memcpy(last, entry, sizeof(midx_entry));
+	}
+
+	if ((error = git_buf_joinpath(&path, pack_dir, GIT_MIDX_FILE)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS, GIT_PACK_FILE_MODE)) < 0)
+		goto done;
+
+	if ((error = midx_write_file(&file, &w, nr)) < 0 ||
+		(error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+done:
+	git_filebuf_cleanup(&file);
+
+	git_vector_foreach(&w.packs, i, p)
+		git_mwindow_put_pack(p);
+
+	git_vector_free(&w.packs);
+	git_array_clear(w.entries);
+	git_buf_free(&path);
+	return error;
+}
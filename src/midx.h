@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_midx_h__
+#define INCLUDE_midx_h__
+
+#include "common.h"
+
+#define GIT_MIDX_FILE "multi-pack-index"
+
+#define GIT_MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define GIT_MIDX_VERSION 1
+#define GIT_MIDX_OID_VERSION 1 /* SHA-1 */
+
+#define GIT_MIDX_CHUNK_PACKNAMES 0x504e414d /* "PNAM" */
+#define GIT_MIDX_CHUNK_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GIT_MIDX_CHUNK_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GIT_MIDX_CHUNK_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define GIT_MIDX_CHUNK_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+/*
+ * Write a `multi-pack-index` in `pack_dir` covering every pack found
+ * there. When an object is contained in several packs, the entry of
+ * the most recent pack is used.
+ */
+extern int git_midx_write(const char *pack_dir);
+
+#endif
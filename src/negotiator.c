@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "negotiator.h"
+#include "revwalk.h"
+#include "pool.h"
+#include "oidmap.h"
+#include "git2/object.h"
+
+GIT__USE_OIDMAP
+
+/* Flags of the commit list nodes in the negotiator's walk */
+#define SEEN       (1 << 0) /* it has been queued */
+#define COMMON     (1 << 1) /* the server has it */
+#define ADVERTISED (1 << 2) /* the server advertised it */
+#define POPPED     (1 << 3) /* it left the queue */
+
+typedef struct {
+	git_commit_list_node *commit;
+
+	/*
+	 * How many commits to skip before offering one. The skipping
+	 * negotiator grows the stretch each time it's walked over.
+	 */
+	uint16_t original_ttl;
+	uint16_t ttl;
+} negotiator_entry;
+
+struct git_negotiator {
+	git_fetch_negotiation_t algorithm;
+	git_revwalk *walk;
+
+	git_pool entry_pool;
+	git_pqueue queue;
+
+	/* the entry of every commit which has been queued, by its id */
+	git_oidmap *entries;
+
+	/* queued commits which aren't known to be common yet */
+	size_t non_common;
+};
+
+static int entry_time_cmp(const void *a, const void *b)
+{
+	const negotiator_entry *entry_a = a, *entry_b = b;
+
+	return git_commit_list_time_cmp(entry_a->commit, entry_b->commit);
+}
+
+int git_negotiator_new(
+	git_negotiator **out,
+	git_repository *repo,
+	git_fetch_negotiation_t algorithm)
+{
+	git_negotiator *negotiator;
+
+	assert(out && repo);
+
+	negotiator = git__calloc(1, sizeof(git_negotiator));
+	GITERR_CHECK_ALLOC(negotiator);
+
+	negotiator->algorithm = algorithm ?
+		algorithm : GIT_FETCH_NEGOTIATION_CONSECUTIVE;
+
+	git_pool_init(&negotiator->entry_pool, sizeof(negotiator_entry));
+
+	if ((negotiator->entries = git_oidmap_alloc()) == NULL ||
+		git_pqueue_init(&negotiator->queue, 0, 8, entry_time_cmp) < 0 ||
+		git_revwalk_new(&negotiator->walk, repo) < 0) {
+		git_negotiator_free(negotiator);
+		return -1;
+	}
+
+	*out = negotiator;
+	return 0;
+}
+
+static int push(
+	negotiator_entry **out,
+	git_negotiator *negotiator,
+	git_commit_list_node *commit,
+	unsigned int flags)
+{
+	negotiator_entry *entry;
+	int error;
+
+	if (!commit->parsed && (error = git_commit_list_parse(negotiator->walk, commit)) < 0)
+		return error;
+
+	entry = git_pool_mallocz(&negotiator->entry_pool, 1);
+	GITERR_CHECK_ALLOC(entry);
+
+	entry->commit = commit;
+	negotiator->walk->store.flags[commit->id] |= flags | SEEN;
+
+	git_oidmap_insert(negotiator->entries, &commit->oid, entry, error);
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	if (git_pqueue_insert(&negotiator->queue, entry) < 0)
+		return -1;
+
+	if (!(flags & COMMON))
+		negotiator->non_common++;
+
+	if (out)
+		*out = entry;
+
+	return 0;
+}
+
+/* Mark a commit and its queued history as common */
+static int mark_common(git_negotiator *negotiator, git_commit_list_node *commit)
+{
+	git_vector stack = GIT_VECTOR_INIT;
+	unsigned short i;
+	int error = 0;
+
+	if (negotiator->walk->store.flags[commit->id] & COMMON)
+		return 0;
+
+	negotiator->walk->store.flags[commit->id] |= COMMON;
+
+	if ((error = git_vector_insert(&stack, commit)) < 0)
+		goto done;
+
+	while ((commit = git_vector_last(&stack)) != NULL) {
+		git_vector_pop(&stack);
+
+		if (!(negotiator->walk->store.flags[commit->id] & POPPED))
+			negotiator->non_common--;
+
+		for (i = 0; i < commit->out_degree; i++) {
+			git_commit_list_node *parent =
+				git_commit_store_parent(&negotiator->walk->store, commit, i);
+
+			if ((negotiator->walk->store.flags[parent->id] & (SEEN | COMMON)) != SEEN)
+				continue;
+
+			negotiator->walk->store.flags[parent->id] |= COMMON;
+
+			if ((error = git_vector_insert(&stack, parent)) < 0)
+				goto done;
+		}
+	}
+
+done:
+	git_vector_free(&stack);
+	return error;
+}
+
+static int push_parent(
+	bool *pushed,
+	git_negotiator *negotiator,
+	negotiator_entry *entry,
+	git_commit_list_node *parent)
+{
+	negotiator_entry *parent_entry = NULL;
+	uint16_t original_ttl, ttl;
+	khiter_t pos;
+	int error;
+
+	*pushed = false;
+
+	if (negotiator->walk->store.flags[parent->id] & POPPED)
+		return 0;
+
+	if (negotiator->walk->store.flags[parent->id] & SEEN) {
+		pos = git_oidmap_lookup_index(negotiator->entries, &parent->oid);
+		assert(git_oidmap_valid_index(negotiator->entries, pos));
+
+		parent_entry = git_oidmap_value_at(negotiator->entries, pos);
+	} else if ((error = push(&parent_entry, negotiator, parent, 0)) < 0) {
+		return error;
+	}
+
+	*pushed = true;
+
+	if (negotiator->walk->store.flags[entry->commit->id] & (COMMON | ADVERTISED))
+		return mark_common(negotiator, parent);
+
+	if (negotiator->algorithm != GIT_FETCH_NEGOTIATION_SKIPPING)
+		return 0;
+
+	/* skip over half as many commits again after each one offered */
+	if (entry->ttl) {
+		original_ttl = entry->original_ttl;
+		ttl = entry->ttl - 1;
+	} else {
+		original_ttl = entry->original_ttl * 3 / 2 + 1;
+		ttl = original_ttl;
+	}
+
+	if (parent_entry->original_ttl < original_ttl) {
+		parent_entry->original_ttl = original_ttl;
+		parent_entry->ttl = ttl;
+	}
+
+	return 0;
+}
+
+/* Look up the commit `id` peels to; NULL when it's not a commit */
+static int lookup_tip(
+	git_commit_list_node **out,
+	git_negotiator *negotiator,
+	const git_oid *id)
+{
+	git_object *obj = NULL, *commit = NULL;
+	int error;
+
+	*out = NULL;
+
+	if ((error = git_object_lookup(&obj, negotiator->walk->repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	if (git_object_peel(&commit, obj, GIT_OBJ_COMMIT) < 0) {
+		giterr_clear();
+		goto done;
+	}
+
+	if ((*out = git_revwalk__commit_lookup(negotiator->walk, git_object_id(commit))) == NULL)
+		error = -1;
+
+done:
+	git_object_free(commit);
+	git_object_free(obj);
+	return error;
+}
+
+static int add_tip(git_negotiator *negotiator, const git_oid *id, unsigned int flags)
+{
+	git_commit_list_node *commit;
+	int error;
+
+	assert(negotiator && id);
+
+	if (negotiator->algorithm == GIT_FETCH_NEGOTIATION_NOOP)
+		return 0;
+
+	if ((error = lookup_tip(&commit, negotiator, id)) < 0)
+		return error;
+
+	if (!commit || (negotiator->walk->store.flags[commit->id] & SEEN))
+		return 0;
+
+	return push(NULL, negotiator, commit, flags);
+}
+
+int git_negotiator_add_tip(git_negotiator *negotiator, const git_oid *id)
+{
+	return add_tip(negotiator, id, 0);
+}
+
+int git_negotiator_known_common(git_negotiator *negotiator, const git_oid *id)
+{
+	return add_tip(negotiator, id, ADVERTISED);
+}
+
+int git_negotiator_next(git_oid *out, git_negotiator *negotiator)
+{
+	git_commit_list_node *to_send = NULL;
+	negotiator_entry *entry;
+	git_commit_list_node *commit;
+	unsigned short i;
+	bool pushed, any_pushed;
+	int error;
+
+	assert(out && negotiator);
+
+	while (!to_send) {
+		if (!negotiator->non_common ||
+			(entry = git_pqueue_pop(&negotiator->queue)) == NULL)
+			return GIT_ITEROVER;
+
+		commit = entry->commit;
+		negotiator->walk->store.flags[commit->id] |= POPPED;
+
+		if (!(negotiator->walk->store.flags[commit->id] & COMMON)) {
+			negotiator->non_common--;
+
+			if (!entry->ttl)
+				to_send = commit;
+		}
+
+		any_pushed = false;
+
+		for (i = 0; i < commit->out_degree; i++) {
+			if ((error = push_parent(&pushed, negotiator, entry,
+					git_commit_store_parent(&negotiator->walk->store, commit, i))) < 0)
+				return error;
+
+			any_pushed |= pushed;
+		}
+
+		/*
+		 * Offer the ends of the history we're skipping through, or
+		 * we'd never learn whether the server has them.
+		 */
+		if (!(negotiator->walk->store.flags[commit->id] & COMMON) && !any_pushed)
+			to_send = commit;
+	}
+
+	git_oid_cpy(out, &to_send->oid);
+	return 0;
+}
+
+int git_negotiator_ack(git_negotiator *negotiator, const git_oid *id)
+{
+	git_commit_list_node *commit;
+	int known;
+
+	assert(negotiator && id);
+
+	commit = git_revwalk__commit_lookup(negotiator->walk, id);
+	GITERR_CHECK_ALLOC(commit);
+
+	/* we never offered it; there's nothing to learn */
+	if (!(negotiator->walk->store.flags[commit->id] & SEEN))
+		return 1;
+
+	known = !!(negotiator->walk->store.flags[commit->id] & COMMON);
+
+	if (mark_common(negotiator, commit) < 0)
+		return -1;
+
+	return known;
+}
+
+void git_negotiator_free(git_negotiator *negotiator)
+{
+	if (negotiator == NULL)
+		return;
+
+	git_pqueue_free(&negotiator->queue);
+	git_oidmap_free(negotiator->entries);
+	git_pool_clear(&negotiator->entry_pool);
+	git_revwalk_free(negotiator->walk);
+	git__free(negotiator);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_negotiator_h__
+#define INCLUDE_negotiator_h__
+
+#include "common.h"
+#include "git2/remote.h"
+
+/*
+ * A fetch negotiator picks the commits to offer as "have" lines,
+ * walking back from the local tips and learning from the server's
+ * acknowledgements which parts of the history need no offering.
+ */
+typedef struct git_negotiator git_negotiator;
+
+int git_negotiator_new(
+	git_negotiator **out,
+	git_repository *repo,
+	git_fetch_negotiation_t algorithm);
+
+/* Walk back from `id`; objects which don't peel to a commit are ignored */
+int git_negotiator_add_tip(git_negotiator *negotiator, const git_oid *id);
+
+/*
+ * Tell the negotiator that the server advertised `id` and we have it;
+ * it and its history are shared, but still worth offering.
+ */
+int git_negotiator_known_common(git_negotiator *negotiator, const git_oid *id);
+
+/* Get the next commit to offer; GIT_ITEROVER once there's none left */
+int git_negotiator_next(git_oid *out, git_negotiator *negotiator);
+
+/*
+ * Record the server's acknowledgement of `id`. Returns 1 when the
+ * commit was already known to be common, 0 when it's news.
+ */
+int git_negotiator_ack(git_negotiator *negotiator, const git_oid *id);
+
+void git_negotiator_free(git_negotiator *negotiator);
+
+#endif
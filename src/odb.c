@@ -15,6 +15,11 @@
 #include "delta-apply.h"
 #include "filter.h"
 #include "repository.h"
+#include "oidmap.h"
+#include "oidarray.h"
+#include "pack.h"
+#include "pool.h"
+#include "zstream.h"
 
 #include "git2/odb_backend.h"
 #include "git2/oid.h"
@@ -30,6 +35,8 @@
 
 #define GIT_ALTERNATES_MAX_DEPTH 5
 
+GIT__USE_OIDMAP
+
 typedef struct
 {
 	git_odb_backend *backend;
@@ -384,6 +391,33 @@ static int backend_sort_cmp(const void *a, const void *b)
 	return (backend_b->priority - backend_a->priority);
 }
 
+int git_odb__load_config(git_odb *odb, git_repository *repo)
+{
+	git_config *config;
+	int64_t threshold;
+	int error;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0)
+		return error;
+
+	error = git_config_get_int64(&threshold, config, "core.bigFileThreshold");
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (!error && threshold < 0) {
+		giterr_set(GITERR_CONFIG, "invalid value for core.bigFileThreshold");
+		return -1;
+	}
+
+	if (!error)
+		odb->big_file_threshold = (uint64_t)threshold;
+
+	return error;
+}
+
 int git_odb_new(git_odb **out)
 {
 	git_odb *db = git__calloc(1, sizeof(*db));
@@ -395,6 +429,9 @@ int git_odb_new(git_odb **out)
 		return -1;
 	}
 
+	db->big_file_threshold = GIT_PACK_BIG_FILE_THRESHOLD;
+	git_remote_init_callbacks(&db->promisor_callbacks, GIT_REMOTE_CALLBACKS_VERSION);
+
 	*out = db;
 	GIT_REFCOUNT_INC(db);
 	return 0;
@@ -624,6 +661,29 @@ void git_odb_free(git_odb *db)
 	GIT_REFCOUNT_DEC(db, odb_free);
 }
 
+int git_odb__refresh_interval = 0;
+
+/*
+ * Refresh the backends before looking a missing object up once more,
+ * unless that was done too recently.  Returns 0 if the backends were
+ * refreshed.
+ */
+static int odb_refresh_after_miss(git_odb *db)
+{
+	double now = git__timer();
+	int error;
+
+	if (git_odb__refresh_interval > 0 && db->last_refresh &&
+		(now - db->last_refresh) * 1000 < git_odb__refresh_interval)
+		return GIT_PASSTHROUGH;
+
+	if ((error = git_odb_refresh(db)) < 0)
+		return error;
+
+	db->last_refresh = now;
+	return 0;
+}
+
 static int odb_exists_1(git_odb *db, const git_oid *id, bool only_refreshed)
 {
 	size_t i;
@@ -657,7 +717,7 @@ int git_odb_exists(git_odb *db, const git_oid *id)
 	if (odb_exists_1(db, id, false))
 		return 1;
 
-	if (!git_odb_refresh(db))
+	if (!odb_refresh_after_miss(db))
 		return odb_exists_1(db, id, true);
 
 	/* Failed to refresh, hence not found */
@@ -736,7 +796,7 @@ int git_odb_exists_prefix(
 
 	error = odb_exists_prefix_1(out, db, &key, len, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_after_miss(db))
 		error = odb_exists_prefix_1(out, db, &key, len, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -877,7 +937,7 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 
 	error = odb_read_1(out, db, id, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_after_miss(db))
 		error = odb_read_1(out, db, id, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -963,7 +1023,7 @@ int git_odb_read_prefix(
 
 	error = read_prefix_1(out, db, &key, len, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_after_miss(db))
 		error = read_prefix_1(out, db, &key, len, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -1139,8 +1199,12 @@ void git_odb_stream_free(git_odb_stream *stream)
 	if (stream == NULL)
 		return;
 
-	git_hash_ctx_cleanup(stream->hash_ctx);
-	git__free(stream->hash_ctx);
+	/* read streams don't hash their contents */
+	if (stream->hash_ctx) {
+		git_hash_ctx_cleanup(stream->hash_ctx);
+		git__free(stream->hash_ctx);
+	}
+
 	stream->free(stream);
 }
 
@@ -1176,6 +1240,9 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer
 
 	assert(out && db);
 
+	/* the objects in the pack should be found without waiting */
+	db->last_refresh = 0;
+
 	for (i = 0; i < db->backends.length && error < 0; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
 		git_odb_backend *b = internal->backend;
@@ -1198,6 +1265,267 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_transfer
 	return error;
 }
 
+struct git_odb_batch {
+	git_odb *odb;
+	git_oidmap *objects;
+	git_pool ids;
+	git_buf entry; /* the entry being added */
+
+	/* the pack entries, without header and trailer, in a temporary file */
+	git_buf spool_path;
+	git_file spool_fd;
+	git_off_t spool_size;
+
+	uint32_t nr_objects;
+	bool passthrough;
+};
+
+#define ODB_BATCH_READ_SIZE (64 * 1024)
+
+static bool odb_can_write_pack(git_odb *db)
+{
+	size_t i;
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		if (!internal->is_alternate && internal->backend->writepack != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+static int odb_batch_spool_open(git_odb_batch *batch)
+{
+	git_repository *repo = GIT_REFCOUNT_OWNER(batch->odb);
+	git_buf prefix = GIT_BUF_INIT;
+	const char *dir;
+	int error;
+
+	/* next to the packs, like git's own temporary packs */
+	if (repo)
+		error = git_buf_joinpath(&prefix, repo->path_repository,
+			GIT_OBJECTS_DIR "pack");
+	else {
+		if ((dir = getenv("TMPDIR")) == NULL &&
+			(dir = getenv("TEMP")) == NULL &&
+			(dir = getenv("TMP")) == NULL)
+			dir = "/tmp";
+
+		error = git_buf_sets(&prefix, dir);
+	}
+
+	if (!error)
+		error = git_buf_joinpath(&prefix, prefix.ptr, "tmp_batch");
+
+	if (!error &&
+		(batch->spool_fd = git_futils_mktmp(&batch->spool_path, prefix.ptr, 0600)) < 0)
+		error = -1;
+
+	git_buf_free(&prefix);
+	return error;
+}
+
+static void odb_batch_spool_close(git_odb_batch *batch)
+{
+	if (batch->spool_fd < 0)
+		return;
+
+	p_close(batch->spool_fd);
+	p_unlink(batch->spool_path.ptr);
+
+	batch->spool_fd = -1;
+	batch->spool_size = 0;
+}
+
+static void odb_batch_reset(git_odb_batch *batch)
+{
+	git_oidmap_clear(batch->objects);
+	git_pool_clear(&batch->ids);
+	odb_batch_spool_close(batch);
+	batch->nr_objects = 0;
+}
+
+int git_odb_batch_new(git_odb_batch **out, git_odb *db)
+{
+	git_odb_batch *batch;
+
+	assert(out && db);
+
+	batch = git__calloc(1, sizeof(git_odb_batch));
+	GITERR_CHECK_ALLOC(batch);
+
+	batch->objects = git_oidmap_alloc();
+	if (!batch->objects) {
+		git__free(batch);
+		giterr_set_oom();
+		return -1;
+	}
+
+	git_pool_init(&batch->ids, sizeof(git_oid));
+	batch->spool_fd = -1;
+
+	/* without a backend taking packs, there is nothing to batch */
+	batch->passthrough = !odb_can_write_pack(db);
+
+	GIT_REFCOUNT_INC(db);
+	batch->odb = db;
+
+	*out = batch;
+	return 0;
+}
+
+int git_odb_batch_write(
+	git_oid *out,
+	git_odb_batch *batch,
+	const void *data,
+	size_t len,
+	git_otype type)
+{
+	unsigned char hdr[10];
+	size_t hdr_len;
+	khiter_t pos;
+	git_oid *id;
+	int error;
+
+	assert(out && batch);
+
+	if (batch->passthrough)
+		return git_odb_write(out, batch->odb, data, len, type);
+
+	if ((error = git_odb_hash(out, data, len, type)) < 0)
+		return error;
+
+	pos = git_oidmap_lookup_index(batch->objects, out);
+	if (git_oidmap_valid_index(batch->objects, pos) ||
+		git_odb_exists(batch->odb, out))
+		return 0;
+
+	if (batch->nr_objects == UINT32_MAX) {
+		giterr_set(GITERR_ODB, "Too many objects in a single batch");
+		return -1;
+	}
+
+	if (batch->spool_fd < 0 && (error = odb_batch_spool_open(batch)) < 0)
+		return error;
+
+	hdr_len = git_packfile__object_header(hdr, len, type);
+
+	git_buf_clear(&batch->entry);
+	if ((error = git_buf_put(&batch->entry, (char *)hdr, hdr_len)) < 0 ||
+		(error = git_zstream_deflatebuf(&batch->entry, data, len)) < 0)
+		return error;
+
+	/* a failed write is overwritten by the next entry */
+	if (p_lseek(batch->spool_fd, batch->spool_size, SEEK_SET) < 0 ||
+		p_write(batch->spool_fd, batch->entry.ptr, batch->entry.size) < 0) {
+		giterr_set(GITERR_OS, "Failed to write to '%s'", batch->spool_path.ptr);
+		return -1;
+	}
+
+	id = git_pool_malloc(&batch->ids, 1);
+	GITERR_CHECK_ALLOC(id);
+	git_oid_cpy(id, out);
+
+	git_oidmap_insert(batch->objects, id, NULL, error);
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	batch->spool_size += batch->entry.size;
+	batch->nr_objects++;
+	return 0;
+}
+
+int git_odb_batch_commit(git_odb_batch *batch)
+{
+	git_odb_writepack *writepack = NULL;
+	git_transfer_progress stats = {0};
+	struct git_pack_header hdr;
+	git_hash_ctx ctx;
+	git_oid trailer;
+	git_off_t remaining;
+	char *buf = NULL;
+	ssize_t read_len;
+	int error;
+
+	assert(batch);
+
+	if (!batch->nr_objects)
+		return 0;
+
+	hdr.hdr_signature = htonl(PACK_SIGNATURE);
+	hdr.hdr_version = htonl(PACK_VERSION);
+	hdr.hdr_entries = htonl(batch->nr_objects);
+
+	if ((error = git_hash_ctx_init(&ctx)) < 0)
+		return error;
+
+	if ((buf = git__malloc(ODB_BATCH_READ_SIZE)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_odb_write_pack(&writepack, batch->odb, NULL, NULL)) < 0 ||
+		(error = git_hash_update(&ctx, &hdr, sizeof(hdr))) < 0 ||
+		(error = writepack->append(writepack, &hdr, sizeof(hdr), &stats)) < 0)
+		goto done;
+
+	if (p_lseek(batch->spool_fd, 0, SEEK_SET) < 0) {
+		giterr_set(GITERR_OS, "Failed to seek in '%s'", batch->spool_path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	/* stream the entries into the pack, hashing them for its trailer */
+	for (remaining = batch->spool_size; remaining > 0; remaining -= read_len) {
+		read_len = p_read(batch->spool_fd, buf,
+			(size_t)min(remaining, ODB_BATCH_READ_SIZE));
+
+		if (read_len <= 0) {
+			giterr_set(GITERR_OS, "Failed to read '%s'", batch->spool_path.ptr);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = git_hash_update(&ctx, buf, read_len)) < 0 ||
+			(error = writepack->append(writepack, buf, read_len, &stats)) < 0)
+			goto done;
+	}
+
+	if ((error = git_hash_final(&trailer, &ctx)) < 0 ||
+		(error = writepack->append(writepack,
+			trailer.id, GIT_OID_RAWSZ, &stats)) < 0 ||
+		(error = writepack->commit(writepack, &stats)) < 0)
+		goto done;
+
+	odb_batch_reset(batch);
+
+done:
+	if (writepack)
+		writepack->free(writepack);
+
+	git__free(buf);
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+void git_odb_batch_free(git_odb_batch *batch)
+{
+	if (batch == NULL)
+		return;
+
+	odb_batch_spool_close(batch);
+	git_oidmap_free(batch->objects);
+	git_pool_clear(&batch->ids);
+	git_buf_free(&batch->entry);
+	git_buf_free(&batch->spool_path);
+	git_odb_free(batch->odb);
+	git__free(batch);
+}
+
 void *git_odb_backend_malloc(git_odb_backend *backend, size_t len)
 {
 	GIT_UNUSED(backend);
@@ -1223,6 +1551,339 @@ int git_odb_refresh(struct git_odb *db)
 	return 0;
 }
 
+int git_odb_prefetch(git_odb *db, const git_oid *ids, size_t count)
+{
+	git_array_oid_t missing = GIT_ARRAY_INIT;
+	backend_internal *internal;
+	git_oid *id;
+	size_t i;
+	bool can_prefetch = false;
+	int error = 0;
+
+	assert(db && (ids || !count));
+
+	git_vector_foreach(&db->backends, i, internal)
+		can_prefetch |= (internal->backend->prefetch != NULL);
+
+	if (!can_prefetch)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		if (git_odb_exists(db, &ids[i]))
+			continue;
+
+		if ((id = git_array_alloc(missing)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(id, &ids[i]);
+	}
+
+	git_vector_foreach(&db->backends, i, internal) {
+		git_odb_backend *b = internal->backend;
+
+		if (!git_array_size(missing) || !b->prefetch)
+			continue;
+
+		if ((error = b->prefetch(b, missing.ptr, missing.size)) < 0)
+			break;
+	}
+
+done:
+	git_array_clear(missing);
+	return error;
+}
+
+/*
+ * The ids of a batch lookup which no backend has answered for yet, along
+ * with their position in the caller's arrays.
+ */
+typedef struct {
+	git_oid *ids;
+	size_t *pos;
+	int *done;
+	size_t count;
+} odb_lookup;
+
+static void odb_lookup_free(odb_lookup *batch)
+{
+	git__free(batch->ids);
+	git__free(batch->pos);
+	git__free(batch->done);
+}
+
+static int odb_lookup_init(odb_lookup *batch, const git_oid *ids, size_t count)
+{
+	size_t i;
+
+	memset(batch, 0, sizeof(*batch));
+
+	for (i = 1; i < count; i++) {
+		if (git_oid__cmp(&ids[i - 1], &ids[i]) >= 0) {
+			giterr_set(GITERR_INVALID,
+				"The ids of a batch lookup must be sorted and unique");
+			return -1;
+		}
+	}
+
+	batch->ids = git__mallocarray(count, sizeof(git_oid));
+	batch->pos = git__mallocarray(count, sizeof(size_t));
+	batch->done = git__calloc(count, sizeof(int));
+
+	if (!batch->ids || !batch->pos || !batch->done) {
+		odb_lookup_free(batch);
+		return -1;
+	}
+
+	memcpy(batch->ids, ids, count * sizeof(git_oid));
+
+	for (i = 0; i < count; i++)
+		batch->pos[i] = i;
+
+	batch->count = count;
+	return 0;
+}
+
+/* Forget about the ids which are done, keeping the rest sorted */
+static void odb_lookup_compact(odb_lookup *batch)
+{
+	size_t i, j;
+
+	for (i = 0, j = 0; i < batch->count; i++) {
+		if (batch->done[i])
+			continue;
+
+		batch->ids[j] = batch->ids[i];
+		batch->pos[j] = batch->pos[i];
+		j++;
+	}
+
+	batch->count = j;
+	memset(batch->done, 0, batch->count * sizeof(int));
+}
+
+static int odb_exists_many_1(
+	int *found, git_odb *db, odb_lookup *batch, bool only_refreshed)
+{
+	size_t i, j;
+	int error;
+
+	for (i = 0; i < db->backends.length && batch->count; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (only_refreshed && !b->refresh)
+			continue;
+
+		if (b->exists_many != NULL) {
+			error = b->exists_many(batch->done, b, batch->ids, batch->count);
+			if (error < 0)
+				return error;
+		} else if (b->exists != NULL) {
+			for (j = 0; j < batch->count; j++)
+				batch->done[j] = b->exists(b, &batch->ids[j]);
+		} else {
+			continue;
+		}
+
+		for (j = 0; j < batch->count; j++)
+			if (batch->done[j])
+				found[batch->pos[j]] = 1;
+
+		odb_lookup_compact(batch);
+	}
+
+	return 0;
+}
+
+int git_odb_exists_many(
+	int *found, git_odb *db, const git_oid *ids, size_t count)
+{
+	odb_lookup batch;
+	git_odb_object *object;
+	size_t i;
+	int error;
+
+	assert(found && db && (ids || !count));
+
+	if (!count)
+		return 0;
+
+	memset(found, 0, count * sizeof(int));
+
+	if ((error = odb_lookup_init(&batch, ids, count)) < 0)
+		return error;
+
+	for (i = 0; i < batch.count; i++) {
+		if ((object = git_cache_get_raw(odb_cache(db), &batch.ids[i])) != NULL) {
+			git_odb_object_free(object);
+			found[i] = batch.done[i] = 1;
+		}
+	}
+
+	odb_lookup_compact(&batch);
+
+	if ((error = odb_exists_many_1(found, db, &batch, false)) < 0)
+		goto done;
+
+	if (batch.count && !odb_refresh_after_miss(db))
+		error = odb_exists_many_1(found, db, &batch, true);
+
+done:
+	odb_lookup_free(&batch);
+	return error;
+}
+
+static int odb_read_header_many_1(
+	size_t *len_p, git_otype *type_p,
+	size_t *lens, git_otype *types,
+	git_odb *db, odb_lookup *batch, bool only_refreshed)
+{
+	size_t i, j;
+	int error;
+
+	for (i = 0; i < db->backends.length && batch->count; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (only_refreshed && !b->refresh)
+			continue;
+
+		if (b->read_header_many != NULL) {
+			for (j = 0; j < batch->count; j++) {
+				lens[j] = 0;
+				types[j] = GIT_OBJ_BAD;
+			}
+
+			error = b->read_header_many(
+				lens, types, b, batch->ids, batch->count);
+			if (error < 0)
+				return error;
+
+			for (j = 0; j < batch->count; j++)
+				batch->done[j] = (types[j] != GIT_OBJ_BAD);
+		} else if (b->read_header != NULL) {
+			for (j = 0; j < batch->count; j++)
+				batch->done[j] = !b->read_header(
+					&lens[j], &types[j], b, &batch->ids[j]);
+		} else {
+			continue;
+		}
+
+		/* move the answers to where the caller expects them */
+		for (j = 0; j < batch->count; j++) {
+			if (!batch->done[j])
+				continue;
+
+			len_p[batch->pos[j]] = lens[j];
+			type_p[batch->pos[j]] = types[j];
+		}
+
+		odb_lookup_compact(batch);
+	}
+
+	return 0;
+}
+
+int git_odb_read_header_many(
+	size_t *len_p, git_otype *type_p,
+	git_odb *db, const git_oid *ids, size_t count)
+{
+	odb_lookup batch;
+	git_odb_object *object;
+	size_t *lens = NULL, i;
+	git_otype *types = NULL;
+	bool can_read_headers = true;
+	int error;
+
+	assert(len_p && type_p && db && (ids || !count));
+
+	if (!count)
+		return 0;
+
+	if ((error = odb_lookup_init(&batch, ids, count)) < 0)
+		return error;
+
+	for (i = 0; i < count; i++) {
+		len_p[i] = 0;
+		type_p[i] = GIT_OBJ_BAD;
+
+		if ((object = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL) {
+			len_p[i] = object->cached.size;
+			type_p[i] = object->cached.type;
+			batch.done[i] = 1;
+			git_odb_object_free(object);
+		}
+	}
+
+	odb_lookup_compact(&batch);
+
+	/*
+	 * The backends work on the compacted batch, whose slots don't line
+	 * up with the caller's arrays, so they get arrays of their own.
+	 */
+	lens = git__mallocarray(count, sizeof(size_t));
+	types = git__mallocarray(count, sizeof(git_otype));
+	if (!lens || !types) {
+		error = -1;
+		goto done;
+	}
+
+	if ((error = odb_read_header_many_1(
+			len_p, type_p, lens, types, db, &batch, false)) < 0)
+		goto done;
+
+	if (batch.count && !odb_refresh_after_miss(db) &&
+		(error = odb_read_header_many_1(
+			len_p, type_p, lens, types, db, &batch, true)) < 0)
+		goto done;
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		can_read_headers &= (b->read_header || b->read_header_many);
+	}
+
+	/*
+	 * What's left is either missing, one of the objects which exist
+	 * without being stored, or in a backend which can only read whole
+	 * objects.
+	 */
+	for (i = 0; i < batch.count; i++) {
+		git_rawobj raw;
+
+		if (!hardcoded_objects(&raw, &batch.ids[i])) {
+			len_p[batch.pos[i]] = raw.len;
+			type_p[batch.pos[i]] = raw.type;
+			git__free(raw.data);
+			continue;
+		}
+
+		if (can_read_headers)
+			continue;
+
+		if ((error = git_odb_read(&object, db, &batch.ids[i])) == GIT_ENOTFOUND)
+			continue;
+		if (error < 0)
+			goto done;
+
+		len_p[batch.pos[i]] = object->cached.size;
+		type_p[batch.pos[i]] = object->cached.type;
+		git_odb_object_free(object);
+	}
+
+	error = 0;
+	giterr_clear();
+
+done:
+	git__free(lens);
+	git__free(types);
+	odb_lookup_free(&batch);
+	return error;
+}
+
 int git_odb__error_notfound(const char *message, const git_oid *oid)
 {
 	if (oid != NULL) {
@@ -10,6 +10,7 @@
 #include "git2/odb.h"
 #include "git2/oid.h"
 #include "git2/types.h"
+#include "git2/remote.h"
 
 #include "vector.h"
 #include "cache.h"
@@ -38,8 +39,17 @@ struct git_odb {
 	git_refcount rc;
 	git_vector backends;
 	git_cache own_cache;
+	double last_refresh; /* of the ones a failed lookup did, or 0 */
+	uint64_t big_file_threshold; /* core.bigFileThreshold */
+	git_remote_callbacks promisor_callbacks; /* for fetching missing objects */
 };
 
+/*
+ * The minimum time, in milliseconds, between two of the refreshes which
+ * failed lookups do; zero refreshes on every miss.
+ */
+extern int git_odb__refresh_interval;
+
 /*
  * Hash a git_rawobj internally.
  * The `git_rawobj` is supposed to be previously initialized
@@ -100,4 +110,17 @@ int git_odb__read_header_or_object(
 /* fully free the object; internal method, DO NOT EXPORT */
 void git_odb_object__free(void *object);
 
+/*
+ * Add a backend fetching the objects promised by the remote, unless
+ * the database already has one for it.
+ */
+int git_odb__add_promisor(
+	git_odb *odb, git_repository *repo, const char *remote_name);
+
+/* Add a backend for each promisor remote configured in `repo` */
+int git_odb__load_promisors(git_odb *odb, git_repository *repo);
+
+/* Read the settings of `repo` which apply to its object database */
+int git_odb__load_config(git_odb *odb, git_repository *repo);
+
 #endif
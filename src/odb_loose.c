@@ -28,6 +28,24 @@ typedef struct {
 	git_filebuf fbuf;
 } loose_writestream;
 
+typedef struct {
+	git_odb_stream stream;
+	git_file fd;
+	z_stream zs;
+	int zerr;
+	size_t size;
+	size_t pos;
+
+	/* inflated data which followed the object header */
+	unsigned char head[64];
+	size_t head_pos, head_len;
+
+	/* objects in the legacy pack-like format are read in full */
+	git_rawobj raw;
+
+	unsigned char in[16 * 1024];
+} loose_readstream;
+
 typedef struct loose_backend {
 	git_odb_backend parent;
 
@@ -876,6 +894,181 @@ static int loose_backend__stream(git_odb_stream **stream_out, git_odb_backend *_
 	return !stream ? -1 : 0;
 }
 
+static int loose_backend__readstream_fill(loose_readstream *stream)
+{
+	ssize_t read_bytes;
+
+	if (stream->zs.avail_in)
+		return 0;
+
+	if ((read_bytes = p_read(stream->fd, stream->in, sizeof(stream->in))) < 0) {
+		giterr_set(GITERR_OS, "Failed to read loose object");
+		return -1;
+	}
+
+	set_stream_input(&stream->zs, stream->in, read_bytes);
+	return 0;
+}
+
+static int loose_backend__readstream_read(git_odb_stream *_stream, char *buffer, size_t len)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+	size_t start = stream->pos, n;
+
+	len = min(len, stream->size - stream->pos);
+	len = min(len, INT_MAX);
+
+	if (stream->raw.data) {
+		memcpy(buffer, (char *)stream->raw.data + stream->pos, len);
+		stream->pos += len;
+		return (int)len;
+	}
+
+	n = min(len, stream->head_len - stream->head_pos);
+	memcpy(buffer, stream->head + stream->head_pos, n);
+	stream->head_pos += n;
+	stream->pos += n;
+
+	set_stream_output(&stream->zs, buffer + n, len - n);
+
+	while (stream->zs.avail_out && stream->zerr != Z_STREAM_END) {
+		if (loose_backend__readstream_fill(stream) < 0)
+			return -1;
+
+		if (!stream->zs.avail_in) {
+			giterr_set(GITERR_ZLIB, "Loose object is truncated");
+			return -1;
+		}
+
+		stream->zerr = inflate(&stream->zs, Z_NO_FLUSH);
+
+		if (stream->zerr != Z_OK && stream->zerr != Z_STREAM_END) {
+			giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+			return -1;
+		}
+	}
+
+	stream->pos += (len - n) - stream->zs.avail_out;
+
+	if (stream->zs.avail_out) {
+		giterr_set(GITERR_ZLIB, "Loose object is truncated");
+		return -1;
+	}
+
+	return (int)(stream->pos - start);
+}
+
+static void loose_backend__readstream_free(git_odb_stream *_stream)
+{
+	loose_readstream *stream = (loose_readstream *)_stream;
+
+	if (stream->fd >= 0) {
+		inflateEnd(&stream->zs);
+		p_close(stream->fd);
+	}
+
+	git__free(stream->raw.data);
+	git__free(stream);
+}
+
+static int loose_backend__readstream_start(loose_readstream *stream, git_buf *path)
+{
+	obj_hdr hdr;
+	size_t used;
+
+	if ((stream->fd = git_futils_open_ro(path->ptr)) < 0)
+		return stream->fd;
+
+	init_stream(&stream->zs, stream->head, sizeof(stream->head));
+
+	if (loose_backend__readstream_fill(stream) < 0)
+		return -1;
+
+	/* the legacy format isn't worth streaming; read it in full */
+	if (stream->zs.avail_in < 2 || !is_zlib_compressed_data(stream->in)) {
+		p_close(stream->fd);
+		stream->fd = -1;
+
+		if (read_loose(&stream->raw, path) < 0)
+			return -1;
+
+		stream->size = stream->raw.len;
+		return 0;
+	}
+
+	if (inflateInit(&stream->zs) < Z_OK) {
+		p_close(stream->fd);
+		stream->fd = -1;
+		giterr_set(GITERR_ZLIB, "Failed to inflate loose object");
+		return -1;
+	}
+
+	/* inflate enough of the object to parse its header */
+	while (stream->zs.avail_out && stream->zerr == Z_OK &&
+		!memchr(stream->head, '\0', stream->zs.total_out)) {
+		if (loose_backend__readstream_fill(stream) < 0)
+			return -1;
+
+		if (!stream->zs.avail_in)
+			break;
+
+		stream->zerr = inflate(&stream->zs, Z_NO_FLUSH);
+	}
+
+	stream->head_len = stream->zs.total_out;
+
+	if ((stream->zerr != Z_OK && stream->zerr != Z_STREAM_END) ||
+		!memchr(stream->head, '\0', stream->head_len) ||
+		(used = get_object_header(&hdr, stream->head)) == 0 ||
+		!git_object_typeisloose(hdr.type)) {
+		giterr_set(GITERR_ZLIB, "Failed to read loose object header");
+		return -1;
+	}
+
+	stream->head_pos = used;
+	stream->head_len = min(stream->head_len, used + hdr.size);
+	stream->size = hdr.size;
+	return 0;
+}
+
+static int loose_backend__readstream(git_odb_stream **stream_out, git_odb_backend *_backend, const git_oid *oid)
+{
+	git_buf object_path = GIT_BUF_INIT;
+	loose_readstream *stream;
+	int error;
+
+	assert(stream_out && _backend && oid);
+
+	*stream_out = NULL;
+
+	if (locate_object(&object_path, (loose_backend *)_backend, oid) < 0) {
+		error = git_odb__error_notfound("no matching loose object", oid);
+		goto done;
+	}
+
+	stream = git__calloc(1, sizeof(loose_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	stream->fd = -1;
+
+	if ((error = loose_backend__readstream_start(stream, &object_path)) < 0) {
+		loose_backend__readstream_free((git_odb_stream *)stream);
+		goto done;
+	}
+
+	stream->stream.backend = _backend;
+	stream->stream.read = &loose_backend__readstream_read;
+	stream->stream.free = &loose_backend__readstream_free;
+	stream->stream.mode = GIT_STREAM_RDONLY;
+	stream->stream.declared_size = (git_off_t)stream->size;
+
+	*stream_out = (git_odb_stream *)stream;
+
+done:
+	git_buf_free(&object_path);
+	return error;
+}
+
 static int loose_backend__write(git_odb_backend *_backend, const git_oid *oid, const void *data, size_t len, git_otype type)
 {
 	int error = 0, header_len;
@@ -968,6 +1161,7 @@ int git_odb_backend_loose(
 	backend->parent.read_prefix = &loose_backend__read_prefix;
 	backend->parent.read_header = &loose_backend__read_header;
 	backend->parent.writestream = &loose_backend__stream;
+	backend->parent.readstream = &loose_backend__readstream;
 	backend->parent.exists = &loose_backend__exists;
 	backend->parent.exists_prefix = &loose_backend__exists_prefix;
 	backend->parent.foreach = &loose_backend__foreach;
@@ -17,19 +17,37 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "pack.h"
+#include "global.h"
 
 #include "git2/odb_backend.h"
 
+/* How many of the ids which aren't in any pack are remembered */
+#define PACK_MISSING_CACHE_SIZE 1024
+
 struct pack_backend {
 	git_odb_backend parent;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
+	git_futils_filestamp pack_folder_stamp;
+
+	/*
+	 * Ids which none of the packs has, in a slot picked by the id.
+	 * Packs don't change, so this holds until the list of packs does.
+	 */
+	git_oid *missing;
 };
 
 struct pack_writepack {
 	struct git_odb_writepack parent;
 	git_indexer *indexer;
+	bool promisor;
+};
+
+struct pack_readstream {
+	git_odb_stream parent;
+	git_packfile_object_stream obj;
+	struct git_pack_file *pack;
 };
 
 /**
@@ -225,6 +243,21 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 }
 
+GIT_INLINE(git_oid *) missing_cache_slot(
+	struct pack_backend *backend, const git_oid *oid)
+{
+	uint32_t h;
+
+	memcpy(&h, oid->id, sizeof(h));
+	return &backend->missing[h % PACK_MISSING_CACHE_SIZE];
+}
+
+static void missing_cache_clear(struct pack_backend *backend)
+{
+	memset(backend->missing, 0, PACK_MISSING_CACHE_SIZE * sizeof(git_oid));
+}
+
+/* Returns GIT_ENOTFOUND only when every pack was searched */
 static int pack_entry_find_inner(
 	struct git_pack_entry *e,
 	struct pack_backend *backend,
@@ -232,10 +265,14 @@ static int pack_entry_find_inner(
 	struct git_pack_file *last_found)
 {
 	size_t i;
+	int error, result = GIT_ENOTFOUND;
 
-	if (last_found &&
-		git_pack_entry_find(e, last_found, oid, GIT_OID_HEXSZ) == 0)
-		return 0;
+	if (last_found) {
+		if (!(error = git_pack_entry_find(e, last_found, oid, GIT_OID_HEXSZ)))
+			return 0;
+		if (error != GIT_ENOTFOUND)
+			result = -1;
+	}
 
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p;
@@ -244,25 +281,38 @@ static int pack_entry_find_inner(
 		if (p == last_found)
 			continue;
 
-		if (git_pack_entry_find(e, p, oid, GIT_OID_HEXSZ) == 0) {
+		if (!(error = git_pack_entry_find(e, p, oid, GIT_OID_HEXSZ))) {
 			backend->last_found = p;
 			return 0;
 		}
+
+		if (error != GIT_ENOTFOUND)
+			result = -1;
 	}
 
-	return -1;
+	return result;
 }
 
 static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
 {
 	struct git_pack_file *last_found = backend->last_found;
+	git_oid *missing = missing_cache_slot(backend, oid);
+
+	if (!git_oid_iszero(oid) && git_oid_equal(missing, oid))
+		return git_odb__error_notfound("failed to find pack entry", oid);
 
 	if (backend->last_found &&
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
 		return 0;
 
-	if (!pack_entry_find_inner(e, backend, oid, last_found))
+	switch (pack_entry_find_inner(e, backend, oid, last_found)) {
+	case 0:
 		return 0;
+	case GIT_ENOTFOUND:
+		/* don't remember it when a pack couldn't be read */
+		git_oid_cpy(missing, oid);
+		break;
+	}
 
 	return git_odb__error_notfound("failed to find pack entry", oid);
 }
@@ -325,9 +375,12 @@ static int pack_entry_find_prefix(
 static int pack_backend__refresh(git_odb_backend *backend_)
 {
 	int error;
+	size_t i;
 	struct stat st;
+	git_futils_filestamp stamp;
 	git_buf path = GIT_BUF_INIT;
 	struct pack_backend *backend = (struct pack_backend *)backend_;
+	time_t now = time(NULL);
 
 	if (backend->pack_folder == NULL)
 		return 0;
@@ -335,6 +388,42 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL);
 
+	/*
+	 * Packs only come and go by being added to or removed from the
+	 * directory, so there's nothing to reload while it stays the same.
+	 */
+	git_futils_filestamp_set_from_stat(&stamp, &st);
+
+	if (stamp.mtime.tv_sec == backend->pack_folder_stamp.mtime.tv_sec &&
+		stamp.mtime.tv_nsec == backend->pack_folder_stamp.mtime.tv_nsec &&
+		stamp.ino == backend->pack_folder_stamp.ino)
+		return 0;
+
+	/*
+	 * The directory may still change within the same second without its
+	 * mtime showing it, so such a stamp can't be trusted the next time.
+	 */
+	if (stamp.mtime.tv_sec >= now)
+		git_futils_filestamp_set(&backend->pack_folder_stamp, NULL);
+	else
+		git_futils_filestamp_set(&backend->pack_folder_stamp, &stamp);
+
+	missing_cache_clear(backend);
+
+	/* forget the packs which were removed, e.g. by a repack */
+	for (i = backend->packs.length; i > 0; --i) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, i - 1);
+
+		if (git_path_exists(p->pack_name))
+			continue;
+
+		if (backend->last_found == p)
+			backend->last_found = NULL;
+
+		git_vector_remove(&backend->packs, i - 1);
+		git_mwindow_put_pack(p);
+	}
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -380,6 +469,61 @@ static int pack_backend__read(
 	return 0;
 }
 
+static int pack_backend__readstream_read(
+	git_odb_stream *_stream, char *buffer, size_t len)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	return (int)git_packfile_object_stream_read(
+		&stream->obj, buffer, min(len, INT_MAX));
+}
+
+static void pack_backend__readstream_free(git_odb_stream *_stream)
+{
+	struct pack_readstream *stream = (struct pack_readstream *)_stream;
+
+	git_packfile_object_stream_free(&stream->obj);
+
+	if (stream->pack)
+		git_mwindow_put_pack(stream->pack);
+
+	git__free(stream);
+}
+
+static int pack_backend__readstream(
+	git_odb_stream **stream_out, git_odb_backend *backend, const git_oid *oid)
+{
+	struct git_pack_entry e;
+	struct pack_readstream *stream;
+	int error;
+
+	assert(stream_out && backend && oid);
+
+	if ((error = pack_entry_find(&e, (struct pack_backend *)backend, oid)) < 0)
+		return error;
+
+	stream = git__calloc(1, sizeof(struct pack_readstream));
+	GITERR_CHECK_ALLOC(stream);
+
+	/* keep the pack alive even if a refresh drops it from the backend */
+	git_atomic_inc(&e.p->refcount);
+	stream->pack = e.p;
+
+	if ((error = git_packfile_object_stream_open(&stream->obj, e.p, e.offset)) < 0) {
+		pack_backend__readstream_free(&stream->parent);
+		return error;
+	}
+
+	stream->parent.backend = backend;
+	stream->parent.mode = GIT_STREAM_RDONLY;
+	stream->parent.declared_size = (git_off_t)stream->obj.size;
+	stream->parent.read = &pack_backend__readstream_read;
+	stream->parent.free = &pack_backend__readstream_free;
+
+	*stream_out = &stream->parent;
+	return 0;
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -423,6 +567,91 @@ static int pack_backend__exists(git_odb_backend *backend, const git_oid *oid)
 	return pack_entry_find(&e, (struct pack_backend *)backend, oid) == 0;
 }
 
+/*
+ * Look up sorted ids in every pack, starting with the one which had the
+ * last hit.  The entries which are not found are left without a pack.
+ */
+static int pack_entry_find_many(
+	struct git_pack_entry **out,
+	struct pack_backend *backend,
+	const git_oid *ids,
+	size_t count)
+{
+	struct git_pack_entry *entries;
+	struct git_pack_file *p;
+	size_t i, j, missing = count;
+
+	*out = entries = git__calloc(count, sizeof(struct git_pack_entry));
+	GITERR_CHECK_ALLOC(entries);
+
+	for (i = 0; i <= backend->packs.length && missing; ++i) {
+		if (i == 0)
+			p = backend->last_found;
+		else if ((p = git_vector_get(&backend->packs, i - 1)) == backend->last_found)
+			continue;
+
+		if (!p)
+			continue;
+
+		/* a pack we cannot read is skipped, like in single lookups */
+		if (git_pack_entry_find_many(entries, p, ids, count) < 0) {
+			giterr_clear();
+			continue;
+		}
+
+		for (missing = 0, j = 0; j < count; j++) {
+			if (entries[j].p == NULL)
+				missing++;
+			else if (entries[j].p == p)
+				backend->last_found = p;
+		}
+	}
+
+	return 0;
+}
+
+static int pack_backend__exists_many(
+	int *found, git_odb_backend *backend, const git_oid *ids, size_t count)
+{
+	struct git_pack_entry *entries;
+	size_t i;
+
+	if (pack_entry_find_many(&entries, (struct pack_backend *)backend, ids, count) < 0)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		found[i] = (entries[i].p != NULL);
+
+	git__free(entries);
+	return 0;
+}
+
+static int pack_backend__read_header_many(
+	size_t *len_p, git_otype *type_p,
+	git_odb_backend *backend, const git_oid *ids, size_t count)
+{
+	struct git_pack_entry *entries;
+	size_t i;
+	int error = 0;
+
+	if (pack_entry_find_many(&entries, (struct pack_backend *)backend, ids, count) < 0)
+		return -1;
+
+	for (i = 0; i < count && !error; i++) {
+		if (entries[i].p == NULL) {
+			len_p[i] = 0;
+			type_p[i] = GIT_OBJ_BAD;
+			continue;
+		}
+
+		error = git_packfile_resolve_header(
+			&len_p[i], &type_p[i], entries[i].p, entries[i].offset);
+	}
+
+	git__free(entries);
+	return error;
+}
+
 static int pack_backend__exists_prefix(
 	git_oid *out, git_odb_backend *backend, const git_oid *short_id, size_t len)
 {
@@ -466,13 +695,41 @@ static int pack_backend__writepack_append(struct git_odb_writepack *_writepack,
 	return git_indexer_append(writepack->indexer, data, size, stats);
 }
 
+/*
+ * Objects which a promisor pack refers to but which are missing are
+ * expected to be missing, and git knows the pack by this file.
+ */
+static int write_promisor_marker(struct pack_backend *backend, const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT, empty = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	int error;
+
+	git_oid_tostr(hex, sizeof(hex), id);
+
+	if ((error = git_buf_printf(&path, "%s/pack-%s.promisor", backend->pack_folder, hex)) == 0)
+		error = git_futils_writebuffer(&empty, path.ptr,
+			O_WRONLY | O_CREAT | O_TRUNC, GIT_PACK_FILE_MODE);
+
+	git_buf_free(&path);
+	return error;
+}
+
 static int pack_backend__writepack_commit(struct git_odb_writepack *_writepack, git_transfer_progress *stats)
 {
 	struct pack_writepack *writepack = (struct pack_writepack *)_writepack;
+	int error;
 
 	assert(writepack);
 
-	return git_indexer_commit(writepack->indexer, stats);
+	if ((error = git_indexer_commit(writepack->indexer, stats)) < 0 ||
+		(writepack->promisor && (error = write_promisor_marker(
+			(struct pack_backend *)writepack->parent.backend,
+			git_indexer_hash(writepack->indexer))) < 0))
+		return error;
+
+	/* pick up the new pack right away */
+	return pack_backend__refresh(writepack->parent.backend);
 }
 
 static void pack_backend__writepack_free(struct git_odb_writepack *_writepack)
@@ -509,6 +766,7 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 		return -1;
 	}
 
+	writepack->promisor = GIT_GLOBAL->promisor_pack;
 	writepack->parent.backend = _backend;
 	writepack->parent.append = pack_backend__writepack_append;
 	writepack->parent.commit = pack_backend__writepack_commit;
@@ -535,6 +793,7 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
+	git__free(backend->missing);
 	git__free(backend);
 }
 
@@ -543,7 +802,11 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GITERR_CHECK_ALLOC(backend);
 
-	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+	backend->missing = git__calloc(PACK_MISSING_CACHE_SIZE, sizeof(git_oid));
+
+	if (!backend->missing ||
+		git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git__free(backend->missing);
 		git__free(backend);
 		return -1;
 	}
@@ -553,8 +816,11 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.readstream = &pack_backend__readstream;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
+	backend->parent.exists_many = &pack_backend__exists_many;
+	backend->parent.read_header_many = &pack_backend__read_header_many;
 	backend->parent.refresh = &pack_backend__refresh;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "git2/config.h"
+#include "git2/remote.h"
+#include "git2/sys/odb_backend.h"
+#include "fetch.h"
+#include "global.h"
+#include "odb.h"
+#include "repository.h"
+
+#include "git2/odb_backend.h"
+
+/* consulted after every other backend */
+#define GIT_PROMISOR_PRIORITY 0
+
+typedef struct {
+	git_odb_backend parent;
+
+	/*
+	 * The database may outlive the repository it was opened for, so the
+	 * repository is opened again from its path for every fetch.
+	 */
+	char *repo_path;
+	char *remote_name;
+} promisor_backend;
+
+static int promisor_fetch(
+	promisor_backend *backend, const git_oid *ids, size_t count)
+{
+	git_repository *repo = NULL;
+	git_remote *remote = NULL;
+	int error;
+
+	/*
+	 * The fetch looks up objects itself, which must not be fetched in
+	 * turn; this is per thread, so other threads may fetch meanwhile.
+	 */
+	GIT_GLOBAL->promisor_fetching = true;
+
+	if ((error = git_repository_open_bare(&repo, backend->repo_path)) == 0 &&
+		(error = git_remote_lookup(&remote, repo, backend->remote_name)) == 0)
+		error = git_fetch__objects(remote, ids, count,
+			&backend->parent.odb->promisor_callbacks);
+
+	GIT_GLOBAL->promisor_fetching = false;
+
+	git_remote_free(remote);
+	git_repository_free(repo);
+
+	/* the remote doesn't have it either: the object is missing */
+	if (error == GIT_ENOTFOUND)
+		giterr_set(GITERR_ODB,
+			"The object is missing from the promisor remote '%s'",
+			backend->remote_name);
+
+	if (error < 0)
+		return error;
+
+	return git_odb_refresh(backend->parent.odb);
+}
+
+static int promisor_backend__read(
+	void **buffer_p, size_t *len_p, git_otype *type_p,
+	git_odb_backend *_backend, const git_oid *oid)
+{
+	promisor_backend *backend = (promisor_backend *)_backend;
+	git_odb_object *obj;
+	int error;
+
+	if (GIT_GLOBAL->promisor_fetching)
+		return GIT_ENOTFOUND;
+
+	if ((error = promisor_fetch(backend, oid, 1)) < 0)
+		return error;
+
+	GIT_GLOBAL->promisor_fetching = true;
+	error = git_odb_read(&obj, backend->parent.odb, oid);
+	GIT_GLOBAL->promisor_fetching = false;
+
+	if (error < 0)
+		return error;
+
+	*len_p = git_odb_object_size(obj);
+	*type_p = git_odb_object_type(obj);
+	*buffer_p = git_odb_backend_malloc(_backend, *len_p + 1);
+
+	if (*buffer_p == NULL) {
+		git_odb_object_free(obj);
+		return -1;
+	}
+
+	memcpy(*buffer_p, git_odb_object_data(obj), *len_p);
+	((char *)*buffer_p)[*len_p] = '\0';
+
+	git_odb_object_free(obj);
+	return 0;
+}
+
+static int promisor_backend__read_header(
+	size_t *len_p, git_otype *type_p,
+	git_odb_backend *_backend, const git_oid *oid)
+{
+	promisor_backend *backend = (promisor_backend *)_backend;
+	int error;
+
+	if (GIT_GLOBAL->promisor_fetching)
+		return GIT_ENOTFOUND;
+
+	if ((error = promisor_fetch(backend, oid, 1)) < 0)
+		return error;
+
+	GIT_GLOBAL->promisor_fetching = true;
+	error = git_odb_read_header(len_p, type_p, backend->parent.odb, oid);
+	GIT_GLOBAL->promisor_fetching = false;
+
+	return error;
+}
+
+static int promisor_backend__prefetch(
+	git_odb_backend *_backend, const git_oid *ids, size_t count)
+{
+	promisor_backend *backend = (promisor_backend *)_backend;
+
+	if (GIT_GLOBAL->promisor_fetching || !count)
+		return 0;
+
+	return promisor_fetch(backend, ids, count);
+}
+
+/* the promised objects are not known until they are asked for */
+static int promisor_backend__foreach(
+	git_odb_backend *_backend, git_odb_foreach_cb cb, void *payload)
+{
+	GIT_UNUSED(_backend);
+	GIT_UNUSED(cb);
+	GIT_UNUSED(payload);
+
+	return 0;
+}
+
+static void promisor_backend__free(git_odb_backend *_backend)
+{
+	promisor_backend *backend = (promisor_backend *)_backend;
+
+	git__free(backend->repo_path);
+	git__free(backend->remote_name);
+	git__free(backend);
+}
+
+int git_odb_backend_promisor(
+	git_odb_backend **out, git_repository *repo, const char *remote_name)
+{
+	promisor_backend *backend;
+
+	assert(out && repo && remote_name);
+
+	backend = git__calloc(1, sizeof(promisor_backend));
+	GITERR_CHECK_ALLOC(backend);
+
+	backend->repo_path = git__strdup(git_repository_path(repo));
+	backend->remote_name = git__strdup(remote_name);
+	if (!backend->repo_path || !backend->remote_name) {
+		promisor_backend__free((git_odb_backend *)backend);
+		return -1;
+	}
+
+	backend->parent.version = GIT_ODB_BACKEND_VERSION;
+	backend->parent.read = &promisor_backend__read;
+	backend->parent.read_header = &promisor_backend__read_header;
+	backend->parent.prefetch = &promisor_backend__prefetch;
+	backend->parent.foreach = &promisor_backend__foreach;
+	backend->parent.free = &promisor_backend__free;
+
+	*out = (git_odb_backend *)backend;
+	return 0;
+}
+
+int git_odb_set_promisor_callbacks(
+	git_odb *odb, const git_remote_callbacks *callbacks)
+{
+	assert(odb);
+
+	if (!callbacks)
+		return git_remote_init_callbacks(
+			&odb->promisor_callbacks, GIT_REMOTE_CALLBACKS_VERSION);
+
+	GITERR_CHECK_VERSION(callbacks, GIT_REMOTE_CALLBACKS_VERSION, "git_remote_callbacks");
+
+	memcpy(&odb->promisor_callbacks, callbacks, sizeof(git_remote_callbacks));
+	return 0;
+}
+
+int git_odb__add_promisor(
+	git_odb *odb, git_repository *repo, const char *remote_name)
+{
+	git_odb_backend *backend;
+	promisor_backend *promisor;
+	size_t i;
+	int error;
+
+	for (i = 0; i < git_odb_num_backends(odb); i++) {
+		if ((error = git_odb_get_backend(&backend, odb, i)) < 0)
+			return error;
+
+		promisor = (promisor_backend *)backend;
+
+		if (backend->read == &promisor_backend__read &&
+			!strcmp(promisor->remote_name, remote_name))
+			return 0;
+	}
+
+	if ((error = git_odb_backend_promisor(&backend, repo, remote_name)) < 0)
+		return error;
+
+	if ((error = git_odb_add_backend(odb, backend, GIT_PROMISOR_PRIORITY)) < 0)
+		backend->free(backend);
+
+	return error;
+}
+
+typedef struct {
+	git_odb *odb;
+	git_repository *repo;
+	git_buf name;
+} load_promisor_data;
+
+static int load_promisor__cb(const git_config_entry *entry, void *payload)
+{
+	load_promisor_data *data = payload;
+	const char *name = entry->name + strlen("remote.");
+	size_t name_len = strlen(name) - strlen(".promisor");
+	int promisor;
+
+	if (git_config_parse_bool(&promisor, entry->value) < 0) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (!promisor)
+		return 0;
+
+	git_buf_clear(&data->name);
+
+	if (git_buf_put(&data->name, name, name_len) < 0)
+		return -1;
+
+	return git_odb__add_promisor(data->odb, data->repo, data->name.ptr);
+}
+
+int git_odb__load_promisors(git_odb *odb, git_repository *repo)
+{
+	load_promisor_data data = { odb, repo, GIT_BUF_INIT };
+	git_config *cfg;
+	int error;
+
+	if ((error = git_repository_config__weakptr(&cfg, repo)) < 0)
+		return error;
+
+	error = git_config_foreach_match(cfg,
+		"^remote\\..+\\.promisor$", load_promisor__cb, &data);
+
+	git_buf_free(&data.name);
+	return error;
+}
@@ -14,6 +14,7 @@
 #include "stream.h"
 #include "socket_stream.h"
 #include "netops.h"
+#include "strmap.h"
 #include "git2/transport.h"
 
 #ifdef GIT_CURL
@@ -304,16 +305,132 @@ typedef struct {
 	git_stream *io;
 	bool connected;
 	char *host;
+	char *port;
 	SSL *ssl;
 	git_cert_x509 cert_info;
 } openssl_stream;
 
 int openssl_close(git_stream *stream);
 
+GIT__USE_STRMAP
+
+/*
+ * The sessions of earlier connections by "host:port", so that a new
+ * connection to the same server can resume one instead of going
+ * through a full handshake.  Guarded by the connection pool's lock.
+ */
+static git_strmap *tls_sessions;
+
+static void tls_sessions_free(void)
+{
+	git_strmap *sessions = tls_sessions;
+	const char *key;
+	SSL_SESSION *session;
+
+	tls_sessions = NULL;
+
+	if (!sessions)
+		return;
+
+	git_strmap_foreach(sessions, key, session, {
+		git__free((char *)key);
+		SSL_SESSION_free(session);
+	});
+
+	git_strmap_free(sessions);
+}
+
+static int tls_session_key(git_buf *out, openssl_stream *st)
+{
+	return git_buf_printf(out, "%s:%s", st->host, st->port);
+}
+
+/* Offer the server the session we last had with it, if any */
+static bool tls_session_resume(openssl_stream *st)
+{
+	git_buf key = GIT_BUF_INIT;
+	khiter_t pos;
+	bool offered = false;
+
+	if (tls_session_key(&key, st) < 0 ||
+		git_mutex_lock(&git__stream_pool_mutex) < 0) {
+		git_buf_free(&key);
+		return false;
+	}
+
+	if (tls_sessions) {
+		pos = git_strmap_lookup_index(tls_sessions, key.ptr);
+
+		/* the SSL object takes its own reference to the session */
+		if (git_strmap_valid_index(tls_sessions, pos))
+			offered = SSL_set_session(st->ssl,
+				git_strmap_value_at(tls_sessions, pos)) == 1;
+	}
+
+	git_mutex_unlock(&git__stream_pool_mutex);
+	git_buf_free(&key);
+	return offered;
+}
+
+/* Remember the session of an established connection, or forget it */
+static void tls_session_store(openssl_stream *st, SSL_SESSION *session)
+{
+	git_buf key = GIT_BUF_INIT;
+	khiter_t pos;
+	int error = 0;
+
+	if (tls_session_key(&key, st) < 0 ||
+		git_mutex_lock(&git__stream_pool_mutex) < 0)
+		goto done;
+
+	if (!tls_sessions && session) {
+		if (git_strmap_alloc(&tls_sessions) < 0) {
+			git_mutex_unlock(&git__stream_pool_mutex);
+			goto done;
+		}
+
+		git__on_shutdown(tls_sessions_free);
+	}
+
+	if (tls_sessions) {
+		pos = git_strmap_lookup_index(tls_sessions, key.ptr);
+
+		if (git_strmap_valid_index(tls_sessions, pos)) {
+			SSL_SESSION_free(git_strmap_value_at(tls_sessions, pos));
+
+			if (session) {
+				git_strmap_set_value_at(tls_sessions, pos, session);
+			} else {
+				git__free((char *)git_strmap_key(tls_sessions, pos));
+				git_strmap_delete_at(tls_sessions, pos);
+			}
+
+			session = NULL;
+		} else if (session) {
+			git_strmap_insert(tls_sessions, key.ptr, session, error);
+
+			if (error >= 0) {
+				git_buf_detach(&key);
+				session = NULL;
+			}
+		}
+	}
+
+	git_mutex_unlock(&git__stream_pool_mutex);
+
+done:
+	if (session)
+		SSL_SESSION_free(session);
+
+	git_buf_free(&key);
+	giterr_clear();
+}
+
 int openssl_connect(git_stream *stream)
 {
 	int ret;
 	BIO *bio;
+	bool resumed;
 	openssl_stream *st = (openssl_stream *) stream;
 
 	if ((ret = git_stream_connect(st->io)) < 0)
@@ -331,10 +448,20 @@ int openssl_connect(git_stream *stream)
 	SSL_set_tlsext_host_name(st->ssl, st->host);
 #endif
 
-	if ((ret = SSL_connect(st->ssl)) <= 0)
+	resumed = tls_session_resume(st);
+
+	if ((ret = SSL_connect(st->ssl)) <= 0) {
+		if (resumed)
+			tls_session_store(st, NULL);
+
 		return ssl_set_error(st->ssl, ret);
+	}
 
-	return verify_server_cert(st->ssl, st->host);
+	if ((ret = verify_server_cert(st->ssl, st->host)) < 0)
+		return ret;
+
+	tls_session_store(st, SSL_get1_session(st->ssl));
+	return 0;
 }
 
 int openssl_certificate(git_cert **out, git_stream *stream)
@@ -363,6 +490,9 @@ int openssl_certificate(git_cert **out, git_stream *stream)
 		return -1;
 	}
 
+	/* a pooled connection has its certificate asked for again */
+	git__free(st->cert_info.data);
+
 	st->cert_info.parent.cert_type = GIT_CERT_X509;
 	st->cert_info.data = encoded_cert;
 	st->cert_info.len = len;
@@ -422,6 +552,7 @@ void openssl_free(git_stream *stream)
 	openssl_stream *st = (openssl_stream *) stream;
 
 	git__free(st->host);
+	git__free(st->port);
 	git__free(st->cert_info.data);
 	git_stream_free(st->io);
 	git__free(st);
@@ -453,6 +584,9 @@ int git_openssl_stream_new(git_stream **out, const char *host, const char *port)
 	st->host = git__strdup(host);
 	GITERR_CHECK_ALLOC(st->host);
 
+	st->port = git__strdup(port);
+	GITERR_CHECK_ALLOC(st->port);
+
 	st->parent.version = GIT_STREAM_VERSION;
 	st->parent.encrypted = 1;
 	st->parent.proxy_support = git_stream_supports_proxy(st->io);
@@ -23,6 +23,7 @@
 #include "git2/tag.h"
 #include "git2/indexer.h"
 #include "git2/config.h"
+#include "git2/odb_backend.h"
 
 struct unpacked {
 	git_pobject *object;
@@ -107,7 +108,7 @@ static int packbuilder_config(git_packbuilder *pb)
 		   GIT_PACK_DELTA_CACHE_SIZE);
 	config_get("pack.deltaCacheLimit", pb->cache_max_small_delta_size,
 		   GIT_PACK_DELTA_CACHE_LIMIT);
-	config_get("pack.deltaCacheSize", pb->big_file_threshold,
+	config_get("core.bigFileThreshold", pb->big_file_threshold,
 		   GIT_PACK_BIG_FILE_THRESHOLD);
 	config_get("pack.windowMemory", pb->window_memory_limit, 0);
 
@@ -300,6 +301,94 @@ on_error:
 	return -1;
 }
 
+static int write_zstream(
+	git_packbuilder *pb,
+	unsigned char *zbuf,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	size_t zbuf_len;
+	int error;
+
+	while (!git_zstream_done(&pb->zstream)) {
+		zbuf_len = COMPRESS_BUFLEN;
+
+		if ((error = git_zstream_get_output(zbuf, &zbuf_len, &pb->zstream)) < 0 ||
+			(error = write_cb(zbuf, zbuf_len, cb_data)) < 0 ||
+			(error = git_hash_update(&pb->ctx, zbuf, zbuf_len)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+/*
+ * Write an object above the big file threshold by streaming it out of
+ * the object database in chunks, so that it's never held in memory in
+ * full. Returns GIT_PASSTHROUGH if the object can't be streamed.
+ */
+static int write_big_object(
+	git_packbuilder *pb,
+	git_pobject *po,
+	unsigned char *zbuf,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	git_odb_stream *stream;
+	unsigned char hdr[10];
+	char *buf = NULL;
+	size_t hdr_len, total = 0;
+	int error, read;
+
+	if (git_odb_open_rstream(&stream, pb->odb, &po->id) < 0) {
+		giterr_clear();
+		return GIT_PASSTHROUGH;
+	}
+
+	if ((size_t)stream->declared_size != po->size) {
+		git_odb_stream_free(stream);
+		return GIT_PASSTHROUGH;
+	}
+
+	if ((buf = git__malloc(COMPRESS_BUFLEN)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	hdr_len = git_packfile__object_header(hdr, po->size, po->type);
+
+	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
+		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+		goto done;
+
+	while ((read = git_odb_stream_read(stream, buf, COMPRESS_BUFLEN)) > 0) {
+		total += read;
+
+		if ((error = git_zstream_set_input_partial(&pb->zstream, buf, read)) < 0 ||
+			(error = write_zstream(pb, zbuf, write_cb, cb_data)) < 0)
+			goto done;
+	}
+
+	if ((error = read) < 0)
+		goto done;
+
+	if (total != po->size) {
+		giterr_set(GITERR_ODB, "object stream ended early");
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_zstream_set_input(&pb->zstream, NULL, 0)) < 0)
+		goto done;
+
+	error = write_zstream(pb, zbuf, write_cb, cb_data);
+
+done:
+	git__free(buf);
+	git_odb_stream_free(stream);
+	return error;
+}
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
@@ -310,9 +399,26 @@ static int write_object(
 	git_otype type;
 	unsigned char hdr[10], *zbuf = NULL;
 	void *data = NULL;
-	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
+	size_t hdr_len, data_len;
+	bool big = !po->delta && po->size > pb->big_file_threshold;
 	int error;
 
+	zbuf = git__malloc(COMPRESS_BUFLEN);
+	GITERR_CHECK_ALLOC(zbuf);
+
+	/*
+	 * Big objects are stored without compression, since it's
+	 * rarely worth the time; try to stream them as we go.
+	 */
+	git_zstream_reset(&pb->zstream);
+
+	if ((error = git_zstream_set_level(&pb->zstream,
+			big ? Z_NO_COMPRESSION : Z_DEFAULT_COMPRESSION)) < 0)
+		goto done;
+
+	if (big && (error = write_big_object(pb, po, zbuf, write_cb, cb_data)) != GIT_PASSTHROUGH)
+		goto written;
+
 	/*
 	 * If we have a delta base, let's use the delta to save space.
 	 * Otherwise load the whole object. 'data' ends up pointing to
@@ -356,20 +462,10 @@ static int write_object(
 			(error = git_hash_update(&pb->ctx, data, data_len)) < 0)
 			goto done;
 	} else {
-		zbuf = git__malloc(zbuf_len);
-		GITERR_CHECK_ALLOC(zbuf);
-
-		git_zstream_reset(&pb->zstream);
 		git_zstream_set_input(&pb->zstream, data, data_len);
 
-		while (!git_zstream_done(&pb->zstream)) {
-			if ((error = git_zstream_get_output(zbuf, &zbuf_len, &pb->zstream)) < 0 ||
-				(error = write_cb(zbuf, zbuf_len, cb_data)) < 0 ||
-				(error = git_hash_update(&pb->ctx, zbuf, zbuf_len)) < 0)
-				goto done;
-
-			zbuf_len = COMPRESS_BUFLEN; /* reuse buffer */
-		}
+		if ((error = write_zstream(pb, zbuf, write_cb, cb_data)) < 0)
+			goto done;
 	}
 
 	/*
@@ -384,7 +480,9 @@ static int write_object(
 		po->delta_data = NULL;
 	}
 
-	pb->nr_written++;
+written:
+	if (!error)
+		pb->nr_written++;
 
 done:
 	git__free(zbuf);
@@ -1383,16 +1481,118 @@ const git_oid *git_packbuilder_hash(git_packbuilder *pb)
 }
 
 
+int git_pack_filter_parse(git_pack_filter *out, const char *spec)
+{
+	const char *end;
+	int64_t n;
+
+	memset(out, 0, sizeof(git_pack_filter));
+
+	if (!strcmp(spec, "blob:none")) {
+		out->type = GIT_PACK_FILTER_BLOB_NONE;
+		return 0;
+	}
+
+	if (!git__prefixcmp(spec, "blob:limit=")) {
+		if (git__strtol64(&n, spec + strlen("blob:limit="), &end, 10) < 0 || n < 0)
+			goto invalid;
+
+		switch (*end) {
+		case 'g': case 'G': n *= 1024; /* fall through */
+		case 'm': case 'M': n *= 1024; /* fall through */
+		case 'k': case 'K': n *= 1024; end++; break;
+		}
+
+		if (*end)
+			goto invalid;
+
+		out->type = GIT_PACK_FILTER_BLOB_LIMIT;
+		out->blob_limit = n;
+		return 0;
+	}
+
+	if (!git__prefixcmp(spec, "tree:")) {
+		if (git__strtol64(&n, spec + strlen("tree:"), &end, 10) < 0 ||
+			n < 0 || n > UINT_MAX || *end)
+			goto invalid;
+
+		out->type = GIT_PACK_FILTER_TREE_DEPTH;
+		out->tree_depth = (unsigned int)n;
+		return 0;
+	}
+
+invalid:
+	giterr_set(GITERR_INVALID, "Invalid object filter '%s'", spec);
+	return -1;
+}
+
+/*
+ * Whether the filter lets through a tree `depth` levels below the root
+ * tree, or a blob when `blob` is given.
+ */
+static int filter_allows(
+	bool *out, git_packbuilder *pb, const git_oid *blob, unsigned int depth)
+{
+	size_t size;
+	git_otype type;
+	int error;
+
+	*out = true;
+
+	switch (pb->filter.type) {
+	case GIT_PACK_FILTER_BLOB_NONE:
+		*out = (blob == NULL);
+		break;
+	case GIT_PACK_FILTER_BLOB_LIMIT:
+		if (blob == NULL)
+			break;
+
+		if ((error = git_odb_read_header(&size, &type, pb->odb, blob)) < 0)
+			return error;
+
+		*out = ((git_off_t)size < pb->filter.blob_limit);
+		break;
+	case GIT_PACK_FILTER_TREE_DEPTH:
+		*out = (depth < pb->filter.tree_depth);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static unsigned int tree_walk_depth(const char *root)
+{
+	unsigned int depth = 1;
+
+	for (; *root; root++)
+		if (*root == '/')
+			depth++;
+
+	return depth;
+}
+
 static int cb_tree_walk(
 	const char *root, const git_tree_entry *entry, void *payload)
 {
 	int error;
+	bool allowed;
 	struct tree_walk_context *ctx = payload;
 
 	/* A commit inside a tree represents a submodule commit and should be skipped. */
 	if (git_tree_entry_type(entry) == GIT_OBJ_COMMIT)
 		return 0;
 
+	if ((error = filter_allows(&allowed, ctx->pb,
+			git_tree_entry_type(entry) == GIT_OBJ_BLOB ? git_tree_entry_id(entry) : NULL,
+			tree_walk_depth(root))) < 0)
+		return error;
+
+	/* skip the entry, and the whole subtree if it is one */
+	if (!allowed)
+		return 1;
+
 	if (!(error = git_buf_sets(&ctx->buf, root)) &&
 		!(error = git_buf_puts(&ctx->buf, git_tree_entry_name(entry))))
 		error = git_packbuilder_insert(
@@ -1404,16 +1604,18 @@ static int cb_tree_walk(
 int git_packbuilder_insert_commit(git_packbuilder *pb, const git_oid *oid)
 {
 	git_commit *commit;
+	bool allowed;
+	int error;
 
-	if (git_commit_lookup(&commit, pb->repo, oid) < 0 ||
-		git_packbuilder_insert(pb, oid, NULL) < 0)
+	if (git_commit_lookup(&commit, pb->repo, oid) < 0)
 		return -1;
 
-	if (git_packbuilder_insert_tree(pb, git_commit_tree_id(commit)) < 0)
-		return -1;
+	if ((error = git_packbuilder_insert(pb, oid, NULL)) == 0 &&
+		(error = filter_allows(&allowed, pb, NULL, 0)) == 0 && allowed)
+		error = git_packbuilder_insert_tree(pb, git_commit_tree_id(commit));
 
 	git_commit_free(commit);
-	return 0;
+	return error < 0 ? -1 : 0;
 }
 
 int git_packbuilder_insert_tree(git_packbuilder *pb, const git_oid *oid)
@@ -1595,14 +1797,18 @@ static int mark_edges_uninteresting(git_packbuilder *pb, git_commit_list *commit
 	return 0;
 }
 
-int insert_tree(git_packbuilder *pb, git_tree *tree)
+int insert_tree(git_packbuilder *pb, git_tree *tree, unsigned int depth)
 {
 	size_t i;
 	int error;
+	bool allowed;
 	git_tree *subtree;
 	git_walk_object *obj;
 	const char *name;
 
+	if ((error = filter_allows(&allowed, pb, NULL, depth)) < 0 || !allowed)
+		return error;
+
 	if ((error = retrieve_object(&obj, pb, git_tree_id(tree))) < 0)
 		return error;
 
@@ -1622,7 +1828,7 @@ int insert_tree(git_packbuilder *pb, git_tree *tree)
 			if ((error = git_tree_lookup(&subtree, pb->repo, entry_id)) < 0)
 				return error;
 
-			error = insert_tree(pb, subtree);
+			error = insert_tree(pb, subtree, depth + 1);
 			git_tree_free(subtree);
 
 			if (error < 0)
@@ -1630,6 +1836,12 @@ int insert_tree(git_packbuilder *pb, git_tree *tree)
 
 			break;
 		case GIT_OBJ_BLOB:
+			if ((error = filter_allows(&allowed, pb, entry_id, depth + 1)) < 0)
+				return error;
+
+			if (!allowed)
+				break;
+
 			name = git_tree_entry_name(entry);
 			if ((error = git_packbuilder_insert(pb, entry_id, name)) < 0)
 				return error;
@@ -1661,7 +1873,7 @@ int insert_commit(git_packbuilder *pb, git_walk_object *obj)
 	if ((error = git_tree_lookup(&tree, pb->repo, git_commit_tree_id(commit))) < 0)
 		goto cleanup;
 
-	if ((error = insert_tree(pb, tree)) < 0)
+	if ((error = insert_tree(pb, tree, 0)) < 0)
 		goto cleanup;
 
 cleanup:
@@ -24,7 +24,20 @@
 #define GIT_PACK_DEPTH 50 /* max delta depth */
 #define GIT_PACK_DELTA_CACHE_SIZE (256 * 1024 * 1024)
 #define GIT_PACK_DELTA_CACHE_LIMIT 1000
-#define GIT_PACK_BIG_FILE_THRESHOLD (512 * 1024 * 1024)
+
+/* Objects left out of a pack for a partial clone */
+typedef enum {
+	GIT_PACK_FILTER_NONE = 0,
+	GIT_PACK_FILTER_BLOB_NONE, /* "blob:none", no blobs at all */
+	GIT_PACK_FILTER_BLOB_LIMIT, /* "blob:limit=<n>", no blobs of n bytes or more */
+	GIT_PACK_FILTER_TREE_DEPTH, /* "tree:<n>", nothing n levels below the root */
+} git_pack_filter_t;
+
+typedef struct {
+	git_pack_filter_t type;
+	git_off_t blob_limit;
+	unsigned int tree_depth;
+} git_pack_filter;
 
 typedef struct git_pobject {
 	git_oid id;
@@ -97,9 +110,18 @@ struct git_packbuilder {
 	void *progress_cb_payload;
 	double last_progress_report_time; /* the time progress was last reported */
 
+	/* applied when inserting the trees of commits and trees */
+	git_pack_filter filter;
+
 	bool done;
 };
 
 int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
 
+/*
+ * Parse a filter specification as sent by git ("blob:none",
+ * "blob:limit=<n>[kmg]" or "tree:<depth>").
+ */
+int git_pack_filter_parse(git_pack_filter *out, const char *spec);
+
 #endif /* INCLUDE_pack_objects_h__ */
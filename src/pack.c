@@ -623,6 +623,103 @@ on_error:
 	return error;
 }
 
+/*
+ * Apply the deltas in `stack[0..count)` on top of `base`, where the
+ * delta at `stack[count - 1]` applies directly to the base and the one
+ * at `stack[0]` produces the object we want.
+ *
+ * As the chain unwinds, each intermediate object small enough for the
+ * base cache is produced and added to it, so that the deltas sharing
+ * it as their base don't unpack the chain again.  Intermediate objects
+ * too big for the cache are never materialized: the deltas on top of
+ * them are composed into a single list of copies from the last base
+ * and literal inserts, which is then applied once.
+ */
+static int packfile_apply_deltas(
+	git_rawobj *obj,
+	struct git_pack_file *p,
+	git_mwindow **w_curs,
+	git_off_t *curpos,
+	struct pack_chain_elem *stack,
+	size_t count,
+	git_rawobj *base)
+{
+	git_delta_chain chain = GIT_DELTA_CHAIN_INIT;
+	git_array_t(git_rawobj) deltas = GIT_ARRAY_INIT;
+	git_pack_cache_entry *cached = NULL;
+	git_rawobj current = *base, result, *delta;
+	size_t i, j;
+	int free_current = 0, error = 0;
+
+	for (i = count; i > 0; i--) {
+		struct pack_chain_elem *elem = &stack[i - 1];
+
+		if ((delta = git_array_alloc(deltas)) == NULL) {
+			error = -1;
+			break;
+		}
+
+		*curpos = elem->offset;
+		error = packfile_unpack_compressed(delta, p, w_curs, curpos, elem->size, elem->type);
+		git_mwindow_close(w_curs);
+
+		if (error < 0) {
+			deltas.size--;
+			break;
+		}
+
+		if ((error = git__delta_chain_add(&chain, delta->data, delta->len)) < 0)
+			break;
+
+		if (i > 1 && chain.res_len > GIT_PACK_CACHE_SIZE_LIMIT)
+			continue;
+
+		/* a single delta needs no composition */
+		if (chain.depth == 1)
+			error = git__delta_apply(&result, current.data, current.len, delta->data, delta->len);
+		else
+			error = git__delta_chain_apply(&result, &chain, current.data, current.len);
+
+		result.type = base->type;
+
+		git__delta_chain_free(&chain);
+		for (j = 0; j < deltas.size; j++)
+			git__free(deltas.ptr[j].data);
+		deltas.size = 0;
+
+		if (free_current)
+			git__free(current.data);
+		if (cached)
+			git_atomic_dec(&cached->refcount);
+
+		free_current = 0;
+		cached = NULL;
+
+		if (error < 0)
+			break;
+
+		if (i == 1) {
+			*obj = result;
+			break;
+		}
+
+		current = result;
+		free_current = !!cache_add(&cached, &p->bases, &current, elem->base_key);
+	}
+
+	for (j = 0; j < deltas.size; j++)
+		git__free(deltas.ptr[j].data);
+	git_array_clear(deltas);
+	git__delta_chain_free(&chain);
+
+	if (free_current)
+		git__free(current.data);
+	if (cached)
+		git_atomic_dec(&cached->refcount);
+
+	return error;
+}
+
 int git_packfile_unpack(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -704,9 +801,9 @@ int git_packfile_unpack(
 		goto cleanup;
 	}
 
-	/* we now apply each consecutive delta until we run out */
-	while (elem_pos > 0 && !error) {
-		git_rawobj base, delta;
+	/* we now apply the deltas on top of the base */
+	if (elem_pos > 0) {
+		git_rawobj base;
 
 		/*
 		 * We can now try to add the base to the cache, as
@@ -715,50 +812,33 @@ int git_packfile_unpack(
 		if (!cached)
 			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
 
-		elem = &stack[elem_pos - 1];
-		curpos = elem->offset;
-		error = packfile_unpack_compressed(&delta, p, &w_curs, &curpos, elem->size, elem->type);
-		git_mwindow_close(&w_curs);
-
-		if (error < 0)
-			break;
-
-		/* the current object becomes the new base, on which we apply the delta */
+		/* the current object is the base on which we apply the deltas */
 		base = *obj;
 		obj->data = NULL;
 		obj->len = 0;
 		obj->type = GIT_OBJ_BAD;
 
-		error = git__delta_apply(obj, base.data, base.len, delta.data, delta.len);
+		error = packfile_apply_deltas(obj, p, &w_curs, &curpos, stack, elem_pos, &base);
 		obj->type = base_type;
+
 		/*
 		 * We usually don't want to free the base at this
-		 * point, as we put it into the cache in the previous
-		 * iteration. free_base lets us know that we got the
-		 * base object directly from the packfile, so we can free it.
+		 * point, as we put it into the cache above. free_base
+		 * lets us know that we got the base object directly
+		 * from the packfile, so we can free it.
 		 */
-		git__free(delta.data);
-		if (free_base) {
-			free_base = 0;
+		if (free_base)
 			git__free(base.data);
-		}
 
-		if (cached) {
+		if (cached)
 			git_atomic_dec(&cached->refcount);
-			cached = NULL;
-		}
-
-		if (error < 0)
-			break;
-
-		elem_pos--;
 	}
 
 cleanup:
 	if (error < 0)
 		git__free(obj->data);
 
-	if (elem)
+	if (elem || elem_pos > 0)
 		*obj_offset = curpos;
 
 	git_array_clear(chain);
@@ -767,8 +847,14 @@ cleanup:
 
 static void *use_git_alloc(void *opaq, unsigned int count, unsigned int size)
 {
-	GIT_UNUSED(opaq);
-	return git__calloc(count, size);
+	size_t *allocated = opaq;
+	void *ptr = git__calloc(count, size);
+
+	/* the checkpoints of object streams count what they hold */
+	if (ptr && allocated)
+		*allocated += (size_t)count * size;
+
+	return ptr;
 }
 
 static void use_git_free(void *opaq, void *ptr)
@@ -790,7 +876,6 @@ int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p,
 	obj->zstream.next_out = Z_NULL;
 	st = inflateInit(&obj->zstream);
 	if (st != Z_OK) {
-		git__free(obj);
 		giterr_set(GITERR_ZLIB, "failed to init packfile stream");
 		return -1;
 	}
@@ -843,6 +928,325 @@ void git_packfile_stream_free(git_packfile_stream *obj)
 	inflateEnd(&obj->zstream);
 }
 
+static void checkpoint_free(git_packfile_checkpoint *cp)
+{
+	if (!cp)
+		return;
+
+	inflateEnd(&cp->zstream);
+	git__free(cp);
+}
+
+static size_t object_stream_next_checkpoint(git_packfile_object_stream *obj)
+{
+	return (obj->checkpoints_len + 1) * obj->checkpoint_interval;
+}
+
+/* Remember where the inflation of the base is, to come back to it */
+static int object_stream_checkpoint(git_packfile_object_stream *obj)
+{
+	git_packfile_checkpoint *cp;
+	size_t i;
+	int st;
+
+	if (obj->checkpoints_len == GIT_PACK_STREAM_CHECKPOINTS) {
+		for (i = 0; i < GIT_PACK_STREAM_CHECKPOINTS; i++) {
+			if (i % 2)
+				obj->checkpoints[i / 2] = obj->checkpoints[i];
+			else
+				checkpoint_free(obj->checkpoints[i]);
+
+			obj->checkpoints[i] = NULL;
+		}
+
+		obj->checkpoints_len /= 2;
+		obj->checkpoint_interval *= 2;
+
+		/* we're halfway between two of the remaining ones */
+		return 0;
+	}
+
+	cp = git__calloc(1, sizeof(git_packfile_checkpoint));
+	GITERR_CHECK_ALLOC(cp);
+
+	obj->base.zstream.opaque = &cp->allocated;
+	st = inflateCopy(&cp->zstream, &obj->base.zstream);
+	obj->base.zstream.opaque = Z_NULL;
+	cp->zstream.opaque = Z_NULL;
+
+	if (st != Z_OK) {
+		git__free(cp);
+		giterr_set(GITERR_ZLIB, "failed to copy the packfile stream");
+		return -1;
+	}
+
+	cp->curpos = obj->base.curpos;
+	obj->checkpoints[obj->checkpoints_len++] = cp;
+
+	return 0;
+}
+
+/* Go back to the closest point at or before `off` in the base */
+static int object_stream_rewind(git_packfile_object_stream *obj, size_t off)
+{
+	git_packfile_checkpoint *cp;
+	size_t n = min(off / obj->checkpoint_interval, obj->checkpoints_len);
+
+	git_packfile_stream_free(&obj->base);
+
+	if (!n) {
+		obj->base_pos = 0;
+		return git_packfile_stream_open(&obj->base, obj->p, obj->base_offset);
+	}
+
+	cp = obj->checkpoints[n - 1];
+
+	memset(&obj->base, 0, sizeof(git_packfile_stream));
+	obj->base.p = obj->p;
+	obj->base.curpos = cp->curpos;
+	obj->base_pos = n * obj->checkpoint_interval;
+
+	if (inflateCopy(&obj->base.zstream, &cp->zstream) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "failed to copy the packfile stream");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Inflate exactly `len` bytes of the object's base into `out` */
+static int object_stream_inflate(
+	git_packfile_object_stream *obj, unsigned char *out, size_t len)
+{
+	while (len) {
+		git_off_t start = obj->base.curpos;
+		size_t chunk = min(len, UINT_MAX);
+		ssize_t read;
+
+		/* only deltas may have to go back in their base */
+		if (obj->chain.depth) {
+			if (obj->base_pos == object_stream_next_checkpoint(obj) &&
+				object_stream_checkpoint(obj) < 0)
+				return -1;
+
+			chunk = min(chunk, object_stream_next_checkpoint(obj) - obj->base_pos);
+		}
+
+		read = git_packfile_stream_read(&obj->base, out, chunk);
+
+		/* we may simply have consumed input without producing output */
+		if (read == GIT_EBUFS && obj->base.curpos != start)
+			continue;
+
+		if (read == 0 || read == GIT_EBUFS)
+			return packfile_error("object is truncated");
+
+		if (read < 0)
+			return (int)read;
+
+		out += read;
+		len -= read;
+		obj->base_pos += read;
+	}
+
+	return 0;
+}
+
+/*
+ * Read `len` bytes from `off` onwards in the object's base, going back
+ * to the closest checkpoint when the deltas copy from before where the
+ * inflation is.
+ */
+static int object_stream_read_base(
+	git_packfile_object_stream *obj, size_t off, unsigned char *out, size_t len)
+{
+	unsigned char skip[4096];
+
+	if (off < obj->base_pos && object_stream_rewind(obj, off) < 0)
+		return -1;
+
+	while (obj->base_pos < off) {
+		if (object_stream_inflate(obj, skip, min(sizeof(skip), off - obj->base_pos)) < 0)
+			return -1;
+	}
+
+	return object_stream_inflate(obj, out, len);
+}
+
+int git_packfile_object_stream_open(
+	git_packfile_object_stream *obj,
+	struct git_pack_file *p,
+	git_off_t offset)
+{
+	git_dependency_chain chain = GIT_ARRAY_INIT;
+	git_mwindow *w_curs = NULL;
+	git_off_t curpos, base_offset;
+	struct pack_chain_elem *elem;
+	git_otype type;
+	size_t size, i;
+	int error;
+
+	memset(obj, 0, sizeof(git_packfile_object_stream));
+	obj->p = p;
+
+	while (true) {
+		curpos = offset;
+		error = git_packfile_unpack_header(&size, &type, &p->mwf, &w_curs, &curpos);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0)
+			goto done;
+
+		if (type != GIT_OBJ_OFS_DELTA && type != GIT_OBJ_REF_DELTA)
+			break;
+
+		base_offset = get_delta_base(p, &w_curs, &curpos, type, offset);
+		git_mwindow_close(&w_curs);
+
+		if (base_offset == 0) {
+			error = packfile_error("delta offset is zero");
+			goto done;
+		}
+		if (base_offset < 0) { /* must actually be an error code */
+			error = (int)base_offset;
+			goto done;
+		}
+
+		if ((elem = git_array_alloc(chain)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		elem->offset = curpos;
+		elem->size = size;
+		elem->type = type;
+
+		offset = base_offset;
+	}
+
+	switch (type) {
+	case GIT_OBJ_COMMIT:
+	case GIT_OBJ_TREE:
+	case GIT_OBJ_BLOB:
+	case GIT_OBJ_TAG:
+		break;
+	default:
+		error = packfile_error("invalid packfile type in header");
+		goto done;
+	}
+
+	obj->type = type;
+	obj->size = size;
+	obj->base_offset = curpos;
+	obj->checkpoint_interval = GIT_PACK_STREAM_CHECKPOINT_INTERVAL;
+
+	/* compose the deltas, starting with the one closest to the base */
+	for (i = git_array_size(chain); i > 0; i--) {
+		git_rawobj *delta = git_array_alloc(obj->deltas);
+
+		if (!delta) {
+			error = -1;
+			goto done;
+		}
+
+		elem = git_array_get(chain, i - 1);
+		curpos = elem->offset;
+
+		error = packfile_unpack_compressed(delta, p, &w_curs, &curpos, elem->size, elem->type);
+		git_mwindow_close(&w_curs);
+
+		if (error < 0) {
+			obj->deltas.size--;
+			goto done;
+		}
+
+		if ((error = git__delta_chain_add(&obj->chain, delta->data, delta->len)) < 0)
+			goto done;
+	}
+
+	if (obj->chain.depth) {
+		if (obj->chain.base_len != size) {
+			error = packfile_error("delta does not match its base");
+			goto done;
+		}
+
+		obj->size = obj->chain.res_len;
+	}
+
+	error = git_packfile_stream_open(&obj->base, p, obj->base_offset);
+
+done:
+	git_array_clear(chain);
+	return error;
+}
+
+ssize_t git_packfile_object_stream_read(
+	git_packfile_object_stream *obj, void *buffer, size_t len)
+{
+	unsigned char *out = buffer;
+	size_t written = 0;
+
+	len = min(len, obj->size - obj->pos);
+
+	if (!obj->chain.depth) {
+		if (len && object_stream_read_base(obj, obj->pos, out, len) < 0)
+			return -1;
+
+		obj->pos += len;
+		return len;
+	}
+
+	while (written < len) {
+		git_delta_fragment *frag = git_array_get(obj->chain.frags, obj->frag);
+		size_t skip, n;
+
+		if (!frag)
+			return packfile_error("delta chain is truncated");
+
+		skip = obj->pos - frag->res_off;
+		n = min(frag->len - skip, len - written);
+
+		if (frag->data)
+			memcpy(out + written, frag->data + skip, n);
+		else if (object_stream_read_base(obj, frag->base_off + skip, out + written, n) < 0)
+			return -1;
+
+		written += n;
+		obj->pos += n;
+
+		if (skip + n == frag->len)
+			obj->frag++;
+	}
+
+	return written;
+}
+
+void git_packfile_object_stream_free(git_packfile_object_stream *obj)
+{
+	size_t i;
+
+	git_packfile_stream_free(&obj->base);
+
+	for (i = 0; i < obj->checkpoints_len; i++)
+		checkpoint_free(obj->checkpoints[i]);
+
+	for (i = 0; i < git_array_size(obj->deltas); i++)
+		git__free(git_array_get(obj->deltas, i)->data);
+
+	git_array_clear(obj->deltas);
+	git__delta_chain_free(&obj->chain);
+}
+
+size_t git_packfile_object_stream__buffered(git_packfile_object_stream *obj)
+{
+	size_t i, buffered = 0;
+
+	for (i = 0; i < obj->checkpoints_len; i++)
+		buffered += sizeof(git_packfile_checkpoint) + obj->checkpoints[i]->allocated;
+
+	return buffered;
+}
+
 int packfile_unpack_compressed(
 	git_rawobj *obj,
 	struct git_pack_file *p,
@@ -1195,6 +1599,17 @@ static int git__memcmp4(const void *a, const void *b) {
 	return memcmp(a, b, 4);
 }
 
+int git_pack_object_count(size_t *out, struct git_pack_file *p)
+{
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	*out = p->num_objects;
+	return 0;
+}
+
 int git_pack_foreach_entry(
 	struct git_pack_file *p,
 	git_odb_foreach_cb cb,
@@ -1387,3 +1802,90 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_find_many(
+		struct git_pack_entry *entries,
+		struct git_pack_file *p,
+		const git_oid *ids,
+		size_t count)
+{
+	const uint32_t *level1_ofs;
+	const unsigned char *index;
+	unsigned hi, lo, stride, from = 0;
+	size_t i, j, found = 0;
+	int pos, error;
+
+	assert(p && (ids || !count));
+
+	if (p->index_version == -1) {
+		if ((error = pack_index_open(p)) < 0)
+			return error;
+		assert(p->index_map.data);
+	}
+
+	level1_ofs = p->index_map.data;
+	index = p->index_map.data;
+
+	if (p->index_version > 1) {
+		level1_ofs += 2;
+		index += 8;
+	}
+
+	index += 4 * 256;
+
+	if (p->index_version > 1) {
+		stride = 20;
+	} else {
+		stride = 24;
+		index += 4;
+	}
+
+	/*
+	 * The ids are sorted, just like the index, so every search can
+	 * start where the previous one left off.
+	 */
+	for (i = 0; i < count; i++) {
+		if (entries[i].p != NULL)
+			continue;
+
+		hi = ntohl(level1_ofs[(int)ids[i].id[0]]);
+		lo = ((ids[i].id[0] == 0x0) ? 0 : ntohl(level1_ofs[(int)ids[i].id[0] - 1]));
+
+		if (lo < from)
+			lo = from;
+		if (lo >= hi)
+			continue;
+
+		pos = sha1_position(index, stride, lo, hi, ids[i].id);
+
+		if (pos < 0) {
+			from = (unsigned)(-1 - pos);
+			continue;
+		}
+
+		from = (unsigned)pos;
+
+		for (j = 0; j < p->num_bad_objects; j++)
+			if (git_oid__cmp(&ids[i], &p->bad_object_sha1[j]) == 0)
+				break;
+
+		if (j < p->num_bad_objects)
+			continue;
+
+		entries[i].offset = nth_packed_object_offset(p, pos);
+		entries[i].p = p;
+		git_oid_cpy(&entries[i].sha1, &ids[i]);
+		found++;
+	}
+
+	/* make sure the packfile backing the index still exists on disk */
+	if (found && p->mwf.fd == -1 && (error = packfile_open(p)) < 0) {
+		for (i = 0; i < count; i++)
+			if (entries[i].p == p)
+				entries[i].p = NULL;
+
+		return error;
+	}
+
+	return 0;
+}
@@ -18,9 +18,16 @@
 #include "odb.h"
 #include "oidmap.h"
 #include "array.h"
+#include "delta-apply.h"
 
 #define GIT_PACK_FILE_MODE 0444
 
+/*
+ * Objects larger than this are neither deltified nor compressed when
+ * packing; they are streamed into the pack inside stored zlib blocks.
+ */
+#define GIT_PACK_BIG_FILE_THRESHOLD (512 * 1024 * 1024)
+
 #define PACK_SIGNATURE 0x5041434b	/* "PACK" */
 #define PACK_VERSION 2
 #define pack_version_ok(v) ((v) == htonl(2) || (v) == htonl(3))
@@ -120,6 +127,48 @@ typedef struct git_packfile_stream {
 	git_mwindow *mw;
 } git_packfile_stream;
 
+#define GIT_PACK_STREAM_CHECKPOINTS 16
+#define GIT_PACK_STREAM_CHECKPOINT_INTERVAL (64 * 1024)
+
+/* A copy of the inflation of a base, to resume it from later on */
+typedef struct {
+	z_stream zstream;
+	git_off_t curpos;
+	size_t allocated;
+} git_packfile_checkpoint;
+
+/*
+ * A stream over the contents of a single object in a pack. The object
+ * is inflated as it is read; for deltified objects, the delta chain is
+ * composed up front and the base is inflated on demand, so memory use
+ * is bounded by the size of the deltas rather than that of the object.
+ *
+ * zlib streams can't seek, so when the deltas copy from the base out of
+ * order, its inflation is resumed from the closest checkpoint before
+ * the copy. There are at most GIT_PACK_STREAM_CHECKPOINTS of them; when
+ * they run out, every other one is dropped and the rest are taken twice
+ * as far apart.
+ */
+typedef struct {
+	struct git_pack_file *p;
+	git_otype type;
+	size_t size;
+	size_t pos;
+
+	git_packfile_stream base;
+	git_off_t base_offset;
+	size_t base_pos;
+
+	/* the n-th checkpoint is `(n + 1) * checkpoint_interval` into the base */
+	git_packfile_checkpoint *checkpoints[GIT_PACK_STREAM_CHECKPOINTS];
+	size_t checkpoints_len;
+	size_t checkpoint_interval;
+
+	git_delta_chain chain;
+	git_array_t(git_rawobj) deltas;
+	size_t frag;
+} git_packfile_object_stream;
+
 size_t git_packfile__object_header(unsigned char *hdr, size_t size, git_otype type);
 
 int git_packfile__name(char **out, const char *path);
@@ -150,6 +199,13 @@ int git_packfile_stream_open(git_packfile_stream *obj, struct git_pack_file *p,
 ssize_t git_packfile_stream_read(git_packfile_stream *obj, void *buffer, size_t len);
 void git_packfile_stream_free(git_packfile_stream *obj);
 
+int git_packfile_object_stream_open(git_packfile_object_stream *obj, struct git_pack_file *p, git_off_t offset);
+ssize_t git_packfile_object_stream_read(git_packfile_object_stream *obj, void *buffer, size_t len);
+void git_packfile_object_stream_free(git_packfile_object_stream *obj);
+
+/* The memory the stream holds on to for seeking back in the base */
+size_t git_packfile_object_stream__buffered(git_packfile_object_stream *obj);
+
 git_off_t get_delta_base(struct git_pack_file *p, git_mwindow **w_curs,
 		git_off_t *curpos, git_otype type,
 		git_off_t delta_obj_offset);
@@ -162,9 +218,24 @@ int git_pack_entry_find(
 		struct git_pack_file *p,
 		const git_oid *short_oid,
 		size_t len);
+
+/*
+ * Look up the sorted `ids` in the index of the pack in a single pass.
+ * Only the entries which have no pack yet are looked for; the ones which
+ * are found are filled in.
+ */
+int git_pack_entry_find_many(
+		struct git_pack_entry *entries,
+		struct git_pack_file *p,
+		const git_oid *ids,
+		size_t count);
+
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		git_odb_foreach_cb cb,
 		void *data);
 
+/* Number of objects in the pack, opening its index if needed */
+int git_pack_object_count(size_t *out, struct git_pack_file *p);
+
 #endif
@@ -74,6 +74,8 @@ int git_push_set_options(git_push *push, const git_push_options *opts)
 
 	push->pb_parallelism = opts->pb_parallelism;
 	push->custom_headers = &opts->custom_headers;
+	push->atomic = !!opts->atomic;
+	push->remote_push_options = &opts->remote_push_options;
 
 	return 0;
 }
@@ -35,10 +35,14 @@ struct git_push {
 	/* report-status */
 	bool unpack_ok;
 	git_vector status;
+	/* whether the transport passed each status on as it arrived */
+	bool status_reported;
 
 	/* options */
 	unsigned pb_parallelism;
 	const git_strarray *custom_headers;
+	bool atomic;
+	const git_strarray *remote_push_options;
 };
 
 /**
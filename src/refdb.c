@@ -13,10 +13,12 @@
 #include "git2/refdb.h"
 #include "git2/sys/refdb_backend.h"
 
+#include "config.h"
 #include "hash.h"
 #include "refdb.h"
 #include "refs.h"
 #include "reflog.h"
+#include "repository.h"
 
 int git_refdb_new(git_refdb **out, git_repository *repo)
 {
@@ -34,20 +36,56 @@ int git_refdb_new(git_refdb **out, git_repository *repo)
 	return 0;
 }
 
+/* Which backend the repository asks for in `extensions.refstorage` */
+static int refdb_storage(bool *reftable, git_repository *repo)
+{
+	git_config *config;
+	git_config_entry *entry = NULL;
+	int error = 0;
+
+	*reftable = false;
+
+	if (!repo->path_repository)
+		return 0;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0 ||
+		(error = git_config__lookup_entry(&entry, config,
+			"extensions.refstorage", false)) < 0)
+		return error;
+
+	if (!entry || !entry->value || !strcasecmp(entry->value, "files"))
+		goto done;
+
+	if (!strcasecmp(entry->value, "reftable")) {
+		*reftable = true;
+	} else {
+		giterr_set(GITERR_REFERENCE,
+			"Unknown reference storage format '%s'", entry->value);
+		error = -1;
+	}
+
+done:
+	git_config_entry_free(entry);
+	return error;
+}
+
 int git_refdb_open(git_refdb **out, git_repository *repo)
 {
 	git_refdb *db;
 	git_refdb_backend *dir;
+	bool reftable;
 
 	assert(out && repo);
 
 	*out = NULL;
 
-	if (git_refdb_new(&db, repo) < 0)
+	if (refdb_storage(&reftable, repo) < 0 ||
+		git_refdb_new(&db, repo) < 0)
 		return -1;
 
-	/* Add the default (filesystem) backend */
-	if (git_refdb_backend_fs(&dir, repo) < 0) {
+	/* Add the default (filesystem) backend, unless told otherwise */
+	if ((reftable ? git_refdb_backend_reftable(&dir, repo) :
+			git_refdb_backend_fs(&dir, repo)) < 0) {
 		git_refdb_free(db);
 		return -1;
 	}
@@ -218,6 +256,29 @@ int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name)
 	return 0;
 }
 
+int git_refdb_reflog_read_recent(
+	git_reflog **out, git_refdb *db, const char *name, size_t count)
+{
+	int error;
+
+	assert(db && db->backend);
+
+	if (!db->backend->reflog_read_recent)
+		return git_refdb_reflog_read(out, db, name);
+
+	if ((error = db->backend->reflog_read_recent(
+			out, db->backend, name, count)) < 0)
+		return error;
+
+	GIT_REFCOUNT_INC(db);
+	(*out)->db = db;
+
+	/* we can only know that the log ended when it came up short */
+	(*out)->truncated = (git_vector_length(&(*out)->entries) >= count);
+
+	return 0;
+}
+
 int git_refdb_has_log(git_refdb *db, const char *refname)
 {
 	assert(db && refname);
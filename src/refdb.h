@@ -46,6 +46,14 @@ int git_refdb_write(git_refdb *refdb, git_reference *ref, int force, const git_s
 int git_refdb_delete(git_refdb *refdb, const char *ref_name, const git_oid *old_id, const char *old_target);
 
 int git_refdb_reflog_read(git_reflog **out, git_refdb *db,  const char *name);
+
+/*
+ * Read the newest `count` entries of a reflog (or more, or all of them).
+ * When the backend may have left older entries out, the reflog is marked
+ * as truncated and cannot be written back.
+ */
+int git_refdb_reflog_read_recent(
+	git_reflog **out, git_refdb *db, const char *name, size_t count);
 int git_refdb_reflog_write(git_reflog *reflog);
 
 int git_refdb_has_log(git_refdb *db, const char *refname);
@@ -17,6 +17,7 @@
 #include "iterator.h"
 #include "sortedcache.h"
 #include "signature.h"
+#include "global.h"
 
 #include <git2/tag.h>
 #include <git2/object.h>
@@ -51,6 +52,31 @@ struct packref {
 	char name[GIT_FLEX_ARRAY];
 };
 
+/*
+ * A packed-refs file that says it is sorted, which we search in place
+ * instead of parsing it into the refcache.  Only the references that
+ * are asked for are ever turned into objects.
+ */
+typedef struct {
+	git_atomic refcount;
+#ifdef GIT_WIN32
+	/* a mapped file could not be replaced when the refs are packed again */
+	git_buf contents;
+#else
+	git_map map;
+#endif
+	const char *start; /* the first record, past the header */
+	const char *end;
+} packed_snapshot;
+
+typedef struct {
+	const char *name;
+	size_t name_len;
+	git_oid oid;
+	git_oid peel;
+	const char *next;
+} packed_record;
+
 typedef struct refdb_fs_backend {
 	git_refdb_backend parent;
 
@@ -61,8 +87,34 @@ typedef struct refdb_fs_backend {
 	int peeling_mode;
 	git_iterator_flag_t iterator_flags;
 	uint32_t direach_flags;
+
+	/* Whenever you want to read or modify these, grab snapshot_lock */
+	git_mutex snapshot_lock;
+	packed_snapshot *snapshot;
+	git_futils_filestamp snapshot_stamp;
+	git_vector txns;
 } refdb_fs_backend;
 
+/* A transaction's deletions wait for its last ref to be unlocked */
+typedef struct {
+	/* the transaction, or the thread, which locked the refs */
+	const void *owner;
+
+	size_t locks;
+	git_vector deletes;
+} fs_txn;
+
+/* What `lock` hands out for every ref */
+typedef struct {
+	fs_txn *txn;
+	git_filebuf lock;
+} fs_txn_ref;
+
+typedef struct {
+	fs_txn_ref *ref;
+	char name[GIT_FLEX_ARRAY];
+} txn_delete;
+
 static int refdb_reflog_fs__delete(git_refdb_backend *_backend, const char *name);
 
 static int packref_cmp(const void *a_, const void *b_)
@@ -194,6 +246,287 @@ parse_failed:
 	return -1;
 }
 
+static int ref_error_notfound(const char *name)
+{
+	giterr_set(GITERR_REFERENCE, "Reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+static void packed_snapshot_free(packed_snapshot *snap)
+{
+	if (!snap || git_atomic_dec(&snap->refcount) > 0)
+		return;
+
+#ifdef GIT_WIN32
+	git_buf_free(&snap->contents);
+#else
+	git_futils_mmap_free(&snap->map);
+#endif
+	git__free(snap);
+}
+
+static int packed_snapshot_corrupted(void)
+{
+	giterr_set(GITERR_REFERENCE, "Corrupted packed references file");
+	return -1;
+}
+
+/*
+ * Load the packed-refs file at `path` if it carries the "sorted" trait;
+ * `out` is left NULL for any other file, which the refcache deals with.
+ */
+static int packed_snapshot_load(
+	packed_snapshot **out, git_futils_filestamp *stamp, const char *path)
+{
+	static const char *traits_header = "# pack-refs with: ";
+	packed_snapshot *snap = NULL;
+	git_buf traits = GIT_BUF_INIT;
+	const char *data, *eol;
+	struct stat st;
+	size_t size;
+	git_file fd;
+	int error;
+
+	*out = NULL;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		giterr_set(GITERR_OS, "Failed to stat '%s'", path);
+		error = -1;
+		goto done;
+	}
+
+	git_futils_filestamp_set_from_stat(stamp, &st);
+
+	if (!git__is_sizet(st.st_size) || !(size = (size_t)st.st_size)) {
+		error = 0;
+		goto done;
+	}
+
+	snap = git__calloc(1, sizeof(packed_snapshot));
+	GITERR_CHECK_ALLOC(snap);
+
+#ifdef GIT_WIN32
+	if ((error = git_futils_readbuffer_fd(&snap->contents, fd, size)) < 0)
+		goto done;
+
+	data = snap->contents.ptr;
+#else
+	if ((error = git_futils_mmap_ro(&snap->map, fd, 0, size)) < 0)
+		goto done;
+
+	data = snap->map.data;
+#endif
+
+	snap->end = data + size;
+
+	if (size < strlen(traits_header) ||
+		memcmp(data, traits_header, strlen(traits_header)) != 0 ||
+		(eol = memchr(data, '\n', size)) == NULL ||
+		git_buf_put(&traits, data, eol - data) < 0 ||
+		strstr(traits.ptr, " sorted ") == NULL) {
+		error = 0;
+		goto done;
+	}
+
+	/* skip the header, and any other comments after it */
+	while (data < snap->end && *data == '#') {
+		if ((eol = memchr(data, '\n', snap->end - data)) == NULL) {
+			error = packed_snapshot_corrupted();
+			goto done;
+		}
+
+		data = eol + 1;
+	}
+
+	snap->start = data;
+	snap->refcount.val = 1;
+
+	*out = snap;
+	snap = NULL;
+	error = 0;
+
+done:
+	if (snap) {
+		snap->refcount.val = 1;
+		packed_snapshot_free(snap);
+	}
+
+	git_buf_free(&traits);
+	p_close(fd);
+	return error;
+}
+
+/*
+ * Get hold of the current packed-refs file if it can be searched in
+ * place, loading it again when it has changed on disk.  `out` is NULL
+ * if the refcache has to be used instead.
+ */
+static int packed_snapshot_get(packed_snapshot **out, refdb_fs_backend *backend)
+{
+	const char *path;
+	int error;
+
+	*out = NULL;
+
+	if (!backend->path)
+		return 0;
+
+	path = git_sortedcache_path(backend->refcache);
+
+	if (git_mutex_lock(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock packed references");
+		return -1;
+	}
+
+	if ((error = git_futils_filestamp_check(&backend->snapshot_stamp, path)) != 0) {
+		packed_snapshot_free(backend->snapshot);
+		backend->snapshot = NULL;
+
+		if (error > 0)
+			error = packed_snapshot_load(
+				&backend->snapshot, &backend->snapshot_stamp, path);
+
+		if (error < 0) {
+			/* try again from scratch the next time around */
+			git_futils_filestamp_set(&backend->snapshot_stamp, NULL);
+
+			if (error == GIT_ENOTFOUND) {
+				giterr_clear();
+				error = 0;
+			}
+		}
+	}
+
+	if (!error && backend->snapshot) {
+		git_atomic_inc(&backend->snapshot->refcount);
+		*out = backend->snapshot;
+	}
+
+	git_mutex_unlock(&backend->snapshot_lock);
+	return error;
+}
+
+/* Parse the record at `pos`, which must be the start of a line */
+static int packed_record_parse(
+	packed_record *rec, packed_snapshot *snap, const char *pos)
+{
+	const char *eol;
+
+	if (snap->end - pos < GIT_OID_HEXSZ + 2 ||
+		git_oid_fromstrn(&rec->oid, pos, GIT_OID_HEXSZ) < 0 ||
+		pos[GIT_OID_HEXSZ] != ' ')
+		return packed_snapshot_corrupted();
+
+	rec->name = pos + GIT_OID_HEXSZ + 1;
+
+	if ((eol = memchr(rec->name, '\n', snap->end - rec->name)) == NULL)
+		return packed_snapshot_corrupted();
+
+	rec->name_len = eol - rec->name;
+	if (rec->name_len && rec->name[rec->name_len - 1] == '\r')
+		rec->name_len--;
+
+	pos = eol + 1;
+	memset(&rec->peel, 0, sizeof(git_oid));
+
+	/* look for optional "^<OID>\n" */
+	if (pos < snap->end && *pos == '^') {
+		if (snap->end - pos < GIT_OID_HEXSZ + 1 ||
+			git_oid_fromstrn(&rec->peel, pos + 1, GIT_OID_HEXSZ) < 0)
+			return packed_snapshot_corrupted();
+
+		pos += GIT_OID_HEXSZ + 1;
+
+		if (pos < snap->end) {
+			if ((eol = memchr(pos, '\n', snap->end - pos)) == NULL)
+				return packed_snapshot_corrupted();
+			pos = eol + 1;
+		}
+	}
+
+	rec->next = pos;
+	return 0;
+}
+
+static int packed_record_cmp(const packed_record *rec, const char *name, size_t len)
+{
+	int cmp = memcmp(rec->name, name, min(rec->name_len, len));
+
+	if (cmp)
+		return cmp;
+
+	return (rec->name_len > len) - (rec->name_len < len);
+}
+
+/* Back up from anywhere in a record to its start */
+static const char *packed_record_start(packed_snapshot *snap, const char *pos)
+{
+	while (pos > snap->start && pos[-1] != '\n')
+		pos--;
+
+	/* a peeled line belongs to the record before it */
+	if (*pos == '^' && pos > snap->start) {
+		pos--;
+
+		while (pos > snap->start && pos[-1] != '\n')
+			pos--;
+	}
+
+	return pos;
+}
+
+/* Find the first record whose name does not sort before `name` */
+static int packed_snapshot_seek(
+	const char **out, packed_snapshot *snap, const char *name, size_t len)
+{
+	const char *lo = snap->start, *hi = snap->end, *mid;
+	packed_record rec;
+
+	while (lo < hi) {
+		mid = packed_record_start(snap, lo + (hi - lo) / 2);
+
+		if (packed_record_parse(&rec, snap, mid) < 0)
+			return -1;
+
+		if (packed_record_cmp(&rec, name, len) < 0)
+			lo = rec.next;
+		else
+			hi = mid;
+	}
+
+	*out = lo;
+	return 0;
+}
+
+static int packed_snapshot_lookup(
+	git_reference **out, packed_snapshot *snap, const char *ref_name)
+{
+	const char *pos;
+	packed_record rec;
+
+	if (packed_snapshot_seek(&pos, snap, ref_name, strlen(ref_name)) < 0)
+		return -1;
+
+	if (pos == snap->end)
+		return ref_error_notfound(ref_name);
+
+	if (packed_record_parse(&rec, snap, pos) < 0)
+		return -1;
+
+	if (packed_record_cmp(&rec, ref_name, strlen(ref_name)) != 0)
+		return ref_error_notfound(ref_name);
+
+	if (out) {
+		*out = git_reference__alloc(ref_name, &rec.oid, &rec.peel);
+		GITERR_CHECK_ALLOC(*out);
+	}
+
+	return 0;
+}
+
 static int loose_parse_oid(
 	git_oid *oid, const char *filename, git_buf *file_content)
 {
@@ -326,18 +659,39 @@ static int refdb_fs_backend__exists(
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
 	git_buf ref_path = GIT_BUF_INIT;
+	packed_snapshot *snap = NULL;
+	int error = 0;
 
 	assert(backend);
 
-	if (packed_reload(backend) < 0 ||
-		git_buf_joinpath(&ref_path, backend->path, ref_name) < 0)
+	*exists = 0;
+
+	if (git_buf_joinpath(&ref_path, backend->path, ref_name) < 0)
 		return -1;
 
-	*exists = git_path_isfile(ref_path.ptr) ||
-		(git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
+	if (git_path_isfile(ref_path.ptr)) {
+		*exists = 1;
+		goto done;
+	}
+
+	if ((error = packed_snapshot_get(&snap, backend)) < 0)
+		goto done;
 
+	if (snap) {
+		if (!(error = packed_snapshot_lookup(NULL, snap, ref_name)))
+			*exists = 1;
+		else if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+	} else if (!(error = packed_reload(backend))) {
+		*exists = (git_sortedcache_lookup(backend->refcache, ref_name) != NULL);
+	}
+
+done:
+	packed_snapshot_free(snap);
 	git_buf_free(&ref_path);
-	return 0;
+	return error;
 }
 
 static const char *loose_parse_symbolic(git_buf *file_content)
@@ -395,12 +749,6 @@ static int loose_lookup(
 	return error;
 }
 
-static int ref_error_notfound(const char *name)
-{
-	giterr_set(GITERR_REFERENCE, "Reference '%s' not found", name);
-	return GIT_ENOTFOUND;
-}
-
 static int packed_lookup(
 	git_reference **out,
 	refdb_fs_backend *backend,
@@ -408,6 +756,16 @@ static int packed_lookup(
 {
 	int error = 0;
 	struct packref *entry;
+	packed_snapshot *snap;
+
+	if ((error = packed_snapshot_get(&snap, backend)) < 0)
+		return error;
+
+	if (snap) {
+		error = packed_snapshot_lookup(out, snap, ref_name);
+		packed_snapshot_free(snap);
+		return error;
+	}
 
 	if (packed_reload(backend) < 0)
 		return -1;
@@ -463,6 +821,12 @@ typedef struct {
 	git_sortedcache *cache;
 	size_t loose_pos;
 	size_t packed_pos;
+
+	/* when the packed-refs file is searched in place */
+	packed_snapshot *snap;
+	const char *packed_cursor;
+	size_t prefix_len;
+	git_buf packed_name;
 } refdb_fs_iter;
 
 static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
@@ -472,9 +836,31 @@ static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 	git_vector_free(&iter->loose);
 	git_pool_clear(&iter->pool);
 	git_sortedcache_free(iter->cache);
+	packed_snapshot_free(iter->snap);
+	git_buf_free(&iter->packed_name);
 	git__free(iter);
 }
 
+/*
+ * The directory the literal start of the glob names, like `refs/tags/`
+ * for "refs/tags/v1.*"; that is all of the loose refs we have to walk.
+ */
+static const char *iter_loose_dir(size_t *out_len, refdb_fs_iter *iter)
+{
+	size_t len = iter->prefix_len;
+
+	if (!iter->glob || git__prefixcmp(iter->glob, GIT_REFS_DIR) != 0) {
+		*out_len = strlen(GIT_REFS_DIR);
+		return GIT_REFS_DIR;
+	}
+
+	while (len > strlen(GIT_REFS_DIR) && iter->glob[len - 1] != '/')
+		len--;
+
+	*out_len = len;
+	return iter->glob;
+}
+
 static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 {
 	int error = 0;
@@ -482,26 +868,34 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 	git_iterator *fsit = NULL;
 	git_iterator_options fsit_opts = GIT_ITERATOR_OPTIONS_INIT;
 	const git_index_entry *entry = NULL;
+	size_t dir_len;
+	const char *dir = iter_loose_dir(&dir_len, iter);
 
 	if (!backend->path) /* do nothing if no path for loose refs */
 		return 0;
 
 	fsit_opts.flags = backend->iterator_flags;
 
-	if ((error = git_buf_printf(&path, "%s/refs", backend->path)) < 0 ||
-		(error = git_iterator_for_filesystem(&fsit, path.ptr, &fsit_opts)) < 0) {
-		git_buf_free(&path);
-		return error;
-	}
+	if ((error = git_buf_printf(&path, "%s/%.*s",
+			backend->path, (int)dir_len, dir)) < 0)
+		goto done;
+
+	/* nothing is loose under there */
+	if (!git_path_isdir(path.ptr))
+		goto done;
+
+	if ((error = git_iterator_for_filesystem(&fsit, path.ptr, &fsit_opts)) < 0)
+		goto done;
 
-	error = git_buf_sets(&path, GIT_REFS_DIR);
+	git_buf_clear(&path);
+	error = git_buf_put(&path, dir, dir_len);
 
 	while (!error && !git_iterator_advance(&entry, fsit)) {
 		const char *ref_name;
 		struct packref *ref;
 		char *ref_dup;
 
-		git_buf_truncate(&path, strlen(GIT_REFS_DIR));
+		git_buf_truncate(&path, dir_len);
 		git_buf_puts(&path, entry->path);
 		ref_name = git_buf_cstr(&path);
 
@@ -509,11 +903,13 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 			(iter->glob && p_fnmatch(iter->glob, ref_name, 0) != 0))
 			continue;
 
-		git_sortedcache_rlock(backend->refcache);
-		ref = git_sortedcache_lookup(backend->refcache, ref_name);
-		if (ref)
-			ref->flags |= PACKREF_SHADOWED;
-		git_sortedcache_runlock(backend->refcache);
+		if (!iter->snap) {
+			git_sortedcache_rlock(backend->refcache);
+			ref = git_sortedcache_lookup(backend->refcache, ref_name);
+			if (ref)
+				ref->flags |= PACKREF_SHADOWED;
+			git_sortedcache_runlock(backend->refcache);
+		}
 
 		ref_dup = git_pool_strdup(&iter->pool, ref_name);
 		if (!ref_dup)
@@ -522,12 +918,85 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 			error = git_vector_insert(&iter->loose, ref_dup);
 	}
 
+done:
 	git_iterator_free(fsit);
 	git_buf_free(&path);
 
+	/* packed refs are checked against these as they are read */
+	if (!error && iter->snap)
+		git_vector_sort(&iter->loose);
+
 	return error;
 }
 
+/*
+ * Read the next packed ref that the iterator should return straight
+ * from the snapshot; its name is left in `iter->packed_name`.
+ */
+static int iter_snapshot_next(packed_record *rec, refdb_fs_iter *iter)
+{
+	while (iter->packed_cursor < iter->snap->end) {
+		if (packed_record_parse(rec, iter->snap, iter->packed_cursor) < 0)
+			return -1;
+
+		iter->packed_cursor = rec->next;
+
+		/* everything under the prefix is together, so we are done */
+		if (rec->name_len < iter->prefix_len ||
+			memcmp(rec->name, iter->glob, iter->prefix_len) != 0) {
+			iter->packed_cursor = iter->snap->end;
+			break;
+		}
+
+		git_buf_clear(&iter->packed_name);
+		if (git_buf_put(&iter->packed_name, rec->name, rec->name_len) < 0)
+			return -1;
+
+		if (git_vector_bsearch(NULL, &iter->loose, iter->packed_name.ptr) == 0)
+			continue;
+		if (iter->glob && p_fnmatch(iter->glob, iter->packed_name.ptr, 0) != 0)
+			continue;
+
+		return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
+/* Copy the packed refs, and skip to the first one under the prefix */
+static int iter_load_cache(refdb_fs_iter *iter, refdb_fs_backend *backend)
+{
+	size_t lo = 0, hi;
+	struct packref *ref;
+	int error;
+
+	if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+		return error;
+
+	hi = git_sortedcache_entrycount(iter->cache);
+
+	while (iter->prefix_len && lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		ref = git_sortedcache_entry(iter->cache, mid);
+
+		if (strncmp(ref->name, iter->glob, iter->prefix_len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	iter->packed_pos = lo;
+	return 0;
+}
+
+/* Whether a packed ref is past the ones under the prefix */
+GIT_INLINE(bool) iter_past_prefix(refdb_fs_iter *iter, const char *name)
+{
+	return iter->prefix_len &&
+		strncmp(name, iter->glob, iter->prefix_len) != 0;
+}
+
 static int refdb_fs_backend__iterator_next(
 	git_reference **out, git_reference_iterator *_iter)
 {
@@ -545,17 +1014,29 @@ static int refdb_fs_backend__iterator_next(
 		giterr_clear();
 	}
 
-	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+	if (iter->snap) {
+		packed_record rec;
+
+		if ((error = iter_snapshot_next(&rec, iter)) < 0)
 			return error;
+
+		*out = git_reference__alloc(iter->packed_name.ptr, &rec.oid, &rec.peel);
+		GITERR_CHECK_ALLOC(*out);
+		return 0;
 	}
 
+	if (!iter->cache && (error = iter_load_cache(iter, backend)) < 0)
+		return error;
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
 		if (!ref) /* stop now if another thread deleted refs and we past end */
 			break;
 
+		if (iter_past_prefix(iter, ref->name))
+			break;
+
 		if (ref->flags & PACKREF_SHADOWED)
 			continue;
 		if (iter->glob && p_fnmatch(iter->glob, ref->name, 0) != 0)
@@ -588,17 +1069,28 @@ static int refdb_fs_backend__iterator_next_name(
 		giterr_clear();
 	}
 
-	if (!iter->cache) {
-		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+	if (iter->snap) {
+		packed_record rec;
+
+		if ((error = iter_snapshot_next(&rec, iter)) < 0)
 			return error;
+
+		*out = iter->packed_name.ptr;
+		return 0;
 	}
 
+	if (!iter->cache && (error = iter_load_cache(iter, backend)) < 0)
+		return error;
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
 		if (!ref) /* stop now if another thread deleted refs and we past end */
 			break;
 
+		if (iter_past_prefix(iter, ref->name))
+			break;
+
 		if (ref->flags & PACKREF_SHADOWED)
 			continue;
 		if (iter->glob && p_fnmatch(iter->glob, ref->name, 0) != 0)
@@ -617,24 +1109,38 @@ static int refdb_fs_backend__iterator(
 {
 	refdb_fs_iter *iter;
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	packed_snapshot *snap;
 
 	assert(backend);
 
-	if (packed_reload(backend) < 0)
+	if (packed_snapshot_get(&snap, backend) < 0)
 		return -1;
 
-	iter = git__calloc(1, sizeof(refdb_fs_iter));
-	GITERR_CHECK_ALLOC(iter);
+	if (!snap && packed_reload(backend) < 0)
+		return -1;
+
+	if ((iter = git__calloc(1, sizeof(refdb_fs_iter))) == NULL) {
+		packed_snapshot_free(snap);
+		return -1;
+	}
 
 	git_pool_init(&iter->pool, 1);
+	iter->snap = snap;
 
-	if (git_vector_init(&iter->loose, 8, NULL) < 0)
+	if (git_vector_init(&iter->loose, 8, git__strcmp_cb) < 0)
 		goto fail;
 
 	if (glob != NULL &&
 		(iter->glob = git_pool_strdup(&iter->pool, glob)) == NULL)
 		goto fail;
 
+	/* only the refs under the literal start of the glob need reading */
+	iter->prefix_len = glob ? strcspn(glob, "*?[\\") : 0;
+
+	if (snap && packed_snapshot_seek(&iter->packed_cursor,
+			snap, glob, iter->prefix_len) < 0)
+		goto fail;
+
 	iter->parent.next = refdb_fs_backend__iterator_next;
 	iter->parent.next_name = refdb_fs_backend__iterator_next_name;
 	iter->parent.free = refdb_fs_backend__iterator_free;
@@ -758,24 +1264,6 @@ static int loose_commit(git_filebuf *file, const git_reference *ref)
 	return git_filebuf_commit(file);
 }
 
-static int refdb_fs_backend__lock(void **out, git_refdb_backend *_backend, const char *refname)
-{
-	int error;
-	git_filebuf *lock;
-	refdb_fs_backend *backend = (refdb_fs_backend *) _backend;
-
-	lock = git__calloc(1, sizeof(git_filebuf));
-	GITERR_CHECK_ALLOC(lock);
-
-	if ((error = loose_lock(lock, backend, refname)) < 0) {
-		git__free(lock);
-		return error;
-	}
-
-	*out = lock;
-	return 0;
-}
-
 static int refdb_fs_backend__write_tail(
 	git_refdb_backend *_backend,
 	const git_reference *ref,
@@ -792,20 +1280,237 @@ static int refdb_fs_backend__delete_tail(
 	const char *ref_name,
 	const git_oid *old_id, const char *old_target);
 
-static int refdb_fs_backend__unlock(git_refdb_backend *backend, void *payload, int success, int update_reflog,
-				    const git_reference *ref, const git_signature *sig, const char *message)
+static int packed_remove_refs(
+	size_t *removed, refdb_fs_backend *backend, git_vector *names);
+
+static void txn_ref_free(fs_txn_ref *ref)
+{
+	git_filebuf_cleanup(&ref->lock);
+	git__free(ref);
+}
+
+static void txn_delete_free(txn_delete *del)
+{
+	txn_ref_free(del->ref);
+	git__free(del);
+}
+
+static void txn_free(fs_txn *txn)
+{
+	txn_delete *del;
+	size_t i;
+
+	if (!txn)
+		return;
+
+	git_vector_foreach(&txn->deletes, i, del)
+		txn_delete_free(del);
+	git_vector_free(&txn->deletes);
+
+	git__free(txn);
+}
+
+/*
+ * The refs locked by a transaction belong to its batch of deletions;
+ * outside of a transaction, those of a thread share one.
+ */
+static int txn_get(fs_txn **out, refdb_fs_backend *backend)
 {
-	git_filebuf *lock = (git_filebuf *) payload;
+	fs_txn *txn = NULL;
+	const void *owner = GIT_GLOBAL->refdb_txn;
+	size_t i;
 	int error = 0;
 
-	if (success == 2)
-		error = refdb_fs_backend__delete_tail(backend, lock, ref->name, NULL, NULL);
-	else if (success)
-		error = refdb_fs_backend__write_tail(backend, ref, lock, update_reflog, sig, message, NULL, NULL);
+	if (!owner)
+		owner = GIT_GLOBAL;
+
+	if (git_mutex_lock(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the transactions");
+		return -1;
+	}
+
+	git_vector_foreach(&backend->txns, i, txn) {
+		if (txn->owner == owner)
+			break;
+	}
+
+	if (i == backend->txns.length) {
+		txn = git__calloc(1, sizeof(fs_txn));
+
+		if (!txn || git_vector_init(&txn->deletes, 4, NULL) < 0 ||
+			git_vector_insert(&backend->txns, txn) < 0) {
+			txn_free(txn);
+			txn = NULL;
+			error = -1;
+		} else {
+			txn->owner = owner;
+		}
+	}
+
+	if (txn)
+		txn->locks++;
+
+	git_mutex_unlock(&backend->snapshot_lock);
+
+	*out = txn;
+	return error;
+}
+
+/* Drop a ref's lock from its transaction; the last one removes it */
+static bool txn_put(refdb_fs_backend *backend, fs_txn *txn)
+{
+	size_t pos;
+
+	if (--txn->locks)
+		return false;
+
+	if (git_mutex_lock(&backend->snapshot_lock) < 0)
+		return true;
+
+	if (!git_vector_search(&pos, &backend->txns, txn))
+		git_vector_remove(&backend->txns, pos);
+
+	git_mutex_unlock(&backend->snapshot_lock);
+	return true;
+}
+
+static int refdb_fs_backend__lock(void **out, git_refdb_backend *_backend, const char *refname)
+{
+	int error;
+	fs_txn_ref *ref;
+	refdb_fs_backend *backend = (refdb_fs_backend *) _backend;
+
+	ref = git__calloc(1, sizeof(fs_txn_ref));
+	GITERR_CHECK_ALLOC(ref);
+
+	if ((error = loose_lock(&ref->lock, backend, refname)) < 0) {
+		git__free(ref);
+		return error;
+	}
+
+	if ((error = txn_get(&ref->txn, backend)) < 0) {
+		txn_ref_free(ref);
+		return error;
+	}
+
+	*out = ref;
+	return 0;
+}
+
+/* Hold on to the lock of a ref the transaction deletes until it ends */
+static int txn_queue_delete(
+	refdb_fs_backend *backend, fs_txn_ref *ref, const char *name)
+{
+	txn_delete *del = NULL;
+	size_t namelen = strlen(name), alloclen;
+	int error, exists;
+
+	if ((error = refdb_fs_backend__exists(&exists, &backend->parent, name)) < 0)
+		goto fail;
+
+	if (!exists) {
+		error = ref_error_notfound(name);
+		goto fail;
+	}
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloclen, sizeof(txn_delete), namelen) ||
+		GIT_ADD_SIZET_OVERFLOW(&alloclen, alloclen, 1) ||
+		(del = git__calloc(1, alloclen)) == NULL) {
+		error = -1;
+		goto fail;
+	}
+
+	del->ref = ref;
+	memcpy(del->name, name, namelen);
+
+	if ((error = git_vector_insert(&ref->txn->deletes, del)) < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	if (del)
+		txn_delete_free(del);
 	else
-		git_filebuf_cleanup(lock);
+		txn_ref_free(ref);
+
+	return error;
+}
+
+/*
+ * Remove everything the transaction deleted, rewriting the packed-refs
+ * file once for all of them.  The packed copies go first, so nobody
+ * sees them come back once the loose files are gone.
+ */
+static int txn_flush_deletes(refdb_fs_backend *backend, fs_txn *txn)
+{
+	git_vector names = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	txn_delete *del;
+	size_t i, removed;
+	int error = 0;
+
+	if (!txn->deletes.length)
+		goto done;
+
+	if ((error = git_vector_init(&names,
+			txn->deletes.length, git__strcmp_cb)) < 0)
+		goto done;
+
+	git_vector_foreach(&txn->deletes, i, del)
+		if ((error = git_vector_insert(&names, del->name)) < 0)
+			goto done;
+
+	git_vector_sort(&names);
+
+	if ((error = packed_remove_refs(&removed, backend, &names)) < 0)
+		goto done;
+
+	git_vector_foreach(&txn->deletes, i, del) {
+		git_buf_clear(&path);
+
+		if (git_buf_joinpath(&path, backend->path, del->name) < 0) {
+			error = -1;
+			goto done;
+		}
+
+		/* keep going, and report the first failure at the end */
+		if (git_path_isfile(path.ptr) && p_unlink(path.ptr) < 0 && !error) {
+			giterr_set(GITERR_OS,
+				"Failed to remove loose reference '%s'", path.ptr);
+			error = -1;
+		}
+	}
+
+done:
+	txn_free(txn);
+
+	git_vector_free(&names);
+	git_buf_free(&path);
+	return error;
+}
+
+static int refdb_fs_backend__unlock(git_refdb_backend *_backend, void *payload, int success, int update_reflog,
+				    const git_reference *ref, const git_signature *sig, const char *message)
+{
+	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	fs_txn_ref *lock = (fs_txn_ref *) payload;
+	fs_txn *txn = lock->txn;
+	int error = 0, flush_error;
+
+	if (success == 2) {
+		error = txn_queue_delete(backend, lock, ref->name);
+	} else {
+		if (success)
+			error = refdb_fs_backend__write_tail(_backend, ref, &lock->lock, update_reflog, sig, message, NULL, NULL);
+
+		txn_ref_free(lock);
+	}
+
+	if (txn_put(backend, txn) &&
+		(flush_error = txn_flush_deletes(backend, txn)) < 0 && !error)
+		error = flush_error;
 
-	git__free(lock);
 	return error;
 }
 
@@ -993,6 +1698,87 @@ fail:
 	return -1;
 }
 
+/*
+ * Drop `names` (sorted) from the packed-refs file in a single pass.
+ * The other records are copied as they are, so nothing needs to be
+ * parsed or peeled, and the file is left alone if none of the names
+ * are in it.
+ */
+static int packed_remove_refs(
+	size_t *removed, refdb_fs_backend *backend, git_vector *names)
+{
+	git_filebuf pack_file = GIT_FILEBUF_INIT;
+	git_buf contents = GIT_BUF_INIT;
+	const char *path = git_sortedcache_path(backend->refcache);
+	char *scan, *eof, *eol, *end, *name, saved;
+	size_t pos;
+	bool keep = true;
+	int error;
+
+	*removed = 0;
+
+	if (!names->length)
+		return 0;
+
+	/* the file may only be read once we hold its lock */
+	if ((error = git_filebuf_open(&pack_file, path, 0, GIT_PACKEDREFS_FILE_MODE)) < 0)
+		return error;
+
+	if ((error = git_futils_readbuffer(&contents, path)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	scan = contents.ptr;
+	eof = scan + contents.size;
+
+	for (; scan < eof; scan = eol + 1) {
+		if ((eol = memchr(scan, '\n', eof - scan)) == NULL)
+			eol = eof - 1;
+
+		/* a peeled line goes wherever the record before it goes */
+		if (*scan != '#' && *scan != '^') {
+			end = (*eol == '\n') ? eol : eof;
+
+			if (end > scan && end[-1] == '\r')
+				end--;
+
+			if (end - scan <= GIT_OID_HEXSZ + 1 || scan[GIT_OID_HEXSZ] != ' ') {
+				giterr_set(GITERR_REFERENCE, "Corrupted packed references file");
+				error = -1;
+				goto done;
+			}
+
+			name = scan + GIT_OID_HEXSZ + 1;
+
+			/* the buffer is ours, and always has room for a terminator */
+			saved = *end;
+			*end = '\0';
+			keep = (git_vector_bsearch(&pos, names, name) != 0);
+			*end = saved;
+
+			if (!keep)
+				(*removed)++;
+		} else if (*scan == '#') {
+			keep = true;
+		}
+
+		if (keep && (error = git_filebuf_write(&pack_file, scan, eol - scan + 1)) < 0)
+			goto done;
+	}
+
+	if (*removed)
+		error = git_filebuf_commit(&pack_file);
+
+done:
+	git_filebuf_cleanup(&pack_file);
+	git_buf_free(&contents);
+	return error;
+}
+
 static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *author, const char *message);
 static int has_reflog(git_repository *repo, const char *name);
 
@@ -1241,7 +2027,8 @@ static int refdb_fs_backend__delete_tail(
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
 	git_buf loose_path = GIT_BUF_INIT;
-	size_t pack_pos;
+	git_vector names = GIT_VECTOR_INIT;
+	size_t removed;
 	int error = 0, cmp = 0;
 	bool loose_deleted = 0;
 
@@ -1269,28 +2056,20 @@ static int refdb_fs_backend__delete_tail(
 	if (error != 0)
 		goto cleanup;
 
-	if ((error = packed_reload(backend)) < 0)
-		goto cleanup;
-
-	/* If a packed reference exists, remove it from the packfile and repack */
-	if ((error = git_sortedcache_wlock(backend->refcache)) < 0)
+	if ((error = git_vector_init(&names, 1, git__strcmp_cb)) < 0 ||
+		(error = git_vector_insert(&names, (void *)ref_name)) < 0)
 		goto cleanup;
 
-	if (!(error = git_sortedcache_lookup_index(
-			&pack_pos, backend->refcache, ref_name)))
-		error = git_sortedcache_remove(backend->refcache, pack_pos);
-
-	git_sortedcache_wunlock(backend->refcache);
-
-	if (error == GIT_ENOTFOUND) {
-		error = loose_deleted ? 0 : ref_error_notfound(ref_name);
+	/* If a packed reference exists, remove it from the packfile */
+	if ((error = packed_remove_refs(&removed, backend, &names)) < 0)
 		goto cleanup;
-	}
 
-	error = packed_write(backend);
+	if (!removed && !loose_deleted)
+		error = ref_error_notfound(ref_name);
 
 cleanup:
 	git_filebuf_cleanup(file);
+	git_vector_free(&names);
 
 	return error;
 }
@@ -1376,10 +2155,18 @@ static int refdb_fs_backend__compress(git_refdb_backend *_backend)
 static void refdb_fs_backend__free(git_refdb_backend *_backend)
 {
 	refdb_fs_backend *backend = (refdb_fs_backend *)_backend;
+	fs_txn *txn;
+	size_t i;
 
 	assert(backend);
 
+	git_vector_foreach(&backend->txns, i, txn)
+		txn_free(txn);
+	git_vector_free(&backend->txns);
+
 	git_sortedcache_free(backend->refcache);
+	packed_snapshot_free(backend->snapshot);
+	git_mutex_free(&backend->snapshot_lock);
 	git__free(backend->path);
 	git__free(backend);
 }
@@ -1630,6 +2417,125 @@ success:
 	return error;
 }
 
+#define REFLOG_TAIL_CHUNK 4096
+
+/*
+ * Read the end of a reflog, going back in growing chunks until there are
+ * at least `count` whole lines, or until the beginning of the file.  Any
+ * partial line at the front is dropped.
+ */
+static int reflog_read_tail(git_buf *out, const char *path, size_t count)
+{
+	git_file fd;
+	struct stat st;
+	git_buf chunk = GIT_BUF_INIT;
+	size_t start, len, lines = 0, i;
+	const char *eol;
+	int error = 0;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		giterr_set(GITERR_OS, "Failed to stat reflog '%s'", path);
+		error = -1;
+		goto done;
+	}
+
+	if (!git__is_sizet(st.st_size)) {
+		giterr_set(GITERR_INVALID, "Reflog '%s' is too large", path);
+		error = -1;
+		goto done;
+	}
+
+	start = (size_t)st.st_size;
+
+	/*
+	 * A line is known to be whole when there is a line break in front
+	 * of it; the last line break ends the file rather than starts one.
+	 */
+	while (start > 0 && lines <= count) {
+		len = max(REFLOG_TAIL_CHUNK, git_buf_len(out));
+		if (len > start)
+			len = start;
+		start -= len;
+
+		if (p_lseek(fd, (git_off_t)start, SEEK_SET) < 0) {
+			giterr_set(GITERR_OS, "Failed to seek in reflog '%s'", path);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = git_futils_readbuffer_fd(&chunk, fd, len)) < 0)
+			goto done;
+
+		for (i = 0; i < len; i++)
+			if (chunk.ptr[i] == '\n')
+				lines++;
+
+		if ((error = git_buf_put(&chunk, out->ptr, out->size)) < 0)
+			goto done;
+
+		git_buf_swap(out, &chunk);
+	}
+
+	if (start > 0 &&
+		(eol = memchr(out->ptr, '\n', out->size)) != NULL)
+		git_buf_consume(out, eol + 1);
+
+done:
+	git_buf_free(&chunk);
+	p_close(fd);
+	return error;
+}
+
+static int refdb_reflog_fs__read_recent(
+	git_reflog **out,
+	git_refdb_backend *_backend,
+	const char *name,
+	size_t count)
+{
+	int error = -1;
+	git_buf log_path = GIT_BUF_INIT;
+	git_buf log_file = GIT_BUF_INIT;
+	git_reflog *log = NULL;
+	refdb_fs_backend *backend;
+
+	assert(out && _backend && name);
+
+	backend = (refdb_fs_backend *) _backend;
+
+	if (reflog_alloc(&log, name) < 0)
+		return -1;
+
+	if (retrieve_reflog_path(&log_path, backend->repo, name) < 0)
+		goto cleanup;
+
+	error = reflog_read_tail(&log_file, git_buf_cstr(&log_path), count);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		goto cleanup;
+
+	if ((error == GIT_ENOTFOUND) &&
+		((error = create_new_reflog_file(git_buf_cstr(&log_path))) < 0))
+		goto cleanup;
+
+	if ((error = reflog_parse(log,
+		git_buf_cstr(&log_file), git_buf_len(&log_file))) < 0)
+		goto cleanup;
+
+	*out = log;
+	goto success;
+
+cleanup:
+	git_reflog_free(log);
+
+success:
+	git_buf_free(&log_file);
+	git_buf_free(&log_path);
+
+	return error;
+}
+
 static int serialize_reflog_entry(
 	git_buf *buf,
 	const git_oid *oid_old,
@@ -1928,12 +2834,19 @@ int git_refdb_backend_fs(
 
 	backend->repo = repository;
 
+	if (git_mutex_init(&backend->snapshot_lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize packed references lock");
+		git__free(backend);
+		return -1;
+	}
+
 	if (setup_namespace(&path, repository) < 0)
 		goto fail;
 
 	backend->path = git_buf_detach(&path);
 
-	if (git_buf_joinpath(&path, backend->path, GIT_PACKEDREFS_FILE) < 0 ||
+	if (git_vector_init(&backend->txns, 2, NULL) < 0 ||
+		git_buf_joinpath(&path, backend->path, GIT_PACKEDREFS_FILE) < 0 ||
 		git_sortedcache_new(
 			&backend->refcache, offsetof(struct packref, name),
 			NULL, NULL, packref_cmp, git_buf_cstr(&path)) < 0)
@@ -1963,6 +2876,7 @@ int git_refdb_backend_fs(
 	backend->parent.ensure_log = &refdb_reflog_fs__ensure_log;
 	backend->parent.free = &refdb_fs_backend__free;
 	backend->parent.reflog_read = &refdb_reflog_fs__read;
+	backend->parent.reflog_read_recent = &refdb_reflog_fs__read_recent;
 	backend->parent.reflog_write = &refdb_reflog_fs__write;
 	backend->parent.reflog_rename = &refdb_reflog_fs__rename;
 	backend->parent.reflog_delete = &refdb_reflog_fs__delete;
@@ -1972,6 +2886,8 @@ int git_refdb_backend_fs(
 
 fail:
 	git_buf_free(&path);
+	git_vector_free(&backend->txns);
+	git_mutex_free(&backend->snapshot_lock);
 	git__free(backend->path);
 	git__free(backend);
 	return -1;
@@ -0,0 +1,2276 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "refs.h"
+#include "repository.h"
+#include "fileops.h"
+#include "filebuf.h"
+#include "reflog.h"
+#include "refdb.h"
+#include "reftable.h"
+#include "global.h"
+
+#include <git2/refdb.h>
+#include <git2/signature.h>
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <git2/sys/reflog.h>
+
+/*
+ * References kept in a stack of reftables, as git does it.  The names
+ * of the tables, oldest first, are listed in `reftable/tables.list`;
+ * every update adds a table to the top of the stack and the newest
+ * record of a name wins.  Updates lock the list, so they are atomic
+ * however many references they touch.  Tables are merged back together
+ * whenever the stack stops shrinking geometrically towards the top.
+ */
+
+#define GIT_REFTABLE_DIR "reftable/"
+#define GIT_REFTABLE_LIST "tables.list"
+
+/* How many times to read the stack again while it is being compacted */
+#define STACK_READ_ATTEMPTS 5
+
+#define MAX_NESTING_LEVEL 10
+
+typedef struct {
+	git_atomic refcount;
+	git_vector names;
+	git_vector tables; /* oldest first */
+	uint64_t max_update_index;
+} reftable_stack;
+
+typedef struct {
+	int type; /* 1 to write the reference, 2 to delete it */
+	git_reference *ref;
+	int update_reflog;
+	git_signature *who;
+	char *message;
+} reftable_txn_update;
+
+typedef struct {
+	git_refdb_backend parent;
+
+	git_repository *repo;
+	char *path;
+	char *list_path;
+
+	/* Whenever you want to read or modify these, grab lock */
+	git_mutex lock;
+	reftable_stack *stack;
+	git_futils_filestamp stamp;
+
+	/* the open transactions, one per thread at most */
+	git_vector txns;
+} refdb_reftable;
+
+/* A transaction keeps the list locked until its last ref is unlocked */
+typedef struct {
+	/* the thread which locked the first ref */
+	const void *owner;
+
+	git_filebuf lock;
+	size_t refs;
+	git_vector updates;
+} reftable_txn;
+
+/* What `lock` hands out for every ref */
+typedef struct {
+	reftable_txn *txn;
+	char name[GIT_FLEX_ARRAY];
+} reftable_txn_ref;
+
+/* The records for a new table */
+typedef struct {
+	git_vector refs;
+	git_vector logs;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	uint64_t next_update_index;
+} reftable_batch;
+
+static int ref_error_notfound(const char *name)
+{
+	giterr_set(GITERR_REFERENCE, "Reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+static void stack_free(reftable_stack *stack)
+{
+	git_reftable *table;
+	size_t i;
+
+	if (!stack || git_atomic_dec(&stack->refcount) > 0)
+		return;
+
+	git_vector_foreach(&stack->tables, i, table)
+		git_reftable_free(table);
+
+	git_vector_free_deep(&stack->names);
+	git_vector_free(&stack->tables);
+	git__free(stack);
+}
+
+static int stack_read_once(reftable_stack *stack, refdb_reftable *backend)
+{
+	git_buf list = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_reftable *table;
+	char *line, *eol;
+	int error;
+
+	if ((error = git_futils_readbuffer(&list, backend->list_path)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	for (line = list.ptr; *line; line = eol) {
+		if ((eol = strchr(line, '\n')) != NULL)
+			*eol++ = '\0';
+		else
+			eol = line + strlen(line);
+
+		if (!*line)
+			continue;
+
+		if (strchr(line, '/') || line[0] == '.') {
+			giterr_set(GITERR_REFERENCE,
+				"Invalid table name '%s' in the reftable stack", line);
+			error = -1;
+			goto done;
+		}
+
+		git_buf_clear(&path);
+		if ((error = git_buf_joinpath(&path, backend->path, line)) < 0 ||
+			(error = git_reftable_open(&table, path.ptr)) < 0)
+			goto done;
+
+		if ((error = git_vector_insert(&stack->tables, table)) < 0) {
+			git_reftable_free(table);
+			goto done;
+		}
+
+		if ((line = git__strdup(line)) == NULL ||
+			(error = git_vector_insert(&stack->names, line)) < 0) {
+			git__free(line);
+			error = -1;
+			goto done;
+		}
+
+		if (table->max_update_index > stack->max_update_index)
+			stack->max_update_index = table->max_update_index;
+	}
+
+done:
+	git_buf_free(&list);
+	git_buf_free(&path);
+	return error;
+}
+
+/* Read the stack as it is on disk right now */
+static int stack_read(reftable_stack **out, refdb_reftable *backend)
+{
+	reftable_stack *stack;
+	int attempt, error;
+
+	*out = NULL;
+
+	for (attempt = 0; ; attempt++) {
+		stack = git__calloc(1, sizeof(reftable_stack));
+		GITERR_CHECK_ALLOC(stack);
+
+		stack->refcount.val = 1;
+
+		if (!(error = stack_read_once(stack, backend))) {
+			*out = stack;
+			return 0;
+		}
+
+		stack_free(stack);
+
+		/* a compaction may have replaced some tables since we read the list */
+		if (error != GIT_ENOTFOUND || attempt + 1 == STACK_READ_ATTEMPTS)
+			return error;
+
+		giterr_clear();
+	}
+}
+
+/*
+ * Get hold of the current stack, reading it again if it changed.  The
+ * list is rewritten with a name of the same length often enough that
+ * whoever holds its lock reads it regardless.
+ */
+static int stack_get(reftable_stack **out, refdb_reftable *backend, bool reload)
+{
+	reftable_stack *stack;
+	int error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the reftable stack");
+		return -1;
+	}
+
+	error = git_futils_filestamp_check(&backend->stamp, backend->list_path);
+
+	if (error == GIT_ENOTFOUND) {
+		/* nothing has been written yet; notice when something is */
+		git_futils_filestamp_set(&backend->stamp, NULL);
+		error = (backend->stack && !backend->stack->tables.length) ? 0 : 1;
+	}
+
+	if (error >= 0 && (reload || !backend->stack))
+		error = 1;
+
+	if (error > 0) {
+		if ((error = stack_read(&stack, backend)) < 0) {
+			git_futils_filestamp_set(&backend->stamp, NULL);
+		} else {
+			stack_free(backend->stack);
+			backend->stack = stack;
+		}
+	}
+
+	if (!error) {
+		git_atomic_inc(&backend->stack->refcount);
+		*out = backend->stack;
+	}
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+/*
+ * Lock the list of tables and read the stack it names; nobody else can
+ * change it until the lock is committed or cleaned up.
+ */
+static int stack_lock(
+	git_filebuf *file, reftable_stack **out, refdb_reftable *backend)
+{
+	int error;
+
+	if ((error = git_futils_mkdir(backend->path,
+			GIT_REFS_DIR_MODE, GIT_MKDIR_PATH)) < 0 ||
+		(error = git_filebuf_open(file, backend->list_path, 0,
+			GIT_REFS_FILE_MODE)) < 0)
+		return error;
+
+	if ((error = stack_get(out, backend, true)) < 0)
+		git_filebuf_cleanup(file);
+
+	return error;
+}
+
+static git_reference *ref_from_record(const git_reftable_ref *rec)
+{
+	if (rec->type == GIT_REFTABLE_REF_SYMREF)
+		return git_reference__alloc_symbolic(rec->name.ptr, rec->target.ptr);
+
+	return git_reference__alloc(rec->name.ptr, &rec->oid,
+		rec->type == GIT_REFTABLE_REF_VAL2 ? &rec->peel : NULL);
+}
+
+/* Look a reference up in the stack, without setting an error */
+static int stack_lookup(
+	git_reftable_ref *out, reftable_stack *stack, const char *name)
+{
+	git_reftable_iter it = GIT_REFTABLE_ITER_INIT;
+	git_reftable *table;
+	size_t i = stack->tables.length;
+	int error = GIT_ENOTFOUND;
+
+	/* the newest table that knows about the name has the answer */
+	while (i > 0 && error == GIT_ENOTFOUND) {
+		table = git_vector_get(&stack->tables, --i);
+
+		if ((error = git_reftable_ref_seek(&it, table, name)) < 0 ||
+			(error = git_reftable_ref_next(out, &it)) < 0) {
+			if (error == GIT_ITEROVER)
+				error = GIT_ENOTFOUND;
+			continue;
+		}
+
+		if (strcmp(out->name.ptr, name))
+			error = GIT_ENOTFOUND;
+		else if (out->type == GIT_REFTABLE_REF_DELETION)
+			break;
+	}
+
+	git_reftable_iter_free(&it);
+
+	if (!error && out->type == GIT_REFTABLE_REF_DELETION)
+		error = GIT_ENOTFOUND;
+
+	return error;
+}
+
+static int stack_lookup_ref(
+	git_reference **out, reftable_stack *stack, const char *name)
+{
+	git_reftable_ref rec = GIT_REFTABLE_REF_INIT;
+	int error;
+
+	if ((error = stack_lookup(&rec, stack, name)) == GIT_ENOTFOUND)
+		error = ref_error_notfound(name);
+	else if (!error && out) {
+		*out = ref_from_record(&rec);
+		if (*out == NULL)
+			error = -1;
+	}
+
+	git_reftable_ref_free(&rec);
+	return error;
+}
+
+/* Follow `name` down to the object it points at */
+static int stack_resolve(git_oid *out, reftable_stack *stack, const char *name)
+{
+	git_reftable_ref rec = GIT_REFTABLE_REF_INIT;
+	git_buf target = GIT_BUF_INIT;
+	int error, nesting;
+
+	if ((error = git_buf_sets(&target, name)) < 0)
+		return error;
+
+	for (nesting = 0; nesting < MAX_NESTING_LEVEL; nesting++) {
+		if ((error = stack_lookup(&rec, stack, target.ptr)) < 0)
+			goto done;
+
+		if (rec.type != GIT_REFTABLE_REF_SYMREF) {
+			git_oid_cpy(out, &rec.oid);
+			goto done;
+		}
+
+		git_buf_swap(&target, &rec.target);
+	}
+
+	giterr_set(GITERR_REFERENCE,
+		"Reference chain too deep while resolving '%s'", name);
+	error = -1;
+
+done:
+	git_reftable_ref_free(&rec);
+	git_buf_free(&target);
+	return error;
+}
+
+typedef struct {
+	git_reftable_iter it;
+	git_reftable_ref rec;
+	bool valid;
+} ref_cursor;
+
+/* Walks the references of a run of tables in name order */
+typedef struct {
+	ref_cursor *cursors;
+	size_t count;
+	const char *prefix;
+	size_t prefix_len;
+	git_reftable_ref current;
+} ref_merger;
+
+static int cursor_advance(ref_cursor *c)
+{
+	int error = git_reftable_ref_next(&c->rec, &c->it);
+
+	c->valid = (error == 0);
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
+
+static void ref_merger_free(ref_merger *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->count; i++) {
+		git_reftable_iter_free(&m->cursors[i].it);
+		git_reftable_ref_free(&m->cursors[i].rec);
+	}
+
+	git__free(m->cursors);
+	git_reftable_ref_free(&m->current);
+	memset(m, 0, sizeof(ref_merger));
+}
+
+static int ref_merger_init(
+	ref_merger *m, reftable_stack *stack, size_t from, size_t to,
+	const char *prefix, size_t prefix_len)
+{
+	git_buf seek = GIT_BUF_INIT;
+	size_t i;
+	int error = 0;
+
+	memset(m, 0, sizeof(ref_merger));
+
+	m->cursors = git__calloc(to - from + 1, sizeof(ref_cursor));
+	GITERR_CHECK_ALLOC(m->cursors);
+
+	m->count = to - from;
+	m->prefix = prefix;
+	m->prefix_len = prefix_len;
+
+	if ((error = git_buf_put(&seek, prefix ? prefix : "", prefix_len)) < 0)
+		goto done;
+
+	for (i = 0; i < m->count; i++) {
+		ref_cursor *c = &m->cursors[i];
+
+		if ((error = git_reftable_ref_seek(&c->it,
+				git_vector_get(&stack->tables, from + i), seek.ptr)) < 0 ||
+			(error = cursor_advance(c)) < 0)
+			goto done;
+	}
+
+done:
+	if (error < 0)
+		ref_merger_free(m);
+
+	git_buf_free(&seek);
+	return error;
+}
+
+/* The next name in the run, deletions included, in `m->current` */
+static int ref_merger_next(ref_merger *m)
+{
+	ref_cursor *best = NULL;
+	git_reftable_ref swap;
+	size_t i;
+	int error;
+
+	for (i = 0; i < m->count; i++) {
+		ref_cursor *c = &m->cursors[i];
+
+		/* on a tie, the newer table wins */
+		if (c->valid &&
+			(!best || strcmp(c->rec.name.ptr, best->rec.name.ptr) <= 0))
+			best = c;
+	}
+
+	if (!best)
+		return GIT_ITEROVER;
+
+	/* we get to keep the record, and the cursor gets the old buffers */
+	swap = m->current;
+	m->current = best->rec;
+	best->rec = swap;
+
+	if ((error = cursor_advance(best)) < 0)
+		return error;
+
+	for (i = 0; i < m->count; i++) {
+		ref_cursor *c = &m->cursors[i];
+
+		while (c->valid && !strcmp(c->rec.name.ptr, m->current.name.ptr))
+			if ((error = cursor_advance(c)) < 0)
+				return error;
+	}
+
+	/* everything under the prefix comes together */
+	if (m->prefix_len &&
+		(m->current.name.size < m->prefix_len ||
+		 memcmp(m->current.name.ptr, m->prefix, m->prefix_len))) {
+		for (i = 0; i < m->count; i++)
+			m->cursors[i].valid = false;
+		return GIT_ITEROVER;
+	}
+
+	return 0;
+}
+
+typedef struct {
+	git_reftable_iter it;
+	git_reftable_log rec;
+	bool valid;
+} log_cursor;
+
+static int log_cursor_advance(log_cursor *c)
+{
+	int error = git_reftable_log_next(&c->rec, &c->it);
+
+	c->valid = (error == 0);
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
+
+static void log_entry_free(git_reftable_log *log)
+{
+	git_reftable_log_free(log);
+	git__free(log);
+}
+
+static void logs_free(git_vector *logs)
+{
+	git_reftable_log *log;
+	size_t i;
+
+	git_vector_foreach(logs, i, log)
+		log_entry_free(log);
+
+	git_vector_free(logs);
+}
+
+static int log_cmp(const void *a, const void *b)
+{
+	return git_reftable_log_cmp(a, b);
+}
+
+static int log_index_cmp(const void *a, const void *b)
+{
+	const git_reftable_log *la = a, *lb = b;
+
+	if (la->update_index != lb->update_index)
+		return la->update_index < lb->update_index ? -1 : 1;
+
+	return 0;
+}
+
+static bool log_is_marker(const git_reftable_log *log)
+{
+	return git_oid_iszero(&log->old_id) && git_oid_iszero(&log->new_id);
+}
+
+static bool log_is_live(const git_reftable_log *log, bool markers)
+{
+	return log->type != GIT_REFTABLE_LOG_DELETION &&
+		(markers || !log_is_marker(log));
+}
+
+/*
+ * Collect the live log records of `name`, oldest first.  The records
+ * that only say a log exists are left out unless asked for.
+ */
+static int stack_read_logs(
+	git_vector *out, reftable_stack *stack, const char *name, bool markers)
+{
+	git_reftable_iter it = GIT_REFTABLE_ITER_INIT;
+	git_reftable_log *log = NULL;
+	git_vector seen = GIT_VECTOR_INIT;
+	size_t i = stack->tables.length, pos;
+	int error = 0;
+
+	if ((error = git_vector_init(out, 8, log_index_cmp)) < 0 ||
+		(error = git_vector_init(&seen, 8, log_index_cmp)) < 0)
+		return error;
+
+	/* newest tables first, so their records mask the older ones */
+	while (!error && i > 0) {
+		if ((error = git_reftable_log_seek(&it,
+				git_vector_get(&stack->tables, --i), name)) < 0)
+			break;
+
+		for (;;) {
+			if (!log && (log = git__calloc(1, sizeof(git_reftable_log))) == NULL) {
+				error = -1;
+				break;
+			}
+
+			if ((error = git_reftable_log_next(log, &it)) < 0) {
+				if (error == GIT_ITEROVER)
+					error = 0;
+				break;
+			}
+
+			if (strcmp(log->name.ptr, name))
+				break;
+
+			if (git_vector_bsearch(&pos, &seen, log) == 0)
+				continue;
+
+			if ((error = git_vector_insert(&seen, log)) < 0)
+				break;
+
+			log = NULL;
+		}
+	}
+
+	if (log)
+		log_entry_free(log);
+
+	/* hand over the live records, and drop the ones that mask others */
+	git_vector_foreach(&seen, i, log) {
+		if (!error && log_is_live(log, markers) &&
+			(error = git_vector_insert(out, log)) == 0)
+			continue;
+
+		log_entry_free(log);
+	}
+
+	git_vector_free(&seen);
+	git_reftable_iter_free(&it);
+
+	if (error < 0)
+		logs_free(out);
+	else
+		git_vector_sort(out);
+
+	return error;
+}
+
+static int stack_has_log(reftable_stack *stack, const char *name)
+{
+	git_vector logs = GIT_VECTOR_INIT;
+	int error;
+
+	if ((error = stack_read_logs(&logs, stack, name, true)) < 0)
+		return error;
+
+	error = logs.length > 0;
+	logs_free(&logs);
+	return error;
+}
+
+static int batch_init(reftable_batch *batch, reftable_stack *stack)
+{
+	memset(batch, 0, sizeof(reftable_batch));
+
+	batch->min_update_index = stack->max_update_index + 1;
+	batch->max_update_index = batch->min_update_index;
+	batch->next_update_index = batch->min_update_index;
+
+	if (git_vector_init(&batch->refs, 8, NULL) < 0 ||
+		git_vector_init(&batch->logs, 8, log_cmp) < 0)
+		return -1;
+
+	return 0;
+}
+
+static void batch_free(reftable_batch *batch)
+{
+	git_reftable_ref *ref;
+	size_t i;
+
+	git_vector_foreach(&batch->refs, i, ref) {
+		git_reftable_ref_free(ref);
+		git__free(ref);
+	}
+
+	git_vector_free(&batch->refs);
+	logs_free(&batch->logs);
+}
+
+/* Every new log record gets an update index of its own */
+static uint64_t batch_next_index(reftable_batch *batch)
+{
+	batch->max_update_index = batch->next_update_index;
+	return batch->next_update_index++;
+}
+
+static int batch_add_ref(reftable_batch *batch, const git_reference *ref)
+{
+	git_reftable_ref *rec;
+	int error;
+
+	rec = git__calloc(1, sizeof(git_reftable_ref));
+	GITERR_CHECK_ALLOC(rec);
+
+	if ((error = git_buf_sets(&rec->name, ref->name)) < 0)
+		goto done;
+
+	if (ref->type == GIT_REF_SYMBOLIC) {
+		rec->type = GIT_REFTABLE_REF_SYMREF;
+		error = git_buf_sets(&rec->target, ref->target.symbolic);
+	} else {
+		rec->type = GIT_REFTABLE_REF_VAL1;
+		git_oid_cpy(&rec->oid, &ref->target.oid);
+
+		if (!git_oid_iszero(&ref->peel)) {
+			rec->type = GIT_REFTABLE_REF_VAL2;
+			git_oid_cpy(&rec->peel, &ref->peel);
+		}
+	}
+
+	if (!error)
+		error = git_vector_insert(&batch->refs, rec);
+
+done:
+	if (error < 0) {
+		git_reftable_ref_free(rec);
+		git__free(rec);
+	}
+
+	return error;
+}
+
+static int batch_delete_ref(reftable_batch *batch, const char *name)
+{
+	git_reftable_ref *rec;
+
+	rec = git__calloc(1, sizeof(git_reftable_ref));
+	GITERR_CHECK_ALLOC(rec);
+
+	rec->type = GIT_REFTABLE_REF_DELETION;
+
+	if (git_buf_sets(&rec->name, name) < 0 ||
+		git_vector_insert(&batch->refs, rec) < 0) {
+		git_reftable_ref_free(rec);
+		git__free(rec);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int batch_add_log(
+	reftable_batch *batch,
+	const char *name,
+	uint64_t update_index,
+	const git_oid *old_id,
+	const git_oid *new_id,
+	const git_signature *who,
+	const char *message)
+{
+	git_reftable_log *log;
+	int error = 0;
+
+	log = git__calloc(1, sizeof(git_reftable_log));
+	GITERR_CHECK_ALLOC(log);
+
+	log->type = GIT_REFTABLE_LOG_UPDATE;
+	log->update_index = update_index;
+
+	if (old_id)
+		git_oid_cpy(&log->old_id, old_id);
+	if (new_id)
+		git_oid_cpy(&log->new_id, new_id);
+
+	if (who) {
+		log->time = who->when.time;
+		log->offset = who->when.offset;
+
+		if ((error = git_buf_sets(&log->committer_name, who->name)) < 0 ||
+			(error = git_buf_sets(&log->committer_email, who->email)) < 0)
+			goto done;
+	}
+
+	/* like the lines of a reflog file, messages end with a newline */
+	if (message && *message) {
+		if ((error = git_buf_sets(&log->message, message)) < 0)
+			goto done;
+
+		if (log->message.ptr[log->message.size - 1] != '\n')
+			error = git_buf_putc(&log->message, '\n');
+	}
+
+	if (!error)
+		error = git_buf_sets(&log->name, name);
+
+	if (!error)
+		error = git_vector_insert(&batch->logs, log);
+
+done:
+	if (error < 0)
+		log_entry_free(log);
+
+	return error;
+}
+
+static int batch_delete_log(
+	reftable_batch *batch, const char *name, uint64_t update_index)
+{
+	git_reftable_log *log;
+
+	log = git__calloc(1, sizeof(git_reftable_log));
+	GITERR_CHECK_ALLOC(log);
+
+	log->type = GIT_REFTABLE_LOG_DELETION;
+	log->update_index = update_index;
+
+	if (git_buf_sets(&log->name, name) < 0 ||
+		git_vector_insert(&batch->logs, log) < 0) {
+		log_entry_free(log);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Mask every live log record of `name` */
+static int batch_delete_logs(
+	reftable_batch *batch, reftable_stack *stack, const char *name)
+{
+	git_vector logs = GIT_VECTOR_INIT;
+	git_reftable_log *log;
+	size_t i;
+	int error;
+
+	if ((error = stack_read_logs(&logs, stack, name, true)) < 0)
+		return error;
+
+	git_vector_foreach(&logs, i, log)
+		if ((error = batch_delete_log(batch, name, log->update_index)) < 0)
+			break;
+
+	logs_free(&logs);
+	return error;
+}
+
+static int ref_rec_cmp(const void *a, const void *b)
+{
+	const git_reftable_ref *ra = a, *rb = b;
+	return strcmp(ra->name.ptr, rb->name.ptr);
+}
+
+static int table_name(git_buf *out, uint64_t min, uint64_t max)
+{
+	uint32_t suffix = (uint32_t)(git__timer() * 1000000.0);
+
+	return git_buf_printf(out, "0x%012"PRIx64"-0x%012"PRIx64"-%08x.ref",
+		min, max, suffix);
+}
+
+/* Write out a table and return its name */
+static int write_table(
+	git_buf *name, refdb_reftable *backend, git_reftable_writer *w,
+	uint64_t min, uint64_t max)
+{
+	git_buf contents = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	int error;
+
+	if ((error = git_reftable_writer_finish(&contents, w)) < 0 ||
+		(error = table_name(name, min, max)) < 0 ||
+		(error = git_buf_joinpath(&path, backend->path, name->ptr)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr, 0,
+			GIT_PACKEDREFS_FILE_MODE)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_write(&file, contents.ptr, contents.size)) < 0 ||
+		(error = git_filebuf_commit(&file)) < 0)
+		git_filebuf_cleanup(&file);
+
+done:
+	git_buf_free(&contents);
+	git_buf_free(&path);
+	return error;
+}
+
+static void remove_table(refdb_reftable *backend, const char *name)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	/* a reader may still have it open; it is not in the list anymore */
+	if (!git_buf_joinpath(&path, backend->path, name))
+		p_unlink(path.ptr);
+
+	git_buf_free(&path);
+}
+
+/* Replace the tables from `from` up with `name`, and unlock the list */
+static int commit_list(
+	git_filebuf *list, refdb_reftable *backend, reftable_stack *stack,
+	size_t from, const char *name)
+{
+	const char *existing;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < from && !error; i++) {
+		existing = git_vector_get(&stack->names, i);
+		error = git_filebuf_printf(list, "%s\n", existing);
+	}
+
+	if (!error && name)
+		error = git_filebuf_printf(list, "%s\n", name);
+
+	if (!error)
+		error = git_filebuf_commit(list);
+
+	if (error < 0) {
+		git_filebuf_cleanup(list);
+
+		if (name)
+			remove_table(backend, name);
+
+		return error;
+	}
+
+	for (i = from; i < stack->names.length; i++)
+		remove_table(backend, git_vector_get(&stack->names, i));
+
+	return 0;
+}
+
+/* Put the batch on top of the stack, and unlock the list */
+static int stack_append(
+	git_filebuf *list, refdb_reftable *backend,
+	reftable_stack *stack, reftable_batch *batch)
+{
+	git_reftable_writer *w = NULL;
+	git_buf name = GIT_BUF_INIT;
+	git_reftable_ref *ref;
+	git_reftable_log *log;
+	size_t i;
+	int error;
+
+	if (!batch->refs.length && !batch->logs.length) {
+		git_filebuf_cleanup(list);
+		return 0;
+	}
+
+	git_vector_set_cmp(&batch->refs, ref_rec_cmp);
+	git_vector_sort(&batch->refs);
+	git_vector_sort(&batch->logs);
+
+	if ((error = git_reftable_writer_new(&w,
+			batch->min_update_index, batch->max_update_index)) < 0)
+		goto done;
+
+	/* the reference records share the last index of the update */
+	git_vector_foreach(&batch->refs, i, ref) {
+		ref->update_index = batch->max_update_index;
+
+		if ((error = git_reftable_writer_add_ref(w, ref)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&batch->logs, i, log)
+		if ((error = git_reftable_writer_add_log(w, log)) < 0)
+			goto done;
+
+	if ((error = write_table(&name, backend, w,
+			batch->min_update_index, batch->max_update_index)) < 0)
+		goto done;
+
+	error = commit_list(list, backend, stack, stack->names.length, name.ptr);
+
+done:
+	if (error < 0)
+		git_filebuf_cleanup(list);
+
+	git_reftable_writer_free(w);
+	git_buf_free(&name);
+	return error;
+}
+
+static int log_merge_next(
+	git_reftable_log **out, log_cursor *cursors, size_t count)
+{
+	log_cursor *best = NULL;
+	size_t i;
+	int error;
+
+	*out = NULL;
+
+	for (i = 0; i < count; i++) {
+		log_cursor *c = &cursors[i];
+
+		if (!c->valid)
+			continue;
+
+		/* on a tie, the newer table wins */
+		if (!best || git_reftable_log_cmp(&c->rec, &best->rec) <= 0)
+			best = c;
+	}
+
+	if (!best)
+		return GIT_ITEROVER;
+
+	*out = git__calloc(1, sizeof(git_reftable_log));
+	GITERR_CHECK_ALLOC(*out);
+
+	memcpy(*out, &best->rec, sizeof(git_reftable_log));
+	memset(&best->rec, 0, sizeof(git_reftable_log));
+
+	if ((error = log_cursor_advance(best)) < 0)
+		return error;
+
+	for (i = 0; i < count; i++) {
+		log_cursor *c = &cursors[i];
+
+		while (c->valid && !git_reftable_log_cmp(&c->rec, *out))
+			if ((error = log_cursor_advance(c)) < 0)
+				return error;
+	}
+
+	return 0;
+}
+
+/*
+ * Merge the tables from `from` up into one, and unlock the list.  The
+ * deletions only need to be kept when there are older tables left.
+ */
+static int stack_compact(
+	git_filebuf *list, refdb_reftable *backend,
+	reftable_stack *stack, size_t from)
+{
+	git_reftable_writer *w = NULL;
+	git_buf name = GIT_BUF_INIT;
+	ref_merger refs;
+	log_cursor *logs = NULL;
+	git_reftable_log *log = NULL;
+	git_reftable *table;
+	size_t i, count = stack->tables.length - from;
+	uint64_t min, max;
+	bool keep_deletions = (from > 0);
+	int error;
+
+	memset(&refs, 0, sizeof(refs));
+
+	if (count < 2) {
+		git_filebuf_cleanup(list);
+		return 0;
+	}
+
+	min = ((git_reftable *)git_vector_get(&stack->tables, from))->min_update_index;
+	max = ((git_reftable *)git_vector_last(&stack->tables))->max_update_index;
+
+	if ((error = git_reftable_writer_new(&w, min, max)) < 0 ||
+		(error = ref_merger_init(&refs, stack, from,
+			stack->tables.length, NULL, 0)) < 0)
+		goto done;
+
+	while ((error = ref_merger_next(&refs)) == 0) {
+		if (!keep_deletions && refs.current.type == GIT_REFTABLE_REF_DELETION)
+			continue;
+
+		if ((error = git_reftable_writer_add_ref(w, &refs.current)) < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	logs = git__calloc(count, sizeof(log_cursor));
+	GITERR_CHECK_ALLOC(logs);
+
+	for (i = 0; i < count; i++) {
+		table = git_vector_get(&stack->tables, from + i);
+
+		if ((error = git_reftable_log_seek(&logs[i].it, table, "")) < 0 ||
+			(error = log_cursor_advance(&logs[i])) < 0)
+			goto done;
+	}
+
+	while ((error = log_merge_next(&log, logs, count)) == 0) {
+		if (keep_deletions || log->type != GIT_REFTABLE_LOG_DELETION)
+			error = git_reftable_writer_add_log(w, log);
+
+		log_entry_free(log);
+		log = NULL;
+
+		if (error < 0)
+			goto done;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	if ((error = write_table(&name, backend, w, min, max)) < 0)
+		goto done;
+
+	error = commit_list(list, backend, stack, from, name.ptr);
+
+done:
+	if (error < 0)
+		git_filebuf_cleanup(list);
+
+	if (logs) {
+		for (i = 0; i < count; i++) {
+			git_reftable_iter_free(&logs[i].it);
+			git_reftable_log_free(&logs[i].rec);
+		}
+		git__free(logs);
+	}
+
+	if (log)
+		log_entry_free(log);
+
+	ref_merger_free(&refs);
+	git_reftable_writer_free(w);
+	git_buf_free(&name);
+	return error;
+}
+
+/*
+ * Keep the stack short: merge the tables at the top while each one is
+ * not at least twice as large as all of the ones above it together.
+ */
+static int maybe_compact(refdb_reftable *backend)
+{
+	git_filebuf list = GIT_FILEBUF_INIT;
+	reftable_stack *stack;
+	git_reftable *table;
+	size_t from, sum;
+	int error;
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0) {
+		/* someone else is at it; they can compact */
+		if (error == GIT_ELOCKED) {
+			giterr_clear();
+			error = 0;
+		}
+		return error;
+	}
+
+	from = stack->tables.length;
+	sum = 0;
+
+	while (from > 0) {
+		table = git_vector_get(&stack->tables, from - 1);
+
+		if (sum && table->size >= 2 * sum)
+			break;
+
+		sum += table->size;
+		from--;
+	}
+
+	error = stack_compact(&list, backend, stack, from);
+
+	stack_free(stack);
+	return error;
+}
+
+static int refdb_reftable__exists(
+	int *exists, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_reftable_ref rec = GIT_REFTABLE_REF_INIT;
+	reftable_stack *stack;
+	int error;
+
+	assert(exists && backend);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	error = stack_lookup(&rec, stack, ref_name);
+	*exists = (error == 0);
+
+	git_reftable_ref_free(&rec);
+	stack_free(stack);
+	return (error == GIT_ENOTFOUND) ? 0 : error;
+}
+
+static int refdb_reftable__lookup(
+	git_reference **out, git_refdb_backend *_backend, const char *ref_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(out && backend);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	error = stack_lookup_ref(out, stack, ref_name);
+
+	stack_free(stack);
+	return error;
+}
+
+typedef struct {
+	git_reference_iterator parent;
+	reftable_stack *stack;
+	char *glob;
+	ref_merger refs;
+} refdb_reftable_iter;
+
+static int refdb_reftable__iterator_next_rec(refdb_reftable_iter *iter)
+{
+	int error;
+
+	while ((error = ref_merger_next(&iter->refs)) == 0) {
+		if (iter->refs.current.type == GIT_REFTABLE_REF_DELETION)
+			continue;
+
+		if (iter->glob && p_fnmatch(iter->glob, iter->refs.current.name.ptr, 0) != 0)
+			continue;
+
+		break;
+	}
+
+	return error;
+}
+
+static int refdb_reftable__iterator_next(
+	git_reference **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	int error;
+
+	if ((error = refdb_reftable__iterator_next_rec(iter)) < 0)
+		return error;
+
+	*out = ref_from_record(&iter->refs.current);
+	GITERR_CHECK_ALLOC(*out);
+
+	return 0;
+}
+
+static int refdb_reftable__iterator_next_name(
+	const char **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+	int error;
+
+	if ((error = refdb_reftable__iterator_next_rec(iter)) < 0)
+		return error;
+
+	*out = iter->refs.current.name.ptr;
+	return 0;
+}
+
+static void refdb_reftable__iterator_free(git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = (refdb_reftable_iter *)_iter;
+
+	ref_merger_free(&iter->refs);
+	stack_free(iter->stack);
+	git__free(iter->glob);
+	git__free(iter);
+}
+
+static int refdb_reftable__iterator(
+	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	refdb_reftable_iter *iter;
+	size_t prefix_len = 0;
+
+	assert(out && backend);
+
+	iter = git__calloc(1, sizeof(refdb_reftable_iter));
+	GITERR_CHECK_ALLOC(iter);
+
+	iter->parent.next = refdb_reftable__iterator_next;
+	iter->parent.next_name = refdb_reftable__iterator_next_name;
+	iter->parent.free = refdb_reftable__iterator_free;
+
+	if (glob) {
+		iter->glob = git__strdup(glob);
+		if (!iter->glob)
+			goto fail;
+
+		/* only the names under the literal start of the glob are read */
+		prefix_len = strcspn(glob, "*?[\\");
+	}
+
+	if (stack_get(&iter->stack, backend, false) < 0 ||
+		ref_merger_init(&iter->refs, iter->stack, 0,
+			iter->stack->tables.length, iter->glob, prefix_len) < 0)
+		goto fail;
+
+	*out = (git_reference_iterator *)iter;
+	return 0;
+
+fail:
+	refdb_reftable__iterator_free((git_reference_iterator *)iter);
+	return -1;
+}
+
+/*
+ * Make sure `name` does not live where a directory of other references
+ * would, nor the other way round, as git expects of every backend.
+ */
+static int check_available(
+	reftable_stack *stack, const char *name, const char *old_name, int force)
+{
+	git_reftable_ref rec = GIT_REFTABLE_REF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	ref_merger refs;
+	const char *slash;
+	int error = 0;
+
+	memset(&refs, 0, sizeof(refs));
+
+	if (!force) {
+		if (!(error = stack_lookup(&rec, stack, name)) &&
+			(!old_name || strcmp(name, old_name))) {
+			giterr_set(GITERR_REFERENCE,
+				"Failed to write reference '%s': a reference with "
+				"that name already exists.", name);
+			error = GIT_EEXISTS;
+			goto done;
+		}
+
+		if (error != GIT_ENOTFOUND && error < 0)
+			goto done;
+	}
+
+	/* none of the leading directories may be a reference */
+	for (slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/')) {
+		git_buf_clear(&path);
+
+		if ((error = git_buf_put(&path, name, slash - name)) < 0)
+			goto done;
+
+		error = stack_lookup(&rec, stack, path.ptr);
+
+		if (!error && (!old_name || strcmp(path.ptr, old_name)))
+			goto collision;
+		if (error < 0 && error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	/* and nothing may be beneath it */
+	git_buf_clear(&path);
+	if ((error = git_buf_printf(&path, "%s/", name)) < 0 ||
+		(error = ref_merger_init(&refs, stack, 0,
+			stack->tables.length, path.ptr, path.size)) < 0)
+		goto done;
+
+	while ((error = ref_merger_next(&refs)) == 0) {
+		if (refs.current.type == GIT_REFTABLE_REF_DELETION ||
+			(old_name && !strcmp(refs.current.name.ptr, old_name)))
+			continue;
+
+		goto collision;
+	}
+
+	error = (error == GIT_ITEROVER) ? 0 : error;
+	goto done;
+
+collision:
+	giterr_set(GITERR_REFERENCE,
+		"Path to reference '%s' collides with existing one", name);
+	error = -1;
+
+done:
+	ref_merger_free(&refs);
+	git_reftable_ref_free(&rec);
+	git_buf_free(&path);
+	return error;
+}
+
+static int cmp_old_ref(
+	int *cmp, reftable_stack *stack, const char *name,
+	const git_oid *old_id, const char *old_target)
+{
+	git_reftable_ref rec = GIT_REFTABLE_REF_INIT;
+	int error;
+
+	*cmp = 0;
+
+	/* It "matches" if there is no old value to compare against */
+	if (!old_id && !old_target)
+		return 0;
+
+	if ((error = stack_lookup(&rec, stack, name)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			error = ref_error_notfound(name);
+		goto done;
+	}
+
+	/* If the types don't match, there's no way the values do */
+	if (old_id && rec.type == GIT_REFTABLE_REF_SYMREF)
+		*cmp = -1;
+	else if (old_target && rec.type != GIT_REFTABLE_REF_SYMREF)
+		*cmp = 1;
+	else if (old_id)
+		*cmp = git_oid_cmp(old_id, &rec.oid);
+	else
+		*cmp = git__strcmp(old_target, rec.target.ptr);
+
+done:
+	git_reftable_ref_free(&rec);
+	return error;
+}
+
+static bool same_value(reftable_stack *stack, const git_reference *ref)
+{
+	git_reftable_ref rec = GIT_REFTABLE_REF_INIT;
+	bool same = false;
+
+	if (stack_lookup(&rec, stack, ref->name) == 0) {
+		if (ref->type == GIT_REF_SYMBOLIC)
+			same = (rec.type == GIT_REFTABLE_REF_SYMREF &&
+				!strcmp(rec.target.ptr, ref->target.symbolic));
+		else
+			same = (rec.type != GIT_REFTABLE_REF_SYMREF &&
+				!git_oid_cmp(&rec.oid, &ref->target.oid));
+	}
+
+	git_reftable_ref_free(&rec);
+	return same;
+}
+
+/* We only write if it's under heads/, remotes/ or notes/ or if it already has a log */
+static int should_write_reflog(
+	int *write, refdb_reftable *backend, reftable_stack *stack, const char *name)
+{
+	int error, logall;
+
+	error = git_repository__cvar(&logall, backend->repo, GIT_CVAR_LOGALLREFUPDATES);
+	if (error < 0)
+		return error;
+
+	/* Defaults to the opposite of the repo being bare */
+	if (logall == GIT_LOGALLREFUPDATES_UNSET)
+		logall = !git_repository_is_bare(backend->repo);
+
+	if (!logall) {
+		*write = 0;
+	} else if (!git__prefixcmp(name, GIT_REFS_HEADS_DIR) ||
+		   !git__strcmp(name, GIT_HEAD_FILE) ||
+		   !git__prefixcmp(name, GIT_REFS_REMOTES_DIR) ||
+		   !git__prefixcmp(name, GIT_REFS_NOTES_DIR)) {
+		*write = 1;
+	} else {
+		if ((error = stack_has_log(stack, name)) < 0)
+			return error;
+
+		*write = error;
+	}
+
+	return 0;
+}
+
+/*
+ * Add the log records for writing `ref`, both its own and, when HEAD
+ * points at it, HEAD's (see `maybe_append_head` in the files backend).
+ */
+static int batch_log_update(
+	reftable_batch *batch,
+	refdb_reftable *backend,
+	reftable_stack *stack,
+	const git_reference *ref,
+	const git_signature *who,
+	const char *message)
+{
+	git_reftable_ref head = GIT_REFTABLE_REF_INIT;
+	git_buf target = GIT_BUF_INIT;
+	git_oid old_id = {{0}}, new_id = {{0}};
+	int error, should_write, nesting;
+
+	if ((error = should_write_reflog(&should_write, backend, stack, ref->name)) < 0 ||
+		!should_write)
+		return error;
+
+	/* "normal" symbolic updates do not write */
+	if (ref->type == GIT_REF_SYMBOLIC && strcmp(ref->name, GIT_HEAD_FILE))
+		return 0;
+
+	error = stack_resolve(&old_id, stack, ref->name);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	if (ref->type == GIT_REF_SYMBOLIC) {
+		/* detaching HEAD does not create an entry */
+		if ((error = stack_resolve(&new_id, stack, ref->target.symbolic)) < 0)
+			return (error == GIT_ENOTFOUND) ? 0 : error;
+
+		return batch_add_log(batch, ref->name, batch_next_index(batch),
+			&old_id, &new_id, who, message);
+	}
+
+	if ((error = batch_add_log(batch, ref->name, batch_next_index(batch),
+			&old_id, &ref->target.oid, who, message)) < 0)
+		return error;
+
+	/* go down HEAD's chain of symbolic refs to the branch */
+	if ((error = git_buf_sets(&target, GIT_HEAD_FILE)) < 0)
+		goto done;
+
+	for (nesting = 0; nesting < MAX_NESTING_LEVEL; nesting++) {
+		if ((error = stack_lookup(&head, stack, target.ptr)) < 0 ||
+			head.type != GIT_REFTABLE_REF_SYMREF)
+			break;
+
+		git_buf_swap(&target, &head.target);
+	}
+
+	if (error == GIT_ENOTFOUND || (!error && head.type != GIT_REFTABLE_REF_SYMREF)) {
+		/* HEAD itself holding an id is not following anything */
+		if (!strcmp(target.ptr, ref->name) && strcmp(ref->name, GIT_HEAD_FILE))
+			error = batch_add_log(batch, GIT_HEAD_FILE, batch_next_index(batch),
+				&old_id, &ref->target.oid, who, message);
+		else
+			error = 0;
+	}
+
+done:
+	git_reftable_ref_free(&head);
+	git_buf_free(&target);
+	return error;
+}
+
+static int refdb_reftable__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	reftable_stack *stack;
+	reftable_batch batch;
+	int error, cmp;
+
+	assert(backend && ref);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = check_available(stack, ref->name, NULL, force)) < 0 ||
+		(error = cmp_old_ref(&cmp, stack, ref->name, old_id, old_target)) < 0)
+		goto done;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		error = GIT_EMODIFIED;
+		goto done;
+	}
+
+	/* Don't update if we have the same value */
+	if (same_value(stack, ref))
+		goto done;
+
+	if ((error = batch_add_ref(&batch, ref)) < 0 ||
+		(error = batch_log_update(&batch, backend, stack, ref, who, message)) < 0)
+		goto done;
+
+	error = stack_append(&list, backend, stack, &batch);
+
+done:
+	git_filebuf_cleanup(&list);
+
+	batch_free(&batch);
+	stack_free(stack);
+
+	return error ? error : maybe_compact(backend);
+}
+
+static int refdb_reftable__delete(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	reftable_stack *stack;
+	reftable_batch batch;
+	int error, cmp;
+
+	assert(backend && ref_name);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = cmp_old_ref(&cmp, stack, ref_name, old_id, old_target)) < 0)
+		goto done;
+
+	if (cmp) {
+		giterr_set(GITERR_REFERENCE, "old reference value does not match");
+		error = GIT_EMODIFIED;
+		goto done;
+	}
+
+	if ((error = stack_lookup_ref(NULL, stack, ref_name)) < 0 ||
+		(error = batch_delete_ref(&batch, ref_name)) < 0 ||
+		(error = batch_delete_logs(&batch, stack, ref_name)) < 0)
+		goto done;
+
+	error = stack_append(&list, backend, stack, &batch);
+
+done:
+	git_filebuf_cleanup(&list);
+
+	batch_free(&batch);
+	stack_free(stack);
+
+	return error ? error : maybe_compact(backend);
+}
+
+/* Give the log of `old_name` to `new_name`, replacing what it had */
+static int batch_move_logs(
+	reftable_batch *batch, reftable_stack *stack,
+	const char *old_name, const char *new_name)
+{
+	git_vector logs = GIT_VECTOR_INIT;
+	git_reftable_log *log;
+	git_signature who;
+	size_t i;
+	int error;
+
+	if ((error = batch_delete_logs(batch, stack, new_name)) < 0 ||
+		(error = stack_read_logs(&logs, stack, old_name, true)) < 0)
+		return error;
+
+	git_vector_foreach(&logs, i, log) {
+		if ((error = batch_delete_log(batch, old_name, log->update_index)) < 0)
+			break;
+
+		who.name = log->committer_name.ptr;
+		who.email = log->committer_email.ptr;
+		who.when.time = log->time;
+		who.when.offset = log->offset;
+
+		if ((error = batch_add_log(batch, new_name, batch_next_index(batch),
+				&log->old_id, &log->new_id, &who, log->message.ptr)) < 0)
+			break;
+	}
+
+	if (!error && !logs.length)
+		error = GIT_ENOTFOUND;
+
+	logs_free(&logs);
+	return error;
+}
+
+static int refdb_reftable__rename(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *old_name,
+	const char *new_name,
+	int force,
+	const git_signature *who,
+	const char *message)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	git_reference *old = NULL, *new = NULL;
+	reftable_stack *stack;
+	reftable_batch batch;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = check_available(stack, new_name, old_name, force)) < 0 ||
+		(error = stack_lookup_ref(&old, stack, old_name)) < 0)
+		goto done;
+
+	if ((new = git_reference__set_name(old, new_name)) == NULL) {
+		error = -1;
+		goto done;
+	}
+	old = NULL;
+
+	/* the ref keeps its log, with a line for the rename at the end */
+	error = batch_move_logs(&batch, stack, old_name, new_name);
+
+	if (error == GIT_ENOTFOUND)
+		error = 0;
+	else if (error < 0)
+		goto done;
+
+	if (new->type == GIT_REF_OID &&
+		(error = batch_add_log(&batch, new_name,
+			batch_next_index(&batch),
+			&new->target.oid, &new->target.oid, who, message)) < 0)
+		goto done;
+
+	if ((strcmp(old_name, new_name) &&
+		 (error = batch_delete_ref(&batch, old_name)) < 0) ||
+		(error = batch_add_ref(&batch, new)) < 0)
+		goto done;
+
+	if ((error = stack_append(&list, backend, stack, &batch)) < 0)
+		goto done;
+
+	if (out) {
+		*out = new;
+		new = NULL;
+	}
+
+done:
+	git_filebuf_cleanup(&list);
+
+	git_reference_free(old);
+	git_reference_free(new);
+	batch_free(&batch);
+	stack_free(stack);
+
+	return error ? error : maybe_compact(backend);
+}
+
+static int refdb_reftable__compress(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	error = stack_compact(&list, backend, stack, 0);
+
+	stack_free(stack);
+	return error;
+}
+
+static int refdb_reftable__has_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	error = stack_has_log(stack, name);
+
+	stack_free(stack);
+	return error;
+}
+
+static int refdb_reftable__ensure_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	reftable_stack *stack;
+	reftable_batch batch;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = stack_has_log(stack, name)) < 0)
+		goto done;
+
+	/* an entry with no ids in it says the log exists */
+	if (!error)
+		error = batch_add_log(&batch, name,
+			batch_next_index(&batch), NULL, NULL, NULL, NULL);
+
+	if (!error)
+		error = stack_append(&list, backend, stack, &batch);
+	else if (error > 0)
+		error = 0;
+
+done:
+	git_filebuf_cleanup(&list);
+
+	batch_free(&batch);
+	stack_free(stack);
+	return error;
+}
+
+static int reflog_alloc(git_reflog **reflog, const char *name)
+{
+	git_reflog *log;
+
+	*reflog = NULL;
+
+	log = git__calloc(1, sizeof(git_reflog));
+	GITERR_CHECK_ALLOC(log);
+
+	log->ref_name = git__strdup(name);
+	GITERR_CHECK_ALLOC(log->ref_name);
+
+	if (git_vector_init(&log->entries, 0, NULL) < 0) {
+		git__free(log->ref_name);
+		git__free(log);
+		return -1;
+	}
+
+	*reflog = log;
+
+	return 0;
+}
+
+static int reflog_entry_from_record(
+	git_reflog_entry **out, const git_reftable_log *log)
+{
+	git_reflog_entry *entry;
+
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GITERR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->oid_old, &log->old_id);
+	git_oid_cpy(&entry->oid_cur, &log->new_id);
+
+	if ((entry->committer = git__calloc(1, sizeof(git_signature))) == NULL ||
+		(entry->committer->name = git__strdup(log->committer_name.ptr)) == NULL ||
+		(entry->committer->email = git__strdup(log->committer_email.ptr)) == NULL)
+		goto fail;
+
+	entry->committer->when.time = log->time;
+	entry->committer->when.offset = log->offset;
+
+	if (log->message.size) {
+		size_t len = log->message.size;
+
+		if (log->message.ptr[len - 1] == '\n')
+			len--;
+
+		if ((entry->msg = git__strndup(log->message.ptr, len)) == NULL)
+			goto fail;
+	}
+
+	*out = entry;
+	return 0;
+
+fail:
+	git_reflog_entry__free(entry);
+	return -1;
+}
+
+static int refdb_reftable__reflog_read(
+	git_reflog **out, git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_vector logs = GIT_VECTOR_INIT;
+	git_reflog *reflog = NULL;
+	git_reflog_entry *entry;
+	git_reftable_log *log;
+	reftable_stack *stack;
+	size_t i;
+	int error;
+
+	assert(out && backend && name);
+
+	if ((error = stack_get(&stack, backend, false)) < 0)
+		return error;
+
+	if ((error = reflog_alloc(&reflog, name)) < 0 ||
+		(error = stack_read_logs(&logs, stack, name, false)) < 0)
+		goto done;
+
+	git_vector_foreach(&logs, i, log) {
+		if ((error = reflog_entry_from_record(&entry, log)) < 0)
+			goto done;
+
+		if ((error = git_vector_insert(&reflog->entries, entry)) < 0) {
+			git_reflog_entry__free(entry);
+			goto done;
+		}
+	}
+
+	*out = reflog;
+	reflog = NULL;
+
+done:
+	git_reflog_free(reflog);
+	logs_free(&logs);
+	stack_free(stack);
+	return error;
+}
+
+static int refdb_reftable__reflog_write(git_refdb_backend *_backend, git_reflog *reflog)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	git_reflog_entry *entry;
+	reftable_stack *stack;
+	reftable_batch batch;
+	size_t i;
+	int error;
+
+	assert(backend && reflog);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = stack_has_log(stack, reflog->ref_name)) < 0)
+		goto done;
+
+	if (!error) {
+		giterr_set(GITERR_INVALID,
+			"Log file for reference '%s' doesn't exist.", reflog->ref_name);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = batch_delete_logs(&batch, stack, reflog->ref_name)) < 0)
+		goto done;
+
+	/* the log is written anew, keeping an empty one in existence */
+	git_vector_foreach(&reflog->entries, i, entry)
+		if ((error = batch_add_log(&batch, reflog->ref_name,
+				batch_next_index(&batch), &entry->oid_old,
+				&entry->oid_cur, entry->committer, entry->msg)) < 0)
+			goto done;
+
+	if (!reflog->entries.length &&
+		(error = batch_add_log(&batch, reflog->ref_name,
+			batch_next_index(&batch), NULL, NULL, NULL, NULL)) < 0)
+		goto done;
+
+	error = stack_append(&list, backend, stack, &batch);
+
+done:
+	git_filebuf_cleanup(&list);
+
+	batch_free(&batch);
+	stack_free(stack);
+
+	return error ? error : maybe_compact(backend);
+}
+
+static int refdb_reftable__reflog_rename(
+	git_refdb_backend *_backend, const char *old_name, const char *new_name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	git_buf normalized = GIT_BUF_INIT;
+	reftable_stack *stack;
+	reftable_batch batch;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = git_reference__normalize_name(
+			&normalized, new_name, GIT_REF_FORMAT_ALLOW_ONELEVEL)) < 0)
+		return error;
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		goto out;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = batch_move_logs(&batch, stack, old_name, normalized.ptr)) < 0)
+		goto done;
+
+	error = stack_append(&list, backend, stack, &batch);
+
+done:
+	git_filebuf_cleanup(&list);
+
+	batch_free(&batch);
+	stack_free(stack);
+
+out:
+	git_buf_free(&normalized);
+	return error;
+}
+
+static int refdb_reftable__reflog_delete(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	git_filebuf list = GIT_FILEBUF_INIT;
+	reftable_stack *stack;
+	reftable_batch batch;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = stack_lock(&list, &stack, backend)) < 0)
+		return error;
+
+	if ((error = batch_init(&batch, stack)) < 0 ||
+		(error = batch_delete_logs(&batch, stack, name)) < 0)
+		goto done;
+
+	error = stack_append(&list, backend, stack, &batch);
+
+done:
+	git_filebuf_cleanup(&list);
+
+	batch_free(&batch);
+	stack_free(stack);
+	return error;
+}
+
+static void txn_update_free(reftable_txn_update *update)
+{
+	if (!update)
+		return;
+
+	git_reference_free(update->ref);
+	git_signature_free(update->who);
+	git__free(update->message);
+	git__free(update);
+}
+
+static git_reference *ref_dup(const git_reference *ref)
+{
+	if (ref->type == GIT_REF_SYMBOLIC)
+		return git_reference__alloc_symbolic(ref->name, ref->target.symbolic);
+
+	return git_reference__alloc(ref->name, &ref->target.oid,
+		git_oid_iszero(&ref->peel) ? NULL : &ref->peel);
+}
+
+static void txn_free(reftable_txn *txn)
+{
+	reftable_txn_update *update;
+	size_t i;
+
+	if (!txn)
+		return;
+
+	git_filebuf_cleanup(&txn->lock);
+
+	git_vector_foreach(&txn->updates, i, update)
+		txn_update_free(update);
+	git_vector_free(&txn->updates);
+
+	git__free(txn);
+}
+
+/*
+ * The refs a thread locks belong to the transaction it has open, so
+ * that a transaction on another thread waits for the list instead.
+ */
+static int txn_get(reftable_txn **out, refdb_reftable *backend)
+{
+	reftable_txn *txn = NULL;
+	const void *owner = GIT_GLOBAL;
+	size_t i;
+	int error = 0;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Unable to lock the reftable stack");
+		return -1;
+	}
+
+	git_vector_foreach(&backend->txns, i, txn) {
+		if (txn->owner == owner)
+			break;
+	}
+
+	if (i == backend->txns.length) {
+		txn = git__calloc(1, sizeof(reftable_txn));
+
+		if (!txn || git_vector_init(&txn->updates, 4, NULL) < 0 ||
+			git_vector_insert(&backend->txns, txn) < 0) {
+			txn_free(txn);
+			txn = NULL;
+			error = -1;
+		} else {
+			txn->owner = owner;
+		}
+	}
+
+	git_mutex_unlock(&backend->lock);
+
+	*out = txn;
+	return error;
+}
+
+static void txn_remove(refdb_reftable *backend, reftable_txn *txn)
+{
+	size_t pos;
+
+	if (git_mutex_lock(&backend->lock) < 0)
+		return;
+
+	if (!git_vector_search(&pos, &backend->txns, txn))
+		git_vector_remove(&backend->txns, pos);
+
+	git_mutex_unlock(&backend->lock);
+
+	txn_free(txn);
+}
+
+static int refdb_reftable__lock(
+	void **out, git_refdb_backend *_backend, const char *refname)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_stack *stack;
+	reftable_txn_ref *ref;
+	reftable_txn *txn;
+	size_t namelen = strlen(refname), alloclen;
+	int error;
+
+	assert(out && backend && refname);
+
+	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(reftable_txn_ref), namelen + 1);
+	ref = git__calloc(1, alloclen);
+	GITERR_CHECK_ALLOC(ref);
+
+	memcpy(ref->name, refname, namelen + 1);
+
+	if ((error = txn_get(&txn, backend)) < 0) {
+		git__free(ref);
+		return error;
+	}
+
+	/* the first ref to be locked locks them all */
+	if (!txn->refs) {
+		if ((error = stack_lock(&txn->lock, &stack, backend)) < 0) {
+			txn_remove(backend, txn);
+			git__free(ref);
+			return error;
+		}
+
+		stack_free(stack);
+	}
+
+	txn->refs++;
+	ref->txn = txn;
+
+	*out = ref;
+	return 0;
+}
+
+/* Write what the transaction updated in one table, and unlock the list */
+static int txn_commit(refdb_reftable *backend, reftable_txn *txn)
+{
+	reftable_txn_update *update;
+	reftable_stack *stack;
+	reftable_batch batch;
+	size_t i;
+	int error;
+
+	if ((error = stack_get(&stack, backend, true)) < 0)
+		goto out;
+
+	if ((error = batch_init(&batch, stack)) < 0)
+		goto done;
+
+	git_vector_foreach(&txn->updates, i, update) {
+		const char *name = update->ref->name;
+
+		if (update->type == 2) {
+			if ((error = stack_lookup_ref(NULL, stack, name)) < 0 ||
+				(error = batch_delete_ref(&batch, name)) < 0 ||
+				(error = batch_delete_logs(&batch, stack, name)) < 0)
+				goto done;
+
+			continue;
+		}
+
+		if ((error = batch_add_ref(&batch, update->ref)) < 0)
+			goto done;
+
+		if (update->update_reflog &&
+			(error = batch_log_update(&batch, backend, stack,
+				update->ref, update->who, update->message)) < 0)
+			goto done;
+	}
+
+	error = stack_append(&txn->lock, backend, stack, &batch);
+
+done:
+	batch_free(&batch);
+	stack_free(stack);
+
+out:
+	txn_remove(backend, txn);
+
+	return error ? error : maybe_compact(backend);
+}
+
+static int refdb_reftable__unlock(
+	git_refdb_backend *_backend, void *payload, int success, int update_reflog,
+	const git_reference *ref, const git_signature *sig, const char *message)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_txn *txn = ((reftable_txn_ref *)payload)->txn;
+	reftable_txn_update *update = NULL;
+	int error = 0;
+
+	assert(backend && txn && txn->refs);
+
+	git__free(payload);
+
+	if (success) {
+		update = git__calloc(1, sizeof(reftable_txn_update));
+
+		if (!update ||
+			(update->ref = ref_dup(ref)) == NULL ||
+			(sig && git_signature_dup(&update->who, sig) < 0) ||
+			(message && (update->message = git__strdup(message)) == NULL) ||
+			git_vector_insert(&txn->updates, update) < 0) {
+			txn_update_free(update);
+			error = -1;
+		} else {
+			update->type = success;
+			update->update_reflog = update_reflog;
+		}
+	}
+
+	if (--txn->refs == 0) {
+		int commit_error = txn_commit(backend, txn);
+		error = error ? error : commit_error;
+	}
+
+	return error;
+}
+
+static void refdb_reftable__free(git_refdb_backend *_backend)
+{
+	refdb_reftable *backend = (refdb_reftable *)_backend;
+	reftable_txn *txn;
+	size_t i;
+
+	assert(backend);
+
+	git_vector_foreach(&backend->txns, i, txn)
+		txn_free(txn);
+	git_vector_free(&backend->txns);
+
+	stack_free(backend->stack);
+	git_mutex_free(&backend->lock);
+	git__free(backend->path);
+	git__free(backend->list_path);
+	git__free(backend);
+}
+
+int git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo)
+{
+	git_buf path = GIT_BUF_INIT;
+	refdb_reftable *backend;
+
+	assert(backend_out && repo);
+
+	if (!repo->path_repository) {
+		giterr_set(GITERR_REFERENCE,
+			"A reftable needs a repository on disk");
+		return -1;
+	}
+
+	backend = git__calloc(1, sizeof(refdb_reftable));
+	GITERR_CHECK_ALLOC(backend);
+
+	backend->repo = repo;
+
+	if (git_mutex_init(&backend->lock) < 0) {
+		giterr_set(GITERR_OS, "Failed to initialize reftable lock");
+		git__free(backend);
+		return -1;
+	}
+
+	if (git_buf_joinpath(&path, repo->path_repository, GIT_REFTABLE_DIR) < 0)
+		goto fail;
+
+	backend->path = git_buf_detach(&path);
+
+	if (git_buf_joinpath(&path, backend->path, GIT_REFTABLE_LIST) < 0 ||
+		git_vector_init(&backend->txns, 2, NULL) < 0)
+		goto fail;
+
+	backend->list_path = git_buf_detach(&path);
+
+	backend->parent.exists = &refdb_reftable__exists;
+	backend->parent.lookup = &refdb_reftable__lookup;
+	backend->parent.iterator = &refdb_reftable__iterator;
+	backend->parent.write = &refdb_reftable__write;
+	backend->parent.del = &refdb_reftable__delete;
+	backend->parent.rename = &refdb_reftable__rename;
+	backend->parent.compress = &refdb_reftable__compress;
+	backend->parent.lock = &refdb_reftable__lock;
+	backend->parent.unlock = &refdb_reftable__unlock;
+	backend->parent.has_log = &refdb_reftable__has_log;
+	backend->parent.ensure_log = &refdb_reftable__ensure_log;
+	backend->parent.free = &refdb_reftable__free;
+	backend->parent.reflog_read = &refdb_reftable__reflog_read;
+	backend->parent.reflog_write = &refdb_reftable__reflog_write;
+	backend->parent.reflog_rename = &refdb_reftable__reflog_rename;
+	backend->parent.reflog_delete = &refdb_reftable__reflog_delete;
+
+	*backend_out = (git_refdb_backend *)backend;
+	return 0;
+
+fail:
+	git_buf_free(&path);
+	refdb_reftable__free((git_refdb_backend *)backend);
+	return -1;
+}
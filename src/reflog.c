@@ -61,12 +61,33 @@ int git_reflog_read(git_reflog **reflog, git_repository *repo,  const char *name
 	return git_refdb_reflog_read(reflog, refdb, name);
 }
 
+int git_reflog__read_recent(
+	git_reflog **reflog, git_repository *repo, const char *name, size_t count)
+{
+	git_refdb *refdb;
+	int error;
+
+	assert(reflog && repo && name);
+
+	if ((error = git_repository_refdb__weakptr(&refdb, repo)) < 0)
+		return error;
+
+	return git_refdb_reflog_read_recent(reflog, refdb, name, count);
+}
+
 int git_reflog_write(git_reflog *reflog)
 {
 	git_refdb *db;
 
 	assert(reflog && reflog->db);
 
+	if (reflog->truncated) {
+		giterr_set(GITERR_REFERENCE,
+			"Cannot write the reflog for '%s' back; only part of it was read",
+			reflog->ref_name);
+		return -1;
+	}
+
 	db = reflog->db;
 	return db->backend->reflog_write(db->backend, reflog);
 }
@@ -30,8 +30,23 @@ struct git_reflog {
 	git_refdb *db;
 	char *ref_name;
 	git_vector entries;
+
+	/* set when only the most recent entries have been read */
+	unsigned int truncated:1;
 };
 
+/*
+ * Read at least the `count` most recent entries of a reflog.  Use
+ * `git_reflog__truncated` to find out whether there are more.
+ */
+extern int git_reflog__read_recent(
+	git_reflog **reflog, git_repository *repo, const char *name, size_t count);
+
+GIT_INLINE(bool) git_reflog__truncated(const git_reflog *reflog)
+{
+	return reflog->truncated;
+}
+
 GIT_INLINE(size_t) reflog_inverse_index(size_t idx, size_t total)
 {
 	return (total - 1) - idx;
@@ -0,0 +1,1139 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include <zlib.h>
+
+#include "common.h"
+#include "array.h"
+#include "fileops.h"
+#include "zstream.h"
+#include "reftable.h"
+
+/*
+ * A reftable starts with a header and ends with a footer repeating it,
+ * with the sections of reference and log blocks in between:
+ *
+ *   'REFT' | version | uint24 block_size | uint64 min | uint64 max
+ *   ref blocks, each padded to block_size
+ *   log blocks, deflated and unpadded
+ *   header | uint64 ref_index | uint64 obj | uint64 obj_index |
+ *     uint64 log_position | uint64 log_index | uint32 crc32
+ *
+ * A block is its type, a uint24 length and the records, followed by
+ * the uint24 offsets of the records whose keys are written in full
+ * and a uint16 count of them.  The first block of the file includes
+ * the file header, and its offsets count from the start of the file.
+ *
+ * We never write the optional index and object sections: readers find
+ * reference blocks by bisecting them, which the padding allows.
+ */
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_LOG 'g'
+#define BLOCK_TYPE_INDEX 'i'
+
+#define BLOCK_HEADER_SIZE 4
+#define MAX_BLOCK_LEN 0xffffff
+#define LOG_KEY_SUFFIX_LEN 9 /* '\0' and the reversed update index */
+
+static int reftable_corrupted(void)
+{
+	giterr_set(GITERR_REFERENCE, "Corrupted reftable");
+	return -1;
+}
+
+static void put_be16(unsigned char *out, uint16_t n)
+{
+	out[0] = (n >> 8) & 0xff;
+	out[1] = n & 0xff;
+}
+
+static void put_be24(unsigned char *out, uint32_t n)
+{
+	out[0] = (n >> 16) & 0xff;
+	out[1] = (n >> 8) & 0xff;
+	out[2] = n & 0xff;
+}
+
+static void put_be32(unsigned char *out, uint32_t n)
+{
+	put_be16(out, (uint16_t)(n >> 16));
+	put_be16(out + 2, (uint16_t)(n & 0xffff));
+}
+
+static void put_be64(unsigned char *out, uint64_t n)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, n >>= 8)
+		out[i] = n & 0xff;
+}
+
+static uint16_t get_be16(const unsigned char *in)
+{
+	return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+static uint32_t get_be24(const unsigned char *in)
+{
+	return ((uint32_t)in[0] << 16) | ((uint32_t)in[1] << 8) | in[2];
+}
+
+static uint32_t get_be32(const unsigned char *in)
+{
+	return ((uint32_t)in[0] << 24) | get_be24(in + 1);
+}
+
+static uint64_t get_be64(const unsigned char *in)
+{
+	uint64_t n = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		n = (n << 8) | in[i];
+
+	return n;
+}
+
+/* The same variable-length integers as the offsets of OFS_DELTA objects */
+static int put_varint(git_buf *buf, uint64_t n)
+{
+	unsigned char varint[10];
+	size_t pos = sizeof(varint) - 1;
+
+	varint[pos] = n & 0x7f;
+
+	while (n >>= 7)
+		varint[--pos] = 0x80 | (--n & 0x7f);
+
+	return git_buf_put(buf, (char *)varint + pos, sizeof(varint) - pos);
+}
+
+static int get_varint(
+	uint64_t *out, const unsigned char *data, size_t *pos, size_t end)
+{
+	uint64_t n;
+	unsigned char c;
+
+	if (*pos >= end)
+		return reftable_corrupted();
+
+	c = data[(*pos)++];
+	n = c & 0x7f;
+
+	while (c & 0x80) {
+		if (*pos >= end || n >= (UINT64_MAX >> 7))
+			return reftable_corrupted();
+
+		c = data[(*pos)++];
+		n = ((n + 1) << 7) | (c & 0x7f);
+	}
+
+	*out = n;
+	return 0;
+}
+
+static int put_header(git_buf *buf, uint64_t min, uint64_t max)
+{
+	unsigned char header[GIT_REFTABLE_HEADER_SIZE];
+
+	memcpy(header, GIT_REFTABLE_SIGNATURE, 4);
+	header[4] = GIT_REFTABLE_VERSION;
+	put_be24(header + 5, GIT_REFTABLE_BLOCK_SIZE);
+	put_be64(header + 8, min);
+	put_be64(header + 16, max);
+
+	return git_buf_put(buf, (char *)header, sizeof(header));
+}
+
+static int log_key(git_buf *key, const git_reftable_log *log)
+{
+	unsigned char suffix[LOG_KEY_SUFFIX_LEN];
+
+	suffix[0] = '\0';
+	put_be64(suffix + 1, UINT64_MAX - log->update_index);
+
+	git_buf_clear(key);
+	git_buf_put(key, log->name.ptr, log->name.size);
+	return git_buf_put(key, (char *)suffix, sizeof(suffix));
+}
+
+void git_reftable_ref_free(git_reftable_ref *ref)
+{
+	if (!ref)
+		return;
+
+	git_buf_free(&ref->name);
+	git_buf_free(&ref->target);
+}
+
+void git_reftable_log_free(git_reftable_log *log)
+{
+	if (!log)
+		return;
+
+	git_buf_free(&log->name);
+	git_buf_free(&log->committer_name);
+	git_buf_free(&log->committer_email);
+	git_buf_free(&log->message);
+}
+
+int git_reftable_log_cmp(const git_reftable_log *a, const git_reftable_log *b)
+{
+	int cmp = strcmp(a->name.ptr, b->name.ptr);
+
+	if (cmp)
+		return cmp;
+
+	if (a->update_index != b->update_index)
+		return a->update_index > b->update_index ? -1 : 1;
+
+	return 0;
+}
+
+struct git_reftable_writer {
+	git_buf out;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	char block_type; /* 0 until the first record of a block */
+	size_t block_start;
+	git_buf records;
+	git_array_t(uint32_t) restarts;
+	size_t entries;
+	git_buf last_key;
+
+	size_t log_position;
+	unsigned int has_logs:1;
+
+	git_buf key;
+	git_buf record;
+};
+
+int git_reftable_writer_new(
+	git_reftable_writer **out,
+	uint64_t min_update_index,
+	uint64_t max_update_index)
+{
+	git_reftable_writer *w;
+
+	assert(out && min_update_index <= max_update_index);
+
+	w = git__calloc(1, sizeof(git_reftable_writer));
+	GITERR_CHECK_ALLOC(w);
+
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+
+	if (put_header(&w->out, min_update_index, max_update_index) < 0) {
+		git_reftable_writer_free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+static size_t block_header_offset(size_t block_start)
+{
+	return block_start ? 0 : GIT_REFTABLE_HEADER_SIZE;
+}
+
+/* The length the current block would have with `extra` more bytes */
+static size_t block_len(git_reftable_writer *w, size_t extra, size_t restarts)
+{
+	return block_header_offset(w->block_start) + BLOCK_HEADER_SIZE +
+		w->records.size + extra + 3 * restarts + 2;
+}
+
+static int flush_block(git_reftable_writer *w)
+{
+	git_buf trailer = GIT_BUF_INIT, deflated = GIT_BUF_INIT;
+	unsigned char header[BLOCK_HEADER_SIZE], n[3];
+	size_t len, i;
+	int error = -1;
+
+	if (!w->block_type)
+		return 0;
+
+	len = block_len(w, 0, git_array_size(w->restarts));
+
+	for (i = 0; i < git_array_size(w->restarts); i++) {
+		put_be24(n, *git_array_get(w->restarts, i));
+		git_buf_put(&trailer, (char *)n, 3);
+	}
+
+	put_be16(n, (uint16_t)git_array_size(w->restarts));
+	git_buf_put(&trailer, (char *)n, 2);
+
+	header[0] = w->block_type;
+	put_be24(header + 1, (uint32_t)len);
+
+	if (git_buf_oom(&trailer) ||
+		(error = git_buf_put(&w->out, (char *)header, sizeof(header))) < 0)
+		goto done;
+
+	if (w->block_type == BLOCK_TYPE_LOG) {
+		/* log blocks are deflated past their header, and not padded */
+		if ((error = git_buf_put(&w->records, trailer.ptr, trailer.size)) < 0 ||
+			(error = git_zstream_deflatebuf(
+				&deflated, w->records.ptr, w->records.size)) < 0 ||
+			(error = git_buf_put(&w->out, deflated.ptr, deflated.size)) < 0)
+			goto done;
+	} else {
+		if ((error = git_buf_put(&w->out, w->records.ptr, w->records.size)) < 0 ||
+			(error = git_buf_put(&w->out, trailer.ptr, trailer.size)) < 0)
+			goto done;
+
+		while (w->out.size < w->block_start + GIT_REFTABLE_BLOCK_SIZE)
+			if ((error = git_buf_putc(&w->out, '\0')) < 0)
+				goto done;
+	}
+
+	w->block_type = 0;
+	git_buf_clear(&w->records);
+	git_array_clear(w->restarts);
+	git_buf_clear(&w->last_key);
+	w->entries = 0;
+
+done:
+	git_buf_free(&trailer);
+	git_buf_free(&deflated);
+	return error;
+}
+
+static int key_cmp(const git_buf *a, const git_buf *b)
+{
+	int cmp = memcmp(a->ptr, b->ptr, min(a->size, b->size));
+
+	if (cmp)
+		return cmp;
+
+	return (a->size > b->size) - (a->size < b->size);
+}
+
+/*
+ * Add the record in `w->record` with key `w->key` to a block of the
+ * given type, starting a new block when it does not fit.
+ */
+static int add_record(git_reftable_writer *w, char type, uint8_t extra)
+{
+	git_buf encoded = GIT_BUF_INIT;
+	size_t prefix, len;
+	bool restart;
+	int error = 0;
+
+	if (w->block_type && w->block_type != type &&
+		(error = flush_block(w)) < 0)
+		return error;
+
+	if (w->entries && key_cmp(&w->last_key, &w->key) >= 0) {
+		giterr_set(GITERR_REFERENCE,
+			"reftable records must be added in order");
+		return -1;
+	}
+
+	for (;;) {
+		restart = (w->entries % GIT_REFTABLE_RESTART_INTERVAL) == 0;
+		prefix = 0;
+
+		while (!restart && prefix < w->last_key.size &&
+			prefix < w->key.size &&
+			w->last_key.ptr[prefix] == w->key.ptr[prefix])
+			prefix++;
+
+		git_buf_clear(&encoded);
+		put_varint(&encoded, prefix);
+		put_varint(&encoded, ((uint64_t)(w->key.size - prefix) << 3) | extra);
+		git_buf_put(&encoded, w->key.ptr + prefix, w->key.size - prefix);
+		git_buf_put(&encoded, w->record.ptr, w->record.size);
+
+		if (git_buf_oom(&encoded)) {
+			error = -1;
+			goto done;
+		}
+
+		if (!w->block_type) {
+			w->block_type = type;
+
+			/* the first block starts with the file header */
+			w->block_start = (w->out.size == GIT_REFTABLE_HEADER_SIZE) ?
+				0 : w->out.size;
+
+			if (type == BLOCK_TYPE_LOG && !w->has_logs) {
+				w->log_position = w->block_start;
+				w->has_logs = 1;
+			}
+		}
+
+		len = block_len(w, encoded.size,
+			git_array_size(w->restarts) + (restart ? 1 : 0));
+
+		if (len <= GIT_REFTABLE_BLOCK_SIZE)
+			break;
+
+		if (!w->entries) {
+			/* only a log block may grow, to hold a long message */
+			if (type == BLOCK_TYPE_LOG && len <= MAX_BLOCK_LEN)
+				break;
+
+			giterr_set(GITERR_REFERENCE, "reftable record is too large");
+			error = -1;
+			goto done;
+		}
+
+		if ((error = flush_block(w)) < 0)
+			goto done;
+	}
+
+	if (restart) {
+		uint32_t *pos = git_array_alloc(w->restarts);
+
+		if (!pos) {
+			error = -1;
+			goto done;
+		}
+
+		*pos = (uint32_t)(block_header_offset(w->block_start) +
+			BLOCK_HEADER_SIZE + w->records.size);
+	}
+
+	if ((error = git_buf_put(&w->records, encoded.ptr, encoded.size)) < 0 ||
+		(error = git_buf_set(&w->last_key, w->key.ptr, w->key.size)) < 0)
+		goto done;
+
+	w->entries++;
+
+done:
+	git_buf_free(&encoded);
+	return error;
+}
+
+int git_reftable_writer_add_ref(
+	git_reftable_writer *w, const git_reftable_ref *ref)
+{
+	git_buf *out = &w->record;
+
+	assert(w && ref);
+
+	if (w->has_logs) {
+		giterr_set(GITERR_REFERENCE,
+			"reftable references must come before the logs");
+		return -1;
+	}
+
+	if (ref->update_index < w->min_update_index ||
+		ref->update_index > w->max_update_index) {
+		giterr_set(GITERR_REFERENCE,
+			"update index of '%s' is out of the table's range", ref->name.ptr);
+		return -1;
+	}
+
+	git_buf_clear(out);
+	put_varint(out, ref->update_index - w->min_update_index);
+
+	switch (ref->type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL2:
+		git_buf_put(out, (char *)ref->oid.id, GIT_OID_RAWSZ);
+		git_buf_put(out, (char *)ref->peel.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+		git_buf_put(out, (char *)ref->oid.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		put_varint(out, ref->target.size);
+		git_buf_put(out, ref->target.ptr, ref->target.size);
+		break;
+	default:
+		giterr_set(GITERR_INVALID, "Invalid reftable record type");
+		return -1;
+	}
+
+	if (git_buf_oom(out) ||
+		git_buf_set(&w->key, ref->name.ptr, ref->name.size) < 0)
+		return -1;
+
+	return add_record(w, BLOCK_TYPE_REF, ref->type);
+}
+
+int git_reftable_writer_add_log(
+	git_reftable_writer *w, const git_reftable_log *log)
+{
+	git_buf *out = &w->record;
+	unsigned char tz[2];
+
+	assert(w && log);
+
+	git_buf_clear(out);
+
+	if (log->type == GIT_REFTABLE_LOG_UPDATE) {
+		put_be16(tz, (uint16_t)(int16_t)log->offset);
+
+		git_buf_put(out, (char *)log->old_id.id, GIT_OID_RAWSZ);
+		git_buf_put(out, (char *)log->new_id.id, GIT_OID_RAWSZ);
+		put_varint(out, log->committer_name.size);
+		git_buf_put(out, log->committer_name.ptr, log->committer_name.size);
+		put_varint(out, log->committer_email.size);
+		git_buf_put(out, log->committer_email.ptr, log->committer_email.size);
+		put_varint(out, (uint64_t)log->time);
+		git_buf_put(out, (char *)tz, sizeof(tz));
+		put_varint(out, log->message.size);
+		git_buf_put(out, log->message.ptr, log->message.size);
+	} else if (log->type != GIT_REFTABLE_LOG_DELETION) {
+		giterr_set(GITERR_INVALID, "Invalid reftable record type");
+		return -1;
+	}
+
+	if (git_buf_oom(out) || log_key(&w->key, log) < 0)
+		return -1;
+
+	return add_record(w, BLOCK_TYPE_LOG, log->type);
+}
+
+int git_reftable_writer_finish(git_buf *out, git_reftable_writer *w)
+{
+	unsigned char footer[GIT_REFTABLE_FOOTER_SIZE - GIT_REFTABLE_HEADER_SIZE];
+	size_t footer_start;
+	uLong crc;
+
+	assert(out && w);
+
+	if (flush_block(w) < 0)
+		return -1;
+
+	footer_start = w->out.size;
+
+	if (put_header(&w->out, w->min_update_index, w->max_update_index) < 0)
+		return -1;
+
+	/* no indexes and no object section, only the logs are pointed at */
+	memset(footer, 0, sizeof(footer));
+	put_be64(footer + 24, w->has_logs ? w->log_position : 0);
+
+	crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, (const Bytef *)w->out.ptr + footer_start,
+		GIT_REFTABLE_HEADER_SIZE);
+	crc = crc32(crc, footer, sizeof(footer) - 4);
+	put_be32(footer + sizeof(footer) - 4, (uint32_t)crc);
+
+	if (git_buf_put(&w->out, (char *)footer, sizeof(footer)) < 0)
+		return -1;
+
+	git_buf_swap(out, &w->out);
+	return 0;
+}
+
+void git_reftable_writer_free(git_reftable_writer *w)
+{
+	if (!w)
+		return;
+
+	git_buf_free(&w->out);
+	git_buf_free(&w->records);
+	git_array_clear(w->restarts);
+	git_buf_free(&w->last_key);
+	git_buf_free(&w->key);
+	git_buf_free(&w->record);
+	git__free(w);
+}
+
+int git_reftable_open(git_reftable **out, const char *path)
+{
+	git_reftable *table;
+	const unsigned char *header, *footer;
+	size_t footer_start;
+	uint64_t ref_index, obj, log_position, log_index;
+	uLong crc;
+	int error;
+
+	assert(out && path);
+
+	*out = NULL;
+
+	table = git__calloc(1, sizeof(git_reftable));
+	GITERR_CHECK_ALLOC(table);
+
+#ifdef GIT_WIN32
+	if ((error = git_futils_readbuffer(&table->contents, path)) < 0)
+		goto done;
+
+	table->data = (const unsigned char *)table->contents.ptr;
+	table->size = table->contents.size;
+#else
+	if ((error = git_futils_mmap_ro_file(&table->map, path)) < 0)
+		goto done;
+
+	table->data = table->map.data;
+	table->size = table->map.len;
+#endif
+
+	if (table->size < GIT_REFTABLE_HEADER_SIZE + GIT_REFTABLE_FOOTER_SIZE) {
+		error = reftable_corrupted();
+		goto done;
+	}
+
+	header = table->data;
+	footer_start = table->size - GIT_REFTABLE_FOOTER_SIZE;
+	footer = table->data + footer_start;
+
+	if (memcmp(header, GIT_REFTABLE_SIGNATURE, 4) != 0 ||
+		header[4] != GIT_REFTABLE_VERSION) {
+		giterr_set(GITERR_REFERENCE,
+			"'%s' is not a reftable we understand", path);
+		error = -1;
+		goto done;
+	}
+
+	crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, footer, GIT_REFTABLE_FOOTER_SIZE - 4);
+
+	if (memcmp(header, footer, GIT_REFTABLE_HEADER_SIZE) != 0 ||
+		get_be32(footer + GIT_REFTABLE_FOOTER_SIZE - 4) != (uint32_t)crc) {
+		error = reftable_corrupted();
+		goto done;
+	}
+
+	table->block_size = get_be24(header + 5);
+	table->min_update_index = get_be64(header + 8);
+	table->max_update_index = get_be64(header + 16);
+
+	ref_index = get_be64(footer + 24);
+	obj = get_be64(footer + 32) >> 5;
+	log_position = get_be64(footer + 48);
+	log_index = get_be64(footer + 56);
+
+	/* whatever kind it is, the first block follows the file header */
+	if (footer_start > GIT_REFTABLE_HEADER_SIZE) {
+		char first = header[GIT_REFTABLE_HEADER_SIZE];
+
+		table->has_logs = (first == BLOCK_TYPE_LOG || log_position > 0);
+
+		if (first == BLOCK_TYPE_REF) {
+			table->ref_end = footer_start;
+
+			if (ref_index && ref_index < table->ref_end)
+				table->ref_end = (size_t)ref_index;
+			if (obj && obj < table->ref_end)
+				table->ref_end = (size_t)obj;
+			if (table->has_logs && log_position < table->ref_end)
+				table->ref_end = (size_t)log_position;
+		}
+	}
+
+	table->log_start = (size_t)log_position;
+	table->log_end = log_index ? (size_t)log_index : footer_start;
+
+	if (table->block_size < GIT_REFTABLE_HEADER_SIZE + BLOCK_HEADER_SIZE ||
+		table->log_start > table->log_end || table->log_end > footer_start) {
+		error = reftable_corrupted();
+		goto done;
+	}
+
+	*out = table;
+	table = NULL;
+	error = 0;
+
+done:
+	git_reftable_free(table);
+	return error;
+}
+
+void git_reftable_free(git_reftable *table)
+{
+	if (!table)
+		return;
+
+#ifdef GIT_WIN32
+	git_buf_free(&table->contents);
+#else
+	if (table->map.data)
+		git_futils_mmap_free(&table->map);
+#endif
+	git__free(table);
+}
+
+static int inflate_block(
+	git_reftable_iter *it, size_t header_off, size_t len, size_t *consumed)
+{
+	git_reftable *table = it->table;
+	size_t start = it->block_start + header_off + BLOCK_HEADER_SIZE;
+	z_stream zs;
+	int status;
+
+	git_buf_clear(&it->inflated);
+
+	/* keep the offsets in the block as they were before deflating */
+	if (git_buf_grow(&it->inflated, len + 1) < 0)
+		return -1;
+
+	memset(it->inflated.ptr, 0, header_off + BLOCK_HEADER_SIZE);
+
+	memset(&zs, 0, sizeof(zs));
+	zs.next_in = (Bytef *)table->data + start;
+	zs.avail_in = (uInt)(it->table->log_end - start);
+	zs.next_out = (Bytef *)it->inflated.ptr + header_off + BLOCK_HEADER_SIZE;
+	zs.avail_out = (uInt)(len - header_off - BLOCK_HEADER_SIZE);
+
+	if (inflateInit(&zs) != Z_OK) {
+		giterr_set(GITERR_ZLIB, "Failed to inflate reftable block");
+		return -1;
+	}
+
+	status = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (status != Z_STREAM_END || zs.avail_out != 0)
+		return reftable_corrupted();
+
+	it->inflated.size = len;
+	it->inflated.ptr[len] = '\0';
+	*consumed = zs.total_in;
+	return 0;
+}
+
+/* Load the block at `start` into the iterator */
+static int load_block(git_reftable_iter *it, size_t start, char type)
+{
+	git_reftable *table = it->table;
+	size_t header_off = block_header_offset(start), section_end, len;
+	size_t restarts, consumed;
+	const unsigned char *header;
+
+	section_end = (type == BLOCK_TYPE_LOG) ? table->log_end : table->ref_end;
+
+	if (start + header_off + BLOCK_HEADER_SIZE > section_end)
+		return reftable_corrupted();
+
+	header = table->data + start + header_off;
+	len = get_be24(header + 1);
+
+	if (header[0] != type ||
+		len < header_off + BLOCK_HEADER_SIZE + 2)
+		return reftable_corrupted();
+
+	it->block_start = start;
+
+	if (type == BLOCK_TYPE_LOG) {
+		if (inflate_block(it, header_off, len, &consumed) < 0)
+			return -1;
+
+		it->block = (const unsigned char *)it->inflated.ptr;
+		it->next_block = start + header_off + BLOCK_HEADER_SIZE + consumed;
+	} else {
+		if (start + len > section_end)
+			return reftable_corrupted();
+
+		it->block = table->data + start;
+		it->next_block = start + table->block_size;
+
+		if (it->next_block > section_end)
+			it->next_block = section_end;
+	}
+
+	restarts = get_be16(it->block + len - 2);
+
+	if (len < header_off + BLOCK_HEADER_SIZE + 2 + 3 * restarts)
+		return reftable_corrupted();
+
+	it->block_type = type;
+	it->records_end = len - 2 - 3 * restarts;
+	it->restart_count = restarts;
+	it->pos = header_off + BLOCK_HEADER_SIZE;
+	git_buf_clear(&it->last_key);
+
+	return 0;
+}
+
+/* Move on to the next block when the current one is used up */
+static int next_block(git_reftable_iter *it)
+{
+	size_t end = (it->block_type == BLOCK_TYPE_LOG) ?
+		it->table->log_end : it->table->ref_end;
+
+	while (it->pos >= it->records_end) {
+		if (it->next_block >= end)
+			return GIT_ITEROVER;
+
+		if (load_block(it, it->next_block, it->block_type) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int decode_key(git_buf *key, uint8_t *extra, git_reftable_iter *it)
+{
+	uint64_t prefix, n;
+
+	if (get_varint(&prefix, it->block, &it->pos, it->records_end) < 0 ||
+		get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+		return -1;
+
+	if (prefix > key->size || (n >> 3) > it->records_end - it->pos)
+		return reftable_corrupted();
+
+	git_buf_truncate(key, (size_t)prefix);
+
+	if (git_buf_put(key, (const char *)it->block + it->pos, (size_t)(n >> 3)) < 0)
+		return -1;
+
+	it->pos += (size_t)(n >> 3);
+	*extra = n & 0x7;
+	return 0;
+}
+
+/* The full key of the record at `pos`, which must be a restart point */
+static int restart_key(git_buf *key, git_reftable_iter *it, size_t pos)
+{
+	size_t saved = it->pos;
+	uint8_t extra;
+	int error;
+
+	git_buf_clear(key);
+
+	it->pos = pos;
+	error = decode_key(key, &extra, it);
+	it->pos = saved;
+
+	return error;
+}
+
+static int key_cmp_str(const git_buf *key, const char *str, size_t len)
+{
+	int cmp = memcmp(key->ptr, str, min(key->size, len));
+
+	if (cmp)
+		return cmp;
+
+	return (key->size > len) - (key->size < len);
+}
+
+static int skip_ref_value(git_reftable_iter *it, uint8_t type)
+{
+	uint64_t n;
+
+	if (get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+		return -1;
+
+	switch (type) {
+	case GIT_REFTABLE_REF_DELETION:
+		return 0;
+	case GIT_REFTABLE_REF_VAL1:
+		n = GIT_OID_RAWSZ;
+		break;
+	case GIT_REFTABLE_REF_VAL2:
+		n = 2 * GIT_OID_RAWSZ;
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		if (get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+			return -1;
+		break;
+	default:
+		return reftable_corrupted();
+	}
+
+	if (n > it->records_end - it->pos)
+		return reftable_corrupted();
+
+	it->pos += (size_t)n;
+	return 0;
+}
+
+int git_reftable_ref_seek(
+	git_reftable_iter *it, git_reftable *table, const char *name)
+{
+	git_buf key = GIT_BUF_INIT, saved_key = GIT_BUF_INIT;
+	size_t len = strlen(name), blocks, lo, hi, mid, saved_pos;
+	uint8_t type;
+	int error = 0;
+
+	assert(it && table && name);
+
+	git_reftable_iter_free(it);
+	it->table = table;
+	it->block_type = BLOCK_TYPE_REF;
+
+	if (!table->ref_end) {
+		it->next_block = it->records_end = it->pos = 0;
+		return 0;
+	}
+
+	/* find the last block that starts at or before the name */
+	blocks = (table->ref_end + table->block_size - 1) / table->block_size;
+	lo = 0;
+	hi = blocks;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+
+		if ((error = load_block(it, mid * table->block_size, BLOCK_TYPE_REF)) < 0 ||
+			(error = restart_key(&key, it, it->pos)) < 0)
+			goto done;
+
+		if (key_cmp_str(&key, name, len) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if ((error = load_block(it, lo * table->block_size, BLOCK_TYPE_REF)) < 0)
+		goto done;
+
+	/* and the last restart point in it that does */
+	lo = 0;
+	hi = it->restart_count;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+
+		if ((error = restart_key(&key, it,
+				get_be24(it->block + it->records_end + 3 * mid))) < 0)
+			goto done;
+
+		if (key_cmp_str(&key, name, len) <= 0)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (it->restart_count)
+		it->pos = get_be24(it->block + it->records_end + 3 * lo);
+
+	/* then walk up to the name */
+	for (;;) {
+		if ((error = next_block(it)) < 0) {
+			if (error == GIT_ITEROVER)
+				error = 0;
+			break;
+		}
+
+		saved_pos = it->pos;
+		if ((error = git_buf_set(&saved_key, it->last_key.ptr, it->last_key.size)) < 0 ||
+			(error = decode_key(&it->last_key, &type, it)) < 0)
+			break;
+
+		if (key_cmp_str(&it->last_key, name, len) >= 0) {
+			it->pos = saved_pos;
+			git_buf_swap(&it->last_key, &saved_key);
+			break;
+		}
+
+		if ((error = skip_ref_value(it, type)) < 0)
+			break;
+	}
+
+done:
+	git_buf_free(&key);
+	git_buf_free(&saved_key);
+	return error;
+}
+
+int git_reftable_ref_next(git_reftable_ref *out, git_reftable_iter *it)
+{
+	uint64_t n;
+	uint8_t type;
+	int error;
+
+	assert(out && it);
+
+	if ((error = next_block(it)) < 0)
+		return error;
+
+	if (decode_key(&it->last_key, &type, it) < 0 ||
+		get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+		return -1;
+
+	if (git_buf_set(&out->name, it->last_key.ptr, it->last_key.size) < 0)
+		return -1;
+
+	out->type = type;
+	out->update_index = it->table->min_update_index + n;
+	git_buf_clear(&out->target);
+
+	switch (type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+	case GIT_REFTABLE_REF_VAL2:
+		if ((type == GIT_REFTABLE_REF_VAL1 ? 1 : 2) * GIT_OID_RAWSZ >
+			it->records_end - it->pos)
+			return reftable_corrupted();
+
+		git_oid_fromraw(&out->oid, it->block + it->pos);
+		it->pos += GIT_OID_RAWSZ;
+
+		if (type == GIT_REFTABLE_REF_VAL2) {
+			git_oid_fromraw(&out->peel, it->block + it->pos);
+			it->pos += GIT_OID_RAWSZ;
+		} else {
+			memset(&out->peel, 0, sizeof(git_oid));
+		}
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		if (get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+			return -1;
+
+		if (n > it->records_end - it->pos ||
+			git_buf_set(&out->target, it->block + it->pos, (size_t)n) < 0)
+			return reftable_corrupted();
+
+		it->pos += (size_t)n;
+		break;
+	default:
+		return reftable_corrupted();
+	}
+
+	return 0;
+}
+
+static int get_string(git_buf *out, git_reftable_iter *it)
+{
+	uint64_t n;
+
+	if (get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+		return -1;
+
+	if (n > it->records_end - it->pos)
+		return reftable_corrupted();
+
+	if (git_buf_set(out, it->block + it->pos, (size_t)n) < 0)
+		return -1;
+
+	it->pos += (size_t)n;
+	return 0;
+}
+
+static int read_log(git_reftable_log *out, git_reftable_iter *it, uint8_t type)
+{
+	const git_buf *key = &it->last_key;
+	size_t name_len;
+	uint64_t n;
+
+	if (key->size < LOG_KEY_SUFFIX_LEN ||
+		key->ptr[key->size - LOG_KEY_SUFFIX_LEN] != '\0')
+		return reftable_corrupted();
+
+	name_len = key->size - LOG_KEY_SUFFIX_LEN;
+
+	if (git_buf_set(&out->name, key->ptr, name_len) < 0)
+		return -1;
+
+	out->update_index = UINT64_MAX -
+		get_be64((const unsigned char *)key->ptr + name_len + 1);
+	out->type = type;
+
+	git_buf_clear(&out->committer_name);
+	git_buf_clear(&out->committer_email);
+	git_buf_clear(&out->message);
+
+	if (type == GIT_REFTABLE_LOG_DELETION)
+		return 0;
+
+	if (type != GIT_REFTABLE_LOG_UPDATE ||
+		2 * GIT_OID_RAWSZ > it->records_end - it->pos)
+		return reftable_corrupted();
+
+	git_oid_fromraw(&out->old_id, it->block + it->pos);
+	git_oid_fromraw(&out->new_id, it->block + it->pos + GIT_OID_RAWSZ);
+	it->pos += 2 * GIT_OID_RAWSZ;
+
+	if (get_string(&out->committer_name, it) < 0 ||
+		get_string(&out->committer_email, it) < 0 ||
+		get_varint(&n, it->block, &it->pos, it->records_end) < 0)
+		return -1;
+
+	out->time = (git_time_t)n;
+
+	if (2 > it->records_end - it->pos)
+		return reftable_corrupted();
+
+	out->offset = (int16_t)get_be16(it->block + it->pos);
+	it->pos += 2;
+
+	return get_string(&out->message, it);
+}
+
+int git_reftable_log_seek(
+	git_reftable_iter *it, git_reftable *table, const char *name)
+{
+	git_reftable_log log = GIT_REFTABLE_LOG_INIT;
+	git_buf saved_key = GIT_BUF_INIT;
+	size_t saved_pos, saved_block;
+	uint8_t type;
+	int error;
+
+	assert(it && table && name);
+
+	git_reftable_iter_free(it);
+	it->table = table;
+	it->block_type = BLOCK_TYPE_LOG;
+
+	if (!table->has_logs) {
+		it->next_block = table->log_end;
+		it->records_end = it->pos = 0;
+		return 0;
+	}
+
+	if ((error = load_block(it, table->log_start, BLOCK_TYPE_LOG)) < 0)
+		return error;
+
+	/* the logs are not indexed, so walk up to the name */
+	for (;;) {
+		if ((error = next_block(it)) < 0) {
+			if (error == GIT_ITEROVER)
+				error = 0;
+			break;
+		}
+
+		saved_pos = it->pos;
+		saved_block = it->block_start;
+
+		if ((error = git_buf_set(&saved_key, it->last_key.ptr, it->last_key.size)) < 0 ||
+			(error = decode_key(&it->last_key, &type, it)) < 0 ||
+			(error = read_log(&log, it, type)) < 0)
+			break;
+
+		if (strcmp(log.name.ptr, name) >= 0) {
+			assert(saved_block == it->block_start);
+			it->pos = saved_pos;
+			git_buf_swap(&it->last_key, &saved_key);
+			break;
+		}
+	}
+
+	git_reftable_log_free(&log);
+	git_buf_free(&saved_key);
+	return error;
+}
+
+int git_reftable_log_next(git_reftable_log *out, git_reftable_iter *it)
+{
+	uint8_t type;
+	int error;
+
+	assert(out && it);
+
+	if ((error = next_block(it)) < 0)
+		return error;
+
+	if (decode_key(&it->last_key, &type, it) < 0)
+		return -1;
+
+	return read_log(out, it, type);
+}
+
+void git_reftable_iter_free(git_reftable_iter *it)
+{
+	if (!it)
+		return;
+
+	git_buf_free(&it->inflated);
+	git_buf_free(&it->last_key);
+	memset(it, 0, sizeof(git_reftable_iter));
+}
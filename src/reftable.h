@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_reftable_h__
+#define INCLUDE_reftable_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "map.h"
+
+#define GIT_REFTABLE_SIGNATURE "REFT"
+#define GIT_REFTABLE_VERSION 1
+#define GIT_REFTABLE_BLOCK_SIZE 4096
+
+#define GIT_REFTABLE_HEADER_SIZE 24
+#define GIT_REFTABLE_FOOTER_SIZE 68
+
+/* Every this many records, a key is written out in full */
+#define GIT_REFTABLE_RESTART_INTERVAL 16
+
+typedef enum {
+	GIT_REFTABLE_REF_DELETION = 0,
+	GIT_REFTABLE_REF_VAL1 = 1, /* a target */
+	GIT_REFTABLE_REF_VAL2 = 2, /* a target and the object it peels to */
+	GIT_REFTABLE_REF_SYMREF = 3,
+} git_reftable_ref_t;
+
+typedef enum {
+	GIT_REFTABLE_LOG_DELETION = 0,
+	GIT_REFTABLE_LOG_UPDATE = 1,
+} git_reftable_log_t;
+
+typedef struct {
+	git_buf name;
+	uint64_t update_index;
+	git_reftable_ref_t type;
+	git_oid oid;
+	git_oid peel;
+	git_buf target;
+} git_reftable_ref;
+
+typedef struct {
+	git_buf name;
+	uint64_t update_index;
+	git_reftable_log_t type;
+	git_oid old_id;
+	git_oid new_id;
+	git_buf committer_name;
+	git_buf committer_email;
+	git_time_t time;
+	int offset; /* in minutes */
+	git_buf message;
+} git_reftable_log;
+
+#define GIT_REFTABLE_REF_INIT { GIT_BUF_INIT, 0, 0, {{0}}, {{0}}, GIT_BUF_INIT }
+#define GIT_REFTABLE_LOG_INIT \
+	{ GIT_BUF_INIT, 0, 0, {{0}}, {{0}}, GIT_BUF_INIT, GIT_BUF_INIT, 0, 0, GIT_BUF_INIT }
+
+extern void git_reftable_ref_free(git_reftable_ref *ref);
+extern void git_reftable_log_free(git_reftable_log *log);
+
+/*
+ * Log records sort by name, and the most recent update of a reference
+ * comes first.
+ */
+extern int git_reftable_log_cmp(const git_reftable_log *a, const git_reftable_log *b);
+
+/*
+ * Build a table in memory.  References have to be added in name order,
+ * and the log records after them, in the order `git_reftable_log_cmp`
+ * gives them.
+ */
+typedef struct git_reftable_writer git_reftable_writer;
+
+extern int git_reftable_writer_new(
+	git_reftable_writer **out,
+	uint64_t min_update_index,
+	uint64_t max_update_index);
+
+extern int git_reftable_writer_add_ref(
+	git_reftable_writer *w, const git_reftable_ref *ref);
+
+extern int git_reftable_writer_add_log(
+	git_reftable_writer *w, const git_reftable_log *log);
+
+/* Close the table and hand over its contents */
+extern int git_reftable_writer_finish(git_buf *out, git_reftable_writer *w);
+
+extern void git_reftable_writer_free(git_reftable_writer *w);
+
+/* A table read back from disk */
+typedef struct {
+#ifdef GIT_WIN32
+	/* the file goes away after a compaction, so it is not kept open */
+	git_buf contents;
+#else
+	git_map map;
+#endif
+	const unsigned char *data;
+	size_t size;
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	size_t ref_end; /* where the reference blocks stop */
+	size_t log_start; /* where the log blocks start, or 0 */
+	size_t log_end;
+	unsigned int has_logs:1;
+} git_reftable;
+
+extern int git_reftable_open(git_reftable **out, const char *path);
+extern void git_reftable_free(git_reftable *table);
+
+/* An iterator over the references or the log records of one table */
+typedef struct {
+	git_reftable *table;
+	char block_type;
+	size_t block_start;
+	size_t next_block;
+	git_buf inflated; /* the current block, for log blocks */
+	const unsigned char *block;
+	size_t records_end; /* where the restart offsets start */
+	size_t restart_count;
+	size_t pos;
+	git_buf last_key;
+} git_reftable_iter;
+
+#define GIT_REFTABLE_ITER_INIT { NULL, 0, 0, 0, GIT_BUF_INIT, NULL, 0, 0, 0, GIT_BUF_INIT }
+
+/*
+ * Position the iterator on the first reference whose name does not
+ * sort before `name`; the empty string starts at the very beginning.
+ */
+extern int git_reftable_ref_seek(
+	git_reftable_iter *it, git_reftable *table, const char *name);
+
+/* Read the next reference, or return GIT_ITEROVER */
+extern int git_reftable_ref_next(git_reftable_ref *out, git_reftable_iter *it);
+
+/*
+ * Position the iterator on the first log record of `name` (or of the
+ * names after it).
+ */
+extern int git_reftable_log_seek(
+	git_reftable_iter *it, git_reftable *table, const char *name);
+
+/* Read the next log record, or return GIT_ITEROVER */
+extern int git_reftable_log_next(git_reftable_log *out, git_reftable_iter *it);
+
+extern void git_reftable_iter_free(git_reftable_iter *it);
+
+#endif
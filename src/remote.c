@@ -687,6 +687,95 @@ int set_transport_callbacks(git_transport *t, const git_remote_callbacks *cbs)
 				cbs->certificate_check, cbs->payload);
 }
 
+static void free_ref_prefixes(git_vector *prefixes)
+{
+	size_t i;
+	char *prefix;
+
+	git_vector_foreach(prefixes, i, prefix)
+		git__free(prefix);
+
+	git_vector_clear(prefixes);
+}
+
+int git_remote__add_ref_prefix(git_remote *remote, const char *prefix)
+{
+	char *copy;
+	size_t i;
+
+	git_vector_foreach(&remote->ref_prefixes, i, copy) {
+		if (!strcmp(copy, prefix))
+			return 0;
+	}
+
+	copy = git__strdup(prefix);
+	GITERR_CHECK_ALLOC(copy);
+
+	if (git_vector_insert(&remote->ref_prefixes, copy) < 0) {
+		git__free(copy);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Servers speaking protocol v2 only advertise the refs under the
+ * prefixes we give them; derive these from the refspecs we are about
+ * to fetch, expanding short names the way the refspecs are DWIMed.
+ */
+static int set_ref_prefixes(
+	git_remote *remote, git_vector *specs, git_remote_autotag_option_t tagopt)
+{
+	static const char *formats[] = {
+		"%.*s", "refs/%.*s", "refs/tags/%.*s", "refs/heads/%.*s",
+		"refs/remotes/%.*s", "refs/remotes/%.*s/HEAD",
+	};
+	git_buf prefix = GIT_BUF_INIT;
+	git_refspec *spec;
+	const char *star;
+	size_t i, j, len, nformats;
+	int error = 0;
+
+	free_ref_prefixes(&remote->ref_prefixes);
+
+	git_vector_foreach(specs, i, spec) {
+		star = strchr(spec->src, '*');
+		len = star ? (size_t)(star - spec->src) : strlen(spec->src);
+
+		/* a refspec matching everything needs the whole advertisement */
+		if (!len) {
+			free_ref_prefixes(&remote->ref_prefixes);
+			goto done;
+		}
+
+		nformats = (!git__prefixcmp(spec->src, GIT_REFS_DIR) ||
+			!strcmp(spec->src, GIT_HEAD_FILE)) ? 1 : ARRAY_SIZE(formats);
+
+		for (j = 0; j < nformats; j++) {
+			git_buf_clear(&prefix);
+
+			if ((error = git_buf_printf(&prefix, formats[j], (int)len, spec->src)) < 0 ||
+				(error = git_remote__add_ref_prefix(remote, prefix.ptr)) < 0)
+				goto done;
+		}
+	}
+
+	/* we list everything when there is nothing to fetch */
+	if (!remote->ref_prefixes.length)
+		goto done;
+
+	if ((error = git_remote__add_ref_prefix(remote, GIT_HEAD_FILE)) < 0)
+		goto done;
+
+	if (tagopt != GIT_REMOTE_DOWNLOAD_TAGS_NONE)
+		error = git_remote__add_ref_prefix(remote, GIT_REFS_TAGS_DIR);
+
+done:
+	git_buf_free(&prefix);
+	return error;
+}
+
 static int set_transport_custom_headers(git_transport *t, const git_strarray *custom_headers)
 {
 	if (!t->set_custom_headers)
@@ -741,11 +830,15 @@ int git_remote_connect(git_remote *remote, git_direction direction, const git_re
 	    (error = t->connect(t, url, credentials, payload, direction, flags)) != 0)
 		goto on_error;
 
+	/* the prefixes only apply to the connection they were set up for */
+	free_ref_prefixes(&remote->ref_prefixes);
+
 	remote->transport = t;
 
 	return 0;
 
 on_error:
+	free_ref_prefixes(&remote->ref_prefixes);
 	t->free(t);
 
 	if (t == remote->transport)
@@ -896,6 +989,7 @@ int git_remote_download(git_remote *remote, const git_strarray *refspecs, const
 	git_vector *to_active, specs = GIT_VECTOR_INIT, refs = GIT_VECTOR_INIT;
 	const git_remote_callbacks *cbs = NULL;
 	const git_strarray *custom_headers = NULL;
+	git_remote_autotag_option_t tagopt = remote->download_tags;
 
 	assert(remote);
 
@@ -903,14 +997,10 @@ int git_remote_download(git_remote *remote, const git_strarray *refspecs, const
 		GITERR_CHECK_VERSION(&opts->callbacks, GIT_REMOTE_CALLBACKS_VERSION, "git_remote_callbacks");
 		cbs = &opts->callbacks;
 		custom_headers = &opts->custom_headers;
-	}
-
-	if (!git_remote_connected(remote) &&
-	    (error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) < 0)
-		goto on_error;
 
-	if (ls_to_vector(&refs, remote) < 0)
-		return -1;
+		if (opts->download_tags != GIT_REMOTE_DOWNLOAD_TAGS_UNSPECIFIED)
+			tagopt = opts->download_tags;
+	}
 
 	if ((git_vector_init(&specs, 0, NULL)) < 0)
 		goto on_error;
@@ -928,6 +1018,14 @@ int git_remote_download(git_remote *remote, const git_strarray *refspecs, const
 		remote->passed_refspecs = 1;
 	}
 
+	if (!git_remote_connected(remote) &&
+	    ((error = set_ref_prefixes(remote, to_active, tagopt)) < 0 ||
+	     (error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) < 0))
+		goto on_error;
+
+	if ((error = ls_to_vector(&refs, remote)) < 0)
+		goto on_error;
+
 	free_refspecs(&remote->passive_refspecs);
 	if ((error = dwim_refspecs(&remote->passive_refspecs, &remote->refspecs, &refs)) < 0)
 		goto on_error;
@@ -970,20 +1068,15 @@ int git_remote_fetch(
 	bool prune = false;
 	git_buf reflog_msg_buf = GIT_BUF_INIT;
 	const git_remote_callbacks *cbs = NULL;
-	const git_strarray *custom_headers = NULL;
 
 	if (opts) {
 		GITERR_CHECK_VERSION(&opts->callbacks, GIT_REMOTE_CALLBACKS_VERSION, "git_remote_callbacks");
 		cbs = &opts->callbacks;
-		custom_headers = &opts->custom_headers;
 		update_fetchhead = opts->update_fetchhead;
 		tagopt = opts->download_tags;
 	}
 
 	/* Connect and download everything */
-	if ((error = git_remote_connect(remote, GIT_DIRECTION_FETCH, cbs, custom_headers)) != 0)
-		return error;
-
 	error = git_remote_download(remote, refspecs, opts);
 
 	/* We don't need to be connected anymore */
@@ -1175,33 +1268,51 @@ cleanup:
 
 /**
  * Generate a list of candidates for pruning by getting a list of
- * references which match the rhs of an active refspec.
+ * references which match the rhs of an active refspec.  Only the
+ * references under each refspec's destination are looked at.
  */
 static int prune_candidates(git_vector *candidates, git_remote *remote)
 {
-	git_strarray arr = { 0 };
+	git_reference_iterator *iter = NULL;
+	const git_refspec *spec;
+	const char *refname;
+	char *refname_dup;
 	size_t i;
-	int error;
+	int error = 0;
 
-	if ((error = git_reference_list(&arr, remote->repo)) < 0)
-		return error;
+	git_vector_foreach(&remote->active_refspecs, i, spec) {
+		if (spec->push || !spec->dst)
+			continue;
 
-	for (i = 0; i < arr.count; i++) {
-		const char *refname = arr.strings[i];
-		char *refname_dup;
+		if ((error = git_reference_iterator_glob_new(&iter, remote->repo, spec->dst)) < 0)
+			goto out;
 
-		if (!git_remote__matching_dst_refspec(remote, refname))
-			continue;
+		while ((error = git_reference_next_name(&refname, iter)) == 0) {
+			if (!git_remote__matching_dst_refspec(remote, refname))
+				continue;
 
-		refname_dup = git__strdup(refname);
-		GITERR_CHECK_ALLOC(refname_dup);
+			if ((refname_dup = git__strdup(refname)) == NULL ||
+				(error = git_vector_insert(candidates, refname_dup)) < 0) {
+				git__free(refname_dup);
+				error = -1;
+				goto out;
+			}
+		}
 
-		if ((error = git_vector_insert(candidates, refname_dup)) < 0)
+		if (error != GIT_ITEROVER)
 			goto out;
+
+		git_reference_iterator_free(iter);
+		iter = NULL;
+		error = 0;
 	}
 
+	/* refspecs may overlap */
+	git_vector_set_cmp(candidates, git__strcmp_cb);
+	git_vector_uniq(candidates, git__free);
+
 out:
-	git_strarray_free(&arr);
+	git_reference_iterator_free(iter);
 	return error;
 }
 
@@ -1658,7 +1769,13 @@ void git_remote_free(git_remote *remote)
 	free_refspecs(&remote->passive_refspecs);
 	git_vector_free(&remote->passive_refspecs);
 
+	free_ref_prefixes(&remote->ref_prefixes);
+	git_vector_free(&remote->ref_prefixes);
+
 	git_push_free(remote->push);
+	git_array_clear(remote->shallow);
+	git_array_clear(remote->unshallow);
+	git__free(remote->filter);
 	git__free(remote->url);
 	git__free(remote->pushurl);
 	git__free(remote->name);
@@ -2255,7 +2372,10 @@ static int remove_refs(git_repository *repo, const git_refspec *spec)
 	if ((error = git_vector_init(&refs, 8, NULL)) < 0)
 		return error;
 
-	if ((error = git_reference_iterator_new(&iter, repo)) < 0)
+	if (!spec->dst)
+		goto cleanup;
+
+	if ((error = git_reference_iterator_glob_new(&iter, repo, spec->dst)) < 0)
 		goto cleanup;
 
 	while ((error = git_reference_next_name(&name, iter)) == 0) {
@@ -2439,7 +2559,7 @@ int git_remote_upload(git_remote *remote, const git_strarray *refspecs, const gi
 	if ((error = git_push_finish(push, cbs)) < 0)
 		goto cleanup;
 
-	if (cbs && cbs->push_update_reference &&
+	if (cbs && cbs->push_update_reference && !push->status_reported &&
 	    (error = git_push_status_foreach(push, cbs->push_update_reference, cbs->payload)) < 0)
 		goto cleanup;
 
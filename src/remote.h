@@ -13,6 +13,7 @@
 
 #include "refspec.h"
 #include "vector.h"
+#include "oidarray.h"
 
 #define GIT_REMOTE_ORIGIN "origin"
 
@@ -32,11 +33,28 @@ struct git_remote {
 	git_remote_autotag_option_t download_tags;
 	int prune_refs;
 	int passed_refspecs;
+
+	/* shallow parameters of the current fetch, and the updated roots */
+	int depth;
+	git_time_t shallow_since;
+	git_array_oid_t shallow;
+	git_array_oid_t unshallow;
+
+	/* object filter of the current fetch */
+	char *filter;
+
+	/* negotiation algorithm of the current fetch */
+	git_fetch_negotiation_t negotiation;
+
+	/* ref prefixes to limit the advertisement of the next connect to */
+	git_vector ref_prefixes;
 };
 
 const char* git_remote__urlfordirection(struct git_remote *remote, int direction);
 int git_remote__get_http_proxy(git_remote *remote, bool use_ssl, char **proxy_url);
 
+int git_remote__add_ref_prefix(git_remote *remote, const char *prefix);
+
 git_refspec *git_remote__matching_refspec(git_remote *remote, const char *refname);
 git_refspec *git_remote__matching_dst_refspec(git_remote *remote, const char *refname);
 
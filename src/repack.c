@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "array.h"
+#include "fileops.h"
+#include "midx.h"
+#include "mwindow.h"
+#include "odb.h"
+#include "pack.h"
+#include "path.h"
+#include "repository.h"
+#include "vector.h"
+
+#include "git2/odb_backend.h"
+#include "git2/pack.h"
+#include "git2/repack.h"
+#include "git2/sys/odb_backend.h"
+
+typedef struct {
+	struct git_pack_file *pack;
+	size_t count;
+} repack_pack;
+
+typedef struct {
+	git_repack_options opts;
+	git_buf objects_dir;
+	git_buf pack_dir;
+	git_vector packs;
+	git_array_t(git_oid) loose;
+	size_t split;
+} repack_ctx;
+
+static int repack_pack_cmp(const void *a, const void *b)
+{
+	const repack_pack *pa = a, *pb = b;
+
+	if (pa->count != pb->count)
+		return pa->count < pb->count ? -1 : 1;
+
+	return strcmp(pa->pack->pack_name, pb->pack->pack_name);
+}
+
+static int load_pack__cb(void *payload, git_buf *path)
+{
+	repack_ctx *ctx = payload;
+	repack_pack *rp;
+	struct git_pack_file *p;
+	git_buf keep = GIT_BUF_INIT;
+	size_t count;
+	bool kept;
+	int error;
+
+	if (git__suffixcmp(path->ptr, ".idx") != 0)
+		return 0;
+
+	/*
+	 * Packs marked with a .keep file are never rewritten; look at the
+	 * disk, as the flag of an already cached pack may be outdated.
+	 */
+	if (git_buf_put(&keep, path->ptr, git_buf_len(path) - strlen(".idx")) < 0 ||
+		git_buf_puts(&keep, ".keep") < 0) {
+		git_buf_free(&keep);
+		return -1;
+	}
+
+	kept = git_path_exists(keep.ptr);
+	git_buf_free(&keep);
+
+	if (kept)
+		return 0;
+
+	error = git_mwindow_get_pack(&p, path->ptr);
+
+	/* ignore missing .pack file as the pack backend does */
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		return 0;
+	}
+
+	if (error < 0)
+		return error;
+
+	if ((error = git_pack_object_count(&count, p)) < 0) {
+		git_mwindow_put_pack(p);
+		return error;
+	}
+
+	rp = git__malloc(sizeof(repack_pack));
+	if (!rp) {
+		git_mwindow_put_pack(p);
+		return -1;
+	}
+
+	rp->pack = p;
+	rp->count = count;
+
+	if ((error = git_vector_insert(&ctx->packs, rp)) < 0) {
+		git_mwindow_put_pack(p);
+		git__free(rp);
+	}
+
+	return error;
+}
+
+static int load_loose__cb(const git_oid *id, void *payload)
+{
+	repack_ctx *ctx = payload;
+	git_oid *out = git_array_alloc(ctx->loose);
+	GITERR_CHECK_ALLOC(out);
+
+	git_oid_cpy(out, id);
+	return 0;
+}
+
+static int load_loose(repack_ctx *ctx)
+{
+	git_odb_backend *loose;
+	int error;
+
+	if ((error = git_odb_backend_loose(
+			&loose, ctx->objects_dir.ptr, -1, 0, 0, 0)) < 0)
+		return error;
+
+	error = loose->foreach(loose, load_loose__cb, ctx);
+	loose->free(loose);
+
+	return error;
+}
+
+/*
+ * Find how many of the smallest packs have to be rolled up so that
+ * the remaining ones form a geometric progression: walking down from
+ * the largest pack, stop at the first pack which isn't `factor` times
+ * larger than the next smaller one. Everything below it is merged,
+ * and the merged pack then swallows any pack which still isn't
+ * `factor` times larger than the accumulated weight.
+ */
+static size_t geometric_split(git_vector *packs, unsigned int factor)
+{
+	repack_pack *ours, *prev;
+	size_t i, split, total = 0;
+
+	if (packs->length < 2)
+		return 0;
+
+	for (i = packs->length - 1; i > 0; i--) {
+		ours = git_vector_get(packs, i);
+		prev = git_vector_get(packs, i - 1);
+
+		if (ours->count < factor * prev->count)
+			break;
+	}
+
+	/* the top element of the offending pair is not in the progression */
+	split = i ? i + 1 : 0;
+
+	for (i = 0; i < split; i++) {
+		prev = git_vector_get(packs, i);
+		total += prev->count;
+	}
+
+	for (i = split; i < packs->length; i++) {
+		ours = git_vector_get(packs, i);
+
+		if (ours->count >= factor * total)
+			break;
+
+		total += ours->count;
+		split++;
+	}
+
+	return split;
+}
+
+static int insert_object__cb(const git_oid *id, void *payload)
+{
+	git_packbuilder *pb = payload;
+	return git_packbuilder_insert(pb, id, NULL);
+}
+
+static int write_pack(git_repository *repo, repack_ctx *ctx, git_oid *out)
+{
+	git_packbuilder *pb;
+	repack_pack *rp;
+	size_t i;
+	int error;
+
+	if ((error = git_packbuilder_new(&pb, repo)) < 0)
+		return error;
+
+	for (i = 0; i < ctx->split; i++) {
+		rp = git_vector_get(&ctx->packs, i);
+
+		if ((error = git_pack_foreach_entry(rp->pack, insert_object__cb, pb)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < git_array_size(ctx->loose); i++) {
+		if ((error = git_packbuilder_insert(
+				pb, git_array_get(ctx->loose, i), NULL)) < 0)
+			goto done;
+	}
+
+	if ((error = git_packbuilder_write(pb, ctx->pack_dir.ptr, 0,
+			ctx->opts.progress_cb, ctx->opts.progress_payload)) < 0)
+		goto done;
+
+	git_oid_cpy(out, git_packbuilder_hash(pb));
+
+done:
+	git_packbuilder_free(pb);
+	return error;
+}
+
+static int remove_pack(struct git_pack_file *p)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t root_len = strlen(p->pack_name) - strlen(".pack");
+	int error;
+
+	/* remove the index first so nobody picks up a half-deleted pack */
+	if ((error = git_buf_put(&path, p->pack_name, root_len)) < 0 ||
+		(error = git_buf_puts(&path, ".idx")) < 0)
+		goto done;
+
+	if ((error = p_unlink(path.ptr)) < 0 && errno != ENOENT)
+		goto on_error;
+
+	if ((error = p_unlink(p->pack_name)) < 0 && errno != ENOENT) {
+		git_buf_sets(&path, p->pack_name);
+		goto on_error;
+	}
+
+	error = 0;
+	goto done;
+
+on_error:
+	giterr_set(GITERR_OS, "failed to remove pack file '%s'", path.ptr);
+	error = -1;
+
+done:
+	git_buf_free(&path);
+	return error;
+}
+
+static int remove_loose(repack_ctx *ctx)
+{
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ];
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < git_array_size(ctx->loose); i++) {
+		git_oid_fmt(hex, git_array_get(ctx->loose, i));
+
+		git_buf_clear(&path);
+		git_buf_printf(&path, "%s%.2s/%.38s", ctx->objects_dir.ptr, hex, hex + 2);
+
+		if (git_buf_oom(&path)) {
+			error = -1;
+			break;
+		}
+
+		if (p_unlink(path.ptr) < 0 && errno != ENOENT) {
+			giterr_set(GITERR_OS,
+				"failed to remove loose object '%s'", path.ptr);
+			error = -1;
+			break;
+		}
+
+		/* drop the fanout directory once it is empty */
+		git_buf_truncate(&path, git_buf_len(&path) - (GIT_OID_HEXSZ - 2) - 1);
+		(void)p_rmdir(path.ptr);
+	}
+
+	git_buf_free(&path);
+	return error;
+}
+
+int git_repack_init_options(git_repack_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_repack_options, GIT_REPACK_OPTIONS_INIT);
+	return 0;
+}
+
+int git_repack(git_repository *repo, const git_repack_options *given)
+{
+	repack_ctx ctx = {{0}};
+	repack_pack *rp;
+	git_odb *odb;
+	git_oid pack_id;
+	git_buf midx_path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	bool rewrite = false;
+	size_t i;
+	int error;
+
+	assert(repo);
+
+	GITERR_CHECK_VERSION(given, GIT_REPACK_OPTIONS_VERSION, "git_repack_options");
+
+	if (given)
+		memcpy(&ctx.opts, given, sizeof(ctx.opts));
+	else
+		git_repack_init_options(&ctx.opts, GIT_REPACK_OPTIONS_VERSION);
+
+	if (!ctx.opts.factor)
+		ctx.opts.factor = GIT_REPACK_DEFAULT_FACTOR;
+
+	if ((error = git_repository_odb__weakptr(&odb, repo)) < 0 ||
+		(error = git_vector_init(&ctx.packs, 8, repack_pack_cmp)) < 0 ||
+		(error = git_buf_joinpath(&ctx.objects_dir,
+			repo->path_repository, GIT_OBJECTS_DIR)) < 0 ||
+		(error = git_buf_joinpath(&ctx.pack_dir, ctx.objects_dir.ptr, "pack")) < 0)
+		goto done;
+
+	if (git_path_isdir(ctx.pack_dir.ptr) &&
+		(error = git_path_direach(&ctx.pack_dir, 0, load_pack__cb, &ctx)) < 0)
+		goto done;
+
+	if ((ctx.opts.flags & GIT_REPACK_LOOSE) && (error = load_loose(&ctx)) < 0)
+		goto done;
+
+	git_vector_sort(&ctx.packs);
+	ctx.split = geometric_split(&ctx.packs, ctx.opts.factor);
+
+	/* a single pack on its own would only be rewritten as it is */
+	if (ctx.split == 1 && !git_array_size(ctx.loose))
+		ctx.split = 0;
+
+	rewrite = ctx.split > 0 || git_array_size(ctx.loose) > 0;
+
+	if (rewrite) {
+		if ((error = git_futils_mkdir(ctx.pack_dir.ptr,
+				GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH)) < 0 ||
+			(error = write_pack(repo, &ctx, &pack_id)) < 0)
+			goto done;
+
+		git_oid_tostr(hex, sizeof(hex), &pack_id);
+
+		for (i = 0; i < ctx.split; i++) {
+			rp = git_vector_get(&ctx.packs, i);
+
+			/* the merged pack may be identical to one of its sources */
+			if (strstr(rp->pack->pack_name, hex) != NULL)
+				continue;
+
+			if ((error = remove_pack(rp->pack)) < 0)
+				goto done;
+		}
+
+		if ((error = remove_loose(&ctx)) < 0)
+			goto done;
+	}
+
+	if ((error = git_buf_joinpath(&midx_path, ctx.pack_dir.ptr, GIT_MIDX_FILE)) < 0)
+		goto done;
+
+	if (ctx.opts.flags & GIT_REPACK_WRITE_MIDX)
+		error = git_midx_write(ctx.pack_dir.ptr);
+	else if (rewrite && git_path_exists(midx_path.ptr) &&
+		p_unlink(midx_path.ptr) < 0) {
+		/* an existing multi-pack-index would name the removed packs */
+		giterr_set(GITERR_OS, "failed to remove '%s'", midx_path.ptr);
+		error = -1;
+	}
+
+	if (!error && rewrite)
+		error = git_odb_refresh(odb);
+
+done:
+	git_vector_foreach(&ctx.packs, i, rp) {
+		git_mwindow_put_pack(rp->pack);
+		git__free(rp);
+	}
+
+	git_vector_free(&ctx.packs);
+	git_array_clear(ctx.loose);
+	git_buf_free(&ctx.objects_dir);
+	git_buf_free(&ctx.pack_dir);
+	git_buf_free(&midx_path);
+	return error;
+}
@@ -40,6 +40,15 @@ static int check_repositoryformatversion(git_config *config);
 
 #define GIT_REPO_VERSION 0
 
+/* Version 1 repositories may only use the extensions we know about */
+#define GIT_REPO_MAX_VERSION 1
+
+static const char *repo_known_extensions[] = {
+	"noop",
+	"partialclone",
+	"refstorage",
+};
+
 git_buf git_repository__reserved_names_win32[] = {
 	{ DOT_GIT, 0, CONST_STRLEN(DOT_GIT) },
 	{ GIT_DIR_SHORTNAME, 0, CONST_STRLEN(GIT_DIR_SHORTNAME) }
@@ -736,6 +745,12 @@ int git_repository_odb__weakptr(git_odb **out, git_repository *repo)
 			return error;
 
 		error = git_odb_open(&odb, odb_path.ptr);
+
+		if (!error &&
+			((error = git_odb__load_config(odb, repo)) < 0 ||
+			 (error = git_odb__load_promisors(odb, repo)) < 0))
+			git_odb_free(odb);
+
 		if (!error) {
 			GIT_REFCOUNT_OWN(odb, repo);
 
@@ -975,6 +990,22 @@ bool git_repository__reserved_names(
 }
 #endif
 
+static int check_extension(const git_config_entry *entry, void *payload)
+{
+	const char *name = entry->name + strlen("extensions.");
+	size_t i;
+
+	GIT_UNUSED(payload);
+
+	for (i = 0; i < ARRAY_SIZE(repo_known_extensions); i++)
+		if (!strcasecmp(name, repo_known_extensions[i]))
+			return 0;
+
+	giterr_set(GITERR_REPOSITORY,
+		"Unsupported repository extension '%s'", name);
+	return -1;
+}
+
 static int check_repositoryformatversion(git_config *config)
 {
 	int version, error;
@@ -987,13 +1018,17 @@ static int check_repositoryformatversion(git_config *config)
 	if (error < 0)
 		return -1;
 
-	if (GIT_REPO_VERSION < version) {
+	if (GIT_REPO_MAX_VERSION < version) {
 		giterr_set(GITERR_REPOSITORY,
 			"Unsupported repository version %d. Only versions up to %d are supported.",
-			version, GIT_REPO_VERSION);
+			version, GIT_REPO_MAX_VERSION);
 		return -1;
 	}
 
+	if (GIT_REPO_VERSION < version)
+		return git_config_foreach_match(
+			config, "^extensions\\.", check_extension, NULL);
+
 	return 0;
 }
 
@@ -11,6 +11,7 @@
 #include "buffer.h"
 #include "tree.h"
 #include "refdb.h"
+#include "reflog.h"
 
 #include "git2.h"
 
@@ -137,20 +138,29 @@ static int try_parse_numeric(int *n, const char *curly_braces_content)
 	return 0;
 }
 
+/*
+ * The lookups below only need the most recent part of a reflog; start with
+ * this many entries and read further back only when they are not enough.
+ */
+#define REFLOG_RECENT_MIN 16
+
+static size_t reflog_read_further(size_t count)
+{
+	return (count > SIZE_MAX / 2) ? SIZE_MAX : count * 2;
+}
+
 static int retrieve_previously_checked_out_branch_or_revision(git_object **out, git_reference **base_ref, git_repository *repo, const char *identifier, size_t position)
 {
 	git_reference *ref = NULL;
 	git_reflog *reflog = NULL;
 	regex_t preg;
 	int error = -1;
-	size_t i, numentries, cur;
+	size_t i, numentries, cur, count;
 	const git_reflog_entry *entry;
 	const char *msg;
 	regmatch_t regexmatches[2];
 	git_buf buf = GIT_BUF_INIT;
 
-	cur = position;
-
 	if (*identifier != '\0' || *base_ref != NULL)
 		return GIT_EINVALIDSPEC;
 
@@ -160,36 +170,45 @@ static int retrieve_previously_checked_out_branch_or_revision(git_object **out,
 	if (git_reference_lookup(&ref, repo, GIT_HEAD_FILE) < 0)
 		goto cleanup;
 
-	if (git_reflog_read(&reflog, repo, GIT_HEAD_FILE) < 0)
-		goto cleanup;
+	for (count = REFLOG_RECENT_MIN; ; count = reflog_read_further(count)) {
+		git_reflog_free(reflog);
+		reflog = NULL;
 
-	numentries  = git_reflog_entrycount(reflog);
+		if (git_reflog__read_recent(&reflog, repo, GIT_HEAD_FILE, count) < 0)
+			goto cleanup;
 
-	for (i = 0; i < numentries; i++) {
-		entry = git_reflog_entry_byindex(reflog, i);
-		msg = git_reflog_entry_message(entry);
-		if (!msg)
-			continue;
+		numentries = git_reflog_entrycount(reflog);
+		cur = position;
+
+		for (i = 0; i < numentries; i++) {
+			entry = git_reflog_entry_byindex(reflog, i);
+			msg = git_reflog_entry_message(entry);
+			if (!msg)
+				continue;
 
-		if (regexec(&preg, msg, 2, regexmatches, 0))
-			continue;
+			if (regexec(&preg, msg, 2, regexmatches, 0))
+				continue;
 
-		cur--;
+			cur--;
 
-		if (cur > 0)
-			continue;
+			if (cur > 0)
+				continue;
 
-		git_buf_put(&buf, msg+regexmatches[1].rm_so, regexmatches[1].rm_eo - regexmatches[1].rm_so);
+			git_buf_put(&buf, msg+regexmatches[1].rm_so, regexmatches[1].rm_eo - regexmatches[1].rm_so);
 
-		if ((error = git_reference_dwim(base_ref, repo, git_buf_cstr(&buf))) == 0)
-			goto cleanup;
+			if ((error = git_reference_dwim(base_ref, repo, git_buf_cstr(&buf))) == 0)
+				goto cleanup;
 
-		if (error < 0 && error != GIT_ENOTFOUND)
-			goto cleanup;
+			if (error < 0 && error != GIT_ENOTFOUND)
+				goto cleanup;
 
-		error = maybe_abbrev(out, repo, git_buf_cstr(&buf));
+			error = maybe_abbrev(out, repo, git_buf_cstr(&buf));
 
-		goto cleanup;
+			goto cleanup;
+		}
+
+		if (!git_reflog__truncated(reflog))
+			break;
 	}
 
 	error = GIT_ENOTFOUND;
@@ -204,39 +223,54 @@ cleanup:
 
 static int retrieve_oid_from_reflog(git_oid *oid, git_reference *ref, size_t identifier)
 {
-	git_reflog *reflog;
+	git_reflog *reflog = NULL;
 	size_t numentries;
 	const git_reflog_entry *entry;
 	bool search_by_pos = (identifier <= 100000000);
 
-	if (git_reflog_read(&reflog, git_reference_owner(ref), git_reference_name(ref)) < 0)
-		return -1;
+	if (search_by_pos) {
+		if (git_reflog__read_recent(&reflog, git_reference_owner(ref),
+				git_reference_name(ref), identifier + 1) < 0)
+			return -1;
 
-	numentries = git_reflog_entrycount(reflog);
+		numentries = git_reflog_entrycount(reflog);
 
-	if (search_by_pos) {
 		if (numentries < identifier + 1)
 			goto notfound;
 
 		entry = git_reflog_entry_byindex(reflog, identifier);
 		git_oid_cpy(oid, git_reflog_entry_id_new(entry));
 	} else {
-		size_t i;
+		size_t i, count;
 		git_time commit_time;
 
-		for (i = 0; i < numentries; i++) {
-			entry = git_reflog_entry_byindex(reflog, i);
-			commit_time = git_reflog_entry_committer(entry)->when;
+		for (count = REFLOG_RECENT_MIN; ; count = reflog_read_further(count)) {
+			git_reflog_free(reflog);
+			reflog = NULL;
 
-			if (commit_time.time > (git_time_t)identifier)
-				continue;
+			if (git_reflog__read_recent(&reflog, git_reference_owner(ref),
+					git_reference_name(ref), count) < 0)
+				return -1;
 
-			git_oid_cpy(oid, git_reflog_entry_id_new(entry));
-			break;
-		}
+			numentries = git_reflog_entrycount(reflog);
 
-		if (i == numentries)
-			goto notfound;
+			for (i = 0; i < numentries; i++) {
+				entry = git_reflog_entry_byindex(reflog, i);
+				commit_time = git_reflog_entry_committer(entry)->when;
+
+				if (commit_time.time > (git_time_t)identifier)
+					continue;
+
+				git_oid_cpy(oid, git_reflog_entry_id_new(entry));
+				break;
+			}
+
+			if (i < numentries)
+				break;
+
+			if (!git_reflog__truncated(reflog))
+				goto notfound;
+		}
 	}
 
 	git_reflog_free(reflog);
@@ -11,34 +11,125 @@
 #include "pool.h"
 
 #include "revwalk.h"
+#include "repository.h"
+#include "shallow.h"
+#include "tree.h"
 #include "git2/revparse.h"
 #include "merge.h"
 
 GIT__USE_OIDMAP
 
-git_commit_list_node *git_revwalk__commit_lookup(
-	git_revwalk *walk, const git_oid *oid)
+/* The number plus one of the commit at `graph_pos`, if the walk has it */
+static uint32_t *graph_id(git_revwalk *walk, size_t graph_pos, bool alloc)
+{
+	uint32_t **page;
+
+	if (!walk->graph_pages) {
+		if (!alloc)
+			return NULL;
+
+		walk->graph_pages = git__calloc(
+			(walk->graph->num_commits >> GRAPH_PAGE_BITS) + 1, sizeof(uint32_t *));
+		if (walk->graph_pages == NULL)
+			return NULL;
+	}
+
+	page = &walk->graph_pages[graph_pos >> GRAPH_PAGE_BITS];
+
+	if (*page == NULL &&
+		(!alloc || (*page = git__calloc(GRAPH_PAGE_SIZE, sizeof(uint32_t))) == NULL))
+		return NULL;
+
+	return &(*page)[graph_pos & (GRAPH_PAGE_SIZE - 1)];
+}
+
+git_commit_list_node *git_revwalk__graph_commit_lookup(
+	git_revwalk *walk, size_t graph_pos)
 {
 	git_commit_list_node *commit;
-	khiter_t pos;
-	int ret;
+	uint32_t *id;
 
-	/* lookup and reserve space if not already present */
-	pos = kh_get(oid, walk->commits, oid);
-	if (pos != kh_end(walk->commits))
-		return kh_value(walk->commits, pos);
+	assert(walk->graph && graph_pos < walk->graph->num_commits);
+
+	if ((id = graph_id(walk, graph_pos, true)) == NULL)
+		return NULL;
+
+	if (*id)
+		return git_commit_store_get(&walk->store, *id - 1);
 
 	commit = git_commit_list_alloc_node(walk);
 	if (commit == NULL)
 		return NULL;
 
-	git_oid_cpy(&commit->oid, oid);
+	git_commit_graph_id(&commit->oid, walk->graph, graph_pos);
+	commit->graph_pos = (uint32_t)graph_pos;
+	commit->in_graph = 1;
+
+	*id = commit->id + 1;
+	return commit;
+}
+
+/* Remember the commit by its id, so looking it up again takes one probe */
+static int commit_map(git_revwalk *walk, git_commit_list_node *commit)
+{
+	khiter_t pos;
+	int ret;
 
 	pos = kh_put(oid, walk->commits, &commit->oid, &ret);
-	assert(ret != 0);
+	if (ret < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
 	kh_value(walk->commits, pos) = commit;
+	return 0;
+}
 
-	return commit;
+/* Find a commit the walk has already seen, without adding it */
+static git_commit_list_node *commit_find(git_revwalk *walk, const git_oid *oid)
+{
+	khiter_t pos;
+	size_t graph_pos;
+	uint32_t *id;
+
+	pos = kh_get(oid, walk->commits, oid);
+	if (pos != kh_end(walk->commits))
+		return kh_value(walk->commits, pos);
+
+	if (walk->graph && git_commit_graph_find(&graph_pos, walk->graph, oid) == 0 &&
+		(id = graph_id(walk, graph_pos, false)) != NULL && *id)
+		return git_commit_store_get(&walk->store, *id - 1);
+
+	return NULL;
+}
+
+git_commit_list_node *git_revwalk__commit_lookup(
+	git_revwalk *walk, const git_oid *oid)
+{
+	git_commit_list_node *commit;
+	khiter_t pos;
+	size_t graph_pos;
+
+	pos = kh_get(oid, walk->commits, oid);
+	if (pos != kh_end(walk->commits))
+		return kh_value(walk->commits, pos);
+
+	/*
+	 * The commits of the commit-graph are kept by their position; the
+	 * parents of those are found that way, without their id. Once one
+	 * has been looked for by its id, it's in the map like any other.
+	 */
+	if (walk->graph && git_commit_graph_find(&graph_pos, walk->graph, oid) == 0) {
+		if ((commit = git_revwalk__graph_commit_lookup(walk, graph_pos)) == NULL)
+			return NULL;
+	} else {
+		if ((commit = git_commit_list_alloc_node(walk)) == NULL)
+			return NULL;
+
+		git_oid_cpy(&commit->oid, oid);
+	}
+
+	return commit_map(walk, commit) < 0 ? NULL : commit;
 }
 
 typedef git_array_t(git_commit_list_node*) commit_list_node_array;
@@ -76,12 +167,16 @@ static int mark_uninteresting(git_revwalk *walk, git_commit_list_node *commit)
 		if ((error = git_commit_list_parse(walk, commit)) < 0)
 			return error;
 
-		for (i = 0; i < commit->out_degree; ++i)
-			if (!commit->parents[i]->uninteresting) {
+		for (i = 0; i < commit->out_degree; ++i) {
+			git_commit_list_node *parent =
+				git_commit_store_parent(&walk->store, commit, i);
+
+			if (!parent->uninteresting) {
 				git_commit_list_node **node = git_array_alloc(pending);
 				GITERR_CHECK_ALLOC(node);
-				*node = commit->parents[i];
+				*node = parent;
 			}
+		}
 
 		tmp = git_array_pop(pending);
 		commit = tmp ? *tmp : NULL;
@@ -93,6 +188,287 @@ static int mark_uninteresting(git_revwalk *walk, git_commit_list_node *commit)
 	return 0;
 }
 
+typedef struct {
+	/* keys of the path and of its leading directories */
+	git_bloom_key *keys;
+	size_t nkeys;
+	char path[GIT_FLEX_ARRAY];
+} revwalk_path;
+
+static void revwalk_paths_free(git_revwalk *walk)
+{
+	revwalk_path *path;
+	size_t i;
+
+	git_vector_foreach(&walk->paths, i, path) {
+		git__free(path->keys);
+		git__free(path);
+	}
+
+	git_vector_free(&walk->paths);
+}
+
+/*
+ * A missing or unreadable commit-graph only makes the walk slower, so
+ * it is not an error. The graph is not used in shallow repositories,
+ * where it would know the parents which are cut off.
+ */
+static int revwalk_load_graph(git_revwalk *walk)
+{
+	git_buf objects_dir = GIT_BUF_INIT;
+	int error;
+
+	if (git_array_size(walk->shallow))
+		return 0;
+
+	if ((error = git_buf_joinpath(&objects_dir,
+			walk->repo->path_repository, GIT_OBJECTS_DIR)) < 0)
+		return error;
+
+	if (git_commit_graph_open(&walk->graph, objects_dir.ptr) < 0)
+		giterr_clear();
+
+	git_buf_free(&objects_dir);
+	return 0;
+}
+
+/* The keys depend on the version of the filters in the commit-graph */
+static int revwalk_path_keys(git_revwalk *walk, revwalk_path *path)
+{
+	const char *slash;
+	size_t i;
+
+	for (path->nkeys = 1, slash = path->path; *slash; slash++)
+		path->nkeys += (*slash == '/');
+
+	path->keys = git__calloc(path->nkeys, sizeof(git_bloom_key));
+	GITERR_CHECK_ALLOC(path->keys);
+
+	for (i = 0, slash = path->path; i < path->nkeys; i++, slash++) {
+		slash = strchr(slash, '/');
+
+		git_bloom_key_init(&path->keys[i], path->path,
+			slash ? (size_t)(slash - path->path) : strlen(path->path),
+			walk->graph->bloom_version);
+
+		if (!slash)
+			break;
+	}
+
+	return 0;
+}
+
+/*
+ * Whether the filters of the commit-graph tell the commit at `pos`
+ * certainly did not change any of the paths compared to its first
+ * parent.
+ */
+static bool bloom_proves_treesame(git_revwalk *walk, size_t pos)
+{
+	revwalk_path *path;
+	size_t i, j;
+	int found;
+
+	git_vector_foreach(&walk->paths, i, path) {
+		found = 1;
+
+		/* the path is only changed if all its leading directories are */
+		for (j = 0; j < path->nkeys && found == 1; j++)
+			found = git_commit_graph_bloom_maybe_changed(
+				walk->graph, pos, &path->keys[j]);
+
+		if (found != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static int commit_tree_id(
+	git_oid *out, git_revwalk *walk, const git_commit_list_node *node)
+{
+	git_commit_graph_entry entry;
+	git_commit *commit;
+
+	if (node->in_graph &&
+		git_commit_graph_entry_get(&entry, walk->graph, node->graph_pos) == 0) {
+		git_oid_cpy(out, &entry.tree_id);
+		return 0;
+	}
+
+	if (git_commit_lookup(&commit, walk->repo, &node->oid) < 0)
+		return -1;
+
+	git_oid_cpy(out, git_commit_tree_id(commit));
+	git_commit_free(commit);
+	return 0;
+}
+
+static int tree_entry_bypath(
+	git_tree_entry **out, git_tree *tree, const char *path)
+{
+	int error;
+
+	*out = NULL;
+
+	if (!tree)
+		return 0;
+
+	if ((error = git_tree_entry_bypath(out, tree, path)) == GIT_ENOTFOUND) {
+		giterr_clear();
+		error = 0;
+	}
+
+	return error;
+}
+
+static bool tree_entry_is_tree(const git_tree_entry *entry)
+{
+	return entry && git_tree_entry_type(entry) == GIT_OBJ_TREE;
+}
+
+/*
+ * Whether a path differs between two trees, either of which may be NULL.
+ * The leading directories of the path are compared first, so the deeper
+ * trees are only loaded while their ids differ.
+ */
+static int path_differs(
+	git_tree *new_tree, git_tree *old_tree, const char *path, git_buf *prefix)
+{
+	git_tree_entry *new_entry = NULL, *old_entry = NULL;
+	const char *slash = path;
+	int error = 0, differ = -1;
+
+	while (differ < 0) {
+		slash = strchr(slash, '/');
+
+		if ((error = git_buf_set(prefix, path,
+				slash ? (size_t)(slash - path) : strlen(path))) < 0 ||
+			(error = tree_entry_bypath(&new_entry, new_tree, prefix->ptr)) < 0 ||
+			(error = tree_entry_bypath(&old_entry, old_tree, prefix->ptr)) < 0)
+			break;
+
+		if (!new_entry && !old_entry)
+			differ = 0;
+		else if (new_entry && old_entry &&
+			git_oid_equal(&new_entry->oid, &old_entry->oid) &&
+			new_entry->attr == old_entry->attr)
+			differ = 0;
+		else if (!slash)
+			differ = 1;
+		else if (!tree_entry_is_tree(new_entry) && !tree_entry_is_tree(old_entry))
+			differ = 0; /* neither side can have the rest of the path */
+		else
+			slash++;
+
+		git_tree_entry_free(new_entry);
+		git_tree_entry_free(old_entry);
+		new_entry = old_entry = NULL;
+	}
+
+	return error < 0 ? error : differ;
+}
+
+static int paths_differ(git_revwalk *walk, git_tree *new_tree, git_tree *old_tree)
+{
+	git_buf prefix = GIT_BUF_INIT;
+	revwalk_path *path;
+	size_t i;
+	int differ = 0;
+
+	git_vector_foreach(&walk->paths, i, path) {
+		if ((differ = path_differs(new_tree, old_tree, path->path, &prefix)) != 0)
+			break;
+	}
+
+	git_buf_free(&prefix);
+	return differ;
+}
+
+/*
+ * Find out whether the commit has the same content at the paths as one
+ * of its parents (it is TREESAME to that parent). Such a commit is not
+ * returned by a path-limited walk and, when simplifying the history,
+ * only that parent is walked further.
+ */
+static int simplify_commit(git_revwalk *walk, git_commit_list_node *commit)
+{
+	git_tree *tree = NULL, *parent_tree = NULL;
+	git_oid tree_id, parent_tree_id;
+	unsigned short i = 0, parents = commit->out_degree;
+	int error = 0, differ = 1;
+
+	if (commit->treesame_checked)
+		return 0;
+
+	if (walk->first_parent && parents > 1)
+		parents = 1;
+
+	if (parents && commit->in_graph &&
+		bloom_proves_treesame(walk, commit->graph_pos)) {
+		differ = 0;
+		goto done;
+	}
+
+	if ((error = commit_tree_id(&tree_id, walk, commit)) < 0 ||
+		(error = git_tree_lookup(&tree, walk->repo, &tree_id)) < 0)
+		goto done;
+
+	if (!parents && (error = differ = paths_differ(walk, tree, NULL)) < 0)
+		goto done;
+
+	for (i = 0; i < parents && differ; i++) {
+		if ((error = commit_tree_id(&parent_tree_id,
+				walk, git_commit_store_parent(&walk->store, commit, i))) < 0)
+			goto done;
+
+		if (git_oid_equal(&tree_id, &parent_tree_id)) {
+			differ = 0;
+			break;
+		}
+
+		if ((error = git_tree_lookup(&parent_tree, walk->repo, &parent_tree_id)) < 0 ||
+			(error = differ = paths_differ(walk, tree, parent_tree)) < 0)
+			goto done;
+
+		git_tree_free(parent_tree);
+		parent_tree = NULL;
+
+		if (!differ)
+			break;
+	}
+
+	error = 0;
+
+done:
+	if (!error) {
+		commit->treesame_checked = 1;
+		commit->treesame = !differ;
+		commit->treesame_parent = differ ? 0 : i;
+	}
+
+	git_tree_free(tree);
+	git_tree_free(parent_tree);
+	return error;
+}
+
+/* The range of the parents of a commit which the walk goes through */
+static unsigned short walk_parents(
+	git_revwalk *walk, git_commit_list_node *commit, unsigned short *first)
+{
+	*first = 0;
+
+	if (!commit->out_degree)
+		return 0;
+
+	if (walk->simplify_history && commit->treesame) {
+		*first = (unsigned short)commit->treesame_parent;
+		return 1;
+	}
+
+	return walk->first_parent ? 1 : commit->out_degree;
+}
+
 static int process_commit(git_revwalk *walk, git_commit_list_node *commit, int hide)
 {
 	int error;
@@ -119,15 +495,18 @@ static int process_commit(git_revwalk *walk, git_commit_list_node *commit, int h
 
 static int process_commit_parents(git_revwalk *walk, git_commit_list_node *commit)
 {
-	unsigned short i, max;
+	unsigned short i, first, max;
 	int error = 0;
 
-	max = commit->out_degree;
-	if (walk->first_parent && commit->out_degree)
-		max = 1;
+	if (walk->simplify_history && walk->paths.length &&
+		(error = simplify_commit(walk, commit)) < 0)
+		return error;
+
+	max = walk_parents(walk, commit, &first);
 
-	for (i = 0; i < max && !error; ++i)
-		error = process_commit(walk, commit->parents[i], commit->uninteresting);
+	for (i = first; i < first + max && !error; ++i)
+		error = process_commit(walk,
+			git_commit_store_parent(&walk->store, commit, i), commit->uninteresting);
 
 	return error;
 }
@@ -356,36 +735,198 @@ static int revwalk_next_unsorted(git_commit_list_node **object_out, git_revwalk
 	return GIT_ITEROVER;
 }
 
+/*
+ * Topological sorting is incremental, the way git does it: a commit is
+ * returned once all its children have been, so the walk only has to
+ * count the children of the commits down to the generation of the next
+ * one it returns. A commit has a higher generation than its parents,
+ * so with the generation numbers of a commit-graph only a bounded part
+ * of the history is explored ahead of the commits returned. Without
+ * them every commit is of the same (infinite) generation and the whole
+ * history is counted first.
+ */
+
+static int topo_enqueue(git_revwalk *walk, git_commit_list_node *commit)
+{
+	/* the delay flag marks the commits already queued */
+	commit->topo_delay = 1;
+
+	if (walk->sorting & GIT_SORT_TIME)
+		return git_pqueue_insert(&walk->iterator_time, commit);
+
+	return git_commit_list_insert(commit, &walk->iterator_topo) ? 0 : -1;
+}
+
+/* Explore the history down to a generation, passing on hidden commits */
+static int topo_explore_to_depth(git_revwalk *walk, uint32_t generation)
+{
+	git_commit_list_node *commit, *parent;
+	unsigned short i;
+	int error;
+
+	while ((commit = git_pqueue_get(&walk->topo_explore, 0)) != NULL &&
+		commit->generation >= generation) {
+		git_pqueue_pop(&walk->topo_explore);
+
+		for (i = 0; i < commit->out_degree; i++) {
+			parent = git_commit_store_parent(&walk->store, commit, i);
+
+			if ((error = git_commit_list_parse(walk, parent)) < 0)
+				return error;
+
+			if (parent->topo_explored) {
+				/* its parents were queued before it was hidden */
+				if (commit->uninteresting && !parent->uninteresting &&
+					(error = mark_uninteresting(walk, parent)) < 0)
+					return error;
+
+				continue;
+			}
+
+			if (commit->uninteresting)
+				parent->uninteresting = 1;
+			else if (walk->hide_cb &&
+				walk->hide_cb(&parent->oid, walk->hide_cb_payload) &&
+				(error = mark_uninteresting(walk, parent)) < 0)
+				return error;
+
+			parent->topo_explored = 1;
+
+			if ((error = git_pqueue_insert(&walk->topo_explore, parent)) < 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+/* Count the children of the commits down to a generation */
+static int topo_count_to_depth(git_revwalk *walk, uint32_t generation)
+{
+	git_commit_list_node *commit, *parent;
+	unsigned short i, first, max;
+	int error;
+
+	while ((commit = git_pqueue_get(&walk->topo_indegree, 0)) != NULL &&
+		commit->generation >= generation) {
+		git_pqueue_pop(&walk->topo_indegree);
+
+		if ((error = topo_explore_to_depth(walk, commit->generation)) < 0)
+			return error;
+
+		if (commit->uninteresting)
+			continue;
+
+		if (walk->simplify_history && walk->paths.length &&
+			(error = simplify_commit(walk, commit)) < 0)
+			return error;
+
+		max = walk_parents(walk, commit, &first);
+
+		for (i = first; i < first + max; ++i) {
+			parent = git_commit_store_parent(&walk->store, commit, i);
+			parent->in_degree++;
+
+			if (parent->topo_counted)
+				continue;
+
+			parent->topo_counted = 1;
+
+			if ((error = git_pqueue_insert(&walk->topo_indegree, parent)) < 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+static int topo_walk_init(git_revwalk *walk)
+{
+	git_commit_list *list;
+	git_commit_list_node *commit;
+	uint32_t generation = GIT_COMMIT_GRAPH_GENERATION_INFINITY;
+	int error;
+
+	/* the pushed commits were queued for the other sorting modes */
+	git_pqueue_clear(&walk->iterator_time);
+	git_commit_list_free(&walk->iterator_rand);
+
+	for (list = walk->user_input; list; list = list->next) {
+		commit = list->item;
+
+		if ((error = git_commit_list_parse(walk, commit)) < 0)
+			return error;
+
+		if (!commit->topo_explored) {
+			commit->topo_explored = 1;
+
+			if ((error = git_pqueue_insert(&walk->topo_explore, commit)) < 0)
+				return error;
+		}
+
+		if (!commit->topo_counted) {
+			commit->topo_counted = 1;
+
+			if ((error = git_pqueue_insert(&walk->topo_indegree, commit)) < 0)
+				return error;
+		}
+
+		if (!commit->uninteresting && commit->generation < generation)
+			generation = commit->generation;
+	}
+
+	walk->topo_generation = generation;
+
+	if ((error = topo_count_to_depth(walk, generation)) < 0)
+		return error;
+
+	for (list = walk->user_input; list; list = list->next) {
+		commit = list->item;
+
+		if (!commit->uninteresting && !commit->in_degree && !commit->topo_delay &&
+			(error = topo_enqueue(walk, commit)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
 static int revwalk_next_toposort(git_commit_list_node **object_out, git_revwalk *walk)
 {
-	git_commit_list_node *next;
-	unsigned short i, max;
+	git_commit_list_node *next, *parent;
+	unsigned short i, first, max;
+	int error;
 
 	for (;;) {
-		next = git_commit_list_pop(&walk->iterator_topo);
+		if (walk->sorting & GIT_SORT_TIME)
+			next = git_pqueue_pop(&walk->iterator_time);
+		else
+			next = git_commit_list_pop(&walk->iterator_topo);
+
 		if (next == NULL) {
 			giterr_clear();
 			return GIT_ITEROVER;
 		}
 
-		if (next->in_degree > 0) {
-			next->topo_delay = 1;
+		/* it may have been found hidden since it was queued */
+		if (next->uninteresting)
 			continue;
-		}
 
+		max = walk_parents(walk, next, &first);
 
-		max = next->out_degree;
-		if (walk->first_parent && next->out_degree)
-			max = 1;
+		for (i = first; i < first + max; ++i) {
+			parent = git_commit_store_parent(&walk->store, next, i);
 
-		for (i = 0; i < max; ++i) {
-			git_commit_list_node *parent = next->parents[i];
+			if (parent->generation < walk->topo_generation) {
+				walk->topo_generation = parent->generation;
 
-			if (--parent->in_degree == 0 && parent->topo_delay) {
-				parent->topo_delay = 0;
-				if (git_commit_list_insert(parent, &walk->iterator_topo) == NULL)
-					return -1;
+				if ((error = topo_count_to_depth(walk, parent->generation)) < 0)
+					return error;
 			}
+
+			if (--parent->in_degree == 0 && !parent->uninteresting &&
+				(error = topo_enqueue(walk, parent)) < 0)
+				return error;
 		}
 
 		*object_out = next;
@@ -449,7 +990,7 @@ static int premark_uninteresting(git_revwalk *walk)
 		commit = git_pqueue_pop(&q);
 
 		for (i = 0; i < commit->out_degree; i++) {
-			parent = commit->parents[i];
+			parent = git_commit_store_parent(&walk->store, commit, i);
 
 			if ((error = git_commit_list_parse(walk, parent)) < 0)
 				goto cleanup;
@@ -482,9 +1023,12 @@ static int prepare_walk(git_revwalk *walk)
 		return GIT_ITEROVER;
 	}
 
-	if (walk->did_hide && (error = premark_uninteresting(walk)) < 0)
+	/* a topological walk finds the hidden commits as it goes */
+	if (walk->did_hide && !(walk->sorting & GIT_SORT_TOPOLOGICAL) &&
+		(error = premark_uninteresting(walk)) < 0)
 		return error;
 
+
 	for (list = walk->user_input; list; list = list->next) {
 		if (process_commit(walk, list->item, list->item->uninteresting) < 0)
 			return -1;
@@ -492,19 +1036,7 @@ static int prepare_walk(git_revwalk *walk)
 
 
 	if (walk->sorting & GIT_SORT_TOPOLOGICAL) {
-		unsigned short i;
-
-		while ((error = walk->get_next(&next, walk)) == 0) {
-			for (i = 0; i < next->out_degree; ++i) {
-				git_commit_list_node *parent = next->parents[i];
-				parent->in_degree++;
-			}
-
-			if (git_commit_list_insert(next, &walk->iterator_topo) == NULL)
-				return -1;
-		}
-
-		if (error != GIT_ITEROVER)
+		if ((error = topo_walk_init(walk)) < 0)
 			return error;
 
 		walk->get_next = &revwalk_next_toposort;
@@ -535,16 +1067,19 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 	walk->commits = git_oidmap_alloc();
 	GITERR_CHECK_ALLOC(walk->commits);
 
-	if (git_pqueue_init(&walk->iterator_time, 0, 8, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&walk->iterator_time, 0, 8, git_commit_list_time_cmp) < 0 ||
+		git_pqueue_init(&walk->topo_explore, 0, 8, git_commit_list_generation_cmp) < 0 ||
+		git_pqueue_init(&walk->topo_indegree, 0, 8, git_commit_list_generation_cmp) < 0)
 		return -1;
 
-	git_pool_init(&walk->commit_pool, COMMIT_ALLOC);
 	walk->get_next = &revwalk_next_unsorted;
 	walk->enqueue = &revwalk_enqueue_unsorted;
 
 	walk->repo = repo;
 
-	if (git_repository_odb(&walk->odb, repo) < 0) {
+	if (git_repository_odb(&walk->odb, repo) < 0 ||
+		git_shallow__roots(&walk->shallow, repo) < 0 ||
+		revwalk_load_graph(walk) < 0) {
 		git_revwalk_free(walk);
 		return -1;
 	}
@@ -553,6 +1088,17 @@ int git_revwalk_new(git_revwalk **revwalk_out, git_repository *repo)
 	return 0;
 }
 
+static void revwalk_graph_ids_free(git_revwalk *walk)
+{
+	size_t i;
+
+	for (i = 0; walk->graph_pages &&
+		i <= (walk->graph->num_commits >> GRAPH_PAGE_BITS); i++)
+		git__free(walk->graph_pages[i]);
+
+	git__free(walk->graph_pages);
+}
+
 void git_revwalk_free(git_revwalk *walk)
 {
 	if (walk == NULL)
@@ -560,10 +1106,16 @@ void git_revwalk_free(git_revwalk *walk)
 
 	git_revwalk_reset(walk);
 	git_odb_free(walk->odb);
+	revwalk_paths_free(walk);
+	revwalk_graph_ids_free(walk);
+	git_commit_graph_free(walk->graph);
 
 	git_oidmap_free(walk->commits);
-	git_pool_clear(&walk->commit_pool);
+	git_commit_store_free(&walk->store);
 	git_pqueue_free(&walk->iterator_time);
+	git_pqueue_free(&walk->topo_explore);
+	git_pqueue_free(&walk->topo_indegree);
+	git_array_clear(walk->shallow);
 	git__free(walk);
 }
 
@@ -596,6 +1148,56 @@ void git_revwalk_simplify_first_parent(git_revwalk *walk)
 	walk->first_parent = 1;
 }
 
+void git_revwalk_simplify_history(git_revwalk *walk)
+{
+	walk->simplify_history = 1;
+}
+
+int git_revwalk_set_paths(git_revwalk *walk, const git_strarray *paths)
+{
+	revwalk_path *path;
+	size_t i, len, alloclen;
+
+	assert(walk);
+
+	if (walk->walking)
+		git_revwalk_reset(walk);
+
+	revwalk_paths_free(walk);
+
+	for (i = 0; paths && i < paths->count; i++) {
+		len = strlen(paths->strings[i]);
+
+		while (len && paths->strings[i][len - 1] == '/')
+			len--;
+
+		if (!len || paths->strings[i][0] == '/') {
+			giterr_set(GITERR_INVALID,
+				"invalid path to limit the walk to: '%s'", paths->strings[i]);
+			revwalk_paths_free(walk);
+			return -1;
+		}
+
+		GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(revwalk_path), len);
+		GITERR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+
+		path = git__calloc(1, alloclen);
+		GITERR_CHECK_ALLOC(path);
+
+		memcpy(path->path, paths->strings[i], len);
+
+		if (git_vector_insert(&walk->paths, path) < 0) {
+			git__free(path);
+			return -1;
+		}
+
+		if (walk->graph && revwalk_path_keys(walk, path) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 int git_revwalk_next(git_oid *oid, git_revwalk *walk)
 {
 	int error;
@@ -608,7 +1210,10 @@ int git_revwalk_next(git_oid *oid, git_revwalk *walk)
 			return error;
 	}
 
-	error = walk->get_next(&next, walk);
+	while ((error = walk->get_next(&next, walk)) == 0 && walk->paths.length) {
+		if ((error = simplify_commit(walk, next)) < 0 || !next->treesame)
+			break;
+	}
 
 	if (error == GIT_ITEROVER) {
 		git_revwalk_reset(walk);
@@ -622,26 +1227,122 @@ int git_revwalk_next(git_oid *oid, git_revwalk *walk)
 	return error;
 }
 
+static int push_walk_parents(
+	commit_list_node_array *pending, git_revwalk *walk, git_commit_list_node *commit)
+{
+	git_commit_list_node **node;
+	unsigned short first, i;
+
+	/* pushed backwards, so the first parent comes out first */
+	for (i = walk_parents(walk, commit, &first); i > 0; i--) {
+		node = git_array_alloc(*pending);
+		GITERR_CHECK_ALLOC(node);
+		*node = git_commit_store_parent(&walk->store, commit, first + i - 1);
+	}
+
+	return 0;
+}
+
+int git_revwalk_rewritten_parents(
+	git_oidarray *out, git_revwalk *walk, const git_oid *commit_id)
+{
+	commit_list_node_array pending = GIT_ARRAY_INIT, visited = GIT_ARRAY_INIT;
+	git_array_oid_t parents = GIT_ARRAY_INIT;
+	git_commit_list_node *commit, **node;
+	git_oid *id;
+	size_t i;
+	int error = 0;
+
+	assert(out && walk && commit_id);
+
+	if ((commit = commit_find(walk, commit_id)) == NULL || !commit->parsed) {
+		giterr_set(GITERR_INVALID, "commit has not been walked");
+		return GIT_ENOTFOUND;
+	}
+
+	if ((error = push_walk_parents(&pending, walk, commit)) < 0)
+		goto done;
+
+	while ((node = git_array_pop(pending)) != NULL) {
+		commit = *node;
+
+		if (commit->rewrite_seen)
+			continue;
+
+		if ((node = git_array_alloc(visited)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		*node = commit;
+		commit->rewrite_seen = 1;
+
+		if (!commit->uninteresting && walk->paths.length) {
+			if ((error = git_commit_list_parse(walk, commit)) < 0 ||
+				(error = simplify_commit(walk, commit)) < 0)
+				goto done;
+
+			if (commit->treesame) {
+				if ((error = push_walk_parents(&pending, walk, commit)) < 0)
+					goto done;
+				continue;
+			}
+		}
+
+		if ((id = git_array_alloc(parents)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(id, &commit->oid);
+	}
+
+	git_oidarray__from_array(out, &parents);
+	git_array_init(parents);
+
+done:
+	for (i = 0; i < visited.size; i++)
+		visited.ptr[i]->rewrite_seen = 0;
+
+	git_array_clear(pending);
+	git_array_clear(visited);
+	git_array_clear(parents);
+	return error;
+}
+
+static void commit_reset(git_commit_list_node *commit)
+{
+	commit->seen = 0;
+	commit->in_degree = 0;
+	commit->topo_delay = 0;
+	commit->uninteresting = 0;
+	commit->treesame_checked = 0;
+	commit->treesame = 0;
+	commit->treesame_parent = 0;
+	commit->topo_explored = 0;
+	commit->topo_counted = 0;
+}
+
 void git_revwalk_reset(git_revwalk *walk)
 {
-	git_commit_list_node *commit;
+	uint32_t i;
 
 	assert(walk);
 
-	kh_foreach_value(walk->commits, commit, {
-		commit->seen = 0;
-		commit->in_degree = 0;
-		commit->topo_delay = 0;
-		commit->uninteresting = 0;
-		commit->flags = 0;
-		});
+	for (i = 0; i < walk->store.count; i++)
+		commit_reset(git_commit_store_get(&walk->store, i));
+
+	git_commit_store_clear_flags(&walk->store);
 
 	git_pqueue_clear(&walk->iterator_time);
+	git_pqueue_clear(&walk->topo_explore);
+	git_pqueue_clear(&walk->topo_indegree);
 	git_commit_list_free(&walk->iterator_topo);
 	git_commit_list_free(&walk->iterator_rand);
 	git_commit_list_free(&walk->iterator_reverse);
 	git_commit_list_free(&walk->user_input);
 	walk->first_parent = 0;
+	walk->simplify_history = 0;
 	walk->walking = 0;
 	walk->did_push = walk->did_hide = 0;
 }
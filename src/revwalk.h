@@ -9,30 +9,42 @@
 
 #include "git2/revwalk.h"
 #include "oidmap.h"
+#include "commit_graph.h"
 #include "commit_list.h"
 #include "pqueue.h"
 #include "pool.h"
 #include "vector.h"
+#include "oidarray.h"
 
 #include "oidmap.h"
 
+#define GRAPH_PAGE_BITS 10
+#define GRAPH_PAGE_SIZE (1 << GRAPH_PAGE_BITS)
+
 struct git_revwalk {
 	git_repository *repo;
 	git_odb *odb;
 
+	/* the commits, and those found by their id */
+	git_commit_store store;
 	git_oidmap *commits;
-	git_pool commit_pool;
 
 	git_commit_list *iterator_topo;
 	git_commit_list *iterator_rand;
 	git_commit_list *iterator_reverse;
 	git_pqueue iterator_time;
 
+	/* incremental topological sorting, ordered by generation */
+	git_pqueue topo_explore;
+	git_pqueue topo_indegree;
+	uint32_t topo_generation;
+
 	int (*get_next)(git_commit_list_node **, git_revwalk *);
 	int (*enqueue)(git_revwalk *, git_commit_list_node *);
 
 	unsigned walking:1,
 		first_parent: 1,
+		simplify_history: 1,
 		did_hide: 1,
 		did_push: 1;
 	unsigned int sorting;
@@ -43,8 +55,23 @@ struct git_revwalk {
 	/* hide callback */
 	git_revwalk_hide_cb hide_cb;
 	void *hide_cb_payload;
+
+	/* commits whose parents are cut off in a shallow repository */
+	git_array_oid_t shallow;
+
+	/* the paths the walk is limited to, see `git_revwalk_set_paths` */
+	git_vector paths;
+	git_commit_graph_file *graph;
+
+	/*
+	 * the numbers in the store of the commits of the graph plus one,
+	 * by their position in it, in pages which are allocated as the
+	 * walk reaches them
+	 */
+	uint32_t **graph_pages;
 };
 
 git_commit_list_node *git_revwalk__commit_lookup(git_revwalk *walk, const git_oid *oid);
+git_commit_list_node *git_revwalk__graph_commit_lookup(git_revwalk *walk, size_t graph_pos);
 
 #endif
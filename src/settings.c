@@ -14,6 +14,7 @@
 #include "sysdir.h"
 #include "cache.h"
 #include "global.h"
+#include "stream_pool.h"
 
 void git_libgit2_version(int *major, int *minor, int *rev)
 {
@@ -43,6 +44,7 @@ int git_libgit2_features()
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern int git_odb__refresh_interval;
 
 static int config_level_to_sysdir(int config_level)
 {
@@ -181,6 +183,27 @@ int git_libgit2_opts(int key, ...)
 		}
 
 		break;
+
+	case GIT_OPT_SET_CONNECTION_POOL:
+		{
+			int max_idle = va_arg(ap, int);
+			int idle_timeout = va_arg(ap, int);
+			error = git_stream_pool_set_limits(max_idle, idle_timeout);
+		}
+		break;
+
+	case GIT_OPT_SET_ODB_REFRESH_INTERVAL:
+		{
+			int interval = va_arg(ap, int);
+
+			if (interval < 0) {
+				giterr_set(GITERR_INVALID, "Invalid refresh interval %d", interval);
+				error = -1;
+			} else {
+				git_odb__refresh_interval = interval;
+			}
+		}
+		break;
 	}
 
 	va_end(ap);
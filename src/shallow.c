@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "shallow.h"
+#include "buffer.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "repository.h"
+
+static int shallow_oid_cmp(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid_cmp(a, b);
+}
+
+static void shallow_sort(git_array_oid_t *roots)
+{
+	size_t i, n = 0;
+
+	if (!roots->size)
+		return;
+
+	git__qsort_r(roots->ptr, roots->size, sizeof(git_oid),
+		shallow_oid_cmp, NULL);
+
+	for (i = 0; i < roots->size; i++) {
+		if (n && git_oid_equal(&roots->ptr[n - 1], &roots->ptr[i]))
+			continue;
+
+		git_oid_cpy(&roots->ptr[n++], &roots->ptr[i]);
+	}
+
+	roots->size = n;
+}
+
+int git_shallow__roots(git_array_oid_t *out, git_repository *repo)
+{
+	git_buf path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	const char *line, *eol;
+	git_oid *id;
+	int error;
+
+	git_array_init(*out);
+
+	if ((error = git_buf_joinpath(&path, repo->path_repository, GIT_SHALLOW_FILE)) < 0)
+		return error;
+
+	if ((error = git_futils_readbuffer(&contents, path.ptr)) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			giterr_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	for (line = contents.ptr; *line; line = eol + 1) {
+		if ((eol = strchr(line, '\n')) == NULL)
+			eol = line + strlen(line);
+
+		if (eol == line) {
+			if (!*eol)
+				break;
+			continue;
+		}
+
+		if ((id = git_array_alloc(*out)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		if (eol - line < GIT_OID_HEXSZ ||
+			git_oid_fromstrn(id, line, GIT_OID_HEXSZ) < 0) {
+			giterr_set(GITERR_REPOSITORY,
+				"Invalid shallow file '%s'", path.ptr);
+			error = -1;
+			goto done;
+		}
+
+		if (!*eol)
+			break;
+	}
+
+	shallow_sort(out);
+
+done:
+	if (error < 0)
+		git_array_clear(*out);
+
+	git_buf_free(&contents);
+	git_buf_free(&path);
+	return error;
+}
+
+bool git_shallow__contains(const git_array_oid_t *roots, const git_oid *id)
+{
+	size_t lo = 0, hi = roots->size;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = git_oid_cmp(id, &roots->ptr[mid]);
+
+		if (!cmp)
+			return true;
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return false;
+}
+
+int git_shallow__update(
+	git_repository *repo,
+	const git_array_oid_t *add,
+	const git_array_oid_t *remove)
+{
+	git_array_oid_t roots, removed = GIT_ARRAY_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	git_oid *id;
+	size_t i, written = 0;
+	int error;
+
+	if (!git_array_size(*add) && !git_array_size(*remove))
+		return 0;
+
+	if ((error = git_shallow__roots(&roots, repo)) < 0)
+		return error;
+
+	for (i = 0; i < git_array_size(*add); i++) {
+		if ((id = git_array_alloc(roots)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(id, git_array_get(*add, i));
+	}
+
+	/* the roots the server sent are in no particular order */
+	for (i = 0; i < git_array_size(*remove); i++) {
+		id = git_array_alloc(removed);
+		if (!id) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(id, git_array_get(*remove, i));
+	}
+
+	shallow_sort(&roots);
+	shallow_sort(&removed);
+
+	if ((error = git_buf_joinpath(&path, repo->path_repository, GIT_SHALLOW_FILE)) < 0 ||
+		(error = git_filebuf_open(&file, path.ptr, GIT_FILEBUF_FORCE, GIT_SHALLOW_FILE_MODE)) < 0)
+		goto done;
+
+	for (i = 0; i < git_array_size(roots); i++) {
+		id = git_array_get(roots, i);
+
+		if (git_shallow__contains(&removed, id))
+			continue;
+
+		git_oid_tostr(hex, sizeof(hex), id);
+		git_filebuf_printf(&file, "%s\n", hex);
+		written++;
+	}
+
+	/* a repository without any root is complete again */
+	if (!written) {
+		git_filebuf_cleanup(&file);
+
+		if (p_unlink(path.ptr) < 0 && errno != ENOENT) {
+			giterr_set(GITERR_OS, "Failed to remove '%s'", path.ptr);
+			error = -1;
+		}
+	} else
+		error = git_filebuf_commit(&file);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_array_clear(roots);
+	git_array_clear(removed);
+	git_buf_free(&path);
+	return error;
+}
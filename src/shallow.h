@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_shallow_h__
+#define INCLUDE_shallow_h__
+
+#include "common.h"
+#include "oidarray.h"
+
+#define GIT_SHALLOW_FILE "shallow"
+#define GIT_SHALLOW_FILE_MODE 0666
+
+/*
+ * Load the shallow roots of a repository: the commits listed in
+ * `.git/shallow`, whose parents are missing and which are treated as
+ * if they had none. The array is sorted and free of duplicates; it is
+ * empty for complete repositories.
+ */
+int git_shallow__roots(git_array_oid_t *out, git_repository *repo);
+
+/* Whether `id` is one of the (sorted) shallow `roots` */
+bool git_shallow__contains(const git_array_oid_t *roots, const git_oid *id);
+
+/*
+ * Update the shallow roots of a repository after a fetch: the commits
+ * in `add` become shallow roots and the ones in `remove` got their
+ * history. `.git/shallow` is removed once no root is left.
+ */
+int git_shallow__update(
+	git_repository *repo,
+	const git_array_oid_t *add,
+	const git_array_oid_t *remove);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "global.h"
+#include "buffer.h"
+#include "vector.h"
+#include "stream.h"
+#include "stream_pool.h"
+
+typedef struct {
+	char *key;
+	git_stream *stream;
+	double idle_since;
+} pooled_stream;
+
+/* Whenever you want to read or modify these, grab git__stream_pool_mutex */
+static git_vector pool = GIT_VECTOR_INIT;
+static int pool_max_idle = GIT_STREAM_POOL_MAX_IDLE;
+static int pool_idle_timeout = GIT_STREAM_POOL_IDLE_TIMEOUT;
+static bool pool_registered;
+
+static void pooled_stream_free(pooled_stream *entry)
+{
+	if (!entry)
+		return;
+
+	git_stream_close(entry->stream);
+	git_stream_free(entry->stream);
+	git__free(entry->key);
+	git__free(entry);
+}
+
+/*
+ * Closing a stream may mean talking to the server, so whatever is
+ * dropped from the pool under the lock is only closed after it.
+ */
+static void free_dropped(git_vector *dropped)
+{
+	pooled_stream *entry;
+	size_t i;
+
+	git_vector_foreach(dropped, i, entry)
+		pooled_stream_free(entry);
+
+	git_vector_free(dropped);
+}
+
+/* Run under the pool lock */
+static int drop_expired(git_vector *dropped, double now)
+{
+	pooled_stream *entry;
+	size_t i = pool.length;
+
+	while (i > 0) {
+		entry = git_vector_get(&pool, --i);
+
+		if (now - entry->idle_since < pool_idle_timeout)
+			continue;
+
+		if (git_vector_insert(dropped, entry) < 0)
+			return -1;
+
+		git_vector_remove(&pool, i);
+	}
+
+	return 0;
+}
+
+/* Run under the pool lock */
+static int drop_overflow(git_vector *dropped)
+{
+	/* the oldest connections are at the front */
+	while (pool.length > (size_t)pool_max_idle) {
+		if (git_vector_insert(dropped, git_vector_get(&pool, 0)) < 0)
+			return -1;
+
+		git_vector_remove(&pool, 0);
+	}
+
+	return 0;
+}
+
+static void stream_pool_shutdown(void)
+{
+	git_stream_pool_clear();
+	git_vector_free(&pool);
+	pool_registered = false;
+}
+
+static int make_key(
+	git_buf *out, const char *scheme, const char *host, const char *port)
+{
+	return git_buf_printf(out, "%s://%s:%s", scheme, host, port);
+}
+
+int git_stream_pool_take(
+	git_stream **out, const char *scheme, const char *host, const char *port)
+{
+	git_vector dropped = GIT_VECTOR_INIT;
+	git_buf key = GIT_BUF_INIT;
+	pooled_stream *entry = NULL;
+	size_t i;
+	int error;
+
+	assert(out && scheme && host && port);
+
+	*out = NULL;
+
+	if ((error = make_key(&key, scheme, host, port)) < 0)
+		return error;
+
+	if (git_mutex_lock(&git__stream_pool_mutex) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock the connection pool");
+		git_buf_free(&key);
+		return -1;
+	}
+
+	if ((error = drop_expired(&dropped, git__timer())) < 0)
+		goto done;
+
+	/* the connection used most recently is the likeliest to be alive */
+	for (i = pool.length; i > 0; i--) {
+		pooled_stream *candidate = git_vector_get(&pool, i - 1);
+
+		if (!strcmp(candidate->key, key.ptr)) {
+			git_vector_remove(&pool, i - 1);
+			entry = candidate;
+			break;
+		}
+	}
+
+done:
+	git_mutex_unlock(&git__stream_pool_mutex);
+
+	if (entry) {
+		*out = entry->stream;
+		git__free(entry->key);
+		git__free(entry);
+	}
+
+	free_dropped(&dropped);
+	git_buf_free(&key);
+	return error;
+}
+
+void git_stream_pool_give(
+	git_stream *stream, const char *scheme, const char *host, const char *port)
+{
+	git_vector dropped = GIT_VECTOR_INIT;
+	git_buf key = GIT_BUF_INIT;
+	pooled_stream *entry;
+
+	assert(stream && scheme && host && port);
+
+	if ((entry = git__calloc(1, sizeof(pooled_stream))) == NULL ||
+		make_key(&key, scheme, host, port) < 0)
+		goto close;
+
+	entry->key = git_buf_detach(&key);
+	entry->stream = stream;
+	entry->idle_since = git__timer();
+
+	if (git_mutex_lock(&git__stream_pool_mutex) < 0)
+		goto close;
+
+	if (pool_max_idle > 0 && pool_idle_timeout > 0 &&
+		git_vector_insert(&pool, entry) == 0) {
+		if (!pool_registered) {
+			git__on_shutdown(stream_pool_shutdown);
+			pool_registered = true;
+		}
+
+		entry = NULL;
+		drop_overflow(&dropped);
+	}
+
+	git_mutex_unlock(&git__stream_pool_mutex);
+
+	free_dropped(&dropped);
+	pooled_stream_free(entry);
+	return;
+
+close:
+	if (entry)
+		git__free(entry->key);
+
+	git__free(entry);
+	git_buf_free(&key);
+	git_stream_close(stream);
+	git_stream_free(stream);
+}
+
+int git_stream_pool_set_limits(int max_idle, int idle_timeout)
+{
+	git_vector dropped = GIT_VECTOR_INIT;
+	int error;
+
+	if (max_idle < 0 || idle_timeout < 0) {
+		giterr_set(GITERR_INVALID, "Invalid connection pool limits");
+		return -1;
+	}
+
+	if (git_mutex_lock(&git__stream_pool_mutex) < 0) {
+		giterr_set(GITERR_OS, "Failed to lock the connection pool");
+		return -1;
+	}
+
+	pool_max_idle = max_idle;
+	pool_idle_timeout = idle_timeout;
+
+	if ((error = drop_expired(&dropped, git__timer())) == 0)
+		error = drop_overflow(&dropped);
+
+	git_mutex_unlock(&git__stream_pool_mutex);
+
+	free_dropped(&dropped);
+	return error;
+}
+
+void git_stream_pool_clear(void)
+{
+	git_vector dropped;
+
+	if (git_mutex_lock(&git__stream_pool_mutex) < 0)
+		return;
+
+	/* the dropped list takes over the entries and their storage */
+	dropped = pool;
+	memset(&pool, 0, sizeof(git_vector));
+
+	git_mutex_unlock(&git__stream_pool_mutex);
+
+	free_dropped(&dropped);
+}
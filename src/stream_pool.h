@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_stream_pool_h__
+#define INCLUDE_stream_pool_h__
+
+#include "common.h"
+#include "git2/sys/stream.h"
+
+#define GIT_STREAM_POOL_MAX_IDLE 8
+#define GIT_STREAM_POOL_IDLE_TIMEOUT 30
+
+/**
+ * Take an idle connection to `host`:`port` over `scheme` out of the
+ * process-wide pool.  `out` is set to NULL when there is none.
+ */
+extern int git_stream_pool_take(
+	git_stream **out, const char *scheme, const char *host, const char *port);
+
+/**
+ * Hand a connected stream, whose last response has been read in full,
+ * over to the pool.  The pool owns the stream from then on and closes
+ * it when it expires or when there is no room for it.
+ */
+extern void git_stream_pool_give(
+	git_stream *stream, const char *scheme, const char *host, const char *port);
+
+/**
+ * Set how many idle connections are kept and for how many seconds;
+ * zero for either turns pooling off.
+ */
+extern int git_stream_pool_set_limits(int max_idle, int idle_timeout);
+
+/** Close every idle connection in the pool */
+extern void git_stream_pool_clear(void);
+
+#endif
@@ -448,7 +448,7 @@ int git_tag_foreach(git_repository *repo, git_tag_foreach_cb cb, void *cb_data)
 	data.cb_data = cb_data;
 	data.repo = repo;
 
-	return git_reference_foreach_name(repo, &tags_cb, &data);
+	return git_reference_foreach_glob(repo, GIT_REFS_TAGS_DIR "*", &tags_cb, &data);
 }
 
 typedef struct {
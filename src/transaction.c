@@ -13,6 +13,7 @@
 #include "reflog.h"
 #include "signature.h"
 #include "config.h"
+#include "global.h"
 
 #include "git2/transaction.h"
 #include "git2/signature.h"
@@ -108,6 +109,7 @@ int git_transaction_lock_ref(git_transaction *tx, const char *refname)
 {
 	int error;
 	transaction_node *node;
+	const void *owner;
 
 	assert(tx && refname);
 
@@ -117,7 +119,13 @@ int git_transaction_lock_ref(git_transaction *tx, const char *refname)
 	node->name = git_pool_strdup(&tx->pool, refname);
 	GITERR_CHECK_ALLOC(node->name);
 
-	if ((error = git_refdb_lock(&node->payload, tx->db, refname)) < 0)
+	/* let the backend tell the locks of different transactions apart */
+	owner = GIT_GLOBAL->refdb_txn;
+	GIT_GLOBAL->refdb_txn = tx;
+	error = git_refdb_lock(&node->payload, tx->db, refname);
+	GIT_GLOBAL->refdb_txn = owner;
+
+	if (error < 0)
 		return error;
 
 	git_strmap_insert(tx->locks, node->name, node, error);
@@ -348,6 +356,10 @@ int git_transaction_commit(git_transaction *tx)
 		if (node->ref_type != GIT_REF_INVALID) {
 			if ((error = update_target(tx->db, node)) < 0)
 				return error;
+		} else {
+			/* the backend may wait for every lock before writing */
+			git_refdb_unlock(tx->db, node->payload, false, false, NULL, NULL, NULL);
+			node->committed = true;
 		}
 	}
 
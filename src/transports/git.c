@@ -8,6 +8,7 @@
 #include "git2.h"
 #include "buffer.h"
 #include "netops.h"
+#include "smart.h"
 #include "git2/sys/transport.h"
 #include "stream.h"
 #include "socket_stream.h"
@@ -28,7 +29,7 @@ typedef struct {
 
 typedef struct {
 	git_smart_subtransport parent;
-	git_transport *owner;
+	transport_smart *owner;
 	git_proto_stream *current_stream;
 } git_subtransport;
 
@@ -37,11 +38,12 @@ typedef struct {
  *
  * For example: 0035git-upload-pack /libgit2/libgit2\0host=github.com\0
  */
-static int gen_proto(git_buf *request, const char *cmd, const char *url)
+static int gen_proto(git_buf *request, const char *cmd, const char *url, int version)
 {
 	char *delim, *repo;
 	char host[] = "host=";
-	size_t len;
+	char extra[16] = {0};
+	size_t len, extra_len = 0;
 
 	delim = strchr(url, '/');
 	if (delim == NULL) {
@@ -57,7 +59,11 @@ static int gen_proto(git_buf *request, const char *cmd, const char *url)
 	if (delim == NULL)
 		delim = strchr(url, '/');
 
-	len = 4 + strlen(cmd) + 1 + strlen(repo) + 1 + strlen(host) + (delim - url) + 1;
+	/* extra parameters follow an empty field, old servers ignore them */
+	if (version)
+		extra_len = p_snprintf(extra, sizeof(extra), "version=%d", version) + 2;
+
+	len = 4 + strlen(cmd) + 1 + strlen(repo) + 1 + strlen(host) + (delim - url) + 1 + extra_len;
 
 	git_buf_grow(request, len);
 	git_buf_printf(request, "%04x%s %s%c%s",
@@ -65,6 +71,11 @@ static int gen_proto(git_buf *request, const char *cmd, const char *url)
 	git_buf_put(request, url, delim - url);
 	git_buf_putc(request, '\0');
 
+	if (version) {
+		git_buf_putc(request, '\0');
+		git_buf_put(request, extra, extra_len - 1);
+	}
+
 	if (git_buf_oom(request))
 		return -1;
 
@@ -76,7 +87,7 @@ static int send_command(git_proto_stream *s)
 	int error;
 	git_buf request = GIT_BUF_INIT;
 
-	error = gen_proto(&request, s->cmd, s->url);
+	error = gen_proto(&request, s->cmd, s->url, OWNING_SUBTRANSPORT(s)->owner->version);
 	if (error < 0)
 		goto cleanup;
 
@@ -358,7 +369,7 @@ int git_smart_subtransport_git(git_smart_subtransport **out, git_transport *owne
 	t = git__calloc(1, sizeof(git_subtransport));
 	GITERR_CHECK_ALLOC(t);
 
-	t->owner = owner;
+	t->owner = (transport_smart *)owner;
 	t->parent.action = _git_action;
 	t->parent.close = _git_close;
 	t->parent.free = _git_free;
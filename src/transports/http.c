@@ -18,6 +18,7 @@
 #include "tls_stream.h"
 #include "socket_stream.h"
 #include "curl_stream.h"
+#include "stream_pool.h"
 
 git_http_auth_scheme auth_schemes[] = {
 	{ GIT_AUTHTYPE_NEGOTIATE, "Negotiate", GIT_CREDTYPE_DEFAULT, git_http_auth_negotiate },
@@ -82,7 +83,11 @@ typedef struct {
 	enum last_cb last_cb;
 	int parse_error;
 	int error;
-	unsigned parse_finished : 1;
+	unsigned parse_finished : 1,
+		/* taken from the pool, and not heard from since */
+		reused : 1,
+		/* may be handed over to the pool once we're done */
+		poolable : 1;
 
 	/* Authentication */
 	git_cred *cred;
@@ -222,6 +227,9 @@ static int gen_request(
 	} else
 		git_buf_puts(buf, "Accept: */*\r\n");
 
+	if (t->owner->version)
+		git_buf_printf(buf, "Git-Protocol: version=%d\r\n", t->owner->version);
+
 	for (i = 0; i < t->owner->custom_headers.count; i++) {
 		if (t->owner->custom_headers.strings[i])
 			git_buf_printf(buf, "%s\r\n", t->owner->custom_headers.strings[i]);
@@ -555,10 +563,15 @@ static int write_chunk(git_stream *io, const char *buffer, size_t len)
 	return 0;
 }
 
-static int http_connect(http_subtransport *t)
+static const char *http_scheme(http_subtransport *t)
 {
-	int error;
-	char *proxy_url;
+	return t->connection_data.use_ssl ? "https" : "http";
+}
+
+static int http_connect(http_subtransport *t, bool pooled)
+{
+	int error = 0;
+	char *proxy_url = NULL;
 
 	if (t->connected &&
 		http_should_keep_alive(&t->parser) &&
@@ -571,32 +584,52 @@ static int http_connect(http_subtransport *t)
 		t->io = NULL;
 	}
 
-	if (t->connection_data.use_ssl) {
-		error = git_tls_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
+	t->connected = 0;
+	t->reused = 0;
+
+	if (git_remote__get_http_proxy(t->owner->owner, !!t->connection_data.use_ssl, &proxy_url) < 0) {
+		giterr_clear();
+		proxy_url = NULL;
+	}
+
+	/* Connections through a proxy are never shared */
+	t->poolable = !proxy_url;
+
+	if (pooled && t->poolable &&
+		(error = git_stream_pool_take(&t->io, http_scheme(t),
+			t->connection_data.host, t->connection_data.port)) < 0)
+		goto done;
+
+	if (t->io) {
+		t->reused = 1;
 	} else {
+		if (t->connection_data.use_ssl) {
+			error = git_tls_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
+		} else {
 #ifdef GIT_CURL
-		error = git_curl_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
+			error = git_curl_stream_new(&t->io, t->connection_data.host, t->connection_data.port);
 #else
-		error = git_socket_stream_new(&t->io,  t->connection_data.host, t->connection_data.port);
+			error = git_socket_stream_new(&t->io,  t->connection_data.host, t->connection_data.port);
 #endif
-	}
+		}
 
-	if (error < 0)
-		return error;
+		if (error < 0)
+			goto done;
+
+		if ((error = giterr__check_version(t->io, GIT_STREAM_VERSION, "git_stream")) < 0)
+			goto done;
 
-	GITERR_CHECK_VERSION(t->io, GIT_STREAM_VERSION, "git_stream");
+		if (proxy_url && git_stream_supports_proxy(t->io) &&
+			(error = git_stream_set_proxy(t->io, proxy_url)) < 0)
+			goto done;
 
-	if (git_stream_supports_proxy(t->io) &&
-	    !git_remote__get_http_proxy(t->owner->owner, !!t->connection_data.use_ssl, &proxy_url)) {
-		error = git_stream_set_proxy(t->io, proxy_url);
-		git__free(proxy_url);
+		error = git_stream_connect(t->io);
 
+		/* Only connections we could verify on our own are shared */
 		if (error < 0)
-			return error;
+			t->poolable = 0;
 	}
 
-	error = git_stream_connect(t->io);
-
 #if defined(GIT_OPENSSL) || defined(GIT_SECURE_TRANSPORT) || defined(GIT_CURL)
 	if ((!error || error == GIT_ECERTIFICATE) && t->owner->certificate_check_cb != NULL &&
 	    git_stream_is_encrypted(t->io)) {
@@ -604,7 +637,7 @@ static int http_connect(http_subtransport *t)
 		int is_valid;
 
 		if ((error = git_stream_certificate(&cert, t->io)) < 0)
-			return error;
+			goto done;
 
 		giterr_clear();
 		is_valid = error != GIT_ECERTIFICATE;
@@ -614,15 +647,18 @@ static int http_connect(http_subtransport *t)
 			if (!giterr_last())
 				giterr_set(GITERR_NET, "user cancelled certificate check");
 
-			return error;
+			goto done;
 		}
 	}
 #endif
 	if (error < 0)
-		return error;
+		goto done;
 
 	t->connected = 1;
-	return 0;
+
+done:
+	git__free(proxy_url);
+	return error;
 }
 
 static int http_stream_read(
@@ -651,6 +687,10 @@ replay:
 
 		if (git_stream_write(t->io, request.ptr, request.size, 0) < 0) {
 			git_buf_free(&request);
+
+			if (t->reused && s->verb == get_verb)
+				goto reconnect;
+
 			return -1;
 		}
 
@@ -698,9 +738,15 @@ replay:
 
 		data_offset = t->parse_buffer.offset;
 
-		if (gitno_recv(&t->parse_buffer) < 0)
+		if ((error = gitno_recv(&t->parse_buffer)) <= 0 &&
+			t->reused && s->verb == get_verb)
+			goto reconnect;
+
+		if (error < 0)
 			return -1;
 
+		t->reused = 0;
+
 		/* This call to http_parser_execute will result in invocations of the
 		 * on_* family of callbacks. The most interesting of these is
 		 * on_body_fill_buffer, which is called when data is ready to be copied
@@ -727,7 +773,7 @@ replay:
 		if (PARSE_ERROR_REPLAY == t->parse_error) {
 			s->sent_request = 0;
 
-			if ((error = http_connect(t)) < 0)
+			if ((error = http_connect(t, s->verb == get_verb)) < 0)
 				return error;
 
 			goto replay;
@@ -749,6 +795,21 @@ replay:
 	}
 
 	return 0;
+
+reconnect:
+	/*
+	 * The server may well have closed a connection while it sat in the
+	 * pool; a request without a body is safe to send again on a new one.
+	 */
+	giterr_clear();
+
+	t->connected = 0;
+	s->sent_request = 0;
+
+	if (http_connect(t, false) < 0)
+		return -1;
+
+	goto replay;
 }
 
 static int http_stream_write_chunked(
@@ -984,7 +1045,10 @@ static int http_action(
 		 (ret = gitno_connection_data_from_url(&t->connection_data, url, NULL)) < 0)
 		return ret;
 
-	if ((ret = http_connect(t)) < 0)
+	/* Only requests we could send again may go out on a pooled connection */
+	if ((ret = http_connect(t,
+			action == GIT_SERVICE_UPLOADPACK_LS ||
+			action == GIT_SERVICE_RECEIVEPACK_LS)) < 0)
 		return ret;
 
 	switch (action) {
@@ -1011,14 +1075,21 @@ static int http_close(git_smart_subtransport *subtransport)
 	git_http_auth_context *context;
 	size_t i;
 
-	clear_parser_state(t);
-
-	if (t->io) {
+	/* A connection that is ready for another request may serve a later operation */
+	if (t->io && t->connected && t->poolable && t->parse_finished &&
+		http_should_keep_alive(&t->parser)) {
+		git_stream_pool_give(t->io, http_scheme(t),
+			t->connection_data.host, t->connection_data.port);
+	} else if (t->io) {
 		git_stream_close(t->io);
 		git_stream_free(t->io);
-		t->io = NULL;
 	}
 
+	t->io = NULL;
+	t->connected = 0;
+
+	clear_parser_state(t);
+
 	if (t->cred) {
 		t->cred->free(t->cred);
 		t->cred = NULL;
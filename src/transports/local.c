@@ -25,6 +25,11 @@
 #include "odb.h"
 #include "push.h"
 #include "remote.h"
+#include "oidmap.h"
+#include "pool.h"
+#include "shallow.h"
+
+GIT__USE_OIDMAP
 
 typedef struct {
 	git_transport parent;
@@ -38,6 +43,7 @@ typedef struct {
 	git_transport_message_cb error_cb;
 	void *message_cb_payload;
 	git_vector refs;
+	git_array_oid_t objects;
 	unsigned connected : 1,
 		have_refs : 1;
 } transport_local;
@@ -267,10 +273,20 @@ static int local_negotiate_fetch(
 {
 	transport_local *t = (transport_local*)transport;
 	git_remote_head *rhead;
+	git_oid *id;
 	unsigned int i;
 
-	GIT_UNUSED(refs);
-	GIT_UNUSED(count);
+	git_array_clear(t->objects);
+
+	/* Wants which weren't advertised are objects asked for by id */
+	for (i = 0; i < count; i++) {
+		if (git_vector_search(NULL, &t->refs, refs[i]) == 0)
+			continue;
+
+		id = git_array_alloc(t->objects);
+		GITERR_CHECK_ALLOC(id);
+		git_oid_cpy(id, &refs[i]->oid);
+	}
 
 	/* Fill in the loids */
 	git_vector_foreach(&t->refs, i, rhead) {
@@ -346,6 +362,12 @@ static int local_push(
 
 	GIT_UNUSED(cbs);
 
+	/* The references are updated one at a time */
+	if (push->atomic) {
+		giterr_set(GITERR_NET, "Local push doesn't support atomic pushes");
+		return -1;
+	}
+
 	/* 'push->remote->url' may be a url or path; convert to a path */
 	if ((error = git_path_from_url_or_path(&buf, push->remote->url)) < 0) {
 		git_buf_free(&buf);
@@ -500,6 +522,203 @@ static int local_counting(int stage, unsigned int current, unsigned int total, v
 	return error;
 }
 
+typedef struct {
+	git_oid id;
+	int level;
+} shallow_commit;
+
+typedef struct {
+	transport_local *t;
+	git_packbuilder *pack;
+	git_odb *odb;
+	git_array_oid_t ours;
+	git_array_oid_t theirs;
+	git_pool commits;
+	git_oidmap *seen;
+	git_vector queue;
+} shallow_walk;
+
+static int shallow_enqueue(shallow_walk *w, const git_oid *id, int level)
+{
+	shallow_commit *c;
+	khiter_t pos;
+	int error;
+
+	pos = git_oidmap_lookup_index(w->seen, id);
+	if (git_oidmap_valid_index(w->seen, pos))
+		return 0;
+
+	c = git_pool_malloc(&w->commits, 1);
+	GITERR_CHECK_ALLOC(c);
+
+	git_oid_cpy(&c->id, id);
+	c->level = level;
+
+	git_oidmap_insert(w->seen, &c->id, c, error);
+	if (error < 0)
+		return -1;
+
+	return git_vector_insert(&w->queue, c);
+}
+
+static int shallow_push_root(git_array_oid_t *roots, const git_oid *id)
+{
+	git_oid *root = git_array_alloc(*roots);
+	GITERR_CHECK_ALLOC(root);
+
+	git_oid_cpy(root, id);
+	return 0;
+}
+
+/*
+ * Whether the walk stops at this commit, as it's either at the depth
+ * requested or its parents are older than the requested date.
+ */
+static int shallow_is_boundary(
+	bool *out, shallow_walk *w, git_commit *commit, int level)
+{
+	git_commit *parent;
+	unsigned int i;
+	int error;
+
+	*out = false;
+
+	if (w->t->owner->depth) {
+		*out = (level >= w->t->owner->depth);
+		return 0;
+	}
+
+	for (i = 0; i < git_commit_parentcount(commit) && !*out; i++) {
+		if ((error = git_commit_parent(&parent, commit, i)) < 0)
+			return error;
+
+		*out = (git_commit_time(parent) < w->t->owner->shallow_since);
+		git_commit_free(parent);
+	}
+
+	return 0;
+}
+
+static int shallow_walk_commit(shallow_walk *w, shallow_commit *c)
+{
+	git_commit *commit;
+	unsigned int i, parents;
+	bool theirs, ours, client_has, boundary;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, w->t->repo, &c->id)) < 0)
+		return error;
+
+	theirs = git_shallow__contains(&w->theirs, &c->id);
+	ours = git_shallow__contains(&w->ours, &c->id);
+	client_has = git_odb_exists(w->odb, &c->id);
+	parents = ours ? 0 : git_commit_parentcount(commit);
+
+	if (!client_has &&
+		(error = git_packbuilder_insert_commit(w->pack, &c->id)) < 0)
+		goto done;
+
+	if (!parents)
+		goto done;
+
+	if ((error = shallow_is_boundary(&boundary, w, commit, c->level)) < 0)
+		goto done;
+
+	if (boundary) {
+		if (!theirs)
+			error = shallow_push_root(&w->t->owner->shallow, &c->id);
+		goto done;
+	}
+
+	if (theirs &&
+		(error = shallow_push_root(&w->t->owner->unshallow, &c->id)) < 0)
+		goto done;
+
+	for (i = 0; i < parents; i++) {
+		if ((error = shallow_enqueue(w,
+				git_commit_parent_id(commit, i), c->level + 1)) < 0)
+			goto done;
+	}
+
+done:
+	git_commit_free(commit);
+	return error;
+}
+
+/*
+ * Fill the pack with the history of the wanted references down to the
+ * requested depth (or date), walking breadth-first so each commit is
+ * reached at its lowest depth. The commits at which the walk stops
+ * become the new shallow roots of the client; its current roots which
+ * are walked past get their history. Commits the client has are still
+ * walked, as their history may have been cut short as well.
+ */
+static int local_insert_shallow(
+	transport_local *t, git_repository *repo, git_packbuilder *pack)
+{
+	shallow_walk w = {0};
+	git_remote_head *rhead;
+	git_object *obj, *peeled;
+	size_t i;
+	int error;
+
+	w.t = t;
+	w.pack = pack;
+	w.seen = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(w.seen);
+
+	git_pool_init(&w.commits, sizeof(shallow_commit));
+
+	if ((error = git_vector_init(&w.queue, 64, NULL)) < 0 ||
+		(error = git_repository_odb__weakptr(&w.odb, repo)) < 0 ||
+		(error = git_shallow__roots(&w.theirs, repo)) < 0 ||
+		(error = git_shallow__roots(&w.ours, t->repo)) < 0)
+		goto cleanup;
+
+	/* only walk from the references the client asked for */
+	git_vector_foreach(&t->owner->refs, i, rhead) {
+		if (rhead->local)
+			continue;
+
+		if ((error = git_object_lookup(&obj, t->repo, &rhead->oid, GIT_OBJ_ANY)) < 0)
+			goto cleanup;
+
+		/* send the tags themselves, and walk from what they point to */
+		if (git_object_type(obj) != GIT_OBJ_TAG)
+			peeled = obj;
+		else if ((error = git_packbuilder_insert(pack, &rhead->oid, rhead->name)) < 0 ||
+			(error = git_object_peel(&peeled, obj, GIT_OBJ_ANY)) < 0) {
+			git_object_free(obj);
+			goto cleanup;
+		} else
+			git_object_free(obj);
+
+		if (git_object_type(peeled) == GIT_OBJ_COMMIT)
+			error = shallow_enqueue(&w, git_object_id(peeled), 1);
+		else
+			error = git_packbuilder_insert_recur(pack, git_object_id(peeled), NULL);
+
+		git_object_free(peeled);
+
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/* the queue grows as we walk */
+	for (i = 0; i < w.queue.length; i++) {
+		if ((error = shallow_walk_commit(&w, git_vector_get(&w.queue, i))) < 0)
+			goto cleanup;
+	}
+
+cleanup:
+	git_oidmap_free(w.seen);
+	git_vector_free(&w.queue);
+	git_pool_clear(&w.commits);
+	git_array_clear(w.ours);
+	git_array_clear(w.theirs);
+	return error;
+}
+
 static int local_download_pack(
 		git_transport *transport,
 		git_repository *repo,
@@ -531,6 +750,28 @@ static int local_download_pack(
 	stats->received_objects = 0;
 	stats->received_bytes = 0;
 
+	if (t->owner && t->owner->filter &&
+		(error = git_pack_filter_parse(&pack->filter, t->owner->filter)) < 0)
+		goto cleanup;
+
+	/* objects missing from a partial clone, along with what they point to */
+	if (git_array_size(t->objects)) {
+		for (i = 0; i < git_array_size(t->objects); i++) {
+			if ((error = git_packbuilder_insert_recur(
+					pack, git_array_get(t->objects, i), NULL)) < 0)
+				goto cleanup;
+		}
+
+		goto counted;
+	}
+
+	if (t->owner && (t->owner->depth || t->owner->shallow_since)) {
+		if ((error = local_insert_shallow(t, repo, pack)) < 0)
+			goto cleanup;
+
+		goto counted;
+	}
+
 	git_vector_foreach(&t->refs, i, rhead) {
 		git_object *obj;
 		if ((error = git_object_lookup(&obj, t->repo, &rhead->oid, GIT_OBJ_ANY)) < 0)
@@ -556,6 +797,7 @@ static int local_download_pack(
 	if ((error = git_packbuilder_insert_walk(pack, walk)))
 		goto cleanup;
 
+counted:
 	if ((error = git_buf_printf(&progress_info, counting_objects_fmt, git_packbuilder_object_count(pack))) < 0)
 		goto cleanup;
 
@@ -670,6 +912,7 @@ static void local_free(git_transport *transport)
 	transport_local *t = (transport_local *)transport;
 
 	free_heads(&t->refs);
+	git_array_clear(t->objects);
 
 	/* Close the transport, if it's still open. */
 	local_close(transport);
@@ -0,0 +1,994 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "git2/sys/server.h"
+#include "git2/graph.h"
+#include "git2/object.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+#include "git2/transaction.h"
+#include "git2/tree.h"
+
+#include "server.h"
+#include "smart.h"
+#include "config.h"
+#include "indexer.h"
+#include "odb.h"
+#include "refs.h"
+#include "repository.h"
+#include "revwalk.h"
+#include "pool.h"
+#include "oidmap.h"
+
+GIT__USE_OIDMAP
+
+typedef struct {
+	git_oid oid;
+	char name[GIT_FLEX_ARRAY];
+} advertised_ref;
+
+typedef struct {
+	git_receive_command command;
+
+	/* why the command was rejected; NULL while it's fine */
+	const char *error;
+
+	char refname[GIT_FLEX_ARRAY];
+} receive_command;
+
+typedef struct {
+	git_repository *repo;
+	const git_receive_pack_options *opts;
+	git_server_io io;
+
+	git_vector refs;
+	git_vector commands;
+
+	/* the branch which is checked out, in a repository with a workdir */
+	char *current_branch;
+
+	/* the capabilities the client asked for */
+	unsigned int report_status:1,
+		atomic:1,
+		sending_report:1;
+
+	unsigned int deny_deletes:1,
+		deny_non_fast_forwards:1,
+		deny_current_branch:1;
+
+	/* why the pack couldn't be stored, if it couldn't */
+	git_buf unpack_error;
+} receive_pack;
+
+static int ref_cmp(const void *a, const void *b)
+{
+	const advertised_ref *ref_a = a, *ref_b = b;
+	return strcmp(ref_a->name, ref_b->name);
+}
+
+static int load_config(receive_pack *rp)
+{
+	static const git_cvar_map deny_current_branch[] = {
+		{GIT_CVAR_FALSE, NULL, 0},
+		{GIT_CVAR_TRUE, NULL, 1},
+		{GIT_CVAR_STRING, "refuse", 1},
+		{GIT_CVAR_STRING, "warn", 0},
+		{GIT_CVAR_STRING, "ignore", 0},
+	};
+	git_config *cfg;
+	int deny, error;
+
+	if ((error = git_repository_config__weakptr(&cfg, rp->repo)) < 0)
+		return error;
+
+	rp->deny_deletes = git_config__get_bool_force(cfg, "receive.denydeletes", 0);
+	rp->deny_non_fast_forwards =
+		git_config__get_bool_force(cfg, "receive.denynonfastforwards", 0);
+
+	error = git_config_get_mapped(&deny, cfg, "receive.denyCurrentBranch",
+		deny_current_branch, ARRAY_SIZE(deny_current_branch));
+
+	if (error == GIT_ENOTFOUND) {
+		giterr_clear();
+		deny = 1;
+	} else if (error < 0) {
+		return error;
+	}
+
+	rp->deny_current_branch = deny;
+	return 0;
+}
+
+static int load_refs(receive_pack *rp)
+{
+	git_reference_iterator *iter = NULL;
+	git_reference *ref = NULL, *head = NULL;
+	advertised_ref *adv;
+	size_t namelen, alloclen;
+	int error;
+
+	if ((error = git_reference_iterator_new(&iter, rp->repo)) < 0)
+		return error;
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		if (git_reference_type(ref) == GIT_REF_OID) {
+			namelen = strlen(git_reference_name(ref));
+
+			GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(advertised_ref), namelen + 1);
+			adv = git__calloc(1, alloclen);
+			GITERR_CHECK_ALLOC(adv);
+
+			memcpy(adv->name, git_reference_name(ref), namelen + 1);
+			git_oid_cpy(&adv->oid, git_reference_target(ref));
+
+			if ((error = git_vector_insert(&rp->refs, adv)) < 0) {
+				git__free(adv);
+				goto done;
+			}
+		}
+
+		git_reference_free(ref);
+		ref = NULL;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	git_vector_sort(&rp->refs);
+	error = 0;
+
+	if (git_repository_is_bare(rp->repo))
+		goto done;
+
+	if ((error = git_reference_lookup(&head, rp->repo, GIT_HEAD_FILE)) < 0)
+		goto done;
+
+	if (git_reference_type(head) == GIT_REF_SYMBOLIC) {
+		rp->current_branch = git__strdup(git_reference_symbolic_target(head));
+		GITERR_CHECK_ALLOC(rp->current_branch);
+	}
+
+done:
+	git_reference_free(head);
+	git_reference_free(ref);
+	git_reference_iterator_free(iter);
+	return error;
+}
+
+static int advertise_refs(receive_pack *rp)
+{
+	static const char caps[] =
+		GIT_CAP_REPORT_STATUS " "
+		GIT_CAP_DELETE_REFS " "
+		GIT_CAP_SIDE_BAND_64K " "
+		GIT_CAP_ATOMIC " "
+		GIT_CAP_OFS_DELTA;
+	char oid[GIT_OID_HEXSZ + 1];
+	advertised_ref *ref;
+	size_t i;
+	int error = 0;
+
+	if (!rp->refs.length) {
+		git_oid zero = {{0}};
+
+		git_oid_tostr(oid, sizeof(oid), &zero);
+		error = git_server__send(&rp->io, "%s capabilities^{}%c%s", oid, '\0', caps);
+	}
+
+	git_vector_foreach(&rp->refs, i, ref) {
+		git_oid_tostr(oid, sizeof(oid), &ref->oid);
+
+		if (i == 0)
+			error = git_server__send(&rp->io, "%s %s%c%s", oid, ref->name, '\0', caps);
+		else
+			error = git_server__send(&rp->io, "%s %s", oid, ref->name);
+
+		if (error < 0)
+			return error;
+	}
+
+	return error ? error : git_server__send_flush(&rp->io);
+}
+
+static void parse_caps(receive_pack *rp, const char *caps)
+{
+	rp->report_status = git_server__has_cap(caps, GIT_CAP_REPORT_STATUS);
+	rp->atomic = git_server__has_cap(caps, GIT_CAP_ATOMIC);
+
+	if (git_server__has_cap(caps, GIT_CAP_SIDE_BAND_64K))
+		rp->io.sideband = GIT_SERVER_MAX_PKT;
+}
+
+/* "<old-id> <new-id> <refname>" */
+static int parse_command(receive_pack *rp, const char *line)
+{
+	receive_command *cmd;
+	git_oid old_id, new_id;
+	const char *ptr;
+	size_t namelen, alloclen;
+
+	if (git_server__parse_oid(&old_id, line, &ptr) < 0 || *ptr++ != ' ' ||
+		git_server__parse_oid(&new_id, ptr, &ptr) < 0 || *ptr++ != ' ' ||
+		!*ptr) {
+		giterr_set(GITERR_NET, "Invalid command '%s'", line);
+		return -1;
+	}
+
+	namelen = strlen(ptr);
+
+	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(receive_command), namelen + 1);
+	cmd = git__calloc(1, alloclen);
+	GITERR_CHECK_ALLOC(cmd);
+
+	memcpy(cmd->refname, ptr, namelen + 1);
+	cmd->command.refname = cmd->refname;
+	git_oid_cpy(&cmd->command.old_id, &old_id);
+	git_oid_cpy(&cmd->command.new_id, &new_id);
+
+	if (git_vector_insert(&rp->commands, cmd) < 0) {
+		git__free(cmd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns GIT_ITEROVER when the client has nothing to push */
+static int recv_commands(receive_pack *rp)
+{
+	git_buf line = GIT_BUF_INIT;
+	git_server_pkt_t type;
+	size_t len;
+	int error;
+
+	while ((error = git_server__recv(&type, &line, &rp->io)) == 0) {
+		if (type == GIT_SERVER_EOF) {
+			if (!rp->commands.length) {
+				error = GIT_ITEROVER;
+				break;
+			}
+
+			giterr_set(GITERR_NET, "Unexpected end of the commands");
+			error = -1;
+			break;
+		}
+
+		if (type == GIT_SERVER_FLUSH)
+			break;
+
+		if (!git__prefixcmp(line.ptr, "shallow ")) {
+			giterr_set(GITERR_NET, "Pushing from a shallow repository is not supported");
+			error = -1;
+			break;
+		}
+
+		/* the capabilities follow the first command */
+		if (!rp->commands.length && (len = strlen(line.ptr)) < line.size)
+			parse_caps(rp, line.ptr + len + 1);
+
+		if ((error = parse_command(rp, line.ptr)) < 0)
+			break;
+	}
+
+	if (!error && !rp->commands.length)
+		error = GIT_ITEROVER;
+
+	git_buf_free(&line);
+	return error;
+}
+
+static bool needs_pack(receive_pack *rp)
+{
+	receive_command *cmd;
+	size_t i;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (!git_oid_iszero(&cmd->command.new_id))
+			return true;
+	}
+
+	return false;
+}
+
+/* Stream the pack which follows the commands into the object database */
+static int recv_pack(receive_pack *rp)
+{
+	git_indexer *idx = NULL;
+	git_transfer_progress stats = {0};
+	git_buf path = GIT_BUF_INIT;
+	git_odb *odb;
+	const char *data;
+	size_t len;
+	int error;
+
+	if ((error = git_repository_odb__weakptr(&odb, rp->repo)) < 0 ||
+		(error = git_buf_joinpath(&path,
+			git_repository_path(rp->repo), GIT_OBJECTS_DIR "pack")) < 0 ||
+		(error = git_indexer_new(&idx, path.ptr, 0, odb, NULL, NULL)) < 0)
+		goto done;
+
+	while (!git_indexer__complete(idx, &stats)) {
+		if ((error = git_server__recv_data(&data, &len, &rp->io)) < 0)
+			goto done;
+
+		if (!len) {
+			giterr_set(GITERR_NET, "Early EOF in the pack");
+			error = -1;
+			goto done;
+		}
+
+		if ((error = git_indexer_append(idx, data, len, &stats)) < 0)
+			goto done;
+	}
+
+	/* an empty pack (say, for a new branch) leaves nothing behind */
+	if (stats.total_objects && (error = git_indexer_commit(idx, &stats)) == 0)
+		error = git_odb_refresh(odb);
+
+done:
+	git_indexer_free(idx);
+	git_buf_free(&path);
+	return error;
+}
+
+typedef struct {
+	git_repository *repo;
+	git_odb *odb;
+
+	/* the trees and blobs which are known to be complete */
+	git_oidmap *seen;
+	git_pool ids;
+} connectivity;
+
+static bool is_seen(connectivity *c, const git_oid *id)
+{
+	return git_oidmap_valid_index(c->seen, git_oidmap_lookup_index(c->seen, id));
+}
+
+static int mark_seen(connectivity *c, const git_oid *id)
+{
+	git_oid *key;
+	int error;
+
+	key = git_pool_malloc(&c->ids, 1);
+	GITERR_CHECK_ALLOC(key);
+
+	git_oid_cpy(key, id);
+	git_oidmap_insert(c->seen, key, key, error);
+
+	return error < 0 ? -1 : 0;
+}
+
+/*
+ * A tree is only marked once everything below it was found, so what
+ * is seen stays true when a later check fails halfway.
+ */
+static int check_tree(connectivity *c, const git_oid *id)
+{
+	git_tree *tree;
+	const git_tree_entry *entry;
+	size_t i;
+	int error = 0;
+
+	if (is_seen(c, id))
+		return 0;
+
+	if ((error = git_tree_lookup(&tree, c->repo, id)) < 0)
+		return error;
+
+	for (i = 0; !error && i < git_tree_entrycount(tree); i++) {
+		entry = git_tree_entry_byindex(tree, i);
+		id = git_tree_entry_id(entry);
+
+		/* a submodule's commits live elsewhere */
+		if (git_tree_entry_type(entry) == GIT_OBJ_COMMIT || is_seen(c, id))
+			continue;
+
+		if (git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+			error = check_tree(c, id);
+		} else if (!git_odb_exists(c->odb, id)) {
+			giterr_set(GITERR_ODB, "Missing blob '%s'", git_tree_entry_name(entry));
+			error = GIT_ENOTFOUND;
+		} else {
+			error = mark_seen(c, id);
+		}
+	}
+
+	if (!error)
+		error = mark_seen(c, git_tree_id(tree));
+
+	git_tree_free(tree);
+	return error;
+}
+
+static int check_tip(connectivity *c, git_revwalk *walk, const git_oid *id)
+{
+	git_object *obj, *target;
+	int error;
+
+	if ((error = git_object_lookup(&obj, c->repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	while (git_object_type(obj) == GIT_OBJ_TAG) {
+		error = git_tag_target(&target, (git_tag *)obj);
+		git_object_free(obj);
+
+		if (error < 0)
+			return error;
+
+		obj = target;
+	}
+
+	if (git_object_type(obj) == GIT_OBJ_COMMIT)
+		error = git_revwalk_push(walk, git_object_id(obj));
+	else if (git_object_type(obj) == GIT_OBJ_TREE)
+		error = check_tree(c, git_object_id(obj));
+
+	git_object_free(obj);
+	return error;
+}
+
+static int check_commit_tree(connectivity *c, const git_oid *id)
+{
+	git_commit *commit;
+	int error;
+
+	if ((error = git_commit_lookup(&commit, c->repo, id)) < 0)
+		return error;
+
+	error = check_tree(c, git_commit_tree_id(commit));
+
+	git_commit_free(commit);
+	return error;
+}
+
+/*
+ * Make sure everything the commands lead to is there, short of the
+ * history which our references lead to already. The trees of the
+ * commits we have at the edge of the new history are looked at first,
+ * so that the new trees only need checking where they changed.
+ * GIT_ENOTFOUND means that something is missing.
+ */
+static int check_connected(
+	connectivity *c, receive_pack *rp, receive_command **cmds, size_t len)
+{
+	git_array_oid_t commits = GIT_ARRAY_INIT;
+	git_revwalk *walk = NULL;
+	git_commit_list_node *node, *parent;
+	git_oid id, *entry;
+	unsigned short j;
+	size_t i;
+	int error;
+
+	if ((error = git_revwalk_new(&walk, rp->repo)) < 0 ||
+		(error = git_revwalk_hide_glob(walk, GIT_REFS_DIR "*")) < 0)
+		goto done;
+
+	for (i = 0; i < len; i++) {
+		if (git_oid_iszero(&cmds[i]->command.new_id))
+			continue;
+
+		if ((error = check_tip(c, walk, &cmds[i]->command.new_id)) < 0)
+			goto done;
+	}
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((entry = git_array_alloc(commits)) == NULL ||
+			(node = git_revwalk__commit_lookup(walk, &id)) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		git_oid_cpy(entry, &id);
+
+		for (j = 0; j < node->out_degree; j++) {
+			parent = git_commit_store_parent(&walk->store, node, j);
+
+			if (parent->uninteresting &&
+				(error = check_commit_tree(c, &parent->oid)) < 0)
+				goto done;
+		}
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	for (i = 0, error = 0; !error && i < git_array_size(commits); i++)
+		error = check_commit_tree(c, git_array_get(commits, i));
+
+done:
+	git_array_clear(commits);
+	git_revwalk_free(walk);
+	return error;
+}
+
+/* Check all the commands at once, and one by one if that fails */
+static int check_commands_connected(receive_pack *rp)
+{
+	receive_command **cmds = (receive_command **)rp->commands.contents;
+	connectivity c;
+	size_t i;
+	int error;
+
+	memset(&c, 0, sizeof(c));
+	c.repo = rp->repo;
+	git_pool_init(&c.ids, sizeof(git_oid));
+
+	if ((error = git_repository_odb__weakptr(&c.odb, rp->repo)) < 0)
+		goto done;
+
+	if ((c.seen = git_oidmap_alloc()) == NULL) {
+		giterr_set_oom();
+		error = -1;
+		goto done;
+	}
+
+	if ((error = check_connected(&c, rp, cmds, rp->commands.length)) != GIT_ENOTFOUND)
+		goto done;
+
+	for (i = 0; i < rp->commands.length; i++) {
+		if ((error = check_connected(&c, rp, &cmds[i], 1)) == GIT_ENOTFOUND)
+			cmds[i]->error = "missing necessary objects";
+		else if (error < 0)
+			goto done;
+	}
+
+	giterr_clear();
+	error = 0;
+
+done:
+	git_oidmap_free(c.seen);
+	git_pool_clear(&c.ids);
+	return error;
+}
+
+static int check_fast_forward(bool *out, receive_pack *rp, receive_command *cmd)
+{
+	git_object *old_obj = NULL, *new_obj = NULL;
+	int error = 0;
+
+	*out = true;
+
+	/* only commits can be fast-forwarded; we may not have the old one */
+	if (git_object_lookup(&old_obj, rp->repo, &cmd->command.old_id, GIT_OBJ_COMMIT) < 0 ||
+		git_object_lookup(&new_obj, rp->repo, &cmd->command.new_id, GIT_OBJ_COMMIT) < 0) {
+		giterr_clear();
+		goto done;
+	}
+
+	if ((error = git_graph_descendant_of(rp->repo,
+			&cmd->command.new_id, &cmd->command.old_id)) >= 0) {
+		*out = error || git_oid_equal(&cmd->command.new_id, &cmd->command.old_id);
+		error = 0;
+	}
+
+done:
+	git_object_free(old_obj);
+	git_object_free(new_obj);
+	return error;
+}
+
+static int check_command(receive_pack *rp, receive_command *cmd)
+{
+	bool is_delete = git_oid_iszero(&cmd->command.new_id), fast_forward;
+	int error;
+
+	if (git__prefixcmp(cmd->refname, GIT_REFS_DIR) != 0 ||
+		!git_reference_is_valid_name(cmd->refname)) {
+		cmd->error = "funny refname";
+		return 0;
+	}
+
+	if (rp->current_branch && !strcmp(cmd->refname, rp->current_branch)) {
+		if (is_delete) {
+			cmd->error = "deletion of the current branch prohibited";
+			return 0;
+		} else if (rp->deny_current_branch) {
+			cmd->error = "branch is currently checked out";
+			return 0;
+		}
+	}
+
+	if (is_delete && rp->deny_deletes) {
+		cmd->error = "deletion prohibited";
+		return 0;
+	}
+
+	if (!is_delete && !git_oid_iszero(&cmd->command.old_id) &&
+		rp->deny_non_fast_forwards) {
+		if ((error = check_fast_forward(&fast_forward, rp, cmd)) < 0)
+			return error;
+
+		if (!fast_forward) {
+			cmd->error = "non-fast-forward";
+			return 0;
+		}
+	}
+
+	if (rp->opts->update &&
+		rp->opts->update(&cmd->command, rp->opts->hook_payload) != 0)
+		cmd->error = "hook declined";
+
+	return 0;
+}
+
+static int collect_accepted(git_vector *out, receive_pack *rp)
+{
+	receive_command *cmd;
+	size_t i;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (!cmd->error && git_vector_insert(out, &cmd->command) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static void reject_all(receive_pack *rp, const char *reason)
+{
+	receive_command *cmd;
+	size_t i;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (!cmd->error)
+			cmd->error = reason;
+	}
+}
+
+static bool any_rejected(receive_pack *rp)
+{
+	receive_command *cmd;
+	size_t i;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (cmd->error)
+			return true;
+	}
+
+	return false;
+}
+
+static int run_pre_receive(receive_pack *rp)
+{
+	git_vector accepted = GIT_VECTOR_INIT;
+	int error;
+
+	if ((error = collect_accepted(&accepted, rp)) == 0 && accepted.length &&
+		rp->opts->pre_receive((const git_receive_command **)accepted.contents,
+			accepted.length, rp->opts->hook_payload) != 0)
+		reject_all(rp, "pre-receive hook declined");
+
+	git_vector_free(&accepted);
+	return error;
+}
+
+static void run_post_receive(receive_pack *rp)
+{
+	git_vector applied = GIT_VECTOR_INIT;
+
+	if (collect_accepted(&applied, rp) == 0 && applied.length)
+		rp->opts->post_receive((const git_receive_command **)applied.contents,
+			applied.length, rp->opts->hook_payload);
+
+	giterr_clear();
+	git_vector_free(&applied);
+}
+
+/* Lock the reference and make sure it still has the value the client saw */
+static int lock_command(git_transaction *tx, receive_pack *rp, receive_command *cmd)
+{
+	git_oid current;
+	int error;
+
+	if (git_transaction_lock_ref(tx, cmd->refname) < 0) {
+		cmd->error = "failed to lock";
+		goto done;
+	}
+
+	if ((error = git_reference_name_to_id(&current, rp->repo, cmd->refname)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		memset(&current, 0, sizeof(git_oid));
+	}
+
+	if (!git_oid_equal(&current, &cmd->command.old_id))
+		cmd->error = "stale info";
+
+done:
+	giterr_clear();
+	return 0;
+}
+
+/* Which updates made it when the transaction failed halfway */
+static int recheck_applied(receive_pack *rp)
+{
+	receive_command *cmd;
+	git_oid current;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (cmd->error)
+			continue;
+
+		if ((error = git_reference_name_to_id(&current, rp->repo, cmd->refname)) < 0) {
+			if (error != GIT_ENOTFOUND)
+				return error;
+
+			memset(&current, 0, sizeof(git_oid));
+		}
+
+		if (!git_oid_equal(&current, &cmd->command.new_id))
+			cmd->error = "failed to update ref";
+	}
+
+	giterr_clear();
+	return 0;
+}
+
+/* Put back the references an atomic push updated before it failed */
+static int roll_back_commands(receive_pack *rp)
+{
+	git_transaction *tx;
+	receive_command *cmd;
+	size_t i;
+	int error;
+
+	if ((error = git_transaction_new(&tx, rp->repo)) < 0)
+		return error;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (cmd->error)
+			continue;
+
+		if ((error = git_transaction_lock_ref(tx, cmd->refname)) < 0)
+			goto done;
+
+		if (git_oid_iszero(&cmd->command.old_id))
+			error = git_transaction_remove(tx, cmd->refname);
+		else
+			error = git_transaction_set_target(tx, cmd->refname,
+				&cmd->command.old_id, NULL, "push: roll back");
+
+		if (error < 0)
+			goto done;
+	}
+
+	error = git_transaction_commit(tx);
+
+done:
+	git_transaction_free(tx);
+	return error;
+}
+
+static int apply_commands(receive_pack *rp)
+{
+	git_transaction *tx = NULL;
+	receive_command *cmd;
+	size_t i;
+	int error;
+
+	if (rp->atomic && any_rejected(rp)) {
+		reject_all(rp, "atomic push failure");
+		return 0;
+	}
+
+	if ((error = git_transaction_new(&tx, rp->repo)) < 0)
+		return error;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (!cmd->error && (error = lock_command(tx, rp, cmd)) < 0)
+			goto done;
+	}
+
+	if (rp->atomic && any_rejected(rp)) {
+		reject_all(rp, "atomic push failure");
+		goto done;
+	}
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (cmd->error)
+			continue;
+
+		if (git_oid_iszero(&cmd->command.new_id))
+			error = git_transaction_remove(tx, cmd->refname);
+		else
+			error = git_transaction_set_target(tx, cmd->refname,
+				&cmd->command.new_id, NULL, "push");
+
+		if (error < 0)
+			goto done;
+	}
+
+	if (git_transaction_commit(tx) < 0 &&
+		(error = recheck_applied(rp)) == 0 && rp->atomic) {
+		/* the references are updated one by one */
+		git_transaction_free(tx);
+		tx = NULL;
+
+		if ((error = roll_back_commands(rp)) == 0)
+			reject_all(rp, "atomic push failure");
+	}
+
+done:
+	if (tx)
+		git_transaction_free(tx);
+	return error;
+}
+
+static int execute_commands(receive_pack *rp)
+{
+	receive_command *cmd;
+	size_t i;
+	int error;
+
+	if (needs_pack(rp) && recv_pack(rp) < 0) {
+		const git_error *e = giterr_last();
+
+		git_buf_puts(&rp->unpack_error, e ? e->message : "unknown error");
+		giterr_clear();
+
+		reject_all(rp, "unpacker error");
+		return git_buf_oom(&rp->unpack_error) ? -1 : 0;
+	}
+
+	if ((error = check_commands_connected(rp)) < 0)
+		return error;
+
+	if (rp->opts->pre_receive && (error = run_pre_receive(rp)) < 0)
+		return error;
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (!cmd->error && (error = check_command(rp, cmd)) < 0)
+			return error;
+	}
+
+	if ((error = apply_commands(rp)) < 0)
+		return error;
+
+	if (rp->opts->post_receive)
+		run_post_receive(rp);
+
+	return 0;
+}
+
+static int send_report(receive_pack *rp)
+{
+	git_buf report = GIT_BUF_INIT;
+	receive_command *cmd;
+	size_t i;
+	int error;
+
+	/* the report goes out on its own, for the side-band to wrap it */
+	if ((error = git_server__flush_output(&rp->io)) < 0)
+		return error;
+
+	rp->sending_report = 1;
+
+	if (rp->unpack_error.size)
+		error = git_server__send(&rp->io, "unpack %s", rp->unpack_error.ptr);
+	else
+		error = git_server__send(&rp->io, "unpack ok");
+
+	git_vector_foreach(&rp->commands, i, cmd) {
+		if (error < 0)
+			return error;
+
+		if (cmd->error)
+			error = git_server__send(&rp->io, "ng %s %s", cmd->refname, cmd->error);
+		else
+			error = git_server__send(&rp->io, "ok %s", cmd->refname);
+	}
+
+	if (error < 0 || (error = git_server__send_flush(&rp->io)) < 0 ||
+		!rp->io.sideband)
+		return error;
+
+	git_buf_swap(&report, &rp->io.out);
+
+	error = git_server__send_band(&rp->io, GIT_SIDE_BAND_DATA, report.ptr, report.size);
+
+	git_buf_free(&report);
+	return error;
+}
+
+/* Let the client know why we're giving up, if we still can */
+static void send_error(receive_pack *rp)
+{
+	const git_error *e = giterr_last();
+	const char *msg = e ? e->message : "unknown error";
+	git_buf buf = GIT_BUF_INIT;
+
+	if (!rp->io.sideband) {
+		git_server__send(&rp->io, "ERR %s", msg);
+	} else {
+		git_buf_printf(&buf, "error: %s\n", msg);
+		git_server__send_band(&rp->io, GIT_SIDE_BAND_ERROR, buf.ptr, buf.size);
+		git_server__send_flush(&rp->io);
+		git_buf_free(&buf);
+	}
+
+	git_server__flush_output(&rp->io);
+}
+
+int git_receive_pack_init_options(git_receive_pack_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_receive_pack_options, GIT_RECEIVE_PACK_OPTIONS_INIT);
+	return 0;
+}
+
+int git_receive_pack(git_repository *repo, const git_receive_pack_options *opts)
+{
+	receive_pack rp;
+	advertised_ref *ref;
+	receive_command *cmd;
+	size_t i;
+	int error;
+
+	assert(repo && opts);
+
+	GITERR_CHECK_VERSION(opts, GIT_RECEIVE_PACK_OPTIONS_VERSION, "git_receive_pack_options");
+
+	if (!opts->read || !opts->write) {
+		giterr_set(GITERR_INVALID, "receive-pack needs read and write callbacks");
+		return -1;
+	}
+
+	memset(&rp, 0, sizeof(receive_pack));
+	rp.repo = repo;
+	rp.opts = opts;
+	git_server__io_init(&rp.io, opts->read, opts->write, opts->payload);
+	git_buf_init(&rp.unpack_error, 0);
+
+	if ((error = git_vector_init(&rp.refs, 16, ref_cmp)) < 0 ||
+		(error = git_vector_init(&rp.commands, 4, NULL)) < 0 ||
+		(error = load_config(&rp)) < 0 ||
+		(error = load_refs(&rp)) < 0)
+		goto done;
+
+	if (!opts->stateless_rpc || opts->advertise_refs) {
+		if ((error = advertise_refs(&rp)) < 0 ||
+			(error = git_server__flush_output(&rp.io)) < 0 ||
+			opts->advertise_refs)
+			goto done;
+	}
+
+	if ((error = recv_commands(&rp)) < 0 ||
+		(error = execute_commands(&rp)) < 0)
+		goto done;
+
+	if (rp.report_status && (error = send_report(&rp)) < 0)
+		goto done;
+
+	if (rp.io.sideband && (error = git_server__send_flush(&rp.io)) < 0)
+		goto done;
+
+	error = git_server__flush_output(&rp.io);
+
+done:
+	if (error == GIT_ITEROVER)
+		error = 0;
+	else if (error < 0 && !rp.sending_report)
+		send_error(&rp);
+
+	git_vector_foreach(&rp.refs, i, ref)
+		git__free(ref);
+
+	git_vector_foreach(&rp.commands, i, cmd)
+		git__free(cmd);
+
+	git_vector_free(&rp.refs);
+	git_vector_free(&rp.commands);
+	git__free(rp.current_branch);
+	git_buf_free(&rp.unpack_error);
+	git_server__io_free(&rp.io);
+	return error;
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "server.h"
+
+#define READ_SIZE (64 * 1024)
+
+/* Output past this size is handed over while we keep writing */
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+void git_server__io_init(
+	git_server_io *io,
+	git_server_read_cb read,
+	git_server_write_cb write,
+	void *payload)
+{
+	memset(io, 0, sizeof(git_server_io));
+
+	io->read = read;
+	io->write = write;
+	io->payload = payload;
+
+	git_buf_init(&io->in, 0);
+	git_buf_init(&io->out, 0);
+}
+
+void git_server__io_free(git_server_io *io)
+{
+	git_buf_free(&io->in);
+	git_buf_free(&io->out);
+}
+
+/* Make sure `len` unconsumed bytes are buffered; 0 if the input ended */
+static int fill(git_server_io *io, size_t len)
+{
+	size_t bytes_read;
+	int error;
+
+	if (io->in_pos) {
+		git_buf_consume(&io->in, io->in.ptr + io->in_pos);
+		io->in_pos = 0;
+	}
+
+	while (io->in.size < len) {
+		if (git_buf_grow_by(&io->in, READ_SIZE) < 0)
+			return -1;
+
+		bytes_read = 0;
+
+		if ((error = io->read(io->in.ptr + io->in.size,
+				io->in.asize - io->in.size - 1, &bytes_read, io->payload)) < 0) {
+			if (!giterr_last())
+				giterr_set(GITERR_NET, "Failed to read the request");
+			return error;
+		}
+
+		if (!bytes_read)
+			return 0;
+
+		io->in.size += bytes_read;
+		io->in.ptr[io->in.size] = '\0';
+	}
+
+	return 1;
+}
+
+static int parse_len(size_t *out, const char *ptr)
+{
+	size_t len = 0;
+	int i, v;
+
+	for (i = 0; i < 4; i++) {
+		if ((v = git__fromhex(ptr[i])) < 0) {
+			giterr_set(GITERR_NET, "Invalid pkt-line length");
+			return -1;
+		}
+
+		len = (len << 4) | v;
+	}
+
+	*out = len;
+	return 0;
+}
+
+static void set_len(char *ptr, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for (i = 3; i >= 0; i--, len >>= 4)
+		ptr[i] = hex[len & 0xf];
+}
+
+int git_server__recv(git_server_pkt_t *type, git_buf *line, git_server_io *io)
+{
+	size_t len;
+	int error;
+
+	git_buf_clear(line);
+
+	if ((error = fill(io, 4)) < 0)
+		return error;
+
+	if (!error) {
+		if (io->in.size) {
+			giterr_set(GITERR_NET, "Unexpected end of the request");
+			return -1;
+		}
+
+		*type = GIT_SERVER_EOF;
+		return 0;
+	}
+
+	if (parse_len(&len, io->in.ptr) < 0)
+		return -1;
+
+	if (len == 0 || len == 1) {
+		io->in_pos = 4;
+		*type = len ? GIT_SERVER_DELIM : GIT_SERVER_FLUSH;
+		return 0;
+	}
+
+	if (len < 4 || len > GIT_SERVER_MAX_PKT) {
+		giterr_set(GITERR_NET, "Invalid pkt-line length %"PRIuZ, len);
+		return -1;
+	}
+
+	if ((error = fill(io, len)) <= 0) {
+		if (!error)
+			giterr_set(GITERR_NET, "Unexpected end of the request");
+		return -1;
+	}
+
+	len -= 4;
+
+	if (len && io->in.ptr[4 + len - 1] == '\n')
+		git_buf_put(line, io->in.ptr + 4, len - 1);
+	else
+		git_buf_put(line, io->in.ptr + 4, len);
+
+	io->in_pos = 4 + len;
+	*type = GIT_SERVER_LINE;
+
+	return git_buf_oom(line) ? -1 : 0;
+}
+
+int git_server__recv_data(const char **data, size_t *len, git_server_io *io)
+{
+	int error;
+
+	if (io->in_pos == io->in.size && (error = fill(io, 1)) < 0)
+		return error;
+
+	*data = io->in.ptr + io->in_pos;
+	*len = io->in.size - io->in_pos;
+
+	io->in_pos = io->in.size;
+	return 0;
+}
+
+bool git_server__has_cap(const char *caps, const char *cap)
+{
+	const char *ptr = caps;
+	size_t len = strlen(cap);
+
+	while ((ptr = strstr(ptr, cap)) != NULL) {
+		if ((ptr[len] == ' ' || ptr[len] == '\0') &&
+			(ptr == caps || ptr[-1] == ' '))
+			return true;
+
+		ptr += len;
+	}
+
+	return false;
+}
+
+int git_server__parse_oid(git_oid *out, const char *line, const char **end)
+{
+	if (strlen(line) < GIT_OID_HEXSZ ||
+		git_oid_fromstrn(out, line, GIT_OID_HEXSZ) < 0 ||
+		(line[GIT_OID_HEXSZ] != '\0' && line[GIT_OID_HEXSZ] != ' ')) {
+		giterr_set(GITERR_NET, "Invalid object id in '%s'", line);
+		return -1;
+	}
+
+	if (end)
+		*end = line + GIT_OID_HEXSZ;
+
+	return 0;
+}
+
+int git_server__send(git_server_io *io, const char *fmt, ...)
+{
+	va_list ap;
+	size_t start = io->out.size;
+
+	/* the length is filled in once we know it */
+	git_buf_puts(&io->out, "0000");
+
+	va_start(ap, fmt);
+	git_buf_vprintf(&io->out, fmt, ap);
+	va_end(ap);
+
+	git_buf_putc(&io->out, '\n');
+
+	if (git_buf_oom(&io->out))
+		return -1;
+
+	if (io->out.size - start > GIT_SERVER_MAX_PKT) {
+		giterr_set(GITERR_NET, "pkt-line too long");
+		git_buf_truncate(&io->out, start);
+		return -1;
+	}
+
+	set_len(io->out.ptr + start, io->out.size - start);
+
+	return 0;
+}
+
+int git_server__send_data(git_server_io *io, const char *data, size_t len)
+{
+	assert(len + 4 <= GIT_SERVER_MAX_PKT);
+
+	git_buf_printf(&io->out, "%04x", (unsigned int)(len + 4));
+	git_buf_put(&io->out, data, len);
+
+	return git_buf_oom(&io->out) ? -1 : 0;
+}
+
+int git_server__send_flush(git_server_io *io)
+{
+	return git_buf_puts(&io->out, "0000");
+}
+
+int git_server__send_delim(git_server_io *io)
+{
+	return git_buf_puts(&io->out, "0001");
+}
+
+int git_server__send_band(
+	git_server_io *io, int band, const char *data, size_t len)
+{
+	size_t chunk;
+	int error;
+
+	if (!io->sideband) {
+		if (band != 1)
+			return 0;
+
+		if (git_buf_put(&io->out, data, len) < 0)
+			return -1;
+	}
+
+	while (io->sideband && len) {
+		chunk = min(len, io->sideband - 5);
+
+		git_buf_printf(&io->out, "%04x%c", (unsigned int)(chunk + 5), band);
+		git_buf_put(&io->out, data, chunk);
+
+		if (git_buf_oom(&io->out))
+			return -1;
+
+		data += chunk;
+		len -= chunk;
+	}
+
+	if (io->out.size >= OUTPUT_BUFFER_SIZE &&
+		(error = git_server__flush_output(io)) < 0)
+		return error;
+
+	return 0;
+}
+
+int git_server__flush_output(git_server_io *io)
+{
+	int error;
+
+	if (!io->out.size)
+		return 0;
+
+	if ((error = io->write(io->out.ptr, io->out.size, io->payload)) < 0) {
+		if (!giterr_last())
+			giterr_set(GITERR_NET, "Failed to write the response");
+		return error;
+	}
+
+	git_buf_clear(&io->out);
+	return 0;
+}
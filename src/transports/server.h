@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_transports_server_h__
+#define INCLUDE_transports_server_h__
+
+#include "common.h"
+#include "buffer.h"
+#include "git2/oid.h"
+#include "git2/sys/server.h"
+
+/* The largest pkt-line, including the length */
+#define GIT_SERVER_MAX_PKT 65520
+
+typedef enum {
+	GIT_SERVER_LINE,
+	GIT_SERVER_FLUSH,
+	GIT_SERVER_DELIM, /* between the sections of a v2 request */
+	GIT_SERVER_EOF,
+} git_server_pkt_t;
+
+/*
+ * The pkt-line framing on top of the embedder's I/O callbacks. Output
+ * is buffered until the other end needs to see it.
+ */
+typedef struct {
+	git_server_read_cb read;
+	git_server_write_cb write;
+	void *payload;
+
+	git_buf in;
+	size_t in_pos;
+	git_buf out;
+
+	/* the largest side-band packet; 0 without side-band */
+	size_t sideband;
+} git_server_io;
+
+void git_server__io_init(
+	git_server_io *io,
+	git_server_read_cb read,
+	git_server_write_cb write,
+	void *payload);
+
+void git_server__io_free(git_server_io *io);
+
+/*
+ * Receive a pkt-line into `line`, without its trailing LF. End of input
+ * is only fine between two pkt-lines.
+ */
+int git_server__recv(git_server_pkt_t *type, git_buf *line, git_server_io *io);
+
+/*
+ * Hand out the input which follows the pkt-lines as it is, such as a
+ * pack; `len` is 0 once the input is over.
+ */
+int git_server__recv_data(const char **data, size_t *len, git_server_io *io);
+
+/* Whether `cap` is in the space-separated list `caps` */
+bool git_server__has_cap(const char *caps, const char *cap);
+
+/* Parse the object id at the start of `line`; `end` is set past it */
+int git_server__parse_oid(git_oid *out, const char *line, const char **end);
+
+/* Buffer a pkt-line; a LF is appended */
+int git_server__send(git_server_io *io, const char *fmt, ...) GIT_FORMAT_PRINTF(2, 3);
+
+/* Buffer a pkt-line which carries `len` bytes of `data` as they are */
+int git_server__send_data(git_server_io *io, const char *data, size_t len);
+
+int git_server__send_flush(git_server_io *io);
+
+int git_server__send_delim(git_server_io *io);
+
+/*
+ * Buffer `data` on a side-band channel, in as many packets as it
+ * takes; without side-band, the pack data is sent as it is and the
+ * other channels are dropped.
+ */
+int git_server__send_band(
+	git_server_io *io, int band, const char *data, size_t len);
+
+/* Hand the buffered output over to the write callback */
+int git_server__flush_output(git_server_io *io);
+
+#endif
@@ -8,6 +8,8 @@
 #include "smart.h"
 #include "refs.h"
 #include "refspec.h"
+#include "remote.h"
+#include "repository.h"
 
 static int git_smart__recv_cb(gitno_buffer *buf)
 {
@@ -194,6 +196,42 @@ static void free_symrefs(git_vector *symrefs)
 	git_vector_free(symrefs);
 }
 
+/*
+ * Protocol v2 is only spoken for fetches, unless "protocol.version"
+ * asks for one of the older protocols.
+ */
+static int wanted_version(transport_smart *t, int direction)
+{
+	git_config *cfg;
+	int32_t version;
+	int error;
+
+	if (direction != GIT_DIRECTION_FETCH)
+		return 0;
+
+	if (!t->owner || !t->owner->repo)
+		return GIT_PROTOCOL_VERSION_2;
+
+	if ((error = git_repository_config__weakptr(&cfg, t->owner->repo)) < 0)
+		return error;
+
+	if ((error = git_config_get_int32(&version, cfg, "protocol.version")) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		giterr_clear();
+		return GIT_PROTOCOL_VERSION_2;
+	}
+
+	if (version < 0 || version > GIT_PROTOCOL_VERSION_2) {
+		giterr_set(GITERR_CONFIG, "Unknown value for 'protocol.version': %d", version);
+		return -1;
+	}
+
+	/* version 1 is version 0 with an announcement */
+	return version == GIT_PROTOCOL_VERSION_2 ? version : 0;
+}
+
 static int git_smart__connect(
 	git_transport *transport,
 	const char *url,
@@ -221,6 +259,9 @@ static int git_smart__connect(
 	t->cred_acquire_cb = cred_acquire_cb;
 	t->cred_acquire_payload = cred_acquire_payload;
 
+	if ((t->version = wanted_version(t, direction)) < 0)
+		return t->version;
+
 	if (GIT_DIRECTION_FETCH == t->direction)
 		service = GIT_SERVICE_UPLOADPACK_LS;
 	else if (GIT_DIRECTION_PUSH == t->direction)
@@ -238,6 +279,22 @@ static int git_smart__connect(
 
 	gitno_buffer_setup_callback(&t->buffer, t->buffer_data, sizeof(t->buffer_data), git_smart__recv_cb, t);
 
+	if (t->version == GIT_PROTOCOL_VERSION_2 &&
+		(error = git_smart__detect_version(t)) < 0)
+		return error;
+
+	if (t->version == GIT_PROTOCOL_VERSION_2) {
+		if ((error = git_smart__ls_refs(t)) < 0)
+			return error;
+
+		t->have_refs = 1;
+
+		if ((error = git_smart__update_heads(t, NULL)) < 0)
+			return error;
+
+		goto connected;
+	}
+
 	/* 2 flushes for RPC; 1 for stateful */
 	if ((error = git_smart__store_refs(t, t->rpc ? 2 : 1)) < 0)
 		return error;
@@ -280,6 +337,7 @@ static int git_smart__connect(
 
 	free_symrefs(&symrefs);
 
+connected:
 	if (t->rpc && git_smart__reset_stream(t, false) < 0)
 		return -1;
 
@@ -21,10 +21,18 @@
 #define GIT_CAP_SIDE_BAND "side-band"
 #define GIT_CAP_SIDE_BAND_64K "side-band-64k"
 #define GIT_CAP_INCLUDE_TAG "include-tag"
+#define GIT_CAP_NO_PROGRESS "no-progress"
 #define GIT_CAP_DELETE_REFS "delete-refs"
 #define GIT_CAP_REPORT_STATUS "report-status"
+#define GIT_CAP_ATOMIC "atomic"
+#define GIT_CAP_PUSH_OPTIONS "push-options"
 #define GIT_CAP_THIN_PACK "thin-pack"
 #define GIT_CAP_SYMREF "symref"
+#define GIT_CAP_SHALLOW "shallow"
+#define GIT_CAP_DEEPEN_SINCE "deepen-since"
+#define GIT_CAP_FILTER "filter"
+
+#define GIT_PROTOCOL_VERSION_2 2
 
 enum git_pkt_type {
 	GIT_PKT_CMD,
@@ -41,6 +49,11 @@ enum git_pkt_type {
 	GIT_PKT_OK,
 	GIT_PKT_NG,
 	GIT_PKT_UNPACK,
+	GIT_PKT_SHALLOW,
+	GIT_PKT_UNSHALLOW,
+	GIT_PKT_DELIM,
+	GIT_PKT_RESPONSE_END,
+	GIT_PKT_TEXT,
 };
 
 /* Used for multi_ack and mutli_ack_detailed */
@@ -112,6 +125,19 @@ typedef struct {
 	int unpack_ok;
 } git_pkt_unpack;
 
+/* Used for both "shallow" and "unshallow" lines */
+typedef struct {
+	enum git_pkt_type type;
+	git_oid oid;
+} git_pkt_shallow;
+
+/* An uninterpreted line of a protocol v2 response, without its LF */
+typedef struct {
+	enum git_pkt_type type;
+	size_t len;
+	char text[GIT_FLEX_ARRAY];
+} git_pkt_text;
+
 typedef struct transport_smart_caps {
 	int common:1,
 		ofs_delta:1,
@@ -122,7 +148,14 @@ typedef struct transport_smart_caps {
 		include_tag:1,
 		delete_refs:1,
 		report_status:1,
-		thin_pack:1;
+		atomic:1,
+		push_options:1,
+		thin_pack:1,
+		shallow:1,
+		deepen_since:1,
+		filter:1,
+		ls_refs:1,
+		fetch:1;
 } transport_smart_caps;
 
 typedef int (*packetsize_cb)(size_t received, void *payload);
@@ -143,6 +176,8 @@ typedef struct {
 	git_smart_subtransport *wrapped;
 	git_smart_subtransport_stream *current_stream;
 	transport_smart_caps caps;
+	/* protocol version asked for on connect; zero once the server refuses it */
+	int version;
 	git_vector refs;
 	git_vector heads;
 	git_vector common;
@@ -159,6 +194,8 @@ typedef struct {
 /* smart_protocol.c */
 int git_smart__store_refs(transport_smart *t, int flushes);
 int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vector *symrefs);
+int git_smart__detect_version(transport_smart *t);
+int git_smart__ls_refs(transport_smart *t);
 int git_smart__push(git_transport *transport, git_push *push, const git_remote_callbacks *cbs);
 
 int git_smart__negotiate_fetch(
@@ -182,9 +219,16 @@ int git_smart__update_heads(transport_smart *t, git_vector *symrefs);
 
 /* smart_pkt.c */
 int git_pkt_parse_line(git_pkt **head, const char *line, const char **out, size_t len);
+int git_pkt_parse_text(git_pkt **head, const char *line, const char **out, size_t len);
 int git_pkt_buffer_flush(git_buf *buf);
+int git_pkt_buffer_delim(git_buf *buf);
+int git_pkt_buffer_text(git_buf *buf, const char *text);
 int git_pkt_send_flush(GIT_SOCKET s);
 int git_pkt_buffer_done(git_buf *buf);
 int git_pkt_buffer_wants(const git_remote_head * const *refs, size_t count, transport_smart_caps *caps, git_buf *buf);
 int git_pkt_buffer_have(git_oid *oid, git_buf *buf);
+int git_pkt_buffer_shallow(const git_oid *oid, git_buf *buf);
+int git_pkt_buffer_deepen(int depth, git_buf *buf);
+int git_pkt_buffer_deepen_since(git_time_t since, git_buf *buf);
+int git_pkt_buffer_filter(const char *filter, git_buf *buf);
 void git_pkt_free(git_pkt *pkt);
@@ -23,6 +23,7 @@
 #define PKT_LEN_SIZE 4
 static const char pkt_done_str[] = "0009done\n";
 static const char pkt_flush_str[] = "0000";
+static const char pkt_delim_str[] = "0001";
 static const char pkt_have_prefix[] = "0032have ";
 static const char pkt_want_prefix[] = "0032want ";
 
@@ -39,6 +40,20 @@ static int flush_pkt(git_pkt **out)
 	return 0;
 }
 
+/* protocol v2 separates the sections of a message with "0001" */
+static int delim_pkt(git_pkt **out, enum git_pkt_type type)
+{
+	git_pkt *pkt;
+
+	pkt = git__malloc(sizeof(git_pkt));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = type;
+	*out = pkt;
+
+	return 0;
+}
+
 /* the rest of the line will be useful for multi_ack and multi_ack_detailed */
 static int ack_pkt(git_pkt **out, const char *line, size_t len)
 {
@@ -59,7 +74,7 @@ static int ack_pkt(git_pkt **out, const char *line, size_t len)
 		len -= GIT_OID_HEXSZ + 1;
 	}
 
-	if (len >= 7) {
+	if (len >= 6) {
 		if (!git__prefixcmp(line + 1, "continue"))
 			pkt->status = GIT_ACK_CONTINUE;
 		if (!git__prefixcmp(line + 1, "common"))
@@ -99,6 +114,56 @@ static int pack_pkt(git_pkt **out)
 	return 0;
 }
 
+static int shallow_pkt(
+	git_pkt **out, enum git_pkt_type type, const char *line, size_t len)
+{
+	git_pkt_shallow *pkt;
+	size_t prefix_len = (type == GIT_PKT_SHALLOW) ?
+		strlen("shallow ") : strlen("unshallow ");
+
+	if (len < prefix_len + GIT_OID_HEXSZ) {
+		giterr_set(GITERR_NET, "Invalid shallow line");
+		return -1;
+	}
+
+	pkt = git__calloc(1, sizeof(git_pkt_shallow));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = type;
+
+	if (git_oid_fromstrn(&pkt->oid, line + prefix_len, GIT_OID_HEXSZ) < 0) {
+		git__free(pkt);
+		giterr_set(GITERR_NET, "Invalid shallow line");
+		return -1;
+	}
+
+	*out = (git_pkt *) pkt;
+	return 0;
+}
+
+static int text_pkt(git_pkt **out, const char *line, size_t len)
+{
+	git_pkt_text *pkt;
+	size_t alloclen;
+
+	if (len > 0 && line[len - 1] == '\n')
+		len--;
+
+	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(git_pkt_text), len);
+	GITERR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+	pkt = git__malloc(alloclen);
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_TEXT;
+	pkt->len = len;
+	memcpy(pkt->text, line, len);
+	pkt->text[len] = '\0';
+
+	*out = (git_pkt *) pkt;
+
+	return 0;
+}
+
 static int comment_pkt(git_pkt **out, const char *line, size_t len)
 {
 	git_pkt_comment *pkt;
@@ -438,6 +503,16 @@ int git_pkt_parse_line(
 		return flush_pkt(head);
 	}
 
+	if (len == 1 || len == 2) {
+		*out = line;
+		return delim_pkt(head, len == 1 ? GIT_PKT_DELIM : GIT_PKT_RESPONSE_END);
+	}
+
+	if (len < PKT_LEN_SIZE) {
+		giterr_set(GITERR_NET, "Invalid pkt-line length %d", (int)len);
+		return -1;
+	}
+
 	len -= PKT_LEN_SIZE; /* the encoded length includes its own size */
 
 	if (*line == GIT_SIDE_BAND_DATA)
@@ -460,6 +535,10 @@ int git_pkt_parse_line(
 		ret = ng_pkt(head, line, len);
 	else if (!git__prefixcmp(line, "unpack"))
 		ret = unpack_pkt(head, line, len);
+	else if (!git__prefixcmp(line, "shallow "))
+		ret = shallow_pkt(head, GIT_PKT_SHALLOW, line, len);
+	else if (!git__prefixcmp(line, "unshallow "))
+		ret = shallow_pkt(head, GIT_PKT_UNSHALLOW, line, len);
 	else
 		ret = ref_pkt(head, line, len);
 
@@ -468,6 +547,51 @@ int git_pkt_parse_line(
 	return ret;
 }
 
+/*
+ * Lines of a protocol v2 response only make sense within the section
+ * they're in, so hand them back as text, recognizing only the special
+ * packets and errors.
+ */
+int git_pkt_parse_text(
+	git_pkt **head, const char *line, const char **out, size_t bufflen)
+{
+	int32_t len;
+
+	if (bufflen > 0 && bufflen < PKT_LEN_SIZE)
+		return GIT_EBUFS;
+
+	if ((len = parse_len(line)) < 0)
+		return (int)len;
+
+	if (bufflen > 0 && bufflen < (size_t)len)
+		return GIT_EBUFS;
+
+	line += PKT_LEN_SIZE;
+
+	if (len == 0) {
+		*out = line;
+		return flush_pkt(head);
+	}
+
+	if (len == 1 || len == 2) {
+		*out = line;
+		return delim_pkt(head, len == 1 ? GIT_PKT_DELIM : GIT_PKT_RESPONSE_END);
+	}
+
+	if (len < PKT_LEN_SIZE) {
+		giterr_set(GITERR_NET, "Invalid pkt-line length %d", (int)len);
+		return -1;
+	}
+
+	len -= PKT_LEN_SIZE;
+	*out = line + len;
+
+	if (len >= 4 && !git__prefixcmp(line, "ERR "))
+		return err_pkt(head, line, len);
+
+	return text_pkt(head, line, len);
+}
+
 void git_pkt_free(git_pkt *pkt)
 {
 	if (pkt->type == GIT_PKT_REF) {
@@ -495,6 +619,17 @@ int git_pkt_buffer_flush(git_buf *buf)
 	return git_buf_put(buf, pkt_flush_str, strlen(pkt_flush_str));
 }
 
+int git_pkt_buffer_delim(git_buf *buf)
+{
+	return git_buf_put(buf, pkt_delim_str, strlen(pkt_delim_str));
+}
+
+int git_pkt_buffer_text(git_buf *buf, const char *text)
+{
+	return git_buf_printf(buf, "%04x%s\n",
+		(unsigned int)(PKT_LEN_SIZE + strlen(text) + 1), text);
+}
+
 static int buffer_want_with_caps(const git_remote_head *head, transport_smart_caps *caps, git_buf *buf)
 {
 	git_buf str = GIT_BUF_INIT;
@@ -522,6 +657,12 @@ static int buffer_want_with_caps(const git_remote_head *head, transport_smart_ca
 	if (caps->ofs_delta)
 		git_buf_puts(&str, GIT_CAP_OFS_DELTA " ");
 
+	if (caps->deepen_since)
+		git_buf_puts(&str, GIT_CAP_DEEPEN_SINCE " ");
+
+	if (caps->filter)
+		git_buf_puts(&str, GIT_CAP_FILTER " ");
+
 	if (git_buf_oom(&str))
 		return -1;
 
@@ -585,7 +726,7 @@ int git_pkt_buffer_wants(
 			return -1;
 	}
 
-	return git_pkt_buffer_flush(buf);
+	return 0;
 }
 
 int git_pkt_buffer_have(git_oid *oid, git_buf *buf)
@@ -597,6 +738,39 @@ int git_pkt_buffer_have(git_oid *oid, git_buf *buf)
 	return git_buf_printf(buf, "%s%s\n", pkt_have_prefix, oidhex);
 }
 
+int git_pkt_buffer_shallow(const git_oid *oid, git_buf *buf)
+{
+	char oidhex[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(oidhex, sizeof(oidhex), oid);
+	return git_buf_printf(buf, "%04xshallow %s\n",
+		(unsigned int)(PKT_LEN_SIZE + strlen("shallow ") + GIT_OID_HEXSZ + 1), oidhex);
+}
+
+int git_pkt_buffer_deepen(int depth, git_buf *buf)
+{
+	char line[32];
+
+	p_snprintf(line, sizeof(line), "deepen %d\n", depth);
+	return git_buf_printf(buf, "%04x%s",
+		(unsigned int)(PKT_LEN_SIZE + strlen(line)), line);
+}
+
+int git_pkt_buffer_deepen_since(git_time_t since, git_buf *buf)
+{
+	char line[48];
+
+	p_snprintf(line, sizeof(line), "deepen-since %lld\n", (long long)since);
+	return git_buf_printf(buf, "%04x%s",
+		(unsigned int)(PKT_LEN_SIZE + strlen(line)), line);
+}
+
+int git_pkt_buffer_filter(const char *filter, git_buf *buf)
+{
+	return git_buf_printf(buf, "%04xfilter %s\n",
+		(unsigned int)(PKT_LEN_SIZE + strlen("filter ") + strlen(filter) + 1), filter);
+}
+
 int git_pkt_buffer_done(git_buf *buf)
 {
 	return git_buf_puts(buf, pkt_done_str);
@@ -8,16 +8,33 @@
 #include "git2/odb_backend.h"
 
 #include "smart.h"
+#include "negotiator.h"
 #include "refs.h"
 #include "repository.h"
 #include "push.h"
 #include "pack-objects.h"
 #include "remote.h"
+#include "shallow.h"
 #include "util.h"
 
 #define NETWORK_XFER_THRESHOLD (100*1024)
 /* The minimal interval between progress updates (in seconds). */
 #define MIN_PROGRESS_UPDATE_INTERVAL 0.5
+/* Give up negotiating after this many haves without a new common commit */
+#define MAX_IN_VAIN 256
+/* The longest pkt-line the other side has to accept */
+#define MAX_PKT_LEN 65520
+
+/*
+ * Report the error the server sent. A server which doesn't have an
+ * object we asked for refuses it as "not our ref"; that is
+ * GIT_ENOTFOUND, so the caller can tell it from a failed transfer.
+ */
+static int remote_error(const git_pkt_err *pkt)
+{
+	giterr_set(GITERR_NET, "Remote error: %s", pkt->error);
+	return strstr(pkt->error, "not our ref") ? GIT_ENOTFOUND : -1;
+}
 
 int git_smart__store_refs(transport_smart *t, int flushes)
 {
@@ -60,9 +77,9 @@ int git_smart__store_refs(transport_smart *t, int flushes)
 
 		gitno_consume(buf, line_end);
 		if (pkt->type == GIT_PKT_ERR) {
-			giterr_set(GITERR_NET, "Remote error: %s", ((git_pkt_err *)pkt)->error);
+			error = remote_error((git_pkt_err *)pkt);
 			git__free(pkt);
-			return -1;
+			return error;
 		}
 
 		if (pkt->type != GIT_PKT_FLUSH && git_vector_insert(refs, pkt) < 0)
@@ -180,12 +197,42 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vec
 			continue;
 		}
 
+		if (!git__prefixcmp(ptr, GIT_CAP_ATOMIC)) {
+			caps->common = caps->atomic = 1;
+			ptr += strlen(GIT_CAP_ATOMIC);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_PUSH_OPTIONS)) {
+			caps->common = caps->push_options = 1;
+			ptr += strlen(GIT_CAP_PUSH_OPTIONS);
+			continue;
+		}
+
 		if (!git__prefixcmp(ptr, GIT_CAP_THIN_PACK)) {
 			caps->common = caps->thin_pack = 1;
 			ptr += strlen(GIT_CAP_THIN_PACK);
 			continue;
 		}
 
+		if (!git__prefixcmp(ptr, GIT_CAP_SHALLOW)) {
+			caps->common = caps->shallow = 1;
+			ptr += strlen(GIT_CAP_SHALLOW);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_DEEPEN_SINCE)) {
+			caps->common = caps->deepen_since = 1;
+			ptr += strlen(GIT_CAP_DEEPEN_SINCE);
+			continue;
+		}
+
+		if (!git__prefixcmp(ptr, GIT_CAP_FILTER)) {
+			caps->common = caps->filter = 1;
+			ptr += strlen(GIT_CAP_FILTER);
+			continue;
+		}
+
 		if (!git__prefixcmp(ptr, GIT_CAP_SYMREF)) {
 			int error;
 
@@ -202,7 +249,51 @@ int git_smart__detect_caps(git_pkt_ref *pkt, transport_smart_caps *caps, git_vec
 	return 0;
 }
 
-static int recv_pkt(git_pkt **out, gitno_buffer *buf)
+typedef int (*pkt_parse_cb)(git_pkt **head, const char *line, const char **out, size_t len);
+
+static bool has_feature(const char *features, const char *name)
+{
+	size_t len = strlen(name);
+	const char *ptr = features;
+
+	while ((ptr = strstr(ptr, name)) != NULL) {
+		if ((ptr == features || ptr[-1] == ' ') &&
+			(ptr[len] == '\0' || ptr[len] == ' '))
+			return true;
+
+		ptr += len;
+	}
+
+	return false;
+}
+
+static int detect_cap_v2(transport_smart_caps *caps, const char *cap)
+{
+	const char *value;
+
+	if (!strcmp(cap, "ls-refs") || !git__prefixcmp(cap, "ls-refs=")) {
+		caps->ls_refs = 1;
+	} else if (!strcmp(cap, "fetch") || !git__prefixcmp(cap, "fetch=")) {
+		value = cap + strlen("fetch");
+		caps->fetch = 1;
+
+		/* deepening by date comes with the shallow feature */
+		if (has_feature(value + (*value == '='), GIT_CAP_SHALLOW))
+			caps->shallow = caps->deepen_since = 1;
+
+		if (has_feature(value + (*value == '='), GIT_CAP_FILTER))
+			caps->filter = 1;
+	} else if (!git__prefixcmp(cap, "object-format=") &&
+		strcmp(cap + strlen("object-format="), "sha1") != 0) {
+		giterr_set(GITERR_NET, "Remote uses an unsupported object format '%s'",
+			cap + strlen("object-format="));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int recv_pkt_with(git_pkt **out, gitno_buffer *buf, pkt_parse_cb parse)
 {
 	const char *ptr = buf->data, *line_end = ptr;
 	git_pkt *pkt = NULL;
@@ -210,7 +301,7 @@ static int recv_pkt(git_pkt **out, gitno_buffer *buf)
 
 	do {
 		if (buf->offset > 0)
-			error = git_pkt_parse_line(&pkt, ptr, &line_end, buf->offset);
+			error = parse(&pkt, ptr, &line_end, buf->offset);
 		else
 			error = GIT_EBUFS;
 
@@ -234,44 +325,290 @@ static int recv_pkt(git_pkt **out, gitno_buffer *buf)
 	return pkt_type;
 }
 
-static int store_common(transport_smart *t)
+static int recv_pkt(git_pkt **out, gitno_buffer *buf)
+{
+	return recv_pkt_with(out, buf, git_pkt_parse_line);
+}
+
+static int recv_text_pkt(git_pkt **out, gitno_buffer *buf)
+{
+	return recv_pkt_with(out, buf, git_pkt_parse_text);
+}
+
+/*
+ * A server speaking protocol v2 opens with "version 2" followed by its
+ * capabilities. Anything else is the start of a v0 ref advertisement,
+ * which we leave in the buffer for git_smart__store_refs.
+ */
+int git_smart__detect_version(transport_smart *t)
 {
-	git_pkt *pkt = NULL;
 	gitno_buffer *buf = &t->buffer;
-	int error;
+	const char *line_end = NULL;
+	git_pkt *pkt = NULL;
+	int error, recvd;
 
 	do {
-		if ((error = recv_pkt(&pkt, buf)) < 0)
-			return error;
+		if (buf->offset > 0)
+			error = git_pkt_parse_text(&pkt, buf->data, &line_end, buf->offset);
+		else
+			error = GIT_EBUFS;
 
-		if (pkt->type == GIT_PKT_ACK) {
-			if (git_vector_insert(&t->common, pkt) < 0)
-				return -1;
-		} else {
-			git__free(pkt);
-			return 0;
+		if (error == GIT_EBUFS) {
+			if ((recvd = gitno_recv(buf)) < 0)
+				return recvd;
+
+			if (recvd == 0) {
+				giterr_set(GITERR_NET, "early EOF");
+				return GIT_EEOF;
+			}
 		}
+	} while (error == GIT_EBUFS);
+
+	if (error < 0)
+		return error;
+
+	if (pkt->type != GIT_PKT_TEXT ||
+		strcmp(((git_pkt_text *)pkt)->text, "version 2") != 0) {
+		git_pkt_free(pkt);
+		t->version = 0;
+		return 0;
+	}
+
+	git_pkt_free(pkt);
+	gitno_consume(buf, line_end);
+
+	memset(&t->caps, 0, sizeof(t->caps));
+
+	/* these need no negotiation in v2, and the pack is always multiplexed */
+	t->caps.ofs_delta = t->caps.thin_pack = t->caps.include_tag = 1;
+	t->caps.side_band_64k = 1;
+
+	while ((error = recv_text_pkt(&pkt, buf)) == GIT_PKT_TEXT) {
+		error = detect_cap_v2(&t->caps, ((git_pkt_text *)pkt)->text);
+		git_pkt_free(pkt);
+
+		if (error < 0)
+			return error;
+	}
+
+	if (error < 0)
+		return error;
+
+	if (error == GIT_PKT_ERR) {
+		error = remote_error((git_pkt_err *)pkt);
+		git_pkt_free(pkt);
+		return error;
+	}
+
+	git_pkt_free(pkt);
+
+	if (error != GIT_PKT_FLUSH) {
+		giterr_set(GITERR_NET, "Invalid capability advertisement");
+		return -1;
+	}
+
+	if (!t->caps.ls_refs || !t->caps.fetch) {
+		giterr_set(GITERR_NET, "Remote does not support listing refs and fetching");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ls_ref_pkt(
+	git_pkt_ref **out, const char *name, size_t name_len, const git_oid *oid)
+{
+	git_pkt_ref *pkt;
+
+	pkt = git__calloc(1, sizeof(git_pkt_ref));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_REF;
+	git_oid_cpy(&pkt->head.oid, oid);
 
-	} while (1);
+	if ((pkt->head.name = git__strndup(name, name_len)) == NULL) {
+		git__free(pkt);
+		return -1;
+	}
 
+	*out = pkt;
 	return 0;
 }
 
-static int fetch_setup_walk(git_revwalk **out, git_repository *repo)
+/*
+ * Parse "<oid> <name>[ symref-target:<target>][ peeled:<oid>]"; like in
+ * the v0 advertisement, the peeled object is stored as "<name>^{}".
+ */
+static int store_ls_ref(git_vector *refs, const char *line)
 {
-	git_revwalk *walk = NULL;
-	git_strarray refs;
-	unsigned int i;
-	git_reference *ref;
+	git_pkt_ref *ref = NULL, *peeled = NULL;
+	git_buf peeled_name = GIT_BUF_INIT;
+	const char *name, *attr, *end;
+	size_t name_len;
+	git_oid oid;
+	int error = -1;
+
+	if (strlen(line) < GIT_OID_HEXSZ + 2 || line[GIT_OID_HEXSZ] != ' ' ||
+		git_oid_fromstrn(&oid, line, GIT_OID_HEXSZ) < 0)
+		goto on_invalid;
+
+	name = line + GIT_OID_HEXSZ + 1;
+	if ((end = strchr(name, ' ')) == NULL)
+		end = name + strlen(name);
+
+	name_len = end - name;
+
+	if (ls_ref_pkt(&ref, name, name_len, &oid) < 0)
+		goto done;
+
+	for (attr = end; *attr == ' '; attr = end) {
+		attr++;
+
+		if ((end = strchr(attr, ' ')) == NULL)
+			end = attr + strlen(attr);
+
+		if (!git__prefixcmp(attr, "symref-target:")) {
+			attr += strlen("symref-target:");
+
+			git__free(ref->head.symref_target);
+			if ((ref->head.symref_target = git__strndup(attr, end - attr)) == NULL)
+				goto done;
+		} else if (!git__prefixcmp(attr, "peeled:")) {
+			attr += strlen("peeled:");
+
+			if (end - attr != GIT_OID_HEXSZ ||
+				git_oid_fromstrn(&oid, attr, GIT_OID_HEXSZ) < 0)
+				goto on_invalid;
+
+			if (git_buf_put(&peeled_name, name, name_len) < 0 ||
+				git_buf_puts(&peeled_name, "^{}") < 0 ||
+				ls_ref_pkt(&peeled, peeled_name.ptr, peeled_name.size, &oid) < 0)
+				goto done;
+		}
+	}
+
+	if (git_vector_insert(refs, ref) < 0)
+		goto done;
+
+	ref = NULL;
+
+	if (peeled && git_vector_insert(refs, peeled) < 0)
+		goto done;
+
+	peeled = NULL;
+	error = 0;
+	goto done;
+
+on_invalid:
+	giterr_set(GITERR_NET, "Invalid ref line '%s'", line);
+
+done:
+	if (ref)
+		git_pkt_free((git_pkt *)ref);
+	if (peeled)
+		git_pkt_free((git_pkt *)peeled);
+
+	git_buf_free(&peeled_name);
+	return error;
+}
+
+static int buffer_ls_refs(transport_smart *t, git_buf *buf)
+{
+	git_buf line = GIT_BUF_INIT;
+	const char *prefix;
+	size_t i;
+
+	git_pkt_buffer_text(buf, "command=ls-refs");
+	git_pkt_buffer_delim(buf);
+	git_pkt_buffer_text(buf, "peel");
+	git_pkt_buffer_text(buf, "symrefs");
+
+	/* without any prefix, the server lists all of its refs */
+	if (t->owner) {
+		git_vector_foreach(&t->owner->ref_prefixes, i, prefix) {
+			git_buf_clear(&line);
+			git_buf_printf(&line, "ref-prefix %s", prefix);
+			git_pkt_buffer_text(buf, line.ptr);
+		}
+	}
+
+	git_pkt_buffer_flush(buf);
+	git_buf_free(&line);
+
+	return git_buf_oom(buf) || git_buf_oom(&line) ? -1 : 0;
+}
+
+/*
+ * Ask a v2 server for its refs, limited to the prefixes the remote
+ * is going to fetch, and store them like a v0 advertisement.
+ */
+int git_smart__ls_refs(transport_smart *t)
+{
+	git_vector *refs = &t->refs;
+	git_buf request = GIT_BUF_INIT;
+	git_pkt *pkt = NULL;
+	size_t i;
 	int error;
 
-	if ((error = git_reference_list(&refs, repo)) < 0)
-		return error;
+	git_vector_foreach(refs, i, pkt) {
+		git_pkt_free(pkt);
+	}
+	git_vector_clear(refs);
 
-	if ((error = git_revwalk_new(&walk, repo)) < 0)
-		return error;
+	if ((error = buffer_ls_refs(t, &request)) < 0 ||
+		(error = git_smart__negotiation_step(&t->parent, request.ptr, request.size)) < 0)
+		goto done;
+
+	while ((error = recv_text_pkt(&pkt, &t->buffer)) >= 0) {
+		if (error == GIT_PKT_FLUSH) {
+			git_pkt_free(pkt);
+			error = 0;
+			break;
+		}
+
+		if (error == GIT_PKT_ERR) {
+			error = remote_error((git_pkt_err *)pkt);
+			git_pkt_free(pkt);
+			break;
+		}
+
+		if (error == GIT_PKT_TEXT)
+			error = store_ls_ref(refs, ((git_pkt_text *)pkt)->text);
+		else
+			error = 0;
+
+		git_pkt_free(pkt);
+
+		if (error < 0)
+			break;
+	}
+
+done:
+	git_buf_free(&request);
+	return error;
+}
+
+/*
+ * Offer the history of our branches; the wants which we have already
+ * are known to be common.
+ */
+static int setup_negotiator(
+	git_negotiator **out,
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count)
+{
+	git_negotiator *negotiator = NULL;
+	git_strarray refs = {0};
+	git_reference *ref = NULL;
+	size_t i;
+	int error;
 
-	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	if ((error = git_negotiator_new(&negotiator, repo,
+			t->owner ? t->owner->negotiation : 0)) < 0 ||
+		(error = git_reference_list(&refs, repo)) < 0)
+		goto on_error;
 
 	for (i = 0; i < refs.count; ++i) {
 		/* No tags */
@@ -281,21 +618,26 @@ static int fetch_setup_walk(git_revwalk **out, git_repository *repo)
 		if ((error = git_reference_lookup(&ref, repo, refs.strings[i])) < 0)
 			goto on_error;
 
-		if (git_reference_type(ref) == GIT_REF_SYMBOLIC)
-			continue;
-
-		if ((error = git_revwalk_push(walk, git_reference_target(ref))) < 0)
+		if (git_reference_type(ref) != GIT_REF_SYMBOLIC &&
+			(error = git_negotiator_add_tip(negotiator, git_reference_target(ref))) < 0)
 			goto on_error;
 
 		git_reference_free(ref);
+		ref = NULL;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (wants[i]->local &&
+			(error = git_negotiator_known_common(negotiator, &wants[i]->oid)) < 0)
+			goto on_error;
 	}
 
 	git_strarray_free(&refs);
-	*out = walk;
+	*out = negotiator;
 	return 0;
 
 on_error:
-	git_revwalk_free(walk);
+	git_negotiator_free(negotiator);
 	git_reference_free(ref);
 	git_strarray_free(&refs);
 	return error;
@@ -315,6 +657,12 @@ static int wait_while_ack(gitno_buffer *buf)
 		if (pkt->type == GIT_PKT_NAK)
 			break;
 
+		if (pkt->type == GIT_PKT_ERR) {
+			error = remote_error((git_pkt_err *)pkt);
+			git__free(pkt);
+			return error;
+		}
+
 		if (pkt->type == GIT_PKT_ACK &&
 		    (pkt->status != GIT_ACK_CONTINUE &&
 		     pkt->status != GIT_ACK_COMMON)) {
@@ -327,208 +675,1000 @@ static int wait_while_ack(gitno_buffer *buf)
 	return 0;
 }
 
-int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, const git_remote_head * const *wants, size_t count)
+static bool wants_deepen(transport_smart *t)
 {
-	transport_smart *t = (transport_smart *)transport;
-	gitno_buffer *buf = &t->buffer;
-	git_buf data = GIT_BUF_INIT;
-	git_revwalk *walk = NULL;
-	int error = -1, pkt_type;
-	unsigned int i;
-	git_oid oid;
-
-	if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
-		return error;
+	return t->owner && (t->owner->depth || t->owner->shallow_since);
+}
 
-	if ((error = fetch_setup_walk(&walk, repo)) < 0)
-		goto on_error;
+/*
+ * Buffer the list of wants, followed by our current shallow roots, the
+ * requested depth and object filter.
+ */
+static int buffer_wants_args(
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count,
+	git_buf *buf)
+{
+	git_array_oid_t roots = GIT_ARRAY_INIT;
+	size_t i;
+	int error;
 
-	/*
-	 * Our support for ACK extensions is simply to parse them. On
-	 * the first ACK we will accept that as enough common
-	 * objects. We give up if we haven't found an answer in the
-	 * first 256 we send.
-	 */
-	i = 0;
-	while (i < 256) {
-		error = git_revwalk_next(&oid, walk);
+	if ((error = git_pkt_buffer_wants(wants, count, &t->caps, buf)) < 0 ||
+		(error = git_shallow__roots(&roots, repo)) < 0)
+		goto done;
 
-		if (error < 0) {
-			if (GIT_ITEROVER == error)
-				break;
+	if ((git_array_size(roots) || wants_deepen(t)) && !t->caps.shallow) {
+		giterr_set(GITERR_NET, "Remote does not support shallow fetches");
+		error = -1;
+		goto done;
+	}
 
-			goto on_error;
-		}
+	if (wants_deepen(t) && t->owner->shallow_since && !t->caps.deepen_since) {
+		giterr_set(GITERR_NET, "Remote does not support fetching since a date");
+		error = -1;
+		goto done;
+	}
 
-		git_pkt_buffer_have(&oid, &data);
-		i++;
-		if (i % 20 == 0) {
-			if (t->cancelled.val) {
-				giterr_set(GITERR_NET, "The fetch was cancelled by the user");
-				error = GIT_EUSER;
-				goto on_error;
-			}
+	for (i = 0; i < git_array_size(roots); i++) {
+		if ((error = git_pkt_buffer_shallow(git_array_get(roots, i), buf)) < 0)
+			goto done;
+	}
 
-			git_pkt_buffer_flush(&data);
-			if (git_buf_oom(&data)) {
-				error = -1;
-				goto on_error;
-			}
+	if (wants_deepen(t)) {
+		if (t->owner->depth)
+			error = git_pkt_buffer_deepen(t->owner->depth, buf);
+		else
+			error = git_pkt_buffer_deepen_since(t->owner->shallow_since, buf);
 
-			if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
-				goto on_error;
+		if (error < 0)
+			goto done;
+	}
 
-			git_buf_clear(&data);
-			if (t->caps.multi_ack || t->caps.multi_ack_detailed) {
-				if ((error = store_common(t)) < 0)
-					goto on_error;
-			} else {
-				pkt_type = recv_pkt(NULL, buf);
-
-				if (pkt_type == GIT_PKT_ACK) {
-					break;
-				} else if (pkt_type == GIT_PKT_NAK) {
-					continue;
-				} else if (pkt_type < 0) {
-					/* recv_pkt returned an error */
-					error = pkt_type;
-					goto on_error;
-				} else {
-					giterr_set(GITERR_NET, "Unexpected pkt type");
-					error = -1;
-					goto on_error;
-				}
-			}
+	if (t->owner && t->owner->filter) {
+		if (!t->caps.filter) {
+			giterr_set(GITERR_NET, "Remote does not support object filters");
+			error = -1;
+			goto done;
 		}
 
-		if (t->common.length > 0)
-			break;
+		if ((error = git_pkt_buffer_filter(t->owner->filter, buf)) < 0)
+			goto done;
+	}
 
-		if (i % 20 == 0 && t->rpc) {
-			git_pkt_ack *pkt;
-			unsigned int i;
+done:
+	git_array_clear(roots);
+	return error;
+}
 
-			if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
-				goto on_error;
+/* Buffer the wants and their arguments, terminated by a flush */
+static int buffer_wants(
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count,
+	git_buf *buf)
+{
+	int error;
 
-			git_vector_foreach(&t->common, i, pkt) {
-				if ((error = git_pkt_buffer_have(&pkt->oid, &data)) < 0)
-					goto on_error;
-			}
+	if ((error = buffer_wants_args(t, repo, wants, count, buf)) < 0)
+		return error;
+
+	return git_pkt_buffer_flush(buf);
+}
+
+/*
+ * When we asked for a depth, the server answers our wants with the
+ * list of commits which became (or stopped being) shallow roots.
+ */
+static int recv_shallow_info(transport_smart *t, enum git_pkt_type end)
+{
+	gitno_buffer *buf = &t->buffer;
+	git_pkt *pkt = NULL;
+	git_oid *id;
+	int error;
+
+	git_array_clear(t->owner->shallow);
+	git_array_clear(t->owner->unshallow);
+
+	while (1) {
+		if ((error = recv_pkt(&pkt, buf)) < 0)
+			return error;
+
+		if (pkt->type == end)
+			break;
+
+		if (pkt->type == GIT_PKT_SHALLOW)
+			id = git_array_alloc(t->owner->shallow);
+		else if (pkt->type == GIT_PKT_UNSHALLOW)
+			id = git_array_alloc(t->owner->unshallow);
+		else {
+			giterr_set(GITERR_NET, "Unexpected pkt type, expected shallow info");
+			git_pkt_free(pkt);
+			return -1;
+		}
+
+		if (!id) {
+			git_pkt_free(pkt);
+			return -1;
+		}
+
+		git_oid_cpy(id, &((git_pkt_shallow *)pkt)->oid);
+		git_pkt_free(pkt);
+	}
+
+	git_pkt_free(pkt);
+	return 0;
+}
+
+static int add_common(transport_smart *t, const git_oid *id)
+{
+	git_pkt_ack *pkt;
+	size_t i;
+
+	git_vector_foreach(&t->common, i, pkt) {
+		if (git_oid_equal(&pkt->oid, id))
+			return 0;
+	}
+
+	pkt = git__calloc(1, sizeof(git_pkt_ack));
+	GITERR_CHECK_ALLOC(pkt);
+
+	pkt->type = GIT_PKT_ACK;
+	pkt->status = GIT_ACK_COMMON;
+	git_oid_cpy(&pkt->oid, id);
+
+	if (git_vector_insert(&t->common, pkt) < 0) {
+		git__free(pkt);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Remember a commit the server acknowledged; a commit which wasn't
+ * known to be common yet means the negotiation is making progress.
+ */
+static int record_common(
+	transport_smart *t,
+	git_negotiator *negotiator,
+	const git_oid *id,
+	unsigned int *in_vain)
+{
+	int known;
+
+	if ((known = git_negotiator_ack(negotiator, id)) < 0 ||
+		add_common(t, id) < 0)
+		return -1;
+
+	if (!known)
+		*in_vain = 0;
+
+	return 0;
+}
+
+/*
+ * Read the server's answer to a round of haves. A multi_ack server
+ * lists every common commit and says whether it's ready to send the
+ * pack; for the others the first common commit has to do.
+ */
+static int store_common(
+	transport_smart *t,
+	git_negotiator *negotiator,
+	bool *ready,
+	unsigned int *in_vain)
+{
+	git_pkt_ack *pkt = NULL;
+	int error;
+
+	while (1) {
+		if ((error = recv_pkt((git_pkt **)&pkt, &t->buffer)) < 0)
+			return error;
+
+		if (error == GIT_PKT_NAK)
+			break;
+
+		if (error == GIT_PKT_ERR) {
+			error = remote_error((git_pkt_err *)pkt);
+			git_pkt_free((git_pkt *)pkt);
+			return error;
+		}
+
+		if (error != GIT_PKT_ACK) {
+			giterr_set(GITERR_NET, "Unexpected pkt type");
+			git_pkt_free((git_pkt *)pkt);
+			return -1;
+		}
+
+		if (record_common(t, negotiator, &pkt->oid, in_vain) < 0) {
+			git_pkt_free((git_pkt *)pkt);
+			return -1;
+		}
+
+		if (pkt->status == GIT_ACK_READY ||
+			(!t->caps.multi_ack && !t->caps.multi_ack_detailed))
+			*ready = true;
+
+		if (pkt->status == GIT_ACK_NONE)
+			break;
+
+		git_pkt_free((git_pkt *)pkt);
+	}
+
+	git_pkt_free((git_pkt *)pkt);
+	return 0;
+}
+
+/*
+ * Every v2 fetch request stands on its own: it carries the wants and
+ * their arguments, plus the haves which we already know to be common.
+ */
+static int buffer_fetch_v2(
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count,
+	git_buf *buf)
+{
+	git_pkt_ack *pkt;
+	size_t i;
+	int error;
+
+	git_pkt_buffer_text(buf, "command=fetch");
+	git_pkt_buffer_delim(buf);
+	git_pkt_buffer_text(buf, GIT_CAP_THIN_PACK);
+	git_pkt_buffer_text(buf, GIT_CAP_OFS_DELTA);
+	git_pkt_buffer_text(buf, GIT_CAP_INCLUDE_TAG);
+
+	if ((error = buffer_wants_args(t, repo, wants, count, buf)) < 0)
+		return error;
+
+	git_vector_foreach(&t->common, i, pkt) {
+		if ((error = git_pkt_buffer_have(&pkt->oid, buf)) < 0)
+			return error;
+	}
+
+	return git_buf_oom(buf) ? -1 : 0;
+}
+
+static int recv_text_error(git_pkt *pkt, const char *expected)
+{
+	int error = -1;
+
+	if (pkt->type == GIT_PKT_ERR)
+		error = remote_error((git_pkt_err *)pkt);
+	else if (pkt->type == GIT_PKT_TEXT)
+		giterr_set(GITERR_NET, "Unexpected line '%s', expected %s",
+			((git_pkt_text *)pkt)->text, expected);
+	else
+		giterr_set(GITERR_NET, "Unexpected pkt type, expected %s", expected);
+
+	git_pkt_free(pkt);
+	return error;
+}
+
+/*
+ * Read the acknowledgments section; when the server is ready to send
+ * the pack, the section ends with a delimiter and the pack follows.
+ */
+static int recv_acks_v2(
+	transport_smart *t,
+	git_negotiator *negotiator,
+	bool *ready,
+	unsigned int *in_vain)
+{
+	git_pkt *pkt = NULL;
+	const char *line;
+	git_oid id;
+	int error;
+
+	*ready = false;
+
+	if ((error = recv_text_pkt(&pkt, &t->buffer)) < 0)
+		return error;
+
+	if (error != GIT_PKT_TEXT ||
+		strcmp(((git_pkt_text *)pkt)->text, "acknowledgments") != 0)
+		return recv_text_error(pkt, "acknowledgments");
+
+	git_pkt_free(pkt);
+
+	while ((error = recv_text_pkt(&pkt, &t->buffer)) == GIT_PKT_TEXT) {
+		line = ((git_pkt_text *)pkt)->text;
+
+		if (!strcmp(line, "ready")) {
+			*ready = true;
+		} else if (!git__prefixcmp(line, "ACK ")) {
+			if (git_oid_fromstrn(&id, line + 4, GIT_OID_HEXSZ) < 0 ||
+				record_common(t, negotiator, &id, in_vain) < 0) {
+				git_pkt_free(pkt);
+				return -1;
+			}
+		} else if (strcmp(line, "NAK") != 0) {
+			return recv_text_error(pkt, "an acknowledgment");
+		}
+
+		git_pkt_free(pkt);
+	}
+
+	if (error < 0)
+		return error;
+
+	if ((error == GIT_PKT_FLUSH && !*ready) || (error == GIT_PKT_DELIM && *ready)) {
+		git_pkt_free(pkt);
+		return 0;
+	}
+
+	return recv_text_error(pkt, "the end of the acknowledgments");
+}
+
+/*
+ * Skip over the sections in front of the pack, keeping the shallow
+ * info; the pack itself is left to git_smart__download_pack.
+ */
+static int recv_sections_v2(transport_smart *t)
+{
+	git_pkt *pkt = NULL;
+	const char *section;
+	int error;
+
+	git_array_clear(t->owner->shallow);
+	git_array_clear(t->owner->unshallow);
+
+	while (1) {
+		if ((error = recv_text_pkt(&pkt, &t->buffer)) < 0)
+			return error;
+
+		if (error != GIT_PKT_TEXT)
+			return recv_text_error(pkt, "a section header");
+
+		section = ((git_pkt_text *)pkt)->text;
+
+		if (!strcmp(section, "packfile")) {
+			git_pkt_free(pkt);
+			return 0;
+		}
+
+		if (!strcmp(section, "shallow-info")) {
+			git_pkt_free(pkt);
+
+			if ((error = recv_shallow_info(t, GIT_PKT_DELIM)) < 0)
+				return error;
+
+			continue;
+		}
+
+		if (strcmp(section, "wanted-refs") != 0 &&
+			strcmp(section, "packfile-uris") != 0)
+			return recv_text_error(pkt, "a section header");
+
+		git_pkt_free(pkt);
+
+		/* we ask for neither, but they're harmless */
+		while ((error = recv_text_pkt(&pkt, &t->buffer)) == GIT_PKT_TEXT)
+			git_pkt_free(pkt);
+
+		if (error < 0)
+			return error;
+
+		if (error != GIT_PKT_DELIM)
+			return recv_text_error(pkt, "a delimiter");
+
+		git_pkt_free(pkt);
+	}
+}
+
+/*
+ * Send our haves in rounds of 20 until the server says it's ready, we
+ * run out of commits to offer or the last MAX_IN_VAIN haves didn't
+ * turn up anything new, then ask for the pack with "done".
+ */
+static int negotiate_fetch_v2(
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count)
+{
+	git_buf data = GIT_BUF_INIT;
+	git_negotiator *negotiator = NULL;
+	bool last = false, ready = false;
+	unsigned int in_vain = 0, round;
+	git_oid oid;
+	int error;
+
+	if ((error = setup_negotiator(&negotiator, t, repo, wants, count)) < 0)
+		goto done;
+
+	while (1) {
+		git_buf_clear(&data);
+
+		if ((error = buffer_fetch_v2(t, repo, wants, count, &data)) < 0)
+			goto done;
+
+		for (round = 0; !last && round < 20; round++, in_vain++) {
+			if ((error = git_negotiator_next(&oid, negotiator)) == GIT_ITEROVER) {
+				last = true;
+				break;
+			}
+
+			if (error < 0 || (error = git_pkt_buffer_have(&oid, &data)) < 0)
+				goto done;
+		}
+
+		if (in_vain >= MAX_IN_VAIN)
+			last = true;
+
+		if (last && (error = git_pkt_buffer_done(&data)) < 0)
+			goto done;
+
+		if ((error = git_pkt_buffer_flush(&data)) < 0)
+			goto done;
+
+		if (t->cancelled.val) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			error = GIT_EUSER;
+			goto done;
+		}
+
+		if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
+			goto done;
+
+		if (last)
+			break;
+
+		if ((error = recv_acks_v2(t, negotiator, &ready, &in_vain)) < 0)
+			goto done;
+
+		if (ready)
+			break;
+	}
+
+	error = recv_sections_v2(t);
+
+done:
+	git_negotiator_free(negotiator);
+	git_buf_free(&data);
+	return error;
+}
+
+/*
+ * A stateless server forgets everything between requests, so each of
+ * them starts over with the wants and the commits known to be common.
+ */
+static int buffer_wants_and_common(
+	transport_smart *t,
+	git_repository *repo,
+	const git_remote_head * const *wants,
+	size_t count,
+	git_buf *buf)
+{
+	git_pkt_ack *pkt;
+	size_t i;
+	int error;
+
+	if ((error = buffer_wants(t, repo, wants, count, buf)) < 0)
+		return error;
+
+	git_vector_foreach(&t->common, i, pkt) {
+		if ((error = git_pkt_buffer_have(&pkt->oid, buf)) < 0)
+			return error;
+	}
+
+	return git_buf_oom(buf) ? -1 : 0;
+}
+
+int git_smart__negotiate_fetch(git_transport *transport, git_repository *repo, const git_remote_head * const *wants, size_t count)
+{
+	transport_smart *t = (transport_smart *)transport;
+	gitno_buffer *buf = &t->buffer;
+	git_buf data = GIT_BUF_INIT;
+	git_negotiator *negotiator = NULL;
+	bool shallow_info = wants_deepen(t), ready = false;
+	int error = -1, pkt_type;
+	unsigned int sent = 0, in_vain = 0;
+	git_oid oid;
+
+	if (t->version == GIT_PROTOCOL_VERSION_2)
+		return negotiate_fetch_v2(t, repo, wants, count);
+
+	if ((error = buffer_wants(t, repo, wants, count, &data)) < 0)
+		goto on_error;
+
+	if ((error = setup_negotiator(&negotiator, t, repo, wants, count)) < 0)
+		goto on_error;
+
+	/*
+	 * Offer our commits in rounds of 20 and learn from the ACKs which
+	 * parts of our history the server has. We stop once it's ready to
+	 * send the pack, or when the last MAX_IN_VAIN haves didn't turn
+	 * up a new common commit.
+	 */
+	while (!ready && in_vain < MAX_IN_VAIN) {
+		if ((error = git_negotiator_next(&oid, negotiator)) == GIT_ITEROVER)
+			break;
+
+		if (error < 0)
+			goto on_error;
+
+		if (t->rpc && !data.size &&
+			(error = buffer_wants_and_common(t, repo, wants, count, &data)) < 0)
+			goto on_error;
+
+		git_pkt_buffer_have(&oid, &data);
+		in_vain++;
+
+		if (++sent % 20 != 0)
+			continue;
+
+		if (t->cancelled.val) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			error = GIT_EUSER;
+			goto on_error;
+		}
+
+		git_pkt_buffer_flush(&data);
+		if (git_buf_oom(&data)) {
+			error = -1;
+			goto on_error;
+		}
+
+		if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
+			goto on_error;
+
+		git_buf_clear(&data);
+
+		/* stateless servers answer the wants of every request */
+		if (shallow_info) {
+			if ((error = recv_shallow_info(t, GIT_PKT_FLUSH)) < 0)
+				goto on_error;
+
+			shallow_info = t->rpc;
+		}
+
+		if ((error = store_common(t, negotiator, &ready, &in_vain)) < 0)
+			goto on_error;
+	}
+
+	/* Tell the other end that we're done negotiating */
+	if (t->rpc && !data.size &&
+		(error = buffer_wants_and_common(t, repo, wants, count, &data)) < 0)
+		goto on_error;
+
+	if ((error = git_pkt_buffer_done(&data)) < 0)
+		goto on_error;
+
+	if (t->cancelled.val) {
+		giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+		error = GIT_EUSER;
+		goto on_error;
+	}
+	if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
+		goto on_error;
+
+	/* the server answers the wants before it acknowledges the "done" */
+	if (shallow_info && (error = recv_shallow_info(t, GIT_PKT_FLUSH)) < 0)
+		goto on_error;
+
+	git_buf_free(&data);
+	git_negotiator_free(negotiator);
+
+	/* Now let's eat up whatever the server gives us */
+	if (!t->caps.multi_ack && !t->caps.multi_ack_detailed) {
+		git_pkt *pkt = NULL;
+
+		if ((pkt_type = recv_pkt(&pkt, buf)) < 0)
+			return pkt_type;
+
+		if (pkt_type == GIT_PKT_ERR) {
+			error = remote_error((git_pkt_err *)pkt);
+		} else if (pkt_type != GIT_PKT_ACK && pkt_type != GIT_PKT_NAK) {
+			giterr_set(GITERR_NET, "Unexpected pkt type");
+			error = -1;
+		}
+
+		git_pkt_free(pkt);
+	} else {
+		error = wait_while_ack(buf);
+	}
+
+	return error;
+
+on_error:
+	git_negotiator_free(negotiator);
+	git_buf_free(&data);
+	return error;
+}
+
+static int no_sideband(transport_smart *t, struct git_odb_writepack *writepack, gitno_buffer *buf, git_transfer_progress *stats)
+{
+	int recvd;
+
+	do {
+		if (t->cancelled.val) {
+			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			return GIT_EUSER;
+		}
+
+		if (writepack->append(writepack, buf->data, buf->offset, stats) < 0)
+			return -1;
+
+		gitno_consume_n(buf, buf->offset);
+
+		if ((recvd = gitno_recv(buf)) < 0)
+			return recvd;
+	} while(recvd > 0);
+
+	if (writepack->commit(writepack, stats) < 0)
+		return -1;
+
+	return 0;
+}
+
+struct network_packetsize_payload
+{
+	git_transfer_progress_cb callback;
+	void *payload;
+	git_transfer_progress *stats;
+	size_t last_fired_bytes;
+};
+
+static int network_packetsize(size_t received, void *payload)
+{
+	struct network_packetsize_payload *npp = (struct network_packetsize_payload*)payload;
+
+	/* Accumulate bytes */
+	npp->stats->received_bytes += received;
+
+	/* Fire notification if the threshold is reached */
+	if ((npp->stats->received_bytes - npp->last_fired_bytes) > NETWORK_XFER_THRESHOLD) {
+		npp->last_fired_bytes = npp->stats->received_bytes;
+
+		if (npp->callback(npp->stats, npp->payload))
+			return GIT_EUSER;
+	}
+
+	return 0;
+}
+
+static int recv_sideband(
+	transport_smart *t,
+	struct git_odb_writepack *writepack,
+	git_transfer_progress *stats)
+{
+	gitno_buffer *buf = &t->buffer;
+	int error = 0;
+
+	do {
+		git_pkt *pkt = NULL;
+
+		/* Check cancellation before network call */
+		if (t->cancelled.val) {
+			giterr_clear();
+			return GIT_EUSER;
+		}
+
+		if ((error = recv_pkt(&pkt, buf)) >= 0) {
+			/* Check cancellation after network call */
+			if (t->cancelled.val) {
+				giterr_clear();
+				error = GIT_EUSER;
+			} else if (pkt->type == GIT_PKT_PROGRESS) {
+				if (t->progress_cb) {
+					git_pkt_progress *p = (git_pkt_progress *) pkt;
+					error = t->progress_cb(p->data, p->len, t->message_cb_payload);
+				}
+			} else if (pkt->type == GIT_PKT_DATA) {
+				git_pkt_data *p = (git_pkt_data *) pkt;
+
+				if (p->len)
+					error = writepack->append(writepack, p->data, p->len, stats);
+			} else if (pkt->type == GIT_PKT_ERR) {
+				error = remote_error((git_pkt_err *)pkt);
+			} else if (pkt->type == GIT_PKT_FLUSH) {
+				/* A flush indicates the end of the packfile */
+				git__free(pkt);
+				return 0;
+			}
+		}
+
+		git__free(pkt);
+	} while (error >= 0);
+
+	return error;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * Receiving the pack and indexing it take turns on the same thread
+ * otherwise; here a thread of its own reads and demultiplexes the
+ * side-band, handing the data over in a ring of large buffers. The
+ * calling thread indexes the pack and runs all the callbacks.
+ *
+ * The subtransports only call back into the user (for credentials or
+ * a certificate check) while they send a request and read the start
+ * of its response; the receiver only starts once that is over.
+ */
+
+#define PACK_RING_SLOTS 4
+#define PACK_RING_SLOT_SIZE (512 * 1024)
+
+typedef enum {
+	PACK_CHUNK_DATA,
+	PACK_CHUNK_PROGRESS,
+	PACK_CHUNK_END,
+} pack_chunk_t;
+
+typedef struct {
+	pack_chunk_t type;
+	char *data;
+	size_t len;
+
+	/* the bytes read from the network while it was filled */
+	size_t received;
+} pack_chunk;
+
+typedef struct {
+	transport_smart *t;
+	git_thread thread;
+	git_mutex lock;
+	git_cond cond;
+
+	/* the filled chunks are `count` slots from `head` on */
+	pack_chunk chunks[PACK_RING_SLOTS];
+	size_t head, count;
+
+	/* the receiver is done; the indexer gave up */
+	unsigned int finished:1,
+		stopped:1;
+
+	int error;
+	git_error_state error_state;
+
+	/* only used by the receiver */
+	pack_chunk *current;
+	size_t received;
+} pack_ring;
+
+static int ring_count_received(size_t received, void *payload)
+{
+	pack_ring *ring = payload;
 
-			if (git_buf_oom(&data)) {
-				error = -1;
-				goto on_error;
-			}
-		}
-	}
+	ring->received += received;
+	return 0;
+}
 
-	/* Tell the other end that we're done negotiating */
-	if (t->rpc && t->common.length > 0) {
-		git_pkt_ack *pkt;
-		unsigned int i;
+static void ring_publish(pack_ring *ring)
+{
+	ring->current->received = ring->received;
+	ring->received = 0;
+
+	git_mutex_lock(&ring->lock);
+	ring->count++;
+	ring->current = NULL;
+	git_cond_broadcast(&ring->cond);
+	git_mutex_unlock(&ring->lock);
+}
 
-		if ((error = git_pkt_buffer_wants(wants, count, &t->caps, &data)) < 0)
-			goto on_error;
+static int ring_append(
+	pack_ring *ring, pack_chunk_t type, const char *data, size_t len)
+{
+	pack_chunk *chunk = ring->current;
 
-		git_vector_foreach(&t->common, i, pkt) {
-			if ((error = git_pkt_buffer_have(&pkt->oid, &data)) < 0)
-				goto on_error;
-		}
+	if (chunk && (chunk->type != type || chunk->len + len > PACK_RING_SLOT_SIZE))
+		ring_publish(ring);
 
-		if (git_buf_oom(&data)) {
-			error = -1;
-			goto on_error;
-		}
-	}
+	if (!ring->current) {
+		git_mutex_lock(&ring->lock);
 
-	if ((error = git_pkt_buffer_done(&data)) < 0)
-		goto on_error;
+		while (ring->count == PACK_RING_SLOTS && !ring->stopped)
+			git_cond_wait(&ring->cond, &ring->lock);
 
-	if (t->cancelled.val) {
-		giterr_set(GITERR_NET, "The fetch was cancelled by the user");
-		error = GIT_EUSER;
-		goto on_error;
-	}
-	if ((error = git_smart__negotiation_step(&t->parent, data.ptr, data.size)) < 0)
-		goto on_error;
+		if (!ring->stopped)
+			ring->current = &ring->chunks[(ring->head + ring->count) % PACK_RING_SLOTS];
 
-	git_buf_free(&data);
-	git_revwalk_free(walk);
+		git_mutex_unlock(&ring->lock);
 
-	/* Now let's eat up whatever the server gives us */
-	if (!t->caps.multi_ack && !t->caps.multi_ack_detailed) {
-		pkt_type = recv_pkt(NULL, buf);
+		/* the indexer has its own error to report */
+		if (!ring->current)
+			return GIT_EUSER;
 
-		if (pkt_type < 0) {
-			return pkt_type;
-		} else if (pkt_type != GIT_PKT_ACK && pkt_type != GIT_PKT_NAK) {
-			giterr_set(GITERR_NET, "Unexpected pkt type");
-			return -1;
-		}
-	} else {
-		error = wait_while_ack(buf);
+		ring->current->type = type;
+		ring->current->len = 0;
 	}
 
-	return error;
+	chunk = ring->current;
 
-on_error:
-	git_revwalk_free(walk);
-	git_buf_free(&data);
-	return error;
+	/* a message may come without any payload */
+	if (len) {
+		memcpy(chunk->data + chunk->len, data, len);
+		chunk->len += len;
+	}
+
+	/* every message goes to the progress callback on its own */
+	if (type != PACK_CHUNK_DATA)
+		ring_publish(ring);
+
+	return 0;
 }
 
-static int no_sideband(transport_smart *t, struct git_odb_writepack *writepack, gitno_buffer *buf, git_transfer_progress *stats)
+static int ring_receive(pack_ring *ring)
 {
-	int recvd;
+	transport_smart *t = ring->t;
+	gitno_buffer *buf = &t->buffer;
+	const char *line_end;
+	git_pkt *pkt;
+	int error, recvd;
 
-	do {
+	while (1) {
 		if (t->cancelled.val) {
-			giterr_set(GITERR_NET, "The fetch was cancelled by the user");
+			giterr_clear();
 			return GIT_EUSER;
 		}
 
-		if (writepack->append(writepack, buf->data, buf->offset, stats) < 0)
-			return -1;
+		if (buf->offset > 0)
+			error = git_pkt_parse_line(&pkt, buf->data, &line_end, buf->offset);
+		else
+			error = GIT_EBUFS;
 
-		gitno_consume_n(buf, buf->offset);
+		if (error == GIT_EBUFS) {
+			/* let the indexer work on what we have while we wait */
+			if (ring->current && ring->current->len)
+				ring_publish(ring);
 
-		if ((recvd = gitno_recv(buf)) < 0)
-			return recvd;
-	} while(recvd > 0);
+			if ((recvd = gitno_recv(buf)) < 0)
+				return recvd;
 
-	if (writepack->commit(writepack, stats) < 0)
-		return -1;
+			if (!recvd) {
+				giterr_set(GITERR_NET, "Early EOF while receiving the pack");
+				return -1;
+			}
 
-	return 0;
+			continue;
+		}
+
+		if (error < 0)
+			return error;
+
+		gitno_consume(buf, line_end);
+
+		if (pkt->type == GIT_PKT_DATA) {
+			git_pkt_data *p = (git_pkt_data *)pkt;
+			error = ring_append(ring, PACK_CHUNK_DATA, p->data, p->len);
+		} else if (pkt->type == GIT_PKT_PROGRESS && t->progress_cb) {
+			git_pkt_progress *p = (git_pkt_progress *)pkt;
+			error = ring_append(ring, PACK_CHUNK_PROGRESS, p->data, p->len);
+		} else if (pkt->type == GIT_PKT_ERR) {
+			error = remote_error((git_pkt_err *)pkt);
+		} else if (pkt->type == GIT_PKT_FLUSH) {
+			/* A flush indicates the end of the packfile */
+			git__free(pkt);
+			return ring_append(ring, PACK_CHUNK_END, NULL, 0);
+		}
+
+		git__free(pkt);
+
+		if (error < 0)
+			return error;
+	}
 }
 
-struct network_packetsize_payload
+static void *ring_receive_thread(void *payload)
 {
-	git_transfer_progress_cb callback;
-	void *payload;
-	git_transfer_progress *stats;
-	size_t last_fired_bytes;
-};
+	pack_ring *ring = payload;
+	int error = ring_receive(ring);
 
-static int network_packetsize(size_t received, void *payload)
+	git_mutex_lock(&ring->lock);
+	ring->error = giterr_state_capture(&ring->error_state, error < 0 ? error : 0);
+	ring->finished = 1;
+	git_cond_broadcast(&ring->cond);
+	git_mutex_unlock(&ring->lock);
+
+	return NULL;
+}
+
+static int recv_sideband_pipelined(
+	transport_smart *t,
+	struct git_odb_writepack *writepack,
+	git_transfer_progress *stats,
+	struct network_packetsize_payload *npp)
 {
-	struct network_packetsize_payload *npp = (struct network_packetsize_payload*)payload;
+	packetsize_cb packetsize_cb = t->packetsize_cb;
+	void *packetsize_payload = t->packetsize_payload;
+	pack_ring ring;
+	pack_chunk *chunk;
+	bool end = false;
+	size_t i;
+	int error = 0;
 
-	/* Accumulate bytes */
-	npp->stats->received_bytes += received;
+	/* the negotiation has usually read past the start already */
+	if (!t->buffer.offset && (error = gitno_recv(&t->buffer)) < 0)
+		return error;
 
-	/* Fire notification if the threshold is reached */
-	if ((npp->stats->received_bytes - npp->last_fired_bytes) > NETWORK_XFER_THRESHOLD) {
-		npp->last_fired_bytes = npp->stats->received_bytes;
+	memset(&ring, 0, sizeof(pack_ring));
+	ring.t = t;
 
-		if (npp->callback(npp->stats, npp->payload))
-			return GIT_EUSER;
+	git_mutex_init(&ring.lock);
+	git_cond_init(&ring.cond);
+
+	/* the progress is reported from this thread */
+	t->packetsize_cb = ring_count_received;
+	t->packetsize_payload = &ring;
+
+	for (i = 0; i < PACK_RING_SLOTS; i++) {
+		if ((ring.chunks[i].data = git__malloc(PACK_RING_SLOT_SIZE)) == NULL) {
+			error = -1;
+			goto done;
+		}
 	}
 
-	return 0;
+	if (git_thread_create(&ring.thread, NULL, ring_receive_thread, &ring) != 0) {
+		giterr_set(GITERR_THREAD, "unable to create thread");
+		error = -1;
+		goto done;
+	}
+
+	while (!end && !error) {
+		git_mutex_lock(&ring.lock);
+
+		while (!ring.count && !ring.finished)
+			git_cond_wait(&ring.cond, &ring.lock);
+
+		chunk = ring.count ? &ring.chunks[ring.head] : NULL;
+		git_mutex_unlock(&ring.lock);
+
+		/* the receiver gave up */
+		if (!chunk) {
+			error = ring.error;
+			giterr_state_restore(&ring.error_state);
+			break;
+		}
+
+		if (npp->callback && chunk->received && !t->cancelled.val &&
+			(error = network_packetsize(chunk->received, npp)) != 0)
+			git_atomic_set(&t->cancelled, 1);
+
+		if (error)
+			;
+		else if (chunk->type == PACK_CHUNK_DATA)
+			error = writepack->append(writepack, chunk->data, chunk->len, stats);
+		else if (chunk->type == PACK_CHUNK_PROGRESS)
+			error = t->progress_cb(chunk->data, (int)chunk->len, t->message_cb_payload);
+		else
+			end = true;
+
+		git_mutex_lock(&ring.lock);
+		ring.head = (ring.head + 1) % PACK_RING_SLOTS;
+		ring.count--;
+		git_cond_broadcast(&ring.cond);
+		git_mutex_unlock(&ring.lock);
+	}
+
+	git_mutex_lock(&ring.lock);
+	ring.stopped = 1;
+	git_cond_broadcast(&ring.cond);
+	git_mutex_unlock(&ring.lock);
+
+	git_thread_join(&ring.thread, NULL);
+	giterr_state_free(&ring.error_state);
+
+done:
+	t->packetsize_cb = packetsize_cb;
+	t->packetsize_payload = packetsize_payload;
+
+	git_cond_free(&ring.cond);
+	git_mutex_free(&ring.lock);
+
+	for (i = 0; i < PACK_RING_SLOTS; i++)
+		git__free(ring.chunks[i].data);
+
+	return error;
 }
 
+#endif
+
 int git_smart__download_pack(
 	git_transport *transport,
 	git_repository *repo,
@@ -572,43 +1712,14 @@ int git_smart__download_pack(
 		goto done;
 	}
 
-	do {
-		git_pkt *pkt = NULL;
-
-		/* Check cancellation before network call */
-		if (t->cancelled.val) {
-			giterr_clear();
-			error = GIT_EUSER;
-			goto done;
-		}
-
-		if ((error = recv_pkt(&pkt, buf)) >= 0) {
-			/* Check cancellation after network call */
-			if (t->cancelled.val) {
-				giterr_clear();
-				error = GIT_EUSER;
-			} else if (pkt->type == GIT_PKT_PROGRESS) {
-				if (t->progress_cb) {
-					git_pkt_progress *p = (git_pkt_progress *) pkt;
-					error = t->progress_cb(p->data, p->len, t->message_cb_payload);
-				}
-			} else if (pkt->type == GIT_PKT_DATA) {
-				git_pkt_data *p = (git_pkt_data *) pkt;
-
-				if (p->len)
-					error = writepack->append(writepack, p->data, p->len, stats);
-			} else if (pkt->type == GIT_PKT_FLUSH) {
-				/* A flush indicates the end of the packfile */
-				git__free(pkt);
-				break;
-			}
-		}
-
-		git__free(pkt);
-		if (error < 0)
-			goto done;
+#ifdef GIT_THREADS
+	error = recv_sideband_pipelined(t, writepack, stats, &npp);
+#else
+	error = recv_sideband(t, writepack, stats);
+#endif
 
-	} while (1);
+	if (error < 0)
+		goto done;
 
 	/*
 	 * Trailing execution of transfer_progress_cb, if necessary...
@@ -638,23 +1749,41 @@ done:
 	return error;
 }
 
-static int gen_pktline(git_buf *buf, git_push *push)
+static int gen_pktline(git_buf *buf, git_push *push, transport_smart_caps *caps)
 {
 	push_spec *spec;
 	size_t i, len;
 	char old_id[GIT_OID_HEXSZ+1], new_id[GIT_OID_HEXSZ+1];
+	const git_strarray *options = push->remote_push_options;
+	bool send_options = options && options->count > 0;
+	git_buf capabilities = GIT_BUF_INIT;
+
+	if (push->atomic && !caps->atomic) {
+		giterr_set(GITERR_NET, "The remote does not support atomic pushes");
+		return -1;
+	}
+
+	if (send_options && !caps->push_options) {
+		giterr_set(GITERR_NET, "The remote does not support push options");
+		return -1;
+	}
 
 	old_id[GIT_OID_HEXSZ] = '\0'; new_id[GIT_OID_HEXSZ] = '\0';
 
+	/* Core git always starts their capabilities string with a space */
+	if (push->report_status)
+		git_buf_printf(&capabilities, " %s", GIT_CAP_REPORT_STATUS);
+	git_buf_printf(&capabilities, " %s", GIT_CAP_SIDE_BAND_64K);
+	if (push->atomic)
+		git_buf_printf(&capabilities, " %s", GIT_CAP_ATOMIC);
+	if (send_options)
+		git_buf_printf(&capabilities, " %s", GIT_CAP_PUSH_OPTIONS);
+
 	git_vector_foreach(&push->specs, i, spec) {
 		len = 2*GIT_OID_HEXSZ + 7 + strlen(spec->refspec.dst);
 
-		if (i == 0) {
-			++len; /* '\0' */
-			if (push->report_status)
-				len += strlen(GIT_CAP_REPORT_STATUS) + 1;
-			len += strlen(GIT_CAP_SIDE_BAND_64K) + 1;
-		}
+		if (i == 0)
+			len += 1 + capabilities.size; /* '\0' */
 
 		git_oid_fmt(old_id, &spec->roid);
 		git_oid_fmt(new_id, &spec->loid);
@@ -663,49 +1792,68 @@ static int gen_pktline(git_buf *buf, git_push *push)
 
 		if (i == 0) {
 			git_buf_putc(buf, '\0');
-			/* Core git always starts their capabilities string with a space */
-			if (push->report_status) {
-				git_buf_putc(buf, ' ');
-				git_buf_printf(buf, GIT_CAP_REPORT_STATUS);
-			}
-			git_buf_putc(buf, ' ');
-			git_buf_printf(buf, GIT_CAP_SIDE_BAND_64K);
+			git_buf_put(buf, capabilities.ptr, capabilities.size);
 		}
 
 		git_buf_putc(buf, '\n');
 	}
 
 	git_buf_puts(buf, "0000");
+	git_buf_free(&capabilities);
+
+	/* The push options follow the commands, each on a line of its own */
+	for (i = 0; send_options && i < options->count; i++) {
+		const char *option = options->strings[i];
+
+		if (strchr(option, '\n') != NULL ||
+			strlen(option) + 5 > MAX_PKT_LEN) {
+			giterr_set(GITERR_INVALID, "Invalid push option '%s'", option);
+			return -1;
+		}
+
+		git_buf_printf(buf, "%04"PRIxZ"%s\n", strlen(option) + 5, option);
+	}
+
+	if (send_options)
+		git_buf_puts(buf, "0000");
+
 	return git_buf_oom(buf) ? -1 : 0;
 }
 
-static int add_push_report_pkt(git_push *push, git_pkt *pkt)
+static int add_push_status(
+	git_push *push, const char *ref, const char *msg, const git_remote_callbacks *cbs)
 {
 	push_status *status;
+	int error;
+
+	status = git__calloc(1, sizeof(push_status));
+	GITERR_CHECK_ALLOC(status);
+
+	status->ref = git__strdup(ref);
+	status->msg = msg ? git__strdup(msg) : NULL;
+
+	if (!status->ref || (msg && !status->msg) ||
+		git_vector_insert(&push->status, status) < 0) {
+		git_push_status_free(status);
+		return -1;
+	}
+
+	/* Let the caller know about each update as soon as we do */
+	if (cbs && cbs->push_update_reference &&
+		(error = cbs->push_update_reference(ref, msg, cbs->payload)) != 0)
+		return giterr_set_after_callback_function(error, "push_update_reference");
+
+	return 0;
+}
 
+static int add_push_report_pkt(git_push *push, git_pkt *pkt, const git_remote_callbacks *cbs)
+{
 	switch (pkt->type) {
 		case GIT_PKT_OK:
-			status = git__calloc(1, sizeof(push_status));
-			GITERR_CHECK_ALLOC(status);
-			status->msg = NULL;
-			status->ref = git__strdup(((git_pkt_ok *)pkt)->ref);
-			if (!status->ref ||
-				git_vector_insert(&push->status, status) < 0) {
-				git_push_status_free(status);
-				return -1;
-			}
-			break;
+			return add_push_status(push, ((git_pkt_ok *)pkt)->ref, NULL, cbs);
 		case GIT_PKT_NG:
-			status = git__calloc(1, sizeof(push_status));
-			GITERR_CHECK_ALLOC(status);
-			status->ref = git__strdup(((git_pkt_ng *)pkt)->ref);
-			status->msg = git__strdup(((git_pkt_ng *)pkt)->msg);
-			if (!status->ref || !status->msg ||
-				git_vector_insert(&push->status, status) < 0) {
-				git_push_status_free(status);
-				return -1;
-			}
-			break;
+			return add_push_status(push, ((git_pkt_ng *)pkt)->ref,
+				((git_pkt_ng *)pkt)->msg, cbs);
 		case GIT_PKT_UNPACK:
 			push->unpack_ok = ((git_pkt_unpack *)pkt)->unpack_ok;
 			break;
@@ -719,41 +1867,67 @@ static int add_push_report_pkt(git_push *push, git_pkt *pkt)
 	return 0;
 }
 
-static int add_push_report_sideband_pkt(git_push *push, git_pkt_data *data_pkt)
+/*
+ * The report may come wrapped in side-band packets, which are free to
+ * split the lines of the report wherever they like; whatever is left
+ * of a line at the end of one packet waits in `pending` for the rest.
+ */
+static int add_push_report_sideband_pkt(
+	git_push *push, git_pkt_data *data_pkt, git_buf *pending,
+	const git_remote_callbacks *cbs)
 {
 	git_pkt *pkt;
-	const char *line = data_pkt->data, *line_end;
-	size_t line_len = data_pkt->len;
-	int error;
+	const char *line, *line_end;
+	size_t line_len;
+	int error = 0;
+
+	if (git_buf_put(pending, data_pkt->data, data_pkt->len) < 0)
+		return -1;
+
+	line = pending->ptr;
+	line_len = pending->size;
 
 	while (line_len > 0) {
 		error = git_pkt_parse_line(&pkt, line, &line_end, line_len);
 
+		if (error == GIT_EBUFS) {
+			error = 0;
+			break;
+		}
+
 		if (error < 0)
-			return error;
+			break;
 
 		/* Advance in the buffer */
 		line_len -= (line_end - line);
 		line = line_end;
 
-		error = add_push_report_pkt(push, pkt);
+		error = add_push_report_pkt(push, pkt, cbs);
 
 		git_pkt_free(pkt);
 
-		if (error < 0 && error != GIT_ITEROVER)
-			return error;
+		if (error == GIT_ITEROVER)
+			error = 0;
+
+		if (error < 0)
+			break;
 	}
 
-	return 0;
+	git_buf_consume(pending, line);
+	return error;
 }
 
-static int parse_report(transport_smart *transport, git_push *push)
+static int parse_report(
+	transport_smart *transport, git_push *push, const git_remote_callbacks *cbs)
 {
 	git_pkt *pkt = NULL;
 	const char *line_end = NULL;
 	gitno_buffer *buf = &transport->buffer;
+	git_buf pending = GIT_BUF_INIT;
 	int error, recvd;
 
+	push->status_reported = cbs && cbs->push_update_reference;
+
 	for (;;) {
 		if (buf->offset > 0)
 			error = git_pkt_parse_line(&pkt, buf->data,
@@ -761,16 +1935,21 @@ static int parse_report(transport_smart *transport, git_push *push)
 		else
 			error = GIT_EBUFS;
 
-		if (error < 0 && error != GIT_EBUFS)
-			return -1;
+		if (error < 0 && error != GIT_EBUFS) {
+			error = -1;
+			goto done;
+		}
 
 		if (error == GIT_EBUFS) {
-			if ((recvd = gitno_recv(buf)) < 0)
-				return recvd;
+			if ((recvd = gitno_recv(buf)) < 0) {
+				error = recvd;
+				goto done;
+			}
 
 			if (recvd == 0) {
 				giterr_set(GITERR_NET, "early EOF");
-				return GIT_EEOF;
+				error = GIT_EEOF;
+				goto done;
 			}
 			continue;
 		}
@@ -782,7 +1961,7 @@ static int parse_report(transport_smart *transport, git_push *push)
 		switch (pkt->type) {
 			case GIT_PKT_DATA:
 				/* This is a sideband packet which contains other packets */
-				error = add_push_report_sideband_pkt(push, (git_pkt_data *)pkt);
+				error = add_push_report_sideband_pkt(push, (git_pkt_data *)pkt, &pending, cbs);
 				break;
 			case GIT_PKT_ERR:
 				giterr_set(GITERR_NET, "report-status: Error reported: %s",
@@ -796,19 +1975,31 @@ static int parse_report(transport_smart *transport, git_push *push)
 				}
 				break;
 			default:
-				error = add_push_report_pkt(push, pkt);
+				error = add_push_report_pkt(push, pkt, cbs);
 				break;
 		}
 
 		git_pkt_free(pkt);
 
 		/* add_push_report_pkt returns GIT_ITEROVER when it receives a flush */
-		if (error == GIT_ITEROVER)
-			return 0;
+		if (error == GIT_ITEROVER) {
+			error = 0;
+
+			if (pending.size) {
+				giterr_set(GITERR_NET, "report-status: incomplete line");
+				error = -1;
+			}
+
+			goto done;
+		}
 
 		if (error < 0)
-			return error;
+			goto done;
 	}
+
+done:
+	git_buf_free(&pending);
+	return error;
 }
 
 static int add_ref_from_push_spec(git_vector *refs, push_spec *push_spec)
@@ -994,7 +2185,7 @@ int git_smart__push(git_transport *transport, git_push *push, const git_remote_c
 	}
 
 	if ((error = git_smart__get_push_stream(t, &packbuilder_payload.stream)) < 0 ||
-		(error = gen_pktline(&pktline, push)) < 0 ||
+		(error = gen_pktline(&pktline, push, &t->caps)) < 0 ||
 		(error = packbuilder_payload.stream->write(packbuilder_payload.stream, git_buf_cstr(&pktline), git_buf_len(&pktline))) < 0)
 		goto done;
 
@@ -1006,7 +2197,7 @@ int git_smart__push(git_transport *transport, git_push *push, const git_remote_c
 	 * we consider the pack to have been unpacked successfully */
 	if (!push->specs.length || !push->report_status)
 		push->unpack_ok = 1;
-	else if ((error = parse_report(t, push)) < 0)
+	else if ((error = parse_report(t, push, cbs)) < 0)
 		goto done;
 
 	/* If progress is being reported write the final report */
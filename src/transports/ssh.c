@@ -99,6 +99,18 @@ static int send_command(ssh_stream *s)
 	if (error < 0)
 		goto cleanup;
 
+	/*
+	 * Most servers refuse to set the variable, in which case they
+	 * simply answer in the older protocol.
+	 */
+	if (OWNING_SUBTRANSPORT(s)->owner->version) {
+		char version[16];
+
+		p_snprintf(version, sizeof(version), "version=%d",
+			OWNING_SUBTRANSPORT(s)->owner->version);
+		(void)libssh2_channel_setenv(s->channel, "GIT_PROTOCOL", version);
+	}
+
 	error = libssh2_channel_exec(s->channel, request.ptr);
 	if (error < LIBSSH2_ERROR_NONE) {
 		ssh_error(s->session, "SSH could not execute request");
@@ -0,0 +1,1152 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+#include "git2/sys/server.h"
+#include "git2/object.h"
+#include "git2/pack.h"
+#include "git2/revwalk.h"
+#include "git2/tag.h"
+
+#include "server.h"
+#include "smart.h"
+#include "refs.h"
+#include "repository.h"
+#include "revwalk.h"
+#include "pack-objects.h"
+#include "oidarray.h"
+
+GIT__USE_OIDMAP
+
+/* The flavours of acknowledgements a client can ask for */
+#define MULTI_ACK_NONE 0
+#define MULTI_ACK 1
+#define MULTI_ACK_DETAILED 2
+
+/* The flags of the commits in the negotiation walk */
+#define THEY_HAVE (1 << 0)
+#define REACHES_COMMON (1 << 1)
+#define EXPLORED (1 << 2)
+
+typedef struct {
+	git_oid oid;
+
+	/* the object an annotated tag points to */
+	git_oid peeled;
+	unsigned int is_tag:1;
+
+	char name[GIT_FLEX_ARRAY];
+} advertised_ref;
+
+typedef struct {
+	git_repository *repo;
+	const git_upload_pack_options *opts;
+	git_server_io io;
+
+	git_vector refs;
+	git_oidmap *advertised;
+	char *head_target;
+
+	/* the capabilities the client asked for */
+	int multi_ack;
+	unsigned int no_progress:1,
+		include_tag:1,
+		sending_pack:1;
+
+	/* whether this round had haves we share, and ones we don't */
+	unsigned int got_common:1,
+		got_other:1;
+
+	git_array_oid_t wants;
+	git_array_oid_t common;
+
+	/* the commits the client told about, the common ones flagged */
+	git_revwalk *walk;
+	int64_t oldest_common;
+} upload_pack;
+
+/* HEAD comes first, the others by name */
+static int ref_cmp(const void *a, const void *b)
+{
+	const advertised_ref *ref_a = a, *ref_b = b;
+
+	if (!strcmp(ref_a->name, GIT_HEAD_FILE))
+		return -1;
+	if (!strcmp(ref_b->name, GIT_HEAD_FILE))
+		return 1;
+
+	return strcmp(ref_a->name, ref_b->name);
+}
+
+static int add_ref(upload_pack *up, const char *name, const git_oid *id)
+{
+	advertised_ref *ref;
+	git_object *obj = NULL, *peeled = NULL;
+	size_t namelen = strlen(name), alloclen;
+	int error;
+
+	GITERR_CHECK_ALLOC_ADD(&alloclen, sizeof(advertised_ref), namelen + 1);
+	ref = git__calloc(1, alloclen);
+	GITERR_CHECK_ALLOC(ref);
+
+	memcpy(ref->name, name, namelen + 1);
+	git_oid_cpy(&ref->oid, id);
+
+	if ((error = git_vector_insert(&up->refs, ref)) < 0) {
+		git__free(ref);
+		return error;
+	}
+
+	git_oidmap_insert(up->advertised, &ref->oid, ref, error);
+	if (error < 0) {
+		giterr_set_oom();
+		return -1;
+	}
+
+	if (git__prefixcmp(name, GIT_REFS_TAGS_DIR) != 0)
+		return 0;
+
+	if ((error = git_object_lookup(&obj, up->repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	if (git_object_type(obj) == GIT_OBJ_TAG) {
+		if ((error = git_object_peel(&peeled, obj, GIT_OBJ_ANY)) < 0)
+			goto done;
+
+		/* peeling stops at the first object which isn't a tag */
+		while (git_object_type(peeled) == GIT_OBJ_TAG) {
+			git_object *next;
+
+			if ((error = git_object_peel(&next, peeled, GIT_OBJ_ANY)) < 0)
+				goto done;
+
+			git_object_free(peeled);
+			peeled = next;
+		}
+
+		git_oid_cpy(&ref->peeled, git_object_id(peeled));
+		ref->is_tag = 1;
+	}
+
+done:
+	git_object_free(peeled);
+	git_object_free(obj);
+	return error;
+}
+
+static int load_refs(upload_pack *up)
+{
+	git_reference_iterator *iter = NULL;
+	git_reference *ref = NULL, *head = NULL, *resolved = NULL;
+	int error;
+
+	if ((error = git_reference_iterator_new(&iter, up->repo)) < 0)
+		return error;
+
+	while ((error = git_reference_next(&ref, iter)) == 0) {
+		/* a symbolic reference is advertised by its target's name */
+		if (git_reference_type(ref) == GIT_REF_OID &&
+			(error = add_ref(up, git_reference_name(ref), git_reference_target(ref))) < 0)
+			goto done;
+
+		git_reference_free(ref);
+		ref = NULL;
+	}
+
+	if (error != GIT_ITEROVER)
+		goto done;
+
+	/* HEAD is advertised if it leads anywhere */
+	if ((error = git_reference_lookup(&head, up->repo, GIT_HEAD_FILE)) < 0 ||
+		(error = git_reference_resolve(&resolved, head)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			goto done;
+
+		giterr_clear();
+	} else {
+		if ((error = add_ref(up, GIT_HEAD_FILE, git_reference_target(resolved))) < 0)
+			goto done;
+
+		if (git_reference_type(head) == GIT_REF_SYMBOLIC) {
+			up->head_target = git__strdup(git_reference_symbolic_target(head));
+			GITERR_CHECK_ALLOC(up->head_target);
+		}
+	}
+
+	git_vector_sort(&up->refs);
+	error = 0;
+
+done:
+	git_reference_free(resolved);
+	git_reference_free(head);
+	git_reference_free(ref);
+	git_reference_iterator_free(iter);
+	return error;
+}
+
+static int send_capabilities(upload_pack *up, git_buf *caps)
+{
+	git_buf_puts(caps,
+		GIT_CAP_MULTI_ACK " "
+		GIT_CAP_MULTI_ACK_DETAILED " "
+		GIT_CAP_SIDE_BAND " "
+		GIT_CAP_SIDE_BAND_64K " "
+		GIT_CAP_NO_PROGRESS " "
+		GIT_CAP_INCLUDE_TAG);
+
+	if (up->head_target)
+		git_buf_printf(caps, " " GIT_CAP_SYMREF "=HEAD:%s", up->head_target);
+
+	return git_buf_oom(caps) ? -1 : 0;
+}
+
+static int advertise_refs(upload_pack *up)
+{
+	git_buf caps = GIT_BUF_INIT;
+	char oid[GIT_OID_HEXSZ + 1];
+	advertised_ref *ref;
+	size_t i;
+	int error;
+
+	if ((error = send_capabilities(up, &caps)) < 0)
+		goto done;
+
+	/* the capabilities ride on the first line, even without refs */
+	if (!up->refs.length) {
+		git_oid zero = {{0}};
+
+		git_oid_tostr(oid, sizeof(oid), &zero);
+		error = git_server__send(&up->io, "%s capabilities^{}%c%s", oid, '\0', caps.ptr);
+		goto done;
+	}
+
+	git_vector_foreach(&up->refs, i, ref) {
+		git_oid_tostr(oid, sizeof(oid), &ref->oid);
+
+		if (i == 0)
+			error = git_server__send(&up->io, "%s %s%c%s", oid, ref->name, '\0', caps.ptr);
+		else
+			error = git_server__send(&up->io, "%s %s", oid, ref->name);
+
+		if (!error && ref->is_tag) {
+			git_oid_tostr(oid, sizeof(oid), &ref->peeled);
+			error = git_server__send(&up->io, "%s %s^{}", oid, ref->name);
+		}
+
+		if (error < 0)
+			goto done;
+	}
+
+done:
+	if (!error)
+		error = git_server__send_flush(&up->io);
+
+	git_buf_free(&caps);
+	return error;
+}
+
+static bool is_advertised(upload_pack *up, const git_oid *id)
+{
+	return git_oidmap_valid_index(up->advertised,
+		git_oidmap_lookup_index(up->advertised, id));
+}
+
+static void parse_caps(upload_pack *up, const char *caps)
+{
+	if (git_server__has_cap(caps, GIT_CAP_MULTI_ACK_DETAILED))
+		up->multi_ack = MULTI_ACK_DETAILED;
+	else if (git_server__has_cap(caps, GIT_CAP_MULTI_ACK))
+		up->multi_ack = MULTI_ACK;
+
+	if (git_server__has_cap(caps, GIT_CAP_SIDE_BAND_64K))
+		up->io.sideband = GIT_SERVER_MAX_PKT;
+	else if (git_server__has_cap(caps, GIT_CAP_SIDE_BAND))
+		up->io.sideband = 1000;
+
+	up->no_progress = git_server__has_cap(caps, GIT_CAP_NO_PROGRESS);
+	up->include_tag = git_server__has_cap(caps, GIT_CAP_INCLUDE_TAG);
+}
+
+static int add_want(upload_pack *up, const git_oid *id)
+{
+	git_oid *want;
+
+	if (!is_advertised(up, id)) {
+		char oid[GIT_OID_HEXSZ + 1];
+
+		git_oid_tostr(oid, sizeof(oid), id);
+		giterr_set(GITERR_NET, "upload-pack: not our ref %s", oid);
+		return -1;
+	}
+
+	want = git_array_alloc(up->wants);
+	GITERR_CHECK_ALLOC(want);
+	git_oid_cpy(want, id);
+
+	return 0;
+}
+
+/* Returns GIT_ITEROVER when the client hung up without wanting anything */
+static int recv_wants(upload_pack *up)
+{
+	git_buf line = GIT_BUF_INIT;
+	git_server_pkt_t type;
+	const char *rest;
+	git_oid id;
+	int error;
+
+	while ((error = git_server__recv(&type, &line, &up->io)) == 0 &&
+		type == GIT_SERVER_LINE) {
+		if (git__prefixcmp(line.ptr, "want ") != 0) {
+			giterr_set(GITERR_NET, "Unexpected line '%s', expected a want", line.ptr);
+			error = -1;
+			goto done;
+		}
+
+		if ((error = git_server__parse_oid(&id, line.ptr + 5, &rest)) < 0)
+			goto done;
+
+		if (!git_array_size(up->wants))
+			parse_caps(up, rest);
+
+		if ((error = add_want(up, &id)) < 0)
+			goto done;
+	}
+
+	if (error < 0)
+		goto done;
+
+	if (type == GIT_SERVER_DELIM) {
+		giterr_set(GITERR_NET, "Unexpected delimiter, expected a want");
+		error = -1;
+		goto done;
+	}
+
+	if (type == GIT_SERVER_EOF && git_array_size(up->wants)) {
+		giterr_set(GITERR_NET, "Unexpected end of the request");
+		error = -1;
+		goto done;
+	}
+
+	if (!git_array_size(up->wants))
+		error = GIT_ITEROVER;
+
+done:
+	git_buf_free(&line);
+	return error;
+}
+
+/*
+ * Walk the ancestry of a want depth-first, looking for a commit we
+ * have in common with the client. Commits older than the oldest common
+ * one can't lead to it, and what we learn stays on the commits for the
+ * other wants.
+ */
+static int reaches_common(
+	bool *out, upload_pack *up, git_commit_list_node *want, git_vector *explored)
+{
+	git_vector stack = GIT_VECTOR_INIT;
+	git_commit_list_node *commit, *parent;
+	unsigned short i;
+	int error;
+
+	if ((error = git_vector_insert(&stack, want)) < 0)
+		return error;
+
+	while ((commit = git_vector_last(&stack)) != NULL) {
+		if (up->walk->store.flags[commit->id] & (THEY_HAVE | REACHES_COMMON)) {
+			git_vector_pop(&stack);
+			continue;
+		}
+
+		/* a tag, or a commit cut off in a shallow repository */
+		if (!commit->parsed && git_commit_list_parse(up->walk, commit) < 0)
+			giterr_clear();
+
+		parent = NULL;
+
+		for (i = 0; commit->parsed && i < commit->out_degree; i++) {
+			parent = git_commit_store_parent(&up->walk->store, commit, i);
+
+			if (up->walk->store.flags[parent->id] & (THEY_HAVE | REACHES_COMMON)) {
+				up->walk->store.flags[commit->id] |= REACHES_COMMON;
+				break;
+			}
+
+			if (!(up->walk->store.flags[parent->id] & EXPLORED))
+				break;
+
+			parent = NULL;
+		}
+
+		if (up->walk->store.flags[commit->id] & REACHES_COMMON) {
+			git_vector_pop(&stack);
+		} else if (parent && commit->time >= up->oldest_common) {
+			if ((error = git_vector_insert(&stack, parent)) < 0)
+				goto done;
+		} else {
+			up->walk->store.flags[commit->id] |= EXPLORED;
+			git_vector_pop(&stack);
+
+			if ((error = git_vector_insert(explored, commit)) < 0)
+				goto done;
+		}
+	}
+
+	*out = !!(up->walk->store.flags[want->id] & (THEY_HAVE | REACHES_COMMON));
+
+done:
+	git_vector_free(&stack);
+	return error;
+}
+
+/*
+ * We can stop negotiating once every want descends from a commit we
+ * have in common with the client.
+ */
+static int ok_to_give_up(bool *out, upload_pack *up)
+{
+	git_vector explored = GIT_VECTOR_INIT;
+	git_commit_list_node *commit;
+	bool reaches = true;
+	size_t i;
+	int error = 0;
+
+	*out = false;
+
+	if (!up->walk)
+		return 0;
+
+	for (i = 0; reaches && i < git_array_size(up->wants); i++) {
+		if ((commit = git_revwalk__commit_lookup(
+				up->walk, git_array_get(up->wants, i))) == NULL) {
+			error = -1;
+			goto done;
+		}
+
+		if ((error = reaches_common(&reaches, up, commit, &explored)) < 0)
+			goto done;
+	}
+
+	*out = reaches;
+
+done:
+	/* a commit which can't reach the common ones now may later on */
+	git_vector_foreach(&explored, i, commit)
+		up->walk->store.flags[commit->id] &= ~EXPLORED;
+
+	git_vector_free(&explored);
+	return error;
+}
+
+static int send_ack(upload_pack *up, const git_oid *id, const char *status)
+{
+	char oid[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(oid, sizeof(oid), id);
+
+	if (status)
+		return git_server__send(&up->io, "ACK %s %s", oid, status);
+
+	return git_server__send(&up->io, "ACK %s", oid);
+}
+
+/*
+ * Look at a have of the client: a commit we have as well is common.
+ * Returns GIT_ENOTFOUND when we don't have the object.
+ */
+static int add_have(bool *common, upload_pack *up, const git_oid *id)
+{
+	git_commit_list_node *commit;
+	git_odb *odb;
+	git_otype type;
+	git_oid *entry;
+	size_t len;
+	int error;
+
+	*common = false;
+
+	if ((error = git_repository_odb__weakptr(&odb, up->repo)) < 0)
+		return error;
+
+	if ((error = git_odb_read_header(&len, &type, odb, id)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			giterr_clear();
+
+		return error;
+	}
+
+	if (type != GIT_OBJ_COMMIT)
+		return 0;
+
+	if (!up->walk && (error = git_revwalk_new(&up->walk, up->repo)) < 0)
+		return error;
+
+	if ((commit = git_revwalk__commit_lookup(up->walk, id)) == NULL)
+		return -1;
+
+	*common = true;
+
+	if (up->walk->store.flags[commit->id] & THEY_HAVE)
+		return 0;
+
+	if (!commit->parsed && (error = git_commit_list_parse(up->walk, commit)) < 0)
+		return error;
+
+	if (!git_array_size(up->common) || commit->time < up->oldest_common)
+		up->oldest_common = commit->time;
+
+	up->walk->store.flags[commit->id] |= THEY_HAVE;
+
+	entry = git_array_alloc(up->common);
+	GITERR_CHECK_ALLOC(entry);
+	git_oid_cpy(entry, id);
+
+	return 0;
+}
+
+/*
+ * Acknowledge a have we share with the client. Once a multi_ack
+ * client offers commits we don't know, it also learns whether it can
+ * stop offering them.
+ */
+static int recv_have(upload_pack *up, const git_oid *id)
+{
+	bool common, ready;
+	int error;
+
+	if ((error = add_have(&common, up, id)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		up->got_other = 1;
+
+		if (!up->multi_ack || (error = ok_to_give_up(&ready, up)) < 0 || !ready)
+			return error;
+
+		if (up->multi_ack == MULTI_ACK)
+			return send_ack(up, id, "continue");
+
+		return send_ack(up, id, "ready");
+	}
+
+	if (!common)
+		return 0;
+
+	up->got_common = 1;
+
+	if (up->multi_ack == MULTI_ACK_DETAILED)
+		return send_ack(up, id, "common");
+	else if (up->multi_ack == MULTI_ACK)
+		return send_ack(up, id, "continue");
+	else if (git_array_size(up->common) == 1)
+		return send_ack(up, id, NULL);
+
+	return 0;
+}
+
+/*
+ * Answer the haves, round by round. Returns GIT_ITEROVER when a
+ * stateless request ends before the client is done.
+ */
+static int negotiate(upload_pack *up)
+{
+	git_buf line = GIT_BUF_INIT;
+	git_server_pkt_t type;
+	git_oid id;
+	bool ready;
+	int error;
+
+	while ((error = git_server__recv(&type, &line, &up->io)) == 0) {
+		if (type == GIT_SERVER_EOF) {
+			giterr_set(GITERR_NET, "Unexpected end of the request");
+			error = -1;
+			break;
+		}
+
+		if (type == GIT_SERVER_FLUSH) {
+			if (up->multi_ack == MULTI_ACK_DETAILED &&
+				up->got_common && !up->got_other) {
+				if ((error = ok_to_give_up(&ready, up)) < 0)
+					break;
+
+				if (ready)
+					error = send_ack(up,
+						git_array_get(up->common, git_array_size(up->common) - 1),
+						"ready");
+			}
+
+			up->got_common = 0;
+			up->got_other = 0;
+
+			if (!error && (!git_array_size(up->common) || up->multi_ack))
+				error = git_server__send(&up->io, "NAK");
+
+			if (!error)
+				error = git_server__flush_output(&up->io);
+
+			if (!error && up->opts->stateless_rpc)
+				error = GIT_ITEROVER;
+
+			if (error)
+				break;
+
+			continue;
+		}
+
+		if (!strcmp(line.ptr, "done"))
+			break;
+
+		if (git__prefixcmp(line.ptr, "have ") != 0) {
+			giterr_set(GITERR_NET, "Unexpected line '%s', expected a have", line.ptr);
+			error = -1;
+			break;
+		}
+
+		if ((error = git_server__parse_oid(&id, line.ptr + 5, NULL)) < 0 ||
+			(error = recv_have(up, &id)) < 0)
+			break;
+	}
+
+	/* without multi_ack, the client has seen its ACK already */
+	if (!error && !git_array_size(up->common))
+		error = git_server__send(&up->io, "NAK");
+	else if (!error && up->multi_ack)
+		error = send_ack(up,
+			git_array_get(up->common, git_array_size(up->common) - 1), NULL);
+
+	git_buf_free(&line);
+	return error;
+}
+
+static int insert_want(git_packbuilder *pb, git_revwalk *walk, const git_oid *id)
+{
+	git_object *obj = NULL, *target = NULL;
+	int error;
+
+	if ((error = git_object_lookup(&obj, pb->repo, id, GIT_OBJ_ANY)) < 0)
+		return error;
+
+	/* a tag comes with the tags and the object it points to */
+	while (git_object_type(obj) == GIT_OBJ_TAG) {
+		if ((error = git_packbuilder_insert(pb, git_object_id(obj), NULL)) < 0 ||
+			(error = git_tag_target(&target, (git_tag *)obj)) < 0)
+			goto done;
+
+		git_object_free(obj);
+		obj = target;
+		target = NULL;
+	}
+
+	switch (git_object_type(obj)) {
+	case GIT_OBJ_COMMIT:
+		error = git_revwalk_push(walk, git_object_id(obj));
+		break;
+	case GIT_OBJ_TREE:
+		error = git_packbuilder_insert_tree(pb, git_object_id(obj));
+		break;
+	default:
+		error = git_packbuilder_insert(pb, git_object_id(obj), NULL);
+		break;
+	}
+
+done:
+	git_object_free(target);
+	git_object_free(obj);
+	return error;
+}
+
+/* Send the tags which point to objects in the pack */
+static int include_tags(upload_pack *up, git_packbuilder *pb)
+{
+	advertised_ref *ref;
+	size_t i;
+	int error;
+
+	git_vector_foreach(&up->refs, i, ref) {
+		if (!ref->is_tag ||
+			git_oidmap_lookup_index(pb->object_ix, &ref->peeled) == kh_end(pb->object_ix) ||
+			git_oidmap_lookup_index(pb->object_ix, &ref->oid) != kh_end(pb->object_ix))
+			continue;
+
+		if ((error = git_packbuilder_insert(pb, &ref->oid, NULL)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int send_pack_data(void *buf, size_t size, void *payload)
+{
+	upload_pack *up = payload;
+
+	return git_server__send_band(&up->io, GIT_SIDE_BAND_DATA, buf, size);
+}
+
+static int send_progress(
+	int stage, unsigned int current, unsigned int total, void *payload)
+{
+	upload_pack *up = payload;
+	git_buf msg = GIT_BUF_INIT;
+	int error;
+
+	if (stage == GIT_PACKBUILDER_ADDING_OBJECTS)
+		git_buf_printf(&msg, "Counting objects: %u\r", current);
+	else
+		git_buf_printf(&msg, "Compressing objects: %3u%% (%u/%u)%s",
+			total ? current * 100 / total : 100, current, total,
+			current == total ? ", done.\n" : "\r");
+
+	if (git_buf_oom(&msg))
+		return -1;
+
+	if ((error = git_server__send_band(&up->io, GIT_SIDE_BAND_PROGRESS, msg.ptr, msg.size)) == 0)
+		error = git_server__flush_output(&up->io);
+
+	git_buf_free(&msg);
+	return error;
+}
+
+static int send_pack(upload_pack *up)
+{
+	git_packbuilder *pb = NULL;
+	git_revwalk *walk = NULL;
+	size_t i;
+	int error;
+
+	if ((error = git_packbuilder_new(&pb, up->repo)) < 0 ||
+		(error = git_revwalk_new(&walk, up->repo)) < 0)
+		goto done;
+
+	git_packbuilder_set_threads(pb, 0);
+
+	if (up->io.sideband && !up->no_progress &&
+		(error = git_packbuilder_set_callbacks(pb, send_progress, up)) < 0)
+		goto done;
+
+	for (i = 0; i < git_array_size(up->wants); i++) {
+		if ((error = insert_want(pb, walk, git_array_get(up->wants, i))) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < git_array_size(up->common); i++) {
+		if ((error = git_revwalk_hide(walk, git_array_get(up->common, i))) < 0)
+			goto done;
+	}
+
+	if ((error = git_packbuilder_insert_walk(pb, walk)) < 0)
+		goto done;
+
+	if (up->include_tag && (error = include_tags(up, pb)) < 0)
+		goto done;
+
+	up->sending_pack = 1;
+
+	if ((error = git_packbuilder_foreach(pb, send_pack_data, up)) < 0)
+		goto done;
+
+	if (up->io.sideband)
+		error = git_server__send_flush(&up->io);
+
+done:
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	return error;
+}
+
+/* Let the client know why we're giving up, if we still can */
+static void send_error(upload_pack *up)
+{
+	const git_error *e = giterr_last();
+	const char *msg = e ? e->message : "unknown error";
+	git_buf buf = GIT_BUF_INIT;
+
+	if (!up->sending_pack) {
+		git_server__send(&up->io, "ERR %s", msg);
+	} else if (up->io.sideband) {
+		git_buf_printf(&buf, "error: %s\n", msg);
+		git_server__send_band(&up->io, GIT_SIDE_BAND_ERROR, buf.ptr, buf.size);
+		git_buf_free(&buf);
+	}
+
+	git_server__flush_output(&up->io);
+}
+
+/*
+ * In protocol v2, the capabilities are advertised in place of the refs;
+ * the client then sends commands, each with its arguments.
+ */
+static int advertise_v2(upload_pack *up)
+{
+	int error;
+
+	if ((error = git_server__send(&up->io, "version 2")) < 0 ||
+		(error = git_server__send(&up->io, "ls-refs")) < 0 ||
+		(error = git_server__send(&up->io, "fetch")) < 0 ||
+		(error = git_server__send(&up->io, "object-format=sha1")) < 0)
+		return error;
+
+	return git_server__send_flush(&up->io);
+}
+
+/*
+ * Receive the command of a v2 request, past the client's capabilities;
+ * `args` tells whether arguments follow. Returns GIT_ITEROVER when the
+ * client is done.
+ */
+static int recv_command(git_buf *command, bool *args, upload_pack *up)
+{
+	git_buf line = GIT_BUF_INIT;
+	git_server_pkt_t type;
+	int error;
+
+	if ((error = git_server__recv(&type, &line, &up->io)) < 0)
+		goto done;
+
+	if (type == GIT_SERVER_EOF || type == GIT_SERVER_FLUSH) {
+		error = GIT_ITEROVER;
+		goto done;
+	}
+
+	if (type != GIT_SERVER_LINE || git__prefixcmp(line.ptr, "command=") != 0) {
+		giterr_set(GITERR_NET, "Unexpected line '%s', expected a command", line.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_buf_sets(command, line.ptr + strlen("command="))) < 0)
+		goto done;
+
+	while ((error = git_server__recv(&type, &line, &up->io)) == 0 &&
+		type == GIT_SERVER_LINE) {
+		if (!git__prefixcmp(line.ptr, "object-format=") &&
+			strcmp(line.ptr + strlen("object-format="), "sha1") != 0) {
+			giterr_set(GITERR_NET, "Unsupported object format '%s'",
+				line.ptr + strlen("object-format="));
+			error = -1;
+			goto done;
+		}
+	}
+
+	if (!error && type == GIT_SERVER_EOF) {
+		giterr_set(GITERR_NET, "Unexpected end of the request");
+		error = -1;
+	}
+
+	*args = (type == GIT_SERVER_DELIM);
+
+done:
+	git_buf_free(&line);
+	return error;
+}
+
+/* Receive an argument of a v2 command; `more` is false past the last */
+static int recv_arg(bool *more, git_buf *line, upload_pack *up)
+{
+	git_server_pkt_t type;
+	int error;
+
+	if ((error = git_server__recv(&type, line, &up->io)) < 0)
+		return error;
+
+	if (type != GIT_SERVER_LINE && type != GIT_SERVER_FLUSH) {
+		giterr_set(GITERR_NET, "Unexpected end of the arguments");
+		return -1;
+	}
+
+	*more = (type == GIT_SERVER_LINE);
+	return 0;
+}
+
+static bool has_prefix(const git_vector *prefixes, const char *name)
+{
+	const char *prefix;
+	size_t i;
+
+	git_vector_foreach(prefixes, i, prefix) {
+		if (!git__prefixcmp(name, prefix))
+			return true;
+	}
+
+	return !prefixes->length;
+}
+
+static int ls_refs_v2(upload_pack *up, bool more)
+{
+	git_vector prefixes = GIT_VECTOR_INIT;
+	git_buf line = GIT_BUF_INIT;
+	char oid[GIT_OID_HEXSZ + 1], *prefix;
+	bool symrefs = false, peel = false;
+	advertised_ref *ref;
+	size_t i;
+	int error = 0;
+
+	while (more) {
+		if ((error = recv_arg(&more, &line, up)) < 0 || !more)
+			break;
+
+		if (!strcmp(line.ptr, "symrefs")) {
+			symrefs = true;
+		} else if (!strcmp(line.ptr, "peel")) {
+			peel = true;
+		} else if (!git__prefixcmp(line.ptr, "ref-prefix ")) {
+			prefix = git__strdup(line.ptr + strlen("ref-prefix "));
+			GITERR_CHECK_ALLOC(prefix);
+
+			if ((error = git_vector_insert(&prefixes, prefix)) < 0) {
+				git__free(prefix);
+				break;
+			}
+		} else {
+			giterr_set(GITERR_NET, "Unexpected argument '%s' to ls-refs", line.ptr);
+			error = -1;
+			break;
+		}
+	}
+
+	git_vector_foreach(&up->refs, i, ref) {
+		if (error < 0)
+			break;
+
+		if (!has_prefix(&prefixes, ref->name))
+			continue;
+
+		git_buf_clear(&line);
+		git_oid_tostr(oid, sizeof(oid), &ref->oid);
+		git_buf_printf(&line, "%s %s", oid, ref->name);
+
+		if (symrefs && up->head_target && !strcmp(ref->name, GIT_HEAD_FILE))
+			git_buf_printf(&line, " symref-target:%s", up->head_target);
+
+		if (peel && ref->is_tag) {
+			git_oid_tostr(oid, sizeof(oid), &ref->peeled);
+			git_buf_printf(&line, " peeled:%s", oid);
+		}
+
+		if (git_buf_oom(&line))
+			error = -1;
+		else
+			error = git_server__send(&up->io, "%s", line.ptr);
+	}
+
+	if (!error)
+		error = git_server__send_flush(&up->io);
+
+	git_vector_foreach(&prefixes, i, prefix)
+		git__free(prefix);
+
+	git_vector_free(&prefixes);
+	git_buf_free(&line);
+	return error;
+}
+
+/*
+ * A v2 fetch request stands on its own. Without "done", the haves are
+ * acknowledged, and the pack follows right away if we're ready.
+ */
+static int fetch_v2(upload_pack *up, bool more)
+{
+	git_array_oid_t acks = GIT_ARRAY_INIT;
+	git_buf line = GIT_BUF_INIT;
+	char oid[GIT_OID_HEXSZ + 1];
+	bool got_done = false, common, ready;
+	git_oid id, *ack;
+	size_t i;
+	int error = 0;
+
+	git_array_clear(up->wants);
+	git_array_clear(up->common);
+	git_revwalk_free(up->walk);
+	up->walk = NULL;
+	up->no_progress = up->include_tag = up->sending_pack = 0;
+
+	/* the pack is always multiplexed */
+	up->io.sideband = GIT_SERVER_MAX_PKT;
+
+	while (more) {
+		if ((error = recv_arg(&more, &line, up)) < 0 || !more)
+			break;
+
+		if (!git__prefixcmp(line.ptr, "want ")) {
+			if ((error = git_server__parse_oid(&id, line.ptr + 5, NULL)) < 0 ||
+				(error = add_want(up, &id)) < 0)
+				break;
+		} else if (!git__prefixcmp(line.ptr, "have ")) {
+			if ((error = git_server__parse_oid(&id, line.ptr + 5, NULL)) < 0 ||
+				((error = add_have(&common, up, &id)) < 0 && error != GIT_ENOTFOUND))
+				break;
+
+			if (!error && common) {
+				ack = git_array_alloc(acks);
+				GITERR_CHECK_ALLOC(ack);
+				git_oid_cpy(ack, &id);
+			}
+
+			error = 0;
+		} else if (!strcmp(line.ptr, "done")) {
+			got_done = true;
+		} else if (!strcmp(line.ptr, GIT_CAP_NO_PROGRESS)) {
+			up->no_progress = 1;
+		} else if (!strcmp(line.ptr, GIT_CAP_INCLUDE_TAG)) {
+			up->include_tag = 1;
+		} else if (strcmp(line.ptr, GIT_CAP_THIN_PACK) != 0 &&
+			strcmp(line.ptr, GIT_CAP_OFS_DELTA) != 0) {
+			giterr_set(GITERR_NET, "Unexpected argument '%s' to fetch", line.ptr);
+			error = -1;
+			break;
+		}
+	}
+
+	if (error < 0)
+		goto done;
+
+	/* the client has no more haves to offer */
+	if (got_done)
+		goto pack;
+
+	if ((error = git_server__send(&up->io, "acknowledgments")) < 0)
+		goto done;
+
+	for (i = 0; i < git_array_size(acks); i++) {
+		git_oid_tostr(oid, sizeof(oid), git_array_get(acks, i));
+
+		if ((error = git_server__send(&up->io, "ACK %s", oid)) < 0)
+			goto done;
+	}
+
+	if ((!git_array_size(acks) &&
+		(error = git_server__send(&up->io, "NAK")) < 0) ||
+		(error = ok_to_give_up(&ready, up)) < 0)
+		goto done;
+
+	if (!ready) {
+		error = git_server__send_flush(&up->io);
+		goto done;
+	}
+
+	if ((error = git_server__send(&up->io, "ready")) < 0 ||
+		(error = git_server__send_delim(&up->io)) < 0)
+		goto done;
+
+pack:
+	if ((error = git_server__send(&up->io, "packfile")) == 0)
+		error = send_pack(up);
+
+done:
+	git_array_clear(acks);
+	git_buf_free(&line);
+	return error;
+}
+
+static int serve_v2(upload_pack *up)
+{
+	git_buf command = GIT_BUF_INIT;
+	bool args;
+	int error = 0;
+
+	if (!up->opts->stateless_rpc || up->opts->advertise_refs) {
+		if ((error = advertise_v2(up)) < 0 ||
+			(error = git_server__flush_output(&up->io)) < 0 ||
+			up->opts->advertise_refs)
+			goto done;
+	}
+
+	/* a stateless request carries a single command */
+	do {
+		if ((error = recv_command(&command, &args, up)) < 0)
+			break;
+
+		if (!strcmp(command.ptr, "ls-refs"))
+			error = ls_refs_v2(up, args);
+		else if (!strcmp(command.ptr, "fetch"))
+			error = fetch_v2(up, args);
+		else {
+			giterr_set(GITERR_NET, "Unknown command '%s'", command.ptr);
+			error = -1;
+		}
+
+		if (!error)
+			error = git_server__flush_output(&up->io);
+	} while (!error && !up->opts->stateless_rpc);
+
+done:
+	git_buf_free(&command);
+	return error;
+}
+
+int git_upload_pack_init_options(git_upload_pack_options *opts, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		opts, version, git_upload_pack_options, GIT_UPLOAD_PACK_OPTIONS_INIT);
+	return 0;
+}
+
+int git_upload_pack(git_repository *repo, const git_upload_pack_options *opts)
+{
+	upload_pack up;
+	advertised_ref *ref;
+	size_t i;
+	int error;
+
+	assert(repo && opts);
+
+	GITERR_CHECK_VERSION(opts, GIT_UPLOAD_PACK_OPTIONS_VERSION, "git_upload_pack_options");
+
+	if (!opts->read || !opts->write) {
+		giterr_set(GITERR_INVALID, "upload-pack needs read and write callbacks");
+		return -1;
+	}
+
+	memset(&up, 0, sizeof(upload_pack));
+	up.repo = repo;
+	up.opts = opts;
+	git_server__io_init(&up.io, opts->read, opts->write, opts->payload);
+
+	up.advertised = git_oidmap_alloc();
+	GITERR_CHECK_ALLOC(up.advertised);
+
+	if ((error = git_vector_init(&up.refs, 16, ref_cmp)) < 0 ||
+		(error = load_refs(&up)) < 0)
+		goto done;
+
+	if (opts->protocol_version == GIT_PROTOCOL_VERSION_2) {
+		error = serve_v2(&up);
+		goto done;
+	}
+
+	if (!opts->stateless_rpc || opts->advertise_refs) {
+		if ((error = advertise_refs(&up)) < 0 ||
+			(error = git_server__flush_output(&up.io)) < 0 ||
+			opts->advertise_refs)
+			goto done;
+	}
+
+	if ((error = recv_wants(&up)) < 0 ||
+		(error = negotiate(&up)) < 0 ||
+		(error = send_pack(&up)) < 0)
+		goto done;
+
+	error = git_server__flush_output(&up.io);
+
+done:
+	if (error == GIT_ITEROVER)
+		error = 0;
+	else if (error < 0)
+		send_error(&up);
+
+	git_vector_foreach(&up.refs, i, ref)
+		git__free(ref);
+
+	git_vector_free(&up.refs);
+	git_oidmap_free(up.advertised);
+	git__free(up.head_target);
+	git_array_clear(up.wants);
+	git_array_clear(up.common);
+	git_revwalk_free(up.walk);
+	git_server__io_free(&up.io);
+	return error;
+}
@@ -30,7 +30,8 @@ static int zstream_seterr(git_zstream *zs)
 
 int git_zstream_init(git_zstream *zstream)
 {
-	zstream->zerr = deflateInit(&zstream->z, Z_DEFAULT_COMPRESSION);
+	zstream->level = Z_DEFAULT_COMPRESSION;
+	zstream->zerr = deflateInit(&zstream->z, zstream->level);
 	return zstream_seterr(zstream);
 }
 
@@ -45,6 +46,26 @@ void git_zstream_reset(git_zstream *zstream)
 	zstream->in = NULL;
 	zstream->in_len = 0;
 	zstream->zerr = Z_STREAM_END;
+	zstream->partial = 0;
+}
+
+/* Change the compression level; only valid on a fresh or reset stream */
+int git_zstream_set_level(git_zstream *zstream, int level)
+{
+	if (zstream->level == level)
+		return 0;
+
+	deflateEnd(&zstream->z);
+	memset(&zstream->z, 0, sizeof(zstream->z));
+
+	zstream->level = level;
+	zstream->zerr = deflateInit(&zstream->z, level);
+
+	if (zstream_seterr(zstream) < 0)
+		return -1;
+
+	git_zstream_reset(zstream);
+	return 0;
 }
 
 int git_zstream_set_input(git_zstream *zstream, const void *in, size_t in_len)
@@ -52,12 +73,21 @@ int git_zstream_set_input(git_zstream *zstream, const void *in, size_t in_len)
 	zstream->in = in;
 	zstream->in_len = in_len;
 	zstream->zerr = Z_OK;
+	zstream->partial = 0;
+	return 0;
+}
+
+int git_zstream_set_input_partial(git_zstream *zstream, const void *in, size_t in_len)
+{
+	git_zstream_set_input(zstream, in, in_len);
+	zstream->partial = 1;
 	return 0;
 }
 
 bool git_zstream_done(git_zstream *zstream)
 {
-	return (!zstream->in_len && zstream->zerr == Z_STREAM_END);
+	return (!zstream->in_len &&
+		(zstream->partial || zstream->zerr == Z_STREAM_END));
 }
 
 size_t git_zstream_suggest_output_len(git_zstream *zstream)
@@ -78,6 +108,10 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 	while (out_remain > 0 && zstream->zerr != Z_STREAM_END) {
 		size_t out_queued, in_queued, out_used, in_used;
 
+		/* partial input is never flushed, so we're done once it's consumed */
+		if (zstream->partial && !zstream->in_len)
+			break;
+
 		/* set up in data */
 		zstream->z.next_in  = (Bytef *)zstream->in;
 		zstream->z.avail_in = (uInt)zstream->in_len;
@@ -85,7 +119,7 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 			zstream->z.avail_in = INT_MAX;
 			zflush = Z_NO_FLUSH;
 		} else {
-			zflush = Z_FINISH;
+			zflush = zstream->partial ? Z_NO_FLUSH : Z_FINISH;
 		}
 		in_queued = (size_t)zstream->z.avail_in;
 
@@ -112,7 +146,7 @@ int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream)
 	}
 
 	/* either we finished the input or we did not flush the data */
-	assert(zstream->in_len > 0 || zflush == Z_FINISH);
+	assert(zstream->in_len > 0 || zstream->partial || zflush == Z_FINISH);
 
 	/* set out_size to number of bytes actually written to output */
 	*out_len = *out_len - out_remain;
@@ -17,6 +17,8 @@ typedef struct {
 	const char *in;
 	size_t in_len;
 	int zerr;
+	int level;
+	unsigned int partial:1;
 } git_zstream;
 
 #define GIT_ZSTREAM_INIT {{0}}
@@ -24,8 +26,17 @@ typedef struct {
 int git_zstream_init(git_zstream *zstream);
 void git_zstream_free(git_zstream *zstream);
 
+int git_zstream_set_level(git_zstream *zstream, int level);
+
 int git_zstream_set_input(git_zstream *zstream, const void *in, size_t in_len);
 
+/*
+ * Like `git_zstream_set_input`, but more input will follow: the stream
+ * is not finished once this input is consumed, and `git_zstream_done`
+ * reports true as soon as all of it has been handed to zlib.
+ */
+int git_zstream_set_input_partial(git_zstream *zstream, const void *in, size_t in_len);
+
 size_t git_zstream_suggest_output_len(git_zstream *zstream);
 
 int git_zstream_get_output(void *out, size_t *out_len, git_zstream *zstream);
@@ -0,0 +1,306 @@
+#include "clar_libgit2.h"
+
+#include "git2/clone.h"
+#include "git2/odb_backend.h"
+#include "fileops.h"
+#include "path.h"
+
+#define README_ID "a8233120f6ad708f843d861ce2b7228ec4e3dec6"
+#define NEW_TXT_ID "a71586c1dfe8a71c6cbf6c129f404c5642ff31bd"
+#define ROOT_TREE_ID "944c0f6e4dfa41595e6eb3ceecdb14f50fe18162"
+
+static git_repository *_repo;
+static git_clone_options _opts;
+
+void test_clone_partial__initialize(void)
+{
+	git_clone_init_options(&_opts, GIT_CLONE_OPTIONS_VERSION);
+	_opts.bare = 1;
+	_repo = NULL;
+}
+
+void test_clone_partial__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_fixture_cleanup("./partial");
+}
+
+static void clone_with_filter(const char *filter)
+{
+	_opts.fetch_opts.filter = filter;
+	cl_git_pass(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./partial", &_opts));
+}
+
+/* whether the object was fetched, without asking the promisor remote */
+static bool has_object(const char *hex)
+{
+	git_odb *odb;
+	git_oid id;
+	bool found;
+
+	cl_git_pass(git_oid_fromstr(&id, hex));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	found = git_odb_exists(odb, &id) != 0;
+	git_odb_free(odb);
+
+	return found;
+}
+
+static int count_packs_cb(void *payload, git_buf *path)
+{
+	size_t *count = payload;
+
+	if (git__suffixcmp(path->ptr, ".pack") == 0)
+		(*count)++;
+
+	return 0;
+}
+
+static size_t count_packs(const char *dir)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t count = 0;
+
+	cl_git_pass(git_buf_sets(&path, dir));
+	cl_git_pass(git_path_direach(&path, 0, count_packs_cb, &count));
+	git_buf_free(&path);
+
+	return count;
+}
+
+void test_clone_partial__blob_none(void)
+{
+	git_config *cfg;
+	git_buf filter = GIT_BUF_INIT;
+	git_blob *blob;
+	git_oid id;
+	int promisor;
+
+	clone_with_filter("blob:none");
+
+	cl_assert(has_object(ROOT_TREE_ID));
+	cl_assert(!has_object(README_ID));
+
+	cl_git_pass(git_repository_config_snapshot(&cfg, _repo));
+	cl_git_pass(git_config_get_bool(&promisor, cfg, "remote.origin.promisor"));
+	cl_assert_equal_i(1, promisor);
+	cl_git_pass(git_config_get_string_buf(&filter, cfg, "remote.origin.partialclonefilter"));
+	cl_assert_equal_s("blob:none", filter.ptr);
+	git_buf_free(&filter);
+	git_config_free(cfg);
+
+	/* the blob is fetched when it is read */
+	cl_git_pass(git_oid_fromstr(&id, README_ID));
+	cl_git_pass(git_blob_lookup(&blob, _repo, &id));
+	cl_assert_equal_s("hey there\n", git_blob_rawcontent(blob));
+	git_blob_free(blob);
+
+	cl_assert(has_object(README_ID));
+	cl_assert(!has_object(NEW_TXT_ID));
+}
+
+void test_clone_partial__reopened_repository_fetches_too(void)
+{
+	git_blob *blob;
+	git_oid id;
+
+	clone_with_filter("blob:none");
+	git_repository_free(_repo);
+
+	cl_git_pass(git_repository_open(&_repo, "./partial"));
+	cl_assert(!has_object(NEW_TXT_ID));
+
+	cl_git_pass(git_oid_fromstr(&id, NEW_TXT_ID));
+	cl_git_pass(git_blob_lookup(&blob, _repo, &id));
+	git_blob_free(blob);
+
+	cl_assert(has_object(NEW_TXT_ID));
+}
+
+void test_clone_partial__odb_fetches_after_the_repository_is_freed(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+
+	clone_with_filter("blob:none");
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_git_pass(git_oid_fromstr(&id, NEW_TXT_ID));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_s("my new file\n", git_odb_object_data(obj));
+
+	git_odb_object_free(obj);
+	git_odb_free(odb);
+}
+
+void test_clone_partial__checkout_fetches_blobs_in_one_batch(void)
+{
+	_opts.bare = 0;
+	clone_with_filter("blob:none");
+
+	cl_assert_equal_file("hey there\n", 0, "./partial/README");
+	cl_assert_equal_file("my new file\n", 0, "./partial/new.txt");
+
+	/* one pack from the clone, and a single one with the blobs */
+	cl_assert_equal_sz(2, count_packs("./partial/.git/objects/pack"));
+}
+
+void test_clone_partial__blob_limit(void)
+{
+	clone_with_filter("blob:limit=11");
+
+	cl_assert(has_object(README_ID));
+	cl_assert(!has_object(NEW_TXT_ID));
+}
+
+void test_clone_partial__tree_depth(void)
+{
+	git_tree *tree;
+	git_oid id;
+
+	clone_with_filter("tree:0");
+
+	cl_assert(!has_object(ROOT_TREE_ID));
+
+	cl_git_pass(git_oid_fromstr(&id, ROOT_TREE_ID));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &id));
+	cl_assert_equal_i(3, git_tree_entrycount(tree));
+	git_tree_free(tree);
+
+	/* the filter applies to the lazy fetch as well */
+	cl_assert(!has_object(README_ID));
+}
+
+void test_clone_partial__prefetch(void)
+{
+	git_odb *odb;
+	git_oid ids[2];
+
+	clone_with_filter("blob:none");
+
+	cl_git_pass(git_oid_fromstr(&ids[0], README_ID));
+	cl_git_pass(git_oid_fromstr(&ids[1], NEW_TXT_ID));
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_prefetch(odb, ids, 2));
+	git_odb_free(odb);
+
+	cl_assert(has_object(README_ID));
+	cl_assert(has_object(NEW_TXT_ID));
+	cl_assert_equal_sz(2, count_packs("./partial/objects/pack"));
+}
+
+void test_clone_partial__missing_objects_are_not_found(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+
+	clone_with_filter("blob:none");
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_read(&obj, odb, &id));
+	git_odb_free(odb);
+}
+
+void test_clone_partial__transfer_errors_are_reported(void)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+	int error;
+
+	clone_with_filter("blob:none");
+	cl_git_pass(git_remote_set_url(_repo, "origin", "unknown://example.com/repo"));
+
+	/* a remote which can't be reached is no missing object */
+	cl_git_pass(git_oid_fromstr(&id, README_ID));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	error = git_odb_read(&obj, odb, &id);
+	git_odb_free(odb);
+
+	cl_assert(error < 0 && error != GIT_ENOTFOUND);
+}
+
+static int transfer_progress_cb(const git_transfer_progress *stats, void *payload)
+{
+	size_t *calls = payload;
+	GIT_UNUSED(stats);
+	(*calls)++;
+	return 0;
+}
+
+void test_clone_partial__fetches_with_the_promisor_callbacks(void)
+{
+	git_remote_callbacks callbacks = GIT_REMOTE_CALLBACKS_INIT;
+	git_odb *odb;
+	git_blob *blob;
+	git_oid id;
+	size_t calls = 0;
+
+	clone_with_filter("blob:none");
+
+	callbacks.transfer_progress = transfer_progress_cb;
+	callbacks.payload = &calls;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_set_promisor_callbacks(odb, &callbacks));
+	git_odb_free(odb);
+
+	cl_git_pass(git_oid_fromstr(&id, README_ID));
+	cl_git_pass(git_blob_lookup(&blob, _repo, &id));
+	git_blob_free(blob);
+
+	cl_assert(calls > 0);
+}
+
+void test_clone_partial__invalid_filter(void)
+{
+	_opts.fetch_opts.filter = "blob:some";
+	cl_git_fail(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./partial", &_opts));
+}
+
+void test_clone_partial__git_accepts_the_partial_clone(void)
+{
+#ifdef GIT_WIN32
+	cl_skip();
+#else
+	git_buf cmd = GIT_BUF_INIT, packs = GIT_BUF_INIT;
+	git_vector contents = GIT_VECTOR_INIT;
+	const char *name;
+	size_t i, markers = 0;
+
+	if (system("git --version >/dev/null 2>&1") != 0)
+		cl_skip();
+
+	clone_with_filter("blob:none");
+
+	cl_git_pass(git_buf_joinpath(&packs, git_repository_path(_repo), "objects/pack"));
+	cl_git_pass(git_path_dirload(&contents, packs.ptr, 0, 0));
+	git_vector_foreach(&contents, i, name)
+		markers += (git__suffixcmp(name, ".promisor") == 0);
+	cl_assert_equal_sz(1, markers);
+
+	/*
+	 * git only tolerates the blobs which were left out when their pack
+	 * is marked as a promisor pack; the fixture has a commit without an
+	 * author name, which fsck would complain about on its own.
+	 */
+	cl_git_pass(git_buf_printf(&cmd,
+		"git --git-dir='%s' -c fsck.missingNameBeforeEmail=ignore "
+		"fsck --no-progress >/dev/null 2>&1",
+		git_repository_path(_repo)));
+	cl_assert_equal_i(0, system(cmd.ptr));
+
+	git_vector_free_deep(&contents);
+	git_buf_free(&packs);
+	git_buf_free(&cmd);
+#endif
+}
@@ -0,0 +1,135 @@
+#include "clar_libgit2.h"
+
+#include "git2/clone.h"
+#include "fileops.h"
+#include "shallow.h"
+
+static git_repository *_repo;
+static git_clone_options _opts;
+
+void test_clone_shallow__initialize(void)
+{
+	git_clone_init_options(&_opts, GIT_CLONE_OPTIONS_VERSION);
+	_opts.bare = 1;
+	_repo = NULL;
+}
+
+void test_clone_shallow__cleanup(void)
+{
+	git_repository_free(_repo);
+	_repo = NULL;
+
+	cl_fixture_cleanup("./shallow.git");
+}
+
+static int count_commits(const char *from)
+{
+	git_revwalk *walk;
+	git_oid id;
+	int count = 0, error;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, from));
+
+	while ((error = git_revwalk_next(&id, walk)) == 0)
+		count++;
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_revwalk_free(walk);
+
+	return count;
+}
+
+static void fetch_with_depth(int depth)
+{
+	git_remote *origin;
+	git_fetch_options opts = GIT_FETCH_OPTIONS_INIT;
+
+	opts.depth = depth;
+
+	cl_git_pass(git_remote_lookup(&origin, _repo, "origin"));
+	cl_git_pass(git_remote_fetch(origin, NULL, &opts, NULL));
+	git_remote_free(origin);
+}
+
+void test_clone_shallow__clone_with_depth(void)
+{
+	git_buf roots = GIT_BUF_INIT;
+	git_commit *commit, *parent;
+
+	_opts.fetch_opts.depth = 1;
+	cl_git_pass(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./shallow.git", &_opts));
+
+	cl_assert_equal_i(1, git_repository_is_shallow(_repo));
+	cl_assert_equal_i(1, count_commits("HEAD"));
+
+	cl_git_pass(git_futils_readbuffer(&roots, "./shallow.git/" GIT_SHALLOW_FILE));
+	cl_assert(strstr(roots.ptr, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n") != NULL);
+	git_buf_free(&roots);
+
+	/* the parent is not there */
+	cl_git_pass(git_revparse_single((git_object **)&commit, _repo, "HEAD"));
+	cl_assert_equal_i(1, git_commit_parentcount(commit));
+	cl_git_fail_with(GIT_ENOTFOUND, git_commit_parent(&parent, commit, 0));
+	git_commit_free(commit);
+}
+
+void test_clone_shallow__plain_paths_are_fetched_too(void)
+{
+	_opts.fetch_opts.depth = 2;
+	cl_git_pass(git_clone(&_repo, cl_fixture("testrepo.git"), "./shallow.git", &_opts));
+
+	cl_assert_equal_i(1, git_repository_is_shallow(_repo));
+	cl_assert_equal_i(2, count_commits("HEAD"));
+}
+
+void test_clone_shallow__deepen(void)
+{
+	_opts.fetch_opts.depth = 1;
+	cl_git_pass(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./shallow.git", &_opts));
+	cl_assert_equal_i(1, count_commits("HEAD"));
+
+	fetch_with_depth(2);
+	cl_assert_equal_i(1, git_repository_is_shallow(_repo));
+	cl_assert_equal_i(2, count_commits("HEAD"));
+
+	/*
+	 * The merge now has its parents, and every branch reaches down to
+	 * a commit without parents, so the history is complete.
+	 */
+	fetch_with_depth(3);
+	cl_assert_equal_i(0, git_repository_is_shallow(_repo));
+	cl_assert_equal_i(7, count_commits("HEAD"));
+}
+
+void test_clone_shallow__unshallow(void)
+{
+	_opts.fetch_opts.depth = 1;
+	cl_git_pass(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./shallow.git", &_opts));
+
+	fetch_with_depth(GIT_FETCH_DEPTH_UNSHALLOW);
+
+	cl_assert_equal_i(0, git_repository_is_shallow(_repo));
+	cl_assert(!git_path_exists("./shallow.git/" GIT_SHALLOW_FILE));
+	cl_assert_equal_i(7, count_commits("HEAD"));
+}
+
+void test_clone_shallow__since(void)
+{
+	/* between "a third commit" and "a fourth commit" */
+	_opts.fetch_opts.shallow_since = 1274721550;
+	cl_git_pass(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./shallow.git", &_opts));
+
+	cl_assert_equal_i(1, git_repository_is_shallow(_repo));
+	cl_assert_equal_i(4, count_commits("HEAD"));
+}
+
+void test_clone_shallow__invalid_depth(void)
+{
+	_opts.fetch_opts.depth = -1;
+	cl_git_fail(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./shallow.git", &_opts));
+
+	_opts.fetch_opts.depth = 1;
+	_opts.fetch_opts.shallow_since = 1234567890;
+	cl_git_fail(git_clone(&_repo, cl_git_fixture_url("testrepo.git"), "./shallow.git", &_opts));
+}
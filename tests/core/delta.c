@@ -0,0 +1,116 @@
+#include "clar_libgit2.h"
+#include "delta.h"
+#include "delta-apply.h"
+
+#define CHAIN_DEPTH 8
+
+static char *versions[CHAIN_DEPTH + 1];
+static size_t version_lens[CHAIN_DEPTH + 1];
+static void *deltas[CHAIN_DEPTH];
+static unsigned long delta_lens[CHAIN_DEPTH];
+
+void test_core_delta__initialize(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	size_t i, j;
+
+	/* each version rewrites, drops and appends a few lines of the last */
+	for (i = 0; i < 200; i++)
+		git_buf_printf(&buf, "line %d of the original file\n", (int)i);
+
+	for (i = 0; i <= CHAIN_DEPTH; i++) {
+		version_lens[i] = git_buf_len(&buf);
+		versions[i] = git_buf_detach(&buf);
+
+		for (j = 0; j < 200; j++) {
+			if (j % (i + 3) == 0)
+				git_buf_printf(&buf, "line %d changed in version %d\n", (int)j, (int)i);
+			else if (j % (i + 7) != 0)
+				git_buf_printf(&buf, "line %d of the original file\n", (int)j);
+		}
+		git_buf_printf(&buf, "trailer of version %d\n", (int)i);
+	}
+	git_buf_free(&buf);
+
+	for (i = 0; i < CHAIN_DEPTH; i++) {
+		deltas[i] = git_delta(versions[i], (unsigned long)version_lens[i],
+			versions[i + 1], (unsigned long)version_lens[i + 1],
+			&delta_lens[i], 0);
+		cl_assert(deltas[i]);
+	}
+}
+
+void test_core_delta__cleanup(void)
+{
+	size_t i;
+
+	for (i = 0; i <= CHAIN_DEPTH; i++) {
+		git__free(versions[i]);
+		versions[i] = NULL;
+	}
+
+	for (i = 0; i < CHAIN_DEPTH; i++) {
+		git__free(deltas[i]);
+		deltas[i] = NULL;
+	}
+}
+
+void test_core_delta__apply_single(void)
+{
+	git_rawobj out;
+
+	cl_git_pass(git__delta_apply(&out,
+		(unsigned char *)versions[0], version_lens[0],
+		deltas[0], delta_lens[0]));
+
+	cl_assert_equal_i(version_lens[1], out.len);
+	cl_assert(memcmp(versions[1], out.data, out.len) == 0);
+	git__free(out.data);
+}
+
+void test_core_delta__compose_chain(void)
+{
+	git_delta_chain chain = GIT_DELTA_CHAIN_INIT;
+	git_rawobj out;
+	size_t i;
+
+	for (i = 0; i < CHAIN_DEPTH; i++) {
+		cl_git_pass(git__delta_chain_add(&chain, deltas[i], delta_lens[i]));
+
+		cl_git_pass(git__delta_chain_apply(&out, &chain,
+			(unsigned char *)versions[0], version_lens[0]));
+
+		cl_assert_equal_i(version_lens[i + 1], out.len);
+		cl_assert(memcmp(versions[i + 1], out.data, out.len) == 0);
+		cl_assert_equal_i(0, ((char *)out.data)[out.len]);
+		git__free(out.data);
+	}
+
+	git__delta_chain_free(&chain);
+}
+
+void test_core_delta__compose_rejects_mismatched_base(void)
+{
+	git_delta_chain chain = GIT_DELTA_CHAIN_INIT;
+	git_rawobj out;
+
+	cl_git_pass(git__delta_chain_add(&chain, deltas[0], delta_lens[0]));
+
+	/* the third delta applies to version 2, not version 1 */
+	cl_git_fail(git__delta_chain_add(&chain, deltas[2], delta_lens[2]));
+
+	cl_git_fail(git__delta_chain_apply(&out, &chain,
+		(unsigned char *)versions[1], version_lens[1]));
+
+	git__delta_chain_free(&chain);
+}
+
+void test_core_delta__compose_rejects_truncated_delta(void)
+{
+	git_delta_chain chain = GIT_DELTA_CHAIN_INIT;
+
+	cl_git_pass(git__delta_chain_add(&chain, deltas[0], delta_lens[0]));
+	cl_git_fail(git__delta_chain_add(&chain, deltas[1], delta_lens[1] - 1));
+
+	git__delta_chain_free(&chain);
+}
@@ -141,3 +141,45 @@ void test_core_zstream__big_data(void)
 
 	git_buf_free(&in);
 }
+
+void test_core_zstream__partial_input_uncompressed(void)
+{
+	git_zstream zs = GIT_ZSTREAM_INIT;
+	git_buf in = GIT_BUF_INIT, out = GIT_BUF_INIT;
+	char fixed[512];
+	size_t pos, step = 1000;
+
+	while (in.size < 64 * 1024)
+		cl_git_pass(git_buf_put(&in, BIG_STRING_PART, strlen(BIG_STRING_PART)));
+
+	cl_git_pass(git_zstream_init(&zs));
+	cl_git_pass(git_zstream_set_level(&zs, Z_NO_COMPRESSION));
+
+	for (pos = 0; pos < in.size; pos += step) {
+		cl_git_pass(git_zstream_set_input_partial(&zs,
+			in.ptr + pos, min(step, in.size - pos)));
+
+		while (!git_zstream_done(&zs)) {
+			size_t written = sizeof(fixed);
+			cl_git_pass(git_zstream_get_output(fixed, &written, &zs));
+			cl_git_pass(git_buf_put(&out, fixed, written));
+		}
+	}
+
+	cl_git_pass(git_zstream_set_input(&zs, NULL, 0));
+
+	while (!git_zstream_done(&zs)) {
+		size_t written = sizeof(fixed);
+		cl_git_pass(git_zstream_get_output(fixed, &written, &zs));
+		cl_git_pass(git_buf_put(&out, fixed, written));
+	}
+
+	git_zstream_free(&zs);
+
+	/* stored blocks are never smaller than their input */
+	cl_assert(out.size > in.size);
+	assert_zlib_equal(in.ptr, in.size, out.ptr, out.size);
+
+	git_buf_free(&out);
+	git_buf_free(&in);
+}
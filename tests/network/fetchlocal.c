@@ -518,3 +518,33 @@ void test_network_fetchlocal__prune_load_fetch_prune_config(void)
 	git_remote_free(origin);
 	git_repository_free(repo);
 }
+
+void test_network_fetchlocal__negotiation_algorithm_config(void)
+{
+	git_repository *repo;
+	git_remote *origin;
+	git_config *config;
+	git_fetch_options options = GIT_FETCH_OPTIONS_INIT;
+	const char *url = cl_git_fixture_url("testrepo.git");
+
+	cl_set_cleanup(&cleanup_local_repo, "foo");
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+
+	cl_git_pass(git_repository_config(&config, repo));
+	cl_git_pass(git_config_set_string(config, "fetch.negotiationAlgorithm", "random"));
+
+	cl_git_pass(git_remote_create(&origin, repo, GIT_REMOTE_ORIGIN, url));
+	cl_git_fail(git_remote_fetch(origin, NULL, &options, NULL));
+
+	/* the option takes precedence over the configuration */
+	options.negotiation = GIT_FETCH_NEGOTIATION_SKIPPING;
+	cl_git_pass(git_remote_fetch(origin, NULL, &options, NULL));
+
+	cl_git_pass(git_config_set_string(config, "fetch.negotiationAlgorithm", "skipping"));
+	options.negotiation = GIT_FETCH_NEGOTIATION_UNSPECIFIED;
+	cl_git_pass(git_remote_fetch(origin, NULL, &options, NULL));
+
+	git_config_free(config);
+	git_remote_free(origin);
+	git_repository_free(repo);
+}
@@ -0,0 +1,155 @@
+#include "clar_libgit2.h"
+#include "negotiator.h"
+
+#define HISTORY_LENGTH 30
+
+static git_repository *_repo;
+static git_oid _history[HISTORY_LENGTH];
+
+/* Build a linear history; _history[0] is the tip */
+void test_network_negotiator__initialize(void)
+{
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_commit *parent = NULL;
+	git_oid tree_id;
+	int i;
+
+	_repo = cl_git_sandbox_init("empty_bare.git");
+
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	git_treebuilder_free(builder);
+
+	for (i = HISTORY_LENGTH - 1; i >= 0; i--) {
+		git_tree *tree;
+
+		cl_git_pass(git_signature_new(&sig, "me", "me@example.com",
+			1400000000 + (HISTORY_LENGTH - i) * 60, 0));
+		cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+
+		cl_git_pass(git_commit_create_v(&_history[i], _repo,
+			"refs/heads/master", sig, sig, NULL, "commit\n",
+			tree, parent ? 1 : 0, parent));
+
+		git_commit_free(parent);
+		git_tree_free(tree);
+		git_signature_free(sig);
+
+		cl_git_pass(git_commit_lookup(&parent, _repo, &_history[i]));
+	}
+
+	git_commit_free(parent);
+}
+
+void test_network_negotiator__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+/* The positions in the history of the offered commits, -1 terminated */
+static void assert_offers(git_negotiator *negotiator, const int *expected)
+{
+	git_oid id;
+	int i, error;
+
+	for (i = 0; expected[i] >= 0; i++) {
+		cl_git_pass(git_negotiator_next(&id, negotiator));
+		cl_assert_equal_oid(&_history[expected[i]], &id);
+	}
+
+	error = git_negotiator_next(&id, negotiator);
+	cl_assert_equal_i(GIT_ITEROVER, error);
+}
+
+void test_network_negotiator__consecutive_offers_every_commit(void)
+{
+	git_negotiator *negotiator;
+	git_oid id;
+	int i;
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, GIT_FETCH_NEGOTIATION_CONSECUTIVE));
+	cl_git_pass(git_negotiator_add_tip(negotiator, &_history[0]));
+
+	for (i = 0; i < HISTORY_LENGTH; i++) {
+		cl_git_pass(git_negotiator_next(&id, negotiator));
+		cl_assert_equal_oid(&_history[i], &id);
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, git_negotiator_next(&id, negotiator));
+	git_negotiator_free(negotiator);
+}
+
+void test_network_negotiator__skipping_grows_the_gaps(void)
+{
+	git_negotiator *negotiator;
+	static const int expected[] = { 0, 2, 5, 10, 18, 29, -1 };
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, GIT_FETCH_NEGOTIATION_SKIPPING));
+	cl_git_pass(git_negotiator_add_tip(negotiator, &_history[0]));
+
+	/* the root is offered even though it falls into a gap */
+	assert_offers(negotiator, expected);
+	git_negotiator_free(negotiator);
+}
+
+void test_network_negotiator__acks_end_the_walk(void)
+{
+	git_negotiator *negotiator;
+	git_oid id;
+	static const int expected[] = { -1 };
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, GIT_FETCH_NEGOTIATION_CONSECUTIVE));
+	cl_git_pass(git_negotiator_add_tip(negotiator, &_history[0]));
+
+	cl_git_pass(git_negotiator_next(&id, negotiator));
+	cl_git_pass(git_negotiator_next(&id, negotiator));
+
+	cl_assert_equal_i(0, git_negotiator_ack(negotiator, &_history[1]));
+	cl_assert_equal_i(1, git_negotiator_ack(negotiator, &_history[1]));
+
+	/* everything left is in the history of a common commit */
+	assert_offers(negotiator, expected);
+	git_negotiator_free(negotiator);
+}
+
+void test_network_negotiator__known_common_history_is_not_offered(void)
+{
+	git_negotiator *negotiator;
+	static const int expected[] = { 0, 1, 2, 3, -1 };
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, GIT_FETCH_NEGOTIATION_CONSECUTIVE));
+	cl_git_pass(git_negotiator_add_tip(negotiator, &_history[0]));
+	cl_git_pass(git_negotiator_known_common(negotiator, &_history[3]));
+
+	assert_offers(negotiator, expected);
+	git_negotiator_free(negotiator);
+}
+
+void test_network_negotiator__noop_offers_nothing(void)
+{
+	git_negotiator *negotiator;
+	static const int expected[] = { -1 };
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, GIT_FETCH_NEGOTIATION_NOOP));
+	cl_git_pass(git_negotiator_add_tip(negotiator, &_history[0]));
+
+	assert_offers(negotiator, expected);
+	git_negotiator_free(negotiator);
+}
+
+void test_network_negotiator__non_commits_are_ignored(void)
+{
+	git_negotiator *negotiator;
+	git_commit *commit;
+	static const int expected[] = { -1 };
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, &_history[0]));
+
+	cl_git_pass(git_negotiator_new(&negotiator, _repo, GIT_FETCH_NEGOTIATION_CONSECUTIVE));
+	cl_git_pass(git_negotiator_add_tip(negotiator, git_commit_tree_id(commit)));
+
+	assert_offers(negotiator, expected);
+	git_negotiator_free(negotiator);
+	git_commit_free(commit);
+}
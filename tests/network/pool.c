@@ -0,0 +1,133 @@
+#include "clar_libgit2.h"
+#include "git2/sys/stream.h"
+#include "stream_pool.h"
+
+static git_stream _streams[3];
+static int _closed, _freed;
+
+static int test_close(git_stream *stream)
+{
+	GIT_UNUSED(stream);
+	_closed++;
+	return 0;
+}
+
+static void test_free(git_stream *stream)
+{
+	GIT_UNUSED(stream);
+	_freed++;
+}
+
+void test_network_pool__initialize(void)
+{
+	size_t i;
+
+	memset(_streams, 0, sizeof(_streams));
+
+	for (i = 0; i < ARRAY_SIZE(_streams); i++) {
+		_streams[i].version = GIT_STREAM_VERSION;
+		_streams[i].close = test_close;
+		_streams[i].free = test_free;
+	}
+
+	_closed = _freed = 0;
+}
+
+void test_network_pool__cleanup(void)
+{
+	git_stream_pool_clear();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL,
+		GIT_STREAM_POOL_MAX_IDLE, GIT_STREAM_POOL_IDLE_TIMEOUT));
+}
+
+void test_network_pool__reuses_connections_to_the_same_server(void)
+{
+	git_stream *stream;
+
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "443"));
+	cl_assert_equal_p(NULL, stream);
+
+	git_stream_pool_give(&_streams[0], "https", "example.com", "443");
+
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "443"));
+	cl_assert_equal_p(NULL, stream);
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "8443"));
+	cl_assert_equal_p(NULL, stream);
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.org", "443"));
+	cl_assert_equal_p(NULL, stream);
+
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "443"));
+	cl_assert_equal_p(&_streams[0], stream);
+
+	/* a connection is only handed out once */
+	cl_git_pass(git_stream_pool_take(&stream, "https", "example.com", "443"));
+	cl_assert_equal_p(NULL, stream);
+
+	cl_assert_equal_i(0, _freed);
+}
+
+void test_network_pool__hands_out_the_latest_connection_first(void)
+{
+	git_stream *stream;
+
+	git_stream_pool_give(&_streams[0], "http", "example.com", "80");
+	git_stream_pool_give(&_streams[1], "http", "example.com", "80");
+
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80"));
+	cl_assert_equal_p(&_streams[1], stream);
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80"));
+	cl_assert_equal_p(&_streams[0], stream);
+}
+
+void test_network_pool__closes_the_oldest_connection_when_full(void)
+{
+	git_stream *stream;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, 2, 30));
+
+	git_stream_pool_give(&_streams[0], "http", "example.com", "80");
+	git_stream_pool_give(&_streams[1], "http", "example.org", "80");
+	git_stream_pool_give(&_streams[2], "http", "example.net", "80");
+
+	cl_assert_equal_i(1, _closed);
+	cl_assert_equal_i(1, _freed);
+
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80"));
+	cl_assert_equal_p(NULL, stream);
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.org", "80"));
+	cl_assert_equal_p(&_streams[1], stream);
+}
+
+void test_network_pool__can_be_turned_off(void)
+{
+	git_stream *stream;
+
+	git_stream_pool_give(&_streams[0], "http", "example.com", "80");
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, 0, 30));
+	cl_assert_equal_i(1, _freed);
+
+	git_stream_pool_give(&_streams[1], "http", "example.com", "80");
+	cl_assert_equal_i(2, _freed);
+
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80"));
+	cl_assert_equal_p(NULL, stream);
+
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, -1, 30));
+}
+
+void test_network_pool__drops_expired_connections(void)
+{
+	git_stream *stream;
+
+	git_stream_pool_give(&_streams[0], "http", "example.com", "80");
+
+	/* everything that has been idle at all has been idle for too long */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CONNECTION_POOL, 8, 0));
+
+	cl_git_pass(git_stream_pool_take(&stream, "http", "example.com", "80"));
+	cl_assert_equal_p(NULL, stream);
+	cl_assert_equal_i(1, _closed);
+	cl_assert_equal_i(1, _freed);
+}
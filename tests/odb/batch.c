@@ -0,0 +1,227 @@
+#include "clar_libgit2.h"
+#include "git2/odb_backend.h"
+#include "fileops.h"
+
+#define NR_BLOBS 100
+
+static git_repository *repo;
+static git_odb *odb;
+static git_odb_batch *batch;
+
+void test_odb_batch__initialize(void)
+{
+	cl_git_pass(git_repository_init(&repo, "batch.git", true));
+	cl_git_pass(git_repository_odb(&odb, repo));
+}
+
+void test_odb_batch__cleanup(void)
+{
+	git_odb_batch_free(batch);
+	batch = NULL;
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+	cl_fixture_cleanup("batch.git");
+}
+
+static int count_entries_cb(void *payload, git_buf *path)
+{
+	size_t *count = payload;
+	GIT_UNUSED(path);
+	(*count)++;
+	return 0;
+}
+
+static size_t count_entries(const char *dir)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t count = 0;
+
+	cl_git_pass(git_buf_sets(&path, dir));
+	cl_git_pass(git_path_direach(&path, 0, count_entries_cb, &count));
+	git_buf_free(&path);
+
+	return count;
+}
+
+static void write_blobs(git_oid *ids)
+{
+	git_buf content = GIT_BUF_INIT;
+	size_t i;
+
+	for (i = 0; i < NR_BLOBS; i++) {
+		git_buf_clear(&content);
+		cl_git_pass(git_buf_printf(&content, "blob number %d\n", (int)i));
+
+		cl_git_pass(git_odb_batch_write(&ids[i], batch,
+			content.ptr, content.size, GIT_OBJ_BLOB));
+	}
+
+	git_buf_free(&content);
+}
+
+static void assert_blobs(const git_oid *ids)
+{
+	git_odb_object *obj;
+	char expected[64];
+	size_t i;
+
+	for (i = 0; i < NR_BLOBS; i++) {
+		p_snprintf(expected, sizeof(expected), "blob number %d\n", (int)i);
+
+		cl_git_pass(git_odb_read(&obj, odb, &ids[i]));
+		cl_assert_equal_i(GIT_OBJ_BLOB, git_odb_object_type(obj));
+		cl_assert_equal_s(expected, git_odb_object_data(obj));
+		git_odb_object_free(obj);
+	}
+}
+
+void test_odb_batch__commit_writes_a_single_pack(void)
+{
+	git_oid ids[NR_BLOBS];
+	size_t loose = count_entries("batch.git/objects");
+
+	cl_git_pass(git_odb_batch_new(&batch, odb));
+	write_blobs(ids);
+
+	/* nothing is visible before the commit */
+	cl_assert(!git_odb_exists(odb, &ids[0]));
+
+	cl_git_pass(git_odb_batch_commit(batch));
+
+	cl_assert_equal_sz(2, count_entries("batch.git/objects/pack"));
+	cl_assert_equal_sz(loose, count_entries("batch.git/objects"));
+	assert_blobs(ids);
+}
+
+static int count_objects_cb(const git_oid *id, void *payload)
+{
+	size_t *count = payload;
+	GIT_UNUSED(id);
+	(*count)++;
+	return 0;
+}
+
+void test_odb_batch__skips_known_objects(void)
+{
+	git_oid ids[NR_BLOBS], again, existing;
+	git_odb *packed;
+	git_odb_backend *backend;
+	size_t count = 0;
+
+	cl_git_pass(git_odb_write(&existing, odb, "loose\n", 6, GIT_OBJ_BLOB));
+
+	cl_git_pass(git_odb_batch_new(&batch, odb));
+	write_blobs(ids);
+
+	cl_git_pass(git_odb_batch_write(&again, batch, "blob number 0\n", 14, GIT_OBJ_BLOB));
+	cl_assert(git_oid_equal(&ids[0], &again));
+
+	cl_git_pass(git_odb_batch_write(&again, batch, "loose\n", 6, GIT_OBJ_BLOB));
+	cl_assert(git_oid_equal(&existing, &again));
+
+	cl_git_pass(git_odb_batch_commit(batch));
+	assert_blobs(ids);
+
+	/* the pack holds each new object exactly once */
+	cl_git_pass(git_odb_new(&packed));
+	cl_git_pass(git_odb_backend_pack(&backend, "batch.git/objects"));
+	cl_git_pass(git_odb_add_backend(packed, backend, 1));
+	cl_git_pass(git_odb_foreach(packed, count_objects_cb, &count));
+	git_odb_free(packed);
+
+	cl_assert_equal_sz(NR_BLOBS, count);
+}
+
+void test_odb_batch__can_be_reused_after_commit(void)
+{
+	git_oid ids[NR_BLOBS], other;
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_batch_new(&batch, odb));
+	write_blobs(ids);
+	cl_git_pass(git_odb_batch_commit(batch));
+
+	cl_git_pass(git_odb_batch_write(&other, batch, "another\n", 8, GIT_OBJ_BLOB));
+	cl_git_pass(git_odb_batch_commit(batch));
+
+	cl_assert_equal_sz(4, count_entries("batch.git/objects/pack"));
+	cl_git_pass(git_odb_read(&obj, odb, &other));
+	git_odb_object_free(obj);
+	assert_blobs(ids);
+
+	/* committing an empty batch writes nothing */
+	cl_git_pass(git_odb_batch_commit(batch));
+	cl_assert_equal_sz(4, count_entries("batch.git/objects/pack"));
+}
+
+void test_odb_batch__spools_entries_to_a_temporary_file(void)
+{
+	git_oid ids[NR_BLOBS], big_id;
+	git_odb_object *obj;
+	char *big;
+	size_t i, big_len = 1024 * 1024;
+
+	/* poorly compressible, so the spool spans many read chunks */
+	big = git__malloc(big_len);
+	cl_assert(big);
+	for (i = 0; i < big_len; i++)
+		big[i] = (char)(rand() & 0xff);
+
+	cl_git_pass(git_odb_batch_new(&batch, odb));
+	write_blobs(ids);
+	cl_git_pass(git_odb_batch_write(&big_id, batch, big, big_len, GIT_OBJ_BLOB));
+
+	/* only the spool file, nothing kept in memory */
+	cl_assert_equal_sz(1, count_entries("batch.git/objects/pack"));
+
+	cl_git_pass(git_odb_batch_commit(batch));
+	cl_assert_equal_sz(2, count_entries("batch.git/objects/pack"));
+
+	assert_blobs(ids);
+	cl_git_pass(git_odb_read(&obj, odb, &big_id));
+	cl_assert_equal_sz(big_len, git_odb_object_size(obj));
+	cl_assert(!memcmp(big, git_odb_object_data(obj), big_len));
+	git_odb_object_free(obj);
+
+	git__free(big);
+}
+
+void test_odb_batch__free_discards_uncommitted_objects(void)
+{
+	git_oid ids[NR_BLOBS];
+
+	cl_git_pass(git_odb_batch_new(&batch, odb));
+	write_blobs(ids);
+	cl_assert_equal_sz(1, count_entries("batch.git/objects/pack"));
+
+	git_odb_batch_free(batch);
+	batch = NULL;
+
+	cl_assert(!git_odb_exists(odb, &ids[0]));
+	cl_assert_equal_sz(0, count_entries("batch.git/objects/pack"));
+}
+
+void test_odb_batch__falls_back_to_loose_objects(void)
+{
+	git_odb *loose_odb;
+	git_odb_backend *backend;
+	git_oid ids[NR_BLOBS];
+	size_t loose = count_entries("batch.git/objects");
+
+	cl_git_pass(git_odb_new(&loose_odb));
+	cl_git_pass(git_odb_backend_loose(&backend, "batch.git/objects", -1, 0, 0, 0));
+	cl_git_pass(git_odb_add_backend(loose_odb, backend, 1));
+
+	cl_git_pass(git_odb_batch_new(&batch, loose_odb));
+	git_odb_free(loose_odb);
+
+	/* objects are written as soon as they are added */
+	write_blobs(ids);
+	cl_assert(git_odb_exists(odb, &ids[0]));
+	cl_assert(count_entries("batch.git/objects") > loose);
+
+	cl_git_pass(git_odb_batch_commit(batch));
+	cl_assert_equal_sz(0, count_entries("batch.git/objects/pack"));
+	assert_blobs(ids);
+}
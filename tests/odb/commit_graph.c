@@ -0,0 +1,144 @@
+#include "clar_libgit2.h"
+#include "commit_graph.h"
+#include "odb.h"
+#include "repository.h"
+
+static git_repository *_repo;
+static git_commit_graph_file *_graph;
+
+void test_odb_commit_graph__initialize(void)
+{
+	git_buf objects_dir = GIT_BUF_INIT;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_commit_graph_write(_repo));
+
+	cl_git_pass(git_buf_joinpath(&objects_dir,
+		_repo->path_repository, GIT_OBJECTS_DIR));
+	cl_git_pass(git_commit_graph_open(&_graph, objects_dir.ptr));
+	git_buf_free(&objects_dir);
+}
+
+void test_odb_commit_graph__cleanup(void)
+{
+	git_commit_graph_free(_graph);
+	_graph = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_entry_matches(git_commit *commit)
+{
+	git_commit_graph_entry entry, parent_entry;
+	git_oid parent_id;
+	size_t pos, parent_pos;
+	unsigned int i;
+
+	cl_git_pass(git_commit_graph_find(&pos, _graph, git_commit_id(commit)));
+	cl_git_pass(git_commit_graph_entry_get(&entry, _graph, pos));
+
+	cl_assert_equal_oid(git_commit_tree_id(commit), &entry.tree_id);
+	cl_assert_equal_i(git_commit_time(commit), entry.commit_time);
+	cl_assert_equal_i(git_commit_parentcount(commit), entry.parent_count);
+
+	if (!entry.parent_count)
+		cl_assert_equal_i(1, entry.generation);
+
+	for (i = 0; i < entry.parent_count; i++) {
+		cl_git_pass(git_commit_graph_parent(&parent_pos, _graph, pos, i));
+		git_commit_graph_id(&parent_id, _graph, parent_pos);
+		cl_assert_equal_oid(git_commit_parent_id(commit, i), &parent_id);
+
+		cl_git_pass(git_commit_graph_entry_get(&parent_entry, _graph, parent_pos));
+		cl_assert(parent_entry.generation < entry.generation);
+	}
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_commit_graph_parent(&parent_pos, _graph, pos, entry.parent_count));
+}
+
+void test_odb_commit_graph__has_every_reachable_commit(void)
+{
+	git_revwalk *walk;
+	git_commit *commit;
+	git_oid id;
+	size_t nr = 0, pos;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+
+	while (git_revwalk_next(&id, walk) == 0) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, &id));
+		assert_entry_matches(commit);
+		git_commit_free(commit);
+		nr++;
+	}
+
+	cl_assert_equal_i(nr, _graph->num_commits);
+	git_revwalk_free(walk);
+
+	/* a blob is not in the graph */
+	git_oid_fromstr(&id, "a8233120f6ad708f843d861ce2b7228ec4e3dec6");
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_find(&pos, _graph, &id));
+}
+
+static int bloom_maybe_changed(const char *commit_id, const char *path)
+{
+	git_bloom_key key;
+	git_oid id;
+	size_t pos;
+
+	git_oid_fromstr(&id, commit_id);
+	cl_git_pass(git_commit_graph_find(&pos, _graph, &id));
+
+	git_commit_graph_bloom_key(&key, _graph, path);
+	return git_commit_graph_bloom_maybe_changed(_graph, pos, &key);
+}
+
+void test_odb_commit_graph__changed_path_filters(void)
+{
+	/* 763d71a added ab/4.txt, ab/c/3.txt, ab/de/2.txt and ab/de/fgh/1.txt */
+	const char *commit = "763d71aadf09a7951596c9746c024e7eece7c7af";
+
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/4.txt"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/c"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/c/3.txt"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/de"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/de/2.txt"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/de/fgh"));
+	cl_assert_equal_i(1, bloom_maybe_changed(commit, "ab/de/fgh/1.txt"));
+
+	cl_assert_equal_i(0, bloom_maybe_changed(commit, "README"));
+	cl_assert_equal_i(0, bloom_maybe_changed(commit, "new.txt"));
+}
+
+void test_odb_commit_graph__missing(void)
+{
+	git_commit_graph_file *graph;
+	git_repository *repo;
+
+	cl_git_pass(git_repository_init(&repo, "empty.git", true));
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_commit_graph_open(&graph, "empty.git/objects"));
+
+	git_repository_free(repo);
+	cl_fixture_cleanup("empty.git");
+}
+
+void test_odb_commit_graph__unborn_head(void)
+{
+	git_commit_graph_file *graph;
+	git_buf objects_dir = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_set_head(_repo, "refs/heads/unborn"));
+	cl_git_pass(git_commit_graph_write(_repo));
+
+	cl_git_pass(git_buf_joinpath(&objects_dir,
+		_repo->path_repository, GIT_OBJECTS_DIR));
+	cl_git_pass(git_commit_graph_open(&graph, objects_dir.ptr));
+	cl_assert_equal_i(_graph->num_commits, graph->num_commits);
+
+	git_commit_graph_free(graph);
+	git_buf_free(&objects_dir);
+}
@@ -77,3 +77,91 @@ void test_odb_packed__read_header_1(void)
 	}
 }
 
+
+static int oid_cmp_r(const void *a, const void *b, void *payload)
+{
+	GIT_UNUSED(payload);
+	return git_oid_cmp(a, b);
+}
+
+static size_t batch_ids(git_oid **out)
+{
+	size_t i, count = 0;
+	git_oid *ids;
+
+	ids = git__calloc(ARRAY_SIZE(packed_objects) + ARRAY_SIZE(loose_objects) + 2, sizeof(git_oid));
+	cl_assert(ids);
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); ++i)
+		cl_git_pass(git_oid_fromstr(&ids[count++], packed_objects[i]));
+	for (i = 0; i < ARRAY_SIZE(loose_objects); ++i)
+		cl_git_pass(git_oid_fromstr(&ids[count++], loose_objects[i]));
+
+	/* one missing object, and the empty tree, which always exists */
+	cl_git_pass(git_oid_fromstr(&ids[count++], "0123456789012345678901234567890123456789"));
+	cl_git_pass(git_oid_fromstr(&ids[count++], "4b825dc642cb6eb9a060e54bf8d69288fbee4904"));
+
+	git__qsort_r(ids, count, sizeof(git_oid), oid_cmp_r, NULL);
+
+	*out = ids;
+	return count;
+}
+
+void test_odb_packed__exists_many(void)
+{
+	git_oid *ids;
+	int *found;
+	size_t i, count;
+
+	count = batch_ids(&ids);
+	found = git__calloc(count, sizeof(int));
+	cl_assert(found);
+
+	cl_git_pass(git_odb_exists_many(found, _odb, ids, count));
+
+	for (i = 0; i < count; ++i)
+		cl_assert_equal_i(git_odb_exists(_odb, &ids[i]), found[i]);
+
+	git__free(found);
+	git__free(ids);
+}
+
+void test_odb_packed__read_header_many(void)
+{
+	git_oid *ids;
+	size_t *lens, i, count, len;
+	git_otype *types, type;
+
+	count = batch_ids(&ids);
+	lens = git__calloc(count, sizeof(size_t));
+	types = git__calloc(count, sizeof(git_otype));
+	cl_assert(lens && types);
+
+	cl_git_pass(git_odb_read_header_many(lens, types, _odb, ids, count));
+
+	for (i = 0; i < count; ++i) {
+		if (git_odb_read_header(&len, &type, _odb, &ids[i]) == GIT_ENOTFOUND) {
+			cl_assert_equal_i(GIT_OBJ_BAD, types[i]);
+			cl_assert_equal_sz(0, lens[i]);
+			continue;
+		}
+
+		cl_assert_equal_i(type, types[i]);
+		cl_assert_equal_sz(len, lens[i]);
+	}
+
+	git__free(types);
+	git__free(lens);
+	git__free(ids);
+}
+
+void test_odb_packed__batch_lookups_need_sorted_ids(void)
+{
+	git_oid ids[2];
+	int found[2];
+
+	cl_git_pass(git_oid_fromstr(&ids[0], packed_objects[1]));
+	cl_git_pass(git_oid_fromstr(&ids[1], packed_objects[0]));
+
+	cl_git_fail(git_odb_exists_many(found, _odb, ids, 2));
+}
@@ -0,0 +1,74 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "fileops.h"
+
+#define PACK "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695"
+
+/* an object which is only in the pack above */
+static const char *packed_id = "001d938dbe69b6251f4a03cf374235c72fd0a0d2";
+
+static git_repository *_repo;
+static git_odb *_odb;
+
+void test_odb_refresh__initialize(void)
+{
+	cl_git_pass(git_repository_init(&_repo, "refresh.git", true));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+}
+
+void test_odb_refresh__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, 0));
+
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+	cl_fixture_cleanup("refresh.git");
+}
+
+static void add_pack(void)
+{
+	cl_git_pass(git_futils_cp(
+		cl_fixture("testrepo.git/objects/pack/" PACK ".pack"),
+		"refresh.git/objects/pack/" PACK ".pack", 0644));
+	cl_git_pass(git_futils_cp(
+		cl_fixture("testrepo.git/objects/pack/" PACK ".idx"),
+		"refresh.git/objects/pack/" PACK ".idx", 0644));
+}
+
+void test_odb_refresh__finds_a_pack_added_after_a_miss(void)
+{
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, packed_id));
+
+	/* the id is remembered as missing from the packs */
+	cl_assert(!git_odb_exists(_odb, &id));
+	cl_assert(!git_odb_exists(_odb, &id));
+
+	add_pack();
+
+	cl_assert(git_odb_exists(_odb, &id));
+}
+
+void test_odb_refresh__misses_can_be_kept_from_refreshing(void)
+{
+	git_oid id;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, 3600 * 1000));
+	cl_git_pass(git_oid_fromstr(&id, packed_id));
+
+	cl_assert(!git_odb_exists(_odb, &id));
+
+	add_pack();
+
+	/* too soon for the odb to look again by itself */
+	cl_assert(!git_odb_exists(_odb, &id));
+
+	cl_git_pass(git_odb_refresh(_odb));
+	cl_assert(git_odb_exists(_odb, &id));
+}
+
+void test_odb_refresh__rejects_a_negative_interval(void)
+{
+	cl_git_fail(git_libgit2_opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, -1));
+}
@@ -0,0 +1,314 @@
+#include "clar_libgit2.h"
+#include "git2/odb_backend.h"
+#include "git2/sys/odb_backend.h"
+#include "buffer.h"
+#include "hash.h"
+#include "pack.h"
+#include "zstream.h"
+#include "path.h"
+
+static git_odb *odb;
+
+void test_odb_streamread__initialize(void)
+{
+	cl_git_pass(git_odb_new(&odb));
+}
+
+static void add_pack_backend(void)
+{
+	git_odb_backend *backend;
+
+	cl_git_pass(git_odb_backend_pack(&backend, cl_fixture("testrepo.git/objects")));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+}
+
+static void add_loose_backend(void)
+{
+	git_odb_backend *backend;
+
+	cl_git_pass(git_odb_backend_loose(&backend, cl_fixture("testrepo.git/objects"), -1, 0, 0, 0));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+}
+
+void test_odb_streamread__cleanup(void)
+{
+	git_odb_free(odb);
+	odb = NULL;
+	cl_fixture_cleanup("unordered");
+}
+
+static void read_streamed(git_buf *out, const git_oid *id, size_t chunk)
+{
+	git_odb_stream *stream;
+	char buffer[1024];
+	int read;
+
+	cl_assert(chunk <= sizeof(buffer));
+
+	cl_git_pass(git_odb_open_rstream(&stream, odb, id));
+	cl_assert_equal_i(GIT_STREAM_RDONLY, stream->mode);
+
+	while ((read = git_odb_stream_read(stream, buffer, chunk)) > 0)
+		cl_git_pass(git_buf_put(out, buffer, read));
+
+	cl_assert_equal_i(0, read);
+	cl_assert_equal_sz(stream->declared_size, git_buf_len(out));
+
+	git_odb_stream_free(stream);
+}
+
+static int compare_streamed_cb(const git_oid *id, void *payload)
+{
+	git_buf streamed = GIT_BUF_INIT;
+	git_odb_object *obj;
+	size_t *chunk = payload;
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+
+	read_streamed(&streamed, id, *chunk);
+
+	cl_assert_equal_sz(git_odb_object_size(obj), git_buf_len(&streamed));
+	cl_assert(memcmp(git_odb_object_data(obj), streamed.ptr, streamed.size) == 0);
+
+	git_odb_object_free(obj);
+	git_buf_free(&streamed);
+	return 0;
+}
+
+void test_odb_streamread__packed_matches_full_read(void)
+{
+	size_t chunk = 1024;
+
+	add_pack_backend();
+	cl_git_pass(git_odb_foreach(odb, compare_streamed_cb, &chunk));
+}
+
+void test_odb_streamread__packed_matches_full_read_in_small_chunks(void)
+{
+	size_t chunk = 7;
+
+	add_pack_backend();
+	cl_git_pass(git_odb_foreach(odb, compare_streamed_cb, &chunk));
+}
+
+void test_odb_streamread__loose_matches_full_read(void)
+{
+	size_t chunk = 1024;
+
+	add_loose_backend();
+	cl_git_pass(git_odb_foreach(odb, compare_streamed_cb, &chunk));
+}
+
+void test_odb_streamread__loose_matches_full_read_in_small_chunks(void)
+{
+	size_t chunk = 7;
+
+	add_loose_backend();
+	cl_git_pass(git_odb_foreach(odb, compare_streamed_cb, &chunk));
+}
+
+void test_odb_streamread__missing_object(void)
+{
+	git_odb_stream *stream;
+	git_oid id;
+
+	add_pack_backend();
+	add_loose_backend();
+
+	cl_git_pass(git_oid_fromstr(&id, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_open_rstream(&stream, odb, &id));
+}
+
+#define BASE_BLOCKS 8
+#define BLOCK_SIZE 1024
+
+static void put_packed(git_buf *pack, git_otype type,
+	const void *data, size_t len, size_t base_offset)
+{
+	git_buf deflated = GIT_BUF_INIT;
+	unsigned char hdr[10];
+	size_t ofs = pack->size - base_offset, pos = sizeof(hdr) - 1;
+
+	cl_git_pass(git_buf_put(pack, (const char *)hdr,
+		git_packfile__object_header(hdr, len, type)));
+
+	if (type == GIT_OBJ_OFS_DELTA) {
+		hdr[pos] = ofs & 127;
+		while (ofs >>= 7)
+			hdr[--pos] = 128 | (--ofs & 127);
+
+		cl_git_pass(git_buf_put(pack, (const char *)hdr + pos, sizeof(hdr) - pos));
+	}
+
+	cl_git_pass(git_zstream_deflatebuf(&deflated, data, len));
+	cl_git_pass(git_buf_put(pack, deflated.ptr, deflated.size));
+	git_buf_free(&deflated);
+}
+
+static void put_varint(git_buf *buf, size_t n)
+{
+	while (n >= 0x80) {
+		cl_git_pass(git_buf_putc(buf, (char)(0x80 | (n & 0x7f))));
+		n >>= 7;
+	}
+
+	cl_git_pass(git_buf_putc(buf, (char)n));
+}
+
+static void put_copy(git_buf *ops, git_buf *expected,
+	const char *base, size_t off, size_t len)
+{
+	unsigned char op[7];
+
+	op[0] = 0x80 | 0x01 | 0x02 | 0x04 | 0x08 | 0x10 | 0x20;
+	op[1] = off & 0xff;
+	op[2] = (off >> 8) & 0xff;
+	op[3] = (off >> 16) & 0xff;
+	op[4] = (off >> 24) & 0xff;
+	op[5] = len & 0xff;
+	op[6] = (len >> 8) & 0xff;
+
+	cl_git_pass(git_buf_put(ops, (const char *)op, sizeof(op)));
+	cl_git_pass(git_buf_put(expected, base + off, len));
+}
+
+/* Index a pack of the base and a delta against it into "unordered" */
+static void write_delta_pack(git_buf *base, git_buf *delta)
+{
+	git_buf pack = GIT_BUF_INIT;
+	git_indexer *indexer;
+	git_transfer_progress stats;
+	git_oid trailer;
+
+	cl_git_pass(git_buf_put(&pack, "PACK\0\0\0\x02\0\0\0\x02", 12));
+	put_packed(&pack, GIT_OBJ_BLOB, base->ptr, base->size, 0);
+	put_packed(&pack, GIT_OBJ_OFS_DELTA, delta->ptr, delta->size, 12);
+	cl_git_pass(git_hash_buf(&trailer, pack.ptr, pack.size));
+	cl_git_pass(git_buf_put(&pack, (const char *)trailer.id, GIT_OID_RAWSZ));
+
+	cl_git_pass(git_futils_mkdir("unordered/pack", 0777, GIT_MKDIR_PATH));
+	cl_git_pass(git_indexer_new(&indexer, "unordered/pack", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(indexer, pack.ptr, pack.size, &stats));
+	cl_git_pass(git_indexer_commit(indexer, &stats));
+	git_indexer_free(indexer);
+
+	git_buf_free(&pack);
+}
+
+void test_odb_streamread__delta_copying_out_of_order(void)
+{
+	git_buf base = GIT_BUF_INIT, ops = GIT_BUF_INIT, delta = GIT_BUF_INIT,
+		expected = GIT_BUF_INIT, streamed = GIT_BUF_INIT;
+	git_odb_backend *backend;
+	git_oid id;
+	size_t i;
+
+	for (i = 0; i < BASE_BLOCKS * BLOCK_SIZE; i++)
+		cl_git_pass(git_buf_putc(&base, 'a' + (i / BLOCK_SIZE + i) % 26));
+
+	/* copy from the end of the base, then go back to its start */
+	put_copy(&ops, &expected, base.ptr, 6 * BLOCK_SIZE, 2 * BLOCK_SIZE);
+	put_copy(&ops, &expected, base.ptr, 0, BLOCK_SIZE);
+	cl_git_pass(git_buf_put(&ops, "\x03new", 4));
+	cl_git_pass(git_buf_put(&expected, "new", 3));
+	put_copy(&ops, &expected, base.ptr, 2 * BLOCK_SIZE + 10, BLOCK_SIZE);
+	put_copy(&ops, &expected, base.ptr, BLOCK_SIZE, 100);
+
+	put_varint(&delta, base.size);
+	put_varint(&delta, expected.size);
+	cl_git_pass(git_buf_put(&delta, ops.ptr, ops.size));
+
+	write_delta_pack(&base, &delta);
+
+	cl_git_pass(git_odb_backend_pack(&backend, "unordered"));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	cl_git_pass(git_odb_hash(&id, expected.ptr, expected.size, GIT_OBJ_BLOB));
+
+	read_streamed(&streamed, &id, 7);
+	cl_assert_equal_sz(expected.size, streamed.size);
+	cl_assert(memcmp(expected.ptr, streamed.ptr, expected.size) == 0);
+
+	git_buf_clear(&streamed);
+	read_streamed(&streamed, &id, 1024);
+	cl_assert(memcmp(expected.ptr, streamed.ptr, expected.size) == 0);
+
+	git_buf_free(&streamed);
+	git_buf_free(&expected);
+	git_buf_free(&delta);
+	git_buf_free(&ops);
+	git_buf_free(&base);
+}
+
+#define LARGE_BASE_SIZE (8 * 1024 * 1024)
+#define LARGE_COPY_SIZE (32 * 1024)
+#define BUFFERED_LIMIT (2 * 1024 * 1024)
+
+void test_odb_streamread__large_delta_buffers_little_of_its_base(void)
+{
+	git_buf base = GIT_BUF_INIT, ops = GIT_BUF_INIT, delta = GIT_BUF_INIT,
+		expected = GIT_BUF_INIT, streamed = GIT_BUF_INIT, idx = GIT_BUF_INIT;
+	git_packfile_object_stream stream;
+	struct git_pack_file *p;
+	struct git_pack_entry e;
+	git_vector packs = GIT_VECTOR_INIT;
+	unsigned char buffer[4096];
+	const char *name;
+	uint32_t seed = 42;
+	size_t i, buffered = 0;
+	ssize_t read;
+	git_oid id;
+
+	for (i = 0; i < LARGE_BASE_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		cl_git_pass(git_buf_putc(&base, (char)(seed >> 16)));
+	}
+
+	/* go back and forth over the whole base */
+	for (i = 0; i < 64; i++) {
+		size_t off = (i % 2 ? i : 63 - i) * (LARGE_BASE_SIZE / 64);
+		put_copy(&ops, &expected, base.ptr, off, LARGE_COPY_SIZE);
+	}
+
+	put_varint(&delta, base.size);
+	put_varint(&delta, expected.size);
+	cl_git_pass(git_buf_put(&delta, ops.ptr, ops.size));
+
+	write_delta_pack(&base, &delta);
+
+	cl_git_pass(git_path_dirload(&packs, "unordered/pack", 0, 0));
+	git_vector_foreach(&packs, i, name) {
+		if (!git__suffixcmp(name, ".idx"))
+			cl_git_pass(git_buf_sets(&idx, name));
+	}
+
+	cl_git_pass(git_odb_hash(&id, expected.ptr, expected.size, GIT_OBJ_BLOB));
+	cl_git_pass(git_packfile_alloc(&p, idx.ptr));
+	cl_git_pass(git_pack_entry_find(&e, p, &id, GIT_OID_HEXSZ));
+
+	cl_git_pass(git_packfile_object_stream_open(&stream, p, e.offset));
+
+	while ((read = git_packfile_object_stream_read(&stream, buffer, sizeof(buffer))) > 0) {
+		cl_git_pass(git_buf_put(&streamed, (const char *)buffer, read));
+		buffered = max(buffered, git_packfile_object_stream__buffered(&stream));
+	}
+
+	cl_assert_equal_i(0, read);
+	cl_assert_equal_sz(expected.size, streamed.size);
+	cl_assert(memcmp(expected.ptr, streamed.ptr, expected.size) == 0);
+
+	/* the base is only ever inflated in part */
+	cl_assert(buffered > 0);
+	cl_assert(buffered < BUFFERED_LIMIT);
+
+	git_packfile_object_stream_free(&stream);
+	git_packfile_free(p);
+
+	git_vector_free_deep(&packs);
+	git_buf_free(&idx);
+	git_buf_free(&streamed);
+	git_buf_free(&expected);
+	git_buf_free(&delta);
+	git_buf_free(&ops);
+	git_buf_free(&base);
+}
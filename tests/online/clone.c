@@ -653,3 +653,55 @@ void test_online_clone__start_with_http(void)
 
 	cl_git_pass(git_clone(&g_repo, "http://github.com/libgit2/TestGitRepository", "./foo", &g_options));
 }
+
+static size_t fetch_master(const char *protocol_version)
+{
+	git_remote *remote;
+	git_config *cfg;
+	const git_remote_head **refs;
+	char *spec = "refs/heads/master:refs/remotes/origin/master";
+	git_strarray specs = { &spec, 1 };
+	size_t count, i, unwanted = 0;
+
+	cl_git_pass(git_repository_init(&g_repo, "./foo", true));
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_string(cfg, "protocol.version", protocol_version));
+	git_config_free(cfg);
+
+	cl_git_pass(git_remote_create(&remote, g_repo, "origin", LIVE_REPO_URL));
+	cl_git_pass(git_remote_fetch(remote, &specs, NULL, NULL));
+	cl_git_pass(git_remote_ls(&refs, &count, remote));
+
+	for (i = 0; i < count; i++) {
+		if (strcmp(refs[i]->name, GIT_HEAD_FILE) != 0 &&
+			git__prefixcmp(refs[i]->name, "refs/heads/master") != 0 &&
+			git__prefixcmp(refs[i]->name, GIT_REFS_TAGS_DIR) != 0)
+			unwanted++;
+	}
+
+	git_remote_free(remote);
+	return unwanted;
+}
+
+void test_online_clone__protocol_v2_lists_only_the_wanted_refs(void)
+{
+	git_reference *ref;
+
+	cl_assert_equal_sz(0, fetch_master("2"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/remotes/origin/master"));
+	git_reference_free(ref);
+}
+
+void test_online_clone__protocol_v0_lists_all_refs(void)
+{
+	cl_assert(fetch_master("0") > 0);
+}
+
+void test_online_clone__protocol_v2_shallow(void)
+{
+	g_options.fetch_opts.depth = 1;
+
+	cl_git_pass(git_clone(&g_repo, "https://github.com/libgit2/TestGitRepository", "./foo", &g_options));
+	cl_assert(git_repository_is_shallow(g_repo));
+}
@@ -0,0 +1,72 @@
+#include "clar_libgit2.h"
+#include "pack.h"
+#include "offmap.h"
+
+GIT__USE_OFFMAP
+
+#define TESTREPO_PACK "testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx"
+
+static struct git_pack_file *_pack;
+
+void test_pack_cache__initialize(void)
+{
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_joinpath(&path, cl_fixture("."), TESTREPO_PACK));
+	cl_git_pass(git_packfile_alloc(&_pack, path.ptr));
+	git_buf_free(&path);
+}
+
+void test_pack_cache__cleanup(void)
+{
+	git_packfile_free(_pack);
+	_pack = NULL;
+}
+
+static git_off_t unpack(const char *id, git_rawobj *out)
+{
+	struct git_pack_entry e;
+	git_oid oid;
+	git_off_t offset;
+
+	cl_git_pass(git_oid_fromstr(&oid, id));
+	cl_git_pass(git_pack_entry_find(&e, _pack, &oid, GIT_OID_HEXSZ));
+
+	offset = e.offset;
+	cl_git_pass(git_packfile_unpack(out, _pack, &e.offset));
+	return offset;
+}
+
+static bool is_cached(const char *id)
+{
+	struct git_pack_entry e;
+	git_oid oid;
+
+	cl_git_pass(git_oid_fromstr(&oid, id));
+	cl_git_pass(git_pack_entry_find(&e, _pack, &oid, GIT_OID_HEXSZ));
+
+	return git_offmap_exists(_pack->bases.entries, e.offset);
+}
+
+void test_pack_cache__keeps_intermediate_bases(void)
+{
+	git_rawobj obj, again;
+	git_oid id;
+
+	/* at depth 5, on top of 5e95e53 (depth 4) and 47015c6 (depth 3) */
+	unpack("0985c00bcf2bc8403f5d0c4957f3c2c8bc2808b4", &obj);
+	cl_git_pass(git_odb_hash(&id, obj.data, obj.len, obj.type));
+	cl_assert_equal_s("0985c00bcf2bc8403f5d0c4957f3c2c8bc2808b4", git_oid_tostr_s(&id));
+
+	cl_assert(is_cached("5e95e5342bb02f75240eb1b5978246e2f10c2810"));
+	cl_assert(is_cached("47015c6bbd6b6736985a562bf227a989c6340df8"));
+	cl_assert(!is_cached("0985c00bcf2bc8403f5d0c4957f3c2c8bc2808b4"));
+
+	/* the object comes out the same when its base is in the cache */
+	unpack("0985c00bcf2bc8403f5d0c4957f3c2c8bc2808b4", &again);
+	cl_assert_equal_sz(obj.len, again.len);
+	cl_assert(memcmp(obj.data, again.data, obj.len) == 0);
+
+	git__free(obj.data);
+	git__free(again.data);
+}
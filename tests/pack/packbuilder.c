@@ -1,6 +1,7 @@
 #include "clar_libgit2.h"
 #include "fileops.h"
 #include "pack.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -223,3 +224,65 @@ void test_pack_packbuilder__foreach_with_cancel(void)
 		git_packbuilder_foreach(_packbuilder, foreach_cancel_cb, idx), -1111);
 	git_indexer_free(idx);
 }
+
+static bool buf_contains(const git_buf *haystack, const git_buf *needle)
+{
+	size_t i;
+
+	for (i = 0; i + needle->size <= haystack->size; i++) {
+		if (!memcmp(haystack->ptr + i, needle->ptr, needle->size))
+			return true;
+	}
+
+	return false;
+}
+
+void test_pack_packbuilder__big_objects_are_stored_uncompressed(void)
+{
+	git_config *cfg;
+	git_odb *odb;
+	git_odb_backend *backend;
+	git_odb_object *obj;
+	git_oid blob_id;
+	git_buf content = GIT_BUF_INIT, pack = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	int i;
+	char hex[GIT_OID_HEXSZ+1]; hex[GIT_OID_HEXSZ] = '\0';
+
+	for (i = 0; i < 256; i++)
+		cl_git_pass(git_buf_puts(&content, "a very compressible line\n"));
+
+	cl_git_pass(git_blob_create_frombuffer(&blob_id, _repo, content.ptr, content.size));
+
+	cl_git_pass(git_repository_config(&cfg, _repo));
+	cl_git_pass(git_config_set_int64(cfg, "core.bigFileThreshold", 1024));
+	git_config_free(cfg);
+
+	git_packbuilder_free(_packbuilder);
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	cl_git_pass(git_packbuilder_insert(_packbuilder, &blob_id, NULL));
+
+	cl_git_pass(git_packbuilder_write_buf(&pack, _packbuilder));
+	cl_assert(buf_contains(&pack, &content));
+
+	/* the pack must still index and read back correctly */
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL, NULL));
+	cl_git_pass(git_indexer_append(_indexer, pack.ptr, pack.size, &_stats));
+	cl_git_pass(git_indexer_commit(_indexer, &_stats));
+
+	git_oid_fmt(hex, git_indexer_hash(_indexer));
+	git_buf_printf(&path, "pack-%s.idx", hex);
+
+	cl_git_pass(git_odb_new(&odb));
+	cl_git_pass(git_odb_backend_one_pack(&backend, path.ptr));
+	cl_git_pass(git_odb_add_backend(odb, backend, 1));
+
+	cl_git_pass(git_odb_read(&obj, odb, &blob_id));
+	cl_assert_equal_sz(content.size, git_odb_object_size(obj));
+	cl_assert(!memcmp(content.ptr, git_odb_object_data(obj), content.size));
+
+	git_odb_object_free(obj);
+	git_odb_free(odb);
+	git_buf_free(&path);
+	git_buf_free(&pack);
+	git_buf_free(&content);
+}
@@ -0,0 +1,202 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "midx.h"
+#include "git2/repack.h"
+
+static git_repository *_repo;
+static git_vector _objects;
+
+static int collect_object_cb(const git_oid *id, void *payload)
+{
+	git_vector *objects = payload;
+	git_oid *copy = git__malloc(sizeof(git_oid));
+
+	cl_assert(copy);
+	git_oid_cpy(copy, id);
+	return git_vector_insert(objects, copy);
+}
+
+void test_pack_repack__initialize(void)
+{
+	git_odb *odb;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+
+	cl_git_pass(git_vector_init(&_objects, 2048, NULL));
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_foreach(odb, collect_object_cb, &_objects));
+	git_odb_free(odb);
+}
+
+void test_pack_repack__cleanup(void)
+{
+	git_oid *id;
+	size_t i;
+
+	git_vector_foreach(&_objects, i, id)
+		git__free(id);
+	git_vector_free(&_objects);
+
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+static int count_suffix_cb(void *payload, git_buf *path)
+{
+	const char *suffix = ((const char **)payload)[0];
+	size_t *count = ((size_t **)payload)[1];
+
+	if (git__suffixcmp(path->ptr, suffix) == 0)
+		(*count)++;
+
+	return 0;
+}
+
+static size_t count_files(const char *dir, const char *suffix)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t count = 0;
+	void *payload[2];
+
+	payload[0] = (void *)suffix;
+	payload[1] = &count;
+
+	cl_git_pass(git_buf_sets(&path, dir));
+	cl_git_pass(git_path_direach(&path, 0, count_suffix_cb, payload));
+	git_buf_free(&path);
+
+	return count;
+}
+
+static void assert_all_objects_readable(git_repository *repo)
+{
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid *id;
+	size_t i;
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	git_vector_foreach(&_objects, i, id) {
+		cl_git_pass(git_odb_read(&obj, odb, id));
+		git_odb_object_free(obj);
+	}
+
+	git_odb_free(odb);
+}
+
+#define BIG_PACK "testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack"
+#define SMALL_PACK "testrepo.git/objects/pack/pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5"
+
+void test_pack_repack__rolls_up_small_packs(void)
+{
+	git_repository *reopened;
+
+	cl_assert_equal_sz(3, count_files("testrepo.git/objects/pack", ".pack"));
+
+	cl_git_pass(git_repack(_repo, NULL));
+
+	/* the two small packs were merged, the big one left alone */
+	cl_assert_equal_sz(2, count_files("testrepo.git/objects/pack", ".pack"));
+	cl_assert(git_path_exists(BIG_PACK));
+	cl_assert(!git_path_exists(SMALL_PACK ".pack"));
+	cl_assert(!git_path_exists(SMALL_PACK ".idx"));
+
+	/* both the refreshed and a fresh object database see everything */
+	assert_all_objects_readable(_repo);
+
+	cl_git_pass(git_repository_open(&reopened, "testrepo.git"));
+	assert_all_objects_readable(reopened);
+	git_repository_free(reopened);
+}
+
+void test_pack_repack__progression_is_left_alone(void)
+{
+	cl_git_pass(git_repack(_repo, NULL));
+	cl_assert_equal_sz(2, count_files("testrepo.git/objects/pack", ".pack"));
+
+	cl_git_pass(git_repack(_repo, NULL));
+	cl_assert_equal_sz(2, count_files("testrepo.git/objects/pack", ".pack"));
+	cl_assert(git_path_exists(BIG_PACK));
+}
+
+void test_pack_repack__larger_factor_merges_everything(void)
+{
+	git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+
+	opts.factor = 1000;
+
+	cl_git_pass(git_repack(_repo, &opts));
+
+	cl_assert_equal_sz(1, count_files("testrepo.git/objects/pack", ".pack"));
+	cl_assert(!git_path_exists(BIG_PACK));
+	assert_all_objects_readable(_repo);
+}
+
+void test_pack_repack__kept_packs_are_untouched(void)
+{
+	cl_git_mkfile(SMALL_PACK ".keep", "");
+
+	cl_git_pass(git_repack(_repo, NULL));
+
+	cl_assert_equal_sz(3, count_files("testrepo.git/objects/pack", ".pack"));
+	cl_assert(git_path_exists(SMALL_PACK ".pack"));
+}
+
+void test_pack_repack__packs_loose_objects(void)
+{
+	git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+
+	cl_assert(git_path_exists("testrepo.git/objects/08"));
+
+	opts.flags = GIT_REPACK_LOOSE;
+	cl_git_pass(git_repack(_repo, &opts));
+
+	cl_assert(!git_path_exists("testrepo.git/objects/08"));
+	cl_assert_equal_sz(2, count_files("testrepo.git/objects/pack", ".pack"));
+	assert_all_objects_readable(_repo);
+}
+
+static uint32_t chunk_offset(const unsigned char *midx, size_t n)
+{
+	/* offsets are 64-bit, but the small fixture fits in the low word */
+	return ntohl(*(uint32_t *)(midx + 12 + n * 12 + 8));
+}
+
+void test_pack_repack__writes_multi_pack_index(void)
+{
+	git_repack_options opts = GIT_REPACK_OPTIONS_INIT;
+	git_buf midx = GIT_BUF_INIT;
+	const unsigned char *data;
+	uint32_t oidf, oidl, ooff;
+
+	opts.flags = GIT_REPACK_WRITE_MIDX;
+	cl_git_pass(git_repack(_repo, &opts));
+
+	cl_git_pass(git_futils_readbuffer(&midx,
+		"testrepo.git/objects/pack/" GIT_MIDX_FILE));
+
+	data = (const unsigned char *)midx.ptr;
+	cl_assert(midx.size > 12 + 5 * 12 + 1024 + GIT_OID_RAWSZ);
+	cl_assert(memcmp(data, "MIDX", 4) == 0);
+	cl_assert_equal_i(GIT_MIDX_VERSION, data[4]);
+	cl_assert_equal_i(GIT_MIDX_OID_VERSION, data[5]);
+	cl_assert_equal_i(4, data[6]);
+	cl_assert_equal_i(2, ntohl(*(uint32_t *)(data + 8)));
+
+	/* the last fanout entry matches the size of the lookup chunk */
+	oidf = chunk_offset(data, 1);
+	oidl = chunk_offset(data, 2);
+	ooff = chunk_offset(data, 3);
+	cl_assert_equal_i(1024, oidl - oidf);
+	cl_assert_equal_i((ooff - oidl) / GIT_OID_RAWSZ,
+		ntohl(*(uint32_t *)(data + oidf + 255 * 4)));
+
+	git_buf_free(&midx);
+
+	/* a later repack without the flag drops the stale index */
+	opts.flags = 0;
+	opts.factor = 1000;
+	cl_git_pass(git_repack(_repo, &opts));
+	cl_assert(!git_path_exists("testrepo.git/objects/pack/" GIT_MIDX_FILE));
+}
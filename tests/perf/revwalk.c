@@ -0,0 +1,83 @@
+#include "clar_libgit2.h"
+#include "helper__perf__timer.h"
+#include "git2/commit_graph.h"
+
+/* This test requires a repo with a long history.
+ *
+ * As with the merge test, we use the LibGit2 repo
+ * containing the source tree because it is already here.
+ *
+ */
+#define SRC_REPO (cl_fixture("../.."))
+
+static git_repository *g_repo;
+
+void test_perf_revwalk__initialize(void)
+{
+}
+
+void test_perf_revwalk__cleanup(void)
+{
+	git_repository_free(g_repo);
+	g_repo = NULL;
+}
+
+static void perf__do_walk(const char *test_name, unsigned int sorting)
+{
+	git_revwalk *walk;
+	git_oid id;
+	size_t count = 0;
+	perf_timer t_walk = PERF_TIMER_INIT;
+
+	perf__timer__start(&t_walk);
+
+	cl_git_pass(git_revwalk_new(&walk, g_repo));
+	git_revwalk_sorting(walk, sorting);
+	cl_git_pass(git_revwalk_push_glob(walk, "*"));
+
+	while (git_revwalk_next(&id, walk) == 0)
+		count++;
+
+	git_revwalk_free(walk);
+
+	perf__timer__stop(&t_walk);
+	perf__timer__report(&t_walk, "%s: %"PRIuZ" commits", test_name, count);
+}
+
+static void perf__do_walks(const char *name)
+{
+	char test_name[64];
+
+	/* the first walk also loads the packs */
+	p_snprintf(test_name, sizeof(test_name), "%s: first walk", name);
+	perf__do_walk(test_name, GIT_SORT_NONE);
+
+	p_snprintf(test_name, sizeof(test_name), "%s: walk", name);
+	perf__do_walk(test_name, GIT_SORT_NONE);
+
+	p_snprintf(test_name, sizeof(test_name), "%s: time", name);
+	perf__do_walk(test_name, GIT_SORT_TIME);
+
+	p_snprintf(test_name, sizeof(test_name), "%s: topological", name);
+	perf__do_walk(test_name, GIT_SORT_TOPOLOGICAL);
+}
+
+void test_perf_revwalk__w1(void)
+{
+#if 1
+	cl_skip();
+#else
+	git_clone_options clone_opts = GIT_CLONE_OPTIONS_INIT;
+
+	clone_opts.bare = 1;
+	cl_git_pass(git_clone(&g_repo, SRC_REPO, "w1.git", &clone_opts));
+
+	perf__do_walks("w1 without commit-graph");
+
+	cl_git_pass(git_commit_graph_write(g_repo));
+	git_repository_free(g_repo);
+	cl_git_pass(git_repository_open(&g_repo, "w1.git"));
+
+	perf__do_walks("w1 with commit-graph");
+#endif
+}
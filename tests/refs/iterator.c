@@ -219,3 +219,36 @@ void test_refs_iterator__concurrent_delete(void)
 	cl_git_sandbox_cleanup();
 	repo = NULL;
 }
+
+static void assert_glob_matches_filter(const char *glob)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t i, count = 0, expected = 0;
+
+	for (i = 0; i < ARRAY_SIZE(refnames); i++)
+		expected += (p_fnmatch(glob, refnames[i], 0) == 0);
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, repo, glob));
+
+	while (git_reference_next_name(&name, iter) == 0) {
+		cl_assert(p_fnmatch(glob, name, 0) == 0);
+		count++;
+	}
+
+	git_reference_iterator_free(iter);
+	cl_assert_equal_sz(expected, count);
+}
+
+void test_refs_iterator__glob_is_applied_by_the_backend(void)
+{
+	assert_glob_matches_filter("refs/heads/*");
+	assert_glob_matches_filter("refs/heads/packed*");
+	assert_glob_matches_filter("refs/heads/master");
+	assert_glob_matches_filter("refs/h*");
+	assert_glob_matches_filter("refs/tags/[a-f]*");
+	assert_glob_matches_filter("refs/remotes/test/*");
+	assert_glob_matches_filter("refs/nothing-here/*");
+	assert_glob_matches_filter("*test*");
+	assert_glob_matches_filter("*");
+}
@@ -103,3 +103,162 @@ void test_refs_pack__symbolic(void)
 
 	packall();
 }
+
+static void count_refs(size_t *out, const char *glob)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	int error;
+
+	*out = 0;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+	while ((error = git_reference_next_name(&name, iter)) == 0)
+		(*out)++;
+	cl_assert_equal_i(GIT_ITEROVER, error);
+
+	git_reference_iterator_free(iter);
+}
+
+void test_refs_pack__sorted_file_is_searched_in_place(void)
+{
+	git_buf contents = GIT_BUF_INIT;
+	git_reference *ref;
+	git_oid head, id;
+	char name[128];
+	int i;
+
+	cl_git_pass(git_reference_name_to_id(&head, g_repo, "HEAD"));
+
+	for (i = 0; i < 100; ++i) {
+		p_snprintf(name, sizeof(name), "refs/heads/direct-%03d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &head, 0, NULL));
+		git_reference_free(ref);
+	}
+
+	packall();
+
+	cl_git_pass(git_futils_readbuffer(&contents, "testrepo/.git/packed-refs"));
+	cl_assert(!git__prefixcmp(contents.ptr, GIT_PACKEDREFS_HEADER));
+	git_buf_free(&contents);
+
+	for (i = 0; i < 100; ++i) {
+		p_snprintf(name, sizeof(name), "refs/heads/direct-%03d", i);
+		cl_git_pass(git_reference_name_to_id(&id, g_repo, name));
+		cl_assert_equal_oid(&head, &id);
+	}
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/direct-100"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/direct-05"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/aaa"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/tags/zzz"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, loose_tag_ref_name));
+	cl_assert(reference_is_packed(ref));
+	cl_assert(git_reference_target_peel(ref) != NULL);
+	git_reference_free(ref);
+
+	/* a packed ref is enough for the name to be taken */
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/direct-042", &head, 0, NULL));
+}
+
+void test_refs_pack__sorted_file_iterates_by_prefix(void)
+{
+	git_reference *ref;
+	git_oid head, other, id;
+	char name[128];
+	size_t count;
+	int i;
+
+	cl_git_pass(git_reference_name_to_id(&head, g_repo, "HEAD"));
+	cl_git_pass(git_reference_name_to_id(&other, g_repo, "refs/heads/br2"));
+
+	for (i = 0; i < 30; ++i) {
+		p_snprintf(name, sizeof(name), "refs/heads/direct-%03d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &head, 0, NULL));
+		git_reference_free(ref);
+	}
+
+	packall();
+
+	count_refs(&count, "refs/heads/direct-*");
+	cl_assert_equal_sz(30, count);
+	count_refs(&count, "refs/heads/direct-01?");
+	cl_assert_equal_sz(10, count);
+	count_refs(&count, "refs/heads/direct-0[0-1]5");
+	cl_assert_equal_sz(2, count);
+	count_refs(&count, "refs/heads/nothing-*");
+	cl_assert_equal_sz(0, count);
+
+	/* a loose ref hides the packed one of the same name */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/direct-012", &other, 1, NULL));
+	git_reference_free(ref);
+
+	count_refs(&count, "refs/heads/direct-*");
+	cl_assert_equal_sz(30, count);
+	cl_git_pass(git_reference_name_to_id(&id, g_repo, "refs/heads/direct-012"));
+	cl_assert_equal_oid(&other, &id);
+}
+
+void test_refs_pack__sorted_file_is_reloaded_when_rewritten(void)
+{
+	git_reference *ref;
+	git_oid head, id;
+
+	cl_git_pass(git_reference_name_to_id(&head, g_repo, "HEAD"));
+
+	packall();
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/packed-later"));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/packed-later", &head, 0, NULL));
+	git_reference_free(ref);
+	packall();
+
+	cl_git_pass(git_reference_name_to_id(&id, g_repo, "refs/heads/packed-later"));
+	cl_assert_equal_oid(&head, &id);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed-later"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/packed-later"));
+}
+
+void test_refs_pack__unsorted_file_is_still_read(void)
+{
+	git_oid id, expected;
+
+	/* without the sorted trait, the refs may come in any order */
+	cl_git_rewritefile("testrepo/.git/packed-refs",
+		"# pack-refs with: peeled \n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/zzz\n"
+		"e90810b8df3e80c413d903f631643c716887138d refs/heads/aaa\n");
+
+	cl_git_pass(git_oid_fromstr(&expected, "e90810b8df3e80c413d903f631643c716887138d"));
+	cl_git_pass(git_reference_name_to_id(&id, g_repo, "refs/heads/aaa"));
+	cl_assert_equal_oid(&expected, &id);
+
+	cl_git_pass(git_oid_fromstr(&expected, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_reference_name_to_id(&id, g_repo, "refs/heads/zzz"));
+	cl_assert_equal_oid(&expected, &id);
+}
+
+void test_refs_pack__corrupted_sorted_file(void)
+{
+	git_reference *ref;
+
+	cl_git_rewritefile("testrepo/.git/packed-refs",
+		GIT_PACKEDREFS_HEADER "\n"
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/aaa\n"
+		"e90810b8df3e80c413d903f631643c716887138d refs/heads/zz");
+
+	cl_git_fail(git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_assert(giterr_last() && strstr(giterr_last()->message, "Corrupted"));
+}
@@ -448,3 +448,101 @@ void test_refs_reflog_reflog__logallrefupdates_nonbare_set_false(void)
 
 	assert_no_reflog_update();
 }
+
+static void append_many_entries(const char *refname, size_t count)
+{
+	git_reflog *reflog;
+	git_signature *committer;
+	git_oid oid;
+	git_buf msg = GIT_BUF_INIT;
+	size_t i;
+
+	git_oid_fromstr(&oid, current_master_tip);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, refname));
+
+	for (i = 0; i < count; i++) {
+		cl_git_pass(git_signature_new(&committer,
+			"foo", "foo@bar", 1195000000 + i, 0));
+
+		git_buf_clear(&msg);
+		cl_git_pass(git_buf_printf(&msg, "commit: entry %"PRIuZ, i));
+		cl_git_pass(git_reflog_append(reflog, &oid, committer, msg.ptr));
+
+		git_signature_free(committer);
+	}
+
+	cl_git_pass(git_reflog_write(reflog));
+
+	git_reflog_free(reflog);
+	git_buf_free(&msg);
+}
+
+void test_refs_reflog_reflog__read_recent_entries(void)
+{
+	git_reflog *full, *recent;
+	const git_reflog_entry *a, *b;
+	size_t i;
+
+	append_many_entries("refs/heads/master", 500);
+
+	cl_git_pass(git_reflog_read(&full, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reflog__read_recent(&recent, g_repo, "refs/heads/master", 3));
+
+	cl_assert(git_reflog__truncated(recent));
+	cl_assert(git_reflog_entrycount(recent) >= 3);
+	cl_assert(git_reflog_entrycount(recent) < git_reflog_entrycount(full));
+
+	for (i = 0; i < git_reflog_entrycount(recent); i++) {
+		a = git_reflog_entry_byindex(full, i);
+		b = git_reflog_entry_byindex(recent, i);
+
+		cl_assert_equal_oid(&a->oid_old, &b->oid_old);
+		cl_assert_equal_oid(&a->oid_cur, &b->oid_cur);
+		cl_assert_equal_s(a->msg, b->msg);
+		assert_signature(a->committer, b->committer);
+	}
+
+	/* only part of the log is there, so it cannot be written back */
+	cl_git_fail(git_reflog_write(recent));
+	git_reflog_free(recent);
+
+	cl_git_pass(git_reflog__read_recent(&recent, g_repo, "refs/heads/master", 1000));
+	cl_assert(!git_reflog__truncated(recent));
+	cl_assert_equal_i(git_reflog_entrycount(full), git_reflog_entrycount(recent));
+
+	git_reflog_free(recent);
+	git_reflog_free(full);
+}
+
+void test_refs_reflog_reflog__revparse_reads_far_enough_back(void)
+{
+	git_reflog *reflog;
+	git_object *obj;
+	git_oid expected;
+	git_buf spec = GIT_BUF_INIT;
+	size_t count;
+
+	append_many_entries("refs/heads/master", 300);
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	count = git_reflog_entrycount(reflog);
+	git_oid_cpy(&expected, &git_reflog_entry_byindex(reflog, count - 1)->oid_cur);
+	git_reflog_free(reflog);
+
+	/* the oldest entry, well past the first chunk read */
+	cl_git_pass(git_buf_printf(&spec, "master@{%"PRIuZ"}", count - 1));
+	cl_git_pass(git_revparse_single(&obj, g_repo, spec.ptr));
+	cl_assert_equal_oid(&expected, git_object_id(obj));
+	git_object_free(obj);
+
+	git_buf_clear(&spec);
+	cl_git_pass(git_buf_printf(&spec, "master@{%"PRIuZ"}", count));
+	cl_git_fail_with(GIT_ENOTFOUND, git_revparse_single(&obj, g_repo, spec.ptr));
+
+	/* and by date, where the search has to keep going back */
+	cl_git_pass(git_revparse_single(&obj, g_repo, "master@{1195000010}"));
+	git_object_free(obj);
+
+	git_buf_free(&spec);
+}
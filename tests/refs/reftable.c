@@ -0,0 +1,447 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "git2/reflog.h"
+#include "git2/refdb.h"
+#include "git2/transaction.h"
+#include "git2/sys/refdb_backend.h"
+#include "git2/sys/refs.h"
+#include "git2/sys/repository.h"
+#include "refs.h"
+
+static git_repository *g_repo;
+static size_t g_ref_count;
+
+static const char *master_id = "099fabac3a9ea935598528c27f866e34089c2eff";
+static const char *other_id = "e90810b8df3e80c413d903f631643c716887138d";
+
+static git_reference *copy_ref(const git_reference *ref)
+{
+	if (git_reference_type(ref) == GIT_REF_SYMBOLIC)
+		return git_reference__alloc_symbolic(
+			git_reference_name(ref), git_reference_symbolic_target(ref));
+
+	return git_reference__alloc(git_reference_name(ref),
+		git_reference_target(ref), git_reference_target_peel(ref));
+}
+
+/* Move the references of the sandbox over to a reftable backend */
+static void use_reftable(void)
+{
+	git_reference_iterator *iter;
+	git_reference *ref, *head;
+	git_vector refs = GIT_VECTOR_INIT;
+	git_refdb_backend *backend;
+	git_refdb *refdb;
+	size_t i;
+
+	cl_git_pass(git_reference_iterator_new(&iter, g_repo));
+	while (git_reference_next(&ref, iter) == 0) {
+		cl_git_pass(git_vector_insert(&refs, copy_ref(ref)));
+		git_reference_free(ref);
+	}
+	git_reference_iterator_free(iter);
+
+	cl_git_pass(git_reference_lookup(&head, g_repo, GIT_HEAD_FILE));
+	cl_git_pass(git_vector_insert(&refs, copy_ref(head)));
+	git_reference_free(head);
+
+	cl_git_pass(git_refdb_new(&refdb, g_repo));
+	cl_git_pass(git_refdb_backend_reftable(&backend, g_repo));
+	cl_git_pass(git_refdb_set_backend(refdb, backend));
+	git_repository_set_refdb(g_repo, refdb);
+	git_refdb_free(refdb);
+
+	g_ref_count = 0;
+
+	git_vector_foreach(&refs, i, ref) {
+		if (git_reference_type(ref) == GIT_REF_SYMBOLIC)
+			cl_git_pass(git_reference_symbolic_create(NULL, g_repo,
+				git_reference_name(ref), git_reference_symbolic_target(ref),
+				true, NULL));
+		else
+			cl_git_pass(git_reference_create(NULL, g_repo,
+				git_reference_name(ref), git_reference_target(ref),
+				true, NULL));
+
+		if (strcmp(git_reference_name(ref), GIT_HEAD_FILE))
+			g_ref_count++;
+
+		git_reference_free(ref);
+	}
+
+	git_vector_free(&refs);
+}
+
+static size_t table_count(void)
+{
+	git_buf path = GIT_BUF_INIT, list = GIT_BUF_INIT;
+	size_t i, count = 0;
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(g_repo), "reftable/tables.list"));
+	cl_git_pass(git_futils_readbuffer(&list, path.ptr));
+
+	for (i = 0; i < list.size; i++)
+		count += (list.ptr[i] == '\n');
+
+	git_buf_free(&path);
+	git_buf_free(&list);
+	return count;
+}
+
+static void assert_ref(const char *name, const char *sha)
+{
+	git_reference *ref;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, sha));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_i(GIT_REF_OID, git_reference_type(ref));
+	cl_assert_equal_oid(&id, git_reference_target(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo");
+	use_reftable();
+}
+
+void test_refs_reftable__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+void test_refs_reftable__lookup(void)
+{
+	git_reference *head;
+
+	assert_ref("refs/heads/master", master_id);
+
+	cl_git_pass(git_reference_lookup(&head, g_repo, GIT_HEAD_FILE));
+	cl_assert_equal_i(GIT_REF_SYMBOLIC, git_reference_type(head));
+	cl_assert_equal_s("refs/heads/master", git_reference_symbolic_target(head));
+	git_reference_free(head);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_reference_lookup(&head, g_repo, "refs/heads/nope"));
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_reference_lookup(&head, g_repo, "refs/heads"));
+}
+
+void test_refs_reftable__iterate_in_order(void)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	char *last = NULL;
+	size_t count = 0;
+
+	cl_git_pass(git_reference_iterator_new(&iter, g_repo));
+
+	while (git_reference_next_name(&name, iter) == 0) {
+		if (last)
+			cl_assert(strcmp(last, name) < 0);
+
+		git__free(last);
+		last = git__strdup(name);
+		count++;
+	}
+
+	git__free(last);
+	git_reference_iterator_free(iter);
+
+	/* HEAD sorts before refs/ like any other name */
+	cl_assert_equal_sz(g_ref_count + 1, count);
+}
+
+void test_refs_reftable__iterate_with_glob(void)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t count = 0;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, "refs/tags/*"));
+
+	while (git_reference_next_name(&name, iter) == 0) {
+		cl_assert(!git__prefixcmp(name, "refs/tags/"));
+		count++;
+	}
+
+	git_reference_iterator_free(iter);
+	cl_assert(count > 0);
+}
+
+void test_refs_reftable__update_and_delete(void)
+{
+	git_reference *ref, *updated;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, other_id));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reference_set_target(&updated, ref, &id, "moved"));
+	git_reference_free(ref);
+
+	assert_ref("refs/heads/master", other_id);
+
+	cl_git_pass(git_reference_delete(updated));
+	git_reference_free(updated);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/master"));
+
+	/* and it can come back */
+	cl_git_pass(git_reference_create(&ref, g_repo,
+		"refs/heads/master", &id, false, NULL));
+	git_reference_free(ref);
+
+	assert_ref("refs/heads/master", other_id);
+}
+
+void test_refs_reftable__old_value_must_match(void)
+{
+	git_reference *ref;
+	git_oid id, wrong;
+
+	cl_git_pass(git_oid_fromstr(&id, master_id));
+	cl_git_pass(git_oid_fromstr(&wrong, other_id));
+
+	cl_assert_equal_i(GIT_EMODIFIED, git_reference_create_matching(&ref, g_repo,
+		"refs/heads/master", &id, true, &wrong, NULL));
+	cl_git_pass(git_reference_create_matching(&ref, g_repo,
+		"refs/heads/master", &wrong, true, &id, NULL));
+	git_reference_free(ref);
+
+	assert_ref("refs/heads/master", other_id);
+}
+
+void test_refs_reftable__names_cannot_collide(void)
+{
+	git_reference *ref;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, master_id));
+
+	cl_assert_equal_i(GIT_EEXISTS, git_reference_create(&ref, g_repo,
+		"refs/heads/master", &id, false, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo,
+		"refs/heads/master/sub", &id, true, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo,
+		"refs/heads", &id, true, NULL));
+}
+
+void test_refs_reftable__reflog(void)
+{
+	git_reference *ref, *updated;
+	git_reflog *log;
+	const git_reflog_entry *entry;
+	git_oid id, master;
+	size_t entries;
+
+	cl_git_pass(git_oid_fromstr(&id, other_id));
+	cl_git_pass(git_oid_fromstr(&master, master_id));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reference_set_target(&updated, ref, &id, "first move"));
+	git_reference_free(ref);
+	git_reference_free(updated);
+
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/master"));
+	entry = git_reflog_entry_byindex(log, 0);
+	cl_assert(entry != NULL);
+	cl_assert_equal_s("first move", git_reflog_entry_message(entry));
+	cl_assert_equal_oid(&id, git_reflog_entry_id_new(entry));
+	git_reflog_free(log);
+
+	/* HEAD follows the branch it points at */
+	cl_git_pass(git_reflog_read(&log, g_repo, GIT_HEAD_FILE));
+	entry = git_reflog_entry_byindex(log, 0);
+	cl_assert(entry != NULL);
+	cl_assert_equal_s("first move", git_reflog_entry_message(entry));
+	git_reflog_free(log);
+
+	/* dropping the entry writes the log anew */
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/master"));
+	entries = git_reflog_entrycount(log);
+	cl_git_pass(git_reflog_drop(log, 0, true));
+	cl_git_pass(git_reflog_write(log));
+	git_reflog_free(log);
+
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/master"));
+	cl_assert_equal_sz(entries - 1, git_reflog_entrycount(log));
+	entry = git_reflog_entry_byindex(log, 0);
+	cl_assert_equal_oid(&master, git_reflog_entry_id_new(entry));
+	git_reflog_free(log);
+
+	/* an empty log is still there */
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/master"));
+	while (git_reflog_entrycount(log) > 0)
+		cl_git_pass(git_reflog_drop(log, 0, false));
+	cl_git_pass(git_reflog_write(log));
+	git_reflog_free(log);
+
+	cl_assert_equal_i(1, git_reference_has_log(g_repo, "refs/heads/master"));
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/master"));
+	cl_assert_equal_sz(0, git_reflog_entrycount(log));
+	git_reflog_free(log);
+}
+
+void test_refs_reftable__rename_keeps_the_log(void)
+{
+	git_reference *ref, *renamed;
+	git_reflog *log;
+	size_t entries;
+
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/master"));
+	entries = git_reflog_entrycount(log);
+	git_reflog_free(log);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/main", false, "renamed"));
+	git_reference_free(ref);
+	git_reference_free(renamed);
+
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	assert_ref("refs/heads/main", master_id);
+
+	cl_git_pass(git_reflog_read(&log, g_repo, "refs/heads/main"));
+	cl_assert_equal_sz(entries + 1, git_reflog_entrycount(log));
+	cl_assert_equal_s("renamed",
+		git_reflog_entry_message(git_reflog_entry_byindex(log, 0)));
+	git_reflog_free(log);
+
+	cl_assert_equal_i(0, git_reference_has_log(g_repo, "refs/heads/master"));
+}
+
+void test_refs_reftable__transactions_write_one_table(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+	git_oid id;
+	size_t before;
+
+	cl_git_pass(git_oid_fromstr(&id, other_id));
+
+	before = table_count();
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &id, NULL, "tx"));
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/br2", &id, NULL, "tx"));
+	cl_git_pass(git_transaction_remove(tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	assert_ref("refs/heads/master", other_id);
+	assert_ref("refs/heads/br2", other_id);
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_assert(table_count() <= before + 1);
+}
+
+#ifdef GIT_THREADS
+static void *lock_from_another_thread(void *payload)
+{
+	git_transaction *tx;
+	int *error = payload;
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	*error = git_transaction_lock_ref(tx, "refs/heads/br2");
+	git_transaction_free(tx);
+
+	giterr_clear();
+	return NULL;
+}
+#endif
+
+void test_refs_reftable__transactions_on_other_threads_are_kept_apart(void)
+{
+#ifdef GIT_THREADS
+	git_transaction *tx;
+	git_thread thread;
+	git_oid id;
+	int error = 0;
+
+	cl_git_pass(git_oid_fromstr(&id, other_id));
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+
+	cl_git_pass(git_thread_create(&thread, NULL, lock_from_another_thread, &error));
+	cl_git_pass(git_thread_join(&thread, NULL));
+	cl_assert_equal_i(GIT_ELOCKED, error);
+
+	cl_git_pass(git_transaction_set_target(tx, "refs/heads/master", &id, NULL, "tx"));
+	cl_git_pass(git_transaction_commit(tx));
+	git_transaction_free(tx);
+
+	assert_ref("refs/heads/master", other_id);
+	assert_ref("refs/heads/br2", "a4a7dce85cf63874e984719f4fdd239f5145052f");
+#endif
+}
+
+void test_refs_reftable__stack_stays_short(void)
+{
+	git_reference *ref;
+	git_oid id;
+	char name[64];
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, master_id));
+
+	for (i = 0; i < 64; i++) {
+		p_snprintf(name, sizeof(name), "refs/heads/branch-%02d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &id, false, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_assert(table_count() < 16);
+	assert_ref("refs/heads/branch-00", master_id);
+	assert_ref("refs/heads/branch-63", master_id);
+}
+
+void test_refs_reftable__compress(void)
+{
+	git_refdb *refdb;
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	cl_assert_equal_sz(1, table_count());
+	assert_ref("refs/heads/master", master_id);
+}
+
+void test_refs_reftable__chosen_by_the_configuration(void)
+{
+	git_repository *repo;
+	git_reference *ref;
+	git_config *cfg;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, master_id));
+	cl_git_pass(git_reference_create(&ref, g_repo,
+		"refs/heads/only-in-reftable", &id, false, NULL));
+	git_reference_free(ref);
+
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/only-in-reftable"));
+
+	cl_git_pass(git_repository_config(&cfg, g_repo));
+	cl_git_pass(git_config_set_int32(cfg, "core.repositoryformatversion", 1));
+	cl_git_pass(git_config_set_string(cfg, "extensions.refstorage", "reftable"));
+
+	cl_git_pass(git_repository_open(&repo, "testrepo"));
+	cl_git_pass(git_reference_lookup(&ref, repo, "refs/heads/only-in-reftable"));
+	git_reference_free(ref);
+	git_repository_free(repo);
+
+	cl_git_pass(git_config_set_string(cfg, "extensions.refstorage", "unheard-of"));
+	cl_git_pass(git_repository_open(&repo, "testrepo"));
+	cl_git_fail(git_reference_lookup(&ref, repo, "refs/heads/master"));
+	git_repository_free(repo);
+
+	git_config_free(cfg);
+}
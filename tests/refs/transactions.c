@@ -1,5 +1,8 @@
 #include "clar_libgit2.h"
 #include "git2/transaction.h"
+#include "git2/refdb.h"
+#include "fileops.h"
+#include "refs.h"
 
 static git_repository *g_repo;
 static git_transaction *g_tx;
@@ -108,3 +111,103 @@ void test_refs_transactions__unlocked_set(void)
 	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_set_target(g_tx, "refs/heads/foo", &id, NULL, NULL));
 	cl_git_pass(git_transaction_commit(g_tx));
 }
+
+void test_refs_transactions__bulk_delete_packed(void)
+{
+	git_reference *ref;
+	git_refdb *refdb;
+	git_buf packed = GIT_BUF_INIT;
+	git_oid id;
+	char name[64];
+	int i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	for (i = 0; i < 100; i++) {
+		p_snprintf(name, sizeof(name), "refs/stale/%03d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &id, false, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+
+	/* some of them are loose again, shadowing the packed ones */
+	git_oid_fromstr(&id, "e90810b8df3e80c413d903f631643c716887138d");
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/stale/007", &id, true, NULL));
+	git_reference_free(ref);
+
+	for (i = 0; i < 100; i++) {
+		p_snprintf(name, sizeof(name), "refs/stale/%03d", i);
+		cl_git_pass(git_transaction_lock_ref(g_tx, name));
+		cl_git_pass(git_transaction_remove(g_tx, name));
+	}
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &id, NULL, NULL));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/stale/000"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/stale/007"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/stale/099"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/stale/007"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
+	git_reference_free(ref);
+
+	/* everything else is still packed, header and all */
+	cl_git_pass(git_futils_readbuffer(&packed, "testrepo/.git/packed-refs"));
+	cl_assert(!git__prefixcmp(packed.ptr, GIT_PACKEDREFS_HEADER));
+	cl_assert(strstr(packed.ptr, "refs/stale/") == NULL);
+	cl_assert(strstr(packed.ptr, " refs/heads/packed\n") != NULL);
+	git_buf_free(&packed);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed-test"));
+	git_reference_free(ref);
+}
+
+void test_refs_transactions__delete_missing_ref(void)
+{
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/not-there"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/not-there"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_commit(g_tx));
+}
+
+void test_refs_transactions__overlapping_deletes_are_kept_apart(void)
+{
+	git_transaction *other;
+	git_reference *ref;
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/br2"));
+
+	/* the second transaction is done while the first still holds its lock */
+	cl_git_pass(git_transaction_new(&other, g_repo));
+	cl_git_pass(git_transaction_lock_ref(other, "refs/heads/packed"));
+	cl_git_pass(git_transaction_remove(other, "refs/heads/packed"));
+	cl_git_pass(git_transaction_commit(other));
+	git_transaction_free(other);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	git_reference_free(ref);
+
+	cl_git_pass(git_transaction_commit(g_tx));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+}
+
+void test_refs_transactions__commit_deletes_with_refs_left_unchanged(void)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	git_reference_free(ref);
+}
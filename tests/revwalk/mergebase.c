@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "vector.h"
+#include "git2/commit_graph.h"
 #include <stdarg.h>
 
 static git_repository *_repo;
@@ -512,3 +513,49 @@ void test_revwalk_mergebase__remove_redundant(void)
 	git_oidarray_free(&result);
 	git_repository_free(repo);
 }
+
+void test_revwalk_mergebase__with_commit_graph(void)
+{
+	git_repository *repo;
+	git_signature *sig;
+	git_commit *parent;
+	git_tree *tree;
+	git_oid one, two, newer, result, expected;
+	size_t ahead, behind;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_commit_graph_write(repo));
+
+	cl_git_pass(git_oid_fromstr(&one, "763d71aadf09a7951596c9746c024e7eece7c7af"));
+	cl_git_pass(git_oid_fromstr(&two, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&expected, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+
+	cl_git_pass(git_merge_base(&result, repo, &one, &two));
+	cl_assert_equal_oid(&expected, &result);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, repo, &one, &two));
+	cl_assert_equal_sz(1, ahead);
+	cl_assert_equal_sz(4, behind);
+
+	/* a commit made after the graph was written is found in the odb */
+	cl_git_pass(git_signature_now(&sig, "Someone", "someone@example.com"));
+	cl_git_pass(git_commit_lookup(&parent, repo, &one));
+	cl_git_pass(git_commit_tree(&tree, parent));
+	cl_git_pass(git_commit_create(&newer, repo, NULL, sig, sig, NULL, "newer",
+		tree, 1, (const git_commit **)&parent));
+	git_tree_free(tree);
+	git_commit_free(parent);
+	git_signature_free(sig);
+
+	cl_git_pass(git_merge_base(&result, repo, &newer, &two));
+	cl_assert_equal_oid(&expected, &result);
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, repo, &newer, &two));
+	cl_assert_equal_sz(2, ahead);
+	cl_assert_equal_sz(4, behind);
+
+	cl_assert(git_graph_descendant_of(repo, &newer, &expected));
+	cl_assert(!git_graph_descendant_of(repo, &two, &newer));
+
+	cl_git_sandbox_cleanup();
+}
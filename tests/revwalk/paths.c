@@ -0,0 +1,197 @@
+#include "clar_libgit2.h"
+#include "revwalk.h"
+#include "git2/commit_graph.h"
+
+static git_repository *_repo;
+static git_revwalk *_walk;
+
+void test_revwalk_paths__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+}
+
+void test_revwalk_paths__cleanup(void)
+{
+	git_revwalk_free(_walk);
+	_walk = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static void set_paths(const char **paths, size_t count)
+{
+	git_strarray array;
+
+	array.strings = (char **)paths;
+	array.count = count;
+
+	cl_git_pass(git_revwalk_set_paths(_walk, &array));
+}
+
+static size_t walk_all(git_oid *out, size_t max)
+{
+	git_oid id;
+	size_t n = 0;
+	int error;
+
+	git_revwalk_sorting(_walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_glob(_walk, "*"));
+
+	while ((error = git_revwalk_next(&id, _walk)) == 0) {
+		cl_assert(n < max);
+		git_oid_cpy(&out[n++], &id);
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	return n;
+}
+
+/* Whether the diff with each parent has changes in the paths */
+static bool commit_changes_paths(const git_oid *id, const char **paths, size_t count)
+{
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	git_commit *commit, *parent;
+	git_tree *tree, *parent_tree = NULL;
+	git_diff *diff;
+	unsigned int i = 0;
+	bool changed = true;
+
+	opts.pathspec.strings = (char **)paths;
+	opts.pathspec.count = count;
+
+	cl_git_pass(git_commit_lookup(&commit, _repo, id));
+	cl_git_pass(git_commit_tree(&tree, commit));
+
+	do {
+		if (git_commit_parentcount(commit) > 0) {
+			cl_git_pass(git_commit_parent(&parent, commit, i));
+			cl_git_pass(git_commit_tree(&parent_tree, parent));
+			git_commit_free(parent);
+		}
+
+		cl_git_pass(git_diff_tree_to_tree(&diff, _repo, parent_tree, tree, &opts));
+		changed = (git_diff_num_deltas(diff) > 0);
+
+		git_diff_free(diff);
+		git_tree_free(parent_tree);
+		parent_tree = NULL;
+	} while (changed && ++i < git_commit_parentcount(commit));
+
+	git_tree_free(tree);
+	git_commit_free(commit);
+	return changed;
+}
+
+static void assert_walk_matches_diffs(const char **paths, size_t count)
+{
+	git_oid all[32], limited[32];
+	size_t nr_all, nr_limited, i, j = 0;
+
+	cl_git_pass(git_revwalk_set_paths(_walk, NULL));
+	nr_all = walk_all(all, 32);
+
+	set_paths(paths, count);
+	nr_limited = walk_all(limited, 32);
+
+	for (i = 0; i < nr_all; i++) {
+		if (!commit_changes_paths(&all[i], paths, count))
+			continue;
+
+		cl_assert(j < nr_limited);
+		cl_assert_equal_oid(&all[i], &limited[j]);
+		j++;
+	}
+
+	cl_assert_equal_i(j, nr_limited);
+}
+
+void test_revwalk_paths__file(void)
+{
+	const char *paths[] = { "README" };
+	git_oid ids[8], expected[2];
+	size_t nr;
+
+	git_oid_fromstr(&expected[0], "4a202b346bb0fb0db7eff3cffeb3c70babbd2045");
+	git_oid_fromstr(&expected[1], "8496071c1b46c854b31185ea97743be6a8774479");
+
+	set_paths(paths, 1);
+	git_revwalk_sorting(_walk, GIT_SORT_TIME);
+	cl_git_pass(git_revwalk_push_head(_walk));
+
+	for (nr = 0; git_revwalk_next(&ids[nr], _walk) == 0; nr++)
+		cl_assert(nr < 8);
+
+	cl_assert_equal_i(2, nr);
+	cl_assert_equal_oid(&expected[0], &ids[0]);
+	cl_assert_equal_oid(&expected[1], &ids[1]);
+}
+
+void test_revwalk_paths__matches_diffs(void)
+{
+	const char *readme[] = { "README" };
+	const char *files[] = { "new.txt", "branch_file.txt" };
+	const char *dir[] = { "ab/de/" };
+	const char *missing[] = { "does/not/exist" };
+
+	assert_walk_matches_diffs(readme, 1);
+	assert_walk_matches_diffs(files, 2);
+	assert_walk_matches_diffs(dir, 1);
+	assert_walk_matches_diffs(missing, 1);
+}
+
+void test_revwalk_paths__matches_diffs_with_commit_graph(void)
+{
+	const char *readme[] = { "README" };
+	const char *files[] = { "new.txt", "branch_file.txt" };
+	const char *dir[] = { "ab/de/" };
+	const char *missing[] = { "does/not/exist" };
+
+	/* the walker reads the commit-graph when it is created */
+	cl_git_pass(git_commit_graph_write(_repo));
+	git_revwalk_free(_walk);
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+	cl_assert(_walk->graph != NULL);
+
+	assert_walk_matches_diffs(readme, 1);
+	assert_walk_matches_diffs(files, 2);
+	assert_walk_matches_diffs(dir, 1);
+	assert_walk_matches_diffs(missing, 1);
+}
+
+void test_revwalk_paths__kept_across_resets(void)
+{
+	const char *paths[] = { "README" };
+	git_oid id;
+	size_t nr;
+
+	set_paths(paths, 1);
+
+	cl_git_pass(git_revwalk_push_head(_walk));
+	git_revwalk_reset(_walk);
+	cl_git_pass(git_revwalk_push_head(_walk));
+
+	for (nr = 0; git_revwalk_next(&id, _walk) == 0; nr++)
+		;
+	cl_assert_equal_i(2, nr);
+
+	cl_git_pass(git_revwalk_set_paths(_walk, NULL));
+	cl_git_pass(git_revwalk_push_head(_walk));
+
+	for (nr = 0; git_revwalk_next(&id, _walk) == 0; nr++)
+		;
+	cl_assert_equal_i(7, nr);
+}
+
+void test_revwalk_paths__invalid(void)
+{
+	const char *empty[] = { "" };
+	const char *absolute[] = { "/README" };
+	git_strarray array;
+
+	array.strings = (char **)empty;
+	array.count = 1;
+	cl_git_fail(git_revwalk_set_paths(_walk, &array));
+
+	array.strings = (char **)absolute;
+	cl_git_fail(git_revwalk_set_paths(_walk, &array));
+}
@@ -0,0 +1,62 @@
+#include "clar_libgit2.h"
+#include "shallow.h"
+
+static git_repository *_repo;
+
+void test_revwalk_shallow__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_revwalk_shallow__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static int count_commits(const char *from)
+{
+	git_revwalk *walk;
+	git_oid id;
+	int count = 0, error;
+
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_ref(walk, from));
+
+	while ((error = git_revwalk_next(&id, walk)) == 0)
+		count++;
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_revwalk_free(walk);
+
+	return count;
+}
+
+void test_revwalk_shallow__stops_at_the_roots(void)
+{
+	cl_assert_equal_i(7, count_commits("refs/heads/master"));
+
+	/* the merge of br2 into master */
+	cl_git_mkfile("testrepo.git/" GIT_SHALLOW_FILE,
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644\n");
+
+	cl_assert_equal_i(1, git_repository_is_shallow(_repo));
+	cl_assert_equal_i(2, count_commits("refs/heads/master"));
+
+	/* the history of the other side is still complete */
+	cl_assert_equal_i(6, count_commits("refs/heads/br2"));
+}
+
+void test_revwalk_shallow__merge_base_does_not_cross_the_roots(void)
+{
+	git_oid master, br2, base;
+
+	cl_git_pass(git_reference_name_to_id(&master, _repo, "refs/heads/master"));
+	cl_git_pass(git_reference_name_to_id(&br2, _repo, "refs/heads/br2"));
+
+	cl_git_pass(git_merge_base(&base, _repo, &master, &br2));
+
+	cl_git_mkfile("testrepo.git/" GIT_SHALLOW_FILE,
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644\n");
+
+	cl_assert_equal_i(GIT_ENOTFOUND, git_merge_base(&base, _repo, &master, &br2));
+}
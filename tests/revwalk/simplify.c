@@ -53,3 +53,121 @@ void test_revwalk_simplify__first_parent(void)
 
 	git_revwalk_free(walk);
 }
+
+/*
+ * Each entry is a commit followed by its rewritten parents, as shown by
+ * `git log --date-order --parents -- <path>`.
+ */
+static void assert_simplified_history(
+	const char *path, bool all_refs, const char *expected[][3], size_t count)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_strarray paths;
+	git_oidarray parents;
+	git_oid id, expected_id;
+	size_t i = 0, j;
+	int error;
+
+	paths.strings = (char **)&path;
+	paths.count = 1;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_set_paths(walk, &paths));
+
+	git_revwalk_sorting(walk, GIT_SORT_TIME);
+	git_revwalk_simplify_history(walk);
+
+	if (all_refs)
+		cl_git_pass(git_revwalk_push_glob(walk, "*"));
+	else
+		cl_git_pass(git_revwalk_push_head(walk));
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		cl_assert(i < count);
+
+		git_oid_fromstr(&expected_id, expected[i][0]);
+		cl_assert_equal_oid(&expected_id, &id);
+
+		cl_git_pass(git_revwalk_rewritten_parents(&parents, walk, &id));
+
+		for (j = 0; j < 2 && expected[i][j + 1]; j++) {
+			cl_assert(j < parents.count);
+			git_oid_fromstr(&expected_id, expected[i][j + 1]);
+			cl_assert_equal_oid(&expected_id, &parents.ids[j]);
+		}
+
+		cl_assert_equal_i(j, parents.count);
+		git_oidarray_free(&parents);
+		i++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	cl_assert_equal_i(count, i);
+
+	git_revwalk_free(walk);
+}
+
+void test_revwalk_simplify__follows_treesame_parent(void)
+{
+	/* be3563a takes README from 9fd738e, so c47800c is never walked */
+	const char *expected[][3] = {
+		{ "4a202b346bb0fb0db7eff3cffeb3c70babbd2045",
+		  "8496071c1b46c854b31185ea97743be6a8774479", NULL },
+		{ "8496071c1b46c854b31185ea97743be6a8774479", NULL, NULL },
+	};
+
+	assert_simplified_history("README", false, expected, 2);
+}
+
+void test_revwalk_simplify__rewrites_parents(void)
+{
+	const char *expected[][3] = {
+		{ "258f0e2a959a364e40ed6603d5d44fbb24765b10",
+		  "9fd738e8f7967c078dceed8190330fc8648ee56a", NULL },
+		{ "9fd738e8f7967c078dceed8190330fc8648ee56a",
+		  "5b5b025afb0b4c913b4c338a42934a3863bf3644", NULL },
+		{ "5b5b025afb0b4c913b4c338a42934a3863bf3644", NULL, NULL },
+	};
+
+	assert_simplified_history("new.txt", true, expected, 3);
+}
+
+void test_revwalk_simplify__rewrites_parents_into_merged_branch(void)
+{
+	/* git sorts 258f0e2 last as it can't parse its committer */
+	const char *expected[][3] = {
+		{ "258f0e2a959a364e40ed6603d5d44fbb24765b10",
+		  "c47800c7266a2be04c571c04d5a6614691ea99bd", NULL },
+		{ "a65fedf39aefe402d3bb6e24df4d4f5fe4547750",
+		  "c47800c7266a2be04c571c04d5a6614691ea99bd", NULL },
+		{ "c47800c7266a2be04c571c04d5a6614691ea99bd", NULL, NULL },
+	};
+
+	assert_simplified_history("branch_file.txt", true, expected, 3);
+}
+
+void test_revwalk_simplify__parents_of_unknown_commit(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_oidarray parents;
+	git_oid id;
+
+	repo = cl_git_sandbox_init("testrepo.git");
+	cl_git_pass(git_revwalk_new(&walk, repo));
+
+	git_oid_fromstr(&id, commit_head);
+	cl_assert_equal_i(GIT_ENOTFOUND,
+		git_revwalk_rewritten_parents(&parents, walk, &id));
+
+	/* without paths, the parents are the ones walked */
+	cl_git_pass(git_revwalk_push(walk, &id));
+	cl_git_pass(git_revwalk_next(&id, walk));
+	cl_git_pass(git_revwalk_rewritten_parents(&parents, walk, &id));
+	cl_assert_equal_i(2, parents.count);
+	git_oidarray_free(&parents);
+
+	git_revwalk_free(walk);
+}
@@ -0,0 +1,199 @@
+#include "clar_libgit2.h"
+#include "revwalk.h"
+#include "git2/commit_graph.h"
+
+#define HISTORY_LENGTH 100
+
+static git_repository *_repo;
+static git_revwalk *_walk;
+static git_oid _commits[HISTORY_LENGTH];
+
+/*
+ * A history where every fifth commit merges a side commit made on top
+ * of an older one, with commit times going back and forth so that
+ * they can't be relied upon for the order.
+ */
+static void create_history(void)
+{
+	git_signature *sig;
+	git_tree *tree;
+	git_commit *parents[2];
+	git_oid side;
+	size_t i, nparents;
+
+	cl_git_pass(git_revparse_single((git_object **)&tree, _repo, "HEAD^{tree}"));
+
+	for (i = 0; i < HISTORY_LENGTH; i++) {
+		cl_git_pass(git_signature_new(&sig, "Walker", "walker@example.com",
+			1400000000 + (i % 7) * 3600 - (i % 3) * 7200, 0));
+
+		nparents = 0;
+
+		if (i > 0)
+			cl_git_pass(git_commit_lookup(&parents[nparents++], _repo, &_commits[i - 1]));
+
+		if (i >= 10 && i % 5 == 0) {
+			cl_git_pass(git_commit_lookup(&parents[1], _repo, &_commits[i - 10]));
+			cl_git_pass(git_commit_create(&side, _repo, NULL, sig, sig,
+				NULL, "side", tree, 1, (const git_commit **)&parents[1]));
+			git_commit_free(parents[1]);
+
+			cl_git_pass(git_commit_lookup(&parents[nparents++], _repo, &side));
+		}
+
+		cl_git_pass(git_commit_create(&_commits[i], _repo, NULL, sig, sig,
+			NULL, "commit", tree, nparents, (const git_commit **)parents));
+
+		while (nparents)
+			git_commit_free(parents[--nparents]);
+
+		git_signature_free(sig);
+	}
+
+	git_tree_free(tree);
+}
+
+void test_revwalk_topological__initialize(void)
+{
+	git_reference *ref;
+
+	_repo = cl_git_sandbox_init("testrepo.git");
+	create_history();
+
+	cl_git_pass(git_reference_create(&ref, _repo, "refs/heads/long",
+		&_commits[HISTORY_LENGTH - 1], true, NULL));
+	git_reference_free(ref);
+}
+
+void test_revwalk_topological__cleanup(void)
+{
+	git_revwalk_free(_walk);
+	_walk = NULL;
+	cl_git_sandbox_cleanup();
+}
+
+static void new_walk(bool with_graph)
+{
+	if (with_graph)
+		cl_git_pass(git_commit_graph_write(_repo));
+
+	git_revwalk_free(_walk);
+	cl_git_pass(git_revwalk_new(&_walk, _repo));
+	cl_assert_equal_b(with_graph, _walk->graph != NULL);
+}
+
+/*
+ * Walk with the given sorting and check that no commit comes after one
+ * of its parents, returning how many commits were walked.
+ */
+static size_t assert_topological(unsigned int sorting)
+{
+	git_array_t(git_oid) ids = GIT_ARRAY_INIT;
+	git_commit *commit;
+	git_oid id, *out;
+	size_t i, j, p, count;
+	int error;
+
+	git_revwalk_sorting(_walk, sorting);
+	cl_git_pass(git_revwalk_push_ref(_walk, "refs/heads/long"));
+
+	while ((error = git_revwalk_next(&id, _walk)) == 0) {
+		out = git_array_alloc(ids);
+		cl_assert(out);
+		git_oid_cpy(out, &id);
+	}
+	cl_assert_equal_i(GIT_ITEROVER, error);
+
+	if (sorting & GIT_SORT_REVERSE) {
+		for (i = 0, j = ids.size - 1; i < j; i++, j--) {
+			id = ids.ptr[i];
+			ids.ptr[i] = ids.ptr[j];
+			ids.ptr[j] = id;
+		}
+	}
+
+	for (i = 0; i < ids.size; i++) {
+		cl_git_pass(git_commit_lookup(&commit, _repo, &ids.ptr[i]));
+
+		for (p = 0; p < git_commit_parentcount(commit); p++) {
+			for (j = 0; j < i; j++)
+				cl_assert(!git_oid_equal(&ids.ptr[j], git_commit_parent_id(commit, p)));
+		}
+
+		git_commit_free(commit);
+	}
+
+	count = ids.size;
+	git_array_clear(ids);
+	return count;
+}
+
+static void assert_sortings(bool with_graph)
+{
+	/* HISTORY_LENGTH commits and one side commit for each merge */
+	size_t expected = HISTORY_LENGTH + (HISTORY_LENGTH - 10) / 5;
+
+	new_walk(with_graph);
+
+	cl_assert_equal_sz(expected, assert_topological(GIT_SORT_TOPOLOGICAL));
+	cl_assert_equal_sz(expected,
+		assert_topological(GIT_SORT_TOPOLOGICAL | GIT_SORT_TIME));
+	cl_assert_equal_sz(expected,
+		assert_topological(GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE));
+}
+
+void test_revwalk_topological__without_commit_graph(void)
+{
+	assert_sortings(false);
+}
+
+void test_revwalk_topological__with_commit_graph(void)
+{
+	assert_sortings(true);
+}
+
+void test_revwalk_topological__does_not_load_whole_history(void)
+{
+	git_oid id;
+	size_t i, loaded;
+
+	new_walk(true);
+	git_revwalk_sorting(_walk, GIT_SORT_TOPOLOGICAL);
+	cl_git_pass(git_revwalk_push_ref(_walk, "refs/heads/long"));
+
+	for (i = 0; i < 3; i++) {
+		cl_git_pass(git_revwalk_next(&id, _walk));
+		cl_assert(git_oid_equal(&id, &_commits[HISTORY_LENGTH - 1 - i]));
+	}
+
+	loaded = _walk->store.count;
+
+	cl_assert(loaded > 3);
+	cl_assert(loaded < HISTORY_LENGTH / 2);
+	/* only the pushed tip was looked up by its id; the rest by position */
+	cl_assert_equal_i(1, git_oidmap_size(_walk->commits));
+}
+
+void test_revwalk_topological__hides_range(void)
+{
+	git_oid id;
+	char range[GIT_OID_HEXSZ * 2 + 3];
+	size_t i = 0;
+
+	new_walk(true);
+	git_revwalk_sorting(_walk, GIT_SORT_TOPOLOGICAL);
+
+	git_oid_tostr(range, GIT_OID_HEXSZ + 1, &_commits[HISTORY_LENGTH - 3]);
+	strcat(range, "..");
+	git_oid_tostr(range + GIT_OID_HEXSZ + 2, GIT_OID_HEXSZ + 1,
+		&_commits[HISTORY_LENGTH - 1]);
+	cl_git_pass(git_revwalk_push_range(_walk, range));
+
+	while (git_revwalk_next(&id, _walk) == 0) {
+		cl_assert(i < 2);
+		cl_assert(git_oid_equal(&id, &_commits[HISTORY_LENGTH - 1 - i]));
+		i++;
+	}
+
+	cl_assert_equal_sz(2, i);
+}
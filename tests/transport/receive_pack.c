@@ -0,0 +1,474 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "hash.h"
+#include "fileops.h"
+#include "server_helpers.h"
+
+static git_repository *_server;
+static git_repository *_client;
+static git_receive_pack_options _opts;
+
+static int _pre_receive_calls;
+static size_t _post_receive_len;
+static git_buf _statuses;
+
+void test_transport_receive_pack__initialize(void)
+{
+	git_clone_options clone_opts = GIT_CLONE_OPTIONS_INIT;
+
+	_server = cl_git_sandbox_init("testrepo.git");
+	_pre_receive_calls = 0;
+	_post_receive_len = 0;
+	git_buf_init(&_statuses, 0);
+
+	cl_git_pass(git_receive_pack_init_options(&_opts, GIT_RECEIVE_PACK_OPTIONS_VERSION));
+	register_served_transport(_server, &_opts);
+
+	cl_git_pass(git_clone(&_client, "served://testrepo.git", "./client", &clone_opts));
+}
+
+void test_transport_receive_pack__cleanup(void)
+{
+	unregister_served_transport();
+
+	git_repository_free(_client);
+	_client = NULL;
+
+	git_buf_free(&_statuses);
+	cl_fixture_cleanup("./client");
+	cl_git_sandbox_cleanup();
+}
+
+static void add_client_commit(git_oid *out, const char *refname)
+{
+	git_commit *head;
+	git_tree *tree;
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_oid blob_id, tree_id;
+
+	cl_git_pass(git_revparse_single((git_object **)&head, _client, "HEAD"));
+	cl_git_pass(git_commit_tree(&tree, head));
+
+	cl_git_pass(git_blob_create_frombuffer(&blob_id, _client, "pushed\n", 7));
+	cl_git_pass(git_treebuilder_new(&builder, _client, tree));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "pushed.txt", &blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	git_treebuilder_free(builder);
+	git_tree_free(tree);
+
+	cl_git_pass(git_tree_lookup(&tree, _client, &tree_id));
+	cl_git_pass(git_signature_now(&sig, "me", "me@example.com"));
+
+	cl_git_pass(git_commit_create_v(out, _client, refname,
+		sig, sig, NULL, "pushed\n", tree, 1, head));
+
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_commit_free(head);
+}
+
+static int record_status(const char *refname, const char *status, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	git_buf_printf(&_statuses, "%s:%s\n", refname, status ? status : "ok");
+	return 0;
+}
+
+static void push(const char *refspec)
+{
+	git_push_options opts = GIT_PUSH_OPTIONS_INIT;
+	git_strarray refspecs = { (char **)&refspec, 1 };
+	git_remote *remote;
+
+	opts.callbacks.push_update_reference = record_status;
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_push(remote, &refspecs, &opts));
+	git_remote_free(remote);
+}
+
+static void assert_server_ref(const char *refname, const git_oid *expected)
+{
+	git_oid id;
+
+	cl_git_pass(git_reference_name_to_id(&id, _server, refname));
+	cl_assert_equal_oid(expected, &id);
+}
+
+void test_transport_receive_pack__advertises_refs_without_head(void)
+{
+	git_buf response = GIT_BUF_INIT;
+
+	cl_git_pass(serve_receive_pack(&response, _server, NULL, "", 0, 1, 1));
+
+	cl_assert(find_in_response(&response, " refs/heads/master") != NULL);
+	cl_assert(find_in_response(&response, "report-status") != NULL);
+	cl_assert(find_in_response(&response, "atomic") != NULL);
+	cl_assert(find_in_response(&response, " HEAD") == NULL);
+	cl_assert(find_in_response(&response, "^{}") == NULL);
+
+	git_buf_free(&response);
+}
+
+void test_transport_receive_pack__updates_and_creates_refs(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	add_client_commit(&id, "refs/heads/master");
+
+	push("refs/heads/master:refs/heads/master");
+	push("refs/heads/master:refs/heads/pushed");
+
+	assert_server_ref("refs/heads/master", &id);
+	assert_server_ref("refs/heads/pushed", &id);
+	cl_assert_equal_s("refs/heads/master:ok\nrefs/heads/pushed:ok\n", _statuses.ptr);
+
+	cl_git_pass(git_repository_odb(&odb, _server));
+	cl_assert(git_odb_exists(odb, &id));
+	git_odb_free(odb);
+}
+
+void test_transport_receive_pack__deletes_refs(void)
+{
+	git_reference *ref;
+
+	push(":refs/heads/br2");
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, _server, "refs/heads/br2"));
+}
+
+void test_transport_receive_pack__honours_deny_deletes(void)
+{
+	git_config *cfg;
+	git_oid id;
+
+	cl_git_pass(git_repository_config(&cfg, _server));
+	cl_git_pass(git_config_set_bool(cfg, "receive.denyDeletes", true));
+	git_config_free(cfg);
+
+	cl_git_pass(git_reference_name_to_id(&id, _server, "refs/heads/br2"));
+
+	push(":refs/heads/br2");
+
+	assert_server_ref("refs/heads/br2", &id);
+	cl_assert_equal_s("refs/heads/br2:deletion prohibited\n", _statuses.ptr);
+}
+
+void test_transport_receive_pack__honours_deny_non_fast_forwards(void)
+{
+	git_config *cfg;
+	git_oid id;
+
+	cl_git_pass(git_repository_config(&cfg, _server));
+	cl_git_pass(git_config_set_bool(cfg, "receive.denyNonFastForwards", true));
+	git_config_free(cfg);
+
+	cl_git_pass(git_reference_name_to_id(&id, _server, "refs/heads/master"));
+
+	push("+refs/remotes/origin/br2:refs/heads/master");
+
+	assert_server_ref("refs/heads/master", &id);
+	cl_assert_equal_s("refs/heads/master:non-fast-forward\n", _statuses.ptr);
+}
+
+void test_transport_receive_pack__atomic_push_from_the_client(void)
+{
+	git_config *cfg;
+	git_push_options opts = GIT_PUSH_OPTIONS_INIT;
+	char *refspecs[] = {
+		"+refs/remotes/origin/br2:refs/heads/master",
+		"refs/heads/master:refs/heads/pushed",
+	};
+	git_strarray specs = { refspecs, 2 };
+	git_remote *remote;
+	git_reference *ref;
+	git_oid id;
+
+	cl_git_pass(git_repository_config(&cfg, _server));
+	cl_git_pass(git_config_set_bool(cfg, "receive.denyNonFastForwards", true));
+	git_config_free(cfg);
+
+	cl_git_pass(git_reference_name_to_id(&id, _server, "refs/heads/master"));
+
+	opts.atomic = 1;
+	opts.callbacks.push_update_reference = record_status;
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_push(remote, &specs, &opts));
+	git_remote_free(remote);
+
+	assert_server_ref("refs/heads/master", &id);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, _server, "refs/heads/pushed"));
+
+	cl_assert_equal_s(
+		"refs/heads/master:non-fast-forward\n"
+		"refs/heads/pushed:atomic push failure\n", _statuses.ptr);
+}
+
+void test_transport_receive_pack__atomic_push_rolls_back_a_failed_update(void)
+{
+	git_config *cfg;
+	git_push_options opts = GIT_PUSH_OPTIONS_INIT;
+	char *refspecs[] = {
+		"+refs/remotes/origin/br2:refs/heads/master",
+		"refs/heads/master:refs/heads/zzz",
+	};
+	git_strarray specs = { refspecs, 2 };
+	git_buf path = GIT_BUF_INIT;
+	git_remote *remote;
+	git_reference *ref;
+	git_oid id;
+
+	/* the new branch's reflog can't be written, so its update fails after master's */
+	cl_git_pass(git_repository_config(&cfg, _server));
+	cl_git_pass(git_config_set_bool(cfg, "core.logallrefupdates", true));
+	git_config_free(cfg);
+
+	cl_git_pass(git_buf_joinpath(&path,
+		git_repository_path(_server), "logs/refs/heads/zzz/blocked"));
+	cl_git_pass(git_futils_mkpath2file(path.ptr, 0777));
+	cl_git_mkfile(path.ptr, "");
+	git_buf_free(&path);
+
+	cl_git_pass(git_reference_name_to_id(&id, _server, "refs/heads/master"));
+
+	opts.atomic = 1;
+	opts.callbacks.push_update_reference = record_status;
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_push(remote, &specs, &opts));
+	git_remote_free(remote);
+
+	assert_server_ref("refs/heads/master", &id);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, _server, "refs/heads/zzz"));
+
+	cl_assert_equal_s(
+		"refs/heads/master:atomic push failure\n"
+		"refs/heads/zzz:failed to update ref\n", _statuses.ptr);
+}
+
+void test_transport_receive_pack__push_options_need_server_support(void)
+{
+	git_push_options opts = GIT_PUSH_OPTIONS_INIT;
+	char *refspec = "refs/heads/master:refs/heads/pushed";
+	git_strarray specs = { &refspec, 1 };
+	char *option = "ci.skip";
+	git_remote *remote;
+
+	opts.remote_push_options.strings = &option;
+	opts.remote_push_options.count = 1;
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_fail(git_remote_push(remote, &specs, &opts));
+	git_remote_free(remote);
+}
+
+static int count_status(const char *refname, const char *status, void *payload)
+{
+	GIT_UNUSED(refname);
+
+	cl_assert_equal_p(NULL, status);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+void test_transport_receive_pack__reports_many_refs(void)
+{
+	git_push_options opts = GIT_PUSH_OPTIONS_INIT;
+	git_strarray specs;
+	git_remote *remote;
+	git_buf name = GIT_BUF_INIT;
+	git_oid expected;
+	size_t i, count = 0;
+
+	/* enough for the report to be split across side-band packets */
+	specs.count = 1500;
+	specs.strings = git__calloc(specs.count, sizeof(char *));
+	cl_assert(specs.strings);
+
+	for (i = 0; i < specs.count; i++) {
+		git_buf_printf(&name,
+			"refs/heads/master:refs/heads/many/%04"PRIuZ"-a-name-long-enough-to-fill-up-the-report", i);
+		specs.strings[i] = git_buf_detach(&name);
+	}
+
+	opts.callbacks.push_update_reference = count_status;
+	opts.callbacks.payload = &count;
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_push(remote, &specs, &opts));
+	git_remote_free(remote);
+
+	cl_assert_equal_i(specs.count, count);
+
+	cl_git_pass(git_reference_name_to_id(&expected, _client, "refs/heads/master"));
+	assert_server_ref(
+		"refs/heads/many/1499-a-name-long-enough-to-fill-up-the-report", &expected);
+
+	git_strarray_free(&specs);
+}
+
+static int decline_pushed(const git_receive_command *command, void *payload)
+{
+	GIT_UNUSED(payload);
+	return !strcmp(command->refname, "refs/heads/pushed");
+}
+
+static int count_pre_receive(const git_receive_command **commands, size_t len, void *payload)
+{
+	GIT_UNUSED(commands);
+	GIT_UNUSED(payload);
+
+	cl_assert_equal_i(2, len);
+	_pre_receive_calls++;
+	return 0;
+}
+
+static int count_post_receive(const git_receive_command **commands, size_t len, void *payload)
+{
+	GIT_UNUSED(payload);
+
+	cl_assert_equal_s("refs/heads/master", commands[0]->refname);
+	_post_receive_len = len;
+	return 0;
+}
+
+void test_transport_receive_pack__runs_the_hooks(void)
+{
+	git_push_options opts = GIT_PUSH_OPTIONS_INIT;
+	char *refspecs[] = {
+		"refs/heads/master:refs/heads/master",
+		"refs/heads/master:refs/heads/pushed",
+	};
+	git_strarray specs = { refspecs, 2 };
+	git_remote *remote;
+	git_reference *ref;
+	git_oid id;
+
+	_opts.pre_receive = count_pre_receive;
+	_opts.update = decline_pushed;
+	_opts.post_receive = count_post_receive;
+
+	add_client_commit(&id, "refs/heads/master");
+
+	opts.callbacks.push_update_reference = record_status;
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_push(remote, &specs, &opts));
+	git_remote_free(remote);
+
+	assert_server_ref("refs/heads/master", &id);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, _server, "refs/heads/pushed"));
+
+	cl_assert_equal_i(1, _pre_receive_calls);
+	cl_assert_equal_i(1, _post_receive_len);
+	cl_assert(strstr(_statuses.ptr, "refs/heads/pushed:hook declined\n") != NULL);
+}
+
+/* A pack without any objects in it */
+static void empty_pack(git_buf *out)
+{
+	static const char header[] = { 'P', 'A', 'C', 'K', 0, 0, 0, 2, 0, 0, 0, 0 };
+	git_oid trailer;
+
+	cl_git_pass(git_hash_buf(&trailer, header, sizeof(header)));
+
+	git_buf_put(out, header, sizeof(header));
+	git_buf_put(out, (const char *)trailer.id, GIT_OID_RAWSZ);
+}
+
+static void send_command(
+	git_buf *request, const char *old_spec, const char *new_spec,
+	const char *refname, const char *caps)
+{
+	git_object *obj;
+	char old_hex[GIT_OID_HEXSZ + 1], new_hex[GIT_OID_HEXSZ + 1];
+	git_buf line = GIT_BUF_INIT;
+
+	cl_git_pass(git_revparse_single(&obj, _server, old_spec));
+	git_oid_tostr(old_hex, sizeof(old_hex), git_object_id(obj));
+	git_object_free(obj);
+
+	if (strlen(new_spec) == GIT_OID_HEXSZ) {
+		strcpy(new_hex, new_spec);
+	} else {
+		cl_git_pass(git_revparse_single(&obj, _server, new_spec));
+		git_oid_tostr(new_hex, sizeof(new_hex), git_object_id(obj));
+		git_object_free(obj);
+	}
+
+	git_buf_printf(&line, "%s %s %s", old_hex, new_hex, refname);
+	if (caps)
+		git_buf_printf(&line, "%c%s", '\0', caps);
+
+	git_buf_printf(request, "%04x", (unsigned int)line.size + 5);
+	git_buf_put(request, line.ptr, line.size);
+	git_buf_putc(request, '\n');
+
+	git_buf_free(&line);
+}
+
+void test_transport_receive_pack__rejects_stale_old_values(void)
+{
+	git_buf request = GIT_BUF_INIT, response = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_reference_name_to_id(&id, _server, "refs/heads/master"));
+
+	send_command(&request, "br2", "br2", "refs/heads/master", "report-status");
+	git_buf_puts(&request, "0000");
+	empty_pack(&request);
+
+	cl_git_pass(serve_receive_pack(&response, _server, NULL, request.ptr, request.size, 1, 0));
+
+	cl_assert(find_in_response(&response, "unpack ok\n") != NULL);
+	cl_assert(find_in_response(&response, "ng refs/heads/master stale info\n") != NULL);
+	assert_server_ref("refs/heads/master", &id);
+
+	git_buf_free(&request);
+	git_buf_free(&response);
+}
+
+void test_transport_receive_pack__rejects_missing_objects(void)
+{
+	git_buf request = GIT_BUF_INIT, response = GIT_BUF_INIT;
+
+	send_command(&request, "br2", "0123456789012345678901234567890123456789",
+		"refs/heads/br2", "report-status");
+	git_buf_puts(&request, "0000");
+	empty_pack(&request);
+
+	cl_git_pass(serve_receive_pack(&response, _server, NULL, request.ptr, request.size, 1, 0));
+
+	cl_assert(find_in_response(&response, "ng refs/heads/br2 missing necessary objects\n") != NULL);
+
+	git_buf_free(&request);
+	git_buf_free(&response);
+}
+
+void test_transport_receive_pack__atomic_pushes_fail_together(void)
+{
+	git_buf request = GIT_BUF_INIT, response = GIT_BUF_INIT;
+	git_oid master, br2;
+
+	cl_git_pass(git_reference_name_to_id(&master, _server, "refs/heads/master"));
+	cl_git_pass(git_reference_name_to_id(&br2, _server, "refs/heads/br2"));
+
+	send_command(&request, "br2", "master", "refs/heads/br2", "report-status atomic");
+	send_command(&request, "br2", "br2", "refs/heads/master", NULL);
+	git_buf_puts(&request, "0000");
+	empty_pack(&request);
+
+	cl_git_pass(serve_receive_pack(&response, _server, NULL, request.ptr, request.size, 1, 0));
+
+	cl_assert(find_in_response(&response, "ng refs/heads/br2 atomic push failure\n") != NULL);
+	cl_assert(find_in_response(&response, "ng refs/heads/master stale info\n") != NULL);
+	assert_server_ref("refs/heads/master", &master);
+	assert_server_ref("refs/heads/br2", &br2);
+
+	git_buf_free(&request);
+	git_buf_free(&response);
+}
@@ -0,0 +1,262 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "git2/sys/transport.h"
+#include "transports/smart.h"
+#include "server_helpers.h"
+
+static git_repository *_served_repo;
+static const git_receive_pack_options *_served_receive_opts;
+static size_t _served_cut;
+
+typedef struct {
+	const char *request;
+	size_t remaining;
+	git_buf *response;
+} exchange;
+
+static int exchange_read(char *buffer, size_t len, size_t *bytes_read, void *payload)
+{
+	exchange *ex = payload;
+
+	*bytes_read = min(len, ex->remaining);
+	memcpy(buffer, ex->request, *bytes_read);
+
+	ex->request += *bytes_read;
+	ex->remaining -= *bytes_read;
+	return 0;
+}
+
+static int exchange_write(const char *buffer, size_t len, void *payload)
+{
+	exchange *ex = payload;
+	return git_buf_put(ex->response, buffer, len);
+}
+
+int serve_upload_pack(
+	git_buf *response, git_repository *repo,
+	const char *request, size_t len, int stateless, int advertise, int version)
+{
+	git_upload_pack_options opts = GIT_UPLOAD_PACK_OPTIONS_INIT;
+	exchange ex;
+
+	ex.request = request;
+	ex.remaining = len;
+	ex.response = response;
+
+	opts.read = exchange_read;
+	opts.write = exchange_write;
+	opts.payload = &ex;
+	opts.stateless_rpc = stateless;
+	opts.advertise_refs = advertise;
+	opts.protocol_version = version;
+
+	return git_upload_pack(repo, &opts);
+}
+
+int serve_receive_pack(
+	git_buf *response, git_repository *repo,
+	const git_receive_pack_options *receive_opts,
+	const char *request, size_t len, int stateless, int advertise)
+{
+	git_receive_pack_options opts = GIT_RECEIVE_PACK_OPTIONS_INIT;
+	exchange ex;
+
+	if (receive_opts)
+		memcpy(&opts, receive_opts, sizeof(opts));
+
+	ex.request = request;
+	ex.remaining = len;
+	ex.response = response;
+
+	opts.read = exchange_read;
+	opts.write = exchange_write;
+	opts.payload = &ex;
+	opts.stateless_rpc = stateless;
+	opts.advertise_refs = advertise;
+
+	return git_receive_pack(repo, &opts);
+}
+
+const char *find_in_response(const git_buf *response, const char *needle)
+{
+	size_t i, len = strlen(needle);
+
+	for (i = 0; i + len <= response->size; i++) {
+		if (!memcmp(response->ptr + i, needle, len))
+			return response->ptr + i;
+	}
+
+	return NULL;
+}
+
+typedef struct {
+	git_smart_subtransport parent;
+	transport_smart *owner;
+} served_subtransport_t;
+
+typedef struct {
+	git_smart_subtransport_stream parent;
+	git_smart_service_t action;
+	int version;
+	git_buf request;
+	git_buf response;
+	size_t response_pos;
+	int served;
+} served_stream;
+
+static int serve_request(served_stream *stream)
+{
+	const char *request = stream->request.ptr;
+	size_t len = stream->request.size;
+
+	switch (stream->action) {
+	case GIT_SERVICE_UPLOADPACK_LS:
+		/* like git-http-backend, there's no header for version 2 */
+		if (stream->version != GIT_PROTOCOL_VERSION_2)
+			git_buf_puts(&stream->response, "001e# service=git-upload-pack\n0000");
+		return serve_upload_pack(&stream->response, _served_repo,
+			request, len, 1, 1, stream->version);
+	case GIT_SERVICE_UPLOADPACK:
+		return serve_upload_pack(&stream->response, _served_repo,
+			request, len, 1, 0, stream->version);
+	case GIT_SERVICE_RECEIVEPACK_LS:
+		git_buf_puts(&stream->response, "001f# service=git-receive-pack\n0000");
+		return serve_receive_pack(&stream->response, _served_repo,
+			_served_receive_opts, request, len, 1, 1);
+	case GIT_SERVICE_RECEIVEPACK:
+		return serve_receive_pack(&stream->response, _served_repo,
+			_served_receive_opts, request, len, 1, 0);
+	}
+
+	return -1;
+}
+
+static int served_stream_read(
+	git_smart_subtransport_stream *s, char *buffer, size_t buf_size, size_t *bytes_read)
+{
+	served_stream *stream = (served_stream *)s;
+
+	if (!stream->served) {
+		if (serve_request(stream) < 0)
+			return -1;
+
+		stream->served = 1;
+	}
+
+	if (_served_cut && stream->response_pos == _served_cut) {
+		giterr_set(GITERR_NET, "the connection was dropped");
+		return -1;
+	}
+
+	*bytes_read = min(buf_size, stream->response.size - stream->response_pos);
+
+	if (_served_cut)
+		*bytes_read = min(*bytes_read, _served_cut - stream->response_pos);
+
+	memcpy(buffer, stream->response.ptr + stream->response_pos, *bytes_read);
+	stream->response_pos += *bytes_read;
+	return 0;
+}
+
+static int served_stream_write(git_smart_subtransport_stream *s, const char *buffer, size_t len)
+{
+	served_stream *stream = (served_stream *)s;
+	return git_buf_put(&stream->request, buffer, len);
+}
+
+static void served_stream_free(git_smart_subtransport_stream *s)
+{
+	served_stream *stream = (served_stream *)s;
+
+	git_buf_free(&stream->request);
+	git_buf_free(&stream->response);
+	git__free(stream);
+}
+
+static int served_action(
+	git_smart_subtransport_stream **out,
+	git_smart_subtransport *transport,
+	const char *url,
+	git_smart_service_t action)
+{
+	served_stream *stream;
+
+	GIT_UNUSED(url);
+
+	stream = git__calloc(1, sizeof(served_stream));
+	GITERR_CHECK_ALLOC(stream);
+
+	stream->parent.subtransport = transport;
+	stream->parent.read = served_stream_read;
+	stream->parent.write = served_stream_write;
+	stream->parent.free = served_stream_free;
+	stream->action = action;
+
+	/* what smart HTTP would send in the Git-Protocol header */
+	stream->version = ((served_subtransport_t *)transport)->owner->version;
+
+	*out = &stream->parent;
+	return 0;
+}
+
+static int served_close(git_smart_subtransport *transport)
+{
+	GIT_UNUSED(transport);
+	return 0;
+}
+
+static void served_free(git_smart_subtransport *transport)
+{
+	git__free(transport);
+}
+
+static int served_subtransport(git_smart_subtransport **out, git_transport *owner, void *param)
+{
+	served_subtransport_t *transport;
+
+	GIT_UNUSED(param);
+
+	transport = git__calloc(1, sizeof(served_subtransport_t));
+	GITERR_CHECK_ALLOC(transport);
+
+	transport->owner = (transport_smart *)owner;
+	transport->parent.action = served_action;
+	transport->parent.close = served_close;
+	transport->parent.free = served_free;
+
+	*out = &transport->parent;
+	return 0;
+}
+
+static git_smart_subtransport_definition _served_definition = {
+	served_subtransport, 1, NULL
+};
+
+static int served_transport(git_transport **out, git_remote *owner, void *param)
+{
+	GIT_UNUSED(param);
+	return git_transport_smart(out, owner, &_served_definition);
+}
+
+void register_served_transport(
+	git_repository *repo, const git_receive_pack_options *receive_opts)
+{
+	_served_repo = repo;
+	_served_receive_opts = receive_opts;
+
+	cl_git_pass(git_transport_register("served", served_transport, NULL));
+}
+
+void unregister_served_transport(void)
+{
+	cl_git_pass(git_transport_unregister("served"));
+
+	_served_repo = NULL;
+	_served_receive_opts = NULL;
+	_served_cut = 0;
+}
+
+void cut_served_responses(size_t len)
+{
+	_served_cut = len;
+}
@@ -0,0 +1,31 @@
+#include "git2/sys/server.h"
+
+/*
+ * Serve "served://" URLs from `repo` in-process through git_upload_pack
+ * and git_receive_pack, one request at a time like smart HTTP. Fetches
+ * use the protocol version the client asks for. The hooks of
+ * `receive_opts`, if given, are used for pushes.
+ */
+extern void register_served_transport(
+	git_repository *repo, const git_receive_pack_options *receive_opts);
+
+extern void unregister_served_transport(void);
+
+/* Fail reading a served response past `len` bytes, like a dropped connection */
+extern void cut_served_responses(size_t len);
+
+/*
+ * Feed `request` to upload-pack or receive-pack and collect the response;
+ * upload-pack speaks the given protocol `version`.
+ */
+extern int serve_upload_pack(
+	git_buf *response, git_repository *repo,
+	const char *request, size_t len, int stateless, int advertise, int version);
+
+extern int serve_receive_pack(
+	git_buf *response, git_repository *repo,
+	const git_receive_pack_options *receive_opts,
+	const char *request, size_t len, int stateless, int advertise);
+
+/* Find `needle` in the response, which has NULs in it */
+extern const char *find_in_response(const git_buf *response, const char *needle);
@@ -0,0 +1,394 @@
+#include "clar_libgit2.h"
+#include "buffer.h"
+#include "refs.h"
+#include "server_helpers.h"
+
+static git_repository *_server;
+static git_repository *_client;
+
+static int serve(git_buf *response, const char *request, size_t len, int stateless, int advertise)
+{
+	return serve_upload_pack(response, _server, request, len, stateless, advertise, 0);
+}
+
+void test_transport_upload_pack__initialize(void)
+{
+	_server = cl_git_sandbox_init("testrepo.git");
+	_client = NULL;
+
+	register_served_transport(_server, NULL);
+}
+
+void test_transport_upload_pack__cleanup(void)
+{
+	unregister_served_transport();
+
+	git_repository_free(_client);
+	_client = NULL;
+
+	cl_fixture_cleanup("./client");
+	cl_git_sandbox_cleanup();
+}
+
+void test_transport_upload_pack__advertises_head_first(void)
+{
+	git_buf response = GIT_BUF_INIT;
+	git_oid head;
+	char hex[GIT_OID_HEXSZ + 1];
+
+	cl_git_pass(git_reference_name_to_id(&head, _server, "HEAD"));
+	git_oid_tostr(hex, sizeof(hex), &head);
+
+	cl_git_pass(serve(&response, "", 0, 1, 1));
+
+	cl_assert(!git__prefixcmp(response.ptr + 4, hex));
+	cl_assert(!git__prefixcmp(response.ptr + 4 + GIT_OID_HEXSZ, " HEAD"));
+	cl_assert(find_in_response(&response, "multi_ack_detailed") != NULL);
+	cl_assert(find_in_response(&response, "refs/tags/e90810b^{}\n") != NULL);
+	cl_assert(!memcmp(response.ptr + response.size - 4, "0000", 4));
+
+	git_buf_free(&response);
+}
+
+void test_transport_upload_pack__sends_a_pack_for_the_wants(void)
+{
+	git_buf request = GIT_BUF_INIT, response = GIT_BUF_INIT;
+	git_oid head;
+	char hex[GIT_OID_HEXSZ + 1];
+	const char *pack;
+
+	cl_git_pass(git_reference_name_to_id(&head, _server, "HEAD"));
+	git_oid_tostr(hex, sizeof(hex), &head);
+
+	git_buf_printf(&request, "0032want %s\n00000009done\n", hex);
+	cl_git_pass(serve(&response, request.ptr, request.size, 0, 0));
+
+	/* without side-band, the pack follows the NAK as it is */
+	cl_assert((pack = find_in_response(&response, "0000" "0008NAK\n")) != NULL);
+	cl_assert(!git__prefixcmp(pack + strlen("0000" "0008NAK\n"), "PACK"));
+
+	git_buf_free(&request);
+	git_buf_free(&response);
+}
+
+void test_transport_upload_pack__refuses_unadvertised_wants(void)
+{
+	git_buf request = GIT_BUF_INIT, response = GIT_BUF_INIT;
+
+	git_buf_puts(&request,
+		"0032want 0123456789012345678901234567890123456789\n00000009done\n");
+	cl_git_fail(serve(&response, request.ptr, request.size, 0, 0));
+
+	cl_assert(find_in_response(&response, "ERR upload-pack: not our ref") != NULL);
+
+	git_buf_free(&request);
+	git_buf_free(&response);
+}
+
+void test_transport_upload_pack__is_ready_once_every_want_reaches_a_common_commit(void)
+{
+	git_buf request = GIT_BUF_INIT, response = GIT_BUF_INIT;
+
+	/* br2 is common but not in master's history, c47800c is */
+	git_buf_puts(&request,
+		"0045want a65fedf39aefe402d3bb6e24df4d4f5fe4547750 multi_ack_detailed\n0000"
+		"0032have a4a7dce85cf63874e984719f4fdd239f5145052f\n"
+		"0032have 0123456789012345678901234567890123456789\n"
+		"0032have c47800c7266a2be04c571c04d5a6614691ea99bd\n"
+		"0032have 1111111111111111111111111111111111111111\n"
+		"00000009done\n");
+	cl_git_pass(serve(&response, request.ptr, request.size, 0, 0));
+
+	cl_assert(find_in_response(&response,
+		"ACK a4a7dce85cf63874e984719f4fdd239f5145052f common\n") != NULL);
+	cl_assert(find_in_response(&response,
+		"ACK 0123456789012345678901234567890123456789 ready\n") == NULL);
+	cl_assert(find_in_response(&response,
+		"ACK c47800c7266a2be04c571c04d5a6614691ea99bd common\n") != NULL);
+	cl_assert(find_in_response(&response,
+		"ACK 1111111111111111111111111111111111111111 ready\n") != NULL);
+
+	git_buf_free(&request);
+	git_buf_free(&response);
+}
+
+static void add_server_commit(git_oid *out)
+{
+	git_commit *head;
+	git_tree *tree;
+	git_signature *sig;
+
+	cl_git_pass(git_revparse_single((git_object **)&head, _server, "refs/heads/master"));
+	cl_git_pass(git_commit_tree(&tree, head));
+	cl_git_pass(git_signature_now(&sig, "me", "me@example.com"));
+
+	cl_git_pass(git_commit_create_v(out, _server, "refs/heads/master",
+		sig, sig, NULL, "served\n", tree, 1, head));
+
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_commit_free(head);
+}
+
+void test_transport_upload_pack__clone_and_fetch_over_stateless_rpc(void)
+{
+	git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+	git_remote *remote;
+	git_oid server_head, client_head;
+
+	cl_git_pass(git_clone(&_client, "served://testrepo.git", "./client", &opts));
+
+	cl_git_pass(git_reference_name_to_id(&server_head, _server, "refs/heads/master"));
+	cl_git_pass(git_reference_name_to_id(&client_head, _client, "refs/remotes/origin/master"));
+	cl_assert_equal_oid(&server_head, &client_head);
+
+	/* the client now has haves to offer */
+	add_server_commit(&server_head);
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_fetch(remote, NULL, NULL, NULL));
+	git_remote_free(remote);
+
+	cl_git_pass(git_reference_name_to_id(&client_head, _client, "refs/remotes/origin/master"));
+	cl_assert_equal_oid(&server_head, &client_head);
+}
+
+void test_transport_upload_pack__advertises_v2_capabilities(void)
+{
+	git_buf response = GIT_BUF_INIT;
+
+	cl_git_pass(serve_upload_pack(&response, _server, "", 0, 1, 1, 2));
+
+	cl_assert_equal_s(
+		"000eversion 2\n" "000cls-refs\n" "000afetch\n"
+		"0017object-format=sha1\n" "0000", response.ptr);
+
+	git_buf_free(&response);
+}
+
+void test_transport_upload_pack__lists_refs_by_prefix_in_v2(void)
+{
+	git_buf response = GIT_BUF_INIT;
+	const char *request =
+		"0014command=ls-refs\n" "0001" "0009peel\n"
+		"001eref-prefix refs/tags/e908\n" "0000";
+
+	cl_git_pass(serve_upload_pack(&response, _server, request, strlen(request), 1, 0, 2));
+
+	cl_assert_equal_s(
+		"006f7b4384978d2493e851f9cca7858815fac9b10980 refs/tags/e90810b"
+		" peeled:e90810b8df3e80c413d903f631643c716887138d\n" "0000",
+		response.ptr);
+
+	git_buf_free(&response);
+}
+
+static void set_protocol_version(git_repository *repo, const char *version)
+{
+	git_config *cfg;
+
+	cl_git_pass(git_repository_config(&cfg, repo));
+	cl_git_pass(git_config_set_string(cfg, "protocol.version", version));
+	git_config_free(cfg);
+}
+
+/* Fetch master into a new repository; returns how many other refs were listed */
+static size_t fetch_master(const char *protocol_version)
+{
+	git_remote *remote;
+	const git_remote_head **refs;
+	char *spec = "refs/heads/master:refs/remotes/origin/master";
+	git_strarray specs = { &spec, 1 };
+	size_t count, i, unwanted = 0;
+
+	cl_git_pass(git_repository_init(&_client, "./client", true));
+	set_protocol_version(_client, protocol_version);
+
+	cl_git_pass(git_remote_create(&remote, _client, "origin", "served://testrepo.git"));
+	cl_git_pass(git_remote_fetch(remote, &specs, NULL, NULL));
+	cl_git_pass(git_remote_ls(&refs, &count, remote));
+
+	for (i = 0; i < count; i++) {
+		if (strcmp(refs[i]->name, GIT_HEAD_FILE) != 0 &&
+			git__prefixcmp(refs[i]->name, "refs/heads/master") != 0 &&
+			git__prefixcmp(refs[i]->name, GIT_REFS_TAGS_DIR) != 0)
+			unwanted++;
+	}
+
+	git_remote_free(remote);
+	return unwanted;
+}
+
+void test_transport_upload_pack__protocol_v2_lists_only_the_wanted_refs(void)
+{
+	git_oid server_head, client_head;
+
+	cl_assert_equal_sz(0, fetch_master("2"));
+
+	cl_git_pass(git_reference_name_to_id(&server_head, _server, "refs/heads/master"));
+	cl_git_pass(git_reference_name_to_id(&client_head, _client, "refs/remotes/origin/master"));
+	cl_assert_equal_oid(&server_head, &client_head);
+}
+
+void test_transport_upload_pack__protocol_v0_lists_all_refs(void)
+{
+	cl_assert(fetch_master("0") > 0);
+}
+
+static void add_client_commits(size_t count)
+{
+	git_commit *head;
+	git_tree *tree;
+	git_signature *sig;
+	git_oid id;
+	size_t i;
+
+	cl_git_pass(git_signature_now(&sig, "me", "me@example.com"));
+
+	for (i = 0; i < count; i++) {
+		cl_git_pass(git_revparse_single((git_object **)&head, _client, "refs/heads/master"));
+		cl_git_pass(git_commit_tree(&tree, head));
+
+		cl_git_pass(git_commit_create_v(&id, _client, "refs/heads/master",
+			sig, sig, NULL, "local\n", tree, 1, head));
+
+		git_tree_free(tree);
+		git_commit_free(head);
+	}
+
+	git_signature_free(sig);
+}
+
+void test_transport_upload_pack__clone_and_fetch_over_protocol_v2(void)
+{
+	git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+	git_remote *remote;
+	const git_remote_head **refs;
+	git_oid server_head, client_head;
+	size_t count;
+
+	cl_git_pass(git_clone(&_client, "served://testrepo.git", "./client", &opts));
+	set_protocol_version(_client, "2");
+
+	/*
+	 * Too much history for the haves to run out in one round, so the
+	 * server acknowledges the common commits before it sends the pack.
+	 */
+	add_client_commits(30);
+	add_server_commit(&server_head);
+
+	cl_git_pass(git_remote_lookup(&remote, _client, "origin"));
+	cl_git_pass(git_remote_fetch(remote, NULL, NULL, NULL));
+	cl_git_pass(git_remote_ls(&refs, &count, remote));
+	cl_assert(count > 0);
+	git_remote_free(remote);
+
+	cl_git_pass(git_reference_name_to_id(&client_head, _client, "refs/remotes/origin/master"));
+	cl_assert_equal_oid(&server_head, &client_head);
+}
+
+#define BIG_BLOB_SIZE (4 * 1024 * 1024)
+
+/* Commit a blob which doesn't compress, for a pack of several ring slots */
+static void add_server_big_commit(git_oid *blob_id)
+{
+	git_commit *head;
+	git_tree *tree;
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_oid tree_id, commit_id;
+	unsigned int seed = 42;
+	char *data;
+	size_t i;
+
+	data = git__malloc(BIG_BLOB_SIZE);
+	cl_assert(data);
+
+	for (i = 0; i < BIG_BLOB_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (char)(seed >> 16);
+	}
+
+	cl_git_pass(git_blob_create_frombuffer(blob_id, _server, data, BIG_BLOB_SIZE));
+	git__free(data);
+
+	cl_git_pass(git_revparse_single((git_object **)&head, _server, "refs/heads/master"));
+	cl_git_pass(git_commit_tree(&tree, head));
+	cl_git_pass(git_treebuilder_new(&builder, _server, tree));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "big.bin", blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	git_treebuilder_free(builder);
+	git_tree_free(tree);
+
+	cl_git_pass(git_tree_lookup(&tree, _server, &tree_id));
+	cl_git_pass(git_signature_now(&sig, "me", "me@example.com"));
+	cl_git_pass(git_commit_create_v(&commit_id, _server, "refs/heads/master",
+		sig, sig, NULL, "big\n", tree, 1, head));
+
+	git_signature_free(sig);
+	git_tree_free(tree);
+	git_commit_free(head);
+}
+
+static int count_progress_cb(const git_transfer_progress *stats, void *payload)
+{
+	size_t *calls = payload;
+	GIT_UNUSED(stats);
+	(*calls)++;
+	return 0;
+}
+
+void test_transport_upload_pack__receives_a_large_pack_over_the_side_band(void)
+{
+	git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+	git_blob *blob;
+	git_oid blob_id;
+	size_t calls = 0;
+
+	add_server_big_commit(&blob_id);
+
+	opts.bare = 1;
+	opts.fetch_opts.callbacks.transfer_progress = count_progress_cb;
+	opts.fetch_opts.callbacks.payload = &calls;
+
+	cl_git_pass(git_clone(&_client, "served://testrepo.git", "./client", &opts));
+	cl_assert(calls > 1);
+
+	cl_git_pass(git_blob_lookup(&blob, _client, &blob_id));
+	cl_assert_equal_i(BIG_BLOB_SIZE, (int)git_blob_rawsize(blob));
+	git_blob_free(blob);
+}
+
+static int cancel_progress_cb(const git_transfer_progress *stats, void *payload)
+{
+	GIT_UNUSED(payload);
+	return stats->received_bytes > BIG_BLOB_SIZE / 4 ? -1 : 0;
+}
+
+void test_transport_upload_pack__progress_callback_cancels_the_side_band(void)
+{
+	git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+	git_oid blob_id;
+
+	add_server_big_commit(&blob_id);
+
+	opts.bare = 1;
+	opts.fetch_opts.callbacks.transfer_progress = cancel_progress_cb;
+
+	cl_git_fail_with(GIT_EUSER,
+		git_clone(&_client, "served://testrepo.git", "./client", &opts));
+}
+
+void test_transport_upload_pack__connection_dropped_in_the_side_band(void)
+{
+	git_clone_options opts = GIT_CLONE_OPTIONS_INIT;
+	git_oid blob_id;
+
+	add_server_big_commit(&blob_id);
+	cut_served_responses(BIG_BLOB_SIZE / 2);
+
+	opts.bare = 1;
+
+	cl_git_fail(git_clone(&_client, "served://testrepo.git", "./client", &opts));
+	cl_assert_equal_s("the connection was dropped", giterr_last()->message);
+}